@@ -0,0 +1,140 @@
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "x64.h"
+
+/*
+ * A loop summing the elements of a 4096 element array above a threshold,
+ * compiled with and without if_convert. The elements are pseudo random, so
+ * the branch around the addition goes either way about half the time at
+ * threshold 0 and is hardly ever taken at 250. Both versions see the same
+ * data, their sums have to agree.
+ *
+ * Usage: branch_bench [iterations]
+ */
+
+using namespace wcc;
+using Clock = std::chrono::steady_clock;
+
+const char SOURCE[] = "i32 xs[4096];\n"
+                      "i32 init(i32 seed) {\n"
+                      "i32 i;\n"
+                      "i32 s;\n"
+                      "s = seed;\n"
+                      "for (i = 0; i < 4096; i = i + 1) {\n"
+                      "s = s * 1103515245 + 12345;\n"
+                      "xs[i] = s / 65536 % 256;\n"
+                      "}\n"
+                      "return 0;\n"
+                      "}\n"
+                      "i32 above(i32 t) {\n"
+                      "i32 i;\n"
+                      "i32 c;\n"
+                      "i32 v;\n"
+                      "c = 0;\n"
+                      "for (i = 0; i < 4096; i = i + 1) {\n"
+                      "v = xs[i];\n"
+                      "if (v > t) {\n"
+                      "c = c + v;\n"
+                      "}\n"
+                      "}\n"
+                      "return c;\n"
+                      "}\n";
+
+static ir::Module
+optimized(const AnalyzedFile&              file,
+          const std::vector<StructLayout>& layouts,
+          bool                             convert)
+{
+  ir::Module module = ir::lower_module(file, layouts);
+
+  for (ir::Function& fn : module.functions) {
+    ir::mem2reg(fn);
+    ir::propagate_constants(fn);
+
+    if (convert)
+      ir::if_convert(fn);
+
+    ir::hoist_invariants(fn);
+    ir::simplify_induction(fn);
+    ir::number_values(fn);
+    ir::eliminate_bounds_checks(fn);
+    ir::number_values(fn);
+  }
+
+  return module;
+}
+
+// Time per call of above(threshold), its result in `result`.
+static double
+time_ns(const ir::Module& module,
+        int32_t           threshold,
+        int               iterations,
+        int32_t&          result)
+{
+  const x64::MModule code = x64::compile_module(module);
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+
+  if (jit == nullptr)
+    return 0;
+
+  const auto above = jit->function<int32_t (*)(int32_t)>("above");
+  jit->function<int32_t (*)(int32_t)>("init")(7);
+
+  const auto start = Clock::now();
+
+  for (int i = 0; i < iterations; ++i)
+    result = above(threshold);
+
+  const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+int
+main(int argc, char** argv)
+{
+  const int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+
+  QueryDatabase db;
+  db.set<SourceTextQuery>("branch.c", SOURCE);
+
+  const auto& file    = db.get<TypecheckQuery>("branch.c");
+  const auto& layouts = db.get<LayoutQuery>("branch.c");
+
+  if (!file->ok)
+    return 1;
+
+  const ir::Module branchy = optimized(*file, layouts, false);
+  const ir::Module select  = optimized(*file, layouts, true);
+
+  fmt::print("{:<10} {:>12} {:>12}\n", "threshold", "branch", "select");
+
+  for (const int32_t threshold : { 0, 250 }) {
+    int32_t branch_result, select_result;
+
+    const double branch_ns =
+      time_ns(branchy, threshold, iterations, branch_result);
+    const double select_ns =
+      time_ns(select, threshold, iterations, select_result);
+
+    if (branch_ns == 0 || select_ns == 0)
+      return 1;
+
+    if (branch_result != select_result) {
+      fmt::print(stderr, "above({}): results differ\n", threshold);
+      return 1;
+    }
+
+    fmt::print(
+      "{:<10} {:>9.1f} ns {:>9.1f} ns\n", threshold, branch_ns, select_ns);
+  }
+
+  return 0;
+}
@@ -0,0 +1,172 @@
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "ir.h"
+#include "queries.h"
+
+/*
+ * Dynamic instruction counts with and without value numbering. Every
+ * function is lowered, run through mem2reg and constant propagation, and
+ * executed in the IR evaluator once as is and once after number_values, on
+ * the same arguments. The evaluator counts the instructions it executes, so
+ * the numbers are exact and do not depend on the machine.
+ *
+ * The programs are the test/ files and generated ones repeating subterms
+ * the way our generated code does. Fails if value numbering changes a
+ * result or makes any function execute more instructions, which makes it
+ * usable as a regression test.
+ *
+ * Usage: gvn_bench
+ */
+
+using namespace wcc;
+
+const char* const PROGRAMS[] = {
+  "call.c",
+  "file1.c",
+  "file2.c",
+};
+
+static std::string
+read_file(const std::string& path)
+{
+  std::ifstream in(path);
+  return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+// `repeat` statements recomputing a + b * c, in all orders of the operands,
+// and a short-circuit whose right hand side is dominated by the first one.
+static std::string
+repeated_subterms(int repeat)
+{
+  static const char* const SPELLINGS[] = {
+    "a + b * c",
+    "b * c + a",
+    "c * b + a",
+    "a + c * b",
+  };
+
+  std::string source = "i64 subterms(i64 a, i64 b, i64 c) {\n"
+                       "i64 s;\n"
+                       "i64 t;\n"
+                       "s = 0;\n";
+
+  for (int i = 0; i < repeat; ++i) {
+    source += "t = " + std::string(SPELLINGS[i % 4]) + ";\n";
+    source += "s = s + t;\n";
+  }
+
+  source += "t = a && b * c;\n"
+            "return s + t;\n"
+            "}\n";
+
+  return source;
+}
+
+static ir::Module
+lowered(const AnalyzedFile&              file,
+        const std::vector<StructLayout>& layouts)
+{
+  ir::Module module = ir::lower_module(file, layouts);
+
+  for (ir::Function& fn : module.functions) {
+    ir::mem2reg(fn);
+    ir::propagate_constants(fn);
+  }
+
+  return module;
+}
+
+int
+main()
+{
+  // Literal arguments narrowed to small parameter types warn.
+  spdlog::set_level(spdlog::level::err);
+
+  std::vector<std::pair<std::string, std::string>> programs;
+
+  for (const char* name : PROGRAMS)
+    programs.emplace_back(name,
+                          read_file(std::string(WCC_TEST_DIR) + "/" + name));
+
+  programs.emplace_back("subterms", repeated_subterms(32));
+
+  fmt::print("{:<22} {:>10} {:>10} {:>8}\n",
+             "function",
+             "before",
+             "after",
+             "saved");
+
+  uint64_t total_before = 0;
+  uint64_t total_after  = 0;
+
+  for (const auto& [name, source] : programs) {
+    QueryDatabase db;
+    db.set<SourceTextQuery>(name, source);
+
+    const auto& file = db.get<TypecheckQuery>(name);
+
+    if (!file->ok)
+      return 1;
+
+    const ir::Module before = lowered(*file, db.get<LayoutQuery>(name));
+    ir::Module       after  = before;
+
+    for (ir::Function& fn : after.functions)
+      ir::number_values(fn);
+
+    for (uint32_t f = 0; f < before.functions.size(); ++f) {
+      const ir::Function& fn = before.functions[f];
+
+      // Small odd arguments, every branch of a short-circuit sees non-zero.
+      std::vector<uint64_t> args;
+
+      for (size_t i = 0; i < fn.params.size(); ++i)
+        args.push_back(2 * i + 3);
+
+      ir::EvalStats counted_before, counted_after;
+
+      const auto expected = ir::evaluate(before, f, args, counted_before);
+      const auto result   = ir::evaluate(after, f, args, counted_after);
+
+      // Functions touching globals are not evaluated.
+      if (!expected.has_value() && !result.has_value())
+        continue;
+
+      if (expected != result) {
+        fmt::print(
+          stderr, "{}: {} computes a different result\n", name, fn.name);
+        return 1;
+      }
+
+      if (counted_after.steps > counted_before.steps) {
+        fmt::print(
+          stderr, "{}: {} executes more instructions\n", name, fn.name);
+        return 1;
+      }
+
+      total_before += counted_before.steps;
+      total_after += counted_after.steps;
+
+      fmt::print("{:<22} {:>10} {:>10} {:>7.1f}%\n",
+                 name + ":" + fn.name,
+                 counted_before.steps,
+                 counted_after.steps,
+                 100.0 * (counted_before.steps - counted_after.steps) /
+                   counted_before.steps);
+    }
+  }
+
+  fmt::print("{:<22} {:>10} {:>10} {:>7.1f}%\n",
+             "total",
+             total_before,
+             total_after,
+             100.0 * (total_before - total_after) / total_before);
+
+  return 0;
+}
@@ -0,0 +1,240 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "x64.h"
+
+/*
+ * Native loop kernels compiled three ways: by wcc without the loop passes,
+ * by wcc with them (hoist_invariants, simplify_induction, unroll_loops) and
+ * by the system C compiler at -O2. The kernels are plain C apart from the
+ * type names, a prelude of typedefs makes the same source text compile with
+ * both. The C compiler builds a shared object that is loaded into this
+ * process, so all three versions are timed by the same loop calling them
+ * through a function pointer. Results have to agree.
+ *
+ * The C compiler is $CC, gcc if unset. Without one only the wcc columns are
+ * printed.
+ *
+ * Usage: loop_bench [iterations] [trip count]
+ */
+
+using namespace wcc;
+using Clock = std::chrono::steady_clock;
+
+using Kernel = int64_t (*)(int64_t, int64_t);
+
+const char PRELUDE[] = "typedef int i32;\n"
+                       "typedef long long i64;\n";
+
+const char* const KERNELS[] = { "sum", "stride", "invariant", "nested" };
+
+const char SOURCE[] = "i64 sum(i64 n, i64 a) {\n"
+                      "i64 s;\n"
+                      "i64 i;\n"
+                      "s = 0;\n"
+                      "for (i = 0; i < n; i = i + 1) {\n"
+                      "s = s + i;\n"
+                      "}\n"
+                      "return s;\n"
+                      "}\n"
+                      "i64 stride(i64 n, i64 a) {\n"
+                      "i64 s;\n"
+                      "i64 i;\n"
+                      "i64 u;\n"
+                      "s = 0;\n"
+                      "for (i = 0; i < n; i = i + 1) {\n"
+                      "u = i * 7;\n"
+                      "s = s + u;\n"
+                      "}\n"
+                      "return s;\n"
+                      "}\n"
+                      "i64 invariant(i64 n, i64 a) {\n"
+                      "i64 s;\n"
+                      "i64 i;\n"
+                      "s = 0;\n"
+                      "for (i = 0; i < n; i = i + 1) {\n"
+                      "i64 t;\n"
+                      "i64 u;\n"
+                      "t = a * a;\n"
+                      "u = t / 3;\n"
+                      "s = s + u;\n"
+                      "s = s + i;\n"
+                      "}\n"
+                      "return s;\n"
+                      "}\n"
+                      "i64 nested(i64 n, i64 a) {\n"
+                      "i64 s;\n"
+                      "i64 i;\n"
+                      "i64 j;\n"
+                      "s = 0;\n"
+                      "for (i = 0; i < n; i = i + 1) {\n"
+                      "for (j = 0; j < 4; j = j + 1) {\n"
+                      "s = s + j;\n"
+                      "s = s + a;\n"
+                      "}\n"
+                      "}\n"
+                      "return s;\n"
+                      "}\n";
+
+static ir::Module
+optimized(const AnalyzedFile&              file,
+          const std::vector<StructLayout>& layouts,
+          bool                             loops)
+{
+  ir::Module module = ir::lower_module(file, layouts);
+
+  for (ir::Function& fn : module.functions) {
+    ir::mem2reg(fn);
+    ir::propagate_constants(fn);
+
+    if (loops) {
+      ir::hoist_invariants(fn);
+      ir::simplify_induction(fn);
+      ir::unroll_loops(fn);
+    }
+
+    ir::reassociate(fn);
+    ir::number_values(fn);
+  }
+
+  return module;
+}
+
+// Compiles the kernels with the C compiler into a shared object and loads
+// it. Null if there is no compiler or it fails.
+static void*
+load_native()
+{
+  const char* cc = getenv("CC");
+  char        dir[] = "/tmp/loop_benchXXXXXX";
+
+  if (mkdtemp(dir) == nullptr)
+    return nullptr;
+
+  const std::string source = std::string(dir) + "/kernels.c";
+  const std::string object = std::string(dir) + "/kernels.so";
+
+  std::ofstream(source) << PRELUDE << SOURCE;
+
+  const std::string command =
+    fmt::format("{} -O2 -shared -fPIC -o {} {} 2>/dev/null",
+                cc != nullptr ? cc : "gcc",
+                object,
+                source);
+
+  void* handle = nullptr;
+
+  if (std::system(command.c_str()) == 0)
+    handle = dlopen(object.c_str(), RTLD_NOW);
+
+  unlink(source.c_str());
+  unlink(object.c_str());
+  rmdir(dir);
+  return handle;
+}
+
+static double
+time_ns(int iterations, Kernel run, int64_t n, int64_t& result)
+{
+  int64_t    sum   = 0;
+  const auto start = Clock::now();
+
+  for (int i = 0; i < iterations; ++i)
+    sum += run(n + (i & 1), i & 15);
+
+  const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+
+  result = sum;
+  return elapsed.count() / iterations;
+}
+
+int
+main(int argc, char** argv)
+{
+  const int     iterations = argc > 1 ? atoi(argv[1]) : 100000;
+  const int64_t n          = argc > 2 ? atoll(argv[2]) : 1000;
+
+  QueryDatabase db;
+  db.set<SourceTextQuery>("kernels.c", SOURCE);
+
+  const auto& file    = db.get<TypecheckQuery>("kernels.c");
+  const auto& layouts = db.get<LayoutQuery>("kernels.c");
+
+  if (!file->ok)
+    return 1;
+
+  const x64::MModule plain =
+    x64::compile_module(optimized(*file, layouts, false));
+  const x64::MModule loops =
+    x64::compile_module(optimized(*file, layouts, true));
+
+  const auto plain_jit = jit::JitModule::load(plain, x64::encode_module(plain));
+  const auto loops_jit = jit::JitModule::load(loops, x64::encode_module(loops));
+
+  if (plain_jit == nullptr || loops_jit == nullptr)
+    return 1;
+
+  void* native = load_native();
+
+  if (native == nullptr)
+    spdlog::warn("No C compiler, comparing wcc only");
+
+  fmt::print("{:<10} {:>12} {:>12} {:>12} {:>8}\n",
+             "kernel",
+             "wcc",
+             "wcc loops",
+             "cc -O2",
+             "speedup");
+
+  for (const char* name : KERNELS) {
+    int64_t plain_result, loops_result, native_result;
+
+    const double plain_ns = time_ns(
+      iterations, plain_jit->function<Kernel>(name), n, plain_result);
+    const double loops_ns = time_ns(
+      iterations, loops_jit->function<Kernel>(name), n, loops_result);
+
+    if (plain_result != loops_result) {
+      fmt::print(stderr, "{}: results differ\n", name);
+      return 1;
+    }
+
+    std::string native_time = "-";
+
+    if (native != nullptr) {
+      const auto   run       = reinterpret_cast<Kernel>(dlsym(native, name));
+      const double native_ns = time_ns(iterations, run, n, native_result);
+
+      if (native_result != loops_result) {
+        fmt::print(stderr, "{}: results differ from cc\n", name);
+        return 1;
+      }
+
+      native_time = fmt::format("{:.2f} ns", native_ns);
+    }
+
+    fmt::print("{:<10} {:>9.2f} ns {:>9.2f} ns {:>12} {:>7.2f}x\n",
+               name,
+               plain_ns,
+               loops_ns,
+               native_time,
+               plain_ns / loops_ns);
+  }
+
+  if (native != nullptr)
+    dlclose(native);
+
+  return 0;
+}
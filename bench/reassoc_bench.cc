@@ -0,0 +1,152 @@
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "x64.h"
+
+/*
+ * Native reductions with and without reassociation. The generated functions
+ * compute LEAVES independent terms of their four parameters and combine them
+ * in one left-leaning chain of + or *, the shape a reduction written out by
+ * hand or by a code generator has. Each is lowered, optimized as the
+ * pipeline does, once without and once with reassociate(), compiled and
+ * loaded into this process. The calls are timed back to back with the
+ * result fed into all arguments of the next call, so the time measured is
+ * the latency of the chain rather than the throughput of the calls.
+ *
+ * Usage: reassoc_bench [iterations]
+ */
+
+using namespace wcc;
+using Clock = std::chrono::steady_clock;
+
+constexpr int LEAVES = 12;
+
+using Reduction = int64_t (*)(int64_t, int64_t, int64_t, int64_t);
+
+// i64 <name>(a, b, c, d) reducing LEAVES terms `p ^ k` with `op`.
+static std::string
+reduction(const std::string& name, const std::string& op)
+{
+  static const char* const PARAMS[] = { "a", "b", "c", "d" };
+
+  std::string source = "i64 " + name + "(i64 a, i64 b, i64 c, i64 d) {\n";
+  std::string chain;
+
+  for (int i = 0; i < LEAVES; ++i) {
+    const std::string term = "t" + std::to_string(i);
+
+    source += "i64 " + term + ";\n";
+    chain += (i == 0 ? "" : " " + op + " ") + term;
+  }
+
+  for (int i = 0; i < LEAVES; ++i) {
+    source += "t" + std::to_string(i) + " = " + PARAMS[i % 4] + " ^ " +
+              std::to_string(2 * i + 3) + ";\n";
+  }
+
+  return source + "return " + chain + ";\n}\n";
+}
+
+static ir::Module
+optimized(const AnalyzedFile&              file,
+          const std::vector<StructLayout>& layouts,
+          bool                             reassociate)
+{
+  ir::Module module = ir::lower_module(file, layouts);
+
+  for (ir::Function& fn : module.functions) {
+    ir::mem2reg(fn);
+    ir::propagate_constants(fn);
+
+    if (reassociate)
+      ir::reassociate(fn);
+
+    ir::number_values(fn);
+  }
+
+  return module;
+}
+
+static double
+time_ns(int iterations, Reduction run, int64_t& result)
+{
+  int64_t    a     = 1;
+  const auto start = Clock::now();
+
+  for (int i = 0; i < iterations; ++i)
+    a = run(a, a + 1, a + 2, a + 3);
+
+  const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+
+  result = a;
+  return elapsed.count() / iterations;
+}
+
+int
+main(int argc, char** argv)
+{
+  const int iterations = argc > 1 ? atoi(argv[1]) : 10000000;
+
+  const std::string source = reduction("sum", "+") + reduction("product", "*");
+
+  QueryDatabase db;
+  db.set<SourceTextQuery>("reduce.c", source);
+
+  const auto& file    = db.get<TypecheckQuery>("reduce.c");
+  const auto& layouts = db.get<LayoutQuery>("reduce.c");
+
+  if (!file->ok)
+    return 1;
+
+  const x64::MModule chained =
+    x64::compile_module(optimized(*file, layouts, false));
+  const x64::MModule balanced =
+    x64::compile_module(optimized(*file, layouts, true));
+
+  const auto chained_jit =
+    jit::JitModule::load(chained, x64::encode_module(chained));
+  const auto balanced_jit =
+    jit::JitModule::load(balanced, x64::encode_module(balanced));
+
+  if (chained_jit == nullptr || balanced_jit == nullptr)
+    return 1;
+
+  fmt::print("{:<10} {:>12} {:>12} {:>8}\n",
+             "function",
+             "chained",
+             "balanced",
+             "speedup");
+
+  for (const char* name : { "sum", "product" }) {
+    int64_t chained_result, balanced_result;
+
+    const double chained_ns =
+      time_ns(iterations,
+              chained_jit->function<Reduction>(name),
+              chained_result);
+    const double balanced_ns =
+      time_ns(iterations,
+              balanced_jit->function<Reduction>(name),
+              balanced_result);
+
+    if (chained_result != balanced_result) {
+      fmt::print(stderr, "{}: results differ\n", name);
+      return 1;
+    }
+
+    fmt::print("{:<10} {:>9.2f} ns {:>9.2f} ns {:>7.2f}x\n",
+               name,
+               chained_ns,
+               balanced_ns,
+               chained_ns / balanced_ns);
+  }
+
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "x64.h"
+
+/*
+ * Native 4-wide f32 code with and without SLP vectorization. The generated
+ * function runs ROUNDS rounds of the same multiply and add on each of its
+ * four parameters, written out statement by statement the way code
+ * unrolled by hand looks, and returns their sum. It is lowered, optimized as
+ * the pipeline does, once without and once with vectorize_slp(), compiled
+ * and loaded into this process. The calls are independent, so the time
+ * measured is the throughput of the calls: both versions have the same
+ * dependency chains, the vector one issues a quarter of the arithmetic.
+ *
+ * Usage: slp_bench [iterations]
+ */
+
+using namespace wcc;
+using Clock = std::chrono::steady_clock;
+
+constexpr int ROUNDS = 16;
+
+using Kernel = float (*)(float, float, float, float);
+
+// f32 <name>(a, b, c, d) iterating x * 0.5 + 1 ROUNDS times on each.
+static std::string
+kernel(const std::string& name)
+{
+  std::string source = "f32 " + name + "(f32 a, f32 b, f32 c, f32 d) {\n";
+
+  for (int i = 0; i < ROUNDS; ++i) {
+    for (const char* v : { "a", "b", "c", "d" })
+      source += std::string(v) + " = " + v + " * 0.5f + 1.0f;\n";
+  }
+
+  return source + "return a + b + c + d;\n}\n";
+}
+
+static ir::Module
+optimized(const AnalyzedFile&              file,
+          const std::vector<StructLayout>& layouts,
+          bool                             vectorize)
+{
+  ir::Module module = ir::lower_module(file, layouts);
+
+  for (ir::Function& fn : module.functions) {
+    ir::mem2reg(fn);
+    ir::propagate_constants(fn);
+    ir::reassociate(fn);
+    ir::number_values(fn);
+
+    if (vectorize && ir::vectorize_slp(fn) == 0)
+      spdlog::warn("Nothing vectorized in {}", fn.name);
+  }
+
+  return module;
+}
+
+static double
+time_ns(int iterations, Kernel run, float& result)
+{
+  float      sum   = 0;
+  const auto start = Clock::now();
+
+  for (int i = 0; i < iterations; ++i) {
+    const auto x = static_cast<float>(i & 1023);
+    sum += run(x, x + 1, x + 2, x + 3);
+  }
+
+  const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+
+  result = sum;
+  return elapsed.count() / iterations;
+}
+
+int
+main(int argc, char** argv)
+{
+  const int iterations = argc > 1 ? atoi(argv[1]) : 10000000;
+
+  QueryDatabase db;
+  db.set<SourceTextQuery>("lanes.c", kernel("lanes"));
+
+  const auto& file    = db.get<TypecheckQuery>("lanes.c");
+  const auto& layouts = db.get<LayoutQuery>("lanes.c");
+
+  if (!file->ok)
+    return 1;
+
+  const x64::MModule scalar =
+    x64::compile_module(optimized(*file, layouts, false));
+  const x64::MModule vector =
+    x64::compile_module(optimized(*file, layouts, true));
+
+  const auto scalar_jit =
+    jit::JitModule::load(scalar, x64::encode_module(scalar));
+  const auto vector_jit =
+    jit::JitModule::load(vector, x64::encode_module(vector));
+
+  if (scalar_jit == nullptr || vector_jit == nullptr)
+    return 1;
+
+  float scalar_result, vector_result;
+
+  const double scalar_ns = time_ns(
+    iterations, scalar_jit->function<Kernel>("lanes"), scalar_result);
+  const double vector_ns = time_ns(
+    iterations, vector_jit->function<Kernel>("lanes"), vector_result);
+
+  if (scalar_result != vector_result) {
+    fmt::print(stderr, "lanes: results differ\n");
+    return 1;
+  }
+
+  fmt::print("{:<10} {:>12} {:>12} {:>8}\n",
+             "function",
+             "scalar",
+             "slp",
+             "speedup");
+  fmt::print("{:<10} {:>9.2f} ns {:>9.2f} ns {:>7.2f}x\n",
+             "lanes",
+             scalar_ns,
+             vector_ns,
+             scalar_ns / vector_ns);
+
+  return 0;
+}
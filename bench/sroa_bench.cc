@@ -0,0 +1,159 @@
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "x64.h"
+
+/*
+ * Mean and variance of 1, 2, ..., count accumulated in a local structure,
+ * compiled with and without scalarize_aggregates, against the same loop
+ * written with one scalar per field. Without it every field update is a
+ * store to and a load from the stack, with it the fields live in registers
+ * like the scalars. All three have to compute the same result.
+ *
+ * Usage: sroa_bench [iterations]
+ */
+
+using namespace wcc;
+using Clock = std::chrono::steady_clock;
+
+const char SOURCE[] = "struct Acc {\n"
+                      "f64 sum;\n"
+                      "f64 sq;\n"
+                      "i32 n;\n"
+                      "};\n"
+                      "f64 with_struct(i32 count) {\n"
+                      "struct Acc a;\n"
+                      "i32 i;\n"
+                      "f64 x;\n"
+                      "for (i = 0; i < count; i = i + 1) {\n"
+                      "x = x + 1.0;\n"
+                      "a.sum = a.sum + x;\n"
+                      "a.sq = a.sq + x * x;\n"
+                      "a.n = a.n + 1;\n"
+                      "}\n"
+                      "return a.sq / a.n - a.sum * a.sum / a.n / a.n;\n"
+                      "}\n"
+                      "f64 with_scalars(i32 count) {\n"
+                      "f64 sum;\n"
+                      "f64 sq;\n"
+                      "i32 n;\n"
+                      "i32 i;\n"
+                      "f64 x;\n"
+                      "for (i = 0; i < count; i = i + 1) {\n"
+                      "x = x + 1.0;\n"
+                      "sum = sum + x;\n"
+                      "sq = sq + x * x;\n"
+                      "n = n + 1;\n"
+                      "}\n"
+                      "return sq / n - sum * sum / n / n;\n"
+                      "}\n";
+
+static ir::Module
+optimized(const AnalyzedFile&              file,
+          const std::vector<StructLayout>& layouts,
+          bool                             scalarize)
+{
+  ir::Module module = ir::lower_module(file, layouts);
+
+  for (ir::Function& fn : module.functions) {
+    ir::mem2reg(fn);
+    ir::propagate_constants(fn);
+
+    if (scalarize && ir::scalarize_aggregates(fn) > 0) {
+      ir::mem2reg(fn);
+      ir::propagate_constants(fn);
+    }
+
+    ir::if_convert(fn);
+    ir::hoist_invariants(fn);
+    ir::simplify_induction(fn);
+    ir::number_values(fn);
+  }
+
+  return module;
+}
+
+// Time per call of `name`, its result in `result`.
+static double
+time_ns(const ir::Module& module,
+        const char*       name,
+        int               iterations,
+        double&           result)
+{
+  const x64::MModule code = x64::compile_module(module);
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+
+  if (jit == nullptr)
+    return 0;
+
+  const auto fn = jit->function<double (*)(int32_t)>(name);
+
+  const auto start = Clock::now();
+
+  for (int i = 0; i < iterations; ++i)
+    result = fn(10000);
+
+  const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+int
+main(int argc, char** argv)
+{
+  const int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+
+  QueryDatabase db;
+  db.set<SourceTextQuery>("sroa.c", SOURCE);
+
+  const auto& file    = db.get<TypecheckQuery>("sroa.c");
+  const auto& layouts = db.get<LayoutQuery>("sroa.c");
+
+  if (!file->ok)
+    return 1;
+
+  const ir::Module in_memory  = optimized(*file, layouts, false);
+  const ir::Module scalarized = optimized(*file, layouts, true);
+
+  struct Run
+  {
+    const char*       label;
+    const ir::Module& module;
+    const char*       function;
+  };
+
+  const Run runs[] = {
+    { "struct", in_memory, "with_struct" },
+    { "struct+sroa", scalarized, "with_struct" },
+    { "scalars", scalarized, "with_scalars" },
+  };
+
+  fmt::print("{:<12} {:>12}\n", "version", "time");
+
+  double expected = 0;
+
+  for (const Run& run : runs) {
+    double       result = 0;
+    const double ns     = time_ns(run.module, run.function, iterations, result);
+
+    if (ns == 0)
+      return 1;
+
+    if (&run == runs)
+      expected = result;
+    else if (result != expected) {
+      fmt::print(stderr, "{}: results differ\n", run.label);
+      return 1;
+    }
+
+    fmt::print("{:<12} {:>9.1f} us\n", run.label, ns / 1000);
+  }
+
+  return 0;
+}
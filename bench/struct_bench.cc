@@ -0,0 +1,127 @@
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "x64.h"
+
+/*
+ * A pass over a 262144 element array of structures whose fields are
+ * declared with as much padding as possible, compiled with the declared
+ * layout and with fields reordered by decreasing alignment. Reordering
+ * halves the size of an element, the array goes from 8 to 4 MiB and the
+ * pass touches half the cache lines. Both layouts see the same data, their
+ * sums have to agree.
+ *
+ * Usage: struct_bench [iterations]
+ */
+
+using namespace wcc;
+using Clock = std::chrono::steady_clock;
+
+const char SOURCE[] = "struct Sample {\n"
+                      "u8 kind;\n"
+                      "f64 value;\n"
+                      "u16 sensor;\n"
+                      "i32 count;\n"
+                      "u8 valid;\n"
+                      "};\n"
+                      "struct Sample samples[262144];\n"
+                      "i32 init(i32 seed) {\n"
+                      "i32 i;\n"
+                      "i32 s;\n"
+                      "s = seed;\n"
+                      "for (i = 0; i < 262144; i = i + 1) {\n"
+                      "s = s * 1103515245 + 12345;\n"
+                      "samples[i].kind = s / 65536 % 4;\n"
+                      "samples[i].value = s / 65536 % 1000;\n"
+                      "samples[i].sensor = i;\n"
+                      "samples[i].count = s / 65536 % 16;\n"
+                      "samples[i].valid = s / 65536 % 8 != 0;\n"
+                      "}\n"
+                      "return 0;\n"
+                      "}\n"
+                      "i32 total() {\n"
+                      "i32 i;\n"
+                      "i32 c;\n"
+                      "c = 0;\n"
+                      "for (i = 0; i < 262144; i = i + 1) {\n"
+                      "if (samples[i].valid != 0) {\n"
+                      "c = c + samples[i].count;\n"
+                      "}\n"
+                      "}\n"
+                      "return c;\n"
+                      "}\n";
+
+// Time per call of total(), its result in `result`.
+static double
+time_ns(const ir::Module& module, int iterations, int32_t& result)
+{
+  const x64::MModule code = x64::compile_module(module);
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+
+  if (jit == nullptr)
+    return 0;
+
+  const auto total = jit->function<int32_t (*)()>("total");
+  jit->function<int32_t (*)(int32_t)>("init")(7);
+
+  const auto start = Clock::now();
+
+  for (int i = 0; i < iterations; ++i)
+    result = total();
+
+  const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+int
+main(int argc, char** argv)
+{
+  const int iterations = argc > 1 ? atoi(argv[1]) : 200;
+
+  // Integer fields are filled from i32 arithmetic, narrowing warns.
+  spdlog::set_level(spdlog::level::err);
+
+  fmt::print("{:<12} {:>8} {:>12}\n", "layout", "bytes", "total");
+
+  int32_t expected = 0;
+
+  for (const FieldOrder order :
+       { FieldOrder::declared, FieldOrder::by_alignment }) {
+    QueryDatabase db;
+    db.set<SourceTextQuery>("struct.c", SOURCE);
+    db.set<FieldOrderQuery>("struct.c", order);
+
+    const auto& file   = db.get<TypecheckQuery>("struct.c");
+    const auto& module = db.get<ModuleQuery>("struct.c");
+
+    if (!file->ok || module == nullptr)
+      return 1;
+
+    int32_t      result = 0;
+    const double ns = time_ns(*module, iterations, result);
+
+    if (ns == 0)
+      return 1;
+
+    if (order == FieldOrder::declared)
+      expected = result;
+    else if (result != expected) {
+      fmt::print(stderr, "total(): results differ\n");
+      return 1;
+    }
+
+    fmt::print("{:<12} {:>8} {:>9.1f} us\n",
+               order == FieldOrder::declared ? "declared" : "reordered",
+               db.get<LayoutQuery>("struct.c")[0].size,
+               ns / 1000);
+  }
+
+  return 0;
+}
@@ -0,0 +1,157 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "queries.h"
+#include "tier.h"
+#include "tree_walker.h"
+#include "vm.h"
+
+/*
+ * Bytecode VM against the tree walking interpreter on the test/ programs,
+ * scaled up: a generated driver calls every function of a program REPEAT
+ * times with literal arguments, and the driver runs `iterations` times in
+ * each engine. The tiered column includes the warm-up in the interpreter and
+ * the background compilation of hot functions.
+ *
+ * Usage: vm_bench [iterations]
+ */
+
+using namespace wcc;
+using Clock = std::chrono::steady_clock;
+
+constexpr int REPEAT = 64;
+
+const char* const PROGRAMS[] = {
+  "call.c",
+  "file1.c",
+  "file2.c",
+};
+
+static std::string
+read_file(const std::string& path)
+{
+  std::ifstream in(path);
+  return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+// The program followed by bench_driver(), which calls each of its functions
+// REPEAT times.
+static std::string
+scale_up(QueryDatabase& db, const std::string& name, const std::string& source)
+{
+  db.set<SourceTextQuery>(name, source);
+
+  std::string driver = "i32 bench_driver() {\n";
+
+  for (const auto& func : db.get<FunctionListQuery>(name)) {
+    const auto& sig = db.get<SignatureQuery>({ name, func });
+    std::string call = func + "(";
+
+    for (size_t i = 0; i < sig->params.size(); ++i) {
+      call += i == 0 ? "" : ", ";
+      call += is_float(sig->params[i]) ? "1.5" : std::to_string(i + 3);
+    }
+
+    for (int i = 0; i < REPEAT; ++i)
+      driver += call + ");\n";
+  }
+
+  return source + "\n" + driver + "return 0;\n}\n";
+}
+
+template<typename F>
+static double
+time_ns(int iterations, F&& run)
+{
+  const auto start = Clock::now();
+
+  for (int i = 0; i < iterations; ++i) {
+    if (!run())
+      exit(1);
+  }
+
+  const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+int
+main(int argc, char** argv)
+{
+  const int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+
+  // Literal arguments narrowed to small parameter types warn.
+  spdlog::set_level(spdlog::level::err);
+
+  fmt::print("{:<10} {:>14} {:>14} {:>8} {:>14} {:>8}\n",
+             "program",
+             "tree walk",
+             "bytecode",
+             "speedup",
+             "tiered",
+             "speedup");
+
+  for (const char* name : PROGRAMS) {
+    QueryDatabase     db;
+    const std::string source =
+      scale_up(db, name, read_file(std::string(WCC_TEST_DIR) + "/" + name));
+
+    db.set<SourceTextQuery>(name, source);
+    const auto& file    = db.get<TypecheckQuery>(name);
+    const auto& layouts = db.get<LayoutQuery>(name);
+    const auto& module  = db.get<ModuleQuery>(name);
+
+    vm::Program program;
+
+    if (!file->ok || module == nullptr ||
+        !vm::compile(*file, layouts, program))
+      return 1;
+
+    const auto tiered = tier::TieredModule::create(*file, layouts, module);
+
+    if (tiered == nullptr)
+      return 1;
+
+    TreeWalker  walker(*file);
+    vm::Machine machine(program);
+    VarValue    walked;
+    VarValue    executed;
+    VarValue    tiered_result;
+
+    const uint32_t driver = program.find("bench_driver");
+
+    const double walk_ns = time_ns(iterations, [&] {
+      return walker.call("bench_driver", {}, walked);
+    });
+
+    const double vm_ns = time_ns(iterations, [&] {
+      return machine.call(driver, {}, executed);
+    });
+
+    const double tier_ns = time_ns(iterations, [&] {
+      return tiered->call("bench_driver", {}, tiered_result);
+    });
+
+    if (walked.u64_value != executed.u64_value ||
+        walked.u64_value != tiered_result.u64_value) {
+      fmt::print(stderr, "{}: results differ\n", name);
+      return 1;
+    }
+
+    fmt::print("{:<10} {:>11.1f} us {:>11.1f} us {:>7.1f}x "
+               "{:>11.1f} us {:>7.1f}x\n",
+               name,
+               walk_ns / 1000,
+               vm_ns / 1000,
+               walk_ns / vm_ns,
+               tier_ns / 1000,
+               walk_ns / tier_ns);
+  }
+
+  return 0;
+}
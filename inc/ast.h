@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <variant>
@@ -21,6 +22,9 @@ enum class ASTID : size_t {
   funcdecl,
   strdecl,
   stmt,
+  loop,
+  branch,
+  block,
 };
 
 constexpr const char *ASTID_STR[] = {
@@ -29,6 +33,9 @@ constexpr const char *ASTID_STR[] = {
     [underlay_cast(ASTID::funcdecl)] = "funcdecl",
     [underlay_cast(ASTID::strdecl)] = "strdecl",
     [underlay_cast(ASTID::stmt)] = "stmt",
+    [underlay_cast(ASTID::loop)] = "loop",
+    [underlay_cast(ASTID::branch)] = "branch",
+    [underlay_cast(ASTID::block)] = "block",
 };
 
 #define MakeLangType(type_name) lt_##type_name
@@ -84,20 +91,79 @@ inline std::optional<LangType> lookup_type(const std::string &type_name) {
   return langtype_it->second;
 }
 
+// Kind of an implicit conversion between two LangTypes, see typecheck.h.
+enum class ConvKind : uint8_t {
+  none,
+  sext,
+  zext,
+  trunc,
+  sitofp,
+  uitofp,
+  fptosi,
+  fptoui,
+  fpext,
+  fptrunc,
+  invalid,
+};
+
+constexpr const char *CONV_KIND_STR[] = {
+    [underlay_cast(ConvKind::none)] = "none",
+    [underlay_cast(ConvKind::sext)] = "sext",
+    [underlay_cast(ConvKind::zext)] = "zext",
+    [underlay_cast(ConvKind::trunc)] = "trunc",
+    [underlay_cast(ConvKind::sitofp)] = "sitofp",
+    [underlay_cast(ConvKind::uitofp)] = "uitofp",
+    [underlay_cast(ConvKind::fptosi)] = "fptosi",
+    [underlay_cast(ConvKind::fptoui)] = "fptoui",
+    [underlay_cast(ConvKind::fpext)] = "fpext",
+    [underlay_cast(ConvKind::fptrunc)] = "fptrunc",
+    [underlay_cast(ConvKind::invalid)] = "invalid",
+};
+
+// Value of a constant. Integers are kept sign or zero extended to 64 bits
+// according to their LangType, f32 is stored in f32_value with the upper half
+// of u64_value cleared, so u64_value always identifies the constant.
 union VarValue {
   uint64_t u64_value;
+  int64_t i64_value;
+  double f64_value;
+  float f32_value;
 };
 
 using SymbolName = std::string;
 
+// Index into the symbol table built by name resolution (resolve.h).
+using SymbolIndex = uint32_t;
+
+constexpr SymbolIndex INVALID_SYMBOL = ~SymbolIndex(0);
+
 struct AstSymRef {
   SymbolName name;
+
+  // Declaration this reference binds to, set by name resolution.
+  SymbolIndex symbol = INVALID_SYMBOL;
+};
+
+// Numeric literal, typed by the parser from its value and suffix.
+struct AstLiteral {
+  LangType type;
+  VarValue value;
 };
 
+// Longest array, its size in bytes and every index into it fit in 32 bits.
+constexpr uint32_t MAX_ARRAY_LENGTH = 1 << 24;
+
 struct AstVariable {
   LangType type;
   SymbolName name;
   VarValue value;
+
+  // Elements of an array `type name[length];`, 0 for a scalar.
+  uint32_t length = 0;
+
+  // Structure of a `struct name var;` variable, whose type is void. The
+  // name is empty for variables of a LangType.
+  AstSymRef structure;
 };
 
 struct AstFunction {
@@ -126,33 +192,108 @@ struct AstFunctionCall {
   // Used to differentiate calls from standard operators, 
   // because for the latter we might have to fix precedence.
   Token from_token;
+
+  // Called function, set by name resolution. Standard operators don't bind.
+  SymbolIndex symbol = INVALID_SYMBOL;
+};
+
+// Explicit conversion inserted by the type checker.
+struct AstConversion {
+  using Operand = std::vector<AstStmt>;
+
+  ConvKind kind;
+  LangType from;
+  LangType to;
+
+  // Always exactly one element.
+  Operand operand;
+};
+
+// Element `index` of an array, `array[index]`.
+struct AstIndex {
+  using Index = std::vector<AstStmt>;
+
+  AstSymRef array;
+
+  // Always exactly one element.
+  Index index;
+};
+
+// Field of a structure variable, `object.field`, or of an element of an
+// array of structures, `object[index].field`.
+struct AstField {
+  using Index = std::vector<AstStmt>;
+
+  AstSymRef object;
+
+  // Empty for a scalar, exactly one element for an array.
+  Index index;
+
+  SymbolName field;
+
+  // Position of the field in the structure declaration, set by the type
+  // checker.
+  uint32_t number = 0;
 };
 
 enum class StmtType {
   varref,
   call,
   ret,
+  conv,
+  literal,
+  index,
+  field,
 };
 
 constexpr const char *STMT_TYPE_STR[] = {
     [underlay_cast(StmtType::varref)] = "varref",
     [underlay_cast(StmtType::call)] = "call",
     [underlay_cast(StmtType::ret)] = "return",
+    [underlay_cast(StmtType::conv)] = "conv",
+    [underlay_cast(StmtType::literal)] = "literal",
+    [underlay_cast(StmtType::index)] = "index",
+    [underlay_cast(StmtType::field)] = "field",
 };
 
+// Dense statement numbering assigned by the type checker. Per-node semantic
+// information lives in side arrays indexed by it.
+using StmtIndex = uint32_t;
+
+constexpr StmtIndex INVALID_STMT = ~StmtIndex(0);
+
 struct AstStmt {
   StmtType type;
 
-  std::variant<AstSymRef, AstFunctionCall> value;
+  std::variant<AstSymRef, AstFunctionCall, AstConversion, AstLiteral,
+               AstIndex, AstField>
+      value;
+
+  StmtIndex id = INVALID_STMT;
+};
+
+// `while (cond) { ... }` and `for (init; cond; step) { ... }`. The body is
+// the children of the loop node, the init statement of a for loop is a
+// statement node of its own right before it.
+struct AstLoop {
+  AstStmt cond;
+  std::optional<AstStmt> step;
 };
 
+// `if (cond) { ... } else { ... }`. The children of the branch node are a
+// block node for each arm, the else arm may be missing.
+struct AstBranch {
+  AstStmt cond;
+};
 
 struct ASTNode {
   using WeakPointer = ASTNode *;
   using Reference = ASTNode &;
   using Pointer = std::unique_ptr<ASTNode>;
   using NodeArray = std::vector<Pointer>;
-  using ValueStorage = std::variant<AstVariable, AstFunction, AstStruct, AstStmt>;
+  using ValueStorage =
+      std::variant<AstVariable, AstFunction, AstStruct, AstStmt, AstLoop,
+                   AstBranch>;
 
   ASTNode() : id(ASTID::empty), nodes() {}
 
@@ -71,6 +71,51 @@ struct fmt::formatter<wcc::AstSymRef>
   }
 };
 
+template<>
+struct fmt::formatter<wcc::AstLiteral>
+{
+  constexpr auto parse(format_parse_context& ctx)
+  {
+    const auto it = ctx.begin(), end = ctx.end();
+    if (it != end && *it != '}')
+      throw format_error("invalid format");
+    return it;
+  }
+
+  template<typename FormatContext>
+  auto format(const wcc::AstLiteral& astlit, FormatContext& ctx) const
+  {
+    const wcc::VarValue& v = astlit.value;
+    std::string          value;
+
+    switch (astlit.type) {
+      case wcc::LangType::lt_f32:
+        value = fmt::format("{}", v.f32_value);
+        break;
+      case wcc::LangType::lt_f64:
+        value = fmt::format("{}", v.f64_value);
+        break;
+      case wcc::LangType::lt_i8:
+      case wcc::LangType::lt_i16:
+      case wcc::LangType::lt_i32:
+      case wcc::LangType::lt_i64:
+        value = fmt::format("{}", v.i64_value);
+        break;
+      default:
+        value = fmt::format("{}", v.u64_value);
+    }
+
+    // clang-format off
+    return format_to(ctx.out(),
+                     "<" COLOR_ID "AstLiteral" COLOR_RESET ": "
+                     COLOR_FIELD "type" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ", "
+                     COLOR_FIELD "value" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ">",
+                     wcc::LANG_TYPE_STR[underlay_cast(astlit.type)],
+                     value);
+    // clang-format on
+  }
+};
+
 template<>
 struct fmt::formatter<wcc::AstFunctionCall>
 {
@@ -130,6 +175,56 @@ struct fmt::formatter<wcc::AstStmt>
                        wcc::STMT_TYPE_STR[underlay_cast(aststmt.type)], 
                        std::get<wcc::AstFunctionCall>(aststmt.value));
       // clang-format on
+    } else if (aststmt.type == wcc::StmtType::conv) {
+      auto& conv = std::get<wcc::AstConversion>(aststmt.value);
+
+      // clang-format off
+      return format_to(ctx.out(),
+                       "<" COLOR_ID "ASTStmt" COLOR_RESET ": "
+                       COLOR_FIELD "type" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ", "
+                       COLOR_FIELD "kind" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ", "
+                       COLOR_FIELD "to" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ", "
+                       COLOR_FIELD "value" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ">",
+                       wcc::STMT_TYPE_STR[underlay_cast(aststmt.type)],
+                       wcc::CONV_KIND_STR[underlay_cast(conv.kind)],
+                       wcc::LANG_TYPE_STR[underlay_cast(conv.to)],
+                       conv.operand[0]);
+      // clang-format on
+    } else if (aststmt.type == wcc::StmtType::literal) {
+      // clang-format off
+      return format_to(ctx.out(),
+                       "<" COLOR_ID "ASTStmt" COLOR_RESET ": "
+                       COLOR_FIELD "type" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ", "
+                       COLOR_FIELD "value" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ">",
+                       wcc::STMT_TYPE_STR[underlay_cast(aststmt.type)],
+                       std::get<wcc::AstLiteral>(aststmt.value));
+      // clang-format on
+    } else if (aststmt.type == wcc::StmtType::index) {
+      auto& index = std::get<wcc::AstIndex>(aststmt.value);
+
+      // clang-format off
+      return format_to(ctx.out(),
+                       "<" COLOR_ID "ASTStmt" COLOR_RESET ": "
+                       COLOR_FIELD "type" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ", "
+                       COLOR_FIELD "array" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ", "
+                       COLOR_FIELD "index" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ">",
+                       wcc::STMT_TYPE_STR[underlay_cast(aststmt.type)],
+                       index.array,
+                       index.index[0]);
+      // clang-format on
+    } else if (aststmt.type == wcc::StmtType::field) {
+      auto& field = std::get<wcc::AstField>(aststmt.value);
+
+      // clang-format off
+      return format_to(ctx.out(),
+                       "<" COLOR_ID "ASTStmt" COLOR_RESET ": "
+                       COLOR_FIELD "type" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ", "
+                       COLOR_FIELD "object" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ", "
+                       COLOR_FIELD "field" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ">",
+                       wcc::STMT_TYPE_STR[underlay_cast(aststmt.type)],
+                       field.object,
+                       field.field);
+      // clang-format on
     } else if (aststmt.type == wcc::StmtType::ret) {
       // clang-format off
       return format_to(ctx.out(),
@@ -195,6 +290,35 @@ struct fmt::formatter<wcc::ASTNode::ValueStorage>
       auto& aststmt = std::get<wcc::AstStmt>(value);
       return format_to(ctx.out(), "{}", aststmt);
 
+    } else if (std::holds_alternative<wcc::AstLoop>(value)) {
+
+      auto& astloop = std::get<wcc::AstLoop>(value);
+
+      // clang-format off
+      format_to(ctx.out(),
+                "<" COLOR_ID "ASTLoop" COLOR_RESET ": "
+                COLOR_FIELD "cond" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET,
+                astloop.cond);
+
+      if (astloop.step.has_value())
+        format_to(ctx.out(),
+                  ", " COLOR_FIELD "step" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET,
+                  *astloop.step);
+      // clang-format on
+
+      return format_to(ctx.out(), ">");
+
+    } else if (std::holds_alternative<wcc::AstBranch>(value)) {
+
+      auto& astbranch = std::get<wcc::AstBranch>(value);
+
+      // clang-format off
+      return format_to(ctx.out(),
+                       "<" COLOR_ID "ASTBranch" COLOR_RESET ": "
+                       COLOR_FIELD "cond" COLOR_RESET "=" COLOR_VALUE "{}" COLOR_RESET ">",
+                       astbranch.cond);
+      // clang-format on
+
     }
 
     return format_to(ctx.out(), "???");
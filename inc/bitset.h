@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace wcc {
+
+// Fixed size set of small integers stored as one bit each. Dataflow passes
+// keep one per basic block, so union and difference work a word at a time.
+class DenseBitset
+{
+public:
+  DenseBitset() = default;
+
+  explicit DenseBitset(size_t size)
+    : bits(size)
+    , words((size + 63) / 64, 0)
+  {}
+
+  size_t size() const { return bits; }
+
+  bool test(size_t i) const { return words[i / 64] >> (i % 64) & 1; }
+
+  void set(size_t i) { words[i / 64] |= uint64_t(1) << (i % 64); }
+
+  void reset(size_t i) { words[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+
+  // this |= other, true if any bit was added.
+  bool unite(const DenseBitset& other)
+  {
+    uint64_t added = 0;
+
+    for (size_t w = 0; w < words.size(); ++w) {
+      added |= other.words[w] & ~words[w];
+      words[w] |= other.words[w];
+    }
+
+    return added != 0;
+  }
+
+  // this |= (in & ~removed), true if any bit was added.
+  bool unite_difference(const DenseBitset& in, const DenseBitset& removed)
+  {
+    uint64_t added = 0;
+
+    for (size_t w = 0; w < words.size(); ++w) {
+      const uint64_t bits = in.words[w] & ~removed.words[w];
+      added |= bits & ~words[w];
+      words[w] |= bits;
+    }
+
+    return added != 0;
+  }
+
+  size_t count() const
+  {
+    size_t n = 0;
+
+    for (const uint64_t w : words)
+      n += static_cast<size_t>(__builtin_popcountll(w));
+
+    return n;
+  }
+
+  // Calls f(i) for every set bit in increasing order.
+  template<typename F>
+  void for_each(F&& f) const
+  {
+    for (size_t w = 0; w < words.size(); ++w) {
+      for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1)
+        f(w * 64 + static_cast<size_t>(__builtin_ctzll(bits)));
+    }
+  }
+
+  bool operator==(const DenseBitset& other) const
+  {
+    return bits == other.bits && words == other.words;
+  }
+
+private:
+  size_t                bits = 0;
+  std::vector<uint64_t> words;
+};
+
+} // namespace wcc
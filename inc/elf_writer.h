@@ -0,0 +1,29 @@
+#pragma once
+
+#include "x64.h"
+
+namespace wcc::elf {
+
+/*
+ * ELF64 output for encoded modules. Files are sized up front, mapped into
+ * memory and filled in place, so writing one costs an open, an ftruncate
+ * and an mmap however large it is.
+ */
+
+// Writes a relocatable object: code in .text, globals in .bss, every
+// function and global as a global symbol and the references between them as
+// .rela.text entries. `source` names the STT_FILE symbol.
+bool
+write_object(const char*             path,
+             const x64::MModule&     module,
+             const x64::MachineCode& code,
+             const char*             source);
+
+// Writes a static executable that needs neither a linker nor libc. Its entry
+// point calls main and exits with main's result.
+bool
+write_executable(const char*             path,
+                 const x64::MModule&     module,
+                 const x64::MachineCode& code);
+
+} // namespace wcc::elf
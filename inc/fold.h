@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "ast.h"
+#include "ir.h"
+#include "typecheck.h"
+
+namespace wcc {
+
+/*
+ * Compile time evaluation of constants, shared by the AST folding pass and
+ * the IR constant propagation. Constants travel as the 64 bits of a VarValue
+ * (see ast.h), arithmetic wraps at the width of the operand type exactly like
+ * the generated code would.
+ */
+
+// Canonical bits of `bits` viewed as a value of `type`: integers are
+// truncated to their width and sign or zero extended back to 64 bits.
+uint64_t
+normalize_constant(LangType type, uint64_t bits);
+
+// Evaluates a binary or compare opcode on two constants of `type`. Empty if
+// the result is not a compile time constant (division by zero, INT_MIN / -1)
+// or the opcode cannot be evaluated.
+std::optional<uint64_t>
+fold_binary(ir::Opcode op, LangType type, uint64_t lhs, uint64_t rhs);
+
+// Evaluates a conversion. Empty for float to integer conversions of values
+// the target type cannot represent.
+std::optional<uint64_t>
+fold_conversion(ConvKind kind, LangType from, LangType to, uint64_t value);
+
+// True if the constant is non-zero in the sense of a condition.
+bool
+constant_truth(LangType type, uint64_t bits);
+
+// Replaces operator calls and conversions whose operands are literals with
+// the resulting literal, bottom up. Runs on a type checked AST, the folded
+// nodes keep their statement id and therefore their type.
+void
+fold_constants(AST& ast, const ExprTypes& types);
+
+} // namespace wcc
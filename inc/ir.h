@@ -0,0 +1,642 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <vector>
+
+#include "ast.h"
+
+namespace wcc {
+struct AnalyzedFile;
+struct StructLayout;
+}
+
+namespace wcc::ir {
+
+/*
+ * SSA intermediate representation.
+ *
+ * Every instruction of a function lives in one contiguous arena
+ * (Function::instrs) and is identified by its index, which doubles as the
+ * name of the virtual register it defines. Operands are u32 indices into the
+ * same arena, stored in a second flat arena (Function::operands) as a
+ * (offset, count) range, so an instruction is a fixed 24 byte record.
+ * Basic blocks only hold the order of their instructions and the CFG edges.
+ *
+ * Instructions are never deleted from the arena: passes turn them into
+ * `nop` and drop them from their block's order.
+ */
+
+using ValueId = uint32_t;
+using BlockId = uint32_t;
+
+constexpr uint32_t NONE = ~uint32_t(0);
+
+// Arrays are named by the imm of aload and astore: a global number, or this
+// bit set on an index into Function::arrays for the local arrays of a
+// function, which start out zeroed on every call.
+constexpr uint64_t LOCAL_ARRAY = uint64_t(1) << 32;
+
+enum class Opcode : uint8_t
+{
+  nop,
+  param,    // imm: parameter number
+  constant, // imm: value bits (f32 as float bits, f64 as double bits)
+  add,
+  sub,
+  mul,
+  div,
+  mod,
+  bit_and,
+  bit_or,
+  bit_xor,
+  shl,    // operands: value, constant count below the width of the type
+  shr,    // logical, the value zero extended from its width
+  sar,    // arithmetic, the value sign extended from its width
+  mulhi,  // upper half of the double width product, signed by the type
+  cmp_lt, // compares operands of the same type, yields i32 0 or 1
+  cmp_le,
+  cmp_gt,
+  cmp_ge,
+  cmp_eq,
+  cmp_ne,
+  select,  // operands: i32 condition, value if non-zero, value if zero
+  conv,    // imm: ConvKind
+  pack,    // operands: one scalar per lane, yields a vector
+  extract, // operands: vector, imm: lane
+  local,   // stack slot of a local variable, imm: slot number
+  load,    // operands: local
+  store,   // operands: local, value
+  gload,   // imm: global number
+  gstore,  // imm: global number, operands: value
+  aload,   // imm: array, operands: i64 index, `lanes` consecutive elements
+  astore,  // imm: array, operands: i64 index, value (a vector of `lanes`)
+  bounds,  // imm: length, operands: i64 index, traps unless below length
+  call,    // imm: callee function number, operands: arguments
+  phi,     // operands: one incoming value per predecessor, in pred order
+  br,      // successor in Block::succs[0]
+  condbr,  // operands: condition, true: Block::succs[0], false: succs[1]
+  ret,     // operands: returned value, if any
+};
+
+constexpr const char* OPCODE_STR[] = {
+  [underlay_cast(Opcode::nop)]      = "nop",
+  [underlay_cast(Opcode::param)]    = "param",
+  [underlay_cast(Opcode::constant)] = "const",
+  [underlay_cast(Opcode::add)]      = "add",
+  [underlay_cast(Opcode::sub)]      = "sub",
+  [underlay_cast(Opcode::mul)]      = "mul",
+  [underlay_cast(Opcode::div)]      = "div",
+  [underlay_cast(Opcode::mod)]      = "mod",
+  [underlay_cast(Opcode::bit_and)]  = "and",
+  [underlay_cast(Opcode::bit_or)]   = "or",
+  [underlay_cast(Opcode::bit_xor)]  = "xor",
+  [underlay_cast(Opcode::shl)]      = "shl",
+  [underlay_cast(Opcode::shr)]      = "shr",
+  [underlay_cast(Opcode::sar)]      = "sar",
+  [underlay_cast(Opcode::mulhi)]    = "mulhi",
+  [underlay_cast(Opcode::cmp_lt)]   = "cmp_lt",
+  [underlay_cast(Opcode::cmp_le)]   = "cmp_le",
+  [underlay_cast(Opcode::cmp_gt)]   = "cmp_gt",
+  [underlay_cast(Opcode::cmp_ge)]   = "cmp_ge",
+  [underlay_cast(Opcode::cmp_eq)]   = "cmp_eq",
+  [underlay_cast(Opcode::cmp_ne)]   = "cmp_ne",
+  [underlay_cast(Opcode::select)]   = "select",
+  [underlay_cast(Opcode::conv)]     = "conv",
+  [underlay_cast(Opcode::pack)]     = "pack",
+  [underlay_cast(Opcode::extract)]  = "extract",
+  [underlay_cast(Opcode::local)]    = "local",
+  [underlay_cast(Opcode::load)]     = "load",
+  [underlay_cast(Opcode::store)]    = "store",
+  [underlay_cast(Opcode::gload)]    = "gload",
+  [underlay_cast(Opcode::gstore)]   = "gstore",
+  [underlay_cast(Opcode::aload)]    = "aload",
+  [underlay_cast(Opcode::astore)]   = "astore",
+  [underlay_cast(Opcode::bounds)]   = "bounds",
+  [underlay_cast(Opcode::call)]     = "call",
+  [underlay_cast(Opcode::phi)]      = "phi",
+  [underlay_cast(Opcode::br)]       = "br",
+  [underlay_cast(Opcode::condbr)]   = "condbr",
+  [underlay_cast(Opcode::ret)]      = "ret",
+};
+
+constexpr bool
+is_binary(Opcode op)
+{
+  return op >= Opcode::add && op <= Opcode::mulhi;
+}
+
+constexpr bool
+is_compare(Opcode op)
+{
+  return op >= Opcode::cmp_lt && op <= Opcode::cmp_ne;
+}
+
+// The opcode testing `b op a` for `a op b`.
+constexpr Opcode
+swap_compare(Opcode op)
+{
+  switch (op) {
+    case Opcode::cmp_lt:
+      return Opcode::cmp_gt;
+    case Opcode::cmp_le:
+      return Opcode::cmp_ge;
+    case Opcode::cmp_gt:
+      return Opcode::cmp_lt;
+    case Opcode::cmp_ge:
+      return Opcode::cmp_le;
+    default:
+      return op;
+  }
+}
+
+// The opcode testing !(a op b).
+constexpr Opcode
+negate_compare(Opcode op)
+{
+  switch (op) {
+    case Opcode::cmp_lt:
+      return Opcode::cmp_ge;
+    case Opcode::cmp_le:
+      return Opcode::cmp_gt;
+    case Opcode::cmp_gt:
+      return Opcode::cmp_le;
+    case Opcode::cmp_ge:
+      return Opcode::cmp_lt;
+    case Opcode::cmp_eq:
+      return Opcode::cmp_ne;
+    default:
+      return Opcode::cmp_eq;
+  }
+}
+
+constexpr bool
+is_terminator(Opcode op)
+{
+  return op == Opcode::br || op == Opcode::condbr || op == Opcode::ret;
+}
+
+// No side effects and the result depends only on the operands.
+constexpr bool
+is_pure(Opcode op)
+{
+  return op == Opcode::constant || is_binary(op) || is_compare(op) ||
+         op == Opcode::select || op == Opcode::conv || op == Opcode::pack ||
+         op == Opcode::extract;
+}
+
+struct Instr
+{
+  Opcode   op;
+  uint8_t  ty; // LangType of the result, lt_void if none
+  uint16_t num_operands;
+  BlockId  block;
+  uint32_t operands; // offset into Function::operands
+  uint8_t  lanes = 1; // vectors of `ty`: pack, aload, ops over vectors
+  uint64_t imm;
+
+  LangType type() const { return static_cast<LangType>(ty); }
+
+  bool operator==(const Instr& other) const
+  {
+    return op == other.op && ty == other.ty &&
+           num_operands == other.num_operands && block == other.block &&
+           operands == other.operands && lanes == other.lanes &&
+           imm == other.imm;
+  }
+};
+
+static_assert(sizeof(Instr) == 24);
+
+struct Block
+{
+  std::vector<ValueId> instrs;
+  std::vector<BlockId> preds;
+  std::vector<BlockId> succs;
+
+  bool operator==(const Block& other) const
+  {
+    return instrs == other.instrs && preds == other.preds &&
+           succs == other.succs;
+  }
+};
+
+struct Array
+{
+  LangType type;
+  uint32_t length;
+
+  bool operator==(const Array& other) const
+  {
+    return type == other.type && length == other.length;
+  }
+};
+
+struct Function
+{
+  SymbolName            name;
+  LangType              return_type;
+  std::vector<LangType> params;
+  std::vector<Array>    arrays; // local arrays
+
+  std::vector<Instr>   instrs;
+  std::vector<ValueId> operands;
+  std::vector<Block>   blocks;
+
+  BlockId add_block();
+  void    add_edge(BlockId from, BlockId to);
+
+  // Appends a new instruction to the end of a block.
+  ValueId append(BlockId                        block,
+                 Opcode                         op,
+                 LangType                       type,
+                 std::initializer_list<ValueId> ops = {},
+                 uint64_t                       imm = 0);
+
+  // Creates an instruction that is not placed in any block yet.
+  ValueId create(BlockId                        block,
+                 Opcode                         op,
+                 LangType                       type,
+                 const ValueId*                 ops,
+                 size_t                         num_ops,
+                 uint64_t                       imm = 0);
+
+  ValueId* operands_of(ValueId v) { return &operands[instrs[v].operands]; }
+
+  const ValueId* operands_of(ValueId v) const
+  {
+    return &operands[instrs[v].operands];
+  }
+
+  ValueId operand(ValueId v, size_t i) const
+  {
+    return operands[instrs[v].operands + i];
+  }
+
+  // Replaces the operand list of an instruction with a fresh range.
+  void set_operands(ValueId v, const ValueId* ops, size_t num_ops);
+
+  // Rewrites every operand through `repl` (NONE entries are kept), following
+  // chains of replacements.
+  void replace_uses(std::vector<ValueId>& repl);
+
+  // Drops nops from the instruction order of every block.
+  void compact_blocks();
+
+  bool operator==(const Function& other) const
+  {
+    return name == other.name && return_type == other.return_type &&
+           params == other.params && arrays == other.arrays &&
+           instrs == other.instrs && operands == other.operands &&
+           blocks == other.blocks;
+  }
+};
+
+struct Global
+{
+  SymbolName name;
+  LangType   type;
+  uint64_t   init;
+  uint32_t   length = 0; // elements of an array, zero for a scalar
+};
+
+enum class InlineVerdict : uint8_t
+{
+  inlined,
+  recursive,        // callee is in the caller's call graph cycle
+  too_costly,       // estimated cost above the threshold
+  caller_too_large, // the caller reached its size limit
+  local_arrays,     // callee arrays would have to be zeroed at the call
+};
+
+constexpr const char* INLINE_VERDICT_STR[] = {
+  [underlay_cast(InlineVerdict::inlined)]          = "inlined",
+  [underlay_cast(InlineVerdict::recursive)]        = "recursive",
+  [underlay_cast(InlineVerdict::too_costly)]       = "too costly",
+  [underlay_cast(InlineVerdict::caller_too_large)] = "caller too large",
+  [underlay_cast(InlineVerdict::local_arrays)]     = "local arrays",
+};
+
+// One call site considered by the inliner.
+struct InlineDecision
+{
+  SymbolName    caller;
+  SymbolName    callee;
+  int32_t       cost; // callee size minus the estimated savings
+  InlineVerdict verdict;
+};
+
+struct Module
+{
+  std::vector<Global>   globals;
+  std::vector<Function> functions;
+
+  // Every call site the inliner looked at, in the order it decided them.
+  std::vector<InlineDecision> inline_report;
+};
+
+/*
+ * Dominator tree, built with the Cooper-Harvey-Kennedy iterative algorithm
+ * ("A Simple, Fast Dominance Algorithm"). Unreachable blocks have no idom
+ * and are absent from `rpo`.
+ */
+struct DomTree
+{
+  std::vector<BlockId>              idom;
+  std::vector<BlockId>              rpo;
+  std::vector<uint32_t>             rpo_index;
+  std::vector<std::vector<BlockId>> children;
+
+  // Preorder entry/exit numbers of the dominator tree, for O(1) queries.
+  std::vector<uint32_t> pre, post;
+
+  bool reachable(BlockId b) const { return rpo_index[b] != NONE; }
+
+  bool dominates(BlockId a, BlockId b) const
+  {
+    return pre[a] <= pre[b] && post[b] <= post[a];
+  }
+};
+
+DomTree
+build_dom_tree(const Function& fn);
+
+// Dominance frontier of every block.
+std::vector<std::vector<BlockId>>
+dominance_frontiers(const Function& fn, const DomTree& dom);
+
+/*
+ * Natural loop of the back edges latch -> header whose header dominates the
+ * latch: the blocks reaching a latch without passing through the header.
+ * Back edges into the same header make up one loop.
+ */
+struct Loop
+{
+  BlockId              header;
+  BlockId              preheader; // only way in, ends with `br header`
+  std::vector<BlockId> latches;
+  std::vector<BlockId> blocks; // in reverse postorder, header first
+  std::vector<BlockId> exits;  // blocks outside branched to from inside
+  uint32_t             parent    = NONE; // innermost enclosing loop
+  bool                 innermost = true;
+};
+
+struct LoopInfo
+{
+  // Inner loops come before the loops containing them.
+  std::vector<Loop> loops;
+
+  // Innermost loop containing every block, NONE outside of loops.
+  std::vector<uint32_t> loop_of;
+
+  bool contains(uint32_t loop, BlockId block) const;
+};
+
+// Finds the natural loops. A loop entered from several blocks, or from a
+// block that branches elsewhere too, first gets a preheader inserted, so
+// every loop found has one.
+LoopInfo
+find_loops(Function& fn);
+
+// Basic induction variable of a loop with a single latch: a header phi
+// starting at `init` and advanced to `next` = phi + step on the latch.
+struct InductionVar
+{
+  ValueId  phi;
+  ValueId  init;
+  ValueId  next;
+  uint64_t step; // canonical bits of a constant of the phi's type
+};
+
+std::vector<InductionVar>
+induction_vars(const Function& fn, const Loop& loop);
+
+// Number of times the body of a loop runs, if the header is the only block
+// leaving the loop and its test compares a basic induction variable with a
+// constant start against a constant. Derived in closed form, empty if the
+// variable would wrap around or never reach the bound.
+std::optional<uint64_t>
+trip_count(const Function& fn, const Loop& loop);
+
+// Opcode computing a standard operator, compound assignments map to their
+// arithmetic part. nop for operators without a direct opcode.
+Opcode
+operator_opcode(TOKENID id);
+
+// Lowers a type checked function (funcdecl node) or file, with structures
+// laid out as in `layouts`. Locals and parameters live in `local` slots
+// accessed with load/store, run mem2reg to get them into SSA form.
+Function
+lower_function(const AnalyzedFile&              file,
+               const std::vector<StructLayout>& layouts,
+               const ASTNode&                   node);
+
+Module
+lower_module(const AnalyzedFile&              file,
+             const std::vector<StructLayout>& layouts);
+
+// A global variable. A structure is an array of words as wide as it is
+// aligned, see storage_type().
+Global
+lower_global(const AnalyzedFile&              file,
+             const std::vector<StructLayout>& layouts,
+             const AstVariable&               var);
+
+// Promotes local slots that are only loaded and stored to SSA values,
+// inserting phis on the iterated dominance frontier of their stores.
+void
+mem2reg(Function& fn);
+
+// Scalar replacement of aggregates: local arrays, structures included,
+// whose memory does not escape their scalars are split into one local slot
+// per distinct scalar accessed, and removed from Function::arrays. Memory
+// escapes through an index that is not a constant, a vector access, or
+// accesses to overlapping bytes as different scalars. Run mem2reg
+// afterwards to get the new slots into SSA form. Returns the number of
+// arrays split up.
+uint32_t
+scalarize_aggregates(Function& fn);
+
+// Turns calls of a function to itself whose result it returns right away
+// into a loop: the parameters become phis of a new header after the entry,
+// which the calls branch back to with their arguments. `self` is the number
+// of `fn` in its module, what its calls name it by. Functions with local
+// arrays are left alone, each call starts them out zeroed. Returns the
+// number of calls removed.
+uint32_t
+eliminate_tail_recursion(Function& fn, uint32_t self);
+
+// Folds instructions whose operands are constants, resolves constant
+// branches, removes the blocks this makes unreachable and collapses phis
+// with a single incoming value. Unused pure instructions are dropped.
+void
+propagate_constants(Function& fn);
+
+// If-conversion: a branch around one or two small arms of pure integer
+// arithmetic that meet again right after, or that both return, is replaced
+// by computing both arms and a `select` for each phi where they meet.
+// Selects of 0 and 1 become the condition, or an and/or of it with another
+// condition, so && and || compute their value without a branch. Nested
+// branches are converted inside out. Returns the number of branches
+// removed.
+uint32_t
+if_convert(Function& fn);
+
+struct InlineOptions
+{
+  // Call sites whose cost is at most this are inlined.
+  int32_t threshold = 16;
+
+  // Callers stop growing at this many instructions.
+  uint32_t max_caller_size = 2000;
+};
+
+// Inlines calls, visiting the call graph bottom-up so callees are already
+// expanded when inlined themselves. Calls within a cycle of the call graph
+// are never inlined, which bounds the expansion. Constant arguments replace
+// the parameters they are passed to and callers are constant propagated
+// afterwards. Decisions are appended to `module.inline_report`.
+void
+inline_calls(Module& module, const InlineOptions& options = {});
+
+// Functions whose result depends only on their arguments and that have no
+// effects: no global accesses and only such callees, recursion included. A
+// global read is as disqualifying as a write, its value at run time is not
+// known at compile time.
+std::vector<uint8_t>
+find_pure_functions(const Module& module);
+
+struct EvalOptions
+{
+  // Instructions one call site may execute before evaluation gives up.
+  uint64_t step_budget = 1 << 16;
+
+  // Nesting of calls during evaluation.
+  uint32_t max_depth = 256;
+};
+
+struct EvalStats
+{
+  uint32_t folded        = 0; // calls replaced by their result
+  uint32_t memo_hits     = 0; // calls answered from the memo table
+  uint32_t out_of_budget = 0; // call sites given up on
+  uint64_t steps         = 0; // instructions executed
+};
+
+// Evaluates calls to pure functions with constant arguments at compile time
+// and replaces them by their result. Evaluation interprets the IR with the
+// same arithmetic as the folder. Traps (division by zero) and exceeding the
+// limits leave the call in place. Results are memoized per function and
+// arguments across the whole module.
+EvalStats
+evaluate_calls(Module& module, const EvalOptions& options = {});
+
+// Runs a pure function on canonical arguments with the evaluator above,
+// adding to `stats`. Empty if it traps or exceeds the limits.
+std::optional<uint64_t>
+evaluate(const Module&                module,
+         uint32_t                     function,
+         const std::vector<uint64_t>& args,
+         EvalStats&                   stats,
+         const EvalOptions&           options = {});
+
+// Rewrites trees of one associative integer operation (+, *, &, |, ^) whose
+// interior values have no other use as balanced trees of minimal depth, so
+// independent parts can execute in parallel. Leaves are ordered by rank,
+// where they are defined, and constants are folded into one applied last.
+void
+reassociate(Function& fn);
+
+// Rewrites integer multiplication, division and modulo by a constant into
+// shifts, additions and multiplications keeping the upper half of the
+// product (mulhi), exact at every width from i8 to u64. Multiplications by
+// 3, 5 and 9 stay for instruction selection, division by zero and signed
+// division by -1 keep their trap.
+void
+reduce_strength(Function& fn);
+
+// Global value numbering over the dominator tree: a pure instruction
+// computing the same operation on the same operands as one in a dominating
+// position is replaced by it. Operands of commutative operators and
+// compares are ordered before hashing, so `b * c + a` and `a + c * b` are
+// found equal. Phis of one block merging the same values are merged too.
+void
+number_values(Function& fn);
+
+// Loop invariant code motion: pure instructions of a loop whose operands
+// are defined outside of it move to its preheader, inner loops first so
+// invariants of a nest move out as far as they can. Division and modulo
+// only move when their constant divisor cannot trap, global loads when
+// the loop neither stores the global nor calls.
+void
+hoist_invariants(Function& fn);
+
+// Induction variable simplification. Multiplying a basic induction
+// variable by a constant other than a power of two becomes an induction
+// variable of its own, advanced by an addition. With a known trip count
+// the value of a variable after the loop is a constant, and a loop left
+// with no effects and no value used afterwards is removed.
+void
+simplify_induction(Function& fn);
+
+struct UnrollOptions
+{
+  // Loops running at most this many times are unrolled completely.
+  uint32_t full_trip_count = 16;
+
+  // Copies of the body other innermost loops are unrolled to, 1 disables
+  // partial unrolling. With a known trip count the factor is lowered to a
+  // divisor of it so the copies need no exit test of their own.
+  uint32_t factor = 4;
+
+  // Instructions of the loop after unrolling, complete or partial.
+  uint32_t max_size = 256;
+};
+
+// Unrolls innermost loops whose header is the only way out, see
+// UnrollOptions. Copies whose exit test is known to fail branch straight
+// into the next one and are merged with it. Returns the number of loops
+// unrolled.
+uint32_t
+unroll_loops(Function& fn, const UnrollOptions& options = {});
+
+// Merges blocks into their only predecessor where it has no other
+// successor.
+void
+merge_blocks(Function& fn);
+
+// Superword level parallelism: packs of independent isomorphic operations of
+// one block, such as the same statement written out for four variables,
+// become one vector operation over `pack`ed operands, and the lanes used
+// elsewhere are `extract`ed. Groups of f32, i32 and u32 operations four
+// wide and f64 two wide are tried, deepest chains first, and kept when a
+// cost model counting the packing and extraction of scalars finds them
+// cheaper than the scalar code. Returns the number of groups vectorized.
+uint32_t
+vectorize_slp(Function& fn);
+
+// Removes array bounds checks that cannot fail: the index is a basic
+// induction variable plus a constant, and the exit test of its loop keeps
+// it within the array in every iteration, or a dominating check of the
+// same index against no larger a length already passed. Returns the number
+// of checks removed.
+uint32_t
+eliminate_bounds_checks(Function& fn);
+
+// Loop vectorization: innermost loops storing elementwise results of loads
+// and arithmetic on i32, u32, f32 or f64 array elements at i plus
+// constants get a loop in front running 32 byte vectors, eight or four
+// iterations at once while they all pass the exit test. The original loop
+// runs what remains. Bounds checks left in the body are made once for the
+// first and once for the last lane. Returns the number of loops
+// vectorized.
+uint32_t
+vectorize_loops(Function& fn);
+
+// Checks structural invariants and that every use is dominated by its
+// definition. Reports problems through spdlog.
+bool
+verify(const Function& fn);
+
+} // namespace wcc::ir
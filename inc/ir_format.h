@@ -0,0 +1,111 @@
+#pragma once
+
+#include <fmt/format.h>
+
+#include "ir.h"
+#include "typecheck.h"
+
+inline void
+print_ir_function(const wcc::ir::Function& fn)
+{
+  using namespace wcc::ir;
+
+  fmt::print("func {}(", fn.name);
+  for (size_t i = 0; i < fn.params.size(); ++i)
+    fmt::print("{}{}",
+               i ? ", " : "",
+               wcc::LANG_TYPE_STR[underlay_cast(fn.params[i])]);
+
+  fmt::print(") -> {} {{\n",
+             wcc::LANG_TYPE_STR[underlay_cast(fn.return_type)]);
+
+  for (size_t i = 0; i < fn.arrays.size(); ++i)
+    fmt::print("  array #l{} {}[{}]\n",
+               i,
+               wcc::LANG_TYPE_STR[underlay_cast(fn.arrays[i].type)],
+               fn.arrays[i].length);
+
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    const Block& block = fn.blocks[b];
+
+    fmt::print("bb{}:", b);
+    if (!block.preds.empty())
+      fmt::print("  ; preds: bb{}", fmt::join(block.preds, ", bb"));
+    fmt::print("\n");
+
+    for (const ValueId v : block.instrs) {
+      const Instr& instr = fn.instrs[v];
+
+      fmt::print("  ");
+      if (instr.type() != wcc::LangType::lt_void)
+        fmt::print("%{} = ", v);
+
+      fmt::print("{}", OPCODE_STR[underlay_cast(instr.op)]);
+      if (instr.type() != wcc::LangType::lt_void)
+        fmt::print(" {}", wcc::LANG_TYPE_STR[underlay_cast(instr.type())]);
+      if (instr.lanes > 1)
+        fmt::print("x{}", instr.lanes);
+
+      for (size_t i = 0; i < instr.num_operands; ++i)
+        fmt::print("{} %{}", i ? "," : "", fn.operand(v, i));
+
+      switch (instr.op) {
+        case Opcode::constant:
+          if (wcc::is_float(instr.type()))
+            fmt::print(" {:#x}", instr.imm);
+          else
+            fmt::print(" {}", static_cast<int64_t>(instr.imm));
+          break;
+        case Opcode::conv:
+          fmt::print(" {}", wcc::CONV_KIND_STR[instr.imm]);
+          break;
+        case Opcode::extract:
+          fmt::print(" [{}]", instr.imm);
+          break;
+        case Opcode::param:
+        case Opcode::local:
+        case Opcode::gload:
+        case Opcode::gstore:
+        case Opcode::call:
+          fmt::print(" #{}", instr.imm);
+          break;
+        case Opcode::aload:
+        case Opcode::astore:
+          if (instr.imm & LOCAL_ARRAY)
+            fmt::print(" #l{}", instr.imm & ~LOCAL_ARRAY);
+          else
+            fmt::print(" #{}", instr.imm);
+          break;
+        case Opcode::bounds:
+          fmt::print(" < {}", instr.imm);
+          break;
+        default:
+          break;
+      }
+
+      if (instr.op == Opcode::br || instr.op == Opcode::condbr)
+        fmt::print(" -> bb{}", fmt::join(block.succs, ", bb"));
+
+      fmt::print("\n");
+    }
+  }
+
+  fmt::print("}}\n");
+}
+
+inline void
+print_ir(const wcc::ir::Module& module)
+{
+  for (size_t i = 0; i < module.globals.size(); ++i) {
+    const wcc::ir::Global& global = module.globals[i];
+
+    fmt::print(
+      "global #{} {}", i, wcc::LANG_TYPE_STR[underlay_cast(global.type)]);
+    if (global.length != 0)
+      fmt::print("[{}]", global.length);
+    fmt::print(" {}\n", global.name);
+  }
+
+  for (const auto& fn : module.functions)
+    print_ir_function(fn);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "x64.h"
+
+namespace wcc::jit {
+
+/*
+ * A module's machine code loaded into this process. The code is copied into
+ * anonymous read/write pages, relocated against its final addresses and then
+ * flipped to read/execute. Globals live in read/write pages right behind the
+ * code so rip relative accesses reach them. The mapping goes away with the
+ * object.
+ */
+class JitModule
+{
+public:
+  // nullptr, with the reason logged, if the memory could not be set up.
+  //
+  // With `globals`, one address per global of the module, the code accesses
+  // that storage instead of its own. It is then mapped close to the first
+  // global, loading fails if a global ends up out of reach of rip relative
+  // addressing.
+  static std::unique_ptr<JitModule> load(
+    const x64::MModule&       module,
+    const x64::MachineCode&   code,
+    const std::vector<void*>& globals = {});
+
+  ~JitModule();
+
+  JitModule(const JitModule&) = delete;
+  JitModule& operator=(const JitModule&) = delete;
+
+  // Entry point of a function, nullptr if the module does not define it.
+  void* lookup(const std::string& name) const;
+
+  template<typename F>
+  F function(const std::string& name) const
+  {
+    return reinterpret_cast<F>(lookup(name));
+  }
+
+  // Address of an offset into the code, for code encoded behind the
+  // module's functions such as entry stubs.
+  void* address(uint32_t offset) const { return memory + offset; }
+
+  // Appends "start size name" lines for every function to
+  // /tmp/perf-<pid>.map, where perf looks up symbols of JIT code.
+  bool write_perf_map() const;
+
+private:
+  JitModule() = default;
+
+  struct Symbol
+  {
+    std::string name;
+    uint8_t*    start;
+    size_t      size;
+  };
+
+  uint8_t*            memory = nullptr;
+  size_t              mapped = 0;
+  std::vector<Symbol> symbols;
+};
+
+// Whether this CPU executes FMA3 instructions: the CPUID feature bit, and
+// the operating system saving the AVX register state (XCR0).
+bool
+cpu_has_fma();
+
+// Whether this CPU executes AVX2 instructions, with the same operating
+// system check.
+bool
+cpu_has_avx2();
+
+// `options` without the instruction set extensions this CPU lacks. Code
+// compiled for the running process goes through here, so contraction asked
+// for on a machine without FMA3 falls back to separate operations, and
+// 32 byte vectors without AVX2 to pairs of SSE operations.
+x64::CompileOptions
+for_host(x64::CompileOptions options);
+
+} // namespace wcc::jit
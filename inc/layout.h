@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ast.h"
+#include "symtab.h"
+
+namespace wcc {
+
+// Order the fields of a structure are placed in memory.
+enum class FieldOrder : uint8_t
+{
+  declared,     // as written, like C
+  by_alignment, // decreasing alignment, ties kept in declaration order
+};
+
+/*
+ * Memory layout of a structure. Every field is aligned to its size, the
+ * structure to its most aligned field, and the size is rounded up to that
+ * alignment so the elements of an array of structures stay aligned too.
+ * Each offset is thus a multiple of the size of its field, and the size a
+ * multiple of the size of every field.
+ *
+ * Fields of LangTypes have power of two sizes, so ordering them by
+ * decreasing alignment leaves no padding between them and only the least
+ * tail padding: the layout is as small as any order allows.
+ */
+struct StructLayout
+{
+  SymbolName            name;
+  uint32_t              size  = 0;
+  uint32_t              align = 1;
+  std::vector<uint32_t> offsets; // of the fields, in declaration order
+
+  // Size of the layout in declaration order, for the report.
+  uint32_t declared_size = 0;
+
+  bool operator==(const StructLayout& other) const
+  {
+    return name == other.name && size == other.size && align == other.align &&
+           offsets == other.offsets && declared_size == other.declared_size;
+  }
+};
+
+StructLayout
+layout_struct(const AstStruct& str, FieldOrder order);
+
+// Layouts of the structures of a file, indexed by their symbol slot.
+std::vector<StructLayout>
+layout_structs(const Symbols& symbols, FieldOrder order);
+
+// Structure variables are stored like arrays of unsigned integers as wide
+// as the structure is aligned, which gives their memory that alignment.
+// Fields are then accessed as elements of their own type, at the index
+// their offset divided by their size.
+LangType
+storage_type(const StructLayout& layout);
+
+// Elements of storage type taken by `length` structures, 0 for a scalar
+// taking as much as one.
+uint32_t
+storage_length(const StructLayout& layout, uint32_t length);
+
+} // namespace wcc
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "ast.h"
+
+namespace wcc {
+
+/*
+ * SWAR (SIMD within a register) digit parsing: eight ASCII characters are
+ * loaded into one 64 bit word and validated/converted with a handful of
+ * multiplies instead of a loop over single characters.
+ */
+
+inline uint64_t
+load_eight_chars(const char* p)
+{
+  uint64_t chunk;
+  std::memcpy(&chunk, p, sizeof(chunk));
+  return chunk;
+}
+
+// True if every byte of the (little endian) chunk is '0'..'9'.
+constexpr bool
+is_eight_digits(uint64_t chunk)
+{
+  return !(((chunk + 0x4646464646464646) | (chunk - 0x3030303030303030)) &
+           0x8080808080808080);
+}
+
+// Value of eight decimal digits, the first character being the most
+// significant digit. Pairs, then quads, then the two halves are combined.
+constexpr uint32_t
+parse_eight_digits(uint64_t chunk)
+{
+  constexpr uint64_t mask = 0x000000FF000000FF;
+  constexpr uint64_t mul1 = 0x000F424000000064; // 100 + (1000000 << 32)
+  constexpr uint64_t mul2 = 0x0000271000000001; // 1 + (10000 << 32)
+
+  chunk -= 0x3030303030303030;
+  chunk = (chunk * 10) + (chunk >> 8);
+  chunk = (((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32;
+
+  return static_cast<uint32_t>(chunk);
+}
+
+// Parses a decimal, 0x prefixed hexadecimal or 0 prefixed octal integer.
+// Fails on an empty digit sequence, stray characters or values that do not
+// fit in 64 bits.
+bool
+parse_integer(std::string_view text, uint64_t& value);
+
+// Converts the text of an INT_LITERAL or FLOAT_LITERAL token into a typed
+// constant. Integers get the narrowest of i32, i64 and u64 holding the value,
+// floats are f64 unless suffixed with 'f'.
+bool
+parse_literal(TOKENID id, std::string_view text, AstLiteral& literal);
+
+} // namespace wcc
@@ -9,6 +9,10 @@ namespace wcc {
 
 inline const std::set<Token::ValueType> KEYWORDS = {
         "struct",
+        "while",
+        "for",
+        "if",
+        "else",
 
         "void",
         "i8",
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "ir.h"
+#include "layout.h"
+#include "query.h"
+#include "symtab.h"
+#include "typecheck.h"
+
+namespace wcc {
+
+/*
+ * Queries over wcc source files. Files are identified by path; the text
+ * itself is an input set by the driver (or a daemon / editor integration).
+ */
+
+using FileKey     = std::string;
+using FunctionKey = std::pair<FileKey, SymbolName>;
+using ExprKey     = std::pair<FileKey, StmtIndex>;
+
+struct FunctionSignature
+{
+  using Params = std::vector<LangType>;
+
+  SymbolName name;
+  LangType   return_type;
+  Params     params;
+
+  bool operator==(const FunctionSignature& other) const
+  {
+    return name == other.name && return_type == other.return_type &&
+           params == other.params;
+  }
+};
+
+struct SourceTextQuery
+{
+  using Key   = FileKey;
+  using Value = std::string;
+
+  static constexpr const char* name  = "source_text";
+  static constexpr bool        input = true;
+};
+
+// Order the fields of the structures of a file are laid out in, the
+// declared one unless set.
+struct FieldOrderQuery
+{
+  using Key   = FileKey;
+  using Value = FieldOrder;
+
+  static constexpr const char* name  = "field_order";
+  static constexpr bool        input = true;
+};
+
+struct ParseQuery
+{
+  using Key   = FileKey;
+  using Value = std::shared_ptr<AST>;
+
+  static constexpr const char* name = "parse";
+
+  static Value execute(QueryDatabase& db, const Key& file);
+};
+
+struct FunctionListQuery
+{
+  using Key   = FileKey;
+  using Value = std::vector<SymbolName>;
+
+  static constexpr const char* name = "function_list";
+
+  static Value execute(QueryDatabase& db, const Key& file);
+};
+
+struct SignatureQuery
+{
+  using Key   = FunctionKey;
+  using Value = std::optional<FunctionSignature>;
+
+  static constexpr const char* name = "signature";
+
+  static Value execute(QueryDatabase& db, const Key& func);
+};
+
+// A parsed file after semantic analysis. The AST is the one produced by the
+// parse query, annotated in place.
+struct AnalyzedFile
+{
+  std::shared_ptr<AST> ast;
+  Symbols              symbols;
+  ExprTypes            types;
+  bool                 ok;
+};
+
+struct ResolveQuery
+{
+  using Key   = FileKey;
+  using Value = std::shared_ptr<const AnalyzedFile>;
+
+  static constexpr const char* name = "resolve";
+
+  static Value execute(QueryDatabase& db, const Key& file);
+};
+
+struct TypecheckQuery
+{
+  using Key   = FileKey;
+  using Value = std::shared_ptr<const AnalyzedFile>;
+
+  static constexpr const char* name = "typecheck";
+
+  static Value execute(QueryDatabase& db, const Key& file);
+};
+
+// Type of a single expression, by the AstStmt::id type checking gave it.
+// lt_void for ids the file does not have or when it does not type check.
+// Every reparse yields a new analyzed file, but the types of expressions an
+// edit left alone compare equal and backdate, so queries reading them stay
+// green.
+struct TypeOfQuery
+{
+  using Key   = ExprKey;
+  using Value = LangType;
+
+  static constexpr const char* name = "type_of";
+
+  static Value execute(QueryDatabase& db, const Key& expr);
+};
+
+// Layouts of the structures of a type checked file, indexed by their slot.
+// Kept apart from the analyzed file so that changing the field order only
+// lays out and lowers again, the annotated AST stays as it is.
+struct LayoutQuery
+{
+  using Key   = FileKey;
+  using Value = std::vector<StructLayout>;
+
+  static constexpr const char* name = "layout";
+
+  static Value execute(QueryDatabase& db, const Key& file);
+};
+
+// SSA form of a single function, after mem2reg, constant propagation, loop
+// optimization, reassociation and value numbering.
+struct LowerQuery
+{
+  using Key   = FunctionKey;
+  using Value = std::optional<ir::Function>;
+
+  static constexpr const char* name = "lower";
+
+  static Value execute(QueryDatabase& db, const Key& func);
+};
+
+// Whole file IR, assembled from the lower query of every function, with
+// calls inlined or evaluated at compile time, arithmetic by constants
+// strength reduced and isomorphic straight-line arithmetic vectorized.
+struct ModuleQuery
+{
+  using Key   = FileKey;
+  using Value = std::shared_ptr<const ir::Module>;
+
+  static constexpr const char* name = "module";
+
+  static Value execute(QueryDatabase& db, const Key& file);
+};
+
+// Finds the declaration node of a function in a parsed file.
+const ASTNode*
+find_function(const AST& ast, const SymbolName& name);
+
+} // namespace wcc
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "util.h"
+
+namespace wcc {
+
+/*
+ * Demand-driven query engine.
+ *
+ * Every compiler phase is expressed as a query: a pure function from a key to
+ * a value, declared as a struct:
+ *
+ *   struct ParseQuery
+ *   {
+ *     using Key   = std::string;
+ *     using Value = std::shared_ptr<AST>;
+ *
+ *     static constexpr const char* name = "parse";
+ *
+ *     static Value execute(QueryDatabase& db, const Key& key);
+ *   };
+ *
+ * Inputs are queries with `static constexpr bool input = true` and no
+ * execute(); their values are provided through QueryDatabase::set().
+ *
+ * Results are memoized together with the list of queries they read. Setting
+ * an input bumps the revision. A memoized result is then revalidated lazily
+ * (red/green): if none of its dependencies changed since it was last verified
+ * it is reused as is (green), otherwise it is recomputed. When a recomputed
+ * value compares equal to the old one, its change revision is kept
+ * (backdated), so queries depending on it stay green.
+ */
+
+using Revision  = uint64_t;
+using SlotIndex = uint32_t;
+
+struct QueryStats
+{
+  size_t executed  = 0; // query bodies run
+  size_t reused    = 0; // memoized results revalidated without running
+  size_t backdated = 0; // recomputed results equal to the previous ones
+};
+
+class QueryDatabase
+{
+public:
+  QueryDatabase() = default;
+
+  QueryDatabase(const QueryDatabase& other) = delete;
+  QueryDatabase& operator=(const QueryDatabase& other) = delete;
+
+  template<typename Q>
+  const typename Q::Value& get(const typename Q::Key& key);
+
+  template<typename Q>
+  void set(const typename Q::Key& key, typename Q::Value value);
+
+  template<typename Q>
+  bool has(const typename Q::Key& key);
+
+  // Value of an input, `fallback` while it is unset. The read is recorded
+  // either way: setting the input later invalidates the reader.
+  template<typename Q>
+  typename Q::Value get_or(const typename Q::Key& key,
+                           typename Q::Value      fallback);
+
+  Revision revision() const { return current_revision; }
+
+  QueryStats stats;
+
+private:
+  struct Slot
+  {
+    Revision               verified_at = 0;
+    Revision               changed_at  = 0;
+    bool                   is_input    = false;
+    bool                   computing   = false;
+    const char*            name        = nullptr;
+    std::vector<SlotIndex> deps;
+
+    // Brings the memoized value of this slot up to date.
+    std::function<void()> refresh;
+  };
+
+  struct Frame
+  {
+    SlotIndex              slot;
+    std::vector<SlotIndex> deps;
+  };
+
+  struct StorageBase
+  {
+    virtual ~StorageBase() = default;
+  };
+
+  template<typename Q>
+  struct Storage : StorageBase
+  {
+    struct Entry
+    {
+      SlotIndex                        slot;
+      std::optional<typename Q::Value> value;
+    };
+
+    // std::map keeps entries at stable addresses, slot refresh callbacks
+    // capture pointers into it.
+    std::map<typename Q::Key, Entry> entries;
+  };
+
+  template<typename T, typename = void>
+  struct is_equality_comparable : std::false_type
+  {};
+
+  template<typename T>
+  struct is_equality_comparable<
+    T,
+    std::void_t<decltype(std::declval<const T&>() == std::declval<const T&>())>>
+    : std::true_type
+  {};
+
+  template<typename Q, typename = void>
+  struct is_input_query : std::false_type
+  {};
+
+  template<typename Q>
+  struct is_input_query<Q, std::void_t<decltype(Q::input)>>
+    : std::bool_constant<Q::input>
+  {};
+
+  template<typename Q>
+  Storage<Q>& storage();
+
+  template<typename Q>
+  typename Storage<Q>::Entry& entry(const typename Q::Key& key);
+
+  template<typename Q>
+  void ensure_fresh(const typename Q::Key& key,
+                    typename Storage<Q>::Entry& e);
+
+  template<typename Q>
+  void execute(const typename Q::Key& key, typename Storage<Q>::Entry& e);
+
+  SlotIndex new_slot(const char* name, bool is_input);
+  void      record_read(SlotIndex slot);
+  bool      deps_unchanged(SlotIndex slot);
+  void      begin_execute(SlotIndex slot);
+  void      end_execute(SlotIndex slot);
+
+  // A deque keeps slots (and the refresh callbacks being run) in place while
+  // new queries are discovered during a refresh.
+  Revision           current_revision = 1;
+  std::deque<Slot>   slots;
+  std::vector<Frame> active;
+
+  std::unordered_map<std::type_index, std::unique_ptr<StorageBase>> storages;
+};
+
+template<typename Q>
+QueryDatabase::Storage<Q>&
+QueryDatabase::storage()
+{
+  auto& s = storages[std::type_index(typeid(Q))];
+
+  if (!s)
+    s = std::make_unique<Storage<Q>>();
+
+  return static_cast<Storage<Q>&>(*s);
+}
+
+template<typename Q>
+typename QueryDatabase::Storage<Q>::Entry&
+QueryDatabase::entry(const typename Q::Key& key)
+{
+  auto& entries = storage<Q>().entries;
+
+  auto it = entries.find(key);
+  if (it != entries.end())
+    return it->second;
+
+  it = entries.emplace(key, typename Storage<Q>::Entry{}).first;
+
+  auto& e = it->second;
+  e.slot  = new_slot(Q::name, is_input_query<Q>::value);
+
+  if constexpr (!is_input_query<Q>::value) {
+    const auto* key_ptr = &it->first;
+    auto*       e_ptr   = &e;
+
+    slots[e.slot].refresh = [this, key_ptr, e_ptr] {
+      ensure_fresh<Q>(*key_ptr, *e_ptr);
+    };
+  }
+
+  return e;
+}
+
+template<typename Q>
+const typename Q::Value&
+QueryDatabase::get(const typename Q::Key& key)
+{
+  auto& e = entry<Q>(key);
+
+  record_read(e.slot);
+
+  if constexpr (is_input_query<Q>::value) {
+    if (unlikely(!e.value.has_value()))
+      panic("Internal error: query input read before it was set");
+  } else {
+    ensure_fresh<Q>(key, e);
+  }
+
+  return *e.value;
+}
+
+template<typename Q>
+void
+QueryDatabase::set(const typename Q::Key& key, typename Q::Value value)
+{
+  static_assert(is_input_query<Q>::value, "only input queries can be set");
+
+  if (unlikely(!active.empty()))
+    panic("Internal error: query input set while a query is running");
+
+  auto& e = entry<Q>(key);
+
+  if constexpr (is_equality_comparable<typename Q::Value>::value) {
+    if (e.value.has_value() && *e.value == value)
+      return;
+  }
+
+  ++current_revision;
+
+  e.value                   = std::move(value);
+  slots[e.slot].changed_at  = current_revision;
+  slots[e.slot].verified_at = current_revision;
+}
+
+template<typename Q>
+bool
+QueryDatabase::has(const typename Q::Key& key)
+{
+  const auto& entries = storage<Q>().entries;
+  const auto  it      = entries.find(key);
+
+  return it != entries.end() && it->second.value.has_value();
+}
+
+template<typename Q>
+typename Q::Value
+QueryDatabase::get_or(const typename Q::Key& key, typename Q::Value fallback)
+{
+  static_assert(is_input_query<Q>::value, "only inputs have a fallback");
+
+  auto& e = entry<Q>(key);
+
+  record_read(e.slot);
+  return e.value.has_value() ? *e.value : fallback;
+}
+
+template<typename Q>
+void
+QueryDatabase::ensure_fresh(const typename Q::Key& key,
+                            typename Storage<Q>::Entry& e)
+{
+  if (slots[e.slot].verified_at == current_revision && e.value.has_value())
+    return;
+
+  if (e.value.has_value() && deps_unchanged(e.slot)) {
+    slots[e.slot].verified_at = current_revision;
+    ++stats.reused;
+    return;
+  }
+
+  execute<Q>(key, e);
+}
+
+template<typename Q>
+void
+QueryDatabase::execute(const typename Q::Key& key,
+                       typename Storage<Q>::Entry& e)
+{
+  const SlotIndex slot = e.slot;
+
+  begin_execute(slot);
+  typename Q::Value value = Q::execute(*this, key);
+  end_execute(slot);
+
+  bool same = false;
+  if constexpr (is_equality_comparable<typename Q::Value>::value)
+    same = e.value.has_value() && *e.value == value;
+
+  if (same) {
+    ++stats.backdated;
+  } else {
+    e.value                = std::move(value);
+    slots[slot].changed_at = current_revision;
+  }
+
+  slots[slot].verified_at = current_revision;
+}
+
+} // namespace wcc
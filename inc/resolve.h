@@ -0,0 +1,20 @@
+#pragma once
+
+#include "ast.h"
+#include "symtab.h"
+
+namespace wcc {
+
+// Name resolution pass. Builds the symbol table for a file and binds every
+// AstSymRef and named AstFunctionCall to its declaration. Top level
+// declarations are visible in the whole file, parameters and locals in the
+// function declaring them.
+bool
+resolve_names(AST& ast, Symbols& symbols);
+
+// Local declarations (vardecl nodes) of a function, those in loop bodies
+// included, in the order of their slots.
+std::vector<const ASTNode*>
+function_locals(const ASTNode& function);
+
+} // namespace wcc
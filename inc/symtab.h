@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "ast.h"
+
+namespace wcc {
+
+enum class SymbolKind
+{
+  global,
+  function,
+  param,
+  local,
+  structure,
+};
+
+constexpr const char* SYMBOL_KIND_STR[] = {
+  [underlay_cast(SymbolKind::global)]    = "global",
+  [underlay_cast(SymbolKind::function)]  = "function",
+  [underlay_cast(SymbolKind::param)]     = "param",
+  [underlay_cast(SymbolKind::local)]     = "local",
+  [underlay_cast(SymbolKind::structure)] = "struct",
+};
+
+struct Symbol
+{
+  SymbolName name;
+  SymbolKind kind;
+  LangType   type;
+
+  // Declaring node: the vardecl node for globals and locals, the funcdecl node
+  // for functions and their parameters, the strdecl node for structures.
+  const ASTNode* node;
+
+  // Position among symbols of the same kind in the same owner: parameter
+  // number, local number within the function, function or global number
+  // within the file.
+  uint32_t slot;
+
+  // Function a parameter or local belongs to.
+  SymbolIndex owner;
+
+  // Elements of an array variable, 0 for scalars and everything else.
+  uint32_t length = 0;
+
+  // Structure of a variable of a structure type, its type is then void.
+  SymbolIndex structure = INVALID_SYMBOL;
+
+  uint32_t hash;
+  uint32_t depth;
+};
+
+using Symbols = std::vector<Symbol>;
+
+/*
+ * Scoped symbol table.
+ *
+ * Names are looked up in a flat open-addressing hash map (linear probing,
+ * power of two capacity) from name to the innermost visible declaration.
+ * Every name gets a single bucket for its whole lifetime, shadowing only
+ * swaps the symbol stored in it. Scopes are an undo log of (bucket, previous
+ * symbol) pairs: leaving a scope replays the log back to the scope mark, so
+ * there is no per-scope map to build or tear down.
+ *
+ * Declared symbols are never removed from `symbols`, indices into it stay
+ * valid after their scope is left.
+ */
+class SymbolTable
+{
+public:
+  SymbolTable();
+
+  // Returns INVALID_SYMBOL if the name is already declared in the current
+  // scope.
+  SymbolIndex declare(Symbol sym);
+  SymbolIndex lookup(std::string_view name) const;
+
+  void     enter_scope();
+  void     leave_scope();
+  uint32_t depth() const { return static_cast<uint32_t>(scope_marks.size()); }
+
+  Symbols symbols;
+
+private:
+  struct Bucket
+  {
+    uint32_t    hash;
+    SymbolIndex key; // first symbol declared with this name, owns the key
+    SymbolIndex current;
+  };
+
+  struct UndoEntry
+  {
+    uint32_t    bucket;
+    SymbolIndex previous;
+  };
+
+  static uint32_t hash_name(std::string_view name);
+
+  uint32_t find_bucket(std::string_view name, uint32_t hash) const;
+  void     grow();
+
+  std::vector<Bucket>    buckets;
+  std::vector<UndoEntry> undo_log;
+  std::vector<size_t>    scope_marks;
+  uint32_t               used = 0;
+};
+
+} // namespace wcc
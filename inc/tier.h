@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ir.h"
+#include "jit.h"
+#include "vm.h"
+
+namespace wcc::tier {
+
+/*
+ * Tiered execution of a file. Everything starts out in the bytecode
+ * interpreter, which counts calls per function. A function reaching the
+ * threshold is queued for a background thread, which compiles it to native
+ * code and installs its entry stub in the interpreter's entry for the
+ * function; from then on calls to it run natively. The interpreter never
+ * waits for the compiler and no thread is started before something gets
+ * hot.
+ *
+ * The compiler thread translates the whole module the first time, later
+ * promotions only switch entries over. Native code calls its callees
+ * natively whether they are hot or not. Globals live in the interpreter and
+ * native code accesses them in place.
+ */
+class TieredModule
+{
+public:
+  static constexpr uint32_t DEFAULT_THRESHOLD = 1000;
+
+  // nullptr, with the reason logged, if the file does not compile to
+  // bytecode. `layouts` and `module` are the structure layouts and the IR of
+  // the same file, `options` apply to its native code as far as this CPU
+  // supports them.
+  static std::unique_ptr<TieredModule> create(
+    const AnalyzedFile&               file,
+    const std::vector<StructLayout>&  layouts,
+    std::shared_ptr<const ir::Module> module,
+    uint32_t                          threshold = DEFAULT_THRESHOLD,
+    const x64::CompileOptions&        options   = {});
+
+  ~TieredModule();
+
+  TieredModule(const TieredModule&) = delete;
+  TieredModule& operator=(const TieredModule&) = delete;
+
+  // Calls the function named `name`, see vm::Machine::call.
+  bool call(const SymbolName&            name,
+            const std::vector<VarValue>& args,
+            VarValue&                    result);
+
+  // Blocks until every function promoted so far runs natively, or failed to
+  // compile and stays interpreted.
+  void wait();
+
+  bool is_native(const SymbolName& name) const;
+
+private:
+  TieredModule() = default;
+
+  // Interpreter thread.
+  void promote(uint32_t function);
+
+  // Compiler thread.
+  void compile_loop();
+  void install(uint32_t function);
+
+  std::shared_ptr<const ir::Module> module;
+  x64::CompileOptions               options;
+  vm::Program                       program;
+  std::unique_ptr<vm::Machine>      machine;
+
+  // Owned by the compiler thread.
+  std::unique_ptr<jit::JitModule>   native;
+  std::vector<x64::EncodedFunction> stubs;
+  bool                              native_failed = false;
+
+  std::mutex              lock;
+  std::condition_variable queued;
+  std::condition_variable drained;
+  std::vector<uint32_t>   pending;
+  size_t                  in_flight = 0; // promoted, not installed yet
+  bool                    stopping  = false;
+  std::thread             compiler;
+};
+
+} // namespace wcc::tier
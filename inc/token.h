@@ -49,6 +49,8 @@ enum class TOKENID : size_t
   SINGLE_QUOTE,
   DOUBLE_QUOTE,
   IDENTIFIER,
+  INT_LITERAL,
+  FLOAT_LITERAL,
   END,
 };
 
@@ -117,6 +119,8 @@ constexpr const char* TOKENID_STR[] = {
   [underlay_cast(TOKENID::OP_GRE)] = "OP_GRE",
   [underlay_cast(TOKENID::OP_DOT)] = "OP_DOT",
   [underlay_cast(TOKENID::IDENTIFIER)] = "IDENTIFIER",
+  [underlay_cast(TOKENID::INT_LITERAL)] = "INT_LITERAL",
+  [underlay_cast(TOKENID::FLOAT_LITERAL)] = "FLOAT_LITERAL",
   [underlay_cast(TOKENID::END)] = "END",
 };
 
@@ -22,7 +22,11 @@ struct fmt::formatter<wcc::Token>
   auto format(const wcc::Token& t, FormatContext& ctx)
   {
 
-    return t.id == wcc::TOKENID::IDENTIFIER
+    const bool has_value = t.id == wcc::TOKENID::IDENTIFIER ||
+                           t.id == wcc::TOKENID::INT_LITERAL ||
+                           t.id == wcc::TOKENID::FLOAT_LITERAL;
+
+    return has_value
              ? format_to(ctx.out(),
                          "Token: {} \"{}\"",
                          wcc::TOKENID_STR[mipc::utils::underlay_cast(t.id)],
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ast.h"
+
+namespace wcc {
+
+struct AnalyzedFile;
+
+/*
+ * Straightforward recursive interpreter over the type checked AST: every
+ * expression is re-dispatched on its node kind, operator and type each time
+ * it runs, and arithmetic goes through the constant folder. It is the
+ * reference the bytecode VM (vm.h) is checked against, and the baseline of
+ * its benchmark.
+ */
+class TreeWalker
+{
+public:
+  // Calls nested deeper than this trap instead of overflowing the C++
+  // stack.
+  static constexpr uint32_t MAX_DEPTH = 10000;
+
+  explicit TreeWalker(const AnalyzedFile& file);
+
+  // Calls the function named `name` with canonical `args`. Returns false,
+  // with the reason logged, if there is no such function or the program
+  // traps: integer division by zero, INT_MIN / -1, an array index out of
+  // bounds or too deep recursion.
+  bool call(const SymbolName&            name,
+            const std::vector<VarValue>& args,
+            VarValue&                    result);
+
+  std::vector<VarValue> globals;
+
+private:
+  bool invoke(uint32_t function, std::vector<VarValue> vars, VarValue& result);
+
+  // Runs the statements, loops and branches among the children of `node`.
+  // `returned` is set once a return statement ran, `result` holds its value.
+  bool execute(std::vector<VarValue>& vars,
+               const ASTNode&         node,
+               bool&                  returned,
+               VarValue&              result);
+  bool execute_loop(std::vector<VarValue>& vars,
+                    const ASTNode&         node,
+                    bool&                  returned,
+                    VarValue&              result);
+  bool execute_branch(std::vector<VarValue>& vars,
+                      const ASTNode&         node,
+                      bool&                  returned,
+                      VarValue&              result);
+  bool eval(std::vector<VarValue>& vars, const AstStmt& stmt, VarValue& value);
+  bool eval_operator(std::vector<VarValue>& vars,
+                     const AstStmt&         stmt,
+                     VarValue&              value);
+
+  // Evaluates the index of an element, trapping if it is out of bounds.
+  bool subscript(std::vector<VarValue>& vars,
+                 const AstSymRef&       array,
+                 const AstStmt&         index,
+                 uint64_t&              i);
+  bool element(std::vector<VarValue>& vars,
+               const AstIndex&        index,
+               VarValue*&             place);
+
+  // Fields of a structure take a value each, those of an element of an
+  // array of structures follow the ones of the element before.
+  bool field(std::vector<VarValue>& vars,
+             const AstField&        field,
+             VarValue*&             place);
+  bool lvalue(std::vector<VarValue>& vars,
+              const AstStmt&         target,
+              VarValue*&             place);
+
+  // Value of the first element of an array or field of a structure.
+  VarValue* elements(std::vector<VarValue>& vars, SymbolIndex sym);
+  VarValue& variable(std::vector<VarValue>& vars, SymbolIndex sym);
+
+  const AnalyzedFile&         file;
+  std::vector<const ASTNode*> functions;
+  std::vector<uint32_t>       num_locals; // per function, elements included
+  std::vector<uint32_t>       element_offset; // per array or structure
+  uint32_t                    depth = 0;
+};
+
+} // namespace wcc
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "ast.h"
+#include "symtab.h"
+
+namespace wcc {
+
+constexpr size_t LANG_TYPE_COUNT = underlay_cast(LangType::lt_f64) + 1;
+
+constexpr uint8_t LANG_TYPE_SIZE[] = {
+  [underlay_cast(LangType::lt_void)] = 0,
+  [underlay_cast(LangType::lt_i8)]   = 1,
+  [underlay_cast(LangType::lt_i16)]  = 2,
+  [underlay_cast(LangType::lt_i32)]  = 4,
+  [underlay_cast(LangType::lt_i64)]  = 8,
+  [underlay_cast(LangType::lt_u8)]   = 1,
+  [underlay_cast(LangType::lt_u16)]  = 2,
+  [underlay_cast(LangType::lt_u32)]  = 4,
+  [underlay_cast(LangType::lt_u64)]  = 8,
+  [underlay_cast(LangType::lt_f32)]  = 4,
+  [underlay_cast(LangType::lt_f64)]  = 8,
+};
+
+constexpr bool
+is_float(LangType t)
+{
+  return t == LangType::lt_f32 || t == LangType::lt_f64;
+}
+
+constexpr bool
+is_signed(LangType t)
+{
+  return t >= LangType::lt_i8 && t <= LangType::lt_i64;
+}
+
+constexpr bool
+is_unsigned(LangType t)
+{
+  return t >= LangType::lt_u8 && t <= LangType::lt_u64;
+}
+
+constexpr bool
+is_integer(LangType t)
+{
+  return is_signed(t) || is_unsigned(t);
+}
+
+constexpr uint8_t
+type_size(LangType t)
+{
+  return LANG_TYPE_SIZE[underlay_cast(t)];
+}
+
+// Result type of a binary arithmetic operator: floats win over integers, the
+// wider operand wins, and at equal width unsigned wins over signed. There is
+// no promotion to int, operations happen at the width of their operands.
+constexpr LangType
+arith_result(LangType a, LangType b)
+{
+  if (a == LangType::lt_void || b == LangType::lt_void)
+    return LangType::lt_void;
+
+  if (is_float(a) || is_float(b)) {
+    if (a == LangType::lt_f64 || b == LangType::lt_f64)
+      return LangType::lt_f64;
+
+    return LangType::lt_f32;
+  }
+
+  if (type_size(a) != type_size(b))
+    return type_size(a) > type_size(b) ? a : b;
+
+  return is_unsigned(a) ? a : b;
+}
+
+constexpr ConvKind
+conv_kind(LangType from, LangType to)
+{
+  if (from == LangType::lt_void || to == LangType::lt_void)
+    return from == to ? ConvKind::none : ConvKind::invalid;
+
+  if (from == to)
+    return ConvKind::none;
+
+  if (is_float(from) && is_float(to))
+    return type_size(to) > type_size(from) ? ConvKind::fpext
+                                           : ConvKind::fptrunc;
+
+  if (is_float(to))
+    return is_signed(from) ? ConvKind::sitofp : ConvKind::uitofp;
+
+  if (is_float(from))
+    return is_signed(to) ? ConvKind::fptosi : ConvKind::fptoui;
+
+  if (type_size(to) < type_size(from))
+    return ConvKind::trunc;
+
+  if (type_size(to) == type_size(from))
+    return ConvKind::none;
+
+  return is_signed(from) ? ConvKind::sext : ConvKind::zext;
+}
+
+// True for conversions that may not preserve the value.
+constexpr bool
+is_narrowing(LangType from, LangType to)
+{
+  switch (conv_kind(from, to)) {
+    case ConvKind::trunc:
+    case ConvKind::fptosi:
+    case ConvKind::fptoui:
+    case ConvKind::fptrunc:
+      return true;
+    default:
+      return false;
+  }
+}
+
+template<typename F>
+constexpr auto
+make_type_table(F f)
+{
+  using Entry = decltype(f(LangType::lt_void, LangType::lt_void));
+
+  std::array<std::array<Entry, LANG_TYPE_COUNT>, LANG_TYPE_COUNT> table{};
+
+  for (size_t a = 0; a < LANG_TYPE_COUNT; ++a) {
+    for (size_t b = 0; b < LANG_TYPE_COUNT; ++b)
+      table[a][b] = f(static_cast<LangType>(a), static_cast<LangType>(b));
+  }
+
+  return table;
+}
+
+inline constexpr auto ARITH_RESULT = make_type_table(arith_result);
+inline constexpr auto CONV_KIND    = make_type_table(conv_kind);
+
+static_assert(ARITH_RESULT[underlay_cast(LangType::lt_i32)]
+                          [underlay_cast(LangType::lt_f32)] == LangType::lt_f32);
+static_assert(ARITH_RESULT[underlay_cast(LangType::lt_i32)]
+                          [underlay_cast(LangType::lt_u32)] == LangType::lt_u32);
+static_assert(CONV_KIND[underlay_cast(LangType::lt_f32)]
+                       [underlay_cast(LangType::lt_i32)] == ConvKind::fptosi);
+
+// Type of every statement node, indexed by AstStmt::id.
+struct ExprTypes
+{
+  std::vector<LangType> types;
+
+  LangType operator[](const AstStmt& stmt) const { return types[stmt.id]; }
+};
+
+// Type checking pass. Runs after name resolution, numbers every AstStmt,
+// records its type in `types` and wraps operands needing an implicit
+// conversion in explicit AstConversion nodes, so later phases never have to
+// re-derive types. Linear in the size of the AST.
+bool
+typecheck(AST& ast, const Symbols& symbols, ExprTypes& types);
+
+} // namespace wcc
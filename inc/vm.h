@@ -0,0 +1,269 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+
+namespace wcc {
+struct AnalyzedFile;
+struct StructLayout;
+}
+
+namespace wcc::vm {
+
+/*
+ * Register based bytecode interpreter.
+ *
+ * Every function gets a window of at most 256 registers: its parameters
+ * first, then its locals, then temporaries. An instruction is a 32 bit
+ * record of an opcode and three 8 bit operands A, B and C, or A and a 16 bit
+ * Bx. Registers hold canonical VarValues (see ast.h), so opcodes only exist
+ * per width class: i8 and i16 arithmetic runs as i32 and is narrowed by a
+ * norm opcode, 64 bit add/sub/mul ignores signedness.
+ *
+ * Operand legend: R[x] register of the current window, K[x] constant of the
+ * current function, G[x] global, E[x] array x of the current function
+ * (Function::arrays), sBx Bx read as a signed offset from the next
+ * instruction.
+ */
+#define WCC_VM_OPCODES(X)                                                      \
+  X(mov)      /* R[A] = R[B] */                                                \
+  X(loadk)    /* R[A] = K[Bx] */                                               \
+  X(gload)    /* R[A] = G[Bx] */                                               \
+  X(gstore)   /* G[Bx] = R[A] */                                               \
+  X(aload)    /* R[A] = E[B][R[C]], traps unless R[C] is below its length */   \
+  X(astore)   /* E[B][R[C]] = R[A], likewise */                                \
+  X(add_i32)  /* R[A] = R[B] + R[C] */                                         \
+  X(add_u32)                                                                   \
+  X(add_x64)                                                                   \
+  X(add_f32)                                                                   \
+  X(add_f64)                                                                   \
+  X(sub_i32)  /* R[A] = R[B] - R[C] */                                         \
+  X(sub_u32)                                                                   \
+  X(sub_x64)                                                                   \
+  X(sub_f32)                                                                   \
+  X(sub_f64)                                                                   \
+  X(mul_i32)  /* R[A] = R[B] * R[C] */                                         \
+  X(mul_u32)                                                                   \
+  X(mul_x64)                                                                   \
+  X(mul_f32)                                                                   \
+  X(mul_f64)                                                                   \
+  X(div_i32)  /* R[A] = R[B] / R[C], traps on integer division by zero */      \
+  X(div_u32)                                                                   \
+  X(div_i64)                                                                   \
+  X(div_u64)                                                                   \
+  X(div_f32)                                                                   \
+  X(div_f64)                                                                   \
+  X(mod_i32)  /* R[A] = R[B] % R[C], traps on division by zero */              \
+  X(mod_u32)                                                                   \
+  X(mod_i64)                                                                   \
+  X(mod_u64)                                                                   \
+  X(band)     /* R[A] = R[B] & R[C] */                                         \
+  X(bor)      /* R[A] = R[B] | R[C] */                                         \
+  X(bxor)     /* R[A] = R[B] ^ R[C] */                                         \
+  X(lt_s)     /* R[A] = R[B] < R[C], as i32 0 or 1 */                          \
+  X(lt_u)                                                                      \
+  X(lt_f32)                                                                    \
+  X(lt_f64)                                                                    \
+  X(le_s)                                                                      \
+  X(le_u)                                                                      \
+  X(le_f32)                                                                    \
+  X(le_f64)                                                                    \
+  X(gt_s)                                                                      \
+  X(gt_u)                                                                      \
+  X(gt_f32)                                                                    \
+  X(gt_f64)                                                                    \
+  X(ge_s)                                                                      \
+  X(ge_u)                                                                      \
+  X(ge_f32)                                                                    \
+  X(ge_f64)                                                                    \
+  X(ne_x)                                                                      \
+  X(ne_f32)                                                                    \
+  X(ne_f64)                                                                    \
+  X(tst_x)    /* R[A] = R[B] != 0 */                                           \
+  X(tst_f32)                                                                   \
+  X(tst_f64)                                                                   \
+  X(norm_i8)  /* R[A] = R[B] truncated and extended back to 64 bits */         \
+  X(norm_i16)                                                                  \
+  X(norm_i32)                                                                  \
+  X(norm_u8)                                                                   \
+  X(norm_u16)                                                                  \
+  X(norm_u32)                                                                  \
+  X(s2f32)    /* R[A] = (f32)(i64)R[B] */                                      \
+  X(s2f64)                                                                     \
+  X(u2f32)                                                                     \
+  X(u2f64)                                                                     \
+  X(f32_s)    /* R[A] = (i64)(f32)R[B] */                                      \
+  X(f64_s)                                                                     \
+  X(f32_u)                                                                     \
+  X(f64_u)                                                                     \
+  X(f32_f64)  /* R[A] = (f64)(f32)R[B] */                                      \
+  X(f64_f32)                                                                   \
+  X(addk_i32) /* R[A] = R[B] + K[C] */                                         \
+  X(addk_x64)                                                                  \
+  X(subk_i32) /* R[A] = R[B] - K[C] */                                         \
+  X(subk_x64)                                                                  \
+  X(gadd_i32) /* R[A] = G[B] = G[B] + R[C] */                                  \
+  X(gadd_u32)                                                                  \
+  X(gadd_x64)                                                                  \
+  X(gadd_f32)                                                                  \
+  X(gadd_f64)                                                                  \
+  X(jmp)      /* pc += sBx */                                                  \
+  X(jz)       /* if R[A] == 0, pc += sBx */                                    \
+  X(jnz)      /* if R[A] != 0, pc += sBx */                                    \
+  X(call)     /* R[A] = function Bx called with the window at R[A] */          \
+  X(ret)      /* return R[A] */                                                \
+  X(ret_void)
+
+enum class Op : uint8_t
+{
+#define WCC_VM_ENUM(name) name,
+  WCC_VM_OPCODES(WCC_VM_ENUM)
+#undef WCC_VM_ENUM
+};
+
+struct Instr
+{
+  Op      op;
+  uint8_t a;
+  uint8_t b;
+  uint8_t c;
+
+  uint16_t bx() const { return static_cast<uint16_t>(b | c << 8); }
+  int16_t  sbx() const { return static_cast<int16_t>(bx()); }
+};
+
+static_assert(sizeof(Instr) == 4);
+
+// An array operand of aload and astore: `length` elements of `type`,
+// `stride` bytes apart from `disp` bytes into memory `offset` words into the
+// memory of the global arrays or into the array area of the frame. Arrays
+// pack their elements at their native size, a field of a structure is an
+// array strided by the size of the structure, like native code lays them
+// out.
+struct Array
+{
+  LangType type;
+  uint32_t length;
+  uint32_t offset;
+  bool     global;
+  uint32_t stride;
+  uint32_t disp = 0;
+};
+
+struct Function
+{
+  SymbolName            name;
+  LangType              return_type;
+  std::vector<LangType> params;
+
+  // Size of the register window, parameters and locals included.
+  uint32_t              num_regs = 0;
+  std::vector<Instr>    code;
+  std::vector<VarValue> constants;
+
+  // Arrays the function refers to, at most 256. Its local arrays take
+  // `array_words` words of the frame, zeroed on every call.
+  std::vector<Array> arrays;
+  uint32_t           array_words = 0;
+};
+
+struct Program
+{
+  std::vector<LangType> globals;
+  std::vector<Function> functions;
+
+  // Per global, a length of 0 for scalars. Global arrays take `array_words`
+  // words, their globals slot is unused.
+  std::vector<Array> global_arrays;
+  uint32_t           array_words = 0;
+
+  // Index of the function called `name`, -1 if there is none.
+  int32_t find(const SymbolName& name) const;
+};
+
+// Compiles a type checked file with structures laid out as in `layouts`.
+// Returns false, with the reason logged, if a function does not fit the
+// instruction format: more than 256 registers, 65536 constants or 256
+// arrays.
+bool
+compile(const AnalyzedFile&              file,
+        const std::vector<StructLayout>& layouts,
+        Program&                         program);
+
+/*
+ * Executes a program. Register windows of all active calls live on a single
+ * stack; a callee's window starts at the register holding its first argument
+ * in the caller, so arguments are never copied. Every handler dispatches the
+ * next instruction itself through a computed goto (threaded code), there is
+ * no central switch.
+ */
+class Machine
+{
+public:
+  // Registers available to all active calls together.
+  static constexpr size_t STACK_SIZE = 1 << 18;
+
+  // Words of local arrays available to all active calls together.
+  static constexpr size_t ARRAY_STACK_SIZE = 1 << 18;
+
+  // Native code a function's calls are redirected to: reads the arguments
+  // from consecutive registers and returns the bits of its result, the upper
+  // bits of results narrower than 64 bits undefined.
+  using NativeEntry = uint64_t (*)(const VarValue* args);
+
+  explicit Machine(const Program& program);
+
+  // Calls function number `function` with canonical `args`. Returns false,
+  // with the reason logged, on a trap: integer division by zero, an array
+  // index out of bounds or stack overflow.
+  bool call(uint32_t                     function,
+            const std::vector<VarValue>& args,
+            VarValue&                    result);
+
+  // Every call, from the outside or from bytecode, goes through the entry
+  // of its callee. Installing native code there switches all later calls
+  // over; it may happen from another thread while the machine runs.
+  void set_native(uint32_t function, NativeEntry entry);
+  bool is_native(uint32_t function) const;
+
+  // Interpreted calls are counted per function. The call that brings a
+  // count to `hot_threshold` invokes `on_hot` with the function, on the
+  // thread running the machine. 0 disables counting.
+  uint32_t                      hot_threshold = 0;
+  std::function<void(uint32_t)> on_hot;
+
+  std::vector<VarValue> globals;
+  std::vector<VarValue> elements; // of global arrays
+
+private:
+  struct Frame
+  {
+    const Function* fn;
+    const Instr*    pc;
+    VarValue*       regs;
+    VarValue*       arrays;
+  };
+
+  struct Entry
+  {
+    std::atomic<NativeEntry> native{ nullptr };
+    uint32_t                 calls = 0;
+  };
+
+  // True if the call went to native code, `result` then holds its value.
+  bool call_native(uint32_t function, const VarValue* args, VarValue& result);
+
+  const Program&           program;
+  std::vector<VarValue>    stack;
+  std::vector<VarValue>    array_stack;
+  std::vector<Frame>       frames;
+  std::unique_ptr<Entry[]> entries;
+};
+
+} // namespace wcc::vm
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#include <fmt/format.h>
+
+namespace wcc {
+
+/*
+ * Output sink of the code generators. Text is collected in one fixed buffer
+ * and handed to write(2) only when the buffer fills up or on flush(), so an
+ * assembly listing costs a handful of system calls no matter how many lines
+ * it has. Formatting goes straight into the buffer.
+ */
+class BufferedWriter
+{
+public:
+  static constexpr size_t CAPACITY = 64 * 1024;
+
+  explicit BufferedWriter(int fd);
+  ~BufferedWriter();
+
+  BufferedWriter(const BufferedWriter&) = delete;
+  BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+  void write(const void* data, size_t size);
+  void write(std::string_view text) { write(text.data(), text.size()); }
+
+  void put(char c)
+  {
+    if (used == CAPACITY)
+      flush();
+
+    buffer[used++] = c;
+  }
+
+  template<typename... Args>
+  void print(fmt::format_string<Args...> format, Args&&... args)
+  {
+    const auto result = fmt::format_to_n(
+      buffer + used, CAPACITY - used, format, std::forward<Args>(args)...);
+
+    if (result.size <= CAPACITY - used) {
+      used += result.size;
+      return;
+    }
+
+    // Did not fit, start over on an empty buffer.
+    flush();
+
+    if (result.size <= CAPACITY) {
+      fmt::format_to(buffer, format, std::forward<Args>(args)...);
+      used = result.size;
+      return;
+    }
+
+    write(fmt::format(format, std::forward<Args>(args)...));
+  }
+
+  // Writes out the buffered bytes. Returns false if any write so far failed.
+  bool flush();
+
+  // Bytes handed to the writer so far.
+  size_t written() const { return total + used; }
+
+private:
+  int    fd;
+  size_t used   = 0;
+  size_t total  = 0;
+  bool   failed = false;
+  char   buffer[CAPACITY];
+};
+
+} // namespace wcc
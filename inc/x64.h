@@ -0,0 +1,596 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "bitset.h"
+#include "ir.h"
+
+namespace wcc {
+class BufferedWriter;
+}
+
+namespace wcc::x64 {
+
+/*
+ * x86-64 machine IR.
+ *
+ * Instruction selection turns SSA IR into two-address machine instructions
+ * over an unbounded set of virtual registers. The register allocator then
+ * rewrites every virtual register into a physical one or a frame slot, after
+ * which the function is ready for the assembly printer. Registers are
+ * numbered like their hardware encoding.
+ */
+
+enum class Reg : uint8_t
+{
+  rax,
+  rcx,
+  rdx,
+  rbx,
+  rsp,
+  rbp,
+  rsi,
+  rdi,
+  r8,
+  r9,
+  r10,
+  r11,
+  r12,
+  r13,
+  r14,
+  r15,
+  xmm0,
+  xmm1,
+  xmm2,
+  xmm3,
+  xmm4,
+  xmm5,
+  xmm6,
+  xmm7,
+  xmm8,
+  xmm9,
+  xmm10,
+  xmm11,
+  xmm12,
+  xmm13,
+  xmm14,
+  xmm15,
+  none,
+};
+
+constexpr size_t REG_COUNT = underlay_cast(Reg::none);
+
+constexpr bool
+is_xmm(Reg r)
+{
+  return r >= Reg::xmm0 && r <= Reg::xmm15;
+}
+
+// Low three bits of the register number as used in ModRM/SIB.
+constexpr uint8_t
+reg_code(Reg r)
+{
+  return underlay_cast(r) & 7;
+}
+
+// Register names by operand size: 1, 2, 4 and 8 bytes.
+constexpr const char* GPR_NAMES[16][4] = {
+  { "al", "ax", "eax", "rax" },     { "cl", "cx", "ecx", "rcx" },
+  { "dl", "dx", "edx", "rdx" },     { "bl", "bx", "ebx", "rbx" },
+  { "spl", "sp", "esp", "rsp" },    { "bpl", "bp", "ebp", "rbp" },
+  { "sil", "si", "esi", "rsi" },    { "dil", "di", "edi", "rdi" },
+  { "r8b", "r8w", "r8d", "r8" },    { "r9b", "r9w", "r9d", "r9" },
+  { "r10b", "r10w", "r10d", "r10" }, { "r11b", "r11w", "r11d", "r11" },
+  { "r12b", "r12w", "r12d", "r12" }, { "r13b", "r13w", "r13d", "r13" },
+  { "r14b", "r14w", "r14d", "r14" }, { "r15b", "r15w", "r15d", "r15" },
+};
+
+constexpr const char* XMM_NAMES[16] = {
+  "xmm0", "xmm1", "xmm2",  "xmm3",  "xmm4",  "xmm5",  "xmm6",  "xmm7",
+  "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15",
+};
+
+// The same registers 32 bytes wide (AVX).
+constexpr const char* YMM_NAMES[16] = {
+  "ymm0", "ymm1", "ymm2",  "ymm3",  "ymm4",  "ymm5",  "ymm6",  "ymm7",
+  "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15",
+};
+
+// System V AMD64 calling convention.
+constexpr Reg INT_ARG_REGS[] = { Reg::rdi, Reg::rsi, Reg::rdx,
+                                 Reg::rcx, Reg::r8,  Reg::r9 };
+
+constexpr Reg FLOAT_ARG_REGS[] = { Reg::xmm0, Reg::xmm1, Reg::xmm2, Reg::xmm3,
+                                   Reg::xmm4, Reg::xmm5, Reg::xmm6, Reg::xmm7 };
+
+constexpr bool
+is_callee_saved(Reg r)
+{
+  switch (r) {
+    case Reg::rbx:
+    case Reg::rbp:
+    case Reg::r12:
+    case Reg::r13:
+    case Reg::r14:
+    case Reg::r15:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Bytes below the stack pointer a leaf function may use without moving it.
+constexpr uint32_t RED_ZONE_SIZE = 128;
+
+enum class RegClass : uint8_t
+{
+  gpr,
+  xmm,
+  vec, // 16 byte packed values, in xmm registers
+  ymm, // 32 byte packed values, in ymm registers (AVX2)
+};
+
+// Whether values of the class live in xmm registers.
+constexpr bool
+in_xmm(RegClass cls)
+{
+  return cls != RegClass::gpr;
+}
+
+// Condition codes, numbered like the low nibble of the Jcc/SETcc/CMOVcc
+// opcodes. A condition and its negation differ in the lowest bit.
+enum class Cond : uint8_t
+{
+  o,
+  no,
+  b,
+  ae,
+  e,
+  ne,
+  be,
+  a,
+  s,
+  ns,
+  p,
+  np,
+  l,
+  ge,
+  le,
+  g,
+};
+
+constexpr const char* COND_STR[] = {
+  [underlay_cast(Cond::o)]  = "o",
+  [underlay_cast(Cond::no)] = "no",
+  [underlay_cast(Cond::b)]  = "b",
+  [underlay_cast(Cond::ae)] = "ae",
+  [underlay_cast(Cond::e)]  = "e",
+  [underlay_cast(Cond::ne)] = "ne",
+  [underlay_cast(Cond::be)] = "be",
+  [underlay_cast(Cond::a)]  = "a",
+  [underlay_cast(Cond::s)]  = "s",
+  [underlay_cast(Cond::ns)] = "ns",
+  [underlay_cast(Cond::p)]  = "p",
+  [underlay_cast(Cond::np)] = "np",
+  [underlay_cast(Cond::l)]  = "l",
+  [underlay_cast(Cond::ge)] = "ge",
+  [underlay_cast(Cond::le)] = "le",
+  [underlay_cast(Cond::g)]  = "g",
+};
+
+constexpr Cond
+invert(Cond c)
+{
+  return static_cast<Cond>(underlay_cast(c) ^ 1);
+}
+
+enum class MOp : uint8_t
+{
+  mov,    // dst, src: reg/mem <- reg/imm, reg <- mem
+  movsx,  // dst, src: sign extend src_size to size
+  movzx,  // dst, src: zero extend src_size to size
+  lea,    // dst, mem, or dst, base, index (either may be none)
+  load,   // dst, base, index: size bytes at base + index * scale + disp
+  store,  // base, index, src: likewise
+  add,    // dst, src: dst op= src
+  sub,
+  imul,
+  and_,
+  or_,
+  xor_,
+  shl,    // dst, imm
+  shr,
+  sar,
+  neg,    // dst
+  cmp,    // lhs, rhs
+  test,   // lhs, rhs
+  setcc,  // dst (byte)
+  cmov,   // dst, src
+  cdq,    // sign extend rax into rdx (cltd/cqto)
+  idiv,   // divisor, implicit rdx:rax
+  div,
+  imulw,  // factor, rdx:rax = rax * factor
+  mulw,
+  movs,   // movss/movsd, size 4 or 8
+  movq,   // gpr <-> xmm bit copy, size 4 (movd) or 8
+  adds,   // addss/addsd
+  subs,
+  muls,
+  divs,
+  ucomis, // lhs, rhs
+  xorps,  // dst, src
+  cvtsi2s,  // dst xmm (size), src gpr (src_size)
+  cvtts2si, // dst gpr (size), src xmm (src_size)
+  cvts2s,   // dst xmm (size), src xmm (src_size)
+  movups,   // dst, src: all 16 bytes
+  addp,     // addps/addpd, size 4 or 8
+  subp,
+  mulp,
+  divp,
+  padd,     // dst, src: 32 bit lanes
+  psub,
+  pmull,
+  pand,
+  por,
+  pxor,
+  insertps, // dst, src, imm: lane 0 of src into the lane of imm bits 5:4
+  movlhps,  // dst, src: lane 0 of src into lane 1 of dst, 64 bit lanes
+  pinsrd,   // dst xmm, src gpr, imm: lane
+  pextrd,   // dst gpr, src xmm, imm: lane
+  pshufd,   // dst, src, imm: lane i of dst from lane (imm >> 2i) & 3
+  broadcast, // dst ymm, src xmm: lane 0 of size bytes into every lane
+  vfmadd231,  // dst, a, b: dst = a * b + dst, one rounding (FMA3)
+  vfmsub231,  // dst = a * b - dst
+  vfnmadd231, // dst = -(a * b) + dst
+  rep_stos, // rep stosq: rcx words of rax to rdi onwards
+  ud2,      // traps
+  push,
+  pop,
+  jmp,    // label
+  jcc,    // label
+  call,   // function
+  tail_call, // function: the epilogue, then a jump to the function
+  ret,
+};
+
+constexpr const char* MOP_STR[] = {
+  [underlay_cast(MOp::mov)]        = "mov",
+  [underlay_cast(MOp::movsx)]      = "movsx",
+  [underlay_cast(MOp::movzx)]      = "movzx",
+  [underlay_cast(MOp::lea)]        = "lea",
+  [underlay_cast(MOp::load)]       = "load",
+  [underlay_cast(MOp::store)]      = "store",
+  [underlay_cast(MOp::add)]        = "add",
+  [underlay_cast(MOp::sub)]        = "sub",
+  [underlay_cast(MOp::imul)]       = "imul",
+  [underlay_cast(MOp::and_)]       = "and",
+  [underlay_cast(MOp::or_)]        = "or",
+  [underlay_cast(MOp::xor_)]       = "xor",
+  [underlay_cast(MOp::shl)]        = "shl",
+  [underlay_cast(MOp::shr)]        = "shr",
+  [underlay_cast(MOp::sar)]        = "sar",
+  [underlay_cast(MOp::neg)]        = "neg",
+  [underlay_cast(MOp::cmp)]        = "cmp",
+  [underlay_cast(MOp::test)]       = "test",
+  [underlay_cast(MOp::setcc)]      = "setcc",
+  [underlay_cast(MOp::cmov)]       = "cmov",
+  [underlay_cast(MOp::cdq)]        = "cdq",
+  [underlay_cast(MOp::idiv)]       = "idiv",
+  [underlay_cast(MOp::div)]        = "div",
+  [underlay_cast(MOp::imulw)]      = "imul",
+  [underlay_cast(MOp::mulw)]       = "mul",
+  [underlay_cast(MOp::movs)]       = "movs",
+  [underlay_cast(MOp::movq)]       = "movq",
+  [underlay_cast(MOp::adds)]       = "adds",
+  [underlay_cast(MOp::subs)]       = "subs",
+  [underlay_cast(MOp::muls)]       = "muls",
+  [underlay_cast(MOp::divs)]       = "divs",
+  [underlay_cast(MOp::ucomis)]     = "ucomis",
+  [underlay_cast(MOp::xorps)]      = "xorps",
+  [underlay_cast(MOp::cvtsi2s)]    = "cvtsi2s",
+  [underlay_cast(MOp::cvtts2si)]   = "cvtts2si",
+  [underlay_cast(MOp::cvts2s)]     = "cvts2s",
+  [underlay_cast(MOp::movups)]     = "movups",
+  [underlay_cast(MOp::addp)]       = "addp",
+  [underlay_cast(MOp::subp)]       = "subp",
+  [underlay_cast(MOp::mulp)]       = "mulp",
+  [underlay_cast(MOp::divp)]       = "divp",
+  [underlay_cast(MOp::padd)]       = "paddd",
+  [underlay_cast(MOp::psub)]       = "psubd",
+  [underlay_cast(MOp::pmull)]      = "pmulld",
+  [underlay_cast(MOp::pand)]       = "pand",
+  [underlay_cast(MOp::por)]        = "por",
+  [underlay_cast(MOp::pxor)]       = "pxor",
+  [underlay_cast(MOp::insertps)]   = "insertps",
+  [underlay_cast(MOp::movlhps)]    = "movlhps",
+  [underlay_cast(MOp::pinsrd)]     = "pinsrd",
+  [underlay_cast(MOp::pextrd)]     = "pextrd",
+  [underlay_cast(MOp::pshufd)]     = "pshufd",
+  [underlay_cast(MOp::broadcast)]  = "vpbroadcast",
+  [underlay_cast(MOp::vfmadd231)]  = "vfmadd231",
+  [underlay_cast(MOp::vfmsub231)]  = "vfmsub231",
+  [underlay_cast(MOp::vfnmadd231)] = "vfnmadd231",
+  [underlay_cast(MOp::rep_stos)]   = "rep stosq",
+  [underlay_cast(MOp::ud2)]        = "ud2",
+  [underlay_cast(MOp::push)]       = "push",
+  [underlay_cast(MOp::pop)]        = "pop",
+  [underlay_cast(MOp::jmp)]        = "jmp",
+  [underlay_cast(MOp::jcc)]        = "jcc",
+  [underlay_cast(MOp::call)]       = "call",
+  [underlay_cast(MOp::tail_call)]  = "jmp",
+  [underlay_cast(MOp::ret)]        = "ret",
+};
+
+enum class OperandKind : uint8_t
+{
+  none,
+  vreg,   // value: virtual register
+  reg,    // value: Reg
+  imm,    // imm
+  frame,  // value: frame slot, imm: byte offset inside the slot
+  arg,    // value: incoming stack argument number
+  global, // value: global number
+  label,  // value: block
+  func,   // value: function number
+};
+
+struct Operand
+{
+  OperandKind kind  = OperandKind::none;
+  uint32_t    value = 0;
+  int64_t     imm   = 0;
+
+  bool operator==(const Operand& other) const
+  {
+    return kind == other.kind && value == other.value && imm == other.imm;
+  }
+
+  bool is_reg() const { return kind == OperandKind::reg; }
+  bool is_vreg() const { return kind == OperandKind::vreg; }
+  bool is_imm() const { return kind == OperandKind::imm; }
+
+  bool is_mem() const
+  {
+    return kind == OperandKind::frame || kind == OperandKind::arg ||
+           kind == OperandKind::global;
+  }
+
+  Reg reg() const { return static_cast<Reg>(value); }
+};
+
+inline Operand
+vreg(uint32_t v)
+{
+  return Operand{ OperandKind::vreg, v, 0 };
+}
+
+inline Operand
+preg(Reg r)
+{
+  return Operand{ OperandKind::reg, underlay_cast(r), 0 };
+}
+
+inline Operand
+imm(int64_t value)
+{
+  return Operand{ OperandKind::imm, 0, value };
+}
+
+inline Operand
+label(uint32_t block)
+{
+  return Operand{ OperandKind::label, block, 0 };
+}
+
+struct MInstr
+{
+  MOp     op;
+  uint8_t size     = 8; // operand size in bytes
+  uint8_t src_size = 0; // source size of extensions and conversions
+  Cond    cond     = Cond::e;
+
+  uint8_t num_ops = 0;
+  Operand ops[3];
+
+  // Address of a lea, load or store with base and index registers:
+  // base + index * scale + disp.
+  uint8_t scale = 1;
+  int32_t disp  = 0;
+
+  // Packed operation on ymm registers, VEX.256 encoded.
+  bool ymm = false;
+
+  // Argument registers read by a call or a tail call, result registers read
+  // by a ret.
+  uint8_t int_args   = 0;
+  uint8_t float_args = 0;
+};
+
+constexpr bool
+is_fma(MOp op)
+{
+  return op == MOp::vfmadd231 || op == MOp::vfmsub231 ||
+         op == MOp::vfnmadd231;
+}
+
+// How an instruction accesses its explicit operands.
+enum OperandUse : uint8_t
+{
+  USE = 1,
+  DEF = 2,
+};
+
+uint8_t
+operand_use(const MInstr& instr, size_t i);
+
+struct MBlock
+{
+  std::vector<MInstr> instrs;
+};
+
+// Register allocation quality of one function.
+struct SpillStats
+{
+  uint32_t intervals = 0; // live intervals allocated
+  uint32_t spilled   = 0; // intervals kept in their stack slot throughout
+  uint32_t split     = 0; // intervals moved to their stack slot part way
+  uint32_t reloads   = 0; // loads from stack slots inserted
+  uint32_t stores    = 0; // stores to stack slots inserted
+};
+
+struct MFunction
+{
+  std::string name;
+
+  std::vector<MBlock>   blocks;
+  std::vector<RegClass> vregs;
+
+  // Frame slots of the local arrays, the first ones. Spill slots follow.
+  uint32_t array_slots = 0;
+
+  // Filled in by register allocation.
+  uint32_t         num_slots  = 0;
+  uint32_t         frame_size = 0; // bytes below the saved registers
+  bool             leaf       = true;
+  std::vector<Reg> saved; // callee saved registers to preserve
+  SpillStats       stats;
+
+  uint32_t new_vreg(RegClass cls)
+  {
+    vregs.push_back(cls);
+    return static_cast<uint32_t>(vregs.size() - 1);
+  }
+};
+
+struct MGlobal
+{
+  std::string name;
+  uint32_t    size;
+};
+
+// Globals are aligned to the largest power of two dividing their size, up
+// to 16 bytes.
+uint32_t
+global_alignment(const MGlobal& global);
+
+struct MModule
+{
+  std::vector<MGlobal>   globals;
+  std::vector<MFunction> functions;
+};
+
+// Offset from rbp of a frame slot or an incoming stack argument. Callee
+// saved registers are pushed right below the saved rbp, the slots follow.
+int64_t
+frame_offset(const MFunction& fn, const Operand& op);
+
+// Whether the prologue moves rsp below the frame. Leaf functions keep small
+// frames in the red zone.
+bool
+allocates_frame(const MFunction& fn);
+
+struct CompileOptions
+{
+  // Contract a float multiplication whose only use is an addition or
+  // subtraction into one FMA3 instruction (-ffp-contract=fast). The result
+  // is rounded once, so it can differ from the separate operations.
+  bool fma = false;
+
+  // Run 32 byte vectors as AVX2 ymm operations, otherwise as two SSE
+  // halves each.
+  bool avx2 = false;
+};
+
+MFunction
+select_function(const ir::Module&     module,
+                const ir::Function&   fn,
+                const CompileOptions& options = {});
+
+// Successor blocks, read off the jumps ending a block.
+std::vector<uint32_t>
+block_successors(const MFunction& fn, uint32_t block);
+
+// Virtual registers live on entry and exit of every block.
+struct Liveness
+{
+  std::vector<DenseBitset> live_in;
+  std::vector<DenseBitset> live_out;
+};
+
+Liveness
+compute_liveness(const MFunction& fn);
+
+// Linear scan register allocation (Poletto and Sarkar) with interval
+// splitting. Maps every virtual register to a physical register, a stack
+// slot or a register up to some point and its slot afterwards, lays out the
+// frame and records SpillStats.
+void
+allocate_registers(MFunction& fn);
+
+// Orders the blocks so that every branch falls through to the successor
+// it is predicted to take, by static heuristics as there is no profile:
+// loops keep running, branches into returns and traps are not taken.
+// Traps are placed last, the entry stays first.
+void
+layout_blocks(MFunction& fn);
+
+// Drops jumps to the next block in layout order.
+void
+remove_fallthrough_jumps(MFunction& fn);
+
+// Instruction selection, register allocation and cleanup of a whole module.
+MModule
+compile_module(const ir::Module& module, const CompileOptions& options = {});
+
+// Prints the module as GNU assembler (AT&T syntax) source.
+void
+emit_asm(const MModule& module, BufferedWriter& out);
+
+enum class RelocKind : uint8_t
+{
+  pc32,  // R_X86_64_PC32, rip relative data access
+  plt32, // R_X86_64_PLT32, call
+};
+
+// A 32 bit field in .text referring to a function or a global, resolved by
+// the linker or by the executable writer.
+struct Relocation
+{
+  uint32_t    offset; // of the field in .text
+  RelocKind   kind;
+  OperandKind target; // func or global
+  uint32_t    index;
+  int64_t     addend;
+};
+
+struct EncodedFunction
+{
+  uint32_t offset;
+  uint32_t size;
+};
+
+// Machine code of a module, functions laid out one after another.
+struct MachineCode
+{
+  std::vector<uint8_t>         text;
+  std::vector<EncodedFunction> functions;
+  std::vector<Relocation>      relocs;
+};
+
+// Encodes the module into x86-64 machine code. Jumps inside functions are
+// resolved, references to functions and globals are left as relocations.
+MachineCode
+encode_module(const MModule& module);
+
+// Appends an entry stub for `fn`, function number `index` of the module: a
+// System V function `uint64_t stub(const uint64_t* args)` that loads the
+// arguments, one per 8 bytes, into the registers and stack slots `fn`
+// expects, calls it and returns the bits of its result in rax. The call is
+// left as a relocation like the calls between functions.
+EncodedFunction
+encode_entry_stub(const ir::Function& fn, uint32_t index, MachineCode& code);
+
+} // namespace wcc::x64
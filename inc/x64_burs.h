@@ -0,0 +1,200 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "ir.h"
+#include "util.h"
+
+namespace wcc::x64::burs {
+
+/*
+ * Tree pattern rules of the bottom up rewrite system (BURS) selecting
+ * integer arithmetic.
+ *
+ * Expression trees are cut from the SSA IR: a pure integer operation whose
+ * only use is an operation of the same block becomes a subtree of that
+ * user, and so does a global load with no store or call before the root.
+ * Every node is labeled bottom up with the cheapest way to derive each
+ * nonterminal from it, the root is then reduced as a register, emitting the
+ * instructions of the chosen rules. A rule derives its nonterminal `lhs`
+ * from a node with opcode `op` whose operands derive `kids`, or, as a
+ * chain rule (op nop), from another nonterminal of the same node.
+ */
+
+enum class Nt : uint8_t
+{
+  reg,    // value in a register
+  con,    // constant
+  imm,    // constant fitting the immediate field
+  mem,    // global variable, read as a memory operand
+  count,  // constant 1 to 3, shift of an index
+  factor, // constant 3, 5 or 9, x + x * 2, 4 or 8
+  index,  // register times 2, 4 or 8
+  pair,   // base register plus scaled index
+  addr,   // base, index and displacement, what one lea computes
+  none,
+};
+
+constexpr size_t NT_COUNT = underlay_cast(Nt::none);
+
+// How a matched rule is emitted.
+enum class Action : uint8_t
+{
+  load_imm,  // reg <- con: materialize the constant
+  load_mem,  // reg <- mem: move from the global
+  lea,       // reg <- addr: compute the address
+  via,       // chain rule that emits nothing, the operand carries over
+  alu,       // reg <- op(reg, x): copy the left operand, apply op
+  alu_swap,  // reg <- op(x, reg) of a commutative op, as op(reg, x)
+  scale,     // index <- shl(reg, count)
+  square,    // pair <- mul(reg, factor): reg + reg * (factor - 1)
+  base_idx,  // pair <- add(reg, index)
+  idx_base,  // pair <- add(index, reg)
+  base_reg,  // pair <- add(reg, reg), scale 1
+  disp,      // addr <- add(x, imm) or add(imm, x)
+};
+
+struct Rule
+{
+  Nt         lhs;
+  ir::Opcode op;
+  Nt         kids[2];
+  uint8_t    cost;
+  Action     action;
+};
+
+using ir::Opcode;
+
+constexpr Rule RULES[] = {
+  // Chain rules.
+  { Nt::reg, Opcode::nop, { Nt::con, Nt::none }, 1, Action::load_imm },
+  { Nt::reg, Opcode::nop, { Nt::mem, Nt::none }, 1, Action::load_mem },
+  { Nt::reg, Opcode::nop, { Nt::addr, Nt::none }, 1, Action::lea },
+  { Nt::addr, Opcode::nop, { Nt::pair, Nt::none }, 0, Action::via },
+  { Nt::addr, Opcode::nop, { Nt::index, Nt::none }, 0, Action::via },
+
+  // Two address arithmetic, the right operand a register, an immediate or
+  // a memory operand.
+  { Nt::reg, Opcode::add, { Nt::reg, Nt::reg }, 1, Action::alu },
+  { Nt::reg, Opcode::add, { Nt::reg, Nt::imm }, 1, Action::alu },
+  { Nt::reg, Opcode::add, { Nt::reg, Nt::mem }, 1, Action::alu },
+  { Nt::reg, Opcode::add, { Nt::mem, Nt::reg }, 1, Action::alu_swap },
+  { Nt::reg, Opcode::add, { Nt::imm, Nt::reg }, 1, Action::alu_swap },
+  { Nt::reg, Opcode::sub, { Nt::reg, Nt::reg }, 1, Action::alu },
+  { Nt::reg, Opcode::sub, { Nt::reg, Nt::imm }, 1, Action::alu },
+  { Nt::reg, Opcode::sub, { Nt::reg, Nt::mem }, 1, Action::alu },
+  { Nt::reg, Opcode::mul, { Nt::reg, Nt::reg }, 3, Action::alu },
+  { Nt::reg, Opcode::mul, { Nt::reg, Nt::imm }, 3, Action::alu },
+  { Nt::reg, Opcode::mul, { Nt::reg, Nt::mem }, 3, Action::alu },
+  { Nt::reg, Opcode::mul, { Nt::mem, Nt::reg }, 3, Action::alu_swap },
+  { Nt::reg, Opcode::mul, { Nt::imm, Nt::reg }, 3, Action::alu_swap },
+  { Nt::reg, Opcode::bit_and, { Nt::reg, Nt::reg }, 1, Action::alu },
+  { Nt::reg, Opcode::bit_and, { Nt::reg, Nt::imm }, 1, Action::alu },
+  { Nt::reg, Opcode::bit_and, { Nt::reg, Nt::mem }, 1, Action::alu },
+  { Nt::reg, Opcode::bit_and, { Nt::mem, Nt::reg }, 1, Action::alu_swap },
+  { Nt::reg, Opcode::bit_and, { Nt::imm, Nt::reg }, 1, Action::alu_swap },
+  { Nt::reg, Opcode::bit_or, { Nt::reg, Nt::reg }, 1, Action::alu },
+  { Nt::reg, Opcode::bit_or, { Nt::reg, Nt::imm }, 1, Action::alu },
+  { Nt::reg, Opcode::bit_or, { Nt::reg, Nt::mem }, 1, Action::alu },
+  { Nt::reg, Opcode::bit_or, { Nt::mem, Nt::reg }, 1, Action::alu_swap },
+  { Nt::reg, Opcode::bit_or, { Nt::imm, Nt::reg }, 1, Action::alu_swap },
+  { Nt::reg, Opcode::bit_xor, { Nt::reg, Nt::reg }, 1, Action::alu },
+  { Nt::reg, Opcode::bit_xor, { Nt::reg, Nt::imm }, 1, Action::alu },
+  { Nt::reg, Opcode::bit_xor, { Nt::reg, Nt::mem }, 1, Action::alu },
+  { Nt::reg, Opcode::bit_xor, { Nt::mem, Nt::reg }, 1, Action::alu_swap },
+  { Nt::reg, Opcode::bit_xor, { Nt::imm, Nt::reg }, 1, Action::alu_swap },
+  { Nt::reg, Opcode::shl, { Nt::reg, Nt::imm }, 1, Action::alu },
+
+  // Address arithmetic for lea.
+  { Nt::index, Opcode::shl, { Nt::reg, Nt::count }, 0, Action::scale },
+  { Nt::pair, Opcode::mul, { Nt::reg, Nt::factor }, 0, Action::square },
+  { Nt::pair, Opcode::mul, { Nt::factor, Nt::reg }, 0, Action::square },
+  { Nt::pair, Opcode::add, { Nt::reg, Nt::index }, 0, Action::base_idx },
+  { Nt::pair, Opcode::add, { Nt::index, Nt::reg }, 0, Action::idx_base },
+  { Nt::pair, Opcode::add, { Nt::reg, Nt::reg }, 0, Action::base_reg },
+  { Nt::addr, Opcode::add, { Nt::pair, Nt::imm }, 0, Action::disp },
+  { Nt::addr, Opcode::add, { Nt::index, Nt::imm }, 0, Action::disp },
+  { Nt::addr, Opcode::add, { Nt::reg, Nt::imm }, 1, Action::disp },
+  { Nt::addr, Opcode::add, { Nt::imm, Nt::pair }, 0, Action::disp },
+  { Nt::addr, Opcode::add, { Nt::imm, Nt::index }, 0, Action::disp },
+  { Nt::addr, Opcode::add, { Nt::imm, Nt::reg }, 1, Action::disp },
+};
+
+constexpr size_t RULE_COUNT   = std::size(RULES);
+constexpr size_t OPCODE_COUNT = underlay_cast(Opcode::ret) + 1;
+
+// Rules of one opcode, as a range of Matchers::order. Chain rules are
+// those of nop.
+struct RuleRange
+{
+  uint8_t begin = 0;
+  uint8_t end   = 0;
+};
+
+// The rule table indexed by opcode, built at compile time.
+struct Matchers
+{
+  std::array<uint8_t, RULE_COUNT>     order{};
+  std::array<RuleRange, OPCODE_COUNT> by_op{};
+};
+
+constexpr Matchers
+build_matchers()
+{
+  Matchers m;
+  uint8_t  next = 0;
+
+  for (size_t op = 0; op < OPCODE_COUNT; ++op) {
+    m.by_op[op].begin = next;
+
+    for (size_t r = 0; r < RULE_COUNT; ++r) {
+      if (underlay_cast(RULES[r].op) == op)
+        m.order[next++] = static_cast<uint8_t>(r);
+    }
+
+    m.by_op[op].end = next;
+  }
+
+  return m;
+}
+
+constexpr Matchers MATCHERS = build_matchers();
+
+// Every rule derives a nonterminal, chain rules from exactly one other,
+// base rules from a node with two operands.
+constexpr bool
+rules_well_formed()
+{
+  for (const Rule& rule : RULES) {
+    if (rule.lhs == Nt::none || rule.kids[0] == Nt::none)
+      return false;
+
+    const bool chain = rule.op == Opcode::nop;
+
+    if (chain != (rule.kids[1] == Nt::none))
+      return false;
+
+    if (chain && rule.lhs == rule.kids[0])
+      return false;
+
+    if (!chain && !ir::is_binary(rule.op))
+      return false;
+  }
+
+  return true;
+}
+
+static_assert(rules_well_formed(), "malformed BURS rule");
+static_assert(RULE_COUNT < 256, "rule numbers are bytes");
+
+// Opcodes trees are built of.
+constexpr bool
+is_tree_op(Opcode op)
+{
+  return MATCHERS.by_op[underlay_cast(op)].begin !=
+           MATCHERS.by_op[underlay_cast(op)].end &&
+         op != Opcode::nop;
+}
+
+} // namespace wcc::x64::burs
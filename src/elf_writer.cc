@@ -0,0 +1,421 @@
+#include "elf_writer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+namespace wcc::elf {
+
+struct MappedOutput
+{
+  const char* path;
+  int         fd   = -1;
+  uint8_t*    data = nullptr;
+  size_t      size = 0;
+};
+
+static bool
+map_output(MappedOutput& out, size_t size, mode_t mode)
+{
+  out.fd = open(out.path, O_RDWR | O_CREAT | O_TRUNC, mode);
+
+  if (out.fd < 0) {
+    spdlog::error("Cannot open {}: {}", out.path, strerror(errno));
+    return false;
+  }
+
+  if (fchmod(out.fd, mode) != 0 || ftruncate(out.fd, size) != 0) {
+    spdlog::error("Cannot resize {}: {}", out.path, strerror(errno));
+    close(out.fd);
+    return false;
+  }
+
+  void* data =
+    mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, out.fd, 0);
+
+  if (data == MAP_FAILED) {
+    spdlog::error("Cannot map {}: {}", out.path, strerror(errno));
+    close(out.fd);
+    return false;
+  }
+
+  out.data = static_cast<uint8_t*>(data);
+  out.size = size;
+  return true;
+}
+
+static bool
+unmap_output(MappedOutput& out)
+{
+  bool ok = munmap(out.data, out.size) == 0;
+  ok      = close(out.fd) == 0 && ok;
+
+  if (!ok)
+    spdlog::error("Cannot write {}: {}", out.path, strerror(errno));
+
+  return ok;
+}
+
+template<typename T>
+static void
+store(MappedOutput& out, size_t offset, const T& value)
+{
+  memcpy(out.data + offset, &value, sizeof(T));
+}
+
+static size_t
+align_to(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Offsets of the globals in .bss, returns its size.
+static size_t
+layout_globals(const x64::MModule& module, std::vector<size_t>& offsets)
+{
+  size_t size = 0;
+
+  for (const x64::MGlobal& global : module.globals) {
+    size = align_to(size, x64::global_alignment(global));
+    offsets.push_back(size);
+    size += global.size;
+  }
+
+  return size;
+}
+
+static Elf64_Ehdr
+file_header(uint16_t type)
+{
+  Elf64_Ehdr header = {};
+
+  memcpy(header.e_ident, ELFMAG, SELFMAG);
+  header.e_ident[EI_CLASS]   = ELFCLASS64;
+  header.e_ident[EI_DATA]    = ELFDATA2LSB;
+  header.e_ident[EI_VERSION] = EV_CURRENT;
+  header.e_ident[EI_OSABI]   = ELFOSABI_SYSV;
+
+  header.e_type    = type;
+  header.e_machine = EM_X86_64;
+  header.e_version = EV_CURRENT;
+  header.e_ehsize  = sizeof(Elf64_Ehdr);
+
+  return header;
+}
+
+// Section header table of relocatable objects.
+enum class Section : uint16_t
+{
+  null,
+  text,
+  data,
+  bss,
+  symtab,
+  strtab,
+  rela_text,
+  note_stack,
+  shstrtab,
+  count,
+};
+
+constexpr size_t SECTION_COUNT = underlay_cast(Section::count);
+
+constexpr const char* SECTION_NAMES[] = {
+  [underlay_cast(Section::null)]       = "",
+  [underlay_cast(Section::text)]       = ".text",
+  [underlay_cast(Section::data)]       = ".data",
+  [underlay_cast(Section::bss)]        = ".bss",
+  [underlay_cast(Section::symtab)]     = ".symtab",
+  [underlay_cast(Section::strtab)]     = ".strtab",
+  [underlay_cast(Section::rela_text)]  = ".rela.text",
+  [underlay_cast(Section::note_stack)] = ".note.GNU-stack",
+  [underlay_cast(Section::shstrtab)]   = ".shstrtab",
+};
+
+// Offset of `name` in a string table under construction.
+static uint32_t
+add_string(std::string& table, const std::string& name)
+{
+  const uint32_t offset = static_cast<uint32_t>(table.size());
+  table += name;
+  table += '\0';
+  return offset;
+}
+
+// Symbol table index of a relocation target. The null and file symbols come
+// first, then functions and globals in module order.
+static uint32_t
+symbol_index(const x64::MModule& module, const x64::Relocation& reloc)
+{
+  constexpr uint32_t FIRST_GLOBAL = 2;
+
+  if (reloc.target == x64::OperandKind::func)
+    return FIRST_GLOBAL + reloc.index;
+
+  return FIRST_GLOBAL + static_cast<uint32_t>(module.functions.size()) +
+         reloc.index;
+}
+
+bool
+write_object(const char*             path,
+             const x64::MModule&     module,
+             const x64::MachineCode& code,
+             const char*             source)
+{
+  std::vector<size_t> global_offsets;
+  const size_t        bss_size = layout_globals(module, global_offsets);
+
+  std::string             strtab(1, '\0');
+  std::vector<Elf64_Sym>  symbols(2, Elf64_Sym{});
+  std::vector<Elf64_Rela> relas;
+
+  symbols[1].st_name  = add_string(strtab, source);
+  symbols[1].st_info  = ELF64_ST_INFO(STB_LOCAL, STT_FILE);
+  symbols[1].st_shndx = SHN_ABS;
+
+  for (size_t i = 0; i < module.functions.size(); ++i) {
+    Elf64_Sym sym = {};
+    sym.st_name   = add_string(strtab, module.functions[i].name);
+    sym.st_info   = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+    sym.st_shndx  = underlay_cast(Section::text);
+    sym.st_value  = code.functions[i].offset;
+    sym.st_size   = code.functions[i].size;
+    symbols.push_back(sym);
+  }
+
+  for (size_t i = 0; i < module.globals.size(); ++i) {
+    Elf64_Sym sym = {};
+    sym.st_name   = add_string(strtab, module.globals[i].name);
+    sym.st_info   = ELF64_ST_INFO(STB_GLOBAL, STT_OBJECT);
+    sym.st_shndx  = underlay_cast(Section::bss);
+    sym.st_value  = global_offsets[i];
+    sym.st_size   = module.globals[i].size;
+    symbols.push_back(sym);
+  }
+
+  for (const x64::Relocation& reloc : code.relocs) {
+    const uint32_t type = reloc.kind == x64::RelocKind::plt32
+                            ? R_X86_64_PLT32
+                            : R_X86_64_PC32;
+
+    relas.push_back(Elf64_Rela{ reloc.offset,
+                                ELF64_R_INFO(symbol_index(module, reloc), type),
+                                reloc.addend });
+  }
+
+  std::string shstrtab;
+  uint32_t    section_names[SECTION_COUNT];
+
+  for (size_t i = 0; i < SECTION_COUNT; ++i)
+    section_names[i] = add_string(shstrtab, SECTION_NAMES[i]);
+
+  // File layout: header, section contents, section header table.
+  const size_t text_offset     = align_to(sizeof(Elf64_Ehdr), 16);
+  const size_t symtab_offset   = align_to(text_offset + code.text.size(), 8);
+  const size_t symtab_size     = symbols.size() * sizeof(Elf64_Sym);
+  const size_t strtab_offset   = symtab_offset + symtab_size;
+  const size_t rela_offset     = align_to(strtab_offset + strtab.size(), 8);
+  const size_t rela_size       = relas.size() * sizeof(Elf64_Rela);
+  const size_t shstrtab_offset = rela_offset + rela_size;
+  const size_t headers_offset = align_to(shstrtab_offset + shstrtab.size(), 8);
+  const size_t file_size = headers_offset + sizeof(Elf64_Shdr) * SECTION_COUNT;
+
+  Elf64_Shdr sections[SECTION_COUNT] = {};
+
+  auto at = [&sections](Section s) -> Elf64_Shdr& {
+    return sections[underlay_cast(s)];
+  };
+
+  at(Section::text) = { .sh_type      = SHT_PROGBITS,
+                        .sh_flags     = SHF_ALLOC | SHF_EXECINSTR,
+                        .sh_offset    = text_offset,
+                        .sh_size      = code.text.size(),
+                        .sh_addralign = 16 };
+
+  at(Section::data) = { .sh_type      = SHT_PROGBITS,
+                        .sh_flags     = SHF_ALLOC | SHF_WRITE,
+                        .sh_offset    = symtab_offset,
+                        .sh_addralign = 1 };
+
+  at(Section::bss) = { .sh_type      = SHT_NOBITS,
+                       .sh_flags     = SHF_ALLOC | SHF_WRITE,
+                       .sh_offset    = symtab_offset,
+                       .sh_size      = bss_size,
+                       .sh_addralign = 16 };
+
+  at(Section::symtab) = { .sh_type      = SHT_SYMTAB,
+                          .sh_offset    = symtab_offset,
+                          .sh_size      = symtab_size,
+                          .sh_link      = underlay_cast(Section::strtab),
+                          .sh_info      = 2, // first global symbol
+                          .sh_addralign = 8,
+                          .sh_entsize   = sizeof(Elf64_Sym) };
+
+  at(Section::strtab) = { .sh_type      = SHT_STRTAB,
+                          .sh_offset    = strtab_offset,
+                          .sh_size      = strtab.size(),
+                          .sh_addralign = 1 };
+
+  at(Section::rela_text) = { .sh_type      = SHT_RELA,
+                             .sh_flags     = SHF_INFO_LINK,
+                             .sh_offset    = rela_offset,
+                             .sh_size      = rela_size,
+                             .sh_link      = underlay_cast(Section::symtab),
+                             .sh_info      = underlay_cast(Section::text),
+                             .sh_addralign = 8,
+                             .sh_entsize   = sizeof(Elf64_Rela) };
+
+  // Empty, marks the stack non executable.
+  at(Section::note_stack) = { .sh_type      = SHT_PROGBITS,
+                              .sh_offset    = shstrtab_offset,
+                              .sh_addralign = 1 };
+
+  at(Section::shstrtab) = { .sh_type      = SHT_STRTAB,
+                            .sh_offset    = shstrtab_offset,
+                            .sh_size      = shstrtab.size(),
+                            .sh_addralign = 1 };
+
+  for (size_t i = 0; i < SECTION_COUNT; ++i)
+    sections[i].sh_name = section_names[i];
+
+  Elf64_Ehdr header  = file_header(ET_REL);
+  header.e_shoff     = headers_offset;
+  header.e_shentsize = sizeof(Elf64_Shdr);
+  header.e_shnum     = SECTION_COUNT;
+  header.e_shstrndx  = underlay_cast(Section::shstrtab);
+
+  MappedOutput out{ path };
+
+  if (!map_output(out, file_size, 0644))
+    return false;
+
+  store(out, 0, header);
+  memcpy(out.data + text_offset, code.text.data(), code.text.size());
+  memcpy(out.data + symtab_offset, symbols.data(), symtab_size);
+  memcpy(out.data + strtab_offset, strtab.data(), strtab.size());
+  memcpy(out.data + rela_offset, relas.data(), rela_size);
+  memcpy(out.data + shstrtab_offset, shstrtab.data(), shstrtab.size());
+  memcpy(out.data + headers_offset, sections, sizeof(sections));
+
+  return unmap_output(out);
+}
+
+constexpr uint64_t EXE_BASE  = 0x400000;
+constexpr uint64_t PAGE_SIZE = 0x1000;
+
+// _start: calls main and passes its result to exit_group. The stack pointer
+// is 16 byte aligned at entry, so main sees the usual alignment after the
+// call pushed the return address.
+constexpr uint8_t ENTRY_STUB[] = {
+  0x31, 0xed,                   // xorl %ebp, %ebp
+  0xe8, 0x00, 0x00, 0x00, 0x00, // call main
+  0x89, 0xc7,                   // movl %eax, %edi
+  0xb8, 0xe7, 0x00, 0x00, 0x00, // movl $231, %eax
+  0x0f, 0x05,                   // syscall
+};
+
+constexpr size_t ENTRY_CALL_FIELD = 3;
+
+bool
+write_executable(const char*             path,
+                 const x64::MModule&     module,
+                 const x64::MachineCode& code)
+{
+  size_t main_index = module.functions.size();
+
+  for (size_t i = 0; i < module.functions.size(); ++i) {
+    if (module.functions[i].name == "main")
+      main_index = i;
+  }
+
+  if (main_index == module.functions.size()) {
+    spdlog::error("Cannot write {}: no main function", path);
+    return false;
+  }
+
+  std::vector<size_t> global_offsets;
+  const size_t        bss_size = layout_globals(module, global_offsets);
+
+  // One read/execute segment with the headers and the code, one anonymous
+  // read/write segment for .bss, and PT_GNU_STACK.
+  const size_t num_segments = bss_size != 0 ? 3 : 2;
+  const size_t stub_offset =
+    align_to(sizeof(Elf64_Ehdr) + num_segments * sizeof(Elf64_Phdr), 16);
+  const size_t   text_offset = stub_offset + sizeof(ENTRY_STUB);
+  const size_t   file_size   = text_offset + code.text.size();
+  const uint64_t bss_vaddr   = align_to(EXE_BASE + file_size, PAGE_SIZE);
+
+  MappedOutput out{ path };
+
+  if (!map_output(out, file_size, 0755))
+    return false;
+
+  uint8_t* const text = out.data + text_offset;
+
+  memcpy(out.data + stub_offset, ENTRY_STUB, sizeof(ENTRY_STUB));
+  memcpy(text, code.text.data(), code.text.size());
+
+  const int32_t main_rel = static_cast<int32_t>(
+    text_offset + code.functions[main_index].offset -
+    (stub_offset + ENTRY_CALL_FIELD + 4));
+  store(out, stub_offset + ENTRY_CALL_FIELD, main_rel);
+
+  // S + A - P for every relocation, the whole image is below 2 GiB.
+  for (const x64::Relocation& reloc : code.relocs) {
+    const uint64_t place = EXE_BASE + text_offset + reloc.offset;
+    const uint64_t target =
+      reloc.target == x64::OperandKind::func
+        ? EXE_BASE + text_offset + code.functions[reloc.index].offset
+        : bss_vaddr + global_offsets[reloc.index];
+
+    const int32_t value = static_cast<int32_t>(target + reloc.addend - place);
+    store(out, text_offset + reloc.offset, value);
+  }
+
+  Elf64_Phdr segments[3] = {};
+
+  segments[0] = Elf64_Phdr{ .p_type   = PT_LOAD,
+                            .p_flags  = PF_R | PF_X,
+                            .p_offset = 0,
+                            .p_vaddr  = EXE_BASE,
+                            .p_paddr  = EXE_BASE,
+                            .p_filesz = file_size,
+                            .p_memsz  = file_size,
+                            .p_align  = PAGE_SIZE };
+
+  segments[1] = Elf64_Phdr{ .p_type  = PT_GNU_STACK,
+                            .p_flags = PF_R | PF_W,
+                            .p_align = 16 };
+
+  segments[2] = Elf64_Phdr{ .p_type   = PT_LOAD,
+                            .p_flags  = PF_R | PF_W,
+                            .p_offset = 0,
+                            .p_vaddr  = bss_vaddr,
+                            .p_paddr  = bss_vaddr,
+                            .p_filesz = 0,
+                            .p_memsz  = bss_size,
+                            .p_align  = PAGE_SIZE };
+
+  Elf64_Ehdr header  = file_header(ET_EXEC);
+  header.e_entry     = EXE_BASE + stub_offset;
+  header.e_phoff     = sizeof(Elf64_Ehdr);
+  header.e_phentsize = sizeof(Elf64_Phdr);
+  header.e_phnum     = static_cast<uint16_t>(num_segments);
+
+  store(out, 0, header);
+  memcpy(out.data + sizeof(Elf64_Ehdr),
+         segments,
+         num_segments * sizeof(Elf64_Phdr));
+
+  return unmap_output(out);
+}
+
+} // namespace wcc::elf
@@ -0,0 +1,386 @@
+#include "fold.h"
+
+#include <cmath>
+
+namespace wcc {
+
+static double
+to_double(LangType type, uint64_t bits)
+{
+  VarValue value;
+  value.u64_value = bits;
+
+  return type == LangType::lt_f32 ? value.f32_value : value.f64_value;
+}
+
+static uint64_t
+from_float(float f)
+{
+  VarValue value;
+  value.u64_value = 0;
+  value.f32_value = f;
+
+  return value.u64_value;
+}
+
+static uint64_t
+from_double(double d)
+{
+  VarValue value;
+  value.f64_value = d;
+
+  return value.u64_value;
+}
+
+uint64_t
+normalize_constant(LangType type, uint64_t bits)
+{
+  if (type == LangType::lt_f32)
+    return bits & 0xFFFFFFFF;
+
+  if (!is_integer(type) || type_size(type) == 8)
+    return bits;
+
+  const unsigned shift = 64 - type_size(type) * 8;
+
+  if (is_signed(type))
+    return static_cast<uint64_t>(static_cast<int64_t>(bits << shift) >> shift);
+
+  return (bits << shift) >> shift;
+}
+
+static std::optional<uint64_t>
+fold_float(ir::Opcode op, LangType type, double a, double b)
+{
+  double r;
+
+  // f32 operands are exact in double and a single double operation rounded
+  // to float gives the correctly rounded f32 result for + - * /.
+  switch (op) {
+    case ir::Opcode::add:
+      r = a + b;
+      break;
+    case ir::Opcode::sub:
+      r = a - b;
+      break;
+    case ir::Opcode::mul:
+      r = a * b;
+      break;
+    case ir::Opcode::div:
+      r = a / b;
+      break;
+    case ir::Opcode::cmp_lt:
+      return a < b;
+    case ir::Opcode::cmp_le:
+      return a <= b;
+    case ir::Opcode::cmp_gt:
+      return a > b;
+    case ir::Opcode::cmp_ge:
+      return a >= b;
+    case ir::Opcode::cmp_eq:
+      return a == b;
+    case ir::Opcode::cmp_ne:
+      return a != b;
+    default:
+      return std::nullopt;
+  }
+
+  return type == LangType::lt_f32 ? from_float(static_cast<float>(r))
+                                  : from_double(r);
+}
+
+std::optional<uint64_t>
+fold_binary(ir::Opcode op, LangType type, uint64_t lhs, uint64_t rhs)
+{
+  if (is_float(type))
+    return fold_float(op, type, to_double(type, lhs), to_double(type, rhs));
+
+  if (!is_integer(type))
+    return std::nullopt;
+
+  // Operands are normalized, so signed values are already sign extended and
+  // 64 bit wrapping arithmetic truncated to the width is exact.
+  const bool     sign = is_signed(type);
+  const int64_t  a    = static_cast<int64_t>(lhs);
+  const int64_t  b    = static_cast<int64_t>(rhs);
+  const unsigned bits = type_size(type) * 8;
+  const int64_t  min  = INT64_MIN >> (64 - bits);
+  uint64_t       r;
+
+  switch (op) {
+    case ir::Opcode::add:
+      r = lhs + rhs;
+      break;
+    case ir::Opcode::sub:
+      r = lhs - rhs;
+      break;
+    case ir::Opcode::mul:
+      r = lhs * rhs;
+      break;
+    case ir::Opcode::div:
+    case ir::Opcode::mod:
+      // Both trap at run time, leave them to the program.
+      if (rhs == 0 || (sign && a == min && b == -1))
+        return std::nullopt;
+
+      if (op == ir::Opcode::div)
+        r = sign ? static_cast<uint64_t>(a / b) : lhs / rhs;
+      else
+        r = sign ? static_cast<uint64_t>(a % b) : lhs % rhs;
+      break;
+    case ir::Opcode::bit_and:
+      r = lhs & rhs;
+      break;
+    case ir::Opcode::bit_or:
+      r = lhs | rhs;
+      break;
+    case ir::Opcode::bit_xor:
+      r = lhs ^ rhs;
+      break;
+    case ir::Opcode::shl:
+    case ir::Opcode::shr:
+    case ir::Opcode::sar: {
+      if (rhs >= bits)
+        return std::nullopt;
+
+      // The value as `bits` wide unsigned and signed number.
+      const unsigned pad = 64 - bits;
+      const uint64_t u   = (lhs << pad) >> pad;
+      const int64_t  s   = static_cast<int64_t>(lhs << pad) >> pad;
+
+      if (op == ir::Opcode::shl)
+        r = lhs << rhs;
+      else if (op == ir::Opcode::shr)
+        r = u >> rhs;
+      else
+        r = static_cast<uint64_t>(s >> rhs);
+      break;
+    }
+    case ir::Opcode::mulhi:
+      // Below 64 bits the full product fits into 64 bits.
+      if (bits == 64 && sign)
+        r = static_cast<uint64_t>((static_cast<__int128>(a) * b) >> 64);
+      else if (bits == 64)
+        r = static_cast<uint64_t>((static_cast<__uint128_t>(lhs) * rhs) >> 64);
+      else if (sign)
+        r = static_cast<uint64_t>((a * b) >> bits);
+      else
+        r = (lhs * rhs) >> bits;
+      break;
+    case ir::Opcode::cmp_lt:
+      return sign ? a < b : lhs < rhs;
+    case ir::Opcode::cmp_le:
+      return sign ? a <= b : lhs <= rhs;
+    case ir::Opcode::cmp_gt:
+      return sign ? a > b : lhs > rhs;
+    case ir::Opcode::cmp_ge:
+      return sign ? a >= b : lhs >= rhs;
+    case ir::Opcode::cmp_eq:
+      return lhs == rhs;
+    case ir::Opcode::cmp_ne:
+      return lhs != rhs;
+    default:
+      return std::nullopt;
+  }
+
+  return normalize_constant(type, r);
+}
+
+std::optional<uint64_t>
+fold_conversion(ConvKind kind, LangType from, LangType to, uint64_t value)
+{
+  switch (kind) {
+    case ConvKind::none:
+    case ConvKind::sext:
+    case ConvKind::zext:
+    case ConvKind::trunc:
+      return normalize_constant(to, value);
+
+    case ConvKind::sitofp: {
+      const auto v = static_cast<int64_t>(value);
+      return to == LangType::lt_f32 ? from_float(static_cast<float>(v))
+                                    : from_double(static_cast<double>(v));
+    }
+
+    case ConvKind::uitofp:
+      return to == LangType::lt_f32 ? from_float(static_cast<float>(value))
+                                    : from_double(static_cast<double>(value));
+
+    case ConvKind::fptosi:
+    case ConvKind::fptoui: {
+      const double   t    = std::trunc(to_double(from, value));
+      const unsigned bits = type_size(to) * 8;
+
+      // Out of range (and NaN) conversions are undefined, don't pick a value.
+      if (kind == ConvKind::fptosi) {
+        const double limit = std::ldexp(1.0, bits - 1);
+
+        if (!(t >= -limit && t < limit))
+          return std::nullopt;
+
+        return normalize_constant(
+          to, static_cast<uint64_t>(static_cast<int64_t>(t)));
+      }
+
+      if (!(t >= 0 && t < std::ldexp(1.0, bits)))
+        return std::nullopt;
+
+      return static_cast<uint64_t>(t);
+    }
+
+    case ConvKind::fpext:
+      return from_double(to_double(from, value));
+
+    case ConvKind::fptrunc:
+      return from_float(static_cast<float>(to_double(from, value)));
+
+    case ConvKind::invalid:
+      break;
+  }
+
+  return std::nullopt;
+}
+
+bool
+constant_truth(LangType type, uint64_t bits)
+{
+  if (is_float(type))
+    return to_double(type, bits) != 0.0;
+
+  return bits != 0;
+}
+
+static bool
+is_assignment(TOKENID id)
+{
+  switch (id) {
+    case TOKENID::OP_EQ:
+    case TOKENID::OP_MULEQ:
+    case TOKENID::OP_DIVEQ:
+    case TOKENID::OP_ANDEQ:
+    case TOKENID::OP_OREQ:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static void
+replace_with_literal(AstStmt& stmt, LangType type, uint64_t bits)
+{
+  AstLiteral literal{ .type = type };
+  literal.value.u64_value = bits;
+
+  // The id is kept, types[stmt] already is the type of the folded value.
+  stmt.type  = StmtType::literal;
+  stmt.value = literal;
+}
+
+static std::optional<uint64_t>
+fold_operator(const AstFunctionCall& call)
+{
+  if (call.args.size() != 2 || call.args[0].type != StmtType::literal ||
+      call.args[1].type != StmtType::literal)
+    return std::nullopt;
+
+  const auto&   lhs = std::get<AstLiteral>(call.args[0].value);
+  const auto&   rhs = std::get<AstLiteral>(call.args[1].value);
+  const TOKENID id  = call.from_token.id;
+
+  // Logic operands are not converted to a common type.
+  if (id == TOKENID::OP_LOGIC_AND || id == TOKENID::OP_LOGIC_OR) {
+    const bool a = constant_truth(lhs.type, lhs.value.u64_value);
+    const bool b = constant_truth(rhs.type, rhs.value.u64_value);
+
+    return id == TOKENID::OP_LOGIC_AND ? (a && b) : (a || b);
+  }
+
+  return fold_binary(ir::operator_opcode(id),
+                     lhs.type,
+                     lhs.value.u64_value,
+                     rhs.value.u64_value);
+}
+
+static void
+fold_stmt(const ExprTypes& types, AstStmt& stmt)
+{
+  switch (stmt.type) {
+    case StmtType::varref:
+    case StmtType::literal:
+    case StmtType::ret:
+      return;
+
+    case StmtType::conv: {
+      AstConversion& conv = std::get<AstConversion>(stmt.value);
+      fold_stmt(types, conv.operand[0]);
+
+      if (conv.operand[0].type != StmtType::literal)
+        return;
+
+      const auto& operand = std::get<AstLiteral>(conv.operand[0].value);
+      const auto  value =
+        fold_conversion(conv.kind, conv.from, conv.to, operand.value.u64_value);
+
+      if (value.has_value())
+        replace_with_literal(stmt, conv.to, *value);
+
+      return;
+    }
+
+    case StmtType::call: {
+      AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+
+      for (auto& arg : call.args)
+        fold_stmt(types, arg);
+
+      if (call.symbol != INVALID_SYMBOL || is_assignment(call.from_token.id))
+        return;
+
+      const auto value = fold_operator(call);
+
+      if (value.has_value())
+        replace_with_literal(stmt, types[stmt], *value);
+
+      return;
+    }
+
+    case StmtType::index:
+      fold_stmt(types, std::get<AstIndex>(stmt.value).index[0]);
+      return;
+
+    case StmtType::field:
+      for (auto& index : std::get<AstField>(stmt.value).index)
+        fold_stmt(types, index);
+
+      return;
+  }
+}
+
+static void
+fold_node(const ExprTypes& types, ASTNode& node)
+{
+  if (node.id == ASTID::stmt)
+    fold_stmt(types, std::get<AstStmt>(node.value));
+
+  if (node.id == ASTID::loop) {
+    AstLoop& loop = std::get<AstLoop>(node.value);
+    fold_stmt(types, loop.cond);
+
+    if (loop.step.has_value())
+      fold_stmt(types, *loop.step);
+  }
+
+  if (node.id == ASTID::branch)
+    fold_stmt(types, std::get<AstBranch>(node.value).cond);
+
+  for (auto& child : node.nodes)
+    fold_node(types, *child);
+}
+
+void
+fold_constants(AST& ast, const ExprTypes& types)
+{
+  fold_node(types, ast.root);
+}
+
+} // namespace wcc
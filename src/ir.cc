@@ -0,0 +1,231 @@
+#include "ir.h"
+#include "util.h"
+
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+namespace wcc::ir {
+
+BlockId
+Function::add_block()
+{
+  blocks.emplace_back();
+  return static_cast<BlockId>(blocks.size() - 1);
+}
+
+void
+Function::add_edge(BlockId from, BlockId to)
+{
+  blocks[from].succs.push_back(to);
+  blocks[to].preds.push_back(from);
+}
+
+ValueId
+Function::create(BlockId        block,
+                 Opcode         op,
+                 LangType       type,
+                 const ValueId* ops,
+                 size_t         num_ops,
+                 uint64_t       imm)
+{
+  if (unlikely(num_ops > UINT16_MAX))
+    panic("Internal error: too many operands for a single instruction");
+
+  const auto id = static_cast<ValueId>(instrs.size());
+
+  instrs.push_back(Instr{ .op           = op,
+                          .ty           = static_cast<uint8_t>(type),
+                          .num_operands = static_cast<uint16_t>(num_ops),
+                          .block        = block,
+                          .operands     = static_cast<uint32_t>(operands.size()),
+                          .imm          = imm });
+
+  operands.insert(operands.end(), ops, ops + num_ops);
+  return id;
+}
+
+ValueId
+Function::append(BlockId                        block,
+                 Opcode                         op,
+                 LangType                       type,
+                 std::initializer_list<ValueId> ops,
+                 uint64_t                       imm)
+{
+  const ValueId id = create(block, op, type, ops.begin(), ops.size(), imm);
+  blocks[block].instrs.push_back(id);
+  return id;
+}
+
+void
+Function::set_operands(ValueId v, const ValueId* ops, size_t num_ops)
+{
+  Instr& instr = instrs[v];
+
+  // Shrinking or same size ranges are rewritten in place, the arena only
+  // grows when an instruction gains operands.
+  if (num_ops <= instr.num_operands) {
+    std::copy(ops, ops + num_ops, operands.begin() + instr.operands);
+    instr.num_operands = static_cast<uint16_t>(num_ops);
+    return;
+  }
+
+  instr.operands     = static_cast<uint32_t>(operands.size());
+  instr.num_operands = static_cast<uint16_t>(num_ops);
+  operands.insert(operands.end(), ops, ops + num_ops);
+}
+
+static ValueId
+resolve_replacement(std::vector<ValueId>& repl, ValueId v)
+{
+  ValueId root = v;
+  while (repl[root] != NONE)
+    root = repl[root];
+
+  // Path compression, later lookups through the chain are O(1).
+  while (repl[v] != NONE && repl[v] != root) {
+    const ValueId next = repl[v];
+    repl[v]            = root;
+    v                  = next;
+  }
+
+  return root;
+}
+
+void
+Function::replace_uses(std::vector<ValueId>& repl)
+{
+  for (const auto& block : blocks) {
+    for (const ValueId v : block.instrs) {
+      ValueId* ops = operands_of(v);
+
+      for (size_t i = 0; i < instrs[v].num_operands; ++i) {
+        if (ops[i] != NONE)
+          ops[i] = resolve_replacement(repl, ops[i]);
+      }
+    }
+  }
+}
+
+void
+Function::compact_blocks()
+{
+  for (auto& block : blocks) {
+    auto& order = block.instrs;
+
+    order.erase(std::remove_if(order.begin(),
+                               order.end(),
+                               [this](ValueId v) {
+                                 return instrs[v].op == Opcode::nop;
+                               }),
+                order.end());
+  }
+}
+
+bool
+verify(const Function& fn)
+{
+  const DomTree dom = build_dom_tree(fn);
+
+  // Position of every placed instruction within its block, NONE if unplaced.
+  std::vector<uint32_t> position(fn.instrs.size(), NONE);
+
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    const auto& order = fn.blocks[b].instrs;
+
+    for (uint32_t i = 0; i < order.size(); ++i)
+      position[order[i]] = i;
+  }
+
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    const Block& block = fn.blocks[b];
+
+    if (!dom.reachable(b))
+      continue;
+
+    if (block.instrs.empty() ||
+        !is_terminator(fn.instrs[block.instrs.back()].op)) {
+      spdlog::error("IR verify: {} bb{} does not end with a terminator",
+                    fn.name,
+                    b);
+      return false;
+    }
+
+    bool past_phis = false;
+
+    for (uint32_t i = 0; i < block.instrs.size(); ++i) {
+      const ValueId v     = block.instrs[i];
+      const Instr&  instr = fn.instrs[v];
+
+      if (instr.block != b) {
+        spdlog::error("IR verify: {} %{} placed in bb{} but owned by bb{}",
+                      fn.name,
+                      v,
+                      b,
+                      instr.block);
+        return false;
+      }
+
+      if (is_terminator(instr.op) && i + 1 != block.instrs.size()) {
+        spdlog::error("IR verify: {} terminator %{} in the middle of bb{}",
+                      fn.name,
+                      v,
+                      b);
+        return false;
+      }
+
+      if ((instr.op == Opcode::aload || instr.op == Opcode::astore) &&
+          (instr.imm & LOCAL_ARRAY) &&
+          (instr.imm & ~LOCAL_ARRAY) >= fn.arrays.size()) {
+        spdlog::error("IR verify: {} %{} uses an undefined array", fn.name, v);
+        return false;
+      }
+
+      if (instr.op == Opcode::phi) {
+        if (past_phis || instr.num_operands != block.preds.size()) {
+          spdlog::error("IR verify: {} malformed phi %{}", fn.name, v);
+          return false;
+        }
+      } else {
+        past_phis = true;
+      }
+
+      for (size_t k = 0; k < instr.num_operands; ++k) {
+        const ValueId op = fn.operand(v, k);
+
+        if (op >= fn.instrs.size() || position[op] == NONE ||
+            fn.instrs[op].op == Opcode::nop) {
+          spdlog::error(
+            "IR verify: {} %{} uses undefined value %{}", fn.name, v, op);
+          return false;
+        }
+
+        // A phi operand only has to dominate the end of its predecessor.
+        const BlockId use_block =
+          instr.op == Opcode::phi ? block.preds[k] : b;
+        const BlockId def_block = fn.instrs[op].block;
+
+        if (!dom.reachable(use_block))
+          continue;
+
+        const bool dominated =
+          def_block == use_block
+            ? (instr.op == Opcode::phi || position[op] < i)
+            : dom.reachable(def_block) && dom.dominates(def_block, use_block);
+
+        if (!dominated) {
+          spdlog::error("IR verify: {} use of %{} in %{} is not dominated by "
+                        "its definition",
+                        fn.name,
+                        op,
+                        v);
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+} // namespace wcc::ir
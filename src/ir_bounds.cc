@@ -0,0 +1,216 @@
+#include "ir.h"
+#include "typecheck.h"
+
+#include <unordered_map>
+
+namespace wcc::ir {
+
+static void
+type_range(LangType type, __int128& lo, __int128& hi)
+{
+  const unsigned bits = type_size(type) * 8;
+
+  if (is_signed(type)) {
+    lo = -(__int128(1) << (bits - 1));
+    hi = (__int128(1) << (bits - 1)) - 1;
+  } else {
+    lo = 0;
+    hi = (__int128(1) << bits) - 1;
+  }
+}
+
+static __int128
+widen(LangType type, uint64_t bits)
+{
+  if (is_signed(type))
+    return static_cast<int64_t>(bits);
+
+  return bits;
+}
+
+static bool
+is_constant(const Function& fn, ValueId v)
+{
+  return fn.instrs[v].op == Opcode::constant;
+}
+
+// Values a basic induction variable takes in the blocks its loop runs
+// after the exit test passed: [lo, hi].
+struct IvRange
+{
+  ValueId  phi = NONE;
+  BlockId  body;
+  __int128 lo, hi;
+};
+
+/*
+ * The header leaves the loop unless `phi < bound` (or <=) holds, the
+ * variable starts at a constant and counts up by a constant step. Adding
+ * the step to the last value that passes must not wrap, so no value below
+ * the start is ever seen.
+ */
+static IvRange
+iv_range(const Function& fn, const LoopInfo& info, uint32_t l)
+{
+  const Loop&   loop = info.loops[l];
+  const ValueId term = fn.blocks[loop.header].instrs.back();
+
+  if (fn.instrs[term].op != Opcode::condbr)
+    return {};
+
+  const auto& succs = fn.blocks[loop.header].succs;
+  const bool  stays = info.contains(l, succs[0]);
+
+  if (stays == info.contains(l, succs[1]))
+    return {};
+
+  const ValueId cond = fn.operand(term, 0);
+  Opcode        op   = fn.instrs[cond].op;
+
+  if (!is_compare(op))
+    return {};
+
+  if (!stays)
+    op = negate_compare(op);
+
+  for (const InductionVar& iv : induction_vars(fn, loop)) {
+    ValueId bound = NONE;
+
+    if (fn.operand(cond, 0) == iv.phi) {
+      bound = fn.operand(cond, 1);
+    } else if (fn.operand(cond, 1) == iv.phi) {
+      bound = fn.operand(cond, 0);
+      op    = swap_compare(op);
+    }
+
+    if (bound == NONE || !is_constant(fn, bound) || !is_constant(fn, iv.init))
+      continue;
+
+    if (op != Opcode::cmp_lt && op != Opcode::cmp_le)
+      return {};
+
+    const LangType type = fn.instrs[iv.phi].type();
+    __int128       min, max;
+    type_range(type, min, max);
+
+    const __int128 init = widen(type, fn.instrs[iv.init].imm);
+    const __int128 step = widen(type, iv.step);
+    __int128       last = widen(type, fn.instrs[bound].imm);
+
+    if (op == Opcode::cmp_lt)
+      --last;
+
+    if (step <= 0 || last + step > max)
+      return {};
+
+    return IvRange{ iv.phi, succs[stays ? 0 : 1], init, last };
+  }
+
+  return {};
+}
+
+// Whether `index` is the induction variable plus a constant, converted to
+// i64 without changing its value, and the sum stays in [0, length).
+static bool
+in_bounds(const Function& fn,
+          const IvRange&  range,
+          ValueId         index,
+          uint64_t        length)
+{
+  const Instr& conv = fn.instrs[index];
+
+  if (conv.op == Opcode::conv) {
+    const auto kind = static_cast<ConvKind>(conv.imm);
+
+    if (kind != ConvKind::sext && kind != ConvKind::zext)
+      return false;
+
+    index = fn.operand(index, 0);
+  }
+
+  const Instr& instr  = fn.instrs[index];
+  __int128     offset = 0;
+
+  if (instr.op == Opcode::add && instr.ty == fn.instrs[range.phi].ty) {
+    const ValueId lhs = fn.operand(index, 0);
+    const ValueId rhs = fn.operand(index, 1);
+    const ValueId c   = lhs == range.phi ? rhs : lhs;
+
+    if ((lhs != range.phi && rhs != range.phi) || !is_constant(fn, c))
+      return false;
+
+    offset = widen(instr.type(), fn.instrs[c].imm);
+    index  = range.phi;
+  }
+
+  if (index != range.phi)
+    return false;
+
+  __int128 min, max;
+  type_range(fn.instrs[range.phi].type(), min, max);
+
+  const __int128 lo = range.lo + offset;
+  const __int128 hi = range.hi + offset;
+
+  return lo >= min && hi <= max && lo >= 0 && hi < __int128(length);
+}
+
+uint32_t
+eliminate_bounds_checks(Function& fn)
+{
+  const LoopInfo info = find_loops(fn);
+  const DomTree  dom  = build_dom_tree(fn);
+  uint32_t       removed = 0;
+
+  const auto remove = [&](ValueId v) {
+    fn.instrs[v].op           = Opcode::nop;
+    fn.instrs[v].num_operands = 0;
+    ++removed;
+  };
+
+  for (uint32_t l = 0; l < info.loops.size(); ++l) {
+    const IvRange range = iv_range(fn, info, l);
+
+    if (range.phi == NONE)
+      continue;
+
+    for (const BlockId b : info.loops[l].blocks) {
+      if (!dom.dominates(range.body, b))
+        continue;
+
+      for (const ValueId v : fn.blocks[b].instrs) {
+        if (fn.instrs[v].op == Opcode::bounds &&
+            in_bounds(fn, range, fn.operand(v, 0), fn.instrs[v].imm))
+          remove(v);
+      }
+    }
+  }
+
+  // A check of the same index against a length no larger already ran.
+  std::unordered_map<ValueId, std::vector<std::pair<BlockId, uint64_t>>>
+    checks;
+
+  for (const BlockId b : dom.rpo) {
+    for (const ValueId v : fn.blocks[b].instrs) {
+      if (fn.instrs[v].op != Opcode::bounds)
+        continue;
+
+      const uint64_t length  = fn.instrs[v].imm;
+      auto&          earlier = checks[fn.operand(v, 0)];
+      bool           covered = false;
+
+      for (const auto& [block, checked] : earlier)
+        covered |= checked <= length && dom.dominates(block, b);
+
+      if (covered)
+        remove(v);
+      else
+        earlier.emplace_back(b, length);
+    }
+  }
+
+  fn.compact_blocks();
+  return removed;
+}
+
+} // namespace wcc::ir
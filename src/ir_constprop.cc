@@ -0,0 +1,314 @@
+#include "fold.h"
+#include "ir.h"
+
+#include <algorithm>
+
+namespace wcc::ir {
+
+static bool
+is_constant(const Function& fn, ValueId v)
+{
+  return fn.instrs[v].op == Opcode::constant;
+}
+
+static void
+make_constant(Function& fn, ValueId v, uint64_t value)
+{
+  Instr& instr       = fn.instrs[v];
+  instr.op           = Opcode::constant;
+  instr.num_operands = 0;
+  instr.imm          = value;
+}
+
+// Drops the edge pred -> block together with the matching phi operands.
+static void
+remove_pred(Function& fn, BlockId block, BlockId pred)
+{
+  auto&        preds = fn.blocks[block].preds;
+  const auto   it    = std::find(preds.begin(), preds.end(), pred);
+  const size_t k     = static_cast<size_t>(it - preds.begin());
+
+  preds.erase(it);
+
+  std::vector<ValueId> ops;
+
+  for (const ValueId v : fn.blocks[block].instrs) {
+    if (fn.instrs[v].op != Opcode::phi)
+      continue;
+
+    const ValueId* old = fn.operands_of(v);
+    ops.assign(old, old + fn.instrs[v].num_operands);
+    ops.erase(ops.begin() + k);
+    fn.set_operands(v, ops.data(), ops.size());
+  }
+}
+
+// Value a phi always yields, NONE if it merges different values.
+static ValueId
+trivial_phi_value(const Function& fn, ValueId phi)
+{
+  ValueId same = NONE;
+
+  for (size_t i = 0; i < fn.instrs[phi].num_operands; ++i) {
+    const ValueId op = fn.operand(phi, i);
+
+    if (op == phi || op == same)
+      continue;
+
+    if (same != NONE)
+      return NONE;
+
+    same = op;
+  }
+
+  return same;
+}
+
+// True if every incoming value is the same constant.
+static bool
+phi_of_equal_constants(const Function& fn, ValueId phi, uint64_t& value)
+{
+  const Instr& instr = fn.instrs[phi];
+
+  if (instr.num_operands == 0)
+    return false;
+
+  for (size_t i = 0; i < instr.num_operands; ++i) {
+    const ValueId op = fn.operand(phi, i);
+
+    if (!is_constant(fn, op) || fn.instrs[op].ty != instr.ty ||
+        fn.instrs[op].imm != fn.instrs[fn.operand(phi, 0)].imm)
+      return false;
+  }
+
+  value = fn.instrs[fn.operand(phi, 0)].imm;
+  return true;
+}
+
+static bool
+fold_instr(Function& fn, BlockId b, ValueId v, std::vector<ValueId>& repl)
+{
+  const Instr& instr = fn.instrs[v];
+
+  if (is_binary(instr.op) || is_compare(instr.op)) {
+    const ValueId lhs = fn.operand(v, 0);
+    const ValueId rhs = fn.operand(v, 1);
+
+    if (!is_constant(fn, lhs) || !is_constant(fn, rhs))
+      return false;
+
+    const auto value = fold_binary(
+      instr.op, fn.instrs[lhs].type(), fn.instrs[lhs].imm, fn.instrs[rhs].imm);
+
+    if (value.has_value())
+      make_constant(fn, v, *value);
+
+    return value.has_value();
+  }
+
+  if (instr.op == Opcode::conv) {
+    const ValueId operand = fn.operand(v, 0);
+
+    if (!is_constant(fn, operand))
+      return false;
+
+    const auto value = fold_conversion(static_cast<ConvKind>(instr.imm),
+                                       fn.instrs[operand].type(),
+                                       instr.type(),
+                                       fn.instrs[operand].imm);
+
+    if (value.has_value())
+      make_constant(fn, v, *value);
+
+    return value.has_value();
+  }
+
+  if (instr.op == Opcode::select) {
+    const ValueId cond = fn.operand(v, 0);
+    ValueId       same = NONE;
+
+    if (is_constant(fn, cond))
+      same = fn.operand(
+        v, constant_truth(fn.instrs[cond].type(), fn.instrs[cond].imm) ? 1 : 2);
+    else if (fn.operand(v, 1) == fn.operand(v, 2))
+      same = fn.operand(v, 1);
+
+    if (same == NONE)
+      return false;
+
+    repl[v]                   = same;
+    fn.instrs[v].op           = Opcode::nop;
+    fn.instrs[v].num_operands = 0;
+    return true;
+  }
+
+  // A constant index known to be in range needs no check.
+  if (instr.op == Opcode::bounds && is_constant(fn, fn.operand(v, 0)) &&
+      fn.instrs[fn.operand(v, 0)].imm < instr.imm) {
+    fn.instrs[v].op           = Opcode::nop;
+    fn.instrs[v].num_operands = 0;
+    return true;
+  }
+
+  if (instr.op == Opcode::phi) {
+    uint64_t value;
+
+    if (phi_of_equal_constants(fn, v, value)) {
+      make_constant(fn, v, value);
+      return true;
+    }
+
+    const ValueId same = trivial_phi_value(fn, v);
+
+    if (same == NONE)
+      return false;
+
+    repl[v]                   = same;
+    fn.instrs[v].op           = Opcode::nop;
+    fn.instrs[v].num_operands = 0;
+    return true;
+  }
+
+  if (instr.op == Opcode::condbr && is_constant(fn, fn.operand(v, 0))) {
+    const ValueId cond = fn.operand(v, 0);
+    const bool    taken =
+      constant_truth(fn.instrs[cond].type(), fn.instrs[cond].imm);
+
+    Block&        block = fn.blocks[b];
+    const BlockId dead  = block.succs[taken ? 1 : 0];
+
+    block.succs.erase(block.succs.begin() + (taken ? 1 : 0));
+    remove_pred(fn, dead, b);
+
+    fn.instrs[v].op           = Opcode::br;
+    fn.instrs[v].num_operands = 0;
+    return true;
+  }
+
+  return false;
+}
+
+// Unlinks blocks no longer reachable from the entry.
+static void
+remove_unreachable(Function& fn)
+{
+  std::vector<uint8_t> reachable(fn.blocks.size(), 0);
+  std::vector<BlockId> worklist{ 0 };
+  reachable[0] = 1;
+
+  while (!worklist.empty()) {
+    const BlockId b = worklist.back();
+    worklist.pop_back();
+
+    for (const BlockId s : fn.blocks[b].succs) {
+      if (!reachable[s]) {
+        reachable[s] = 1;
+        worklist.push_back(s);
+      }
+    }
+  }
+
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    if (reachable[b])
+      continue;
+
+    Block& block = fn.blocks[b];
+
+    for (const BlockId s : block.succs) {
+      if (reachable[s])
+        remove_pred(fn, s, b);
+    }
+
+    for (const ValueId v : block.instrs)
+      fn.instrs[v].op = Opcode::nop;
+
+    block.instrs.clear();
+    block.preds.clear();
+    block.succs.clear();
+  }
+}
+
+static void
+remove_dead_values(Function& fn)
+{
+  std::vector<uint32_t> uses(fn.instrs.size(), 0);
+  std::vector<ValueId>  worklist;
+
+  for (const auto& block : fn.blocks) {
+    for (const ValueId v : block.instrs) {
+      for (size_t i = 0; i < fn.instrs[v].num_operands; ++i)
+        ++uses[fn.operand(v, i)];
+    }
+  }
+
+  const auto removable = [&fn](ValueId v) {
+    return is_pure(fn.instrs[v].op) || fn.instrs[v].op == Opcode::phi;
+  };
+
+  for (const auto& block : fn.blocks) {
+    for (const ValueId v : block.instrs) {
+      if (uses[v] == 0 && removable(v))
+        worklist.push_back(v);
+    }
+  }
+
+  while (!worklist.empty()) {
+    const ValueId v = worklist.back();
+    worklist.pop_back();
+
+    for (size_t i = 0; i < fn.instrs[v].num_operands; ++i) {
+      const ValueId op = fn.operand(v, i);
+
+      if (--uses[op] == 0 && op != v && removable(op))
+        worklist.push_back(op);
+    }
+
+    fn.instrs[v].op           = Opcode::nop;
+    fn.instrs[v].num_operands = 0;
+  }
+}
+
+void
+propagate_constants(Function& fn)
+{
+  std::vector<ValueId> repl(fn.instrs.size(), NONE);
+  bool                 changed = true;
+
+  // Instructions are rewritten in place, so every use sees the folded value
+  // right away. Iterating to a fixed point picks up phis and branches that
+  // only become constant after their operands were folded.
+  while (changed) {
+    bool replaced = false;
+    changed       = false;
+
+    for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+      for (const ValueId v : fn.blocks[b].instrs) {
+        if (!fold_instr(fn, b, v, repl))
+          continue;
+
+        changed = true;
+        replaced |= fn.instrs[v].op == Opcode::nop;
+      }
+    }
+
+    remove_unreachable(fn);
+
+    if (replaced)
+      fn.replace_uses(repl);
+
+    fn.compact_blocks();
+  }
+
+  remove_dead_values(fn);
+  fn.compact_blocks();
+
+  // Folded phis became constants, keep the remaining phis at the block start.
+  for (auto& block : fn.blocks) {
+    std::stable_partition(
+      block.instrs.begin(), block.instrs.end(), [&fn](ValueId v) {
+        return fn.instrs[v].op == Opcode::phi;
+      });
+  }
+}
+
+} // namespace wcc::ir
@@ -0,0 +1,153 @@
+#include "ir.h"
+
+namespace wcc::ir {
+
+static void
+compute_rpo(const Function& fn, DomTree& dom)
+{
+  const size_t n = fn.blocks.size();
+
+  std::vector<BlockId>                      postorder;
+  std::vector<uint8_t>                      visited(n, 0);
+  std::vector<std::pair<BlockId, uint32_t>> stack;
+
+  postorder.reserve(n);
+
+  // Iterative DFS, recursion depth would be proportional to function size.
+  stack.emplace_back(0, 0);
+  visited[0] = 1;
+
+  while (!stack.empty()) {
+    auto& [b, next] = stack.back();
+
+    if (next < fn.blocks[b].succs.size()) {
+      const BlockId s = fn.blocks[b].succs[next++];
+
+      if (!visited[s]) {
+        visited[s] = 1;
+        stack.emplace_back(s, 0);
+      }
+
+      continue;
+    }
+
+    postorder.push_back(b);
+    stack.pop_back();
+  }
+
+  dom.rpo.assign(postorder.rbegin(), postorder.rend());
+  dom.rpo_index.assign(n, NONE);
+
+  for (uint32_t i = 0; i < dom.rpo.size(); ++i)
+    dom.rpo_index[dom.rpo[i]] = i;
+}
+
+static BlockId
+intersect(const DomTree& dom, BlockId a, BlockId b)
+{
+  while (a != b) {
+    while (dom.rpo_index[a] > dom.rpo_index[b])
+      a = dom.idom[a];
+
+    while (dom.rpo_index[b] > dom.rpo_index[a])
+      b = dom.idom[b];
+  }
+
+  return a;
+}
+
+DomTree
+build_dom_tree(const Function& fn)
+{
+  DomTree      dom;
+  const size_t n = fn.blocks.size();
+
+  dom.idom.assign(n, NONE);
+  dom.children.assign(n, {});
+  dom.pre.assign(n, NONE);
+  dom.post.assign(n, NONE);
+
+  if (n == 0)
+    return dom;
+
+  compute_rpo(fn, dom);
+
+  dom.idom[0] = 0;
+
+  for (bool changed = true; changed;) {
+    changed = false;
+
+    for (size_t i = 1; i < dom.rpo.size(); ++i) {
+      const BlockId b        = dom.rpo[i];
+      BlockId       new_idom = NONE;
+
+      for (const BlockId p : fn.blocks[b].preds) {
+        if (dom.idom[p] == NONE)
+          continue;
+
+        new_idom = new_idom == NONE ? p : intersect(dom, p, new_idom);
+      }
+
+      if (dom.idom[b] != new_idom) {
+        dom.idom[b] = new_idom;
+        changed     = true;
+      }
+    }
+  }
+
+  for (size_t i = 1; i < dom.rpo.size(); ++i)
+    dom.children[dom.idom[dom.rpo[i]]].push_back(dom.rpo[i]);
+
+  // Number the tree so dominance queries are two comparisons.
+  uint32_t                                  counter = 0;
+  std::vector<std::pair<BlockId, uint32_t>> stack;
+
+  stack.emplace_back(0, 0);
+  dom.pre[0] = counter++;
+
+  while (!stack.empty()) {
+    auto& [b, next] = stack.back();
+
+    if (next < dom.children[b].size()) {
+      const BlockId c = dom.children[b][next++];
+      dom.pre[c]      = counter++;
+      stack.emplace_back(c, 0);
+      continue;
+    }
+
+    dom.post[b] = counter++;
+    stack.pop_back();
+  }
+
+  return dom;
+}
+
+std::vector<std::vector<BlockId>>
+dominance_frontiers(const Function& fn, const DomTree& dom)
+{
+  std::vector<std::vector<BlockId>> df(fn.blocks.size());
+
+  for (const BlockId b : dom.rpo) {
+    const auto& preds = fn.blocks[b].preds;
+
+    if (preds.size() < 2)
+      continue;
+
+    for (const BlockId p : preds) {
+      if (!dom.reachable(p))
+        continue;
+
+      for (BlockId runner = p; runner != dom.idom[b];
+           runner         = dom.idom[runner]) {
+        auto& frontier = df[runner];
+
+        if (frontier.empty() || frontier.back() != b)
+          frontier.push_back(b);
+      }
+    }
+  }
+
+  return df;
+}
+
+} // namespace wcc::ir
@@ -0,0 +1,312 @@
+#include "fold.h"
+#include "ir.h"
+
+#include <algorithm>
+#include <map>
+#include <optional>
+
+namespace wcc::ir {
+
+std::vector<uint8_t>
+find_pure_functions(const Module& module)
+{
+  const size_t         count = module.functions.size();
+  std::vector<uint8_t> pure(count, 1);
+
+  // Optimistic: everything is pure until it touches state or calls an impure
+  // function, which makes pure recursion come out pure.
+  bool changed = true;
+
+  while (changed) {
+    changed = false;
+
+    for (size_t f = 0; f < count; ++f) {
+      const Function& fn = module.functions[f];
+
+      if (!pure[f])
+        continue;
+
+      for (const auto& block : fn.blocks) {
+        for (const ValueId v : block.instrs) {
+          const Instr& instr = fn.instrs[v];
+
+          const bool effect =
+            instr.op == Opcode::gload || instr.op == Opcode::gstore ||
+            instr.op == Opcode::local || instr.op == Opcode::load ||
+            instr.op == Opcode::store || instr.op == Opcode::aload ||
+            instr.op == Opcode::astore ||
+            (instr.op == Opcode::call && !pure[instr.imm]);
+
+          if (effect && pure[f]) {
+            pure[f] = 0;
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+
+  return pure;
+}
+
+using MemoKey = std::pair<uint32_t, std::vector<uint64_t>>;
+
+struct EvalContext
+{
+  const Module&               module;
+  const std::vector<uint8_t>& pure;
+  const EvalOptions&          options;
+
+  uint64_t steps     = 0; // left for the current call site
+  uint32_t depth     = 0;
+  bool     exhausted = false;
+
+  // Empty results are traps, which happen again with the same arguments.
+  // Running out of budget is not memoized, another call site starts with a
+  // fresh one.
+  std::map<MemoKey, std::optional<uint64_t>> memo;
+  EvalStats                                  stats;
+};
+
+static std::optional<uint64_t>
+call_function(EvalContext& ctx, uint32_t f, std::vector<uint64_t> args);
+
+// Runs the function body. Empty on traps, instructions that cannot be
+// evaluated and exhausted limits.
+static std::optional<uint64_t>
+run(EvalContext& ctx, const Function& fn, const std::vector<uint64_t>& args)
+{
+  std::vector<uint64_t> values(fn.instrs.size(), 0);
+  std::vector<uint64_t> incoming;
+  BlockId               block = 0;
+  BlockId               pred  = NONE;
+
+  while (true) {
+    const auto& order = fn.blocks[block].instrs;
+    size_t      i     = 0;
+
+    // Phis read their operands all at once, before any of them is written.
+    if (pred != NONE) {
+      const auto&  preds = fn.blocks[block].preds;
+      const size_t k     = static_cast<size_t>(
+        std::find(preds.begin(), preds.end(), pred) - preds.begin());
+
+      incoming.clear();
+
+      for (; i < order.size() && fn.instrs[order[i]].op == Opcode::phi; ++i)
+        incoming.push_back(values[fn.operand(order[i], k)]);
+
+      for (size_t p = 0; p < incoming.size(); ++p)
+        values[order[p]] = incoming[p];
+    }
+
+    for (; i < order.size(); ++i) {
+      const ValueId v     = order[i];
+      const Instr&  instr = fn.instrs[v];
+
+      if (ctx.steps == 0) {
+        ctx.exhausted = true;
+        return std::nullopt;
+      }
+
+      --ctx.steps;
+      ++ctx.stats.steps;
+
+      if (is_binary(instr.op) || is_compare(instr.op)) {
+        const ValueId lhs   = fn.operand(v, 0);
+        const auto    value = fold_binary(instr.op,
+                                       fn.instrs[lhs].type(),
+                                       values[lhs],
+                                       values[fn.operand(v, 1)]);
+
+        if (!value.has_value())
+          return std::nullopt;
+
+        values[v] = *value;
+        continue;
+      }
+
+      switch (instr.op) {
+        case Opcode::param:
+          values[v] = args[instr.imm];
+          continue;
+
+        case Opcode::constant:
+          values[v] = instr.imm;
+          continue;
+
+        case Opcode::select: {
+          const ValueId cond = fn.operand(v, 0);
+          const bool    taken =
+            constant_truth(fn.instrs[cond].type(), values[cond]);
+
+          values[v] = values[fn.operand(v, taken ? 1 : 2)];
+          continue;
+        }
+
+        case Opcode::conv: {
+          const ValueId operand = fn.operand(v, 0);
+          const auto    value =
+            fold_conversion(static_cast<ConvKind>(instr.imm),
+                            fn.instrs[operand].type(),
+                            instr.type(),
+                            values[operand]);
+
+          if (!value.has_value())
+            return std::nullopt;
+
+          values[v] = *value;
+          continue;
+        }
+
+        case Opcode::call: {
+          std::vector<uint64_t> call_args;
+
+          for (size_t k = 0; k < instr.num_operands; ++k)
+            call_args.push_back(values[fn.operand(v, k)]);
+
+          const auto value = call_function(
+            ctx, static_cast<uint32_t>(instr.imm), std::move(call_args));
+
+          if (!value.has_value())
+            return std::nullopt;
+
+          values[v] = *value;
+          continue;
+        }
+
+        case Opcode::br:
+          pred  = block;
+          block = fn.blocks[block].succs[0];
+          break;
+
+        case Opcode::condbr: {
+          const ValueId cond = fn.operand(v, 0);
+          const bool    taken =
+            constant_truth(fn.instrs[cond].type(), values[cond]);
+
+          pred  = block;
+          block = fn.blocks[block].succs[taken ? 0 : 1];
+          break;
+        }
+
+        case Opcode::ret:
+          return instr.num_operands != 0 ? values[fn.operand(v, 0)] : 0;
+
+        default:
+          return std::nullopt;
+      }
+
+      break;
+    }
+  }
+}
+
+static std::optional<uint64_t>
+call_function(EvalContext& ctx, uint32_t f, std::vector<uint64_t> args)
+{
+  MemoKey    key{ f, std::move(args) };
+  const auto found = ctx.memo.find(key);
+
+  if (found != ctx.memo.end()) {
+    ++ctx.stats.memo_hits;
+    return found->second;
+  }
+
+  if (ctx.depth == ctx.options.max_depth) {
+    ctx.exhausted = true;
+    return std::nullopt;
+  }
+
+  ++ctx.depth;
+  const auto result = run(ctx, ctx.module.functions[f], key.second);
+  --ctx.depth;
+
+  if (!ctx.exhausted)
+    ctx.memo.emplace(std::move(key), result);
+
+  return result;
+}
+
+std::optional<uint64_t>
+evaluate(const Module&                module,
+         uint32_t                     function,
+         const std::vector<uint64_t>& args,
+         EvalStats&                   stats,
+         const EvalOptions&           options)
+{
+  const std::vector<uint8_t> pure = find_pure_functions(module);
+  EvalContext                ctx{ module, pure, options };
+
+  if (!pure[function])
+    return std::nullopt;
+
+  ctx.steps = options.step_budget;
+
+  const auto result = call_function(ctx, function, args);
+
+  stats.memo_hits += ctx.stats.memo_hits;
+  stats.out_of_budget += ctx.exhausted;
+  stats.steps += ctx.stats.steps;
+  return result;
+}
+
+EvalStats
+evaluate_calls(Module& module, const EvalOptions& options)
+{
+  const std::vector<uint8_t> pure = find_pure_functions(module);
+  EvalContext                ctx{ module, pure, options };
+
+  for (Function& fn : module.functions) {
+    bool changed = false;
+
+    for (const auto& block : fn.blocks) {
+      for (const ValueId v : block.instrs) {
+        Instr& instr = fn.instrs[v];
+
+        if (instr.op != Opcode::call || instr.type() == LangType::lt_void ||
+            !pure[instr.imm])
+          continue;
+
+        std::vector<uint64_t> args;
+
+        for (size_t k = 0; k < instr.num_operands; ++k) {
+          const Instr& arg = fn.instrs[fn.operand(v, k)];
+
+          if (arg.op != Opcode::constant)
+            break;
+
+          args.push_back(arg.imm);
+        }
+
+        if (args.size() != instr.num_operands)
+          continue;
+
+        ctx.steps     = options.step_budget;
+        ctx.exhausted = false;
+
+        const auto value =
+          call_function(ctx, static_cast<uint32_t>(instr.imm), std::move(args));
+
+        if (ctx.exhausted)
+          ++ctx.stats.out_of_budget;
+
+        if (!value.has_value())
+          continue;
+
+        instr.op           = Opcode::constant;
+        instr.num_operands = 0;
+        instr.imm          = *value;
+        changed            = true;
+        ++ctx.stats.folded;
+      }
+    }
+
+    if (changed)
+      propagate_constants(fn);
+  }
+
+  return ctx.stats;
+}
+
+} // namespace wcc::ir
@@ -0,0 +1,202 @@
+#include "ir.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace wcc::ir {
+
+// Identity of a pure instruction: equal keys compute equal values.
+struct ValueKey
+{
+  Opcode   op;
+  uint8_t  ty;
+  uint8_t  lanes; // a vector op is not its scalar counterpart
+  uint64_t imm;
+  ValueId  lhs;
+  ValueId  rhs;
+  ValueId  third; // the value of a select if its condition is zero
+
+  bool operator==(const ValueKey& other) const
+  {
+    return op == other.op && ty == other.ty && lanes == other.lanes &&
+           imm == other.imm && lhs == other.lhs && rhs == other.rhs &&
+           third == other.third;
+  }
+};
+
+struct ValueKeyHash
+{
+  size_t operator()(const ValueKey& key) const
+  {
+    uint64_t h = key.imm * 0x9e3779b97f4a7c15ull;
+    h ^= (uint64_t(underlay_cast(key.op)) << 16 | uint64_t(key.lanes) << 8 |
+          key.ty) + (h << 6) + (h >> 2);
+    h ^= (uint64_t(key.lhs) << 32 | key.rhs) + (h << 6) + (h >> 2);
+    h ^= key.third + (h << 6) + (h >> 2);
+    return static_cast<size_t>(h);
+  }
+};
+
+static bool
+is_commutative(Opcode op)
+{
+  return op == Opcode::add || op == Opcode::mul || op == Opcode::bit_and ||
+         op == Opcode::bit_or || op == Opcode::bit_xor ||
+         op == Opcode::mulhi || op == Opcode::cmp_eq || op == Opcode::cmp_ne;
+}
+
+// a < b is b > a, a <= b is b >= a.
+static Opcode
+swapped_compare(Opcode op)
+{
+  switch (op) {
+    case Opcode::cmp_lt:
+      return Opcode::cmp_gt;
+    case Opcode::cmp_gt:
+      return Opcode::cmp_lt;
+    case Opcode::cmp_le:
+      return Opcode::cmp_ge;
+    case Opcode::cmp_ge:
+      return Opcode::cmp_le;
+    default:
+      return op;
+  }
+}
+
+// Operands are ordered by value number, so a + b and b + a, or a < b and
+// b > a, get the same key.
+static ValueKey
+value_key(const Function& fn, ValueId v)
+{
+  const Instr& instr = fn.instrs[v];
+  ValueKey     key{
+    instr.op, instr.ty, instr.lanes, instr.imm, NONE, NONE, NONE
+  };
+
+  if (instr.num_operands > 0)
+    key.lhs = fn.operand(v, 0);
+
+  if (instr.num_operands > 1)
+    key.rhs = fn.operand(v, 1);
+
+  if (instr.num_operands > 2)
+    key.third = fn.operand(v, 2);
+
+  if (instr.num_operands == 2 && key.lhs > key.rhs) {
+    if (is_commutative(instr.op)) {
+      std::swap(key.lhs, key.rhs);
+    } else if (is_compare(instr.op)) {
+      std::swap(key.lhs, key.rhs);
+      key.op = swapped_compare(instr.op);
+    }
+  }
+
+  return key;
+}
+
+// Phis of one block merging the same values are the same value.
+static ValueId
+equal_phi(const Function& fn, const std::vector<ValueId>& phis, ValueId v)
+{
+  const Instr& instr = fn.instrs[v];
+
+  for (const ValueId other : phis) {
+    const Instr& candidate = fn.instrs[other];
+
+    if (candidate.ty == instr.ty &&
+        std::equal(fn.operands_of(v),
+                   fn.operands_of(v) + instr.num_operands,
+                   fn.operands_of(other)))
+      return other;
+  }
+
+  return NONE;
+}
+
+struct NumberFrame
+{
+  BlockId block;
+  size_t  next_child;
+  size_t  scope_mark;
+};
+
+void
+number_values(Function& fn)
+{
+  const DomTree dom = build_dom_tree(fn);
+
+  std::unordered_map<ValueKey, ValueId, ValueKeyHash> leaders;
+  std::vector<ValueKey>                               scope;
+  std::vector<ValueId>                                phis;
+  std::vector<ValueId>                                repl;
+
+  repl.assign(fn.instrs.size(), NONE);
+
+  const auto visit = [&](BlockId b) {
+    phis.clear();
+
+    for (const ValueId v : fn.blocks[b].instrs) {
+      ValueId* ops = fn.operands_of(v);
+
+      // Definitions dominate their uses, so every operand but phi inputs
+      // along back edges has been numbered already.
+      for (size_t i = 0; i < fn.instrs[v].num_operands; ++i) {
+        if (repl[ops[i]] != NONE)
+          ops[i] = repl[ops[i]];
+      }
+
+      if (fn.instrs[v].op == Opcode::phi) {
+        repl[v] = equal_phi(fn, phis, v);
+
+        if (repl[v] == NONE)
+          phis.push_back(v);
+      } else if (is_pure(fn.instrs[v].op) &&
+                 fn.instrs[v].num_operands <= 3) {
+        // Packs of four or more lanes do not fit the key and stay as
+        // they are.
+        const ValueKey key          = value_key(fn, v);
+        const auto [leader, is_new] = leaders.emplace(key, v);
+
+        if (is_new)
+          scope.push_back(key);
+        else
+          repl[v] = leader->second;
+      }
+
+      if (repl[v] != NONE) {
+        fn.instrs[v].op           = Opcode::nop;
+        fn.instrs[v].num_operands = 0;
+      }
+    }
+  };
+
+  // Preorder over the dominator tree, leaders are visible in the subtree of
+  // the block defining them and dropped when the walk leaves it.
+  std::vector<NumberFrame> stack{ { 0, 0, 0 } };
+  visit(0);
+
+  while (!stack.empty()) {
+    NumberFrame& frame    = stack.back();
+    const auto&  children = dom.children[frame.block];
+
+    if (frame.next_child < children.size()) {
+      const BlockId child = children[frame.next_child++];
+
+      stack.push_back({ child, 0, scope.size() });
+      visit(child);
+      continue;
+    }
+
+    while (scope.size() > frame.scope_mark) {
+      leaders.erase(scope.back());
+      scope.pop_back();
+    }
+
+    stack.pop_back();
+  }
+
+  fn.replace_uses(repl);
+  fn.compact_blocks();
+}
+
+} // namespace wcc::ir
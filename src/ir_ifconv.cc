@@ -0,0 +1,287 @@
+#include "ir.h"
+#include "typecheck.h"
+
+#include <algorithm>
+
+namespace wcc::ir {
+
+// Most instructions, constants aside, of an arm that then runs on both
+// paths.
+constexpr uint32_t MAX_ARM_SIZE = 4;
+
+// A block that may run whether or not its branch is taken: only entered
+// from `from`, ends with `end` and computes nothing that can trap or is
+// costly enough to be worth skipping.
+static bool
+is_arm(const Function& fn, BlockId arm, BlockId from, Opcode end)
+{
+  const Block& block = fn.blocks[arm];
+
+  if (arm == from || block.preds.size() != 1 || block.preds[0] != from ||
+      fn.instrs[block.instrs.back()].op != end)
+    return false;
+
+  uint32_t size = 0;
+
+  for (size_t i = 0; i + 1 < block.instrs.size(); ++i) {
+    const Instr& instr = fn.instrs[block.instrs[i]];
+
+    if (!is_pure(instr.op) || instr.lanes != 1 || instr.op == Opcode::div ||
+        instr.op == Opcode::mod)
+      return false;
+
+    if (instr.op != Opcode::constant && ++size > MAX_ARM_SIZE)
+      return false;
+  }
+
+  return true;
+}
+
+static bool
+is_constant(const Function& fn, ValueId v, uint64_t value)
+{
+  return fn.instrs[v].op == Opcode::constant && fn.instrs[v].imm == value;
+}
+
+// Whether an i32 value is always 0 or 1.
+static bool
+is_boolean(const Function& fn, ValueId v)
+{
+  const Instr& instr = fn.instrs[v];
+
+  if (instr.ty != underlay_cast(LangType::lt_i32) || instr.lanes != 1)
+    return false;
+
+  if (is_compare(instr.op))
+    return true;
+
+  if (instr.op == Opcode::bit_and || instr.op == Opcode::bit_or)
+    return is_boolean(fn, fn.operand(v, 0)) &&
+           is_boolean(fn, fn.operand(v, 1));
+
+  return is_constant(fn, v, 0) || is_constant(fn, v, 1);
+}
+
+static ValueId
+insert_before_end(Function&                      fn,
+                  BlockId                        block,
+                  Opcode                         op,
+                  LangType                       type,
+                  std::initializer_list<ValueId> ops)
+{
+  const ValueId v = fn.create(block, op, type, ops.begin(), ops.size());
+  auto&         order = fn.blocks[block].instrs;
+
+  order.insert(order.end() - 1, v);
+  return v;
+}
+
+// Value of `cond ? t : f` computed in `block`. Conditions are compares, so
+// selecting between 0 and 1 is the condition or its negation, and between
+// a boolean and 0 or 1 an and or an or with it.
+static ValueId
+select_value(Function& fn, BlockId block, ValueId cond, ValueId t, ValueId f)
+{
+  const LangType type = fn.instrs[t].type();
+
+  if (t == f)
+    return t;
+
+  if (is_boolean(fn, cond) && type == LangType::lt_i32) {
+    if (is_constant(fn, t, 1) && is_constant(fn, f, 0))
+      return cond;
+
+    if (is_constant(fn, f, 0) && is_boolean(fn, t))
+      return insert_before_end(fn, block, Opcode::bit_and, type, { cond, t });
+
+    if (is_constant(fn, t, 1) && is_boolean(fn, f))
+      return insert_before_end(fn, block, Opcode::bit_or, type, { cond, f });
+
+    // The negation of a float compare is not a compare, NaN fails both.
+    const Instr& compare = fn.instrs[cond];
+
+    if (is_constant(fn, t, 0) && is_constant(fn, f, 1) &&
+        is_compare(compare.op) &&
+        !is_float(fn.instrs[fn.operand(cond, 0)].type()))
+      return insert_before_end(fn,
+                               block,
+                               negate_compare(compare.op),
+                               type,
+                               { fn.operand(cond, 0), fn.operand(cond, 1) });
+  }
+
+  return insert_before_end(fn, block, Opcode::select, type, { cond, t, f });
+}
+
+// Moves the instructions of an arm but its terminator in front of the
+// terminator of `b` and unlinks the arm.
+static void
+hoist_arm(Function& fn, BlockId arm, BlockId b)
+{
+  auto& from  = fn.blocks[arm].instrs;
+  auto& order = fn.blocks[b].instrs;
+
+  for (size_t i = 0; i + 1 < from.size(); ++i)
+    fn.instrs[from[i]].block = b;
+
+  order.insert(order.end() - 1, from.begin(), from.end() - 1);
+  fn.instrs[from.back()].op           = Opcode::nop;
+  fn.instrs[from.back()].num_operands = 0;
+
+  fn.blocks[arm].instrs.clear();
+  fn.blocks[arm].preds.clear();
+  fn.blocks[arm].succs.clear();
+}
+
+// Both ways return a value: `if (c) { return x; } return y;`.
+static bool
+convert_returns(Function& fn, BlockId b)
+{
+  const ValueId term  = fn.blocks[b].instrs.back();
+  const BlockId then  = fn.blocks[b].succs[0];
+  const BlockId other = fn.blocks[b].succs[1];
+
+  if (then == other || !is_arm(fn, then, b, Opcode::ret) ||
+      !is_arm(fn, other, b, Opcode::ret))
+    return false;
+
+  const ValueId ret_then  = fn.blocks[then].instrs.back();
+  const ValueId ret_other = fn.blocks[other].instrs.back();
+
+  if (fn.instrs[ret_then].num_operands == 0)
+    return false;
+
+  const ValueId t = fn.operand(ret_then, 0);
+  const ValueId f = fn.operand(ret_other, 0);
+
+  if (!is_integer(fn.instrs[t].type()) || fn.instrs[t].lanes != 1)
+    return false;
+
+  hoist_arm(fn, then, b);
+  hoist_arm(fn, other, b);
+
+  const ValueId value = select_value(fn, b, fn.operand(term, 0), t, f);
+
+  fn.instrs[term].op = Opcode::ret;
+  fn.set_operands(term, &value, 1);
+  fn.blocks[b].succs.clear();
+  return true;
+}
+
+/*
+ * Converts the branch ending `b` if both ways lead to the same block, each
+ * through an arm or directly:
+ *
+ *   b:    condbr c, then, else        b:    ...then, ...else
+ *   then: ...; br join          =>          v = select c, x, y
+ *   else: ...; br join                      br join
+ *   join: phi(x, y, ...)              join: phi(v, ...)
+ *
+ * The join may have other predecessors, the phi operands of the two edges
+ * are merged into one.
+ */
+static bool
+convert_branch(Function& fn, BlockId b)
+{
+  const ValueId term = fn.blocks[b].instrs.back();
+
+  BlockId arm[2], edge[2], join[2];
+
+  for (int s = 0; s < 2; ++s) {
+    const BlockId succ = fn.blocks[b].succs[s];
+
+    arm[s]  = is_arm(fn, succ, b, Opcode::br) ? succ : NONE;
+    edge[s] = arm[s] != NONE ? succ : b;
+    join[s] = arm[s] != NONE ? fn.blocks[succ].succs[0] : succ;
+  }
+
+  if (join[0] != join[1] || join[0] == b || edge[0] == edge[1])
+    return false;
+
+  const BlockId target = join[0];
+  const auto&   preds  = fn.blocks[target].preds;
+
+  const auto pred_index = [&preds](BlockId pred) {
+    return static_cast<size_t>(
+      std::find(preds.begin(), preds.end(), pred) - preds.begin());
+  };
+
+  const size_t k0 = pred_index(edge[0]);
+  const size_t k1 = pred_index(edge[1]);
+
+  // cmov has no form for floats, and vectors are left alone.
+  for (const ValueId v : fn.blocks[target].instrs) {
+    const Instr& instr = fn.instrs[v];
+
+    if (instr.op != Opcode::phi)
+      break;
+
+    if (!is_integer(instr.type()) || instr.lanes != 1)
+      return false;
+  }
+
+  const ValueId cond = fn.operand(term, 0);
+
+  for (const BlockId a : arm) {
+    if (a != NONE)
+      hoist_arm(fn, a, b);
+  }
+
+  // The phi operand of the first edge becomes the select, the second edge
+  // goes away.
+  const size_t keep = std::min(k0, k1);
+  const size_t drop = std::max(k0, k1);
+
+  for (const ValueId v : fn.blocks[target].instrs) {
+    if (fn.instrs[v].op != Opcode::phi)
+      break;
+
+    std::vector<ValueId> ops(fn.operands_of(v),
+                             fn.operands_of(v) + fn.instrs[v].num_operands);
+
+    ops[keep] = select_value(fn, b, cond, ops[k0], ops[k1]);
+    ops.erase(ops.begin() + drop);
+    fn.set_operands(v, ops.data(), ops.size());
+  }
+
+  auto& join_preds = fn.blocks[target].preds;
+  join_preds[keep]  = b;
+  join_preds.erase(join_preds.begin() + drop);
+
+  fn.instrs[term].op           = Opcode::br;
+  fn.instrs[term].num_operands = 0;
+  fn.blocks[b].succs           = { target };
+  return true;
+}
+
+uint32_t
+if_convert(Function& fn)
+{
+  uint32_t converted = 0;
+  bool     changed   = true;
+
+  // Merging a converted branch into the block before it makes that block
+  // an arm of the branch around it.
+  while (changed) {
+    changed = false;
+
+    for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+      if (fn.blocks[b].instrs.empty() ||
+          fn.instrs[fn.blocks[b].instrs.back()].op != Opcode::condbr)
+        continue;
+
+      if (convert_branch(fn, b) || convert_returns(fn, b)) {
+        changed = true;
+        ++converted;
+      }
+    }
+
+    if (changed)
+      merge_blocks(fn);
+  }
+
+  fn.compact_blocks();
+  return converted;
+}
+
+} // namespace wcc::ir
@@ -0,0 +1,276 @@
+#include "fold.h"
+#include "ir.h"
+
+#include <algorithm>
+
+namespace wcc::ir {
+
+static bool
+is_power_of_two(LangType type, uint64_t bits)
+{
+  bits = normalize_constant(type, bits);
+
+  if (type_size(type) < 8)
+    bits &= (uint64_t(1) << type_size(type) * 8) - 1;
+
+  return bits != 0 && (bits & (bits - 1)) == 0;
+}
+
+// Places `v` at the end of `block`, before its terminator.
+static void
+insert_before_terminator(Function& fn, BlockId block, ValueId v)
+{
+  auto& order = fn.blocks[block].instrs;
+  order.insert(order.end() - 1, v);
+}
+
+static ValueId
+create_before_terminator(Function&                      fn,
+                         BlockId                        block,
+                         Opcode                         op,
+                         LangType                       type,
+                         std::initializer_list<ValueId> ops = {},
+                         uint64_t                       imm = 0)
+{
+  const ValueId v = fn.create(block, op, type, ops.begin(), ops.size(), imm);
+  insert_before_terminator(fn, block, v);
+  return v;
+}
+
+struct Product
+{
+  ValueId  mul;
+  ValueId  iv; // index into the induction variables
+  uint64_t factor;
+};
+
+/*
+ * iv * c  ->  phi(init * c, phi' + step * c)
+ *
+ * Wrapping multiplication distributes over wrapping addition, the new
+ * variable equals the product in every iteration at any width. Products of
+ * the same variable and factor share one.
+ */
+static bool
+reduce_products(Function& fn, const Loop& loop)
+{
+  const std::vector<InductionVar> ivs = induction_vars(fn, loop);
+  std::vector<Product>            products;
+
+  for (uint32_t k = 0; k < ivs.size(); ++k) {
+    const ValueId phi = ivs[k].phi;
+
+    for (const BlockId b : loop.blocks) {
+      for (const ValueId v : fn.blocks[b].instrs) {
+        const Instr& instr = fn.instrs[v];
+
+        if (instr.op != Opcode::mul || instr.ty != fn.instrs[phi].ty ||
+            instr.lanes != 1)
+          continue;
+
+        const ValueId lhs    = fn.operand(v, 0);
+        const ValueId rhs    = fn.operand(v, 1);
+        const ValueId factor = lhs == phi ? rhs : rhs == phi ? lhs : NONE;
+
+        if (factor == NONE || fn.instrs[factor].op != Opcode::constant ||
+            is_power_of_two(instr.type(), fn.instrs[factor].imm))
+          continue;
+
+        products.push_back(Product{ v, k, fn.instrs[factor].imm });
+      }
+    }
+  }
+
+  if (products.empty())
+    return false;
+
+  const BlockId latch = loop.latches[0];
+  const bool    entry_first =
+    fn.blocks[loop.header].preds[0] == loop.preheader;
+
+  std::vector<Product> reduced;
+  std::vector<ValueId> values;
+
+  for (const Product& product : products) {
+    const InductionVar& iv   = ivs[product.iv];
+    const LangType      type = fn.instrs[iv.phi].type();
+
+    const auto same = std::find_if(
+      reduced.begin(), reduced.end(), [&](const Product& other) {
+        return other.iv == product.iv && other.factor == product.factor;
+      });
+
+    if (same != reduced.end()) {
+      values.push_back(values[same - reduced.begin()]);
+      reduced.push_back(product);
+      continue;
+    }
+
+    const ValueId factor = create_before_terminator(
+      fn, loop.preheader, Opcode::constant, type, {}, product.factor);
+    const ValueId init = create_before_terminator(
+      fn, loop.preheader, Opcode::mul, type, { iv.init, factor });
+
+    const ValueId step = create_before_terminator(
+      fn,
+      latch,
+      Opcode::constant,
+      type,
+      {},
+      *fold_binary(Opcode::mul, type, iv.step, product.factor));
+
+    const ValueId incoming[] = { init, init };
+    const ValueId phi =
+      fn.create(loop.header, Opcode::phi, type, incoming, 2);
+    auto& order = fn.blocks[loop.header].instrs;
+    order.insert(order.begin(), phi);
+
+    const ValueId next =
+      create_before_terminator(fn, latch, Opcode::add, type, { phi, step });
+
+    fn.operands_of(phi)[entry_first ? 1 : 0] = next;
+
+    values.push_back(phi);
+    reduced.push_back(product);
+  }
+
+  std::vector<ValueId> repl(fn.instrs.size(), NONE);
+
+  for (size_t i = 0; i < reduced.size(); ++i) {
+    repl[reduced[i].mul]                   = values[i];
+    fn.instrs[reduced[i].mul].op           = Opcode::nop;
+    fn.instrs[reduced[i].mul].num_operands = 0;
+  }
+
+  fn.replace_uses(repl);
+  fn.compact_blocks();
+  return true;
+}
+
+// Uses of the induction variables after a loop with a known trip count see
+// their final value, a constant.
+static bool
+replace_exit_values(Function& fn, const LoopInfo& info, uint32_t l)
+{
+  const Loop&                   loop  = info.loops[l];
+  const std::optional<uint64_t> count = trip_count(fn, loop);
+
+  if (!count.has_value())
+    return false;
+
+  std::vector<ValueId> repl(fn.instrs.size(), NONE);
+  bool                 changed = false;
+
+  for (const InductionVar& iv : induction_vars(fn, loop)) {
+    if (fn.instrs[iv.init].op != Opcode::constant)
+      continue;
+
+    const LangType type  = fn.instrs[iv.phi].type();
+    const uint64_t steps = *fold_binary(
+      Opcode::mul, type, normalize_constant(type, *count), iv.step);
+    const uint64_t final =
+      *fold_binary(Opcode::add, type, fn.instrs[iv.init].imm, steps);
+
+    ValueId constant = NONE;
+
+    for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+      if (info.contains(l, b))
+        continue;
+
+      for (const ValueId v : fn.blocks[b].instrs) {
+        ValueId* ops = fn.operands_of(v);
+
+        for (size_t i = 0; i < fn.instrs[v].num_operands; ++i) {
+          if (ops[i] != iv.phi)
+            continue;
+
+          // The preheader dominates every block the header does.
+          if (constant == NONE)
+            constant = create_before_terminator(
+              fn, loop.preheader, Opcode::constant, type, {}, final);
+
+          ops    = fn.operands_of(v);
+          ops[i] = constant;
+        }
+      }
+    }
+
+    changed |= constant != NONE;
+  }
+
+  return changed;
+}
+
+// Unlinks a loop that terminates, has no effects and computes nothing used
+// after it. Inner loops might not terminate, their outer loop stays.
+static bool
+remove_dead_loop(Function& fn, const LoopInfo& info, uint32_t l)
+{
+  const Loop& loop = info.loops[l];
+
+  if (!loop.innermost || !trip_count(fn, loop).has_value())
+    return false;
+
+  for (const BlockId b : loop.blocks) {
+    for (const ValueId v : fn.blocks[b].instrs) {
+      const Instr& instr = fn.instrs[v];
+
+      const bool traps = (instr.op == Opcode::div || instr.op == Opcode::mod) &&
+                         is_integer(instr.type()) &&
+                         (fn.instrs[fn.operand(v, 1)].op != Opcode::constant ||
+                          fn.instrs[fn.operand(v, 1)].imm == 0);
+
+      if (traps || !(is_pure(instr.op) || instr.op == Opcode::phi ||
+                     instr.op == Opcode::gload || is_terminator(instr.op)))
+        return false;
+    }
+  }
+
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    if (info.contains(l, b))
+      continue;
+
+    for (const ValueId v : fn.blocks[b].instrs) {
+      for (size_t i = 0; i < fn.instrs[v].num_operands; ++i) {
+        if (info.contains(l, fn.instrs[fn.operand(v, i)].block))
+          return false;
+      }
+    }
+  }
+
+  const BlockId exit = loop.exits[0];
+
+  fn.blocks[loop.preheader].succs[0] = exit;
+
+  auto& preds = fn.blocks[exit].preds;
+  std::replace(preds.begin(), preds.end(), loop.header, loop.preheader);
+
+  auto& succs = fn.blocks[loop.header].succs;
+  succs.erase(std::remove(succs.begin(), succs.end(), exit), succs.end());
+
+  return true;
+}
+
+void
+simplify_induction(Function& fn)
+{
+  const LoopInfo info    = find_loops(fn);
+  bool           changed = false;
+
+  for (uint32_t l = 0; l < info.loops.size(); ++l) {
+    const Loop& loop = info.loops[l];
+
+    if (loop.latches.size() != 1)
+      continue;
+
+    changed |= reduce_products(fn, loop);
+    changed |= replace_exit_values(fn, info, l);
+    changed |= remove_dead_loop(fn, info, l);
+  }
+
+  // Folds the new products of constants and drops the unlinked loops.
+  if (changed)
+    propagate_constants(fn);
+}
+
+} // namespace wcc::ir
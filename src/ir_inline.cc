@@ -0,0 +1,371 @@
+#include "ir.h"
+
+#include <algorithm>
+
+namespace wcc::ir {
+
+// What a call costs beyond the callee's body: the call and return, the
+// callee's frame setup and the argument moves that are not counted per
+// argument.
+constexpr int32_t CALL_OVERHEAD = 4;
+
+// Instructions a function adds to its caller when inlined. Parameters
+// become the arguments and constants are immediates, neither is code.
+static uint32_t
+body_size(const Function& fn)
+{
+  uint32_t size = 0;
+
+  for (const auto& block : fn.blocks) {
+    for (const ValueId v : block.instrs) {
+      const Opcode op = fn.instrs[v].op;
+      size += op != Opcode::param && op != Opcode::constant;
+    }
+  }
+
+  return size;
+}
+
+static std::vector<ValueId>
+call_sites(const Function& fn)
+{
+  std::vector<ValueId> calls;
+
+  for (const auto& block : fn.blocks) {
+    for (const ValueId v : block.instrs) {
+      if (fn.instrs[v].op == Opcode::call)
+        calls.push_back(v);
+    }
+  }
+
+  return calls;
+}
+
+/*
+ * Strongly connected components of the call graph (Tarjan). Components are
+ * completed callees first, `order` lists the functions in that order, which
+ * is the bottom-up order the inliner needs.
+ */
+struct CallGraph
+{
+  std::vector<std::vector<uint32_t>> callees;
+
+  std::vector<uint32_t> index, low, scc;
+  std::vector<uint8_t>  on_stack;
+  std::vector<uint32_t> stack, order;
+  uint32_t              next_index = 0, num_sccs = 0;
+};
+
+static void
+connect(CallGraph& graph, uint32_t f)
+{
+  graph.index[f] = graph.low[f] = graph.next_index++;
+  graph.stack.push_back(f);
+  graph.on_stack[f] = 1;
+
+  for (const uint32_t callee : graph.callees[f]) {
+    if (graph.index[callee] == NONE) {
+      connect(graph, callee);
+      graph.low[f] = std::min(graph.low[f], graph.low[callee]);
+    } else if (graph.on_stack[callee]) {
+      graph.low[f] = std::min(graph.low[f], graph.index[callee]);
+    }
+  }
+
+  if (graph.low[f] != graph.index[f])
+    return;
+
+  uint32_t member;
+
+  do {
+    member = graph.stack.back();
+    graph.stack.pop_back();
+    graph.on_stack[member] = 0;
+    graph.scc[member]      = graph.num_sccs;
+    graph.order.push_back(member);
+  } while (member != f);
+
+  ++graph.num_sccs;
+}
+
+static CallGraph
+build_call_graph(const Module& module)
+{
+  const size_t count = module.functions.size();
+  CallGraph    graph;
+
+  graph.callees.resize(count);
+  graph.index.assign(count, NONE);
+  graph.low.assign(count, NONE);
+  graph.scc.assign(count, NONE);
+  graph.on_stack.assign(count, 0);
+
+  for (size_t f = 0; f < count; ++f) {
+    const Function& fn = module.functions[f];
+
+    for (const ValueId call : call_sites(fn))
+      graph.callees[f].push_back(static_cast<uint32_t>(fn.instrs[call].imm));
+  }
+
+  for (uint32_t f = 0; f < count; ++f) {
+    if (graph.index[f] == NONE)
+      connect(graph, f);
+  }
+
+  return graph;
+}
+
+// Body size less what inlining saves: the call overhead, the argument
+// moves, and every pure use of a parameter that receives a constant, which
+// constant propagation is likely to fold away.
+static int32_t
+inline_cost(const Function& caller, ValueId call, const Function& callee)
+{
+  const Instr& instr = caller.instrs[call];
+  int32_t      cost  = static_cast<int32_t>(body_size(callee));
+
+  cost -= CALL_OVERHEAD + instr.num_operands;
+
+  std::vector<uint8_t> constant_param(callee.instrs.size(), 0);
+
+  for (const ValueId v : callee.blocks[0].instrs) {
+    const Instr& param = callee.instrs[v];
+
+    if (param.op == Opcode::param &&
+        caller.instrs[caller.operand(call, param.imm)].op == Opcode::constant)
+      constant_param[v] = 1;
+  }
+
+  for (const auto& block : callee.blocks) {
+    for (const ValueId v : block.instrs) {
+      if (!is_pure(callee.instrs[v].op))
+        continue;
+
+      for (size_t i = 0; i < callee.instrs[v].num_operands; ++i)
+        cost -= constant_param[callee.operand(v, i)];
+    }
+  }
+
+  return cost;
+}
+
+/*
+ * Replaces `call` with a copy of the callee's body. The call's block is
+ * split after the call, the copy is entered from the first half and every
+ * return branches to the second half, where a phi merges the returned
+ * values if there is more than one return.
+ */
+static void
+inline_call(Function& fn, ValueId call, const Function& callee)
+{
+  const BlockId block = fn.instrs[call].block;
+  const BlockId rest  = fn.add_block();
+
+  // Instructions after the call move to the continuation, together with the
+  // outgoing edges.
+  auto&      order = fn.blocks[block].instrs;
+  const auto at    = std::find(order.begin(), order.end(), call);
+
+  fn.blocks[rest].instrs.assign(at + 1, order.end());
+  order.erase(at, order.end());
+
+  for (const ValueId v : fn.blocks[rest].instrs)
+    fn.instrs[v].block = rest;
+
+  fn.blocks[rest].succs.swap(fn.blocks[block].succs);
+
+  for (const BlockId succ : fn.blocks[rest].succs) {
+    auto& preds = fn.blocks[succ].preds;
+    std::replace(preds.begin(), preds.end(), block, rest);
+  }
+
+  const std::vector<ValueId> args(fn.operands_of(call),
+                                  fn.operands_of(call) +
+                                    fn.instrs[call].num_operands);
+
+  const BlockId        base = static_cast<BlockId>(fn.blocks.size());
+  std::vector<ValueId> map(callee.instrs.size(), NONE);
+  std::vector<ValueId> cloned;
+  std::vector<ValueId> returned;
+
+  for (size_t b = 0; b < callee.blocks.size(); ++b)
+    fn.add_block();
+
+  for (BlockId b = 0; b < callee.blocks.size(); ++b) {
+    for (const ValueId v : callee.blocks[b].instrs) {
+      const Instr& instr = callee.instrs[v];
+
+      if (instr.op == Opcode::param) {
+        map[v] = args[instr.imm];
+        continue;
+      }
+
+      if (instr.op == Opcode::ret) {
+        if (instr.num_operands != 0)
+          returned.push_back(callee.operand(v, 0));
+
+        fn.append(base + b, Opcode::br, LangType::lt_void);
+        fn.add_edge(base + b, rest);
+        continue;
+      }
+
+      map[v] = fn.create(base + b,
+                         instr.op,
+                         instr.type(),
+                         callee.operands_of(v),
+                         instr.num_operands,
+                         instr.imm);
+
+      fn.blocks[base + b].instrs.push_back(map[v]);
+      cloned.push_back(map[v]);
+    }
+
+    // Phi operands follow the predecessor order, which has to be kept.
+    for (const BlockId pred : callee.blocks[b].preds)
+      fn.blocks[base + b].preds.push_back(base + pred);
+
+    for (const BlockId succ : callee.blocks[b].succs)
+      fn.blocks[base + b].succs.push_back(base + succ);
+  }
+
+  // Operands may refer to values cloned later, phis across back edges.
+  for (const ValueId v : cloned) {
+    ValueId* ops = fn.operands_of(v);
+
+    for (size_t i = 0; i < fn.instrs[v].num_operands; ++i)
+      ops[i] = map[ops[i]];
+  }
+
+  fn.append(block, Opcode::br, LangType::lt_void);
+  fn.add_edge(block, base);
+
+  ValueId result = NONE;
+
+  if (returned.size() == 1) {
+    result = map[returned[0]];
+  } else if (!returned.empty()) {
+    for (ValueId& value : returned)
+      value = map[value];
+
+    result = fn.create(rest,
+                       Opcode::phi,
+                       fn.instrs[call].type(),
+                       returned.data(),
+                       returned.size());
+
+    auto& rest_order = fn.blocks[rest].instrs;
+    rest_order.insert(rest_order.begin(), result);
+  }
+
+  fn.instrs[call].op           = Opcode::nop;
+  fn.instrs[call].num_operands = 0;
+
+  std::vector<ValueId> repl(fn.instrs.size(), NONE);
+  repl[call] = result;
+  fn.replace_uses(repl);
+}
+
+// Merges blocks into their predecessor where that is the only way in and
+// out, which undoes the splits around inlined bodies ending in a single
+// return.
+void
+merge_blocks(Function& fn)
+{
+  std::vector<ValueId> repl(fn.instrs.size(), NONE);
+
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    while (!fn.blocks[b].instrs.empty()) {
+      const ValueId term = fn.blocks[b].instrs.back();
+
+      if (fn.instrs[term].op != Opcode::br)
+        break;
+
+      const BlockId succ = fn.blocks[b].succs[0];
+
+      if (succ == b || fn.blocks[succ].preds.size() != 1)
+        break;
+
+      fn.instrs[term].op = Opcode::nop;
+      fn.blocks[b].instrs.pop_back();
+
+      for (const ValueId v : fn.blocks[succ].instrs) {
+        if (fn.instrs[v].op == Opcode::phi) {
+          repl[v]                   = fn.operand(v, 0);
+          fn.instrs[v].op           = Opcode::nop;
+          fn.instrs[v].num_operands = 0;
+          continue;
+        }
+
+        fn.instrs[v].block = b;
+        fn.blocks[b].instrs.push_back(v);
+      }
+
+      fn.blocks[b].succs = std::move(fn.blocks[succ].succs);
+
+      for (const BlockId next : fn.blocks[b].succs) {
+        auto& preds = fn.blocks[next].preds;
+        std::replace(preds.begin(), preds.end(), succ, b);
+      }
+
+      fn.blocks[succ].instrs.clear();
+      fn.blocks[succ].preds.clear();
+      fn.blocks[succ].succs.clear();
+    }
+  }
+
+  fn.replace_uses(repl);
+}
+
+void
+inline_calls(Module& module, const InlineOptions& options)
+{
+  const CallGraph graph = build_call_graph(module);
+
+  for (const uint32_t f : graph.order) {
+    Function& fn      = module.functions[f];
+    uint32_t  size    = body_size(fn);
+    bool      changed = false;
+
+    for (const ValueId call : call_sites(fn)) {
+      const auto      target = static_cast<uint32_t>(fn.instrs[call].imm);
+      const Function& callee = module.functions[target];
+
+      InlineDecision decision{
+        fn.name, callee.name, 0, InlineVerdict::inlined
+      };
+
+      if (graph.scc[target] == graph.scc[f]) {
+        decision.verdict = InlineVerdict::recursive;
+      } else if (!callee.arrays.empty()) {
+        decision.verdict = InlineVerdict::local_arrays;
+      } else {
+        decision.cost = inline_cost(fn, call, callee);
+
+        if (decision.cost > options.threshold)
+          decision.verdict = InlineVerdict::too_costly;
+        else if (size + body_size(callee) > options.max_caller_size)
+          decision.verdict = InlineVerdict::caller_too_large;
+      }
+
+      module.inline_report.push_back(decision);
+
+      if (decision.verdict != InlineVerdict::inlined)
+        continue;
+
+      size += body_size(callee);
+      inline_call(fn, call, callee);
+      changed = true;
+    }
+
+    // Folds what the constant arguments made constant and merges what the
+    // copies recompute, callers further up the graph inline the result.
+    if (changed) {
+      propagate_constants(fn);
+      merge_blocks(fn);
+      reassociate(fn);
+      number_values(fn);
+    }
+  }
+}
+
+} // namespace wcc::ir
@@ -0,0 +1,115 @@
+#include "fold.h"
+#include "ir.h"
+
+#include <algorithm>
+
+namespace wcc::ir {
+
+struct LoopEffects
+{
+  bool                  calls = false;
+  std::vector<uint64_t> stored_globals;
+};
+
+static LoopEffects
+loop_effects(const Function& fn, const Loop& loop)
+{
+  LoopEffects effects;
+
+  for (const BlockId b : loop.blocks) {
+    for (const ValueId v : fn.blocks[b].instrs) {
+      const Instr& instr = fn.instrs[v];
+
+      if (instr.op == Opcode::call)
+        effects.calls = true;
+      else if (instr.op == Opcode::gstore)
+        effects.stored_globals.push_back(instr.imm);
+    }
+  }
+
+  return effects;
+}
+
+// True if the divisor rules out both traps: division by zero and the
+// signed minimum divided by -1.
+static bool
+safe_divisor(const Function& fn, ValueId divisor)
+{
+  const Instr& instr = fn.instrs[divisor];
+
+  if (!is_integer(instr.type()))
+    return true;
+
+  if (instr.op != Opcode::constant || instr.imm == 0)
+    return false;
+
+  return !is_signed(instr.type()) || instr.imm != ~uint64_t(0);
+}
+
+static bool
+hoistable(const Function& fn, ValueId v, const LoopEffects& effects)
+{
+  const Instr& instr = fn.instrs[v];
+
+  switch (instr.op) {
+    case Opcode::div:
+    case Opcode::mod:
+      return safe_divisor(fn, fn.operand(v, 1));
+
+    case Opcode::gload:
+      return !effects.calls &&
+             std::find(effects.stored_globals.begin(),
+                       effects.stored_globals.end(),
+                       instr.imm) == effects.stored_globals.end();
+
+    default:
+      return is_pure(instr.op);
+  }
+}
+
+// Moves the invariants of one loop to its preheader. Blocks are visited in
+// reverse postorder, so the operands of an instruction defined in the loop
+// were looked at, and moved if they could be, before it.
+static void
+hoist_loop(Function& fn, const LoopInfo& info, uint32_t l)
+{
+  const Loop&       loop    = info.loops[l];
+  const LoopEffects effects = loop_effects(fn, loop);
+  auto&             target  = fn.blocks[loop.preheader].instrs;
+
+  for (const BlockId b : loop.blocks) {
+    auto& order = fn.blocks[b].instrs;
+
+    for (size_t i = 0; i < order.size();) {
+      const ValueId v = order[i];
+
+      const bool invariant =
+        hoistable(fn, v, effects) &&
+        std::none_of(fn.operands_of(v),
+                     fn.operands_of(v) + fn.instrs[v].num_operands,
+                     [&](ValueId op) {
+                       return info.contains(l, fn.instrs[op].block);
+                     });
+
+      if (!invariant) {
+        ++i;
+        continue;
+      }
+
+      order.erase(order.begin() + i);
+      target.insert(target.end() - 1, v);
+      fn.instrs[v].block = loop.preheader;
+    }
+  }
+}
+
+void
+hoist_invariants(Function& fn)
+{
+  const LoopInfo info = find_loops(fn);
+
+  for (uint32_t l = 0; l < info.loops.size(); ++l)
+    hoist_loop(fn, info, l);
+}
+
+} // namespace wcc::ir
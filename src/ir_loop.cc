@@ -0,0 +1,424 @@
+#include "fold.h"
+#include "ir.h"
+
+#include <algorithm>
+
+namespace wcc::ir {
+
+bool
+LoopInfo::contains(uint32_t loop, BlockId block) const
+{
+  for (uint32_t l = loop_of[block]; l != NONE; l = loops[l].parent) {
+    if (l == loop)
+      return true;
+  }
+
+  return false;
+}
+
+/*
+ * Redirects the edges into `header` from the predecessors marked outside to
+ * a new block branching to it. Phi operands of those edges move along: into
+ * a phi of the new block if they differ, as they are otherwise.
+ */
+static void
+insert_preheader(Function&                   fn,
+                 BlockId                     header,
+                 const std::vector<uint8_t>& is_outside)
+{
+  const BlockId        pre   = fn.add_block();
+  const auto           preds = fn.blocks[header].preds;
+  std::vector<BlockId> inside;
+
+  for (size_t k = 0; k < preds.size(); ++k) {
+    if (is_outside[k]) {
+      fn.blocks[pre].preds.push_back(preds[k]);
+
+      // Both edges of a predecessor branching here twice move at once.
+      auto& succs = fn.blocks[preds[k]].succs;
+      std::replace(succs.begin(), succs.end(), header, pre);
+    } else {
+      inside.push_back(preds[k]);
+    }
+  }
+
+  std::vector<ValueId> outer, ops;
+
+  for (const ValueId v : fn.blocks[header].instrs) {
+    if (fn.instrs[v].op != Opcode::phi)
+      break;
+
+    outer.clear();
+    ops.assign(1, NONE);
+
+    for (size_t k = 0; k < preds.size(); ++k) {
+      if (is_outside[k])
+        outer.push_back(fn.operand(v, k));
+      else
+        ops.push_back(fn.operand(v, k));
+    }
+
+    if (std::all_of(outer.begin(), outer.end(), [&](ValueId op) {
+          return op == outer[0];
+        })) {
+      ops[0] = outer[0];
+    } else {
+      ops[0] = fn.create(
+        pre, Opcode::phi, fn.instrs[v].type(), outer.data(), outer.size());
+      fn.blocks[pre].instrs.push_back(ops[0]);
+    }
+
+    fn.set_operands(v, ops.data(), ops.size());
+  }
+
+  fn.blocks[header].preds.assign(1, pre);
+  fn.blocks[header].preds.insert(
+    fn.blocks[header].preds.end(), inside.begin(), inside.end());
+
+  fn.append(pre, Opcode::br, LangType::lt_void);
+  fn.blocks[pre].succs.push_back(header);
+}
+
+// Gives every loop header whose entry is not a preheader already one.
+// Returns true if the CFG changed.
+static bool
+insert_preheaders(Function& fn, const DomTree& dom)
+{
+  bool changed = false;
+
+  for (const BlockId header : dom.rpo) {
+    const auto& preds = fn.blocks[header].preds;
+
+    std::vector<uint8_t> is_outside(preds.size());
+    bool                 is_header = false;
+    size_t               outside   = 0;
+    BlockId              entry     = NONE;
+
+    for (size_t k = 0; k < preds.size(); ++k) {
+      is_outside[k] = !dom.dominates(header, preds[k]);
+      is_header |= !is_outside[k];
+
+      if (is_outside[k]) {
+        entry = preds[k];
+        ++outside;
+      }
+    }
+
+    if (!is_header || (outside == 1 && fn.blocks[entry].succs.size() == 1))
+      continue;
+
+    insert_preheader(fn, header, is_outside);
+    changed = true;
+  }
+
+  return changed;
+}
+
+LoopInfo
+find_loops(Function& fn)
+{
+  DomTree dom = build_dom_tree(fn);
+
+  if (insert_preheaders(fn, dom))
+    dom = build_dom_tree(fn);
+
+  LoopInfo             info;
+  std::vector<uint8_t> in_loop(fn.blocks.size());
+
+  for (const BlockId header : dom.rpo) {
+    Loop loop{ .header = header, .preheader = NONE };
+
+    for (const BlockId pred : fn.blocks[header].preds) {
+      if (dom.dominates(header, pred))
+        loop.latches.push_back(pred);
+      else
+        loop.preheader = pred;
+    }
+
+    if (loop.latches.empty())
+      continue;
+
+    // Everything reaching a latch backwards without passing the header.
+    std::fill(in_loop.begin(), in_loop.end(), 0);
+    std::vector<BlockId> worklist = loop.latches;
+    in_loop[header]               = 1;
+    loop.blocks.push_back(header);
+
+    while (!worklist.empty()) {
+      const BlockId b = worklist.back();
+      worklist.pop_back();
+
+      if (in_loop[b])
+        continue;
+
+      in_loop[b] = 1;
+      loop.blocks.push_back(b);
+
+      for (const BlockId pred : fn.blocks[b].preds) {
+        if (!in_loop[pred])
+          worklist.push_back(pred);
+      }
+    }
+
+    std::sort(
+      loop.blocks.begin(), loop.blocks.end(), [&](BlockId a, BlockId b) {
+        return dom.rpo_index[a] < dom.rpo_index[b];
+      });
+
+    for (const BlockId b : loop.blocks) {
+      for (const BlockId succ : fn.blocks[b].succs) {
+        if (!in_loop[succ] && std::find(loop.exits.begin(),
+                                        loop.exits.end(),
+                                        succ) == loop.exits.end())
+          loop.exits.push_back(succ);
+      }
+    }
+
+    info.loops.push_back(std::move(loop));
+  }
+
+  // A loop nested in another has fewer blocks, loops of equal size are
+  // disjoint.
+  std::stable_sort(
+    info.loops.begin(), info.loops.end(), [](const Loop& a, const Loop& b) {
+      return a.blocks.size() < b.blocks.size();
+    });
+
+  info.loop_of.assign(fn.blocks.size(), NONE);
+
+  for (uint32_t l = 0; l < info.loops.size(); ++l) {
+    for (const BlockId b : info.loops[l].blocks) {
+      if (info.loop_of[b] == NONE)
+        info.loop_of[b] = l;
+    }
+  }
+
+  // The innermost loop around a header is the smallest other loop holding
+  // it, the first one found among the larger loops.
+  for (uint32_t l = 0; l < info.loops.size(); ++l) {
+    const BlockId header = info.loops[l].header;
+
+    for (uint32_t outer = l + 1; outer < info.loops.size(); ++outer) {
+      const auto& blocks = info.loops[outer].blocks;
+
+      if (std::find(blocks.begin(), blocks.end(), header) != blocks.end()) {
+        info.loops[l].parent        = outer;
+        info.loops[outer].innermost = false;
+        break;
+      }
+    }
+  }
+
+  return info;
+}
+
+std::vector<InductionVar>
+induction_vars(const Function& fn, const Loop& loop)
+{
+  std::vector<InductionVar> ivs;
+
+  const auto& preds = fn.blocks[loop.header].preds;
+
+  if (loop.latches.size() != 1 || preds.size() != 2)
+    return ivs;
+
+  const size_t entry = preds[0] == loop.preheader ? 0 : 1;
+  const size_t back  = 1 - entry;
+
+  for (const ValueId phi : fn.blocks[loop.header].instrs) {
+    const Instr& instr = fn.instrs[phi];
+
+    if (instr.op != Opcode::phi)
+      break;
+
+    if (!is_integer(instr.type()) || instr.lanes != 1)
+      continue;
+
+    const ValueId next = fn.operand(phi, back);
+    const Instr&  step = fn.instrs[next];
+
+    if ((step.op != Opcode::add && step.op != Opcode::sub) ||
+        step.ty != instr.ty)
+      continue;
+
+    const ValueId lhs = fn.operand(next, 0);
+    const ValueId rhs = fn.operand(next, 1);
+
+    // phi + c, c + phi or phi - c.
+    ValueId constant = NONE;
+
+    if (lhs == phi)
+      constant = rhs;
+    else if (rhs == phi && step.op == Opcode::add)
+      constant = lhs;
+
+    if (constant == NONE || fn.instrs[constant].op != Opcode::constant)
+      continue;
+
+    uint64_t bits = fn.instrs[constant].imm;
+
+    if (step.op == Opcode::sub)
+      bits = *fold_binary(Opcode::sub, instr.type(), 0, bits);
+
+    ivs.push_back(InductionVar{ phi, fn.operand(phi, entry), next, bits });
+  }
+
+  return ivs;
+}
+
+// Value range of an integer type, as wide integers.
+static void
+type_range(LangType type, __int128& lo, __int128& hi)
+{
+  const unsigned bits = type_size(type) * 8;
+
+  if (is_signed(type)) {
+    lo = -(__int128(1) << (bits - 1));
+    hi = (__int128(1) << (bits - 1)) - 1;
+  } else {
+    lo = 0;
+    hi = (__int128(1) << bits) - 1;
+  }
+}
+
+static __int128
+widen(LangType type, uint64_t bits)
+{
+  if (is_signed(type))
+    return static_cast<int64_t>(bits);
+
+  return bits;
+}
+
+// Steps of unsigned variables count down when their top bit is set, adding
+// 0xFFFFFFFF to a u32 is subtracting one.
+static __int128
+signed_step(LangType type, uint64_t bits)
+{
+  const unsigned shift = 64 - type_size(type) * 8;
+  return static_cast<int64_t>(bits << shift) >> shift;
+}
+
+static __int128
+div_floor(__int128 a, __int128 b)
+{
+  const __int128 q = a / b;
+  return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+std::optional<uint64_t>
+trip_count(const Function& fn, const Loop& loop)
+{
+  if (loop.exits.size() != 1)
+    return std::nullopt;
+
+  for (const BlockId b : loop.blocks) {
+    if (b == loop.header)
+      continue;
+
+    for (const BlockId succ : fn.blocks[b].succs) {
+      if (succ == loop.exits[0])
+        return std::nullopt;
+    }
+  }
+
+  const ValueId term = fn.blocks[loop.header].instrs.back();
+
+  if (fn.instrs[term].op != Opcode::condbr)
+    return std::nullopt;
+
+  const ValueId cond = fn.operand(term, 0);
+  Opcode        op   = fn.instrs[cond].op;
+
+  if (!is_compare(op))
+    return std::nullopt;
+
+  // The loop goes on while `iv op bound` holds.
+  const ValueId lhs = fn.operand(cond, 0);
+  const ValueId rhs = fn.operand(cond, 1);
+
+  for (const InductionVar& iv : induction_vars(fn, loop)) {
+    if (lhs != iv.phi && rhs != iv.phi)
+      continue;
+
+    const ValueId bound = lhs == iv.phi ? rhs : lhs;
+
+    if (fn.instrs[bound].op != Opcode::constant ||
+        fn.instrs[iv.init].op != Opcode::constant)
+      return std::nullopt;
+
+    if (rhs == iv.phi)
+      op = swap_compare(op);
+
+    if (fn.blocks[loop.header].succs[0] == loop.exits[0])
+      op = negate_compare(op);
+
+    const LangType type = fn.instrs[iv.phi].type();
+    __int128       lo, hi;
+    type_range(type, lo, hi);
+
+    const __int128 init  = widen(type, fn.instrs[iv.init].imm);
+    const __int128 limit = widen(type, fn.instrs[bound].imm);
+
+    const __int128 step = signed_step(type, iv.step);
+    __int128       count;
+
+    switch (op) {
+      case Opcode::cmp_lt:
+      case Opcode::cmp_le: {
+        const __int128 last = op == Opcode::cmp_lt ? limit - 1 : limit;
+
+        if (init > last) {
+          count = 0;
+          break;
+        }
+
+        if (step <= 0)
+          return std::nullopt;
+
+        count = div_floor(last - init, step) + 1;
+        break;
+      }
+
+      case Opcode::cmp_gt:
+      case Opcode::cmp_ge: {
+        const __int128 last = op == Opcode::cmp_gt ? limit + 1 : limit;
+
+        if (init < last) {
+          count = 0;
+          break;
+        }
+
+        if (step >= 0)
+          return std::nullopt;
+
+        count = div_floor(init - last, -step) + 1;
+        break;
+      }
+
+      case Opcode::cmp_ne:
+        if (step == 0 || (limit - init) % step != 0 ||
+            (limit - init) / step < 0)
+          return std::nullopt;
+
+        count = (limit - init) / step;
+        break;
+
+      default:
+        return std::nullopt;
+    }
+
+    // Every value the variable takes, the one failing the test included,
+    // has to be in range for the count not to depend on wrapping.
+    const __int128 final = init + count * step;
+
+    if (final < lo || final > hi || count > UINT32_MAX)
+      return std::nullopt;
+
+    return static_cast<uint64_t>(count);
+  }
+
+  return std::nullopt;
+}
+
+} // namespace wcc::ir
@@ -0,0 +1,652 @@
+#include "ir.h"
+#include "queries.h"
+#include "resolve.h"
+#include "typecheck.h"
+#include "util.h"
+
+#include <spdlog/spdlog.h>
+
+namespace wcc::ir {
+
+struct LowerContext
+{
+  const AnalyzedFile&              file;
+  const std::vector<StructLayout>& layouts;
+  Function&                        fn;
+
+  // Block new instructions are appended to, NONE after a terminator until
+  // the next block starts. Statements lowered while there is no block are
+  // unreachable and dropped.
+  BlockId block;
+
+  // Local slot of every parameter followed by every local, NONE for local
+  // arrays, which have their number in Function::arrays in `arrays`.
+  std::vector<ValueId>  slots;
+  std::vector<uint32_t> arrays;
+  size_t                num_params;
+};
+
+static ValueId
+emit(LowerContext&                  ctx,
+     Opcode                         op,
+     LangType                       type,
+     std::initializer_list<ValueId> ops = {},
+     uint64_t                       imm = 0)
+{
+  return ctx.fn.append(ctx.block, op, type, ops, imm);
+}
+
+static ValueId
+emit(LowerContext&               ctx,
+     Opcode                      op,
+     LangType                    type,
+     const std::vector<ValueId>& ops,
+     uint64_t                    imm = 0)
+{
+  const ValueId v =
+    ctx.fn.create(ctx.block, op, type, ops.data(), ops.size(), imm);
+  ctx.fn.blocks[ctx.block].instrs.push_back(v);
+  return v;
+}
+
+static void
+jump(LowerContext& ctx, BlockId target)
+{
+  emit(ctx, Opcode::br, LangType::lt_void);
+  ctx.fn.add_edge(ctx.block, target);
+}
+
+static ValueId
+slot_of(const LowerContext& ctx, SymbolIndex sym)
+{
+  const Symbol& symbol = ctx.file.symbols[sym];
+
+  if (symbol.kind == SymbolKind::param)
+    return ctx.slots[symbol.slot];
+
+  return ctx.slots[ctx.num_params + symbol.slot];
+}
+
+Opcode
+operator_opcode(TOKENID id)
+{
+  switch (id) {
+    case TOKENID::OP_PLUS:
+      return Opcode::add;
+    case TOKENID::OP_MINUS:
+      return Opcode::sub;
+    case TOKENID::OP_MUL:
+    case TOKENID::OP_MULEQ:
+      return Opcode::mul;
+    case TOKENID::OP_DIV:
+    case TOKENID::OP_DIVEQ:
+      return Opcode::div;
+    case TOKENID::OP_MOD:
+      return Opcode::mod;
+    case TOKENID::OP_AND:
+    case TOKENID::OP_ANDEQ:
+      return Opcode::bit_and;
+    case TOKENID::OP_OR:
+    case TOKENID::OP_OREQ:
+      return Opcode::bit_or;
+    case TOKENID::OP_XOR:
+      return Opcode::bit_xor;
+    case TOKENID::OP_LS:
+      return Opcode::cmp_lt;
+    case TOKENID::OP_LSE:
+      return Opcode::cmp_le;
+    case TOKENID::OP_GR:
+      return Opcode::cmp_gt;
+    case TOKENID::OP_GRE:
+      return Opcode::cmp_ge;
+    case TOKENID::OP_NEQ:
+      return Opcode::cmp_ne;
+    default:
+      return Opcode::nop;
+  }
+}
+
+// Reference to an array in the imm of aload and astore.
+static uint64_t
+array_ref(const LowerContext& ctx, SymbolIndex sym)
+{
+  const Symbol& symbol = ctx.file.symbols[sym];
+
+  if (symbol.kind == SymbolKind::global)
+    return symbol.slot;
+
+  return LOCAL_ARRAY | ctx.arrays[ctx.num_params + symbol.slot];
+}
+
+static ValueId
+lower_expr(LowerContext& ctx, const AstStmt& stmt);
+
+// Evaluates the index of an element and checks it against the length of
+// the array.
+static ValueId
+lower_index(LowerContext& ctx, const AstIndex& index)
+{
+  const Symbol& symbol = ctx.file.symbols[index.array.symbol];
+  const ValueId i      = lower_expr(ctx, index.index[0]);
+
+  emit(ctx, Opcode::bounds, LangType::lt_void, { i }, symbol.length);
+  return i;
+}
+
+// Index of a field as an element of its own type in the memory of the
+// structure: its offset over its size, plus the checked index of the
+// element times the size of the structure over the size of the field for
+// an array of structures. Fields are aligned to their size, so a constant
+// index becomes the displacement of a base + offset address.
+static ValueId
+lower_field_index(LowerContext& ctx, const AstField& field)
+{
+  const Symbol&       symbol    = ctx.file.symbols[field.object.symbol];
+  const Symbol&       structure = ctx.file.symbols[symbol.structure];
+  const StructLayout& layout    = ctx.layouts[structure.slot];
+  const auto&         str  = std::get<AstStruct>(structure.node->value);
+  const uint32_t      size = type_size(str.fields[field.number].type);
+
+  if (field.index.empty())
+    return emit(ctx,
+                Opcode::constant,
+                LangType::lt_i64,
+                {},
+                layout.offsets[field.number] / size);
+
+  const ValueId i = lower_expr(ctx, field.index[0]);
+  emit(ctx, Opcode::bounds, LangType::lt_void, { i }, symbol.length);
+
+  const ValueId stride =
+    emit(ctx, Opcode::constant, LangType::lt_i64, {}, layout.size / size);
+  const ValueId offset = emit(
+    ctx, Opcode::constant, LangType::lt_i64, {}, layout.offsets[field.number] / size);
+  const ValueId scaled = emit(ctx, Opcode::mul, LangType::lt_i64, { i, stride });
+
+  return emit(ctx, Opcode::add, LangType::lt_i64, { scaled, offset });
+}
+
+static void
+store_to(LowerContext& ctx, const AstStmt& target, ValueId value)
+{
+  const SymbolIndex sym    = std::get<AstSymRef>(target.value).symbol;
+  const Symbol&     symbol = ctx.file.symbols[sym];
+
+  if (symbol.kind == SymbolKind::global) {
+    emit(ctx, Opcode::gstore, LangType::lt_void, { value }, symbol.slot);
+    return;
+  }
+
+  emit(ctx, Opcode::store, LangType::lt_void, { slot_of(ctx, sym), value });
+}
+
+// Lowers `a && b` / `a || b` with short-circuit evaluation:
+//
+//   cur:  c = a != 0; condbr c, rhs, end   (|| swaps the targets)
+//   rhs:  r = b != 0; br end
+//   end:  phi(short-circuit value, r)
+static ValueId
+lower_logic(LowerContext& ctx, const AstFunctionCall& call)
+{
+  const bool is_and = call.from_token.id == TOKENID::OP_LOGIC_AND;
+
+  const auto test = [&ctx](const AstStmt& operand) {
+    const ValueId  v    = lower_expr(ctx, operand);
+    const LangType type = ctx.file.types[operand];
+    const ValueId  zero = emit(ctx, Opcode::constant, type);
+
+    return emit(ctx, Opcode::cmp_ne, LangType::lt_i32, { v, zero });
+  };
+
+  const ValueId lhs = test(call.args[0]);
+  const ValueId short_value =
+    emit(ctx, Opcode::constant, LangType::lt_i32, {}, is_and ? 0 : 1);
+
+  const BlockId lhs_end   = ctx.block;
+  const BlockId rhs_block = ctx.fn.add_block();
+  const BlockId end_block = ctx.fn.add_block();
+
+  emit(ctx, Opcode::condbr, LangType::lt_void, { lhs });
+  ctx.fn.add_edge(lhs_end, is_and ? rhs_block : end_block);
+  ctx.fn.add_edge(lhs_end, is_and ? end_block : rhs_block);
+
+  ctx.block         = rhs_block;
+  const ValueId rhs = test(call.args[1]);
+  const BlockId rhs_end = ctx.block;
+  jump(ctx, end_block);
+
+  ctx.block = end_block;
+
+  // Phi operands follow the predecessor order of end_block.
+  const auto& preds = ctx.fn.blocks[end_block].preds;
+  return emit(ctx,
+              Opcode::phi,
+              LangType::lt_i32,
+              { preds[0] == lhs_end ? short_value : rhs,
+                preds[1] == rhs_end ? rhs : short_value });
+}
+
+static bool
+is_assignment(TOKENID id)
+{
+  return id == TOKENID::OP_EQ || id == TOKENID::OP_MULEQ ||
+         id == TOKENID::OP_DIVEQ || id == TOKENID::OP_ANDEQ ||
+         id == TOKENID::OP_OREQ;
+}
+
+// Assignments to elements and fields. The index is evaluated and checked
+// once, before the right hand side, as the interpreters do.
+static ValueId
+lower_element_assign(LowerContext& ctx, const AstStmt& stmt)
+{
+  const AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+  const AstStmt&         lhs  = call.args[0];
+  const LangType         type = ctx.file.types[stmt];
+  uint64_t               array;
+  ValueId                i, value;
+
+  if (lhs.type == StmtType::index) {
+    const AstIndex& index = std::get<AstIndex>(lhs.value);
+
+    array = array_ref(ctx, index.array.symbol);
+    i     = lower_index(ctx, index);
+  } else {
+    const AstField& field = std::get<AstField>(lhs.value);
+
+    array = array_ref(ctx, field.object.symbol);
+    i     = lower_field_index(ctx, field);
+  }
+
+  if (call.from_token.id == TOKENID::OP_EQ) {
+    value = lower_expr(ctx, call.args[1]);
+  } else {
+    const ValueId lhs = emit(ctx, Opcode::aload, type, { i }, array);
+    const ValueId rhs = lower_expr(ctx, call.args[1]);
+    value = emit(ctx, operator_opcode(call.from_token.id), type, { lhs, rhs });
+  }
+
+  emit(ctx, Opcode::astore, LangType::lt_void, { i, value }, array);
+  return value;
+}
+
+static ValueId
+lower_operator(LowerContext& ctx, const AstStmt& stmt)
+{
+  const AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+  const TOKENID          id   = call.from_token.id;
+  const LangType         type = ctx.file.types[stmt];
+
+  if (is_assignment(id) && (call.args[0].type == StmtType::index ||
+                            call.args[0].type == StmtType::field))
+    return lower_element_assign(ctx, stmt);
+
+  switch (id) {
+    case TOKENID::OP_EQ: {
+      const ValueId value = lower_expr(ctx, call.args[1]);
+      store_to(ctx, call.args[0], value);
+      return value;
+    }
+
+    case TOKENID::OP_MULEQ:
+    case TOKENID::OP_DIVEQ:
+    case TOKENID::OP_ANDEQ:
+    case TOKENID::OP_OREQ: {
+      const ValueId lhs   = lower_expr(ctx, call.args[0]);
+      const ValueId rhs   = lower_expr(ctx, call.args[1]);
+      const ValueId value = emit(ctx, operator_opcode(id), type, { lhs, rhs });
+      store_to(ctx, call.args[0], value);
+      return value;
+    }
+
+    case TOKENID::OP_LOGIC_AND:
+    case TOKENID::OP_LOGIC_OR:
+      return lower_logic(ctx, call);
+
+    default: {
+      const ValueId lhs = lower_expr(ctx, call.args[0]);
+      const ValueId rhs = lower_expr(ctx, call.args[1]);
+      return emit(ctx, operator_opcode(id), type, { lhs, rhs });
+    }
+  }
+}
+
+static ValueId
+lower_expr(LowerContext& ctx, const AstStmt& stmt)
+{
+  const LangType type = ctx.file.types[stmt];
+
+  switch (stmt.type) {
+    case StmtType::varref: {
+      const AstSymRef& ref    = std::get<AstSymRef>(stmt.value);
+      const Symbol&    symbol = ctx.file.symbols[ref.symbol];
+
+      if (symbol.kind == SymbolKind::global)
+        return emit(ctx, Opcode::gload, type, {}, symbol.slot);
+
+      return emit(ctx, Opcode::load, type, { slot_of(ctx, ref.symbol) });
+    }
+
+    case StmtType::conv: {
+      const AstConversion& conv = std::get<AstConversion>(stmt.value);
+
+      const ValueId operand = lower_expr(ctx, conv.operand[0]);
+      return emit(ctx, Opcode::conv, type, { operand }, underlay_cast(conv.kind));
+    }
+
+    case StmtType::call: {
+      const AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+
+      if (call.symbol == INVALID_SYMBOL)
+        return lower_operator(ctx, stmt);
+
+      std::vector<ValueId> args;
+      args.reserve(call.args.size());
+
+      for (const auto& arg : call.args)
+        args.push_back(lower_expr(ctx, arg));
+
+      return emit(ctx,
+                  Opcode::call,
+                  type,
+                  args,
+                  ctx.file.symbols[call.symbol].slot);
+    }
+
+    case StmtType::literal: {
+      const AstLiteral& literal = std::get<AstLiteral>(stmt.value);
+      return emit(ctx, Opcode::constant, type, {}, literal.value.u64_value);
+    }
+
+    case StmtType::index: {
+      const AstIndex& index = std::get<AstIndex>(stmt.value);
+      const ValueId   i     = lower_index(ctx, index);
+
+      return emit(
+        ctx, Opcode::aload, type, { i }, array_ref(ctx, index.array.symbol));
+    }
+
+    case StmtType::field: {
+      const AstField& field = std::get<AstField>(stmt.value);
+      const ValueId   i     = lower_field_index(ctx, field);
+
+      return emit(
+        ctx, Opcode::aload, type, { i }, array_ref(ctx, field.object.symbol));
+    }
+
+    case StmtType::ret:
+      break;
+  }
+
+  panic("Internal error: unexpected statement in expression");
+}
+
+static void
+lower_node(LowerContext& ctx, const ASTNode& node);
+
+static bool
+is_logic(const AstStmt& stmt, TOKENID id)
+{
+  if (stmt.type != StmtType::call)
+    return false;
+
+  const AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+  return call.symbol == INVALID_SYMBOL && call.from_token.id == id;
+}
+
+// Branches to `if_true` or `if_false` on a condition. && and || jump
+// straight to the target their left operand decides instead of computing
+// a value first:
+//
+//   a && b:  condbr a, rhs, if_false   rhs: condbr b, if_true, if_false
+//   a || b:  condbr a, if_true, rhs    rhs: condbr b, if_true, if_false
+static void
+lower_cond(LowerContext&  ctx,
+           const AstStmt& cond,
+           BlockId        if_true,
+           BlockId        if_false)
+{
+  const bool is_and = is_logic(cond, TOKENID::OP_LOGIC_AND);
+
+  if (is_and || is_logic(cond, TOKENID::OP_LOGIC_OR)) {
+    const AstFunctionCall& call = std::get<AstFunctionCall>(cond.value);
+    const BlockId          rhs  = ctx.fn.add_block();
+
+    lower_cond(ctx,
+               call.args[0],
+               is_and ? rhs : if_true,
+               is_and ? if_false : rhs);
+    ctx.block = rhs;
+    lower_cond(ctx, call.args[1], if_true, if_false);
+    return;
+  }
+
+  // Compares already yield 0 or 1, other values are tested against zero.
+  const LangType type  = ctx.file.types[cond];
+  ValueId        value = lower_expr(ctx, cond);
+
+  if (!is_compare(ctx.fn.instrs[value].op)) {
+    const ValueId zero = emit(ctx, Opcode::constant, type);
+    value = emit(ctx, Opcode::cmp_ne, LangType::lt_i32, { value, zero });
+  }
+
+  emit(ctx, Opcode::condbr, LangType::lt_void, { value });
+  ctx.fn.add_edge(ctx.block, if_true);
+  ctx.fn.add_edge(ctx.block, if_false);
+  ctx.block = NONE;
+}
+
+// Lowers a loop with the test at the top:
+//
+//   cur:    br header
+//   header: c = cond; condbr c, body, exit
+//   body:   ...; step; br header
+//   exit:
+//
+// `cur` is the only way into the loop from outside, it serves as preheader.
+static void
+lower_loop(LowerContext& ctx, const ASTNode& node)
+{
+  const AstLoop& loop = std::get<AstLoop>(node.value);
+
+  const BlockId header = ctx.fn.add_block();
+  const BlockId body   = ctx.fn.add_block();
+  const BlockId exit   = ctx.fn.add_block();
+
+  jump(ctx, header);
+  ctx.block = header;
+  lower_cond(ctx, loop.cond, body, exit);
+  ctx.block = body;
+
+  for (const auto& child : node.nodes)
+    lower_node(ctx, *child);
+
+  if (ctx.block != NONE) {
+    if (loop.step.has_value())
+      lower_expr(ctx, *loop.step);
+
+    jump(ctx, header);
+  }
+
+  ctx.block = exit;
+}
+
+// Lowers an if statement, the else arm may be missing:
+//
+//   cur:  condbr c, then, else
+//   then: ...; br join
+//   else: ...; br join
+//   join:
+//
+// An arm that returns does not branch to the join block, which stays
+// unreachable if both do.
+static void
+lower_branch(LowerContext& ctx, const ASTNode& node)
+{
+  const AstBranch& branch = std::get<AstBranch>(node.value);
+
+  const BlockId then_block = ctx.fn.add_block();
+  const BlockId else_block =
+    node.nodes.size() > 1 ? ctx.fn.add_block() : NONE;
+  const BlockId join = ctx.fn.add_block();
+
+  lower_cond(
+    ctx, branch.cond, then_block, else_block != NONE ? else_block : join);
+
+  for (size_t arm = 0; arm < node.nodes.size(); ++arm) {
+    ctx.block = arm == 0 ? then_block : else_block;
+
+    for (const auto& child : node.nodes[arm]->nodes)
+      lower_node(ctx, *child);
+
+    if (ctx.block != NONE)
+      jump(ctx, join);
+  }
+
+  ctx.block = ctx.fn.blocks[join].preds.empty() ? NONE : join;
+}
+
+static void
+lower_node(LowerContext& ctx, const ASTNode& node)
+{
+  if (node.id == ASTID::loop && ctx.block != NONE) {
+    lower_loop(ctx, node);
+    return;
+  }
+
+  if (node.id == ASTID::branch && ctx.block != NONE) {
+    lower_branch(ctx, node);
+    return;
+  }
+
+  if (node.id != ASTID::stmt || ctx.block == NONE)
+    return;
+
+  const AstStmt& stmt = std::get<AstStmt>(node.value);
+
+  if (stmt.type != StmtType::ret) {
+    lower_expr(ctx, stmt);
+    return;
+  }
+
+  if (node.nodes.empty()) {
+    emit(ctx, Opcode::ret, LangType::lt_void);
+  } else {
+    const ValueId value =
+      lower_expr(ctx, std::get<AstStmt>(node.nodes[0]->value));
+    emit(ctx, Opcode::ret, LangType::lt_void, { value });
+  }
+
+  ctx.block = NONE;
+}
+
+// Memory of an array or a structure variable, a length of 0 for a scalar.
+static Array
+storage_of(const AnalyzedFile&              file,
+           const std::vector<StructLayout>& layouts,
+           const AstVariable&               var)
+{
+  if (var.structure.symbol == INVALID_SYMBOL)
+    return Array{ var.type, var.length };
+
+  const StructLayout& layout = layouts[file.symbols[var.structure.symbol].slot];
+
+  return Array{ storage_type(layout), storage_length(layout, var.length) };
+}
+
+static void
+collect_locals(LowerContext& ctx, const ASTNode& node)
+{
+  for (const ASTNode* local : function_locals(node)) {
+    const AstVariable& var     = std::get<AstVariable>(local->value);
+    const Array        storage = storage_of(ctx.file, ctx.layouts, var);
+
+    if (storage.length != 0) {
+      ctx.slots.push_back(NONE);
+      ctx.arrays.push_back(static_cast<uint32_t>(ctx.fn.arrays.size()));
+      ctx.fn.arrays.push_back(storage);
+      continue;
+    }
+
+    ctx.slots.push_back(
+      emit(ctx, Opcode::local, var.type, {}, ctx.slots.size()));
+    ctx.arrays.push_back(NONE);
+  }
+}
+
+Function
+lower_function(const AnalyzedFile&              file,
+               const std::vector<StructLayout>& layouts,
+               const ASTNode&                   node)
+{
+  const AstFunction& astfunc = std::get<AstFunction>(node.value);
+
+  Function fn;
+  fn.name        = astfunc.name;
+  fn.return_type = astfunc.return_type;
+
+  LowerContext ctx{
+    file, layouts, fn, fn.add_block(), {}, {}, astfunc.args.size()
+  };
+
+  // Parameters are copied into slots so they can be assigned like locals,
+  // mem2reg turns the copies back into plain values.
+  for (size_t i = 0; i < astfunc.args.size(); ++i) {
+    const LangType type = astfunc.args[i].type;
+
+    fn.params.push_back(type);
+    ctx.slots.push_back(emit(ctx, Opcode::local, type, {}, i));
+    ctx.arrays.push_back(NONE);
+  }
+
+  collect_locals(ctx, node);
+
+  for (size_t i = 0; i < astfunc.args.size(); ++i) {
+    const ValueId param = emit(ctx, Opcode::param, fn.params[i], {}, i);
+    emit(ctx, Opcode::store, LangType::lt_void, { ctx.slots[i], param });
+  }
+
+  for (const auto& child : node.nodes)
+    lower_node(ctx, *child);
+
+  // Falling off the end returns zero, which makes main() without a return
+  // statement exit successfully.
+  if (ctx.block != NONE) {
+    if (fn.return_type == LangType::lt_void) {
+      emit(ctx, Opcode::ret, LangType::lt_void);
+    } else {
+      const ValueId zero = emit(ctx, Opcode::constant, fn.return_type);
+      emit(ctx, Opcode::ret, LangType::lt_void, { zero });
+    }
+  }
+
+  return fn;
+}
+
+Global
+lower_global(const AnalyzedFile&              file,
+             const std::vector<StructLayout>& layouts,
+             const AstVariable&               var)
+{
+  const Array storage = storage_of(file, layouts, var);
+  return Global{ var.name, storage.type, 0, storage.length };
+}
+
+Module
+lower_module(const AnalyzedFile&              file,
+             const std::vector<StructLayout>& layouts)
+{
+  Module module;
+
+  for (const auto& node : file.ast->root.nodes) {
+    if (node->id == ASTID::vardecl) {
+      module.globals.push_back(
+        lower_global(file, layouts, std::get<AstVariable>(node->value)));
+    } else if (node->id == ASTID::funcdecl) {
+      module.functions.push_back(lower_function(file, layouts, *node));
+    }
+  }
+
+  return module;
+}
+
+} // namespace wcc::ir
@@ -0,0 +1,216 @@
+#include "ir.h"
+
+namespace wcc::ir {
+
+struct RenameFrame
+{
+  BlockId block;
+  size_t  next_child;
+  size_t  log_mark;
+};
+
+void
+mem2reg(Function& fn)
+{
+  const DomTree dom = build_dom_tree(fn);
+  const auto    df  = dominance_frontiers(fn, dom);
+
+  // Slots are promotable when their only uses are as the address of a load
+  // or store.
+  std::vector<uint32_t> local_index(fn.instrs.size(), NONE);
+  std::vector<ValueId>  locals;
+
+  for (const ValueId v : fn.blocks[0].instrs) {
+    if (fn.instrs[v].op == Opcode::local) {
+      local_index[v] = static_cast<uint32_t>(locals.size());
+      locals.push_back(v);
+    }
+  }
+
+  if (locals.empty())
+    return;
+
+  std::vector<uint8_t>              promotable(locals.size(), 1);
+  std::vector<std::vector<BlockId>> def_blocks(locals.size());
+
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    for (const ValueId v : fn.blocks[b].instrs) {
+      const Instr& instr = fn.instrs[v];
+
+      for (size_t i = 0; i < instr.num_operands; ++i) {
+        const uint32_t l = local_index[fn.operand(v, i)];
+
+        if (l == NONE)
+          continue;
+
+        const bool address_use =
+          i == 0 && (instr.op == Opcode::load || instr.op == Opcode::store);
+
+        if (!address_use)
+          promotable[l] = 0;
+        else if (instr.op == Opcode::store &&
+                 (def_blocks[l].empty() || def_blocks[l].back() != b))
+          def_blocks[l].push_back(b);
+      }
+    }
+  }
+
+  // Phi placement on the iterated dominance frontier of the stores.
+  std::vector<uint32_t>             phi_local(fn.instrs.size(), NONE);
+  std::vector<uint32_t>             has_phi(fn.blocks.size(), NONE);
+  std::vector<uint32_t>             queued(fn.blocks.size(), NONE);
+  std::vector<std::vector<ValueId>> new_phis(fn.blocks.size());
+  std::vector<BlockId>              worklist;
+
+  for (uint32_t l = 0; l < locals.size(); ++l) {
+    if (!promotable[l])
+      continue;
+
+    worklist = def_blocks[l];
+    for (const BlockId b : worklist)
+      queued[b] = l;
+
+    while (!worklist.empty()) {
+      const BlockId b = worklist.back();
+      worklist.pop_back();
+
+      for (const BlockId d : df[b]) {
+        if (has_phi[d] == l)
+          continue;
+
+        has_phi[d] = l;
+
+        const std::vector<ValueId> incoming(fn.blocks[d].preds.size(), NONE);
+        const ValueId              phi = fn.create(d,
+                                      Opcode::phi,
+                                      fn.instrs[locals[l]].type(),
+                                      incoming.data(),
+                                      incoming.size());
+        new_phis[d].push_back(phi);
+        phi_local.resize(fn.instrs.size(), NONE);
+        phi_local[phi] = l;
+
+        if (queued[d] != l) {
+          queued[d] = l;
+          worklist.push_back(d);
+        }
+      }
+    }
+  }
+
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    if (new_phis[b].empty())
+      continue;
+
+    auto& order = fn.blocks[b].instrs;
+    order.insert(order.begin(), new_phis[b].begin(), new_phis[b].end());
+  }
+
+  // Locals start out zeroed. The constants are created up front so the
+  // instruction arena does not move while renaming, and only placed in the
+  // entry block if some load actually reads them.
+  std::vector<ValueId> undef(locals.size(), NONE);
+  std::vector<uint8_t> undef_used(locals.size(), 0);
+
+  for (uint32_t l = 0; l < locals.size(); ++l) {
+    if (promotable[l])
+      undef[l] = fn.create(
+        0, Opcode::constant, fn.instrs[locals[l]].type(), nullptr, 0);
+  }
+
+  // Renaming along the dominator tree. `current` holds the reaching
+  // definition of every slot, `log` the (slot, previous value) pairs to undo
+  // when leaving a subtree.
+  std::vector<ValueId>                      current(locals.size(), NONE);
+  std::vector<std::pair<uint32_t, ValueId>> log;
+  std::vector<ValueId>                      repl(fn.instrs.size(), NONE);
+  std::vector<RenameFrame>                  stack;
+
+  const auto reaching = [&](uint32_t l) {
+    if (current[l] != NONE)
+      return current[l];
+
+    undef_used[l] = 1;
+    return undef[l];
+  };
+
+  const auto define = [&](uint32_t l, ValueId v) {
+    log.emplace_back(l, current[l]);
+    current[l] = v;
+  };
+
+  stack.push_back(RenameFrame{ 0, 0, 0 });
+
+  while (!stack.empty()) {
+    RenameFrame& frame = stack.back();
+    const BlockId b    = frame.block;
+
+    if (frame.next_child == 0) {
+      frame.log_mark = log.size();
+
+      for (const ValueId v : fn.blocks[b].instrs) {
+        Instr& instr = fn.instrs[v];
+
+        if (instr.op == Opcode::phi && phi_local[v] != NONE) {
+          define(phi_local[v], v);
+          continue;
+        }
+
+        if (instr.op != Opcode::load && instr.op != Opcode::store)
+          continue;
+
+        const uint32_t l = local_index[fn.operand(v, 0)];
+        if (l == NONE || !promotable[l])
+          continue;
+
+        if (instr.op == Opcode::load)
+          repl[v] = reaching(l);
+        else
+          define(l, fn.operand(v, 1));
+
+        instr.op = Opcode::nop;
+      }
+
+      for (const BlockId s : fn.blocks[b].succs) {
+        const auto& preds = fn.blocks[s].preds;
+
+        for (size_t j = 0; j < preds.size(); ++j) {
+          if (preds[j] != b)
+            continue;
+
+          for (const ValueId phi : new_phis[s])
+            fn.operands_of(phi)[j] = reaching(phi_local[phi]);
+        }
+      }
+    }
+
+    if (frame.next_child < dom.children[b].size()) {
+      const BlockId child = dom.children[b][frame.next_child++];
+      stack.push_back(RenameFrame{ child, 0, 0 });
+      continue;
+    }
+
+    while (log.size() > frame.log_mark) {
+      current[log.back().first] = log.back().second;
+      log.pop_back();
+    }
+
+    stack.pop_back();
+  }
+
+  for (uint32_t l = 0; l < locals.size(); ++l) {
+    if (promotable[l])
+      fn.instrs[locals[l]].op = Opcode::nop;
+  }
+
+  fn.replace_uses(repl);
+  fn.compact_blocks();
+
+  auto& entry = fn.blocks[0].instrs;
+  for (uint32_t l = 0; l < locals.size(); ++l) {
+    if (undef_used[l])
+      entry.insert(entry.begin(), undef[l]);
+  }
+}
+
+} // namespace wcc::ir
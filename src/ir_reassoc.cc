@@ -0,0 +1,234 @@
+#include "fold.h"
+#include "ir.h"
+#include "typecheck.h"
+
+#include <algorithm>
+
+namespace wcc::ir {
+
+// Integer arithmetic wraps, so these are associative and commutative at
+// every width. Float addition and multiplication are neither. Vectors are
+// left to the vectorizers that built them.
+static bool
+is_associative(const Instr& instr)
+{
+  const bool op = instr.op == Opcode::add || instr.op == Opcode::mul ||
+                  instr.op == Opcode::bit_and || instr.op == Opcode::bit_or ||
+                  instr.op == Opcode::bit_xor;
+
+  return op && !is_float(instr.type()) && instr.lanes == 1;
+}
+
+// The c with x op c == x for every x.
+static uint64_t
+identity(Opcode op, LangType type)
+{
+  switch (op) {
+    case Opcode::mul:
+      return 1;
+    case Opcode::bit_and:
+      return normalize_constant(type, ~uint64_t(0));
+    default:
+      return 0;
+  }
+}
+
+struct ReassocContext
+{
+  Function&             fn;
+  std::vector<uint32_t> rank;
+  std::vector<uint32_t> uses;
+  std::vector<ValueId>  user; // the only user of single use values
+  std::vector<ValueId>  repl;
+};
+
+// Values are ranked by where they are defined in reverse postorder, so a
+// leaf that is available earlier ranks lower. Constants rank lowest.
+static void
+compute_ranks(ReassocContext& ctx)
+{
+  const Function& fn   = ctx.fn;
+  const DomTree   dom  = build_dom_tree(fn);
+  uint32_t        next = 1;
+
+  ctx.rank.assign(fn.instrs.size(), 0);
+  ctx.uses.assign(fn.instrs.size(), 0);
+  ctx.user.assign(fn.instrs.size(), NONE);
+
+  for (const BlockId b : dom.rpo) {
+    for (const ValueId v : fn.blocks[b].instrs) {
+      if (fn.instrs[v].op != Opcode::constant)
+        ctx.rank[v] = next++;
+
+      for (size_t i = 0; i < fn.instrs[v].num_operands; ++i) {
+        const ValueId op = fn.operand(v, i);
+        ++ctx.uses[op];
+        ctx.user[op] = v;
+      }
+    }
+  }
+}
+
+// Operand of a tree that is itself part of the tree: the same operation on
+// the same type, used only there, in the same block.
+static bool
+is_interior(const ReassocContext& ctx, ValueId op, ValueId parent)
+{
+  const Instr& instr = ctx.fn.instrs[op];
+  const Instr& of    = ctx.fn.instrs[parent];
+
+  return is_associative(instr) && instr.op == of.op && instr.ty == of.ty &&
+         instr.block == of.block && ctx.uses[op] == 1;
+}
+
+static void
+collect_leaves(ReassocContext&       ctx,
+               ValueId               root,
+               std::vector<ValueId>& leaves,
+               std::vector<ValueId>& interior)
+{
+  std::vector<ValueId> stack{ root };
+
+  while (!stack.empty()) {
+    const ValueId v = stack.back();
+    stack.pop_back();
+
+    for (size_t i = 0; i < 2; ++i) {
+      const ValueId op = ctx.fn.operand(v, i);
+
+      if (is_interior(ctx, op, root)) {
+        interior.push_back(op);
+        stack.push_back(op);
+      } else {
+        leaves.push_back(op);
+      }
+    }
+  }
+}
+
+// Rewrites the tree rooted at `root` as a balanced tree over its leaves,
+// lowest ranks paired first, with the constants folded into one that is
+// applied last.
+static void
+rebuild_tree(ReassocContext& ctx, ValueId root)
+{
+  Function&      fn   = ctx.fn;
+  const Opcode   op   = fn.instrs[root].op;
+  const LangType type = fn.instrs[root].type();
+
+  std::vector<ValueId> leaves, interior;
+  collect_leaves(ctx, root, leaves, interior);
+
+  std::vector<ValueId> values;
+  size_t               constants = 0;
+  uint64_t             folded    = identity(op, type);
+
+  for (const ValueId leaf : leaves) {
+    if (fn.instrs[leaf].op != Opcode::constant) {
+      values.push_back(leaf);
+      continue;
+    }
+
+    folded = *fold_binary(op, type, folded, fn.instrs[leaf].imm);
+    ++constants;
+  }
+
+  // Nothing to rebalance or fold.
+  if (leaves.size() < 3 && constants < 2)
+    return;
+
+  if (values.empty())
+    return;
+
+  std::stable_sort(
+    values.begin(), values.end(), [&ctx](ValueId a, ValueId b) {
+      return ctx.rank[a] < ctx.rank[b];
+    });
+
+  // New instructions go right before the root, after all the leaves.
+  const BlockId block = fn.instrs[root].block;
+  auto&         order = fn.blocks[block].instrs;
+
+  const auto insert =
+    [&](Opcode new_op, const ValueId* ops, size_t n, uint64_t imm) {
+      const ValueId v = fn.create(block, new_op, type, ops, n, imm);
+      order.insert(std::find(order.begin(), order.end(), root), v);
+      return v;
+    };
+
+  if (folded != identity(op, type))
+    values.push_back(insert(Opcode::constant, nullptr, 0, folded));
+
+  for (const ValueId v : interior) {
+    fn.instrs[v].op           = Opcode::nop;
+    fn.instrs[v].num_operands = 0;
+  }
+
+  if (values.size() == 1) {
+    ctx.repl[root]               = values[0];
+    fn.instrs[root].op           = Opcode::nop;
+    fn.instrs[root].num_operands = 0;
+    return;
+  }
+
+  // Pairs neighbours level by level until two values are left for the root,
+  // the constant, if any, stays last and joins at the top.
+  const bool has_constant = folded != identity(op, type);
+  ValueId    constant     = has_constant ? values.back() : NONE;
+
+  if (has_constant)
+    values.pop_back();
+
+  while (values.size() + has_constant > 2) {
+    std::vector<ValueId> next;
+
+    for (size_t i = 0; i < values.size(); i += 2) {
+      if (i + 1 == values.size()) {
+        next.push_back(values[i]);
+        continue;
+      }
+
+      const ValueId pair[] = { values[i], values[i + 1] };
+      next.push_back(insert(op, pair, 2, 0));
+    }
+
+    values.swap(next);
+  }
+
+  if (has_constant)
+    values.push_back(constant);
+
+  fn.set_operands(root, values.data(), 2);
+}
+
+void
+reassociate(Function& fn)
+{
+  ReassocContext ctx{ fn };
+  compute_ranks(ctx);
+  ctx.repl.assign(fn.instrs.size(), NONE);
+
+  // Roots are the tops of trees: not themselves interior to a larger one.
+  std::vector<ValueId> roots;
+
+  for (const auto& block : fn.blocks) {
+    for (const ValueId v : block.instrs) {
+      if (!is_associative(fn.instrs[v]))
+        continue;
+
+      const ValueId user = ctx.user[v];
+
+      if (user == NONE || !is_interior(ctx, v, user))
+        roots.push_back(v);
+    }
+  }
+
+  for (const ValueId root : roots)
+    rebuild_tree(ctx, root);
+
+  ctx.repl.resize(fn.instrs.size(), NONE);
+  fn.replace_uses(ctx.repl);
+  fn.compact_blocks();
+}
+
+} // namespace wcc::ir
@@ -0,0 +1,436 @@
+#include "ir.h"
+#include "typecheck.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <tuple>
+
+namespace wcc::ir {
+
+/*
+ * Bottom up SLP vectorization. Seeds are groups of isomorphic operations of
+ * one block at the same depth of their expression chains: the roots of the
+ * same statement written out for several variables. From the seeds the tree
+ * of vector operations grows through the operands, as long as every lane
+ * holds the same operation on values used nowhere else. Lanes that differ
+ * become packs of scalars. The tree replaces the scalar code when it is
+ * cheaper counting the packs and the extraction of the seeds.
+ */
+
+// Lanes of one xmm register.
+static size_t
+width(LangType type)
+{
+  switch (type) {
+    case LangType::lt_f32:
+    case LangType::lt_i32:
+    case LangType::lt_u32:
+      return 4;
+    case LangType::lt_f64:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+// Operations with a packed SSE4.1 instruction.
+static bool
+is_packable(const Instr& instr)
+{
+  if (instr.lanes != 1 || width(instr.type()) == 0)
+    return false;
+
+  switch (instr.op) {
+    case Opcode::add:
+    case Opcode::sub:
+    case Opcode::mul:
+      return true;
+    case Opcode::div:
+      return is_float(instr.type());
+    case Opcode::bit_and:
+    case Opcode::bit_or:
+    case Opcode::bit_xor:
+      return !is_float(instr.type());
+    default:
+      return false;
+  }
+}
+
+static bool
+is_commutative(Opcode op)
+{
+  return op == Opcode::add || op == Opcode::mul || op == Opcode::bit_and ||
+         op == Opcode::bit_or || op == Opcode::bit_xor;
+}
+
+// Latency weighted cost of one scalar operation, and of the same operation
+// over a full vector.
+static uint32_t
+scalar_cost(Opcode op)
+{
+  return op == Opcode::div ? 4 : 1;
+}
+
+static uint32_t
+vector_cost(Opcode op, LangType type)
+{
+  if (op == Opcode::div)
+    return 4;
+
+  // pmulld is two micro operations.
+  return op == Opcode::mul && !is_float(type) ? 2 : 1;
+}
+
+constexpr size_t MAX_LANES = 4;
+
+using Lanes = std::array<ValueId, MAX_LANES>;
+
+// A vector operation over its lanes, or a pack of scalars (op nop).
+struct SlpNode
+{
+  Opcode   op;
+  Lanes    lanes;
+  uint32_t kids[2];
+  ValueId  value = NONE; // once emitted
+};
+
+struct SlpContext
+{
+  Function& fn;
+  BlockId   block;
+  LangType  type;
+  size_t    width;
+
+  std::vector<uint32_t> position; // in the block, NONE elsewhere
+  std::vector<uint32_t> uses;
+  std::vector<uint8_t>  member; // part of the tree under construction
+
+  std::vector<SlpNode>      nodes;
+  std::map<Lanes, uint32_t> packs; // lanes -> node packing them
+  std::vector<ValueId>      members;
+  std::vector<ValueId>      sunk; // moved below the tree, in order
+};
+
+static bool
+is_candidate(const SlpContext& ctx, ValueId v)
+{
+  const Instr& instr = ctx.fn.instrs[v];
+  return ctx.position[v] != NONE && is_packable(instr) && !ctx.member[v];
+}
+
+static uint32_t
+add_pack(SlpContext& ctx, const Lanes& lanes)
+{
+  const auto it = ctx.packs.find(lanes);
+
+  if (it != ctx.packs.end())
+    return it->second;
+
+  const auto n = static_cast<uint32_t>(ctx.nodes.size());
+  ctx.nodes.push_back({ Opcode::nop, lanes, { NONE, NONE } });
+  ctx.packs.emplace(lanes, n);
+  return n;
+}
+
+// Builds the node computing `lanes`, a vector operation if they are
+// isomorphic and only used by the lanes of the parent, a pack otherwise.
+static uint32_t
+build_node(SlpContext& ctx, Lanes lanes, bool root)
+{
+  const Function& fn    = ctx.fn;
+  const Instr&    first = fn.instrs[lanes[0]];
+
+  bool isomorphic = true;
+
+  for (size_t i = 0; i < ctx.width && isomorphic; ++i) {
+    const Instr& instr = fn.instrs[lanes[i]];
+
+    isomorphic = is_candidate(ctx, lanes[i]) && instr.op == first.op &&
+                 instr.type() == ctx.type &&
+                 (root || ctx.uses[lanes[i]] == 1);
+
+    for (size_t j = 0; j < i && isomorphic; ++j)
+      isomorphic = lanes[j] != lanes[i];
+  }
+
+  if (!isomorphic)
+    return add_pack(ctx, lanes);
+
+  Lanes ops[2] = {};
+
+  for (size_t i = 0; i < ctx.width; ++i) {
+    ctx.member[lanes[i]] = true;
+    ctx.members.push_back(lanes[i]);
+
+    ops[0][i] = fn.operand(lanes[i], 0);
+    ops[1][i] = fn.operand(lanes[i], 1);
+
+    // Commuted operands line up with the first lane.
+    const Opcode want = fn.instrs[ops[0][0]].op;
+
+    if (i > 0 && is_commutative(first.op) &&
+        fn.instrs[ops[0][i]].op != want && fn.instrs[ops[1][i]].op == want)
+      std::swap(ops[0][i], ops[1][i]);
+  }
+
+  const uint32_t lhs = build_node(ctx, ops[0], false);
+  const uint32_t rhs = build_node(ctx, ops[1], false);
+
+  const auto n = static_cast<uint32_t>(ctx.nodes.size());
+  ctx.nodes.push_back({ first.op, lanes, { lhs, rhs } });
+  return n;
+}
+
+// Whether `v` depends on a member of the tree within the block. Packed
+// scalars must not, they are needed before the vector operations run.
+static bool
+reaches_member(const SlpContext& ctx, ValueId v, std::vector<uint8_t>& seen)
+{
+  std::vector<ValueId> stack{ v };
+
+  while (!stack.empty()) {
+    const ValueId x = stack.back();
+    stack.pop_back();
+
+    if (ctx.position[x] == NONE || seen[x])
+      continue;
+
+    seen[x] = true;
+
+    if (ctx.member[x])
+      return true;
+
+    if (ctx.fn.instrs[x].op == Opcode::phi)
+      continue;
+
+    for (size_t i = 0; i < ctx.fn.instrs[x].num_operands; ++i)
+      stack.push_back(ctx.fn.operand(x, i));
+  }
+
+  return false;
+}
+
+static bool
+is_splat(const SlpContext& ctx, const Lanes& lanes)
+{
+  for (size_t i = 1; i < ctx.width; ++i) {
+    if (lanes[i] != lanes[0])
+      return false;
+  }
+
+  return true;
+}
+
+// Checks that the tree can be placed at its last member and pays off,
+// collecting the instructions that have to move below it.
+static bool
+profitable(SlpContext& ctx, uint32_t last)
+{
+  std::vector<uint8_t> seen(ctx.fn.instrs.size(), false);
+
+  uint32_t scalar = 0;
+  uint32_t vector = static_cast<uint32_t>(ctx.width); // extracts
+
+  for (const SlpNode& node : ctx.nodes) {
+    if (node.op != Opcode::nop) {
+      scalar += static_cast<uint32_t>(ctx.width) * scalar_cost(node.op);
+      vector += vector_cost(node.op, ctx.type);
+      continue;
+    }
+
+    for (size_t i = 0; i < ctx.width; ++i) {
+      const ValueId v = node.lanes[i];
+
+      if (ctx.member[v] || reaches_member(ctx, v, seen))
+        return false;
+    }
+
+    vector += is_splat(ctx, node.lanes) ? 1 : uint32_t(ctx.width);
+  }
+
+  const Lanes& seeds = ctx.nodes.back().lanes;
+
+  // Instructions before `last` that read the seeds move below the extracted
+  // lanes, along with everything depending on them. Only pure ones can.
+  std::vector<uint8_t> after(ctx.fn.instrs.size(), false);
+
+  for (size_t i = 0; i < ctx.width; ++i)
+    after[seeds[i]] = true;
+
+  for (const ValueId v : ctx.fn.blocks[ctx.block].instrs) {
+    if (ctx.position[v] > last || ctx.member[v])
+      continue;
+
+    for (size_t i = 0; i < ctx.fn.instrs[v].num_operands; ++i)
+      after[v] = after[v] || after[ctx.fn.operand(v, i)];
+
+    if (!after[v])
+      continue;
+
+    if (!is_pure(ctx.fn.instrs[v].op))
+      return false;
+
+    ctx.sunk.push_back(v);
+  }
+
+  return vector < scalar;
+}
+
+// Emits the tree before the last member and replaces the seeds by their
+// lanes.
+static void
+emit_tree(SlpContext& ctx, uint32_t last)
+{
+  Function&  fn    = ctx.fn;
+  auto&      order = fn.blocks[ctx.block].instrs;
+  const auto lanes = static_cast<uint8_t>(ctx.width);
+
+  std::vector<ValueId> created;
+
+  // Kids come before their parents in `nodes`.
+  for (SlpNode& node : ctx.nodes) {
+    if (node.op == Opcode::nop) {
+      node.value = fn.create(
+        ctx.block, Opcode::pack, ctx.type, node.lanes.data(), ctx.width);
+    } else {
+      const ValueId ops[] = { ctx.nodes[node.kids[0]].value,
+                              ctx.nodes[node.kids[1]].value };
+      node.value = fn.create(ctx.block, node.op, ctx.type, ops, 2);
+    }
+
+    fn.instrs[node.value].lanes = lanes;
+    created.push_back(node.value);
+  }
+
+  const SlpNode& root = ctx.nodes.back();
+
+  std::vector<ValueId> repl(fn.instrs.size() + ctx.width, NONE);
+
+  for (size_t i = 0; i < ctx.width; ++i) {
+    const ValueId e =
+      fn.create(ctx.block, Opcode::extract, ctx.type, &root.value, 1, i);
+    repl[root.lanes[i]] = e;
+    created.push_back(e);
+  }
+
+  for (const ValueId v : ctx.members) {
+    fn.instrs[v].op           = Opcode::nop;
+    fn.instrs[v].num_operands = 0;
+  }
+
+  created.insert(created.end(), ctx.sunk.begin(), ctx.sunk.end());
+
+  for (size_t i = ctx.sunk.size(); i-- > 0;)
+    order.erase(order.begin() + ctx.position[ctx.sunk[i]]);
+
+  // Sunk instructions all came before the last member.
+  last -= static_cast<uint32_t>(ctx.sunk.size());
+  order.insert(order.begin() + last, created.begin(), created.end());
+  fn.replace_uses(repl);
+  fn.compact_blocks();
+}
+
+// Tries the seeds as the roots of a tree.
+static bool
+vectorize_group(SlpContext& ctx, const Lanes& seeds)
+{
+  ctx.nodes.clear();
+  ctx.packs.clear();
+  ctx.members.clear();
+  ctx.sunk.clear();
+
+  build_node(ctx, seeds, true);
+
+  uint32_t last = 0;
+
+  for (const ValueId v : ctx.members)
+    last = std::max(last, ctx.position[v]);
+
+  const bool ok = ctx.nodes.back().op != Opcode::nop && profitable(ctx, last);
+
+  if (ok)
+    emit_tree(ctx, last);
+
+  for (const ValueId v : ctx.members)
+    ctx.member[v] = false;
+
+  return ok;
+}
+
+// Looks for one group of seeds in the block that vectorizes.
+static bool
+vectorize_block(Function& fn, BlockId b)
+{
+  SlpContext ctx{ fn, b };
+
+  ctx.position.assign(fn.instrs.size(), NONE);
+  ctx.uses.assign(fn.instrs.size(), 0);
+  ctx.member.assign(fn.instrs.size(), false);
+
+  const auto& order = fn.blocks[b].instrs;
+
+  for (uint32_t i = 0; i < order.size(); ++i)
+    ctx.position[order[i]] = i;
+
+  for (const auto& block : fn.blocks) {
+    for (const ValueId v : block.instrs) {
+      for (size_t i = 0; i < fn.instrs[v].num_operands; ++i)
+        ++ctx.uses[fn.operand(v, i)];
+    }
+  }
+
+  // Depth of each packable operation in its chain within the block, seeds
+  // are drawn from the deepest first: (depth, opcode, type) -> values.
+  std::vector<uint32_t> depth(fn.instrs.size(), 0);
+  std::map<std::tuple<uint32_t, Opcode, uint8_t>,
+           std::vector<ValueId>,
+           std::greater<>>
+    groups;
+
+  for (const ValueId v : order) {
+    if (!is_packable(fn.instrs[v]))
+      continue;
+
+    for (size_t i = 0; i < 2; ++i) {
+      const ValueId op = fn.operand(v, i);
+
+      if (ctx.position[op] != NONE)
+        depth[v] = std::max(depth[v], depth[op]);
+    }
+
+    ++depth[v];
+    groups[{ depth[v], fn.instrs[v].op, fn.instrs[v].ty }].push_back(v);
+  }
+
+  for (const auto& [key, values] : groups) {
+    ctx.type  = static_cast<LangType>(std::get<2>(key));
+    ctx.width = width(ctx.type);
+
+    for (size_t i = 0; i + ctx.width <= values.size(); i += ctx.width) {
+      Lanes seeds = {};
+      std::copy_n(values.begin() + i, ctx.width, seeds.begin());
+
+      if (vectorize_group(ctx, seeds))
+        return true;
+    }
+  }
+
+  return false;
+}
+
+uint32_t
+vectorize_slp(Function& fn)
+{
+  uint32_t vectorized = 0;
+
+  // Every group changes the block, its state is rebuilt after each one.
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    while (vectorize_block(fn, b))
+      ++vectorized;
+  }
+
+  return vectorized;
+}
+
+} // namespace wcc::ir
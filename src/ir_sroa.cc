@@ -0,0 +1,174 @@
+#include "ir.h"
+#include "typecheck.h"
+
+#include <algorithm>
+
+namespace wcc::ir {
+
+// A scalar an array is accessed as, `type` at byte `offset`.
+struct Piece
+{
+  uint64_t offset;
+  LangType type;
+  ValueId  slot = NONE;
+
+  bool operator<(const Piece& other) const
+  {
+    return offset != other.offset ? offset < other.offset : type < other.type;
+  }
+
+  bool operator==(const Piece& other) const
+  {
+    return offset == other.offset && type == other.type;
+  }
+};
+
+// Type of the elements an aload reads or an astore writes.
+static LangType
+access_type(const Function& fn, ValueId v)
+{
+  if (fn.instrs[v].op == Opcode::aload)
+    return fn.instrs[v].type();
+
+  return fn.instrs[fn.operand(v, 1)].type();
+}
+
+static bool
+is_local_access(const Function& fn, ValueId v)
+{
+  const Instr& instr = fn.instrs[v];
+
+  return (instr.op == Opcode::aload || instr.op == Opcode::astore) &&
+         (instr.imm & LOCAL_ARRAY);
+}
+
+/*
+ * Escape analysis of the local arrays. Arrays have no address in the IR,
+ * only aload and astore name them, and the language can neither pass them
+ * to calls nor return them, so the memory of an array escapes its scalars
+ * only through the accesses themselves: an index not known at compile
+ * time, a vector access, or accesses overlapping without being the same
+ * scalar, which reinterpret bytes written as another type. Collects the
+ * pieces of the arrays that do not escape, an escaping array has none.
+ */
+static std::vector<uint8_t>
+find_escaping_arrays(const Function&                  fn,
+                     std::vector<std::vector<Piece>>& pieces)
+{
+  std::vector<uint8_t> escapes(fn.arrays.size(), 0);
+  pieces.assign(fn.arrays.size(), {});
+
+  for (const auto& block : fn.blocks) {
+    for (const ValueId v : block.instrs) {
+      if (!is_local_access(fn, v))
+        continue;
+
+      const uint64_t a     = fn.instrs[v].imm & ~LOCAL_ARRAY;
+      const ValueId  index = fn.operand(v, 0);
+      const LangType type  = access_type(fn, v);
+      const uint64_t size  = type_size(type);
+      const uint64_t bytes =
+        uint64_t(fn.arrays[a].length) * type_size(fn.arrays[a].type);
+
+      // A constant index out of range traps at its bounds check, such an
+      // array is left alone.
+      if (fn.instrs[v].lanes != 1 ||
+          fn.instrs[index].op != Opcode::constant ||
+          fn.instrs[index].imm >= bytes / size) {
+        escapes[a] = 1;
+        continue;
+      }
+
+      pieces[a].push_back(Piece{ fn.instrs[index].imm * size, type });
+    }
+  }
+
+  for (size_t a = 0; a < pieces.size(); ++a) {
+    auto& list = pieces[a];
+
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+
+    for (size_t p = 1; p < list.size() && !escapes[a]; ++p) {
+      escapes[a] |=
+        list[p - 1].offset + type_size(list[p - 1].type) > list[p].offset;
+    }
+
+    if (escapes[a])
+      list.clear();
+  }
+
+  return escapes;
+}
+
+uint32_t
+scalarize_aggregates(Function& fn)
+{
+  std::vector<std::vector<Piece>> pieces;
+  const std::vector<uint8_t>      escapes = find_escaping_arrays(fn, pieces);
+
+  // Every piece becomes a local slot. Local slots start out zeroed like the
+  // arrays, and parts of an array never accessed are never read either.
+  std::vector<ValueId> slots;
+
+  for (size_t a = 0; a < pieces.size(); ++a) {
+    for (Piece& piece : pieces[a]) {
+      piece.slot = fn.create(0, Opcode::local, piece.type, nullptr, 0);
+      slots.push_back(piece.slot);
+    }
+  }
+
+  auto& entry = fn.blocks[0].instrs;
+  entry.insert(entry.begin(), slots.begin(), slots.end());
+
+  // Arrays that stay are renumbered past the ones split up.
+  std::vector<uint64_t> number(fn.arrays.size(), NONE);
+  std::vector<Array>    kept;
+
+  for (size_t a = 0; a < fn.arrays.size(); ++a) {
+    if (escapes[a]) {
+      number[a] = kept.size();
+      kept.push_back(fn.arrays[a]);
+    }
+  }
+
+  for (const auto& block : fn.blocks) {
+    for (const ValueId v : block.instrs) {
+      if (!is_local_access(fn, v))
+        continue;
+
+      Instr&         instr = fn.instrs[v];
+      const uint64_t a     = instr.imm & ~LOCAL_ARRAY;
+
+      if (escapes[a]) {
+        instr.imm = LOCAL_ARRAY | number[a];
+        continue;
+      }
+
+      const LangType type = access_type(fn, v);
+      const Piece    key{ fn.instrs[fn.operand(v, 0)].imm * type_size(type),
+                          type };
+      const ValueId  slot =
+        std::lower_bound(pieces[a].begin(), pieces[a].end(), key)->slot;
+
+      if (instr.op == Opcode::aload) {
+        instr.op  = Opcode::load;
+        instr.imm = 0;
+        fn.set_operands(v, &slot, 1);
+      } else {
+        const ValueId ops[] = { slot, fn.operand(v, 1) };
+
+        instr.op  = Opcode::store;
+        instr.imm = 0;
+        fn.set_operands(v, ops, 2);
+      }
+    }
+  }
+
+  const uint32_t split = fn.arrays.size() - kept.size();
+  fn.arrays            = std::move(kept);
+
+  return split;
+}
+
+} // namespace wcc::ir
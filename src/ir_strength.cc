@@ -0,0 +1,300 @@
+#include "fold.h"
+#include "ir.h"
+#include "typecheck.h"
+
+namespace wcc::ir {
+
+/*
+ * Multiplication, division and modulo by constants rewritten into shifts,
+ * additions and multiplications by a magic number keeping the upper half
+ * of the product (Granlund and Montgomery, "Division by Invariant Integers
+ * using Multiplication", 1994). Everything is computed at the width of the
+ * operand type, so the same sequences are exact for i8 up to u64.
+ */
+
+// Emits the replacement sequence of one instruction into the new order of
+// its block.
+struct StrengthContext
+{
+  Function&             fn;
+  BlockId               block;
+  LangType              type;
+  unsigned              bits;
+  std::vector<ValueId>& order;
+
+  ValueId emit(Opcode op, std::initializer_list<ValueId> ops, uint64_t imm)
+  {
+    const ValueId v = fn.create(block, op, type, ops.begin(), ops.size(), imm);
+    order.push_back(v);
+    return v;
+  }
+
+  ValueId constant(uint64_t bits)
+  {
+    return emit(Opcode::constant, {}, normalize_constant(type, bits));
+  }
+
+  ValueId binary(Opcode op, ValueId lhs, ValueId rhs)
+  {
+    return emit(op, { lhs, rhs }, 0);
+  }
+
+  ValueId shift(Opcode op, ValueId value, unsigned count)
+  {
+    return count == 0 ? value : binary(op, value, constant(count));
+  }
+};
+
+static bool
+is_power_of_two(uint64_t value)
+{
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+static unsigned
+log2_floor(uint64_t value)
+{
+  return 63 - static_cast<unsigned>(__builtin_clzll(value));
+}
+
+// Smallest l with value <= 2^l, value at least 2.
+static unsigned
+log2_ceil(uint64_t value)
+{
+  return log2_floor(value - 1) + 1;
+}
+
+static uint64_t
+width_mask(unsigned bits)
+{
+  return bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+}
+
+// Factors a single lea computes: x + x * 2, 4 or 8.
+static bool
+is_lea_factor(uint64_t value)
+{
+  return value == 3 || value == 5 || value == 9;
+}
+
+// x * c as shifts and one addition or subtraction, NONE if imul is as
+// cheap. Multiplications by 3, 5 and 9 are left to instruction selection,
+// which has a single lea for them.
+static ValueId
+reduce_mul(StrengthContext& ctx, ValueId x, uint64_t c)
+{
+  const uint64_t mask = width_mask(ctx.bits);
+  const uint64_t u    = c & mask;
+  const uint64_t neg  = (0 - u) & mask;
+
+  if (u == 0)
+    return ctx.constant(0);
+
+  if (u == 1)
+    return x;
+
+  const unsigned low = static_cast<unsigned>(__builtin_ctzll(u));
+  const uint64_t odd = u >> low;
+
+  if (odd == 1)
+    return ctx.shift(Opcode::shl, x, low);
+
+  if (is_lea_factor(odd)) {
+    if (low == 0)
+      return NONE;
+
+    const ValueId f = ctx.binary(Opcode::mul, x, ctx.constant(odd));
+    return ctx.shift(Opcode::shl, f, low);
+  }
+
+  // 2^a + 2^b
+  if (is_power_of_two(odd - 1)) {
+    const ValueId high = ctx.shift(Opcode::shl, x, log2_floor(u));
+    return ctx.binary(Opcode::add, high, ctx.shift(Opcode::shl, x, low));
+  }
+
+  // 2^k - 1
+  if (low == 0 && is_power_of_two((u + 1) & mask)) {
+    const ValueId high = ctx.shift(Opcode::shl, x, log2_floor(u + 1));
+    return ctx.binary(Opcode::sub, high, x);
+  }
+
+  // -2^k
+  if (is_power_of_two(neg)) {
+    const ValueId high = ctx.shift(Opcode::shl, x, log2_floor(neg));
+    return ctx.binary(Opcode::sub, ctx.constant(0), high);
+  }
+
+  return NONE;
+}
+
+// x / d for unsigned x and d >= 1.
+static ValueId
+reduce_udiv(StrengthContext& ctx, ValueId x, uint64_t d)
+{
+  const unsigned N = ctx.bits;
+
+  if (d == 1)
+    return x;
+
+  if (is_power_of_two(d))
+    return ctx.shift(Opcode::shr, x, log2_floor(d));
+
+  const unsigned l = log2_ceil(d);
+
+  // With 2^(N+s) <= m * d <= 2^(N+s) + 2^s, floor(m * x / 2^(N+s)) is
+  // floor(x / d) for every N bit x (Theorem 4.2). The smallest such s whose
+  // m fits in N bits needs one mulhi and a shift.
+  for (unsigned s = 0; s < l; ++s) {
+    const __uint128_t p = __uint128_t(1) << (N + s);
+    const __uint128_t m = (p + d - 1) / d;
+
+    if (m >> N == 0 && m * d - p <= (__uint128_t(1) << s)) {
+      const ValueId hi = ctx.binary(Opcode::mulhi, x, ctx.constant(m));
+      return ctx.shift(Opcode::shr, hi, s);
+    }
+  }
+
+  // Otherwise the multiplier has N + 1 bits. Its implicit top bit adds x
+  // back, halved first to stay within N bits (Figure 4.1).
+  const __uint128_t p = (__uint128_t(1) << N) * ((__uint128_t(1) << l) - d);
+  const uint64_t    m = static_cast<uint64_t>(p / d + 1);
+
+  const ValueId t    = ctx.binary(Opcode::mulhi, x, ctx.constant(m));
+  const ValueId half = ctx.shift(Opcode::shr, ctx.binary(Opcode::sub, x, t), 1);
+  return ctx.shift(Opcode::shr, ctx.binary(Opcode::add, t, half), l - 1);
+}
+
+// x / d for signed x and d, truncating. NONE for d = -1, which traps on the
+// smallest x like idiv does.
+static ValueId
+reduce_sdiv(StrengthContext& ctx, ValueId x, int64_t d)
+{
+  const unsigned N = ctx.bits;
+  const uint64_t a = d < 0 ? 0 - static_cast<uint64_t>(d) : d;
+
+  if (d == 1)
+    return x;
+
+  if (d == -1)
+    return NONE;
+
+  const ValueId sign = ctx.shift(Opcode::sar, x, N - 1);
+  ValueId       q;
+
+  if (is_power_of_two(a)) {
+    // Negative x rounds toward zero with a bias of 2^k - 1.
+    const unsigned k    = log2_floor(a);
+    const ValueId  bias = ctx.shift(Opcode::shr, sign, N - k);
+
+    q = ctx.shift(Opcode::sar, ctx.binary(Opcode::add, x, bias), k);
+  } else {
+    // m = 1 + floor(2^(N+l-1) / |d|) lies in [2^(N-1), 2^N), its low N bits
+    // read as signed are m - 2^N and x + mulhi(x, m - 2^N) is
+    // floor(m * x / 2^N) (Figure 5.1).
+    const unsigned    l = log2_ceil(a);
+    const __uint128_t m = ((__uint128_t(1) << (N + l - 1)) / a) + 1;
+
+    const ValueId hi  = ctx.binary(Opcode::mulhi, x, ctx.constant(m));
+    const ValueId sum = ctx.binary(Opcode::add, x, hi);
+
+    q = ctx.binary(Opcode::sub, ctx.shift(Opcode::sar, sum, l - 1), sign);
+  }
+
+  if (d < 0)
+    q = ctx.binary(Opcode::sub, ctx.constant(0), q);
+
+  return q;
+}
+
+// Replacement of `v`, a mul, div or mod with a constant operand, NONE if it
+// stays.
+static ValueId
+reduce(StrengthContext& ctx, ValueId v)
+{
+  const Function& fn  = ctx.fn;
+  const Instr&    ins = fn.instrs[v];
+  ValueId         lhs = fn.operand(v, 0);
+  ValueId         rhs = fn.operand(v, 1);
+
+  if (ins.op == Opcode::mul && fn.instrs[lhs].op == Opcode::constant)
+    std::swap(lhs, rhs);
+
+  if (fn.instrs[rhs].op != Opcode::constant ||
+      fn.instrs[lhs].op == Opcode::constant)
+    return NONE;
+
+  const Opcode   op   = ins.op;
+  const uint64_t c    = fn.instrs[rhs].imm;
+  const bool     sign = is_signed(ctx.type);
+
+  if (op == Opcode::mul)
+    return reduce_mul(ctx, lhs, c);
+
+  // Division by zero traps at run time.
+  if (c == 0)
+    return NONE;
+
+  if (op == Opcode::mod && !sign && is_power_of_two(c))
+    return ctx.binary(Opcode::bit_and, lhs, ctx.constant(c - 1));
+
+  if (op == Opcode::mod && c == 1)
+    return ctx.constant(0);
+
+  const ValueId q = sign ? reduce_sdiv(ctx, lhs, static_cast<int64_t>(c))
+                         : reduce_udiv(ctx, lhs, c);
+
+  if (q == NONE || op == Opcode::div)
+    return q;
+
+  // x % d = x - x / d * d
+  ValueId product = reduce_mul(ctx, q, c);
+
+  if (product == NONE)
+    product = ctx.binary(Opcode::mul, q, ctx.constant(c));
+
+  return ctx.binary(Opcode::sub, lhs, product);
+}
+
+void
+reduce_strength(Function& fn)
+{
+  std::vector<ValueId> repl(fn.instrs.size(), NONE);
+
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    std::vector<ValueId> order;
+    order.reserve(fn.blocks[b].instrs.size());
+
+    for (const ValueId v : fn.blocks[b].instrs) {
+      const Opcode   op   = fn.instrs[v].op;
+      const LangType type = fn.instrs[v].type();
+
+      if ((op != Opcode::mul && op != Opcode::div && op != Opcode::mod) ||
+          !is_integer(type)) {
+        order.push_back(v);
+        continue;
+      }
+
+      StrengthContext ctx{ fn, b, type, type_size(type) * 8u, order };
+      const size_t    mark = order.size();
+      const ValueId   r    = reduce(ctx, v);
+
+      if (r == NONE) {
+        order.resize(mark);
+        order.push_back(v);
+        continue;
+      }
+
+      repl[v]                   = r;
+      fn.instrs[v].op           = Opcode::nop;
+      fn.instrs[v].num_operands = 0;
+    }
+
+    fn.blocks[b].instrs = std::move(order);
+  }
+
+  repl.resize(fn.instrs.size(), NONE);
+  fn.replace_uses(repl);
+}
+
+} // namespace wcc::ir
@@ -0,0 +1,134 @@
+#include "ir.h"
+
+namespace wcc::ir {
+
+// The call to `self` a block ends with, returning its result right away,
+// NONE if there is none.
+static ValueId
+self_tail_call(const Function& fn, BlockId b, uint32_t self)
+{
+  const auto& order = fn.blocks[b].instrs;
+
+  if (order.size() < 2)
+    return NONE;
+
+  const ValueId ret  = order.back();
+  const ValueId call = order[order.size() - 2];
+
+  if (fn.instrs[ret].op != Opcode::ret || fn.instrs[call].op != Opcode::call ||
+      fn.instrs[call].imm != self)
+    return NONE;
+
+  if (fn.instrs[ret].num_operands == 0)
+    return fn.instrs[call].type() == LangType::lt_void ? call : NONE;
+
+  return fn.operand(ret, 0) == call ? call : NONE;
+}
+
+uint32_t
+eliminate_tail_recursion(Function& fn, uint32_t self)
+{
+  // Local arrays would have to be zeroed again for every iteration.
+  if (!fn.arrays.empty())
+    return 0;
+
+  std::vector<BlockId> sites;
+
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    if (self_tail_call(fn, b, self) != NONE)
+      sites.push_back(b);
+  }
+
+  if (sites.empty())
+    return 0;
+
+  // The entry keeps the parameters and falls into a new header, which gets
+  // everything else and becomes the target of the tail calls.
+  const BlockId header = fn.add_block();
+
+  std::vector<ValueId> params(fn.params.size(), NONE);
+  std::vector<ValueId> kept;
+
+  for (const ValueId v : fn.blocks[0].instrs) {
+    if (fn.instrs[v].op == Opcode::param) {
+      params[fn.instrs[v].imm] = v;
+      kept.push_back(v);
+    } else {
+      fn.instrs[v].block = header;
+      fn.blocks[header].instrs.push_back(v);
+    }
+  }
+
+  for (uint32_t i = 0; i < params.size(); ++i) {
+    if (params[i] == NONE) {
+      params[i] = fn.create(0, Opcode::param, fn.params[i], nullptr, 0, i);
+      kept.push_back(params[i]);
+    }
+  }
+
+  fn.blocks[0].instrs = std::move(kept);
+  fn.blocks[header].succs = std::move(fn.blocks[0].succs);
+  fn.blocks[0].succs.clear();
+
+  for (const BlockId s : fn.blocks[header].succs) {
+    for (BlockId& pred : fn.blocks[s].preds) {
+      if (pred == 0)
+        pred = header;
+    }
+  }
+
+  fn.append(0, Opcode::br, LangType::lt_void);
+  fn.add_edge(0, header);
+
+  // Every tail call passes its arguments to the parameter phis of the header
+  // and branches back to it.
+  std::vector<std::vector<ValueId>> incoming(params.size(),
+                                             std::vector<ValueId>(1, NONE));
+
+  for (BlockId& site : sites) {
+    if (site == 0)
+      site = header;
+
+    auto&         order = fn.blocks[site].instrs;
+    const ValueId call  = order[order.size() - 2];
+
+    for (uint32_t i = 0; i < params.size(); ++i)
+      incoming[i].push_back(fn.operand(call, i));
+
+    fn.instrs[order.back()].op = Opcode::nop;
+    fn.instrs[call].op         = Opcode::nop;
+    order.resize(order.size() - 2);
+
+    fn.append(site, Opcode::br, LangType::lt_void);
+    fn.add_edge(site, header);
+  }
+
+  std::vector<ValueId> phis;
+
+  for (uint32_t i = 0; i < params.size(); ++i) {
+    phis.push_back(fn.create(header,
+                             Opcode::phi,
+                             fn.params[i],
+                             incoming[i].data(),
+                             incoming[i].size()));
+  }
+
+  auto& order = fn.blocks[header].instrs;
+  order.insert(order.begin(), phis.begin(), phis.end());
+
+  // Uses of the parameters, the arguments of the tail calls included, see
+  // the phis instead. The entry edge brings the parameters themselves.
+  std::vector<ValueId> repl(fn.instrs.size(), NONE);
+
+  for (uint32_t i = 0; i < params.size(); ++i)
+    repl[params[i]] = phis[i];
+
+  fn.replace_uses(repl);
+
+  for (uint32_t i = 0; i < params.size(); ++i)
+    fn.operands_of(phis[i])[0] = params[i];
+
+  return static_cast<uint32_t>(sites.size());
+}
+
+} // namespace wcc::ir
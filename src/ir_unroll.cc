@@ -0,0 +1,304 @@
+#include "ir.h"
+
+#include <algorithm>
+
+namespace wcc::ir {
+
+// Loops the unroller handles: innermost, one latch, and the header as the
+// only way out into an exit nothing else branches to.
+static bool
+unrollable(const Function& fn, const Loop& loop)
+{
+  if (!loop.innermost || loop.latches.size() != 1 || loop.exits.size() != 1)
+    return false;
+
+  const Block& header = fn.blocks[loop.header];
+
+  if (header.preds.size() != 2 ||
+      fn.instrs[header.instrs.back()].op != Opcode::condbr)
+    return false;
+
+  const auto& exit_preds = fn.blocks[loop.exits[0]].preds;
+  return exit_preds.size() == 1 && exit_preds[0] == loop.header;
+}
+
+static uint32_t
+loop_size(const Function& fn, const Loop& loop)
+{
+  uint32_t size = 0;
+
+  for (const BlockId b : loop.blocks)
+    size += static_cast<uint32_t>(fn.blocks[b].instrs.size());
+
+  return size;
+}
+
+// Replaces the exit test of a copy of the header by a constant.
+static void
+fix_exit_test(Function& fn, BlockId header, BlockId exit, bool exits)
+{
+  const ValueId term  = fn.blocks[header].instrs.back();
+  const bool    taken = fn.blocks[header].succs[0] != exit;
+
+  const ValueId constant = fn.create(header,
+                                     Opcode::constant,
+                                     LangType::lt_i32,
+                                     nullptr,
+                                     0,
+                                     exits != taken ? 1 : 0);
+
+  auto& order = fn.blocks[header].instrs;
+  order.insert(order.end() - 1, constant);
+  fn.operands_of(term)[0] = constant;
+}
+
+/*
+ * Lays out `copies` copies of the loop, the original first, in a chain: the
+ * latch of every copy branches to the header of the next, the last one back
+ * to the original header. Header phis of a copy are the values its
+ * predecessor passes along the back edge. Every header keeps its exit test.
+ *
+ * Values of the header used after the loop are merged by new phis in the
+ * exit, which gains an edge from every copy.
+ */
+static std::vector<BlockId>
+replicate(Function& fn, const Loop& loop, uint32_t copies)
+{
+  const BlockId header = loop.header;
+  const BlockId latch  = loop.latches[0];
+  const BlockId exit   = loop.exits[0];
+  const size_t  back   = fn.blocks[header].preds[0] == latch ? 0 : 1;
+
+  std::vector<ValueId> header_values;
+
+  for (const ValueId v : fn.blocks[header].instrs)
+    header_values.push_back(v);
+
+  // Uses after the loop, before any copy exists.
+  std::vector<std::pair<ValueId, size_t>> outside_uses;
+
+  for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+    if (std::find(loop.blocks.begin(), loop.blocks.end(), b) !=
+        loop.blocks.end())
+      continue;
+
+    for (const ValueId v : fn.blocks[b].instrs) {
+      if (b == exit && fn.instrs[v].op == Opcode::phi)
+        continue;
+
+      for (size_t i = 0; i < fn.instrs[v].num_operands; ++i) {
+        if (fn.instrs[fn.operand(v, i)].block == header)
+          outside_uses.emplace_back(v, i);
+      }
+    }
+  }
+
+  std::vector<BlockId> headers{ header };
+
+  // map[v]: the copy of `v` in the copy being built, v itself in the
+  // original.
+  std::vector<ValueId> map(fn.instrs.size());
+  std::vector<ValueId> prev(fn.instrs.size());
+
+  for (ValueId v = 0; v < map.size(); ++v)
+    map[v] = v;
+
+  std::vector<std::vector<ValueId>> exit_values(header_values.size());
+
+  for (size_t i = 0; i < header_values.size(); ++i)
+    exit_values[i].push_back(header_values[i]);
+
+  std::vector<BlockId> blocks(fn.blocks.size(), NONE);
+  BlockId              prev_latch = latch;
+  std::vector<ValueId> ops;
+
+  for (uint32_t c = 1; c < copies; ++c) {
+    prev = map;
+
+    for (const BlockId b : loop.blocks)
+      blocks[b] = fn.add_block();
+
+    for (const BlockId b : loop.blocks) {
+      for (const ValueId v : fn.blocks[b].instrs) {
+        const Instr instr = fn.instrs[v];
+
+        if (b == header && instr.op == Opcode::phi) {
+          map[v] = prev[fn.operand(v, back)];
+          continue;
+        }
+
+        ops.assign(fn.operands_of(v), fn.operands_of(v) + instr.num_operands);
+        map[v] = fn.create(
+          blocks[b], instr.op, instr.type(), ops.data(), ops.size(), instr.imm);
+        fn.instrs[map[v]].lanes = instr.lanes;
+        fn.blocks[blocks[b]].instrs.push_back(map[v]);
+      }
+    }
+
+    // Operands are mapped once every value of the copy exists, phis of
+    // inner blocks may refer to values defined later in the copy.
+    for (const BlockId b : loop.blocks) {
+      for (const ValueId v : fn.blocks[blocks[b]].instrs) {
+        ValueId* operands = fn.operands_of(v);
+
+        for (size_t i = 0; i < fn.instrs[v].num_operands; ++i)
+          operands[i] = map[operands[i]];
+      }
+
+      // The back edge goes to the original header until the next copy
+      // takes it.
+      for (const BlockId succ : fn.blocks[b].succs) {
+        const bool out = succ == header || succ == exit;
+        fn.blocks[blocks[b]].succs.push_back(out ? succ : blocks[succ]);
+      }
+
+      if (b == header)
+        continue;
+
+      for (const BlockId pred : fn.blocks[b].preds)
+        fn.blocks[blocks[b]].preds.push_back(blocks[pred]);
+    }
+
+    // The previous copy continues into this one. The original latch is
+    // still cloned from and changes last.
+    const BlockId copy_header = blocks[header];
+
+    if (prev_latch != latch) {
+      auto& succs = fn.blocks[prev_latch].succs;
+      std::replace(succs.begin(), succs.end(), header, copy_header);
+    }
+
+    fn.blocks[copy_header].preds.push_back(prev_latch);
+
+    fn.blocks[exit].preds.push_back(copy_header);
+
+    for (size_t i = 0; i < header_values.size(); ++i)
+      exit_values[i].push_back(map[header_values[i]]);
+
+    headers.push_back(copy_header);
+    prev_latch = blocks[latch];
+  }
+
+  if (copies > 1) {
+    auto& succs = fn.blocks[latch].succs;
+    std::replace(succs.begin(), succs.end(), header, headers[1]);
+  }
+
+  // The last copy closes the loop.
+  fn.blocks[header].preds[back] = prev_latch;
+
+  for (const ValueId v : header_values) {
+    if (fn.instrs[v].op != Opcode::phi)
+      break;
+
+    fn.operands_of(v)[back] = map[fn.operand(v, back)];
+  }
+
+  // Exit phis get an operand per copy.
+  for (const ValueId v : fn.blocks[exit].instrs) {
+    if (fn.instrs[v].op != Opcode::phi)
+      break;
+
+    const ValueId value = fn.operand(v, 0);
+
+    ops.clear();
+
+    for (uint32_t c = 0; c < copies; ++c) {
+      const auto it =
+        std::find(header_values.begin(), header_values.end(), value);
+
+      ops.push_back(it == header_values.end()
+                      ? value
+                      : exit_values[it - header_values.begin()][c]);
+    }
+
+    fn.set_operands(v, ops.data(), ops.size());
+  }
+
+  std::vector<ValueId> merged(fn.instrs.size(), NONE);
+  auto&                exit_order = fn.blocks[exit].instrs;
+
+  for (const auto& [user, i] : outside_uses) {
+    const ValueId value = fn.operand(user, i);
+    const size_t  k =
+      std::find(header_values.begin(), header_values.end(), value) -
+      header_values.begin();
+
+    if (merged[value] == NONE) {
+      merged[value] = fn.create(exit,
+                                Opcode::phi,
+                                fn.instrs[value].type(),
+                                exit_values[k].data(),
+                                exit_values[k].size());
+      fn.instrs[merged[value]].lanes = fn.instrs[value].lanes;
+      exit_order.insert(exit_order.begin(), merged[value]);
+    }
+
+    fn.operands_of(user)[i] = merged[value];
+  }
+
+  return headers;
+}
+
+uint32_t
+unroll_loops(Function& fn, const UnrollOptions& options)
+{
+  std::vector<BlockId> done;
+  uint32_t             unrolled = 0;
+
+  for (;;) {
+    const LoopInfo info = find_loops(fn);
+    const Loop*    loop = nullptr;
+
+    for (const Loop& candidate : info.loops) {
+      if (unrollable(fn, candidate) &&
+          std::find(done.begin(), done.end(), candidate.header) == done.end()) {
+        loop = &candidate;
+        break;
+      }
+    }
+
+    if (loop == nullptr)
+      break;
+
+    done.push_back(loop->header);
+
+    const std::optional<uint64_t> count = trip_count(fn, *loop);
+    const uint32_t                size  = loop_size(fn, *loop);
+
+    // A complete unroll runs the header once more than the body, for the
+    // test that leaves.
+    if (count.has_value() && *count <= options.full_trip_count &&
+        size * (*count + 1) <= options.max_size) {
+      const auto headers =
+        replicate(fn, *loop, static_cast<uint32_t>(*count + 1));
+
+      for (size_t c = 0; c < headers.size(); ++c)
+        fix_exit_test(fn, headers[c], loop->exits[0], c == *count);
+    } else {
+      uint32_t factor = std::min(options.factor, options.max_size / size);
+
+      // With a known count every exit happens in the original header.
+      while (count.has_value() && factor > 1 && *count % factor != 0)
+        --factor;
+
+      if (factor < 2)
+        continue;
+
+      const auto headers = replicate(fn, *loop, factor);
+
+      if (count.has_value()) {
+        for (size_t c = 1; c < headers.size(); ++c)
+          fix_exit_test(fn, headers[c], loop->exits[0], false);
+      }
+    }
+
+    propagate_constants(fn);
+    merge_blocks(fn);
+    ++unrolled;
+  }
+
+  return unrolled;
+}
+
+} // namespace wcc::ir
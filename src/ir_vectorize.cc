@@ -0,0 +1,488 @@
+#include "ir.h"
+#include "typecheck.h"
+
+#include <map>
+
+namespace wcc::ir {
+
+// Vectors of the loop vectorizer are 32 bytes: eight f32, i32 or u32 lanes
+// or four f64 lanes.
+constexpr uint32_t VECTOR_BYTES = 32;
+
+// What an instruction of the loop body becomes in the vector loop.
+enum class Role : uint8_t
+{
+  none,
+  index,  // i + c or its conversion to i64, computed once for lane 0
+  vector, // element loads and arithmetic, one vector operation
+  check,  // bounds of an index, checked for the first and the last lane
+  store,  // element store of a vector
+};
+
+struct VectorPlan
+{
+  ValueId              phi;   // the induction variable, counting up by one
+  ValueId              bound; // loop invariant, the loop runs while phi < it
+  LangType             type = LangType::lt_void; // of the elements
+  std::vector<Role>    role;   // per value of the function
+  std::vector<int64_t> offset; // per index value, its c
+};
+
+static bool
+is_element_type(LangType type)
+{
+  return type == LangType::lt_i32 || type == LangType::lt_u32 ||
+         type == LangType::lt_f32 || type == LangType::lt_f64;
+}
+
+static bool
+is_vector_op(const Instr& instr)
+{
+  switch (instr.op) {
+    case Opcode::add:
+    case Opcode::sub:
+    case Opcode::mul:
+    case Opcode::bit_and:
+    case Opcode::bit_or:
+    case Opcode::bit_xor:
+      return true;
+    case Opcode::div:
+      return is_float(instr.type());
+    default:
+      return false;
+  }
+}
+
+// i + c in the type of i, or i or i + c converted to i64 without changing
+// the value an index in bounds has.
+static bool
+classify_index(const Function& fn, VectorPlan& plan, ValueId v)
+{
+  const Instr& instr = fn.instrs[v];
+  const Instr& iv    = fn.instrs[plan.phi];
+
+  if (instr.op == Opcode::add && instr.ty == iv.ty) {
+    const ValueId lhs = fn.operand(v, 0);
+    const ValueId rhs = fn.operand(v, 1);
+    const ValueId c   = lhs == plan.phi ? rhs : lhs;
+
+    if ((lhs != plan.phi && rhs != plan.phi) ||
+        fn.instrs[c].op != Opcode::constant)
+      return false;
+
+    plan.offset[v] = static_cast<int64_t>(fn.instrs[c].imm);
+    return true;
+  }
+
+  if (instr.op != Opcode::conv || instr.type() != LangType::lt_i64)
+    return false;
+
+  const auto    kind  = static_cast<ConvKind>(instr.imm);
+  const ValueId value = fn.operand(v, 0);
+
+  if ((kind != ConvKind::sext && kind != ConvKind::zext) ||
+      (value != plan.phi && plan.role[value] != Role::index))
+    return false;
+
+  plan.offset[v] = value == plan.phi ? 0 : plan.offset[value];
+  return true;
+}
+
+// An i64 element index: one of the index values, or the variable itself.
+static bool
+is_index(const Function& fn, const VectorPlan& plan, ValueId v)
+{
+  if (v == plan.phi)
+    return fn.instrs[v].type() == LangType::lt_i64;
+
+  return plan.role[v] == Role::index &&
+         fn.instrs[v].type() == LangType::lt_i64;
+}
+
+static int64_t
+offset_of(const VectorPlan& plan, ValueId index)
+{
+  return index == plan.phi ? 0 : plan.offset[index];
+}
+
+/*
+ * Loops the vectorizer handles: innermost, a header holding only the
+ * induction variable and its test `i < n` with n invariant, and a single
+ * body block that is the latch. The body consists of element loads,
+ * arithmetic on elements of one type and invariants, and element stores,
+ * all indexed by i plus constants. A stored array is only ever accessed at
+ * one offset, so no iteration reads what another writes.
+ */
+static bool
+plan_loop(const Function& fn,
+          const LoopInfo& info,
+          uint32_t        l,
+          VectorPlan&     plan)
+{
+  const Loop& loop = info.loops[l];
+
+  if (!loop.innermost || loop.latches.size() != 1 || loop.blocks.size() != 2)
+    return false;
+
+  const BlockId body   = loop.latches[0];
+  const Block&  header = fn.blocks[loop.header];
+
+  if (header.instrs.size() != 3 || header.preds.size() != 2 ||
+      header.succs[0] != body || fn.blocks[body].succs.size() != 1)
+    return false;
+
+  const ValueId phi  = header.instrs[0];
+  const ValueId cond = header.instrs[1];
+
+  if (fn.instrs[header.instrs[2]].op != Opcode::condbr ||
+      fn.operand(header.instrs[2], 0) != cond)
+    return false;
+
+  const auto ivs = induction_vars(fn, loop);
+
+  if (ivs.size() != 1 || ivs[0].phi != phi || ivs[0].step != 1 ||
+      type_size(fn.instrs[phi].type()) < 4)
+    return false;
+
+  if (fn.instrs[cond].op != Opcode::cmp_lt || fn.operand(cond, 0) != phi ||
+      info.contains(l, fn.instrs[fn.operand(cond, 1)].block))
+    return false;
+
+  plan.phi   = phi;
+  plan.bound = fn.operand(cond, 1);
+  plan.role.assign(fn.instrs.size(), Role::none);
+  plan.offset.assign(fn.instrs.size(), 0);
+
+  const auto invariant = [&](ValueId v) {
+    return !info.contains(l, fn.instrs[v].block);
+  };
+
+  const auto element = [&](LangType type) {
+    if (plan.type == LangType::lt_void)
+      plan.type = type;
+
+    return type == plan.type && is_element_type(type);
+  };
+
+  const auto vector_operand = [&](ValueId v) {
+    return plan.role[v] == Role::vector ||
+           (invariant(v) && fn.instrs[v].type() == plan.type);
+  };
+
+  // Offset every stored array is accessed at.
+  std::map<uint64_t, int64_t> stored;
+  bool                        stores = false;
+
+  const auto& instrs = fn.blocks[body].instrs;
+
+  for (size_t i = 0; i + 1 < instrs.size(); ++i) {
+    const ValueId v     = instrs[i];
+    const Instr&  instr = fn.instrs[v];
+
+    if (instr.lanes != 1)
+      return false;
+
+    switch (instr.op) {
+      case Opcode::add:
+      case Opcode::conv:
+        if (classify_index(fn, plan, v)) {
+          plan.role[v] = Role::index;
+          continue;
+        }
+        break;
+
+      case Opcode::bounds:
+        if (!is_index(fn, plan, fn.operand(v, 0)))
+          return false;
+
+        plan.role[v] = Role::check;
+        continue;
+
+      case Opcode::aload:
+        if (!is_index(fn, plan, fn.operand(v, 0)) || !element(instr.type()))
+          return false;
+
+        plan.role[v] = Role::vector;
+        continue;
+
+      case Opcode::astore: {
+        const ValueId index = fn.operand(v, 0);
+        const ValueId value = fn.operand(v, 1);
+
+        if (!is_index(fn, plan, index) ||
+            !element(fn.instrs[value].type()) || !vector_operand(value))
+          return false;
+
+        const int64_t offset = offset_of(plan, index);
+
+        if (stored.emplace(instr.imm, offset).first->second != offset)
+          return false;
+
+        plan.role[v] = Role::store;
+        stores       = true;
+        continue;
+      }
+
+      default:
+        break;
+    }
+
+    if (!is_vector_op(instr) || !element(instr.type()) ||
+        !vector_operand(fn.operand(v, 0)) || !vector_operand(fn.operand(v, 1)))
+      return false;
+
+    plan.role[v] = Role::vector;
+  }
+
+  // Loads of stored arrays at the offset of the stores only.
+  for (size_t i = 0; i + 1 < instrs.size(); ++i) {
+    const ValueId v  = instrs[i];
+    const auto    it = stored.find(fn.instrs[v].imm);
+
+    if (fn.instrs[v].op == Opcode::aload && it != stored.end() &&
+        it->second != offset_of(plan, fn.operand(v, 0)))
+      return false;
+  }
+
+  // Index values only serve as indices, the next value of the variable
+  // aside, which the header phi reads.
+  for (const ValueId v : instrs) {
+    for (size_t k = 0; k < fn.instrs[v].num_operands; ++k) {
+      const ValueId op = fn.operand(v, k);
+      const Opcode  by = fn.instrs[v].op;
+
+      const bool as_index =
+        k == 0 && (by == Opcode::aload || by == Opcode::astore ||
+                   by == Opcode::bounds || by == Opcode::conv);
+
+      if (plan.role[op] == Role::index && !as_index)
+        return false;
+    }
+  }
+
+  if (!stores)
+    return false;
+
+  const auto count = trip_count(fn, loop);
+  return !count.has_value() ||
+         *count >= VECTOR_BYTES / type_size(plan.type);
+}
+
+struct VectorContext
+{
+  Function&                  fn;
+  const VectorPlan&          plan;
+  BlockId                    preheader;
+  uint8_t                    lanes;
+  std::vector<ValueId>       map;    // scalar value -> vector loop value
+  std::map<ValueId, ValueId> splats; // invariant -> vector of it
+};
+
+static ValueId
+emit(Function&                   fn,
+     BlockId                     block,
+     Opcode                      op,
+     LangType                    type,
+     const std::vector<ValueId>& ops,
+     uint64_t                    imm   = 0,
+     uint8_t                     lanes = 1)
+{
+  const ValueId v = fn.create(block, op, type, ops.data(), ops.size(), imm);
+
+  fn.instrs[v].lanes = lanes;
+  fn.blocks[block].instrs.push_back(v);
+  return v;
+}
+
+// Invariants go before the branch ending the preheader.
+static ValueId
+emit_invariant(VectorContext&              ctx,
+               Opcode                      op,
+               LangType                    type,
+               const std::vector<ValueId>& ops,
+               uint64_t                    imm   = 0,
+               uint8_t                     lanes = 1)
+{
+  Function&     fn = ctx.fn;
+  const ValueId v =
+    fn.create(ctx.preheader, op, type, ops.data(), ops.size(), imm);
+
+  fn.instrs[v].lanes = lanes;
+
+  auto& order = fn.blocks[ctx.preheader].instrs;
+  order.insert(order.end() - 1, v);
+  return v;
+}
+
+// Vector operand for `v`: its vector counterpart, or an invariant broadcast
+// to every lane once, in the preheader.
+static ValueId
+vector_of(VectorContext& ctx, ValueId v)
+{
+  if (ctx.plan.role[v] == Role::vector)
+    return ctx.map[v];
+
+  const auto it = ctx.splats.find(v);
+
+  if (it != ctx.splats.end())
+    return it->second;
+
+  const std::vector<ValueId> ops(ctx.lanes, v);
+  const ValueId              splat = emit_invariant(
+    ctx, Opcode::pack, ctx.fn.instrs[v].type(), ops, 0, ctx.lanes);
+
+  ctx.splats.emplace(v, splat);
+  return splat;
+}
+
+/*
+ * preheader -> vector header: phi j = (init, j + VF); continue while
+ *              j + VF - 1 < n and that sum did not wrap, else -> header
+ * vector body: the body VF lanes wide, bounds checked for the first and
+ *              last lane -> vector header
+ *
+ * The original loop follows as the remainder, its variable starting where
+ * the vector loop stopped.
+ */
+static void
+vectorize(Function& fn, const Loop& loop, const VectorPlan& plan)
+{
+  const BlockId  header  = loop.header;
+  const BlockId  body    = loop.latches[0];
+  const BlockId  pre     = loop.preheader;
+  const LangType iv_type = fn.instrs[plan.phi].type();
+  const size_t   entry   = fn.blocks[header].preds[0] == pre ? 0 : 1;
+  const ValueId  init    = fn.operand(plan.phi, entry);
+  const auto     lanes =
+    static_cast<uint8_t>(VECTOR_BYTES / type_size(plan.type));
+
+  VectorContext ctx{ fn, plan, pre, lanes, {}, {} };
+  ctx.map.assign(fn.instrs.size(), NONE);
+
+  const BlockId vheader = fn.add_block();
+  const BlockId vbody   = fn.add_block();
+
+  // preheader -> vector header -> header
+  fn.blocks[pre].succs           = { vheader };
+  fn.blocks[vheader].preds       = { pre, vbody };
+  fn.blocks[vheader].succs       = { vbody, header };
+  fn.blocks[vbody].preds         = { vheader };
+  fn.blocks[vbody].succs         = { vheader };
+  fn.blocks[header].preds[entry] = vheader;
+
+  const ValueId width =
+    emit_invariant(ctx, Opcode::constant, iv_type, {}, lanes);
+  const ValueId last_lane =
+    emit_invariant(ctx, Opcode::constant, iv_type, {}, lanes - 1);
+  const ValueId last_index =
+    emit_invariant(ctx, Opcode::constant, LangType::lt_i64, {}, lanes - 1);
+
+  const ValueId vphi =
+    emit(fn, vheader, Opcode::phi, iv_type, { init, init });
+  const ValueId last =
+    emit(fn, vheader, Opcode::add, iv_type, { vphi, last_lane });
+  const ValueId fits =
+    emit(fn, vheader, Opcode::cmp_lt, LangType::lt_i32, { last, plan.bound });
+  const ValueId no_wrap =
+    emit(fn, vheader, Opcode::cmp_gt, LangType::lt_i32, { last, vphi });
+  const ValueId cond =
+    emit(fn, vheader, Opcode::bit_and, LangType::lt_i32, { fits, no_wrap });
+
+  emit(fn, vheader, Opcode::condbr, LangType::lt_void, { cond });
+
+  ctx.map[plan.phi] = vphi;
+
+  const std::vector<ValueId> instrs = fn.blocks[body].instrs;
+
+  for (const ValueId v : instrs) {
+    const Instr instr = fn.instrs[v];
+
+    switch (plan.role[v]) {
+      case Role::index: {
+        std::vector<ValueId> ops;
+
+        for (size_t k = 0; k < instr.num_operands; ++k) {
+          const ValueId op = fn.operand(v, k);
+          ops.push_back(ctx.map[op] != NONE ? ctx.map[op] : op);
+        }
+
+        ctx.map[v] = emit(fn, vbody, instr.op, instr.type(), ops, instr.imm);
+        break;
+      }
+
+      case Role::check: {
+        const ValueId first = ctx.map[fn.operand(v, 0)];
+        const ValueId end   = emit(
+          fn, vbody, Opcode::add, LangType::lt_i64, { first, last_index });
+
+        for (const ValueId index : { first, end }) {
+          emit(
+            fn, vbody, Opcode::bounds, LangType::lt_void, { index }, instr.imm);
+        }
+        break;
+      }
+
+      case Role::vector:
+        if (instr.op == Opcode::aload) {
+          ctx.map[v] = emit(fn,
+                            vbody,
+                            Opcode::aload,
+                            instr.type(),
+                            { ctx.map[fn.operand(v, 0)] },
+                            instr.imm,
+                            lanes);
+        } else {
+          const ValueId lhs = vector_of(ctx, fn.operand(v, 0));
+          const ValueId rhs = vector_of(ctx, fn.operand(v, 1));
+
+          ctx.map[v] =
+            emit(fn, vbody, instr.op, instr.type(), { lhs, rhs }, 0, lanes);
+        }
+        break;
+
+      case Role::store: {
+        const ValueId index = ctx.map[fn.operand(v, 0)];
+        const ValueId value = vector_of(ctx, fn.operand(v, 1));
+
+        emit(fn,
+             vbody,
+             Opcode::astore,
+             LangType::lt_void,
+             { index, value },
+             instr.imm);
+        break;
+      }
+
+      case Role::none:
+        break;
+    }
+  }
+
+  const ValueId next =
+    emit(fn, vbody, Opcode::add, iv_type, { vphi, width });
+  emit(fn, vbody, Opcode::br, LangType::lt_void, {});
+
+  fn.operands_of(vphi)[1]         = next;
+  fn.operands_of(plan.phi)[entry] = vphi;
+}
+
+uint32_t
+vectorize_loops(Function& fn)
+{
+  const LoopInfo info = find_loops(fn);
+  uint32_t       count = 0;
+
+  for (uint32_t l = 0; l < info.loops.size(); ++l) {
+    VectorPlan plan;
+
+    if (!plan_loop(fn, info, l, plan))
+      continue;
+
+    vectorize(fn, info.loops[l], plan);
+    ++count;
+  }
+
+  return count;
+}
+
+} // namespace wcc::ir
@@ -0,0 +1,249 @@
+#include "jit.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <cpuid.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "writer.h"
+
+namespace wcc::jit {
+
+static size_t
+page_align(size_t size)
+{
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return (size + page - 1) / page * page;
+}
+
+static void*
+map_anywhere(size_t size)
+{
+  return mmap(nullptr,
+              size,
+              PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS,
+              -1,
+              0);
+}
+
+// Maps `size` bytes within rip-relative reach of `anchor`. The pages right
+// next to it usually belong to the heap, so free space is probed in steps
+// growing away from it, on both sides.
+static void*
+map_near(const void* anchor, size_t size)
+{
+  constexpr uintptr_t STEP  = uintptr_t(64) << 20;
+  constexpr int       STEPS = 24;
+
+  const uintptr_t base = reinterpret_cast<uintptr_t>(anchor);
+
+  for (int i = 1; i <= STEPS; ++i) {
+    for (const uintptr_t at : { base + i * STEP, base - i * STEP }) {
+      void* memory = mmap(reinterpret_cast<void*>(page_align(at)),
+                          size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+                          -1,
+                          0);
+
+      if (memory == MAP_FAILED)
+        continue;
+
+      // Kernels before 4.17 take the address as a mere hint.
+      const uintptr_t got  = reinterpret_cast<uintptr_t>(memory);
+      const uintptr_t dist = got > base ? got + size - base : base - got;
+
+      if (dist < (uintptr_t(1) << 31) - size)
+        return memory;
+
+      munmap(memory, size);
+    }
+  }
+
+  return map_anywhere(size);
+}
+
+std::unique_ptr<JitModule>
+JitModule::load(const x64::MModule&       module,
+                const x64::MachineCode&   code,
+                const std::vector<void*>& globals)
+{
+  const bool shared = !globals.empty();
+
+  // Globals are 16 byte aligned, like in .bss of an object.
+  std::vector<size_t> global_offsets;
+  size_t              data_size = 0;
+
+  for (const x64::MGlobal& global : module.globals) {
+    global_offsets.push_back(data_size);
+    data_size += shared ? 0 : (global.size + 15) / 16 * 16;
+  }
+
+  // At least a page, mmap refuses empty mappings.
+  const size_t text_size = page_align(std::max<size_t>(code.text.size(), 1));
+  const size_t total     = text_size + page_align(data_size);
+
+  void* memory = shared ? map_near(globals[0], total) : map_anywhere(total);
+
+  if (memory == MAP_FAILED) {
+    spdlog::error("Cannot map JIT memory: {}", strerror(errno));
+    return nullptr;
+  }
+
+  std::unique_ptr<JitModule> jit(new JitModule);
+  jit->memory = static_cast<uint8_t*>(memory);
+  jit->mapped = total;
+
+  uint8_t* const text = jit->memory;
+  uint8_t* const data = jit->memory + text_size;
+
+  memcpy(text, code.text.data(), code.text.size());
+
+  // Calls between functions and global accesses, S + A - P.
+  for (const x64::Relocation& reloc : code.relocs) {
+    const uint8_t* target;
+
+    if (reloc.target == x64::OperandKind::func)
+      target = text + code.functions[reloc.index].offset;
+    else if (shared)
+      target = static_cast<const uint8_t*>(globals[reloc.index]);
+    else
+      target = data + global_offsets[reloc.index];
+
+    const int64_t value = target + reloc.addend - (text + reloc.offset);
+
+    if (value < INT32_MIN || value > INT32_MAX) {
+      spdlog::error("JIT code is out of reach of global {}",
+                    module.globals[reloc.index].name);
+      return nullptr;
+    }
+
+    const int32_t field = static_cast<int32_t>(value);
+    memcpy(text + reloc.offset, &field, sizeof(field));
+  }
+
+  if (mprotect(text, text_size, PROT_READ | PROT_EXEC) != 0) {
+    spdlog::error("Cannot make JIT code executable: {}", strerror(errno));
+    return nullptr;
+  }
+
+  for (size_t i = 0; i < module.functions.size(); ++i) {
+    jit->symbols.push_back(Symbol{ module.functions[i].name,
+                                   text + code.functions[i].offset,
+                                   code.functions[i].size });
+  }
+
+  return jit;
+}
+
+JitModule::~JitModule()
+{
+  if (memory != nullptr)
+    munmap(memory, mapped);
+}
+
+void*
+JitModule::lookup(const std::string& name) const
+{
+  for (const Symbol& symbol : symbols) {
+    if (symbol.name == name)
+      return symbol.start;
+  }
+
+  return nullptr;
+}
+
+bool
+JitModule::write_perf_map() const
+{
+  const std::string path = fmt::format("/tmp/perf-{}.map", getpid());
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+  if (fd < 0) {
+    spdlog::error("Cannot open {}: {}", path, strerror(errno));
+    return false;
+  }
+
+  bool ok;
+
+  {
+    BufferedWriter out(fd);
+
+    for (const Symbol& symbol : symbols) {
+      out.print("{:x} {:x} {}\n",
+                reinterpret_cast<uintptr_t>(symbol.start),
+                symbol.size,
+                symbol.name);
+    }
+
+    ok = out.flush();
+  }
+
+  close(fd);
+  return ok;
+}
+
+// AVX and XSAVE are there and the operating system saves the XMM and YMM
+// state.
+static bool
+cpu_has_avx()
+{
+  unsigned eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return false;
+
+  if (!(ecx & bit_AVX) || !(ecx & bit_OSXSAVE))
+    return false;
+
+  uint32_t xcr0, high;
+  __asm__("xgetbv" : "=a"(xcr0), "=d"(high) : "c"(0));
+  return (xcr0 & 6) == 6;
+}
+
+bool
+cpu_has_fma()
+{
+  static const bool supported = [] {
+    unsigned eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+      return false;
+
+    return (ecx & bit_FMA) && cpu_has_avx();
+  }();
+
+  return supported;
+}
+
+bool
+cpu_has_avx2()
+{
+  static const bool supported = [] {
+    unsigned eax, ebx, ecx, edx;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+      return false;
+
+    return (ebx & bit_AVX2) && cpu_has_avx();
+  }();
+
+  return supported;
+}
+
+x64::CompileOptions
+for_host(x64::CompileOptions options)
+{
+  options.fma  = options.fma && cpu_has_fma();
+  options.avx2 = options.avx2 && cpu_has_avx2();
+  return options;
+}
+
+} // namespace wcc::jit
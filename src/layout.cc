@@ -0,0 +1,86 @@
+#include "layout.h"
+#include "typecheck.h"
+
+#include <algorithm>
+
+namespace wcc {
+
+// Places the fields in the order of `order`, a permutation of their
+// declaration order.
+static StructLayout
+place_fields(const AstStruct& str, const std::vector<uint32_t>& order)
+{
+  StructLayout layout{ .name = str.name };
+  layout.offsets.resize(str.fields.size());
+
+  for (const uint32_t f : order) {
+    const uint32_t size = type_size(str.fields[f].type);
+
+    layout.size       = (layout.size + size - 1) / size * size;
+    layout.offsets[f] = layout.size;
+    layout.size += size;
+    layout.align = std::max(layout.align, size);
+  }
+
+  layout.size = (layout.size + layout.align - 1) / layout.align * layout.align;
+  return layout;
+}
+
+StructLayout
+layout_struct(const AstStruct& str, FieldOrder order)
+{
+  std::vector<uint32_t> fields(str.fields.size());
+
+  for (uint32_t f = 0; f < fields.size(); ++f)
+    fields[f] = f;
+
+  const uint32_t declared_size = place_fields(str, fields).size;
+
+  if (order == FieldOrder::by_alignment) {
+    std::stable_sort(
+      fields.begin(), fields.end(), [&str](uint32_t a, uint32_t b) {
+        return type_size(str.fields[a].type) > type_size(str.fields[b].type);
+      });
+  }
+
+  StructLayout layout  = place_fields(str, fields);
+  layout.declared_size = declared_size;
+  return layout;
+}
+
+std::vector<StructLayout>
+layout_structs(const Symbols& symbols, FieldOrder order)
+{
+  std::vector<StructLayout> layouts;
+
+  for (const Symbol& symbol : symbols) {
+    if (symbol.kind == SymbolKind::structure)
+      layouts.push_back(
+        layout_struct(std::get<AstStruct>(symbol.node->value), order));
+  }
+
+  return layouts;
+}
+
+LangType
+storage_type(const StructLayout& layout)
+{
+  switch (layout.align) {
+    case 1:
+      return LangType::lt_u8;
+    case 2:
+      return LangType::lt_u16;
+    case 4:
+      return LangType::lt_u32;
+    default:
+      return LangType::lt_u64;
+  }
+}
+
+uint32_t
+storage_length(const StructLayout& layout, uint32_t length)
+{
+  return std::max<uint32_t>(length, 1) * (layout.size / layout.align);
+}
+
+} // namespace wcc
@@ -0,0 +1,154 @@
+#include "literal.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+namespace wcc {
+
+static bool
+parse_decimal(const char* p, const char* end, uint64_t& value)
+{
+  uint64_t v = 0;
+
+  if (end - p > 20)
+    return false;
+
+  while (end - p >= 8) {
+    const uint64_t chunk = load_eight_chars(p);
+
+    if (!is_eight_digits(chunk))
+      return false;
+
+    if (__builtin_mul_overflow(v, 100000000, &v) ||
+        __builtin_add_overflow(v, parse_eight_digits(chunk), &v))
+      return false;
+
+    p += 8;
+  }
+
+  for (; p != end; ++p) {
+    const unsigned digit = static_cast<unsigned char>(*p) - '0';
+
+    if (digit > 9)
+      return false;
+
+    if (__builtin_mul_overflow(v, 10, &v) || __builtin_add_overflow(v, digit, &v))
+      return false;
+  }
+
+  value = v;
+  return true;
+}
+
+static int
+hex_digit(char c)
+{
+  switch (c) {
+    case '0' ... '9':
+      return c - '0';
+    case 'a' ... 'f':
+      return c - 'a' + 10;
+    case 'A' ... 'F':
+      return c - 'A' + 10;
+    default:
+      return -1;
+  }
+}
+
+static bool
+parse_radix(const char* p, const char* end, unsigned shift, uint64_t& value)
+{
+  const int limit = 1 << shift;
+  uint64_t  v     = 0;
+
+  if (p == end)
+    return false;
+
+  for (; p != end; ++p) {
+    const int digit = hex_digit(*p);
+
+    if (digit < 0 || digit >= limit || (v >> (64 - shift)) != 0)
+      return false;
+
+    v = (v << shift) | static_cast<uint64_t>(digit);
+  }
+
+  value = v;
+  return true;
+}
+
+bool
+parse_integer(std::string_view text, uint64_t& value)
+{
+  const char* p   = text.data();
+  const char* end = p + text.size();
+
+  if (text.empty())
+    return false;
+
+  if (text.size() > 1 && text[0] == '0') {
+    if (text[1] == 'x' || text[1] == 'X')
+      return parse_radix(p + 2, end, 4, value);
+
+    return parse_radix(p + 1, end, 3, value);
+  }
+
+  return parse_decimal(p, end, value);
+}
+
+static bool
+parse_float(std::string_view text, AstLiteral& literal)
+{
+  if (text.empty())
+    return false;
+
+  const bool  is_f32 = text.back() == 'f' || text.back() == 'F';
+  std::string digits(text.substr(0, text.size() - is_f32));
+  char*       end = nullptr;
+
+  // strtod/strtof round correctly, the digit count of float literals in
+  // practice is too small for a hand rolled parser to pay off.
+  errno                   = 0;
+  literal.value.u64_value = 0;
+
+  if (is_f32) {
+    literal.type            = LangType::lt_f32;
+    literal.value.f32_value = std::strtof(digits.c_str(), &end);
+  } else {
+    literal.type            = LangType::lt_f64;
+    literal.value.f64_value = std::strtod(digits.c_str(), &end);
+  }
+
+  if (*end != '\0' || digits.empty())
+    return false;
+
+  // Underflow to a denormal or zero is fine, overflow to infinity is not.
+  return errno != ERANGE || (is_f32 ? std::isfinite(literal.value.f32_value)
+                                    : std::isfinite(literal.value.f64_value));
+}
+
+bool
+parse_literal(TOKENID id, std::string_view text, AstLiteral& literal)
+{
+  if (id == TOKENID::FLOAT_LITERAL)
+    return parse_float(text, literal);
+
+  uint64_t value;
+
+  if (id != TOKENID::INT_LITERAL || !parse_integer(text, value))
+    return false;
+
+  if (value <= INT32_MAX)
+    literal.type = LangType::lt_i32;
+  else if (value <= INT64_MAX)
+    literal.type = LangType::lt_i64;
+  else
+    literal.type = LangType::lt_u64;
+
+  literal.value.u64_value = value;
+  return true;
+}
+
+} // namespace wcc
@@ -1,6 +1,7 @@
 #include "parser.h"
 #include "ast.h"
 #include "ast_format.h"
+#include "literal.h"
 #include "token.h"
 
 #include <optional>
@@ -102,13 +103,12 @@ parse_strdecl(Tokenizer& tokenizer, AstStruct& str)
 }
 
 static bool
-parse_func_params(Tokenizer& tokenizer, ASTNode& node)
+parse_func_params(Tokenizer& tokenizer, AstFunction& func)
 {
   Token token;
 
   while (1) {
-    ASTNode& param = node.add(ASTID::vardecl);
-    param.value    = AstVariable();
+    AstVariable& var = func.args.emplace_back();
 
     token = tokenizer.get();
 
@@ -129,8 +129,7 @@ parse_func_params(Tokenizer& tokenizer, ASTNode& node)
 
     token = tokenizer.get();
 
-    AstVariable& var = std::get<AstVariable>(param.value);
-    var.type         = type.value();
+    var.type = type.value();
 
     if (token.id == TOKENID::IDENTIFIER) {
       var.name = token.value;
@@ -176,7 +175,7 @@ parse_funcdecl(Tokenizer& tokenizer, ASTNode& node)
   if (tokenizer.peek().id == TOKENID::PAREN_CLOSE) {
     tokenizer.get();
   } else {
-    const auto parse_res = parse_func_params(tokenizer, node);
+    const auto parse_res = parse_func_params(tokenizer, func);
 
     if (!parse_res)
       return false;
@@ -241,6 +240,29 @@ get_function_symbol_name(Token t)
   return t.value;
 }
 
+static bool
+is_literal(const Token& token)
+{
+  return token.id == TOKENID::INT_LITERAL ||
+         token.id == TOKENID::FLOAT_LITERAL;
+}
+
+static bool
+make_literal(const Token& token, AstStmt& stmt)
+{
+  AstLiteral literal;
+
+  if (!parse_literal(token.id, token.value, literal)) {
+    spdlog::error("Syntax error: invalid numeric literal {}", token.value);
+    spdlog::error("At: {}:{}", token.line, token.pos);
+    return false;
+  }
+
+  stmt.type  = StmtType::literal;
+  stmt.value = literal;
+  return true;
+}
+
 static bool
 parse_statement_list(Tokenizer& tokenizer, ASTNode& node)
 {
@@ -266,13 +288,21 @@ parse_statement_list(Tokenizer& tokenizer, ASTNode& node)
 
   Token tok = tokenizer.peek();
 
-  if (tok.id == TOKENID::PAREN_CLOSE)
+  if (tok.id == TOKENID::PAREN_CLOSE) {
+    tokenizer.get();
     return true;
+  }
 
   while (1) {
     tok = tokenizer.get();
 
-    if (tok.id != TOKENID::IDENTIFIER) {
+    if (is_literal(tok)) {
+      if (!make_literal(tok, call.args.emplace_back()))
+        return false;
+    } else if (tok.id == TOKENID::IDENTIFIER) {
+      call.args.emplace_back(AstStmt{ .type  = StmtType::varref,
+                                      .value = AstSymRef{ .name = tok.value } });
+    } else {
       spdlog::error("Syntax error: expected argument identifier in call "
                     "parenthesis, but got {}",
                     TOKENID_STR[underlay_cast(tok.id)]);
@@ -280,9 +310,6 @@ parse_statement_list(Tokenizer& tokenizer, ASTNode& node)
       return false;
     }
 
-    call.args.emplace_back(AstStmt{ .type  = StmtType::varref,
-                                    .value = AstSymRef{ .name = tok.value } });
-
     tok = tokenizer.get();
 
     if (tok.id == TOKENID::PAREN_CLOSE)
@@ -309,24 +336,69 @@ parse_statement_symbol(Tokenizer& tokenizer)
   return SymbolName(symtok.value);
 }
 
-static size_t
-get_precedence(const Token t)
+// Binding strength of the binary operators, as in C. The assignments bind
+// weakest and group to the right, the others group to the left.
+static unsigned
+get_operator_precedence(Token t)
 {
-  switch(t.id) {
+  switch (t.id) {
+    case TOKENID::OP_DOT:
+    case TOKENID::OP_ACCESS:
+      return 11;
+    case TOKENID::OP_MUL:
+    case TOKENID::OP_DIV:
+    case TOKENID::OP_MOD:
+      return 10;
+    case TOKENID::OP_PLUS:
+    case TOKENID::OP_MINUS:
+      return 9;
+    case TOKENID::OP_LS:
+    case TOKENID::OP_LSE:
+    case TOKENID::OP_GR:
+    case TOKENID::OP_GRE:
+      return 8;
+    case TOKENID::OP_NEQ:
+      return 7;
+    case TOKENID::OP_AND:
+      return 6;
+    case TOKENID::OP_XOR:
+      return 5;
+    case TOKENID::OP_OR:
+      return 4;
+    case TOKENID::OP_LOGIC_AND:
+      return 3;
+    case TOKENID::OP_LOGIC_OR:
+      return 2;
     default:
-      return 0;
+      return 1;
   }
 }
 
-static unsigned
-get_operator_precedence(Token t)
+// Whether `stmt` is an operator that has to be applied after `op` when it
+// is its right operand in the source.
+static bool
+binds_looser(const AstStmt& stmt, Token op)
 {
-  if (t.id == TOKENID::OP_MUL)
-    return 1;
+  if (stmt.type != StmtType::call)
+    return false;
+
+  const auto& call = std::get<AstFunctionCall>(stmt.value);
 
-  return 0;
+  if (!is_stdop(call.from_token))
+    return false;
+
+  const unsigned inner = get_operator_precedence(call.from_token);
+  const unsigned outer = get_operator_precedence(op);
+
+  return inner < outer || (inner == outer && outer != 1);
 }
 
+/*
+ * Statements are parsed from the right: `a op rest` is built once `rest`
+ * is a finished tree. The new operator then moves down the left edge of
+ * `rest`, past every operator it binds tighter than, and takes the operand
+ * it reaches as its right one. Operands keep their order.
+ */
 static bool
 maybe_fix_precedence_(ASTNode& opnode)
 {
@@ -340,45 +412,61 @@ maybe_fix_precedence_(ASTNode& opnode)
   if (!is_stdop(this_opcall.from_token))
     return true;
 
-  auto& rhs_stmt = this_opcall.args.back();
+  if (this_opcall.args.size() != 2) {
+    spdlog::critical("Internal error: we expected stdop to have 2 args");
+    return false;
+  }
 
-  if (rhs_stmt.type != StmtType::call)
+  if (!binds_looser(this_opcall.args[1], this_opcall.from_token))
     return true;
 
-  auto& rhs_opcall = std::get<AstFunctionCall>(rhs_stmt.value);
+  const Token op   = this_opcall.from_token;
+  AstStmt     rest = std::move(this_opcall.args[1]);
+  AstStmt*    slot = &std::get<AstFunctionCall>(rest.value).args[0];
 
-  if (!is_stdop(rhs_opcall.from_token))
-    return true;
+  while (binds_looser(*slot, op))
+    slot = &std::get<AstFunctionCall>(slot->value).args[0];
 
-  if (get_operator_precedence(this_opcall.from_token) <=
-      get_operator_precedence(rhs_opcall.from_token))
-    return true;
+  this_opcall.args[1] = std::move(*slot);
+  *slot               = std::move(this_stmt);
+  this_stmt           = std::move(rest);
 
-  if (rhs_opcall.args.size() != 2) {
-    spdlog::critical("Internal error: we expected stdop to have 2 args");
-    return false;
-  }
+  return true;
+}
+
+static bool
+parse_loop_statement(Tokenizer& tokenizer, AstStmt& stmt, TOKENID end);
 
-  std::swap(rhs_opcall.args.front(), rhs_opcall.args.back());
-  AstStmt rhs_of_rhs = std::move(rhs_opcall.args.back());
-  rhs_opcall.args.pop_back();
+// The `'.' field` after a variable or an element, which `stmt` holds. It
+// becomes the field.
+static bool
+parse_field(Tokenizer& tokenizer, AstStmt& stmt)
+{
+  tokenizer.get();
 
-  AstStmt rhs_of_this = std::move(this_opcall.args.back());
-  this_opcall.args.pop_back();
+  const Token token = tokenizer.get();
 
-  std::swap(this_stmt, rhs_of_this);
+  if (token.id != TOKENID::IDENTIFIER) {
+    syntax_error(".",
+                 "field name",
+                 TOKENID_STR[underlay_cast(token.id)],
+                 token.line,
+                 token.pos);
+    return false;
+  }
 
-  // Function calls (std::variants) of the statement struct just got swapped.
-  // We have to retake the value because It changed (we move-assigned variants).
-  // We reassign the references by shadowing
-  {
-    auto& this_opcall = std::get<AstFunctionCall>(this_stmt.value);
-    auto& rhs_opcall  = std::get<AstFunctionCall>(rhs_of_this.value);
+  AstField field{ .field = token.value };
 
-    rhs_opcall.args.emplace_back(std::move(rhs_of_rhs));
-    this_opcall.args.emplace_back(std::move(rhs_of_this));
+  if (stmt.type == StmtType::index) {
+    AstIndex& index = std::get<AstIndex>(stmt.value);
+    field.object    = std::move(index.array);
+    field.index     = std::move(index.index);
+  } else {
+    field.object = std::move(std::get<AstSymRef>(stmt.value));
   }
 
+  stmt.type  = StmtType::field;
+  stmt.value = std::move(field);
   return true;
 }
 
@@ -387,6 +475,9 @@ maybe_fix_precedence_(ASTNode& opnode)
  *
  * stmt: sym
  * stmt: sym '(' arglist ')'
+ * stmt: sym '[' stmt ']'
+ * stmt: sym '.' field
+ * stmt: sym '[' stmt ']' '.' field
  * stmt: stmt op stmt    [Note, translated to: op(stmt, stmt)]
  * stmt: stmt ';'
  * stmt: 'return' stmt
@@ -394,38 +485,61 @@ maybe_fix_precedence_(ASTNode& opnode)
  * arglist: stmt
  * arglist: stmt ',' stmt
  *
+ * The statement ends with `end`, which is consumed: ';' in code blocks, ')'
+ * for the condition of a while loop and the step of a for loop.
  */
 static bool
-parse_statement(Tokenizer& tokenizer, ASTNode& node)
+parse_statement(Tokenizer& tokenizer,
+                ASTNode&   node,
+                TOKENID    end = TOKENID::SEMICOLON)
 {
   ASTNode& this_node = node.add(ASTID::stmt);
   this_node.value    = AstStmt();
   AstStmt& stmt      = std::get<AstStmt>(this_node.value);
 
-  std::optional<SymbolName> opt_sym;
-  if (opt_sym = parse_statement_symbol(tokenizer); !opt_sym.has_value()) {
-    return false;
-  }
+  if (is_literal(tokenizer.peek())) {
+    if (!make_literal(tokenizer.get(), stmt))
+      return false;
+  } else {
+    std::optional<SymbolName> opt_sym;
+    if (opt_sym = parse_statement_symbol(tokenizer); !opt_sym.has_value()) {
+      return false;
+    }
 
-  spdlog::debug("Parsing symbol: {}", opt_sym.value());
+    spdlog::debug("Parsing symbol: {}", opt_sym.value());
 
-  if (opt_sym.value() == "return") {
-    stmt.type = StmtType::ret;
-    return parse_statement(tokenizer, this_node);
-  }
+    if (opt_sym.value() == "return") {
+      stmt.type = StmtType::ret;
+      return parse_statement(tokenizer, this_node, end);
+    }
 
-  if (tokenizer.peek().id == TOKENID::PAREN_OPEN) {
-    tokenizer.get();
+    if (tokenizer.peek().id == TOKENID::PAREN_OPEN) {
+      tokenizer.get();
+
+      stmt.type  = StmtType::call;
+      stmt.value = AstFunctionCall{ .name       = opt_sym.value(),
+                                    .from_token = TOKENID::IDENTIFIER };
 
-    stmt.type  = StmtType::call;
-    stmt.value = AstFunctionCall{ .name       = opt_sym.value(),
-                                  .from_token = TOKENID::IDENTIFIER };
+      if (!parse_statement_list(tokenizer, this_node))
+        return false;
+    } else if (tokenizer.peek().id == TOKENID::BRACKET_OPEN) {
+      tokenizer.get();
+
+      AstIndex index{ .array = AstSymRef{ .name = opt_sym.value() } };
 
-    if (!parse_statement_list(tokenizer, this_node))
+      if (!parse_loop_statement(
+            tokenizer, index.index.emplace_back(), TOKENID::BRACKET_CLOSE))
+        return false;
+
+      stmt.type  = StmtType::index;
+      stmt.value = std::move(index);
+    } else {
+      stmt.type  = StmtType::varref;
+      stmt.value = AstSymRef{ .name = opt_sym.value() };
+    }
+
+    if (tokenizer.peek().id == TOKENID::OP_DOT && !parse_field(tokenizer, stmt))
       return false;
-  } else {
-    stmt.type  = StmtType::varref;
-    stmt.value = AstSymRef{ .name = opt_sym.value() };
   }
 
   if (is_stdop(tokenizer.peek())) {
@@ -447,7 +561,7 @@ parse_statement(Tokenizer& tokenizer, ASTNode& node)
     // TODO: remove node as a arg to parse_statement so we dont have to do this.
     ASTNode node_for_rhs;
 
-    if (!parse_statement(tokenizer, node_for_rhs))
+    if (!parse_statement(tokenizer, node_for_rhs, end))
       return false;
 
     if (node_for_rhs.nodes.size() != 1) {
@@ -469,8 +583,17 @@ parse_statement(Tokenizer& tokenizer, ASTNode& node)
     return true;
   }
 
-  if (tokenizer.peek().id != TOKENID::SEMICOLON) {
-    spdlog::error("Syntax error: missing semicolon?");
+  if (tokenizer.peek().id != end) {
+    const Token token = tokenizer.peek();
+
+    if (end == TOKENID::SEMICOLON)
+      spdlog::error("Syntax error: missing semicolon?");
+    else
+      spdlog::error("Syntax error: Expected {} after statement, but got {}",
+                    TOKENID_STR[underlay_cast(end)],
+                    TOKENID_STR[underlay_cast(token.id)]);
+
+    spdlog::error("At: {}:{}", token.line, token.pos);
     return false;
   }
 
@@ -478,6 +601,159 @@ parse_statement(Tokenizer& tokenizer, ASTNode& node)
   return true;
 }
 
+// Parses a statement into a node of its own and moves it out.
+static bool
+parse_loop_statement(Tokenizer& tokenizer, AstStmt& stmt, TOKENID end)
+{
+  ASTNode holder;
+
+  if (!parse_statement(tokenizer, holder, end))
+    return false;
+
+  stmt = std::move(std::get<AstStmt>(holder.nodes[0]->value));
+  return true;
+}
+
+static bool
+expect(Tokenizer& tokenizer, TOKENID id, const char* after)
+{
+  const Token token = tokenizer.get();
+
+  if (token.id == id)
+    return true;
+
+  syntax_error(after,
+               TOKENID_STR[underlay_cast(id)],
+               TOKENID_STR[underlay_cast(token.id)],
+               token.line,
+               token.pos);
+  return false;
+}
+
+// The `'[' length ']'` of an array declaration, a positive integer literal.
+static bool
+parse_array_length(Tokenizer& tokenizer, AstVariable& var)
+{
+  tokenizer.get();
+
+  const Token token = tokenizer.get();
+  AstLiteral  length;
+
+  if (token.id != TOKENID::INT_LITERAL ||
+      !parse_literal(token.id, token.value, length) ||
+      length.value.u64_value == 0 ||
+      length.value.u64_value > MAX_ARRAY_LENGTH) {
+    spdlog::error("Syntax error: Expected array length, got {}", token.value);
+    spdlog::error("At: {}:{}", token.line, token.pos);
+    return false;
+  }
+
+  var.length = static_cast<uint32_t>(length.value.u64_value);
+  return expect(tokenizer, TOKENID::BRACKET_CLOSE, "array length");
+}
+
+/*
+ * Loop grammar:
+ *
+ * loop: 'while' '(' stmt ')' '{' block '}'
+ * loop: 'for' '(' [stmt] ';' stmt ';' [stmt] ')' '{' block '}'
+ *
+ * The init statement of a for loop is added to `node` before the loop.
+ */
+static bool
+parse_loop(Tokenizer& tokenizer, ASTNode& node, const Token& keyword)
+{
+  const bool is_for = keyword.value == "for";
+
+  if (!expect(tokenizer, TOKENID::PAREN_OPEN, keyword.value.c_str()))
+    return false;
+
+  if (is_for) {
+    if (tokenizer.peek().id == TOKENID::SEMICOLON)
+      tokenizer.get();
+    else if (!parse_statement(tokenizer, node))
+      return false;
+  }
+
+  AstLoop loop;
+
+  if (!parse_loop_statement(tokenizer,
+                            loop.cond,
+                            is_for ? TOKENID::SEMICOLON
+                                   : TOKENID::PAREN_CLOSE))
+    return false;
+
+  if (is_for) {
+    if (tokenizer.peek().id == TOKENID::PAREN_CLOSE)
+      tokenizer.get();
+    else if (!parse_loop_statement(
+               tokenizer, loop.step.emplace(), TOKENID::PAREN_CLOSE))
+      return false;
+  }
+
+  if (!expect(tokenizer, TOKENID::BLOCK_BEGIN, "loop header"))
+    return false;
+
+  ASTNode& loop_node = node.add(ASTID::loop);
+  loop_node.value    = std::move(loop);
+
+  return parse_code_block(tokenizer, loop_node);
+}
+
+/*
+ * Branch grammar:
+ *
+ * branch: 'if' '(' stmt ')' '{' block '}'
+ * branch: 'if' '(' stmt ')' '{' block '}' 'else' '{' block '}'
+ * branch: 'if' '(' stmt ')' '{' block '}' 'else' branch
+ *
+ * The branch node holds a block node for each arm, an `else if` is a
+ * branch alone in the block of the else arm.
+ */
+static bool
+parse_branch(Tokenizer& tokenizer, ASTNode& node)
+{
+  if (!expect(tokenizer, TOKENID::PAREN_OPEN, "if"))
+    return false;
+
+  AstBranch branch;
+
+  if (!parse_loop_statement(tokenizer, branch.cond, TOKENID::PAREN_CLOSE))
+    return false;
+
+  if (!expect(tokenizer, TOKENID::BLOCK_BEGIN, "if condition"))
+    return false;
+
+  ASTNode& branch_node = node.add(ASTID::branch);
+  branch_node.value    = std::move(branch);
+
+  if (!parse_code_block(tokenizer, branch_node.add(ASTID::block)))
+    return false;
+
+  const Token next = tokenizer.peek();
+
+  if (next.id != TOKENID::IDENTIFIER || next.value != "else")
+    return true;
+
+  tokenizer.get();
+  ASTNode& else_block = branch_node.add(ASTID::block);
+  const Token token   = tokenizer.get();
+
+  if (token.id == TOKENID::IDENTIFIER && token.value == "if")
+    return parse_branch(tokenizer, else_block);
+
+  if (token.id != TOKENID::BLOCK_BEGIN) {
+    syntax_error("else",
+                 TOKENID_STR[underlay_cast(TOKENID::BLOCK_BEGIN)],
+                 TOKENID_STR[underlay_cast(token.id)],
+                 token.line,
+                 token.pos);
+    return false;
+  }
+
+  return parse_code_block(tokenizer, else_block);
+}
+
 static bool
 parse_code_block(Tokenizer& tokenizer, ASTNode& node)
 {
@@ -498,6 +774,20 @@ parse_code_block(Tokenizer& tokenizer, ASTNode& node)
 
       case TOKENID::IDENTIFIER: {
 
+        if (token.value == "while" || token.value == "for") {
+          if (!parse_loop(tokenizer, node, token))
+            return false;
+
+          continue;
+        }
+
+        if (token.value == "if") {
+          if (!parse_branch(tokenizer, node))
+            return false;
+
+          continue;
+        }
+
         if (token.value == "struct") {
 
           token = tokenizer.get();
@@ -523,11 +813,31 @@ parse_code_block(Tokenizer& tokenizer, ASTNode& node)
             return parse_strdecl(tokenizer, str);
           }
 
-          syntax_error("struct",
-                       "identifier",
-                       TOKENID_STR[underlay_cast(token.id)],
-                       token.line,
-                       token.pos);
+          // `struct name var;` or `struct name var[length];`
+          if (next_token.id == TOKENID::IDENTIFIER) {
+            ASTNode& vardecl_node = node.add(ASTID::vardecl);
+            vardecl_node.value =
+              AstVariable{ .type      = LangType::lt_void,
+                           .name      = next_token.value,
+                           .structure = AstSymRef{ .name = token.value } };
+            AstVariable& vardecl = std::get<AstVariable>(vardecl_node.value);
+
+            if (tokenizer.peek().id == TOKENID::BRACKET_OPEN &&
+                !parse_array_length(tokenizer, vardecl))
+              return false;
+
+            if (!expect(tokenizer, TOKENID::SEMICOLON, "declaration"))
+              return false;
+
+            continue;
+          }
+
+          syntax_error("struct name",
+                       "structure body or variable name",
+                       TOKENID_STR[underlay_cast(next_token.id)],
+                       next_token.line,
+                       next_token.pos);
+          return false;
         }
 
         else if (const auto opt_type = lookup_type(token.value);
@@ -554,7 +864,8 @@ parse_code_block(Tokenizer& tokenizer, ASTNode& node)
             return parse_funcdecl(tokenizer, func_node);
           }
 
-          else if (tokenizer.peek().id == TOKENID::SEMICOLON) {
+          else if (tokenizer.peek().id == TOKENID::SEMICOLON ||
+                   tokenizer.peek().id == TOKENID::BRACKET_OPEN) {
             ASTNode& vardecl_node = node.add(ASTID::vardecl);
             vardecl_node.value    = AstVariable();
             AstVariable& vardecl  = std::get<AstVariable>(vardecl_node.value);
@@ -562,8 +873,15 @@ parse_code_block(Tokenizer& tokenizer, ASTNode& node)
             vardecl.type = opt_type.value();
             vardecl.name = symbol_name.value;
 
+            if (tokenizer.peek().id == TOKENID::BRACKET_OPEN &&
+                !parse_array_length(tokenizer, vardecl))
+              return false;
+
             spdlog::debug("Parsed variable declaration: {}", vardecl.name);
-            tokenizer.get();
+
+            if (!expect(tokenizer, TOKENID::SEMICOLON, "declaration"))
+              return false;
+
             continue;
           }
 
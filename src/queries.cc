@@ -0,0 +1,203 @@
+#include "queries.h"
+#include "fold.h"
+#include "parser.h"
+#include "resolve.h"
+#include "typecheck.h"
+#include "tokenizer.h"
+
+namespace wcc {
+
+const ASTNode*
+find_function(const AST& ast, const SymbolName& name)
+{
+  for (const auto& node : ast.root.nodes) {
+    if (node->id != ASTID::funcdecl)
+      continue;
+
+    if (std::get<AstFunction>(node->value).name == name)
+      return node.get();
+  }
+
+  return nullptr;
+}
+
+ParseQuery::Value
+ParseQuery::execute(QueryDatabase& db, const Key& file)
+{
+  const std::string& text = db.get<SourceTextQuery>(file);
+
+  Tokenizer tokenizer(text.data(), text.size());
+  Parser    parser(tokenizer);
+
+  return std::make_shared<AST>(parser.buildAST());
+}
+
+FunctionListQuery::Value
+FunctionListQuery::execute(QueryDatabase& db, const Key& file)
+{
+  const auto& ast = db.get<ParseQuery>(file);
+  Value       functions;
+
+  for (const auto& node : ast->root.nodes) {
+    if (node->id == ASTID::funcdecl)
+      functions.push_back(std::get<AstFunction>(node->value).name);
+  }
+
+  return functions;
+}
+
+SignatureQuery::Value
+SignatureQuery::execute(QueryDatabase& db, const Key& func)
+{
+  const auto& ast  = db.get<ParseQuery>(func.first);
+  const auto* node = find_function(*ast, func.second);
+
+  if (node == nullptr)
+    return std::nullopt;
+
+  const auto&       astfunc = std::get<AstFunction>(node->value);
+  FunctionSignature sig{ .name        = astfunc.name,
+                         .return_type = astfunc.return_type };
+
+  for (const auto& arg : astfunc.args)
+    sig.params.push_back(arg.type);
+
+  return sig;
+}
+
+ResolveQuery::Value
+ResolveQuery::execute(QueryDatabase& db, const Key& file)
+{
+  // The parse query never backdates (every parse yields a new AST), so each
+  // AST instance is annotated exactly once.
+  auto result = std::make_shared<AnalyzedFile>();
+  result->ast = db.get<ParseQuery>(file);
+  result->ok  = resolve_names(*result->ast, result->symbols);
+
+  return result;
+}
+
+TypecheckQuery::Value
+TypecheckQuery::execute(QueryDatabase& db, const Key& file)
+{
+  const auto& resolved = db.get<ResolveQuery>(file);
+  auto        result   = std::make_shared<AnalyzedFile>(*resolved);
+
+  if (result->ok)
+    result->ok = typecheck(*result->ast, result->symbols, result->types);
+
+  // Folding needs the types, later phases only ever see the folded tree.
+  if (result->ok)
+    fold_constants(*result->ast, result->types);
+
+  return result;
+}
+
+TypeOfQuery::Value
+TypeOfQuery::execute(QueryDatabase& db, const Key& expr)
+{
+  const auto& file  = db.get<TypecheckQuery>(expr.first);
+  const auto& types = file->types.types;
+
+  if (!file->ok || expr.second >= types.size())
+    return LangType::lt_void;
+
+  return types[expr.second];
+}
+
+LayoutQuery::Value
+LayoutQuery::execute(QueryDatabase& db, const Key& file)
+{
+  // Fields are only known to have a size once the file type checks.
+  const auto& analyzed = db.get<TypecheckQuery>(file);
+
+  if (!analyzed->ok)
+    return {};
+
+  return layout_structs(analyzed->symbols,
+                        db.get_or<FieldOrderQuery>(file, FieldOrder::declared));
+}
+
+// Number of a function in the module of its file, what calls name it by.
+static uint32_t
+function_number(const AnalyzedFile& file, const SymbolName& name)
+{
+  for (const Symbol& symbol : file.symbols) {
+    if (symbol.kind == SymbolKind::function && symbol.name == name)
+      return symbol.slot;
+  }
+
+  return ir::NONE;
+}
+
+LowerQuery::Value
+LowerQuery::execute(QueryDatabase& db, const Key& func)
+{
+  const auto& file = db.get<TypecheckQuery>(func.first);
+
+  if (!file->ok)
+    return std::nullopt;
+
+  const auto* node = find_function(*file->ast, func.second);
+
+  if (node == nullptr)
+    return std::nullopt;
+
+  const auto&  layouts = db.get<LayoutQuery>(func.first);
+  ir::Function fn      = ir::lower_function(*file, layouts, *node);
+  ir::mem2reg(fn);
+  ir::propagate_constants(fn);
+
+  if (ir::scalarize_aggregates(fn) > 0) {
+    ir::mem2reg(fn);
+    ir::propagate_constants(fn);
+  }
+
+  ir::eliminate_tail_recursion(fn, function_number(*file, func.second));
+  ir::if_convert(fn);
+  ir::hoist_invariants(fn);
+  ir::simplify_induction(fn);
+  ir::number_values(fn);
+  ir::eliminate_bounds_checks(fn);
+  ir::vectorize_loops(fn);
+  ir::unroll_loops(fn);
+  ir::reassociate(fn);
+  ir::number_values(fn);
+
+  return fn;
+}
+
+ModuleQuery::Value
+ModuleQuery::execute(QueryDatabase& db, const Key& file)
+{
+  const auto& analyzed = db.get<TypecheckQuery>(file);
+  auto        module   = std::make_shared<ir::Module>();
+
+  if (!analyzed->ok)
+    return nullptr;
+
+  const auto& layouts = db.get<LayoutQuery>(file);
+
+  for (const auto& node : analyzed->ast->root.nodes) {
+    if (node->id == ASTID::vardecl) {
+      module->globals.push_back(ir::lower_global(
+        *analyzed, layouts, std::get<AstVariable>(node->value)));
+    } else if (node->id == ASTID::funcdecl) {
+      const auto& name = std::get<AstFunction>(node->value).name;
+      module->functions.push_back(*db.get<LowerQuery>({ file, name }));
+    }
+  }
+
+  ir::inline_calls(*module);
+  ir::evaluate_calls(*module);
+
+  for (ir::Function& fn : module->functions) {
+    ir::reduce_strength(fn);
+    ir::number_values(fn);
+    ir::vectorize_slp(fn);
+  }
+
+  return module;
+}
+
+} // namespace wcc
@@ -0,0 +1,79 @@
+#include "query.h"
+#include "util.h"
+
+#include <spdlog/spdlog.h>
+
+namespace wcc {
+
+SlotIndex
+QueryDatabase::new_slot(const char* name, bool is_input)
+{
+  const auto index = static_cast<SlotIndex>(slots.size());
+
+  auto& slot    = slots.emplace_back();
+  slot.name     = name;
+  slot.is_input = is_input;
+
+  return index;
+}
+
+void
+QueryDatabase::record_read(SlotIndex slot)
+{
+  if (active.empty())
+    return;
+
+  auto& deps = active.back().deps;
+
+  // Queries tend to read the same few inputs repeatedly, checking the tail
+  // keeps the dependency list short without a set.
+  if (!deps.empty() && deps.back() == slot)
+    return;
+
+  deps.push_back(slot);
+}
+
+bool
+QueryDatabase::deps_unchanged(SlotIndex slot)
+{
+  const Revision verified_at = slots[slot].verified_at;
+
+  // Dependencies are revalidated in the order they were read, so a changed
+  // early dependency stops the walk before later (possibly no longer needed)
+  // queries get recomputed.
+  for (size_t i = 0; i < slots[slot].deps.size(); ++i) {
+    const SlotIndex dep = slots[slot].deps[i];
+
+    if (!slots[dep].is_input)
+      slots[dep].refresh();
+
+    if (slots[dep].changed_at > verified_at)
+      return false;
+  }
+
+  return true;
+}
+
+void
+QueryDatabase::begin_execute(SlotIndex slot)
+{
+  if (unlikely(slots[slot].computing)) {
+    spdlog::critical("Query cycle detected in {}", slots[slot].name);
+    panic("Internal error: cyclic query");
+  }
+
+  slots[slot].computing = true;
+  active.push_back(Frame{ slot, {} });
+}
+
+void
+QueryDatabase::end_execute(SlotIndex slot)
+{
+  slots[slot].deps      = std::move(active.back().deps);
+  slots[slot].computing = false;
+  active.pop_back();
+
+  ++stats.executed;
+}
+
+} // namespace wcc
@@ -0,0 +1,366 @@
+#include "resolve.h"
+#include "ast_format.h"
+#include "symtab.h"
+#include "util.h"
+
+#include <spdlog/spdlog.h>
+
+namespace wcc {
+
+struct ResolveContext
+{
+  SymbolTable table;
+  SymbolIndex function = INVALID_SYMBOL;
+  uint32_t    locals   = 0;
+};
+
+static const char*
+function_name(const ResolveContext& ctx)
+{
+  if (ctx.function == INVALID_SYMBOL)
+    return "<file scope>";
+
+  return ctx.table.symbols[ctx.function].name.c_str();
+}
+
+static bool
+declare(ResolveContext& ctx, Symbol sym)
+{
+  const SymbolName name = sym.name;
+  const SymbolKind kind = sym.kind;
+
+  if (ctx.table.declare(std::move(sym)) != INVALID_SYMBOL)
+    return true;
+
+  spdlog::error("Redeclaration of {} \"{}\" in {}",
+                SYMBOL_KIND_STR[underlay_cast(kind)],
+                name,
+                function_name(ctx));
+  return false;
+}
+
+static bool
+resolve_variable(ResolveContext& ctx, AstSymRef& ref)
+{
+  ref.symbol = ctx.table.lookup(ref.name);
+
+  if (ref.symbol == INVALID_SYMBOL) {
+    spdlog::error("Use of undeclared identifier \"{}\" in {}",
+                  ref.name,
+                  function_name(ctx));
+    return false;
+  }
+
+  const SymbolKind kind = ctx.table.symbols[ref.symbol].kind;
+  if (kind == SymbolKind::function || kind == SymbolKind::structure) {
+    spdlog::error("{} \"{}\" used as a variable in {}",
+                  SYMBOL_KIND_STR[underlay_cast(kind)],
+                  ref.name,
+                  function_name(ctx));
+    return false;
+  }
+
+  return true;
+}
+
+// Binds the structure of a `struct name var;` declaration.
+static bool
+resolve_structure(ResolveContext& ctx, AstVariable& var)
+{
+  if (var.structure.name.empty())
+    return true;
+
+  var.structure.symbol = ctx.table.lookup(var.structure.name);
+
+  if (var.structure.symbol == INVALID_SYMBOL ||
+      ctx.table.symbols[var.structure.symbol].kind != SymbolKind::structure) {
+    spdlog::error("Variable \"{}\" of undeclared structure \"{}\" in {}",
+                  var.name,
+                  var.structure.name,
+                  function_name(ctx));
+    return false;
+  }
+
+  return true;
+}
+
+static bool
+resolve_stmt(ResolveContext& ctx, AstStmt& stmt)
+{
+  switch (stmt.type) {
+    case StmtType::varref:
+      return resolve_variable(ctx, std::get<AstSymRef>(stmt.value));
+
+    case StmtType::index: {
+      AstIndex& index = std::get<AstIndex>(stmt.value);
+
+      return resolve_variable(ctx, index.array) &&
+             resolve_stmt(ctx, index.index[0]);
+    }
+
+    case StmtType::field: {
+      AstField& field = std::get<AstField>(stmt.value);
+
+      if (!resolve_variable(ctx, field.object))
+        return false;
+
+      return field.index.empty() || resolve_stmt(ctx, field.index[0]);
+    }
+
+    case StmtType::call: {
+      AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+
+      for (auto& arg : call.args) {
+        if (!resolve_stmt(ctx, arg))
+          return false;
+      }
+
+      // Standard operators are builtins, there is nothing to bind.
+      if (call.from_token.id != TOKENID::IDENTIFIER)
+        return true;
+
+      call.symbol = ctx.table.lookup(call.name);
+
+      if (call.symbol == INVALID_SYMBOL) {
+        spdlog::error("Call to undeclared function \"{}\" in {}",
+                      call.name,
+                      function_name(ctx));
+        return false;
+      }
+
+      if (ctx.table.symbols[call.symbol].kind != SymbolKind::function) {
+        spdlog::error("Called object \"{}\" is not a function in {}",
+                      call.name,
+                      function_name(ctx));
+        return false;
+      }
+
+      return true;
+    }
+
+    case StmtType::ret:
+      // The returned expression is a child node.
+      return true;
+
+    case StmtType::conv:
+      return resolve_stmt(ctx, std::get<AstConversion>(stmt.value).operand[0]);
+
+    case StmtType::literal:
+      return true;
+  }
+
+  return true;
+}
+
+static bool
+resolve_node(ResolveContext& ctx, ASTNode& node)
+{
+  switch (node.id) {
+    case ASTID::vardecl: {
+      AstVariable& var = std::get<AstVariable>(node.value);
+
+      if (!resolve_structure(ctx, var))
+        return false;
+
+      return declare(ctx,
+                     Symbol{ .name      = var.name,
+                             .kind      = SymbolKind::local,
+                             .type      = var.type,
+                             .node      = &node,
+                             .slot      = ctx.locals++,
+                             .owner     = ctx.function,
+                             .length    = var.length,
+                             .structure = var.structure.symbol });
+    }
+
+    case ASTID::stmt:
+      if (!resolve_stmt(ctx, std::get<AstStmt>(node.value)))
+        return false;
+
+      for (auto& child : node.nodes) {
+        if (!resolve_node(ctx, *child))
+          return false;
+      }
+
+      return true;
+
+    case ASTID::loop: {
+      AstLoop& loop = std::get<AstLoop>(node.value);
+
+      if (!resolve_stmt(ctx, loop.cond))
+        return false;
+
+      if (loop.step.has_value() && !resolve_stmt(ctx, *loop.step))
+        return false;
+
+      // Locals of the body are visible in the body only, they still get a
+      // slot of the function.
+      ctx.table.enter_scope();
+      OnBlockExit([&ctx] { ctx.table.leave_scope(); });
+
+      for (auto& child : node.nodes) {
+        if (!resolve_node(ctx, *child))
+          return false;
+      }
+
+      return true;
+    }
+
+    case ASTID::branch:
+      if (!resolve_stmt(ctx, std::get<AstBranch>(node.value).cond))
+        return false;
+
+      for (auto& child : node.nodes) {
+        if (!resolve_node(ctx, *child))
+          return false;
+      }
+
+      return true;
+
+    // An arm of a branch, a scope like the body of a loop.
+    case ASTID::block: {
+      ctx.table.enter_scope();
+      OnBlockExit([&ctx] { ctx.table.leave_scope(); });
+
+      for (auto& child : node.nodes) {
+        if (!resolve_node(ctx, *child))
+          return false;
+      }
+
+      return true;
+    }
+
+    default:
+      spdlog::critical("Internal error: unexpected node in function body: {}",
+                       node);
+      return false;
+  }
+}
+
+static bool
+resolve_function(ResolveContext& ctx, ASTNode& node, SymbolIndex sym)
+{
+  const AstFunction& func = std::get<AstFunction>(node.value);
+
+  ctx.function = sym;
+  ctx.locals   = 0;
+  ctx.table.enter_scope();
+
+  OnBlockExit([&ctx] {
+    ctx.table.leave_scope();
+    ctx.function = INVALID_SYMBOL;
+  });
+
+  for (uint32_t i = 0; i < func.args.size(); ++i) {
+    const AstVariable& param = func.args[i];
+
+    if (param.name.empty())
+      continue;
+
+    if (!declare(ctx,
+                 Symbol{ .name  = param.name,
+                         .kind  = SymbolKind::param,
+                         .type  = param.type,
+                         .node  = &node,
+                         .slot  = i,
+                         .owner = sym }))
+      return false;
+  }
+
+  for (auto& child : node.nodes) {
+    if (!resolve_node(ctx, *child))
+      return false;
+  }
+
+  return true;
+}
+
+static void
+collect_locals(const ASTNode& node, std::vector<const ASTNode*>& locals)
+{
+  for (const auto& child : node.nodes) {
+    if (child->id == ASTID::vardecl)
+      locals.push_back(child.get());
+    else if (child->id == ASTID::loop || child->id == ASTID::branch ||
+             child->id == ASTID::block)
+      collect_locals(*child, locals);
+  }
+}
+
+std::vector<const ASTNode*>
+function_locals(const ASTNode& function)
+{
+  std::vector<const ASTNode*> locals;
+  collect_locals(function, locals);
+  return locals;
+}
+
+bool
+resolve_names(AST& ast, Symbols& symbols)
+{
+  ResolveContext                                ctx;
+  std::vector<std::pair<ASTNode*, SymbolIndex>> function_syms, global_syms;
+  uint32_t globals = 0, functions = 0, structures = 0;
+
+  // Declare everything at file scope first, so functions can refer to
+  // functions and globals declared below them.
+  for (auto& node : ast.root.nodes) {
+    Symbol sym{ .node = node.get(), .owner = INVALID_SYMBOL };
+
+    switch (node->id) {
+      case ASTID::vardecl: {
+        const auto& var = std::get<AstVariable>(node->value);
+        sym.name        = var.name;
+        sym.kind        = SymbolKind::global;
+        sym.type        = var.type;
+        sym.slot        = globals++;
+        sym.length      = var.length;
+        global_syms.emplace_back(node.get(), ctx.table.symbols.size());
+        break;
+      }
+
+      case ASTID::funcdecl: {
+        const auto& func = std::get<AstFunction>(node->value);
+        sym.name         = func.name;
+        sym.kind         = SymbolKind::function;
+        sym.type         = func.return_type;
+        sym.slot         = functions++;
+        function_syms.emplace_back(node.get(), ctx.table.symbols.size());
+        break;
+      }
+
+      case ASTID::strdecl:
+        sym.name = std::get<AstStruct>(node->value).name;
+        sym.kind = SymbolKind::structure;
+        sym.type = LangType::lt_void;
+        sym.slot = structures++;
+        break;
+
+      default:
+        continue;
+    }
+
+    if (!declare(ctx, std::move(sym)))
+      return false;
+  }
+
+  // Structures may be declared below the globals of their type.
+  for (const auto& [node, sym] : global_syms) {
+    AstVariable& var = std::get<AstVariable>(node->value);
+
+    if (!resolve_structure(ctx, var))
+      return false;
+
+    ctx.table.symbols[sym].structure = var.structure.symbol;
+  }
+
+  for (const auto& [node, sym] : function_syms) {
+    if (!resolve_function(ctx, *node, sym))
+      return false;
+  }
+
+  symbols = std::move(ctx.table.symbols);
+  return true;
+}
+
+} // namespace wcc
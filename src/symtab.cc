@@ -0,0 +1,129 @@
+#include "symtab.h"
+#include "util.h"
+
+namespace wcc {
+
+static constexpr uint32_t SYMTAB_INITIAL_BUCKETS = 64;
+
+SymbolTable::SymbolTable()
+  : buckets(SYMTAB_INITIAL_BUCKETS,
+            Bucket{ 0, INVALID_SYMBOL, INVALID_SYMBOL })
+{}
+
+uint32_t
+SymbolTable::hash_name(std::string_view name)
+{
+  // FNV-1a, identifiers are short so this beats anything vectorized.
+  uint32_t hash = 2166136261u;
+
+  for (const char c : name) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+uint32_t
+SymbolTable::find_bucket(std::string_view name, uint32_t hash) const
+{
+  const uint32_t mask = static_cast<uint32_t>(buckets.size()) - 1;
+
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    const Bucket& b = buckets[i];
+
+    if (b.key == INVALID_SYMBOL)
+      return i;
+
+    if (b.hash == hash && symbols[b.key].name == name)
+      return i;
+  }
+}
+
+void
+SymbolTable::grow()
+{
+  std::vector<Bucket>   old = std::move(buckets);
+  std::vector<uint32_t> remap(old.size());
+
+  buckets.assign(old.size() * 2, Bucket{ 0, INVALID_SYMBOL, INVALID_SYMBOL });
+
+  const uint32_t mask = static_cast<uint32_t>(buckets.size()) - 1;
+
+  for (uint32_t i = 0; i < old.size(); ++i) {
+    if (old[i].key == INVALID_SYMBOL)
+      continue;
+
+    uint32_t j = old[i].hash & mask;
+    while (buckets[j].key != INVALID_SYMBOL)
+      j = (j + 1) & mask;
+
+    buckets[j] = old[i];
+    remap[i]   = j;
+  }
+
+  for (auto& entry : undo_log)
+    entry.bucket = remap[entry.bucket];
+}
+
+SymbolIndex
+SymbolTable::declare(Symbol sym)
+{
+  // Keep the load factor under 1/2 so probe sequences stay short.
+  if ((used + 1) * 2 > buckets.size())
+    grow();
+
+  sym.hash  = hash_name(sym.name);
+  sym.depth = depth();
+
+  const uint32_t bucket = find_bucket(sym.name, sym.hash);
+  Bucket&        b      = buckets[bucket];
+
+  if (b.current != INVALID_SYMBOL && symbols[b.current].depth == sym.depth)
+    return INVALID_SYMBOL;
+
+  const auto index = static_cast<SymbolIndex>(symbols.size());
+  symbols.emplace_back(std::move(sym));
+
+  if (b.key == INVALID_SYMBOL) {
+    b.hash = symbols[index].hash;
+    b.key  = index;
+    ++used;
+  }
+
+  if (!scope_marks.empty())
+    undo_log.push_back(UndoEntry{ bucket, b.current });
+
+  b.current = index;
+  return index;
+}
+
+SymbolIndex
+SymbolTable::lookup(std::string_view name) const
+{
+  return buckets[find_bucket(name, hash_name(name))].current;
+}
+
+void
+SymbolTable::enter_scope()
+{
+  scope_marks.push_back(undo_log.size());
+}
+
+void
+SymbolTable::leave_scope()
+{
+  if (unlikely(scope_marks.empty()))
+    panic("Internal error: leaving the outermost scope");
+
+  const size_t mark = scope_marks.back();
+  scope_marks.pop_back();
+
+  while (undo_log.size() > mark) {
+    const UndoEntry& entry        = undo_log.back();
+    buckets[entry.bucket].current = entry.previous;
+    undo_log.pop_back();
+  }
+}
+
+} // namespace wcc
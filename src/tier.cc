@@ -0,0 +1,152 @@
+#include "tier.h"
+
+#include <spdlog/spdlog.h>
+
+#include "x64.h"
+
+namespace wcc::tier {
+
+std::unique_ptr<TieredModule>
+TieredModule::create(const AnalyzedFile&               file,
+                     const std::vector<StructLayout>&  layouts,
+                     std::shared_ptr<const ir::Module> module,
+                     uint32_t                          threshold,
+                     const x64::CompileOptions&        options)
+{
+  std::unique_ptr<TieredModule> tiered(new TieredModule);
+  tiered->module  = std::move(module);
+  tiered->options = jit::for_host(options);
+
+  if (!vm::compile(file, layouts, tiered->program))
+    return nullptr;
+
+  tiered->machine = std::make_unique<vm::Machine>(tiered->program);
+
+  TieredModule* self             = tiered.get();
+  tiered->machine->hot_threshold = threshold;
+  tiered->machine->on_hot = [self](uint32_t fn) { self->promote(fn); };
+
+  return tiered;
+}
+
+TieredModule::~TieredModule()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+
+  queued.notify_one();
+
+  if (compiler.joinable())
+    compiler.join();
+}
+
+bool
+TieredModule::call(const SymbolName&            name,
+                   const std::vector<VarValue>& args,
+                   VarValue&                    result)
+{
+  const int32_t function = program.find(name);
+
+  if (function < 0) {
+    spdlog::error("No function named {}", name);
+    return false;
+  }
+
+  return machine->call(static_cast<uint32_t>(function), args, result);
+}
+
+bool
+TieredModule::is_native(const SymbolName& name) const
+{
+  const int32_t function = program.find(name);
+  return function >= 0 && machine->is_native(static_cast<uint32_t>(function));
+}
+
+void
+TieredModule::wait()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  drained.wait(guard, [this] { return in_flight == 0; });
+}
+
+void
+TieredModule::promote(uint32_t function)
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    pending.push_back(function);
+    ++in_flight;
+  }
+
+  if (!compiler.joinable())
+    compiler = std::thread(&TieredModule::compile_loop, this);
+
+  queued.notify_one();
+}
+
+void
+TieredModule::compile_loop()
+{
+  std::unique_lock<std::mutex> guard(lock);
+
+  while (true) {
+    queued.wait(guard, [this] { return stopping || !pending.empty(); });
+
+    if (stopping)
+      return;
+
+    std::vector<uint32_t> batch;
+    batch.swap(pending);
+    guard.unlock();
+
+    for (const uint32_t function : batch)
+      install(function);
+
+    guard.lock();
+    in_flight -= batch.size();
+    drained.notify_all();
+  }
+}
+
+void
+TieredModule::install(uint32_t function)
+{
+  if (native == nullptr && !native_failed) {
+    const x64::MModule code    = x64::compile_module(*module, options);
+    x64::MachineCode   encoded = x64::encode_module(code);
+
+    for (size_t i = 0; i < module->functions.size(); ++i) {
+      stubs.push_back(x64::encode_entry_stub(
+        module->functions[i], static_cast<uint32_t>(i), encoded));
+    }
+
+    // Native code finds the elements of a global array where the
+    // interpreter keeps them.
+    std::vector<void*> globals;
+
+    for (size_t i = 0; i < program.globals.size(); ++i) {
+      const vm::Array& array = program.global_arrays[i];
+
+      globals.push_back(array.length != 0
+                          ? &machine->elements[array.offset]
+                          : &machine->globals[i]);
+    }
+
+    native        = jit::JitModule::load(code, encoded, globals);
+    native_failed = native == nullptr;
+
+    if (native_failed)
+      spdlog::warn("Native tier unavailable, staying interpreted");
+  }
+
+  if (native == nullptr)
+    return;
+
+  machine->set_native(function,
+                      reinterpret_cast<vm::Machine::NativeEntry>(
+                        native->address(stubs[function].offset)));
+}
+
+} // namespace wcc::tier
@@ -74,7 +74,11 @@ Tokenizer::get()
   if (current == end)
     return ret;
 
-  auto next = [](DataViewType current) { return *(current + 1); };
+  // `current` already points past the character being matched, so the
+  // lookahead is the character it points at.
+  auto next = [this](DataViewType current) {
+    return current == end ? '\0' : *current;
+  };
 
 match_token:
 
@@ -137,6 +141,7 @@ match_token:
           ret.id = TOKENID::OP_OR;
       }
 
+      break;
     case '*':
       ret.id = TOKENID::OP_MUL;
 
@@ -226,6 +231,34 @@ match_token:
     case '.':
       ret.id = TOKENID::OP_DOT;
       break;
+    case '0' ... '9': {
+      ret.id    = TOKENID::INT_LITERAL;
+      ret.value = c;
+
+      // Only the extent of the literal is found here, the value is parsed
+      // once by the parser (see literal.h) instead of on every peek().
+      for (; current != end; ++current) {
+        const char prev = ret.value.back();
+        c               = *current;
+
+        if (c == '.')
+          ret.id = TOKENID::FLOAT_LITERAL;
+        else if ((c == '+' || c == '-') && (prev == 'e' || prev == 'E'))
+          ret.id = TOKENID::FLOAT_LITERAL;
+        else if (!is_identifier(c))
+          break;
+
+        ret.value += c;
+      }
+
+      const bool is_hex = ret.value.size() > 1 &&
+                          (ret.value[1] == 'x' || ret.value[1] == 'X');
+
+      if (!is_hex && ret.value.find_first_of("eE") != std::string::npos)
+        ret.id = TOKENID::FLOAT_LITERAL;
+
+      break;
+    }
     default:
       ret.id    = TOKENID::IDENTIFIER;
       ret.value = "";
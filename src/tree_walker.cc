@@ -0,0 +1,472 @@
+#include "tree_walker.h"
+
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+#include "fold.h"
+#include "queries.h"
+#include "resolve.h"
+#include "util.h"
+
+namespace wcc {
+
+TreeWalker::TreeWalker(const AnalyzedFile& file)
+  : file(file)
+{
+  for (const auto& node : file.ast->root.nodes) {
+    if (node->id == ASTID::vardecl)
+      globals.push_back(VarValue{ 0 });
+    else if (node->id == ASTID::funcdecl)
+      functions.push_back(node.get());
+  }
+
+  for (const ASTNode* node : functions)
+    num_locals.push_back(static_cast<uint32_t>(function_locals(*node).size()));
+
+  // Elements get a value each, after the globals or after the locals of
+  // their function. So do the fields of structures, whatever their layout.
+  element_offset.resize(file.symbols.size());
+
+  for (size_t i = 0; i < file.symbols.size(); ++i) {
+    const Symbol& symbol = file.symbols[i];
+    uint32_t      count  = symbol.length;
+
+    if (symbol.structure != INVALID_SYMBOL) {
+      const auto& str =
+        std::get<AstStruct>(file.symbols[symbol.structure].node->value);
+      count = std::max<uint32_t>(count, 1) *
+              static_cast<uint32_t>(str.fields.size());
+    }
+
+    if (count == 0)
+      continue;
+
+    if (symbol.kind == SymbolKind::global) {
+      element_offset[i] = static_cast<uint32_t>(globals.size());
+      globals.resize(globals.size() + count, VarValue{ 0 });
+      continue;
+    }
+
+    uint32_t& locals = num_locals[file.symbols[symbol.owner].slot];
+    element_offset[i] = locals;
+    locals += count;
+  }
+}
+
+bool
+TreeWalker::call(const SymbolName&            name,
+                 const std::vector<VarValue>& args,
+                 VarValue&                    result)
+{
+  for (size_t i = 0; i < functions.size(); ++i) {
+    const AstFunction& fn = std::get<AstFunction>(functions[i]->value);
+
+    if (fn.name != name)
+      continue;
+
+    if (args.size() != fn.args.size()) {
+      spdlog::error("{}: expected {} arguments, got {}",
+                    name,
+                    fn.args.size(),
+                    args.size());
+      return false;
+    }
+
+    depth = 0;
+    return invoke(static_cast<uint32_t>(i), args, result);
+  }
+
+  spdlog::error("No function named {}", name);
+  return false;
+}
+
+// Parameters come first in `vars`, followed by the locals and the elements
+// of local arrays.
+VarValue&
+TreeWalker::variable(std::vector<VarValue>& vars, SymbolIndex sym)
+{
+  const Symbol& symbol = file.symbols[sym];
+
+  switch (symbol.kind) {
+    case SymbolKind::global:
+      return globals[symbol.slot];
+    case SymbolKind::param:
+      return vars[symbol.slot];
+    case SymbolKind::local: {
+      const ASTNode& owner = *file.symbols[symbol.owner].node;
+      return vars[std::get<AstFunction>(owner.value).args.size() + symbol.slot];
+    }
+    default:
+      panic("Internal error: reference to a non-variable symbol");
+  }
+}
+
+VarValue*
+TreeWalker::elements(std::vector<VarValue>& vars, SymbolIndex sym)
+{
+  const Symbol& symbol = file.symbols[sym];
+
+  // Local element offsets count from the first local.
+  return symbol.kind == SymbolKind::global
+           ? &globals[element_offset[sym]]
+           : &variable(vars, sym) - symbol.slot + element_offset[sym];
+}
+
+bool
+TreeWalker::subscript(std::vector<VarValue>& vars,
+                      const AstSymRef&       array,
+                      const AstStmt&         index,
+                      uint64_t&              i)
+{
+  const Symbol& symbol = file.symbols[array.symbol];
+  VarValue      value;
+
+  if (!eval(vars, index, value))
+    return false;
+
+  if (value.u64_value >= symbol.length) {
+    spdlog::error("Index {} of \"{}\" out of bounds",
+                  value.i64_value,
+                  symbol.name);
+    return false;
+  }
+
+  i = value.u64_value;
+  return true;
+}
+
+bool
+TreeWalker::element(std::vector<VarValue>& vars,
+                    const AstIndex&        index,
+                    VarValue*&             place)
+{
+  uint64_t i;
+
+  if (!subscript(vars, index.array, index.index[0], i))
+    return false;
+
+  place = elements(vars, index.array.symbol) + i;
+  return true;
+}
+
+bool
+TreeWalker::field(std::vector<VarValue>& vars,
+                  const AstField&        field,
+                  VarValue*&             place)
+{
+  const Symbol& symbol = file.symbols[field.object.symbol];
+  const auto&   str =
+    std::get<AstStruct>(file.symbols[symbol.structure].node->value);
+  uint64_t i = 0;
+
+  if (!field.index.empty() &&
+      !subscript(vars, field.object, field.index[0], i))
+    return false;
+
+  place = elements(vars, field.object.symbol) + i * str.fields.size() +
+          field.number;
+  return true;
+}
+
+bool
+TreeWalker::lvalue(std::vector<VarValue>& vars,
+                   const AstStmt&         target,
+                   VarValue*&             place)
+{
+  if (target.type == StmtType::index)
+    return element(vars, std::get<AstIndex>(target.value), place);
+
+  if (target.type == StmtType::field)
+    return field(vars, std::get<AstField>(target.value), place);
+
+  place = &variable(vars, std::get<AstSymRef>(target.value).symbol);
+  return true;
+}
+
+bool
+TreeWalker::invoke(uint32_t              function,
+                   std::vector<VarValue> vars,
+                   VarValue&             result)
+{
+  if (depth == MAX_DEPTH) {
+    spdlog::error("Call depth exceeds {}", MAX_DEPTH);
+    return false;
+  }
+
+  const ASTNode& node = *functions[function];
+
+  vars.resize(vars.size() + num_locals[function], VarValue{ 0 });
+
+  ++depth;
+
+  bool returned = false;
+
+  if (!execute(vars, node, returned, result))
+    return false;
+
+  // Falling off the end returns zero.
+  if (!returned)
+    result.u64_value = 0;
+
+  --depth;
+  return true;
+}
+
+bool
+TreeWalker::execute(std::vector<VarValue>& vars,
+                    const ASTNode&         node,
+                    bool&                  returned,
+                    VarValue&              result)
+{
+  for (const auto& child : node.nodes) {
+    if (child->id == ASTID::loop) {
+      if (!execute_loop(vars, *child, returned, result))
+        return false;
+
+      if (returned)
+        return true;
+
+      continue;
+    }
+
+    if (child->id == ASTID::branch) {
+      if (!execute_branch(vars, *child, returned, result))
+        return false;
+
+      if (returned)
+        return true;
+
+      continue;
+    }
+
+    if (child->id != ASTID::stmt)
+      continue;
+
+    const AstStmt& stmt = std::get<AstStmt>(child->value);
+    VarValue       value;
+
+    if (stmt.type != StmtType::ret) {
+      if (!eval(vars, stmt, value))
+        return false;
+
+      continue;
+    }
+
+    result.u64_value = 0;
+
+    if (!child->nodes.empty() &&
+        !eval(vars, std::get<AstStmt>(child->nodes[0]->value), result))
+      return false;
+
+    returned = true;
+    return true;
+  }
+
+  return true;
+}
+
+bool
+TreeWalker::execute_loop(std::vector<VarValue>& vars,
+                         const ASTNode&         node,
+                         bool&                  returned,
+                         VarValue&              result)
+{
+  const AstLoop& loop = std::get<AstLoop>(node.value);
+  VarValue       value;
+
+  for (;;) {
+    if (!eval(vars, loop.cond, value))
+      return false;
+
+    if (!constant_truth(file.types[loop.cond], value.u64_value))
+      return true;
+
+    if (!execute(vars, node, returned, result))
+      return false;
+
+    if (returned)
+      return true;
+
+    if (loop.step.has_value() && !eval(vars, *loop.step, value))
+      return false;
+  }
+}
+
+bool
+TreeWalker::execute_branch(std::vector<VarValue>& vars,
+                           const ASTNode&         node,
+                           bool&                  returned,
+                           VarValue&              result)
+{
+  const AstBranch& branch = std::get<AstBranch>(node.value);
+  VarValue         value;
+
+  if (!eval(vars, branch.cond, value))
+    return false;
+
+  const bool   taken = constant_truth(file.types[branch.cond], value.u64_value);
+  const size_t arm   = taken ? 0 : 1;
+
+  if (arm >= node.nodes.size())
+    return true;
+
+  return execute(vars, *node.nodes[arm], returned, result);
+}
+
+bool
+TreeWalker::eval_operator(std::vector<VarValue>& vars,
+                          const AstStmt&         stmt,
+                          VarValue&              value)
+{
+  const AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+  const TOKENID          id   = call.from_token.id;
+
+  VarValue  lhs;
+  VarValue  rhs;
+  VarValue* place;
+
+  switch (id) {
+    case TOKENID::OP_EQ:
+      if (!lvalue(vars, call.args[0], place) ||
+          !eval(vars, call.args[1], value))
+        return false;
+
+      *place = value;
+      return true;
+
+    case TOKENID::OP_MULEQ:
+    case TOKENID::OP_DIVEQ:
+    case TOKENID::OP_ANDEQ:
+    case TOKENID::OP_OREQ:
+      if (!lvalue(vars, call.args[0], place))
+        return false;
+
+      lhs = *place;
+      break;
+
+    case TOKENID::OP_LOGIC_AND:
+    case TOKENID::OP_LOGIC_OR: {
+      const bool is_and = id == TOKENID::OP_LOGIC_AND;
+
+      if (!eval(vars, call.args[0], lhs))
+        return false;
+
+      const bool left = constant_truth(file.types[call.args[0]], lhs.u64_value);
+
+      if (left != is_and) {
+        value.u64_value = left;
+        return true;
+      }
+
+      if (!eval(vars, call.args[1], rhs))
+        return false;
+
+      value.u64_value = constant_truth(file.types[call.args[1]], rhs.u64_value);
+      return true;
+    }
+
+    default:
+      break;
+  }
+
+  const bool compound = id == TOKENID::OP_MULEQ || id == TOKENID::OP_DIVEQ ||
+                        id == TOKENID::OP_ANDEQ || id == TOKENID::OP_OREQ;
+
+  if ((!compound && !eval(vars, call.args[0], lhs)) ||
+      !eval(vars, call.args[1], rhs))
+    return false;
+
+  const ir::Opcode op   = ir::operator_opcode(id);
+  const LangType   type = ir::is_compare(op) ? file.types[call.args[0]]
+                                             : file.types[stmt];
+
+  const auto result = fold_binary(op, type, lhs.u64_value, rhs.u64_value);
+
+  if (!result) {
+    spdlog::error("Integer division trap");
+    return false;
+  }
+
+  value.u64_value = *result;
+
+  // Compound assignments store their result back.
+  if (compound)
+    *place = value;
+
+  return true;
+}
+
+bool
+TreeWalker::eval(std::vector<VarValue>& vars,
+                 const AstStmt&         stmt,
+                 VarValue&              value)
+{
+  switch (stmt.type) {
+    case StmtType::varref:
+      value = variable(vars, std::get<AstSymRef>(stmt.value).symbol);
+      return true;
+
+    case StmtType::literal:
+      value = std::get<AstLiteral>(stmt.value).value;
+      return true;
+
+    case StmtType::conv: {
+      const AstConversion& conv = std::get<AstConversion>(stmt.value);
+      VarValue             operand;
+
+      if (!eval(vars, conv.operand[0], operand))
+        return false;
+
+      // Out of range float to integer conversions are undefined, any value
+      // will do.
+      value.u64_value =
+        fold_conversion(conv.kind, conv.from, conv.to, operand.u64_value)
+          .value_or(0);
+      return true;
+    }
+
+    case StmtType::call: {
+      const AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+
+      if (call.symbol == INVALID_SYMBOL)
+        return eval_operator(vars, stmt, value);
+
+      std::vector<VarValue> args(call.args.size());
+
+      for (size_t i = 0; i < call.args.size(); ++i) {
+        if (!eval(vars, call.args[i], args[i]))
+          return false;
+      }
+
+      return invoke(file.symbols[call.symbol].slot, std::move(args), value);
+    }
+
+    case StmtType::index: {
+      VarValue* place;
+
+      if (!element(vars, std::get<AstIndex>(stmt.value), place))
+        return false;
+
+      value = *place;
+      return true;
+    }
+
+    case StmtType::field: {
+      VarValue* place;
+
+      if (!field(vars, std::get<AstField>(stmt.value), place))
+        return false;
+
+      value = *place;
+      return true;
+    }
+
+    case StmtType::ret:
+      break;
+  }
+
+  panic("Internal error: unexpected statement in expression");
+}
+
+} // namespace wcc
@@ -0,0 +1,618 @@
+#include "typecheck.h"
+#include "ast_format.h"
+#include "layout.h"
+#include "resolve.h"
+#include "symtab.h"
+
+#include <spdlog/spdlog.h>
+
+namespace wcc {
+
+struct TypecheckContext
+{
+  const Symbols&     symbols;
+  ExprTypes&         types;
+  const AstFunction* function;
+};
+
+enum class OperatorClass
+{
+  arith,
+  integer_arith,
+  compare,
+  logic,
+  assign,
+  compound_assign,
+  integer_compound_assign,
+  unsupported,
+};
+
+static OperatorClass
+classify_operator(TOKENID id)
+{
+  switch (id) {
+    case TOKENID::OP_PLUS:
+    case TOKENID::OP_MINUS:
+    case TOKENID::OP_MUL:
+    case TOKENID::OP_DIV:
+      return OperatorClass::arith;
+
+    case TOKENID::OP_MOD:
+    case TOKENID::OP_AND:
+    case TOKENID::OP_OR:
+    case TOKENID::OP_XOR:
+      return OperatorClass::integer_arith;
+
+    case TOKENID::OP_LS:
+    case TOKENID::OP_LSE:
+    case TOKENID::OP_GR:
+    case TOKENID::OP_GRE:
+    case TOKENID::OP_NEQ:
+      return OperatorClass::compare;
+
+    case TOKENID::OP_LOGIC_AND:
+    case TOKENID::OP_LOGIC_OR:
+      return OperatorClass::logic;
+
+    case TOKENID::OP_EQ:
+      return OperatorClass::assign;
+
+    case TOKENID::OP_MULEQ:
+    case TOKENID::OP_DIVEQ:
+      return OperatorClass::compound_assign;
+
+    case TOKENID::OP_ANDEQ:
+    case TOKENID::OP_OREQ:
+      return OperatorClass::integer_compound_assign;
+
+    default:
+      return OperatorClass::unsupported;
+  }
+}
+
+static const char*
+function_name(const TypecheckContext& ctx)
+{
+  return ctx.function ? ctx.function->name.c_str() : "<file scope>";
+}
+
+static void
+number(TypecheckContext& ctx, AstStmt& stmt)
+{
+  stmt.id = static_cast<StmtIndex>(ctx.types.types.size());
+  ctx.types.types.push_back(LangType::lt_void);
+}
+
+static void
+set_type(TypecheckContext& ctx, const AstStmt& stmt, LangType type)
+{
+  ctx.types.types[stmt.id] = type;
+}
+
+static bool
+convert(TypecheckContext& ctx, AstStmt& stmt, LangType to)
+{
+  const LangType from = ctx.types[stmt];
+
+  if (from == to)
+    return true;
+
+  const ConvKind kind = CONV_KIND[underlay_cast(from)][underlay_cast(to)];
+
+  if (kind == ConvKind::invalid) {
+    spdlog::error("Cannot convert {} to {} in {}",
+                  LANG_TYPE_STR[underlay_cast(from)],
+                  LANG_TYPE_STR[underlay_cast(to)],
+                  function_name(ctx));
+    return false;
+  }
+
+  if (is_narrowing(from, to))
+    spdlog::warn("Implicit conversion from {} to {} in {} may lose precision",
+                 LANG_TYPE_STR[underlay_cast(from)],
+                 LANG_TYPE_STR[underlay_cast(to)],
+                 function_name(ctx));
+
+  AstStmt conv{ .type  = StmtType::conv,
+                .value = AstConversion{ .kind = kind, .from = from, .to = to } };
+
+  std::get<AstConversion>(conv.value).operand.emplace_back(std::move(stmt));
+  stmt = std::move(conv);
+
+  number(ctx, stmt);
+  set_type(ctx, stmt, to);
+  return true;
+}
+
+static bool
+check_varref(TypecheckContext& ctx, AstStmt& stmt)
+{
+  const AstSymRef& ref = std::get<AstSymRef>(stmt.value);
+
+  if (ref.symbol == INVALID_SYMBOL) {
+    spdlog::critical("Internal error: unresolved reference \"{}\" in {}",
+                     ref.name,
+                     function_name(ctx));
+    return false;
+  }
+
+  if (ctx.symbols[ref.symbol].structure != INVALID_SYMBOL) {
+    spdlog::error("Structure \"{}\" used as a value in {}",
+                  ref.name,
+                  function_name(ctx));
+    return false;
+  }
+
+  if (ctx.symbols[ref.symbol].length != 0) {
+    spdlog::error("Array \"{}\" used as a value in {}",
+                  ref.name,
+                  function_name(ctx));
+    return false;
+  }
+
+  set_type(ctx, stmt, ctx.symbols[ref.symbol].type);
+  return true;
+}
+
+static bool
+check_stmt(TypecheckContext& ctx, AstStmt& stmt);
+
+// Indices are converted to i64 and checked against the length as unsigned,
+// negative ones included.
+static bool
+check_subscript(TypecheckContext& ctx, const AstSymRef& array, AstStmt& index)
+{
+  if (ctx.symbols[array.symbol].length == 0) {
+    spdlog::error("Subscripted variable \"{}\" is not an array in {}",
+                  array.name,
+                  function_name(ctx));
+    return false;
+  }
+
+  if (!check_stmt(ctx, index))
+    return false;
+
+  if (!is_integer(ctx.types[index])) {
+    spdlog::error("Index of \"{}\" is not an integer in {}",
+                  array.name,
+                  function_name(ctx));
+    return false;
+  }
+
+  return convert(ctx, index, LangType::lt_i64);
+}
+
+static bool
+check_index(TypecheckContext& ctx, AstStmt& stmt)
+{
+  AstIndex&     index  = std::get<AstIndex>(stmt.value);
+  const Symbol& symbol = ctx.symbols[index.array.symbol];
+
+  if (!check_subscript(ctx, index.array, index.index[0]))
+    return false;
+
+  if (symbol.structure != INVALID_SYMBOL) {
+    spdlog::error("Element of \"{}\" used as a value in {}, it is a structure",
+                  index.array.name,
+                  function_name(ctx));
+    return false;
+  }
+
+  set_type(ctx, stmt, symbol.type);
+  return true;
+}
+
+// `object.field` and `object[index].field`, typed by the field.
+static bool
+check_field(TypecheckContext& ctx, AstStmt& stmt)
+{
+  AstField&     field  = std::get<AstField>(stmt.value);
+  const Symbol& symbol = ctx.symbols[field.object.symbol];
+
+  if (symbol.structure == INVALID_SYMBOL) {
+    spdlog::error("Member access on \"{}\" in {}, which is not a structure",
+                  field.object.name,
+                  function_name(ctx));
+    return false;
+  }
+
+  if (field.index.empty() && symbol.length != 0) {
+    spdlog::error("Member access on array \"{}\" in {}",
+                  field.object.name,
+                  function_name(ctx));
+    return false;
+  }
+
+  if (!field.index.empty() &&
+      !check_subscript(ctx, field.object, field.index[0]))
+    return false;
+
+  const auto& str =
+    std::get<AstStruct>(ctx.symbols[symbol.structure].node->value);
+
+  for (uint32_t f = 0; f < str.fields.size(); ++f) {
+    if (str.fields[f].name == field.field) {
+      field.number = f;
+      set_type(ctx, stmt, str.fields[f].type);
+      return true;
+    }
+  }
+
+  spdlog::error("Structure \"{}\" has no field \"{}\" in {}",
+                str.name,
+                field.field,
+                function_name(ctx));
+  return false;
+}
+
+static bool
+is_lvalue(const AstStmt& stmt)
+{
+  return stmt.type == StmtType::varref || stmt.type == StmtType::index ||
+         stmt.type == StmtType::field;
+}
+
+static bool
+check_operator(TypecheckContext& ctx, AstStmt& stmt)
+{
+  AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+  const auto       cls  = classify_operator(call.from_token.id);
+
+  if (cls == OperatorClass::unsupported) {
+    spdlog::error(
+      "Operator {} is not supported in {}", call.name, function_name(ctx));
+    return false;
+  }
+
+  if (call.args.size() != 2) {
+    spdlog::critical("Internal error: we expected stdop to have 2 args");
+    return false;
+  }
+
+  AstStmt& lhs = call.args[0];
+  AstStmt& rhs = call.args[1];
+
+  const LangType lhs_type = ctx.types[lhs];
+  const LangType rhs_type = ctx.types[rhs];
+
+  if (lhs_type == LangType::lt_void || rhs_type == LangType::lt_void) {
+    spdlog::error(
+      "Void value used as operand of {} in {}", call.name, function_name(ctx));
+    return false;
+  }
+
+  const bool integer_only = cls == OperatorClass::integer_arith ||
+                            cls == OperatorClass::integer_compound_assign;
+
+  if (integer_only && !(is_integer(lhs_type) && is_integer(rhs_type))) {
+    spdlog::error("Operator {} requires integer operands, got {} and {} in {}",
+                  call.name,
+                  LANG_TYPE_STR[underlay_cast(lhs_type)],
+                  LANG_TYPE_STR[underlay_cast(rhs_type)],
+                  function_name(ctx));
+    return false;
+  }
+
+  switch (cls) {
+    case OperatorClass::arith:
+    case OperatorClass::integer_arith: {
+      const LangType result =
+        ARITH_RESULT[underlay_cast(lhs_type)][underlay_cast(rhs_type)];
+
+      if (!convert(ctx, lhs, result) || !convert(ctx, rhs, result))
+        return false;
+
+      set_type(ctx, stmt, result);
+      return true;
+    }
+
+    case OperatorClass::compare: {
+      const LangType common =
+        ARITH_RESULT[underlay_cast(lhs_type)][underlay_cast(rhs_type)];
+
+      if (!convert(ctx, lhs, common) || !convert(ctx, rhs, common))
+        return false;
+
+      set_type(ctx, stmt, LangType::lt_i32);
+      return true;
+    }
+
+    case OperatorClass::logic:
+      // Operands are only tested against zero, no conversion needed.
+      set_type(ctx, stmt, LangType::lt_i32);
+      return true;
+
+    case OperatorClass::assign:
+    case OperatorClass::compound_assign:
+    case OperatorClass::integer_compound_assign:
+      if (!is_lvalue(lhs)) {
+        spdlog::error("Left hand side of {} is not assignable in {}",
+                      call.name,
+                      function_name(ctx));
+        return false;
+      }
+
+      if (!convert(ctx, rhs, lhs_type))
+        return false;
+
+      set_type(ctx, stmt, lhs_type);
+      return true;
+
+    case OperatorClass::unsupported:
+      break;
+  }
+
+  return false;
+}
+
+static bool
+check_call(TypecheckContext& ctx, AstStmt& stmt)
+{
+  AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+
+  for (auto& arg : call.args) {
+    if (!check_stmt(ctx, arg))
+      return false;
+  }
+
+  if (call.symbol == INVALID_SYMBOL)
+    return check_operator(ctx, stmt);
+
+  const Symbol& callee = ctx.symbols[call.symbol];
+  const auto&   params = std::get<AstFunction>(callee.node->value).args;
+
+  if (params.size() != call.args.size()) {
+    spdlog::error("Function {} expects {} arguments, but {} were given in {}",
+                  callee.name,
+                  params.size(),
+                  call.args.size(),
+                  function_name(ctx));
+    return false;
+  }
+
+  for (size_t i = 0; i < params.size(); ++i) {
+    if (!convert(ctx, call.args[i], params[i].type))
+      return false;
+  }
+
+  set_type(ctx, stmt, callee.type);
+  return true;
+}
+
+static bool
+check_stmt(TypecheckContext& ctx, AstStmt& stmt)
+{
+  // Number the node before its children, so ids follow source order.
+  number(ctx, stmt);
+
+  switch (stmt.type) {
+    case StmtType::varref:
+      return check_varref(ctx, stmt);
+
+    case StmtType::call:
+      return check_call(ctx, stmt);
+
+    case StmtType::ret:
+      // Operand is a child node, checked by check_node().
+      return true;
+
+    case StmtType::conv: {
+      AstConversion& conv = std::get<AstConversion>(stmt.value);
+
+      if (!check_stmt(ctx, conv.operand[0]))
+        return false;
+
+      set_type(ctx, stmt, conv.to);
+      return true;
+    }
+
+    case StmtType::literal:
+      set_type(ctx, stmt, std::get<AstLiteral>(stmt.value).type);
+      return true;
+
+    case StmtType::index:
+      return check_index(ctx, stmt);
+
+    case StmtType::field:
+      return check_field(ctx, stmt);
+  }
+
+  return false;
+}
+
+static bool
+check_node(TypecheckContext& ctx, ASTNode& node);
+
+// The condition is true when non-zero, like an operand of && and ||.
+static bool
+check_loop(TypecheckContext& ctx, ASTNode& node)
+{
+  AstLoop& loop = std::get<AstLoop>(node.value);
+
+  if (loop.cond.type == StmtType::ret ||
+      (loop.step.has_value() && loop.step->type == StmtType::ret)) {
+    spdlog::error("Return statement in a loop header in {}",
+                  function_name(ctx));
+    return false;
+  }
+
+  if (!check_stmt(ctx, loop.cond))
+    return false;
+
+  if (ctx.types[loop.cond] == LangType::lt_void) {
+    spdlog::error("Loop condition has no value in {}", function_name(ctx));
+    return false;
+  }
+
+  if (loop.step.has_value() && !check_stmt(ctx, *loop.step))
+    return false;
+
+  for (auto& child : node.nodes) {
+    if (!check_node(ctx, *child))
+      return false;
+  }
+
+  return true;
+}
+
+// Like a loop condition, true when non-zero.
+static bool
+check_branch(TypecheckContext& ctx, ASTNode& node)
+{
+  AstBranch& branch = std::get<AstBranch>(node.value);
+
+  if (branch.cond.type == StmtType::ret) {
+    spdlog::error("Return statement in an if condition in {}",
+                  function_name(ctx));
+    return false;
+  }
+
+  if (!check_stmt(ctx, branch.cond))
+    return false;
+
+  if (ctx.types[branch.cond] == LangType::lt_void) {
+    spdlog::error("If condition has no value in {}", function_name(ctx));
+    return false;
+  }
+
+  for (auto& child : node.nodes) {
+    if (!check_node(ctx, *child))
+      return false;
+  }
+
+  return true;
+}
+
+static bool
+check_node(TypecheckContext& ctx, ASTNode& node)
+{
+  if (node.id == ASTID::loop)
+    return check_loop(ctx, node);
+
+  if (node.id == ASTID::branch)
+    return check_branch(ctx, node);
+
+  if (node.id == ASTID::block) {
+    for (auto& child : node.nodes) {
+      if (!check_node(ctx, *child))
+        return false;
+    }
+
+    return true;
+  }
+
+  if (node.id != ASTID::stmt)
+    return true;
+
+  AstStmt& stmt = std::get<AstStmt>(node.value);
+
+  if (!check_stmt(ctx, stmt))
+    return false;
+
+  if (stmt.type != StmtType::ret)
+    return true;
+
+  const LangType ret_type = ctx.function->return_type;
+
+  if (node.nodes.empty()) {
+    if (ret_type == LangType::lt_void)
+      return true;
+
+    spdlog::error("Missing return value in {}", function_name(ctx));
+    return false;
+  }
+
+  AstStmt& value = std::get<AstStmt>(node.nodes[0]->value);
+
+  if (!check_stmt(ctx, value))
+    return false;
+
+  if (ret_type == LangType::lt_void) {
+    spdlog::error("Void function {} returns a value", function_name(ctx));
+    return false;
+  }
+
+  return convert(ctx, value, ret_type);
+}
+
+// Fields have a LangType and a name of their own. Variables of a structure
+// take some memory, but no more than the largest array.
+static bool
+check_structures(const Symbols& symbols)
+{
+  for (const Symbol& symbol : symbols) {
+    if (symbol.kind != SymbolKind::structure)
+      continue;
+
+    const auto& str = std::get<AstStruct>(symbol.node->value);
+
+    for (size_t f = 0; f < str.fields.size(); ++f) {
+      if (str.fields[f].type == LangType::lt_void) {
+        spdlog::error("Field \"{}\" of structure \"{}\" has type void",
+                      str.fields[f].name,
+                      str.name);
+        return false;
+      }
+
+      for (size_t g = 0; g < f; ++g) {
+        if (str.fields[g].name == str.fields[f].name) {
+          spdlog::error("Duplicate field \"{}\" in structure \"{}\"",
+                        str.fields[f].name,
+                        str.name);
+          return false;
+        }
+      }
+    }
+  }
+
+  for (const Symbol& symbol : symbols) {
+    if (symbol.structure == INVALID_SYMBOL)
+      continue;
+
+    // No order of the fields is larger than the declared one.
+    const auto& str = std::get<AstStruct>(symbols[symbol.structure].node->value);
+    const uint64_t size = layout_struct(str, FieldOrder::declared).size;
+
+    if (size == 0) {
+      spdlog::error("Variable \"{}\" of empty structure \"{}\"",
+                    symbol.name,
+                    str.name);
+      return false;
+    }
+
+    if (std::max<uint64_t>(symbol.length, 1) * size >
+        uint64_t(MAX_ARRAY_LENGTH) * 8) {
+      spdlog::error("Variable \"{}\" of structure \"{}\" is too large",
+                    symbol.name,
+                    str.name);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool
+typecheck(AST& ast, const Symbols& symbols, ExprTypes& types)
+{
+  TypecheckContext ctx{ symbols, types, nullptr };
+
+  if (!check_structures(symbols))
+    return false;
+
+  for (auto& node : ast.root.nodes) {
+    if (node->id != ASTID::funcdecl)
+      continue;
+
+    ctx.function = &std::get<AstFunction>(node->value);
+
+    for (auto& child : node->nodes) {
+      if (!check_node(ctx, *child))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+} // namespace wcc
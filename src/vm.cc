@@ -0,0 +1,534 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+#include "fold.h"
+#include "typecheck.h"
+#include "util.h"
+
+namespace wcc::vm {
+
+static inline uint64_t
+sext32(uint64_t v)
+{
+  return static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(v)));
+}
+
+static inline uint64_t
+zext32(uint64_t v)
+{
+  return v & 0xFFFFFFFF;
+}
+
+static inline VarValue
+from_f32(float f)
+{
+  VarValue v;
+  v.u64_value = 0;
+  v.f32_value = f;
+  return v;
+}
+
+static inline VarValue
+from_f64(double d)
+{
+  VarValue v;
+  v.f64_value = d;
+  return v;
+}
+
+// Float to integer conversions of values out of range are undefined in the
+// language; they give the x86 "integer indefinite" value instead of being
+// undefined in the interpreter as well.
+constexpr uint64_t INDEFINITE = uint64_t(1) << 63;
+
+static inline uint64_t
+to_i64(double d)
+{
+  const double t = std::trunc(d);
+
+  if (!(t >= -0x1p63 && t < 0x1p63))
+    return INDEFINITE;
+
+  return static_cast<uint64_t>(static_cast<int64_t>(t));
+}
+
+static inline uint64_t
+to_u64(double d)
+{
+  const double t = std::trunc(d);
+
+  if (!(t >= 0 && t < 0x1p64))
+    return INDEFINITE;
+
+  return static_cast<uint64_t>(t);
+}
+
+Machine::Machine(const Program& program)
+  : globals(program.globals.size())
+  , elements(program.array_words)
+  , program(program)
+  , stack(STACK_SIZE)
+  , array_stack(ARRAY_STACK_SIZE)
+  , entries(new Entry[program.functions.size()])
+{
+  for (VarValue& global : globals)
+    global.u64_value = 0;
+
+  for (VarValue& element : elements)
+    element.u64_value = 0;
+}
+
+// Address of element `index` of `array`, null if it is out of bounds.
+static inline char*
+element(VarValue* globals, VarValue* locals, const Array& array, uint64_t index)
+{
+  if (index >= array.length)
+    return nullptr;
+
+  VarValue* base = (array.global ? globals : locals) + array.offset;
+  return reinterpret_cast<char*>(base) + array.disp + index * array.stride;
+}
+
+void
+Machine::set_native(uint32_t function, NativeEntry entry)
+{
+  entries[function].native.store(entry, std::memory_order_release);
+}
+
+bool
+Machine::is_native(uint32_t function) const
+{
+  return entries[function].native.load(std::memory_order_acquire) != nullptr;
+}
+
+inline bool
+Machine::call_native(uint32_t function, const VarValue* args, VarValue& result)
+{
+  Entry&            entry  = entries[function];
+  const NativeEntry native = entry.native.load(std::memory_order_acquire);
+
+  if (native != nullptr) {
+    const LangType type = program.functions[function].return_type;
+    result.u64_value    = normalize_constant(type, native(args));
+    return true;
+  }
+
+  if (hot_threshold != 0 && ++entry.calls == hot_threshold && on_hot)
+    on_hot(function);
+
+  return false;
+}
+
+bool
+Machine::call(uint32_t                     function,
+              const std::vector<VarValue>& args,
+              VarValue&                    result)
+{
+#define WCC_VM_LABEL(name) &&op_##name,
+  static void* const labels[] = { WCC_VM_OPCODES(WCC_VM_LABEL) };
+#undef WCC_VM_LABEL
+
+  const Function* fn = &program.functions[function];
+
+  if (args.size() != fn->params.size()) {
+    spdlog::error("{}: expected {} arguments, got {}",
+                  fn->name,
+                  fn->params.size(),
+                  args.size());
+    return false;
+  }
+
+  if (call_native(function, args.data(), result))
+    return true;
+
+  VarValue* const stack_end  = stack.data() + stack.size();
+  VarValue* const arrays_end = array_stack.data() + array_stack.size();
+  VarValue* const g          = globals.data();
+  VarValue* const e          = elements.data();
+  VarValue*       regs       = stack.data();
+  VarValue*       a          = array_stack.data();
+  const VarValue* k          = fn->constants.data();
+  const Instr*    pc         = fn->code.data();
+  char*           address;
+
+  if (regs + fn->num_regs > stack_end || a + fn->array_words > arrays_end)
+    goto stack_overflow;
+
+  std::fill(a, a + fn->array_words, VarValue{ 0 });
+
+  std::copy(args.begin(), args.end(), regs);
+  frames.clear();
+
+#define RA regs[pc->a]
+#define RB regs[pc->b]
+#define RC regs[pc->c]
+#define DISPATCH() goto* labels[underlay_cast(pc->op)]
+#define NEXT() goto* labels[underlay_cast((++pc)->op)]
+
+  DISPATCH();
+
+op_mov:
+  RA = RB;
+  NEXT();
+op_loadk:
+  RA = k[pc->bx()];
+  NEXT();
+op_gload:
+  RA = g[pc->bx()];
+  NEXT();
+op_aload: {
+  const Array& array = fn->arrays[pc->b];
+  uint64_t     bits  = 0;
+
+  if ((address = element(e, a, array, RC.u64_value)) == nullptr)
+    goto out_of_bounds;
+
+  std::memcpy(&bits, address, type_size(array.type));
+  RA.u64_value = normalize_constant(array.type, bits);
+  NEXT();
+}
+op_astore: {
+  const Array& array = fn->arrays[pc->b];
+
+  if ((address = element(e, a, array, RC.u64_value)) == nullptr)
+    goto out_of_bounds;
+
+  // Little endian: the low bytes of the canonical value are the element.
+  std::memcpy(address, &RA, type_size(array.type));
+  NEXT();
+}
+op_gstore:
+  g[pc->bx()] = RA;
+  NEXT();
+
+op_add_i32:
+  RA.u64_value = sext32(RB.u64_value + RC.u64_value);
+  NEXT();
+op_add_u32:
+  RA.u64_value = zext32(RB.u64_value + RC.u64_value);
+  NEXT();
+op_add_x64:
+  RA.u64_value = RB.u64_value + RC.u64_value;
+  NEXT();
+op_add_f32:
+  RA = from_f32(RB.f32_value + RC.f32_value);
+  NEXT();
+op_add_f64:
+  RA = from_f64(RB.f64_value + RC.f64_value);
+  NEXT();
+
+op_sub_i32:
+  RA.u64_value = sext32(RB.u64_value - RC.u64_value);
+  NEXT();
+op_sub_u32:
+  RA.u64_value = zext32(RB.u64_value - RC.u64_value);
+  NEXT();
+op_sub_x64:
+  RA.u64_value = RB.u64_value - RC.u64_value;
+  NEXT();
+op_sub_f32:
+  RA = from_f32(RB.f32_value - RC.f32_value);
+  NEXT();
+op_sub_f64:
+  RA = from_f64(RB.f64_value - RC.f64_value);
+  NEXT();
+
+op_mul_i32:
+  RA.u64_value = sext32(RB.u64_value * RC.u64_value);
+  NEXT();
+op_mul_u32:
+  RA.u64_value = zext32(RB.u64_value * RC.u64_value);
+  NEXT();
+op_mul_x64:
+  RA.u64_value = RB.u64_value * RC.u64_value;
+  NEXT();
+op_mul_f32:
+  RA = from_f32(RB.f32_value * RC.f32_value);
+  NEXT();
+op_mul_f64:
+  RA = from_f64(RB.f64_value * RC.f64_value);
+  NEXT();
+
+  // 32 bit operands are extended to 64 bits, where INT32_MIN / -1 does not
+  // overflow; narrowing the result wraps it like the 64 bit case below.
+op_div_i32:
+  if (RC.u64_value == 0)
+    goto division_by_zero;
+  RA.u64_value = sext32(static_cast<uint64_t>(RB.i64_value / RC.i64_value));
+  NEXT();
+op_div_u32:
+op_div_u64:
+  if (RC.u64_value == 0)
+    goto division_by_zero;
+  RA.u64_value = RB.u64_value / RC.u64_value;
+  NEXT();
+op_div_i64:
+  if (RC.u64_value == 0)
+    goto division_by_zero;
+  if (RC.i64_value == -1)
+    RA.u64_value = 0 - RB.u64_value;
+  else
+    RA.i64_value = RB.i64_value / RC.i64_value;
+  NEXT();
+op_div_f32:
+  RA = from_f32(RB.f32_value / RC.f32_value);
+  NEXT();
+op_div_f64:
+  RA = from_f64(RB.f64_value / RC.f64_value);
+  NEXT();
+
+op_mod_i32:
+  if (RC.u64_value == 0)
+    goto division_by_zero;
+  RA.i64_value = RB.i64_value % RC.i64_value;
+  NEXT();
+op_mod_u32:
+op_mod_u64:
+  if (RC.u64_value == 0)
+    goto division_by_zero;
+  RA.u64_value = RB.u64_value % RC.u64_value;
+  NEXT();
+op_mod_i64:
+  if (RC.u64_value == 0)
+    goto division_by_zero;
+  if (RC.i64_value == -1)
+    RA.u64_value = 0;
+  else
+    RA.i64_value = RB.i64_value % RC.i64_value;
+  NEXT();
+
+op_band:
+  RA.u64_value = RB.u64_value & RC.u64_value;
+  NEXT();
+op_bor:
+  RA.u64_value = RB.u64_value | RC.u64_value;
+  NEXT();
+op_bxor:
+  RA.u64_value = RB.u64_value ^ RC.u64_value;
+  NEXT();
+
+op_lt_s:
+  RA.u64_value = RB.i64_value < RC.i64_value;
+  NEXT();
+op_lt_u:
+  RA.u64_value = RB.u64_value < RC.u64_value;
+  NEXT();
+op_lt_f32:
+  RA.u64_value = RB.f32_value < RC.f32_value;
+  NEXT();
+op_lt_f64:
+  RA.u64_value = RB.f64_value < RC.f64_value;
+  NEXT();
+op_le_s:
+  RA.u64_value = RB.i64_value <= RC.i64_value;
+  NEXT();
+op_le_u:
+  RA.u64_value = RB.u64_value <= RC.u64_value;
+  NEXT();
+op_le_f32:
+  RA.u64_value = RB.f32_value <= RC.f32_value;
+  NEXT();
+op_le_f64:
+  RA.u64_value = RB.f64_value <= RC.f64_value;
+  NEXT();
+op_gt_s:
+  RA.u64_value = RB.i64_value > RC.i64_value;
+  NEXT();
+op_gt_u:
+  RA.u64_value = RB.u64_value > RC.u64_value;
+  NEXT();
+op_gt_f32:
+  RA.u64_value = RB.f32_value > RC.f32_value;
+  NEXT();
+op_gt_f64:
+  RA.u64_value = RB.f64_value > RC.f64_value;
+  NEXT();
+op_ge_s:
+  RA.u64_value = RB.i64_value >= RC.i64_value;
+  NEXT();
+op_ge_u:
+  RA.u64_value = RB.u64_value >= RC.u64_value;
+  NEXT();
+op_ge_f32:
+  RA.u64_value = RB.f32_value >= RC.f32_value;
+  NEXT();
+op_ge_f64:
+  RA.u64_value = RB.f64_value >= RC.f64_value;
+  NEXT();
+op_ne_x:
+  RA.u64_value = RB.u64_value != RC.u64_value;
+  NEXT();
+op_ne_f32:
+  RA.u64_value = RB.f32_value != RC.f32_value;
+  NEXT();
+op_ne_f64:
+  RA.u64_value = RB.f64_value != RC.f64_value;
+  NEXT();
+
+op_tst_x:
+  RA.u64_value = RB.u64_value != 0;
+  NEXT();
+op_tst_f32:
+  RA.u64_value = RB.f32_value != 0;
+  NEXT();
+op_tst_f64:
+  RA.u64_value = RB.f64_value != 0;
+  NEXT();
+
+op_norm_i8:
+  RA.i64_value = static_cast<int8_t>(RB.u64_value);
+  NEXT();
+op_norm_i16:
+  RA.i64_value = static_cast<int16_t>(RB.u64_value);
+  NEXT();
+op_norm_i32:
+  RA.i64_value = static_cast<int32_t>(RB.u64_value);
+  NEXT();
+op_norm_u8:
+  RA.u64_value = static_cast<uint8_t>(RB.u64_value);
+  NEXT();
+op_norm_u16:
+  RA.u64_value = static_cast<uint16_t>(RB.u64_value);
+  NEXT();
+op_norm_u32:
+  RA.u64_value = static_cast<uint32_t>(RB.u64_value);
+  NEXT();
+
+op_s2f32:
+  RA = from_f32(static_cast<float>(RB.i64_value));
+  NEXT();
+op_s2f64:
+  RA = from_f64(static_cast<double>(RB.i64_value));
+  NEXT();
+op_u2f32:
+  RA = from_f32(static_cast<float>(RB.u64_value));
+  NEXT();
+op_u2f64:
+  RA = from_f64(static_cast<double>(RB.u64_value));
+  NEXT();
+op_f32_s:
+  RA.u64_value = to_i64(RB.f32_value);
+  NEXT();
+op_f64_s:
+  RA.u64_value = to_i64(RB.f64_value);
+  NEXT();
+op_f32_u:
+  RA.u64_value = to_u64(RB.f32_value);
+  NEXT();
+op_f64_u:
+  RA.u64_value = to_u64(RB.f64_value);
+  NEXT();
+op_f32_f64:
+  RA = from_f64(RB.f32_value);
+  NEXT();
+op_f64_f32:
+  RA = from_f32(static_cast<float>(RB.f64_value));
+  NEXT();
+
+op_addk_i32:
+  RA.u64_value = sext32(RB.u64_value + k[pc->c].u64_value);
+  NEXT();
+op_addk_x64:
+  RA.u64_value = RB.u64_value + k[pc->c].u64_value;
+  NEXT();
+op_subk_i32:
+  RA.u64_value = sext32(RB.u64_value - k[pc->c].u64_value);
+  NEXT();
+op_subk_x64:
+  RA.u64_value = RB.u64_value - k[pc->c].u64_value;
+  NEXT();
+
+op_gadd_i32:
+  g[pc->b].u64_value = sext32(g[pc->b].u64_value + RC.u64_value);
+  RA = g[pc->b];
+  NEXT();
+op_gadd_u32:
+  g[pc->b].u64_value = zext32(g[pc->b].u64_value + RC.u64_value);
+  RA = g[pc->b];
+  NEXT();
+op_gadd_x64:
+  g[pc->b].u64_value += RC.u64_value;
+  RA = g[pc->b];
+  NEXT();
+op_gadd_f32:
+  g[pc->b] = from_f32(g[pc->b].f32_value + RC.f32_value);
+  RA       = g[pc->b];
+  NEXT();
+op_gadd_f64:
+  g[pc->b].f64_value += RC.f64_value;
+  RA = g[pc->b];
+  NEXT();
+
+op_jmp:
+  pc += pc->sbx();
+  NEXT();
+op_jz:
+  if (RA.u64_value == 0)
+    pc += pc->sbx();
+  NEXT();
+op_jnz:
+  if (RA.u64_value != 0)
+    pc += pc->sbx();
+  NEXT();
+
+op_call:
+  if (call_native(pc->bx(), &RA, RA))
+    NEXT();
+
+  frames.push_back(Frame{ fn, pc, regs, a });
+  a += fn->array_words;
+  fn   = &program.functions[pc->bx()];
+  regs = &RA;
+  k    = fn->constants.data();
+  pc   = fn->code.data();
+
+  if (regs + fn->num_regs > stack_end || a + fn->array_words > arrays_end)
+    goto stack_overflow;
+
+  std::fill(a, a + fn->array_words, VarValue{ 0 });
+
+  DISPATCH();
+
+op_ret:
+  regs[0] = RA;
+op_ret_void:
+  if (frames.empty()) {
+    result = regs[0];
+    return true;
+  }
+
+  fn   = frames.back().fn;
+  pc   = frames.back().pc;
+  regs = frames.back().regs;
+  a    = frames.back().arrays;
+  k    = fn->constants.data();
+  frames.pop_back();
+  NEXT();
+
+#undef NEXT
+#undef DISPATCH
+#undef RC
+#undef RB
+#undef RA
+
+division_by_zero:
+  spdlog::error("{}: division by zero", fn->name);
+  return false;
+
+out_of_bounds:
+  spdlog::error("{}: array index {} out of bounds",
+                fn->name,
+                regs[pc->c].i64_value);
+  return false;
+
+stack_overflow:
+  spdlog::error("{}: stack overflow", fn->name);
+  return false;
+}
+
+} // namespace wcc::vm
@@ -0,0 +1,1310 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <optional>
+
+#include <spdlog/spdlog.h>
+
+#include "queries.h"
+#include "resolve.h"
+#include "typecheck.h"
+#include "util.h"
+
+namespace wcc::vm {
+
+// Destination register of an expression that may go anywhere.
+constexpr int ANY = -1;
+
+constexpr uint32_t MAX_REGS = 256;
+
+struct CompileContext
+{
+  const AnalyzedFile&              file;
+  const std::vector<StructLayout>& layouts;
+  const Program&                   program;
+  Function&                        fn;
+  const std::vector<uint32_t>&     element_offset; // per local array symbol
+
+  // Registers below this hold parameters and locals.
+  uint32_t num_vars;
+
+  // First free temporary. Temporaries are allocated like a stack: an
+  // expression leaves its result at the top and everything above it free.
+  uint32_t next_reg;
+
+  bool ok;
+};
+
+// Words of memory taking `length` elements of `type`.
+static uint32_t
+array_words(LangType type, uint32_t length)
+{
+  return static_cast<uint32_t>((uint64_t(length) * type_size(type) + 7) / 8);
+}
+
+// Words of memory of a variable: the elements of an array or the fields of
+// a structure, none for a scalar.
+static uint32_t
+variable_words(const AnalyzedFile&              file,
+               const std::vector<StructLayout>& layouts,
+               LangType                         type,
+               uint32_t                         length,
+               SymbolIndex                      structure)
+{
+  if (structure == INVALID_SYMBOL)
+    return array_words(type, length);
+
+  const StructLayout& layout = layouts[file.symbols[structure].slot];
+  return array_words(storage_type(layout), storage_length(layout, length));
+}
+
+// Opcode tables are indexed by the width class of the operand type.
+enum class WidthClass : uint8_t
+{
+  i32,
+  u32,
+  i64,
+  u64,
+  f32,
+  f64,
+};
+
+constexpr Op ADD_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::add_i32,
+  [underlay_cast(WidthClass::u32)] = Op::add_u32,
+  [underlay_cast(WidthClass::i64)] = Op::add_x64,
+  [underlay_cast(WidthClass::u64)] = Op::add_x64,
+  [underlay_cast(WidthClass::f32)] = Op::add_f32,
+  [underlay_cast(WidthClass::f64)] = Op::add_f64,
+};
+
+constexpr Op SUB_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::sub_i32,
+  [underlay_cast(WidthClass::u32)] = Op::sub_u32,
+  [underlay_cast(WidthClass::i64)] = Op::sub_x64,
+  [underlay_cast(WidthClass::u64)] = Op::sub_x64,
+  [underlay_cast(WidthClass::f32)] = Op::sub_f32,
+  [underlay_cast(WidthClass::f64)] = Op::sub_f64,
+};
+
+constexpr Op MUL_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::mul_i32,
+  [underlay_cast(WidthClass::u32)] = Op::mul_u32,
+  [underlay_cast(WidthClass::i64)] = Op::mul_x64,
+  [underlay_cast(WidthClass::u64)] = Op::mul_x64,
+  [underlay_cast(WidthClass::f32)] = Op::mul_f32,
+  [underlay_cast(WidthClass::f64)] = Op::mul_f64,
+};
+
+constexpr Op DIV_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::div_i32,
+  [underlay_cast(WidthClass::u32)] = Op::div_u32,
+  [underlay_cast(WidthClass::i64)] = Op::div_i64,
+  [underlay_cast(WidthClass::u64)] = Op::div_u64,
+  [underlay_cast(WidthClass::f32)] = Op::div_f32,
+  [underlay_cast(WidthClass::f64)] = Op::div_f64,
+};
+
+// Floats have no remainder, the type checker rejects them.
+constexpr Op MOD_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::mod_i32,
+  [underlay_cast(WidthClass::u32)] = Op::mod_u32,
+  [underlay_cast(WidthClass::i64)] = Op::mod_i64,
+  [underlay_cast(WidthClass::u64)] = Op::mod_u64,
+};
+
+constexpr Op LT_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::lt_s,
+  [underlay_cast(WidthClass::u32)] = Op::lt_u,
+  [underlay_cast(WidthClass::i64)] = Op::lt_s,
+  [underlay_cast(WidthClass::u64)] = Op::lt_u,
+  [underlay_cast(WidthClass::f32)] = Op::lt_f32,
+  [underlay_cast(WidthClass::f64)] = Op::lt_f64,
+};
+
+constexpr Op LE_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::le_s,
+  [underlay_cast(WidthClass::u32)] = Op::le_u,
+  [underlay_cast(WidthClass::i64)] = Op::le_s,
+  [underlay_cast(WidthClass::u64)] = Op::le_u,
+  [underlay_cast(WidthClass::f32)] = Op::le_f32,
+  [underlay_cast(WidthClass::f64)] = Op::le_f64,
+};
+
+constexpr Op GT_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::gt_s,
+  [underlay_cast(WidthClass::u32)] = Op::gt_u,
+  [underlay_cast(WidthClass::i64)] = Op::gt_s,
+  [underlay_cast(WidthClass::u64)] = Op::gt_u,
+  [underlay_cast(WidthClass::f32)] = Op::gt_f32,
+  [underlay_cast(WidthClass::f64)] = Op::gt_f64,
+};
+
+constexpr Op GE_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::ge_s,
+  [underlay_cast(WidthClass::u32)] = Op::ge_u,
+  [underlay_cast(WidthClass::i64)] = Op::ge_s,
+  [underlay_cast(WidthClass::u64)] = Op::ge_u,
+  [underlay_cast(WidthClass::f32)] = Op::ge_f32,
+  [underlay_cast(WidthClass::f64)] = Op::ge_f64,
+};
+
+constexpr Op NE_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::ne_x,
+  [underlay_cast(WidthClass::u32)] = Op::ne_x,
+  [underlay_cast(WidthClass::i64)] = Op::ne_x,
+  [underlay_cast(WidthClass::u64)] = Op::ne_x,
+  [underlay_cast(WidthClass::f32)] = Op::ne_f32,
+  [underlay_cast(WidthClass::f64)] = Op::ne_f64,
+};
+
+constexpr Op TST_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::tst_x,
+  [underlay_cast(WidthClass::u32)] = Op::tst_x,
+  [underlay_cast(WidthClass::i64)] = Op::tst_x,
+  [underlay_cast(WidthClass::u64)] = Op::tst_x,
+  [underlay_cast(WidthClass::f32)] = Op::tst_f32,
+  [underlay_cast(WidthClass::f64)] = Op::tst_f64,
+};
+
+// Load-add-store on a global, only for types that need no narrowing.
+constexpr Op GADD_OP[] = {
+  [underlay_cast(WidthClass::i32)] = Op::gadd_i32,
+  [underlay_cast(WidthClass::u32)] = Op::gadd_u32,
+  [underlay_cast(WidthClass::i64)] = Op::gadd_x64,
+  [underlay_cast(WidthClass::u64)] = Op::gadd_x64,
+  [underlay_cast(WidthClass::f32)] = Op::gadd_f32,
+  [underlay_cast(WidthClass::f64)] = Op::gadd_f64,
+};
+
+static WidthClass
+width_class(LangType type)
+{
+  switch (type) {
+    case LangType::lt_i8:
+    case LangType::lt_i16:
+    case LangType::lt_i32:
+      return WidthClass::i32;
+    case LangType::lt_u8:
+    case LangType::lt_u16:
+    case LangType::lt_u32:
+      return WidthClass::u32;
+    case LangType::lt_i64:
+      return WidthClass::i64;
+    case LangType::lt_u64:
+      return WidthClass::u64;
+    case LangType::lt_f32:
+      return WidthClass::f32;
+    case LangType::lt_f64:
+      return WidthClass::f64;
+    default:
+      panic("Internal error: no bytecode for values of type void");
+  }
+}
+
+// Opcode bringing a value back to the canonical form of an integer type
+// narrower than 64 bits.
+static std::optional<Op>
+norm_op(LangType type)
+{
+  switch (type) {
+    case LangType::lt_i8:
+      return Op::norm_i8;
+    case LangType::lt_i16:
+      return Op::norm_i16;
+    case LangType::lt_i32:
+      return Op::norm_i32;
+    case LangType::lt_u8:
+      return Op::norm_u8;
+    case LangType::lt_u16:
+      return Op::norm_u16;
+    case LangType::lt_u32:
+      return Op::norm_u32;
+    default:
+      return std::nullopt;
+  }
+}
+
+static void
+emit(CompileContext& ctx, Op op, uint32_t a, uint32_t b = 0, uint32_t c = 0)
+{
+  ctx.fn.code.push_back(Instr{ op,
+                               static_cast<uint8_t>(a),
+                               static_cast<uint8_t>(b),
+                               static_cast<uint8_t>(c) });
+}
+
+static void
+emit_bx(CompileContext& ctx, Op op, uint32_t a, uint32_t bx)
+{
+  emit(ctx, op, a, bx & 0xFF, bx >> 8);
+}
+
+static void
+move(CompileContext& ctx, uint32_t dst, uint32_t src)
+{
+  if (dst != src)
+    emit(ctx, Op::mov, dst, src);
+}
+
+static uint32_t
+reserve(CompileContext& ctx, uint32_t count)
+{
+  const uint32_t first = ctx.next_reg;
+  ctx.next_reg += count;
+
+  if (ctx.next_reg > MAX_REGS && ctx.ok) {
+    spdlog::error("{}: needs more than {} registers", ctx.fn.name, MAX_REGS);
+    ctx.ok = false;
+  }
+
+  ctx.fn.num_regs = std::max(ctx.fn.num_regs, ctx.next_reg);
+  return first;
+}
+
+// The register an expression computes into: the requested one, or a fresh
+// temporary.
+static uint32_t
+dest(CompileContext& ctx, int target)
+{
+  return target == ANY ? reserve(ctx, 1) : static_cast<uint32_t>(target);
+}
+
+static uint32_t
+constant(CompileContext& ctx, VarValue value)
+{
+  auto& constants = ctx.fn.constants;
+
+  for (size_t i = 0; i < constants.size(); ++i) {
+    if (constants[i].u64_value == value.u64_value)
+      return static_cast<uint32_t>(i);
+  }
+
+  if (constants.size() > UINT16_MAX && ctx.ok) {
+    spdlog::error("{}: too many constants", ctx.fn.name);
+    ctx.ok = false;
+  }
+
+  constants.push_back(value);
+  return static_cast<uint32_t>(constants.size() - 1);
+}
+
+static uint32_t
+var_register(const CompileContext& ctx, SymbolIndex sym)
+{
+  const Symbol&  symbol = ctx.file.symbols[sym];
+  const uint32_t params = static_cast<uint32_t>(ctx.fn.params.size());
+
+  return symbol.kind == SymbolKind::param ? symbol.slot : params + symbol.slot;
+}
+
+static const Symbol*
+global_of(const CompileContext& ctx, const AstStmt& stmt)
+{
+  if (stmt.type != StmtType::varref)
+    return nullptr;
+
+  const Symbol& symbol =
+    ctx.file.symbols[std::get<AstSymRef>(stmt.value).symbol];
+
+  return symbol.kind == SymbolKind::global ? &symbol : nullptr;
+}
+
+static bool
+is_assignment(TOKENID id)
+{
+  return id == TOKENID::OP_EQ || id == TOKENID::OP_MULEQ ||
+         id == TOKENID::OP_DIVEQ || id == TOKENID::OP_ANDEQ ||
+         id == TOKENID::OP_OREQ;
+}
+
+static uint32_t
+add_array(CompileContext& ctx, const Array& array)
+{
+  auto& arrays = ctx.fn.arrays;
+
+  for (size_t i = 0; i < arrays.size(); ++i) {
+    if (arrays[i].global == array.global && arrays[i].offset == array.offset &&
+        arrays[i].disp == array.disp)
+      return static_cast<uint32_t>(i);
+  }
+
+  if (arrays.size() > UINT8_MAX && ctx.ok) {
+    spdlog::error("{}: refers to more than 256 arrays", ctx.fn.name);
+    ctx.ok = false;
+  }
+
+  arrays.push_back(array);
+  return static_cast<uint32_t>(arrays.size() - 1);
+}
+
+// Operand B of aload and astore for the array `sym`.
+static uint32_t
+array_operand(CompileContext& ctx, SymbolIndex sym)
+{
+  const Symbol& symbol = ctx.file.symbols[sym];
+
+  if (symbol.kind == SymbolKind::global)
+    return add_array(ctx, ctx.program.global_arrays[symbol.slot]);
+
+  return add_array(ctx,
+                   Array{ .type   = symbol.type,
+                          .length = symbol.length,
+                          .offset = ctx.element_offset[sym],
+                          .global = false,
+                          .stride = type_size(symbol.type) });
+}
+
+// Operand B of aload and astore for a field, an array of its elements in
+// the memory of the structure variable.
+static uint32_t
+field_operand(CompileContext& ctx, const AstField& field)
+{
+  const SymbolIndex   sym       = field.object.symbol;
+  const Symbol&       symbol    = ctx.file.symbols[sym];
+  const Symbol&       structure = ctx.file.symbols[symbol.structure];
+  const StructLayout& layout    = ctx.layouts[structure.slot];
+  const auto&         str = std::get<AstStruct>(structure.node->value);
+  const bool          global = symbol.kind == SymbolKind::global;
+
+  return add_array(
+    ctx,
+    Array{ .type   = str.fields[field.number].type,
+           .length = std::max<uint32_t>(symbol.length, 1),
+           .offset = global ? ctx.program.global_arrays[symbol.slot].offset
+                            : ctx.element_offset[sym],
+           .global = global,
+           .stride = layout.size,
+           .disp   = layout.offsets[field.number] });
+}
+
+// True if evaluating the expression may store to a local or parameter.
+static bool
+assigns(const AstStmt& stmt)
+{
+  if (stmt.type == StmtType::conv)
+    return assigns(std::get<AstConversion>(stmt.value).operand[0]);
+
+  if (stmt.type == StmtType::index)
+    return assigns(std::get<AstIndex>(stmt.value).index[0]);
+
+  if (stmt.type == StmtType::field) {
+    const auto& index = std::get<AstField>(stmt.value).index;
+    return !index.empty() && assigns(index[0]);
+  }
+
+  if (stmt.type != StmtType::call)
+    return false;
+
+  const AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+
+  if (call.symbol == INVALID_SYMBOL && is_assignment(call.from_token.id))
+    return true;
+
+  return std::any_of(call.args.begin(), call.args.end(), assigns);
+}
+
+static uint32_t
+compile_expr(CompileContext& ctx, const AstStmt& stmt, int target);
+
+// Evaluates the left operand of a binary operator. A variable is read in
+// place unless the right operand assigns to variables, then its current
+// value is saved first.
+static uint32_t
+compile_lhs(CompileContext& ctx, const AstStmt& lhs, const AstStmt& rhs)
+{
+  const uint32_t reg = compile_expr(ctx, lhs, ANY);
+
+  if (reg >= ctx.num_vars || !assigns(rhs))
+    return reg;
+
+  const uint32_t copy = reserve(ctx, 1);
+  move(ctx, copy, reg);
+  return copy;
+}
+
+// Emits `op dst, lhs, rhs` followed by the narrowing a type below 32 bits
+// needs.
+static void
+emit_arith(CompileContext& ctx,
+           Op              op,
+           LangType        type,
+           uint32_t        dst,
+           uint32_t        lhs,
+           uint32_t        rhs)
+{
+  emit(ctx, op, dst, lhs, rhs);
+
+  if (type_size(type) < 4)
+    emit(ctx, *norm_op(type), dst, dst);
+}
+
+static Op
+arith_op(TOKENID id, LangType type)
+{
+  const auto cls = underlay_cast(width_class(type));
+
+  switch (ir::operator_opcode(id)) {
+    case ir::Opcode::add:
+      return ADD_OP[cls];
+    case ir::Opcode::sub:
+      return SUB_OP[cls];
+    case ir::Opcode::mul:
+      return MUL_OP[cls];
+    case ir::Opcode::div:
+      return DIV_OP[cls];
+    case ir::Opcode::mod:
+      return MOD_OP[cls];
+    case ir::Opcode::bit_and:
+      return Op::band;
+    case ir::Opcode::bit_or:
+      return Op::bor;
+    case ir::Opcode::bit_xor:
+      return Op::bxor;
+    case ir::Opcode::cmp_lt:
+      return LT_OP[cls];
+    case ir::Opcode::cmp_le:
+      return LE_OP[cls];
+    case ir::Opcode::cmp_gt:
+      return GT_OP[cls];
+    case ir::Opcode::cmp_ge:
+      return GE_OP[cls];
+    case ir::Opcode::cmp_ne:
+      return NE_OP[cls];
+    default:
+      panic("Internal error: operator without a bytecode opcode");
+  }
+}
+
+// `x + k` and `x - k` with a constant operand of i32 or 64 bit type: a
+// single addk/subk reading the constant straight from the pool.
+static bool
+compile_constant_add(CompileContext&        ctx,
+                     const AstFunctionCall& call,
+                     LangType               type,
+                     int                    target,
+                     uint32_t&              result)
+{
+  const TOKENID id = call.from_token.id;
+
+  if (id != TOKENID::OP_PLUS && id != TOKENID::OP_MINUS)
+    return false;
+
+  const bool wide = type_size(type) == 8 && is_integer(type);
+
+  if (type != LangType::lt_i32 && !wide)
+    return false;
+
+  // Addition commutes, the constant may come first.
+  size_t k = 1;
+
+  if (call.args[1].type != StmtType::literal) {
+    if (id != TOKENID::OP_PLUS || call.args[0].type != StmtType::literal)
+      return false;
+
+    k = 0;
+  }
+
+  const AstLiteral& literal = std::get<AstLiteral>(call.args[k].value);
+  const uint32_t    index   = constant(ctx, literal.value);
+
+  if (index > UINT8_MAX)
+    return false;
+
+  const uint32_t mark  = ctx.next_reg;
+  const uint32_t other = compile_expr(ctx, call.args[1 - k], ANY);
+
+  ctx.next_reg = mark;
+  result       = dest(ctx, target);
+
+  const Op op = id == TOKENID::OP_PLUS ? (wide ? Op::addk_x64 : Op::addk_i32)
+                                       : (wide ? Op::subk_x64 : Op::subk_i32);
+
+  emit(ctx, op, result, other, index);
+  return true;
+}
+
+// Stores `value` to the variable `target` refers to.
+static void
+store_to(CompileContext& ctx, const AstStmt& target, uint32_t value)
+{
+  if (const Symbol* global = global_of(ctx, target)) {
+    emit_bx(ctx, Op::gstore, value, global->slot);
+    return;
+  }
+
+  const SymbolIndex sym = std::get<AstSymRef>(target.value).symbol;
+  move(ctx, var_register(ctx, sym), value);
+}
+
+// `g = g + x` (or `g = x + g`) as one gadd.
+static bool
+compile_global_add(CompileContext&        ctx,
+                   const AstFunctionCall& assign,
+                   int                    target,
+                   uint32_t&              result)
+{
+  const Symbol*  global = global_of(ctx, assign.args[0]);
+  const AstStmt& value  = assign.args[1];
+
+  if (global == nullptr || global->slot > UINT8_MAX ||
+      type_size(global->type) < 4 || value.type != StmtType::call)
+    return false;
+
+  const AstFunctionCall& add = std::get<AstFunctionCall>(value.value);
+
+  if (add.symbol != INVALID_SYMBOL || add.from_token.id != TOKENID::OP_PLUS)
+    return false;
+
+  size_t other;
+
+  if (global_of(ctx, add.args[0]) == global)
+    other = 1;
+  else if (global_of(ctx, add.args[1]) == global)
+    other = 0;
+  else
+    return false;
+
+  const uint32_t mark = ctx.next_reg;
+  const uint32_t rhs  = compile_expr(ctx, add.args[other], ANY);
+
+  ctx.next_reg = mark;
+  result       = dest(ctx, target);
+
+  emit(ctx,
+       GADD_OP[underlay_cast(width_class(global->type))],
+       result,
+       global->slot,
+       rhs);
+  return true;
+}
+
+static uint32_t
+compile_assign(CompileContext& ctx, const AstStmt& stmt, int target)
+{
+  const AstFunctionCall& call   = std::get<AstFunctionCall>(stmt.value);
+  const AstStmt&         lhs    = call.args[0];
+  const Symbol*          global = global_of(ctx, lhs);
+  uint32_t               result;
+
+  if (compile_global_add(ctx, call, target, result))
+    return result;
+
+  // A local is the destination of the value itself, `x = a + b` is a
+  // single add.
+  if (global == nullptr) {
+    const uint32_t var =
+      var_register(ctx, std::get<AstSymRef>(lhs.value).symbol);
+
+    compile_expr(ctx, call.args[1], var);
+
+    if (target == ANY)
+      return var;
+
+    move(ctx, target, var);
+    return target;
+  }
+
+  result = compile_expr(ctx, call.args[1], target);
+  store_to(ctx, lhs, result);
+  return result;
+}
+
+static uint32_t
+compile_compound(CompileContext& ctx, const AstStmt& stmt, int target)
+{
+  const AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+  const LangType         type = ctx.file.types[stmt];
+  const uint32_t         mark = ctx.next_reg;
+
+  uint32_t lhs;
+
+  if (global_of(ctx, call.args[0]) != nullptr) {
+    lhs = reserve(ctx, 1);
+    compile_expr(ctx, call.args[0], lhs);
+  } else {
+    lhs = compile_lhs(ctx, call.args[0], call.args[1]);
+  }
+
+  const uint32_t rhs = compile_expr(ctx, call.args[1], ANY);
+
+  // Computing into the variable itself needs no separate store.
+  uint32_t value = lhs;
+
+  if (global_of(ctx, call.args[0]) == nullptr)
+    value = var_register(ctx, std::get<AstSymRef>(call.args[0].value).symbol);
+
+  emit_arith(ctx, arith_op(call.from_token.id, type), type, value, lhs, rhs);
+  store_to(ctx, call.args[0], value);
+
+  ctx.next_reg = mark;
+
+  if (target == ANY) {
+    if (value < ctx.num_vars)
+      return value;
+
+    const uint32_t result = reserve(ctx, 1);
+    move(ctx, result, value);
+    return result;
+  }
+
+  move(ctx, static_cast<uint32_t>(target), value);
+  return static_cast<uint32_t>(target);
+}
+
+// Register holding the element index of a field: the index of an element
+// of an array of structures, evaluated like the left operand of `rhs` if
+// the field is assigned, or 0 for a scalar structure.
+static uint32_t
+compile_field_index(CompileContext& ctx,
+                    const AstField& field,
+                    const AstStmt*  rhs)
+{
+  if (field.index.empty()) {
+    const uint32_t reg = reserve(ctx, 1);
+    emit_bx(ctx, Op::loadk, reg, constant(ctx, VarValue{ 0 }));
+    return reg;
+  }
+
+  if (rhs != nullptr)
+    return compile_lhs(ctx, field.index[0], *rhs);
+
+  return compile_expr(ctx, field.index[0], ANY);
+}
+
+// `a[i] = x`, `a[i] op= x` and the same on fields. The index is evaluated
+// first, a compound assignment then loads the element before evaluating
+// `x`.
+static uint32_t
+compile_element_assign(CompileContext& ctx, const AstStmt& stmt, int target)
+{
+  const AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+  const AstStmt&         lhs  = call.args[0];
+  const LangType         type = ctx.file.types[stmt];
+  const uint32_t         mark = ctx.next_reg;
+
+  uint32_t array, reg;
+
+  if (lhs.type == StmtType::index) {
+    const AstIndex& index = std::get<AstIndex>(lhs.value);
+
+    array = array_operand(ctx, index.array.symbol);
+    reg   = compile_lhs(ctx, index.index[0], call.args[1]);
+  } else {
+    const AstField& field = std::get<AstField>(lhs.value);
+
+    array = field_operand(ctx, field);
+    reg   = compile_field_index(ctx, field, &call.args[1]);
+  }
+
+  uint32_t value;
+
+  if (call.from_token.id == TOKENID::OP_EQ) {
+    value = compile_expr(ctx, call.args[1], ANY);
+  } else {
+    value = reserve(ctx, 1);
+    emit(ctx, Op::aload, value, array, reg);
+
+    const uint32_t rhs = compile_expr(ctx, call.args[1], ANY);
+    const Op       op  = arith_op(call.from_token.id, type);
+
+    emit_arith(ctx, op, type, value, value, rhs);
+  }
+
+  emit(ctx, Op::astore, value, array, reg);
+  ctx.next_reg = mark;
+
+  if (target == ANY) {
+    if (value < ctx.num_vars)
+      return value;
+
+    const uint32_t result = reserve(ctx, 1);
+    move(ctx, result, value);
+    return result;
+  }
+
+  move(ctx, static_cast<uint32_t>(target), value);
+  return static_cast<uint32_t>(target);
+}
+
+// Emits a forward jump to be patched once its target is known.
+static size_t
+emit_jump(CompileContext& ctx, Op op, uint32_t cond)
+{
+  emit(ctx, op, cond);
+  return ctx.fn.code.size() - 1;
+}
+
+static void
+patch_jump(CompileContext& ctx, size_t jump)
+{
+  const size_t offset = ctx.fn.code.size() - (jump + 1);
+
+  if (offset > INT16_MAX && ctx.ok) {
+    spdlog::error("{}: jump out of range", ctx.fn.name);
+    ctx.ok = false;
+  }
+
+  Instr& instr = ctx.fn.code[jump];
+  instr.b      = static_cast<uint8_t>(offset);
+  instr.c      = static_cast<uint8_t>(offset >> 8);
+}
+
+// `a && b` / `a || b`:
+//
+//   tst  t, a
+//   jz   t, end      (|| jumps with jnz)
+//   tst  t, b
+//   end:
+//
+// The value is built in a temporary, writing a variable early would be seen
+// by `b`.
+static uint32_t
+compile_logic(CompileContext& ctx, const AstStmt& stmt, int target)
+{
+  const AstFunctionCall& call   = std::get<AstFunctionCall>(stmt.value);
+  const bool             is_and = call.from_token.id == TOKENID::OP_LOGIC_AND;
+
+  const uint32_t mark   = ctx.next_reg;
+  const uint32_t result = reserve(ctx, 1);
+
+  const auto test = [&](const AstStmt& operand) {
+    const uint32_t reg = compile_expr(ctx, operand, ANY);
+    const auto     cls = underlay_cast(width_class(ctx.file.types[operand]));
+
+    emit(ctx, TST_OP[cls], result, reg);
+    ctx.next_reg = result + 1;
+  };
+
+  test(call.args[0]);
+  const size_t jump = emit_jump(ctx, is_and ? Op::jz : Op::jnz, result);
+  test(call.args[1]);
+  patch_jump(ctx, jump);
+
+  if (target == ANY)
+    return result;
+
+  ctx.next_reg = mark;
+  move(ctx, static_cast<uint32_t>(target), result);
+  return static_cast<uint32_t>(target);
+}
+
+static uint32_t
+compile_operator(CompileContext& ctx, const AstStmt& stmt, int target)
+{
+  const AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+  const TOKENID          id   = call.from_token.id;
+
+  if (is_assignment(id) && (call.args[0].type == StmtType::index ||
+                            call.args[0].type == StmtType::field))
+    return compile_element_assign(ctx, stmt, target);
+
+  switch (id) {
+    case TOKENID::OP_EQ:
+      return compile_assign(ctx, stmt, target);
+
+    case TOKENID::OP_MULEQ:
+    case TOKENID::OP_DIVEQ:
+    case TOKENID::OP_ANDEQ:
+    case TOKENID::OP_OREQ:
+      return compile_compound(ctx, stmt, target);
+
+    case TOKENID::OP_LOGIC_AND:
+    case TOKENID::OP_LOGIC_OR:
+      return compile_logic(ctx, stmt, target);
+
+    default:
+      break;
+  }
+
+  // Comparisons yield i32, they dispatch on the type of their operands.
+  const ir::Opcode opcode = ir::operator_opcode(id);
+  const LangType   type   = ir::is_compare(opcode)
+                              ? ctx.file.types[call.args[0]]
+                              : ctx.file.types[stmt];
+
+  uint32_t result;
+
+  if (compile_constant_add(ctx, call, type, target, result))
+    return result;
+
+  const uint32_t mark = ctx.next_reg;
+  const uint32_t lhs = compile_lhs(ctx, call.args[0], call.args[1]);
+  const uint32_t rhs = compile_expr(ctx, call.args[1], ANY);
+
+  // Operands are read before the result is written, so the result may
+  // reuse their temporaries.
+  ctx.next_reg = mark;
+  result       = dest(ctx, target);
+
+  if (ir::is_compare(opcode))
+    emit(ctx, arith_op(id, type), result, lhs, rhs);
+  else
+    emit_arith(ctx, arith_op(id, type), type, result, lhs, rhs);
+
+  return result;
+}
+
+static Op
+int_to_float(bool sign, LangType to)
+{
+  if (to == LangType::lt_f32)
+    return sign ? Op::s2f32 : Op::u2f32;
+
+  return sign ? Op::s2f64 : Op::u2f64;
+}
+
+static Op
+float_to_int(bool sign, LangType from)
+{
+  if (from == LangType::lt_f32)
+    return sign ? Op::f32_s : Op::f32_u;
+
+  return sign ? Op::f64_s : Op::f64_u;
+}
+
+static void
+compile_conversion(CompileContext&      ctx,
+                   const AstConversion& conv,
+                   uint32_t             dst,
+                   uint32_t             src)
+{
+  const std::optional<Op> norm = norm_op(conv.to);
+
+  switch (conv.kind) {
+    case ConvKind::none:
+      move(ctx, dst, src);
+      return;
+
+    case ConvKind::sext:
+    case ConvKind::zext:
+    case ConvKind::trunc:
+      // Extensions keep the bits of a canonical value unless the signedness
+      // of a narrow target differs.
+      if (norm && (conv.kind == ConvKind::trunc ||
+                   is_signed(conv.from) != is_signed(conv.to)))
+        emit(ctx, *norm, dst, src);
+      else
+        move(ctx, dst, src);
+      return;
+
+    case ConvKind::sitofp:
+    case ConvKind::uitofp:
+      emit(ctx, int_to_float(conv.kind == ConvKind::sitofp, conv.to), dst, src);
+      return;
+
+    case ConvKind::fptosi:
+    case ConvKind::fptoui:
+      emit(ctx,
+           float_to_int(conv.kind == ConvKind::fptosi, conv.from),
+           dst,
+           src);
+
+      if (norm)
+        emit(ctx, *norm, dst, dst);
+      return;
+
+    case ConvKind::fpext:
+      emit(ctx, Op::f32_f64, dst, src);
+      return;
+
+    case ConvKind::fptrunc:
+      emit(ctx, Op::f64_f32, dst, src);
+      return;
+
+    case ConvKind::invalid:
+      break;
+  }
+
+  panic("Internal error: invalid conversion reached the bytecode compiler");
+}
+
+static uint32_t
+compile_call(CompileContext& ctx, const AstFunctionCall& call, int target)
+{
+  const uint32_t nargs = static_cast<uint32_t>(call.args.size());
+
+  // Arguments go to consecutive registers, which become the bottom of the
+  // callee's window. The result comes back in the first one.
+  const uint32_t base = reserve(ctx, std::max<uint32_t>(nargs, 1));
+
+  for (uint32_t i = 0; i < nargs; ++i) {
+    compile_expr(ctx, call.args[i], static_cast<int>(base + i));
+    ctx.next_reg = base + std::max<uint32_t>(nargs, 1);
+  }
+
+  emit_bx(ctx, Op::call, base, ctx.file.symbols[call.symbol].slot);
+  ctx.next_reg = base + 1;
+
+  if (target == ANY)
+    return base;
+
+  ctx.next_reg = base;
+  move(ctx, static_cast<uint32_t>(target), base);
+  return static_cast<uint32_t>(target);
+}
+
+static uint32_t
+compile_expr(CompileContext& ctx, const AstStmt& stmt, int target)
+{
+  switch (stmt.type) {
+    case StmtType::varref: {
+      const AstSymRef& ref    = std::get<AstSymRef>(stmt.value);
+      const Symbol&    symbol = ctx.file.symbols[ref.symbol];
+
+      if (symbol.kind == SymbolKind::global) {
+        const uint32_t dst = dest(ctx, target);
+        emit_bx(ctx, Op::gload, dst, symbol.slot);
+
+        // Native code sharing the globals (Machine::set_native) only stores
+        // the bytes of the type, the rest of the slot is stale.
+        if (symbol.type == LangType::lt_f32)
+          emit(ctx, Op::norm_u32, dst, dst);
+        else if (const std::optional<Op> norm = norm_op(symbol.type))
+          emit(ctx, *norm, dst, dst);
+
+        return dst;
+      }
+
+      const uint32_t var = var_register(ctx, ref.symbol);
+
+      if (target == ANY)
+        return var;
+
+      move(ctx, static_cast<uint32_t>(target), var);
+      return static_cast<uint32_t>(target);
+    }
+
+    case StmtType::conv: {
+      const AstConversion& conv = std::get<AstConversion>(stmt.value);
+      const uint32_t       mark = ctx.next_reg;
+      const uint32_t       src  = compile_expr(ctx, conv.operand[0], ANY);
+
+      ctx.next_reg       = mark;
+      const uint32_t dst = dest(ctx, target);
+
+      compile_conversion(ctx, conv, dst, src);
+      return dst;
+    }
+
+    case StmtType::call: {
+      const AstFunctionCall& call = std::get<AstFunctionCall>(stmt.value);
+
+      if (call.symbol == INVALID_SYMBOL)
+        return compile_operator(ctx, stmt, target);
+
+      return compile_call(ctx, call, target);
+    }
+
+    case StmtType::literal: {
+      const AstLiteral& literal = std::get<AstLiteral>(stmt.value);
+      const uint32_t    dst     = dest(ctx, target);
+
+      emit_bx(ctx, Op::loadk, dst, constant(ctx, literal.value));
+      return dst;
+    }
+
+    case StmtType::index: {
+      const AstIndex& index = std::get<AstIndex>(stmt.value);
+      const uint32_t  array = array_operand(ctx, index.array.symbol);
+      const uint32_t  mark  = ctx.next_reg;
+      const uint32_t  reg   = compile_expr(ctx, index.index[0], ANY);
+
+      ctx.next_reg       = mark;
+      const uint32_t dst = dest(ctx, target);
+
+      emit(ctx, Op::aload, dst, array, reg);
+      return dst;
+    }
+
+    case StmtType::field: {
+      const AstField& field = std::get<AstField>(stmt.value);
+      const uint32_t  array = field_operand(ctx, field);
+      const uint32_t  mark  = ctx.next_reg;
+      const uint32_t  reg   = compile_field_index(ctx, field, nullptr);
+
+      ctx.next_reg       = mark;
+      const uint32_t dst = dest(ctx, target);
+
+      emit(ctx, Op::aload, dst, array, reg);
+      return dst;
+    }
+
+    case StmtType::ret:
+      break;
+  }
+
+  panic("Internal error: unexpected statement in expression");
+}
+
+// Emits a jump back to `target`, the index of an instruction already
+// emitted.
+static void
+emit_loop_jump(CompileContext& ctx, size_t target)
+{
+  const auto offset = static_cast<int64_t>(target) -
+                      static_cast<int64_t>(ctx.fn.code.size() + 1);
+
+  if (offset < INT16_MIN && ctx.ok) {
+    spdlog::error("{}: jump out of range", ctx.fn.name);
+    ctx.ok = false;
+  }
+
+  emit_bx(ctx, Op::jmp, 0, static_cast<uint16_t>(offset));
+}
+
+static bool
+compile_block(CompileContext& ctx, const ASTNode& node);
+
+// Register that is zero when `cond` is false. Floats are tested, integers
+// are tested as they are.
+static uint32_t
+compile_condition(CompileContext& ctx, const AstStmt& cond)
+{
+  const LangType type = ctx.file.types[cond];
+
+  ctx.next_reg = ctx.num_vars;
+  uint32_t reg = compile_expr(ctx, cond, ANY);
+
+  if (is_float(type)) {
+    const uint32_t truth = reserve(ctx, 1);
+    emit(ctx, TST_OP[underlay_cast(width_class(type))], truth, reg);
+    reg = truth;
+  }
+
+  return reg;
+}
+
+// while (cond) body:
+//
+//   start: t = cond      (tst for floats, integers are tested as they are)
+//          jz   t, end
+//          body; step
+//          jmp  start
+//   end:
+static void
+compile_loop(CompileContext& ctx, const ASTNode& node)
+{
+  const AstLoop& loop  = std::get<AstLoop>(node.value);
+  const size_t   start = ctx.fn.code.size();
+  const uint32_t cond  = compile_condition(ctx, loop.cond);
+  const size_t   exit  = emit_jump(ctx, Op::jz, cond);
+
+  // A return ends the body, the rest of it is unreachable.
+  if (!compile_block(ctx, node)) {
+    if (loop.step.has_value()) {
+      ctx.next_reg = ctx.num_vars;
+      compile_expr(ctx, *loop.step, ANY);
+    }
+
+    emit_loop_jump(ctx, start);
+  }
+
+  patch_jump(ctx, exit);
+}
+
+// if (cond) then else other:
+//
+//   t = cond
+//   jz   t, else
+//   then
+//   jmp  end         (only after an else arm and if then did not return)
+//   else: other
+//   end:
+//
+// Returns true if both arms end with a return statement.
+static bool
+compile_branch(CompileContext& ctx, const ASTNode& node)
+{
+  const auto&  cond = std::get<AstBranch>(node.value).cond;
+  const size_t skip = emit_jump(ctx, Op::jz, compile_condition(ctx, cond));
+  const bool   then = compile_block(ctx, *node.nodes[0]);
+
+  if (node.nodes.size() == 1) {
+    patch_jump(ctx, skip);
+    return false;
+  }
+
+  const size_t end = then ? 0 : emit_jump(ctx, Op::jmp, 0);
+  patch_jump(ctx, skip);
+
+  const bool other = compile_block(ctx, *node.nodes[1]);
+
+  if (!then)
+    patch_jump(ctx, end);
+
+  return then && other;
+}
+
+// Compiles the statements, loops and branches among the children of `node`.
+// Returns true if they end with a return statement.
+static bool
+compile_block(CompileContext& ctx, const ASTNode& node)
+{
+  for (const auto& child : node.nodes) {
+    if (child->id == ASTID::loop) {
+      compile_loop(ctx, *child);
+      continue;
+    }
+
+    // Whatever follows a branch returning on both arms is unreachable.
+    if (child->id == ASTID::branch) {
+      if (compile_branch(ctx, *child))
+        return true;
+
+      continue;
+    }
+
+    if (child->id != ASTID::stmt)
+      continue;
+
+    const AstStmt& stmt = std::get<AstStmt>(child->value);
+    ctx.next_reg        = ctx.num_vars;
+
+    if (stmt.type != StmtType::ret) {
+      compile_expr(ctx, stmt, ANY);
+      continue;
+    }
+
+    if (child->nodes.empty()) {
+      emit(ctx, Op::ret_void, 0);
+    } else {
+      const auto&    value = std::get<AstStmt>(child->nodes[0]->value);
+      const uint32_t reg   = compile_expr(ctx, value, ANY);
+      emit(ctx, Op::ret, reg);
+    }
+
+    // Whatever follows is unreachable.
+    return true;
+  }
+
+  return false;
+}
+
+static Function
+compile_function(const AnalyzedFile&              file,
+                 const std::vector<StructLayout>& layouts,
+                 const Program&                   program,
+                 const ASTNode&                   node,
+                 const std::vector<uint32_t>&     element_offset,
+                 bool&                            ok)
+{
+  const AstFunction& astfunc = std::get<AstFunction>(node.value);
+
+  Function fn;
+  fn.name        = astfunc.name;
+  fn.return_type = astfunc.return_type;
+
+  for (const auto& arg : astfunc.args)
+    fn.params.push_back(arg.type);
+
+  const auto num_vars =
+    static_cast<uint32_t>(fn.params.size() + function_locals(node).size());
+
+  for (const ASTNode* local : function_locals(node)) {
+    const AstVariable& var = std::get<AstVariable>(local->value);
+    fn.array_words += variable_words(
+      file, layouts, var.type, var.length, var.structure.symbol);
+  }
+
+  CompileContext ctx{
+    file, layouts, program, fn, element_offset, num_vars, 0, true
+  };
+  reserve(ctx, num_vars);
+
+  const bool returned = compile_block(ctx, node);
+
+  // Falling off the end returns zero, like the native code does.
+  if (!returned) {
+    ctx.next_reg = num_vars;
+
+    if (fn.return_type == LangType::lt_void) {
+      emit(ctx, Op::ret_void, 0);
+    } else {
+      const uint32_t reg = reserve(ctx, 1);
+      emit_bx(ctx, Op::loadk, reg, constant(ctx, VarValue{ 0 }));
+      emit(ctx, Op::ret, reg);
+    }
+  }
+
+  ok = ok && ctx.ok;
+  return fn;
+}
+
+bool
+compile(const AnalyzedFile&              file,
+        const std::vector<StructLayout>& layouts,
+        Program&                         program)
+{
+  bool ok = true;
+
+  // Local arrays follow each other in the array area of the frame, in the
+  // order of their slots.
+  std::vector<uint32_t> element_offset(file.symbols.size());
+  std::vector<uint32_t> words;
+
+  for (size_t i = 0; i < file.symbols.size(); ++i) {
+    const Symbol& symbol = file.symbols[i];
+
+    const uint32_t size = variable_words(
+      file, layouts, symbol.type, symbol.length, symbol.structure);
+
+    if (symbol.kind != SymbolKind::local || size == 0)
+      continue;
+
+    const uint32_t function = file.symbols[symbol.owner].slot;
+
+    if (words.size() <= function)
+      words.resize(function + 1);
+
+    element_offset[i] = words[function];
+    words[function] += size;
+  }
+
+  for (const auto& node : file.ast->root.nodes) {
+    if (node->id != ASTID::vardecl)
+      continue;
+
+    const AstVariable& var = std::get<AstVariable>(node->value);
+    Array array{ .type   = var.type,
+                 .length = var.length,
+                 .offset = program.array_words,
+                 .global = true,
+                 .stride = type_size(var.type) };
+
+    // The memory of a structure, only ever accessed through its fields.
+    if (var.structure.symbol != INVALID_SYMBOL) {
+      const StructLayout& layout =
+        layouts[file.symbols[var.structure.symbol].slot];
+
+      array.type   = storage_type(layout);
+      array.length = storage_length(layout, var.length);
+      array.stride = type_size(array.type);
+    }
+
+    program.globals.push_back(var.type);
+    program.global_arrays.push_back(array);
+    program.array_words += array_words(array.type, array.length);
+  }
+
+  for (const auto& node : file.ast->root.nodes) {
+    if (node->id == ASTID::funcdecl)
+      program.functions.push_back(
+        compile_function(file, layouts, program, *node, element_offset, ok));
+  }
+
+  return ok;
+}
+
+int32_t
+Program::find(const SymbolName& name) const
+{
+  for (size_t i = 0; i < functions.size(); ++i) {
+    if (functions[i].name == name)
+      return static_cast<int32_t>(i);
+  }
+
+  return -1;
+}
+
+} // namespace wcc::vm
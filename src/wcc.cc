@@ -1,6 +1,12 @@
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
 #include <map>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <fmt/format.h>
 #include <spdlog/cfg/env.h>
 #include <spdlog/spdlog.h>
@@ -11,8 +17,15 @@
 #include "token_format.h"
 #include "tokenizer.h"
 #include "parser.h"
+#include "queries.h"
 
 #include "ast_format.h"
+#include "elf_writer.h"
+#include "ir_format.h"
+#include "jit.h"
+#include "tier.h"
+#include "writer.h"
+#include "x64.h"
 
 using namespace wcc;
 // using namespace wcc::regex;
@@ -21,7 +34,15 @@ using mipc::finbuf;
 
 void
 usage(int argc, char** argv)
-{}
+{
+  fmt::print(stderr,
+             "Usage: {} [--watch] [--emit-ir] "
+             "[-S | -c | --exe | --run | --tiered] "
+             "[-o <output>] [-ffp-contract=fast] [-mavx2] "
+             "[-freorder-fields] [--spill-stats] [--inline-report] "
+             "[--struct-report] <file>\n",
+             argv[0]);
+}
 
 // int
 // trie_main(int argc, char **argv)
@@ -42,25 +63,368 @@ usage(int argc, char** argv)
 //  return 0;
 //}
 
-AST ast;
+struct Options
+{
+  bool        watch         = false;
+  bool        emit_ir       = false;
+  bool        emit_asm      = false;
+  bool        emit_object   = false; // -c, relocatable ELF object
+  bool        emit_exe      = false; // --exe, static executable, no linker
+  bool        run           = false; // --run, compile in memory, call main
+  bool        tiered        = false; // --tiered, interpret, JIT hot functions
+  bool        fp_contract   = false; // -ffp-contract=fast, fuse a + b * c
+  bool        avx2          = false; // -mavx2, 32 byte vectors in ymm
+  bool        reorder       = false; // -freorder-fields, by alignment
+  bool        spill_stats   = false;
+  bool        inline_report = false;
+  bool        struct_report = false;
+  const char* input         = nullptr;
+  const char* output        = nullptr;
+};
+
+QueryDatabase db;
 
-int
-tokenizer_main(int argc, char** argv)
+static bool
+parse_options(int argc, char** argv, Options& opts)
 {
-  if (argc != 2) {
-    usage(argc, argv);
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--watch") == 0)
+      opts.watch = true;
+    else if (strcmp(argv[i], "--emit-ir") == 0)
+      opts.emit_ir = true;
+    else if (strcmp(argv[i], "-S") == 0)
+      opts.emit_asm = true;
+    else if (strcmp(argv[i], "-c") == 0)
+      opts.emit_object = true;
+    else if (strcmp(argv[i], "--exe") == 0)
+      opts.emit_exe = true;
+    else if (strcmp(argv[i], "--run") == 0)
+      opts.run = true;
+    else if (strcmp(argv[i], "--tiered") == 0)
+      opts.tiered = true;
+    else if (strcmp(argv[i], "-ffp-contract=fast") == 0)
+      opts.fp_contract = true;
+    else if (strcmp(argv[i], "-ffp-contract=off") == 0)
+      opts.fp_contract = false;
+    else if (strcmp(argv[i], "-mavx2") == 0)
+      opts.avx2 = true;
+    else if (strcmp(argv[i], "-mno-avx2") == 0)
+      opts.avx2 = false;
+    else if (strcmp(argv[i], "-freorder-fields") == 0)
+      opts.reorder = true;
+    else if (strcmp(argv[i], "-fno-reorder-fields") == 0)
+      opts.reorder = false;
+    else if (strcmp(argv[i], "--spill-stats") == 0)
+      opts.spill_stats = true;
+    else if (strcmp(argv[i], "--inline-report") == 0)
+      opts.inline_report = true;
+    else if (strcmp(argv[i], "--struct-report") == 0)
+      opts.struct_report = true;
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      opts.output = argv[++i];
+    else if (argv[i][0] == '-' || opts.input != nullptr)
+      return false;
+    else
+      opts.input = argv[i];
+  }
+
+  const int modes =
+    opts.emit_asm + opts.emit_object + opts.emit_exe + opts.run + opts.tiered;
+
+  if (modes > 1)
+    return false;
+
+  return opts.input != nullptr;
+}
+
+static void
+load_source(const Options& opts)
+{
+  finbuf f(opts.input);
+  db.set<SourceTextQuery>(opts.input, std::string(f.begin(), f.size()));
+  db.set<FieldOrderQuery>(opts.input,
+                          opts.reorder ? FieldOrder::by_alignment
+                                       : FieldOrder::declared);
+}
+
+static void
+print_query_stats()
+{
+  spdlog::info("Revision {}: {} queries executed, {} reused, {} backdated",
+               db.revision(),
+               db.stats.executed,
+               db.stats.reused,
+               db.stats.backdated);
+}
+
+static void
+print_spill_stats(const x64::MModule& code)
+{
+  for (const auto& fn : code.functions) {
+    const auto& stats = fn.stats;
+
+    spdlog::info("{}: {} intervals, {} spilled, {} split, {} reloads, {} "
+                 "stores, {} callee saved",
+                 fn.name,
+                 stats.intervals,
+                 stats.spilled,
+                 stats.split,
+                 stats.reloads,
+                 stats.stores,
+                 fn.saved.size());
+  }
+}
+
+static void
+print_inline_report(const ir::Module& module)
+{
+  for (const auto& decision : module.inline_report) {
+    spdlog::info("{}: call to {} {} (cost {})",
+                 decision.caller,
+                 decision.callee,
+                 ir::INLINE_VERDICT_STR[underlay_cast(decision.verdict)],
+                 decision.cost);
+  }
+}
+
+static void
+print_struct_report(const std::vector<StructLayout>& layouts)
+{
+  for (const auto& layout : layouts) {
+    spdlog::info("struct {}: {} bytes, aligned to {}, {} as declared, {} "
+                 "saved",
+                 layout.name,
+                 layout.size,
+                 layout.align,
+                 layout.declared_size,
+                 layout.declared_size - layout.size);
+  }
+}
+
+// Code written out is contracted and vectorized as asked, the target is
+// assumed to have FMA3 and AVX2. Code run in this process is dispatched on
+// the CPU, see jit::for_host.
+static x64::CompileOptions
+compile_options(const Options& opts)
+{
+  return x64::CompileOptions{ .fma = opts.fp_contract, .avx2 = opts.avx2 };
+}
+
+// Writes the module as assembly to the -o file, stdout by default.
+static bool
+emit_assembly(const Options& opts, const ir::Module& module)
+{
+  int fd = STDOUT_FILENO;
+
+  if (opts.output != nullptr) {
+    fd = open(opts.output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+      spdlog::error("Cannot open {}: {}", opts.output, strerror(errno));
+      return false;
+    }
+  }
+
+  const x64::MModule code =
+    x64::compile_module(module, compile_options(opts));
+
+  if (opts.spill_stats)
+    print_spill_stats(code);
+
+  bool ok;
+
+  {
+    BufferedWriter out(fd);
+    x64::emit_asm(code, out);
+    ok = out.flush();
+  }
+
+  if (fd != STDOUT_FILENO)
+    close(fd);
+
+  return ok;
+}
+
+// foo/bar.c -> bar.o, like cc -c.
+static std::string
+object_path(const char* input)
+{
+  std::string name = input;
+  name.erase(0, name.rfind('/') + 1);
+
+  const size_t dot = name.rfind('.');
+
+  if (dot != std::string::npos && dot != 0)
+    name.erase(dot);
+
+  return name + ".o";
+}
+
+// Encodes the module itself and writes an ELF object (-c) or a static
+// executable (--exe), no assembler or linker involved.
+static bool
+emit_binary(const Options& opts, const ir::Module& module)
+{
+  const x64::MModule code =
+    x64::compile_module(module, compile_options(opts));
+
+  if (opts.spill_stats)
+    print_spill_stats(code);
+
+  const x64::MachineCode machine = x64::encode_module(code);
+
+  if (opts.emit_exe) {
+    const char* path = opts.output != nullptr ? opts.output : "a.out";
+    return elf::write_executable(path, code, machine);
+  }
+
+  const std::string path =
+    opts.output != nullptr ? opts.output : object_path(opts.input);
+
+  return elf::write_object(path.c_str(), code, machine, opts.input);
+}
+
+static bool
+emit(const Options& opts)
+{
+  const auto& file = db.get<TypecheckQuery>(opts.input);
+
+  const bool codegen = opts.emit_asm || opts.emit_object || opts.emit_exe;
+
+  if (!opts.emit_ir && !codegen) {
+    print_ast(*file->ast);
+    return file->ok;
+  }
+
+  const auto& module = db.get<ModuleQuery>(opts.input);
+
+  if (module == nullptr)
+    return false;
+
+  if (opts.inline_report)
+    print_inline_report(*module);
+
+  if (opts.emit_asm)
+    return emit_assembly(opts, *module);
+
+  if (opts.emit_object || opts.emit_exe)
+    return emit_binary(opts, *module);
+
+  print_ir(*module);
+  return true;
+}
+
+// Compiles into memory and calls main, whose result becomes the exit status.
+static int
+run_main(const Options& opts)
+{
+  const auto& module = db.get<ModuleQuery>(opts.input);
+
+  if (module == nullptr)
+    return 1;
+
+  if (opts.inline_report)
+    print_inline_report(*module);
+
+  const x64::MModule code =
+    x64::compile_module(*module, jit::for_host(compile_options(opts)));
+
+  if (opts.spill_stats)
+    print_spill_stats(code);
+
+  const auto loaded = jit::JitModule::load(code, x64::encode_module(code));
+
+  if (loaded == nullptr)
+    return 1;
+
+  const auto entry = loaded->function<int (*)()>("main");
+
+  if (entry == nullptr) {
+    spdlog::error("{}: no main function", opts.input);
     return 1;
   }
 
-  finbuf    f(argv[1]);
-  Tokenizer tokenizer(f.begin(), f.size());
-  Parser    parser(tokenizer);
+  loaded->write_perf_map();
+  return entry();
+}
+
+// Calls main in the bytecode interpreter, hot functions move to native code
+// while it runs.
+static int
+run_tiered(const Options& opts)
+{
+  const auto& file   = db.get<TypecheckQuery>(opts.input);
+  const auto& module = db.get<ModuleQuery>(opts.input);
+
+  if (!file->ok || module == nullptr)
+    return 1;
+
+  if (opts.inline_report)
+    print_inline_report(*module);
+
+  const auto tiered =
+    tier::TieredModule::create(*file,
+                               db.get<LayoutQuery>(opts.input),
+                               module,
+                               tier::TieredModule::DEFAULT_THRESHOLD,
+                               compile_options(opts));
+  VarValue   result;
+
+  if (tiered == nullptr || !tiered->call("main", {}, result))
+    return 1;
+
+  return static_cast<int>(result.i64_value);
+}
+
+int
+tokenizer_main(const Options& opts)
+{
+  load_source(opts);
+
+  if (opts.struct_report)
+    print_struct_report(db.get<LayoutQuery>(opts.input));
+
+  if (opts.run)
+    return run_main(opts);
+
+  if (opts.tiered)
+    return run_tiered(opts);
 
   //Tokenizer::breakpoints.emplace_back(2);
 
-  ast = parser.buildAST();
+  return emit(opts) ? 0 : 1;
+}
+
+// Keeps the query database alive and recompiles whenever the file changes.
+// Only queries whose inputs actually changed are recomputed.
+int
+watch_main(const Options& opts)
+{
+  const char*     path       = opts.input;
+  struct timespec last_mtime = {};
+
+  while (1) {
+    struct stat st;
+
+    if (stat(path, &st) == 0 && (st.st_mtim.tv_sec != last_mtime.tv_sec ||
+                                 st.st_mtim.tv_nsec != last_mtime.tv_nsec)) {
+      last_mtime = st.st_mtim;
+
+      load_source(opts);
+
+      if (opts.struct_report)
+        print_struct_report(db.get<LayoutQuery>(path));
 
-  print_ast(ast);
+      emit(opts);
+
+      for (const auto& func : db.get<FunctionListQuery>(path))
+        db.get<SignatureQuery>({ path, func });
+
+      print_query_stats();
+    }
+
+    usleep(250 * 1000);
+  }
 
   return 0;
 }
@@ -69,7 +433,18 @@ int
 main(int argc, char** argv)
 {
   spdlog::cfg::load_env_levels();
-  return tokenizer_main(argc, argv);
+
+  Options opts;
+
+  if (!parse_options(argc, argv, opts)) {
+    usage(argc, argv);
+    return 1;
+  }
+
+  if (opts.watch)
+    return watch_main(opts);
+
+  return tokenizer_main(opts);
   // return trie_main(argc, argv);
   // nfa n;
   // n.append('a');
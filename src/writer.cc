@@ -0,0 +1,78 @@
+#include "writer.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+namespace wcc {
+
+BufferedWriter::BufferedWriter(int fd)
+  : fd(fd)
+{}
+
+BufferedWriter::~BufferedWriter()
+{
+  flush();
+}
+
+static bool
+write_all(int fd, const char* data, size_t size)
+{
+  while (size != 0) {
+    const ssize_t n = ::write(fd, data, size);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0) {
+      spdlog::error("Write failed: {}", strerror(errno));
+      return false;
+    }
+
+    data += n;
+    size -= static_cast<size_t>(n);
+  }
+
+  return true;
+}
+
+void
+BufferedWriter::write(const void* data, size_t size)
+{
+  const char* bytes = static_cast<const char*>(data);
+
+  if (size <= CAPACITY - used) {
+    memcpy(buffer + used, bytes, size);
+    used += size;
+    return;
+  }
+
+  flush();
+
+  if (size < CAPACITY) {
+    memcpy(buffer, bytes, size);
+    used = size;
+    return;
+  }
+
+  // Large blocks bypass the buffer.
+  failed |= !failed && !write_all(fd, bytes, size);
+  total += size;
+}
+
+bool
+BufferedWriter::flush()
+{
+  if (used != 0) {
+    failed |= !failed && !write_all(fd, buffer, used);
+    total += used;
+    used = 0;
+  }
+
+  return !failed;
+}
+
+} // namespace wcc
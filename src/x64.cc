@@ -0,0 +1,361 @@
+#include "typecheck.h"
+#include "x64.h"
+
+#include <algorithm>
+
+namespace wcc::x64 {
+
+uint8_t
+operand_use(const MInstr& instr, size_t i)
+{
+  switch (instr.op) {
+    case MOp::mov:
+    case MOp::movsx:
+    case MOp::movzx:
+    case MOp::lea:
+    case MOp::movs:
+    case MOp::movq:
+    case MOp::cvtsi2s:
+    case MOp::cvtts2si:
+    case MOp::cvts2s:
+    case MOp::movups:
+    case MOp::pextrd:
+    case MOp::pshufd:
+    case MOp::broadcast:
+    case MOp::load:
+      return i == 0 ? DEF : USE;
+
+    case MOp::setcc:
+    case MOp::pop:
+      return DEF;
+
+    case MOp::xor_:
+    case MOp::xorps:
+      // Zeroing idiom, the old value is not read.
+      if (instr.ops[0] == instr.ops[1])
+        return i == 0 ? DEF : 0;
+
+      return i == 0 ? USE | DEF : USE;
+
+    case MOp::add:
+    case MOp::sub:
+    case MOp::imul:
+    case MOp::and_:
+    case MOp::or_:
+    case MOp::shl:
+    case MOp::shr:
+    case MOp::sar:
+    case MOp::neg:
+    case MOp::cmov:
+    case MOp::adds:
+    case MOp::subs:
+    case MOp::muls:
+    case MOp::divs:
+    case MOp::addp:
+    case MOp::subp:
+    case MOp::mulp:
+    case MOp::divp:
+    case MOp::padd:
+    case MOp::psub:
+    case MOp::pmull:
+    case MOp::pand:
+    case MOp::por:
+    case MOp::pxor:
+    case MOp::insertps:
+    case MOp::movlhps:
+    case MOp::pinsrd:
+    case MOp::vfmadd231:
+    case MOp::vfmsub231:
+    case MOp::vfnmadd231:
+      return i == 0 ? USE | DEF : USE;
+
+    case MOp::cmp:
+    case MOp::test:
+    case MOp::ucomis:
+    case MOp::push:
+    case MOp::idiv:
+    case MOp::div:
+    case MOp::imulw:
+    case MOp::mulw:
+    case MOp::store:
+      return USE;
+
+    case MOp::cdq:
+    case MOp::rep_stos:
+    case MOp::ud2:
+    case MOp::jmp:
+    case MOp::jcc:
+    case MOp::call:
+    case MOp::tail_call:
+    case MOp::ret:
+      return 0;
+  }
+
+  return 0;
+}
+
+int64_t
+frame_offset(const MFunction& fn, const Operand& op)
+{
+  if (op.kind == OperandKind::arg)
+    return 16 + 8 * static_cast<int64_t>(op.value);
+
+  return -8 * static_cast<int64_t>(fn.saved.size() + op.value + 1) + op.imm;
+}
+
+uint32_t
+global_alignment(const MGlobal& global)
+{
+  uint32_t alignment = 1;
+
+  while (alignment < 16 && global.size % (alignment * 2) == 0)
+    alignment *= 2;
+
+  return alignment;
+}
+
+bool
+allocates_frame(const MFunction& fn)
+{
+  return fn.frame_size != 0 && !(fn.leaf && fn.frame_size <= RED_ZONE_SIZE);
+}
+
+void
+remove_fallthrough_jumps(MFunction& fn)
+{
+  for (size_t b = 0; b < fn.blocks.size(); ++b) {
+    auto&         instrs = fn.blocks[b].instrs;
+    const Operand next   = label(static_cast<uint32_t>(b + 1));
+
+    if (instrs.empty() || instrs.back().op != MOp::jmp)
+      continue;
+
+    if (instrs.back().ops[0] == next) {
+      instrs.pop_back();
+      continue;
+    }
+
+    // jcc next; jmp other -> j!cc other
+    const size_t n = instrs.size();
+
+    if (n >= 2 && instrs[n - 2].op == MOp::jcc && instrs[n - 2].ops[0] == next) {
+      instrs[n - 2].cond   = invert(instrs[n - 2].cond);
+      instrs[n - 2].ops[0] = instrs[n - 1].ops[0];
+      instrs.pop_back();
+    }
+  }
+}
+
+// Blocks only trapping, such as the target of failed bounds checks.
+static bool
+is_cold(const MBlock& block)
+{
+  return block.instrs.size() == 1 && block.instrs[0].op == MOp::ud2;
+}
+
+// Blocks of every natural loop: a back edge found by a depth first search
+// and the blocks reaching its source without passing its target.
+static std::vector<DenseBitset>
+find_machine_loops(const std::vector<std::vector<uint32_t>>& succs)
+{
+  const size_t                               n = succs.size();
+  std::vector<std::vector<uint32_t>>         preds(n);
+  std::vector<std::pair<uint32_t, uint32_t>> back_edges;
+
+  for (uint32_t b = 0; b < n; ++b) {
+    for (const uint32_t s : succs[b])
+      preds[s].push_back(b);
+  }
+
+  // 0: not visited, 1: on the stack, 2: done.
+  std::vector<uint8_t>                     state(n, 0);
+  std::vector<std::pair<uint32_t, size_t>> stack{ { 0, 0 } };
+  state[0] = 1;
+
+  while (!stack.empty()) {
+    auto& [b, next] = stack.back();
+
+    if (next == succs[b].size()) {
+      state[b] = 2;
+      stack.pop_back();
+      continue;
+    }
+
+    const uint32_t s = succs[b][next++];
+
+    if (state[s] == 1) {
+      back_edges.emplace_back(b, s);
+    } else if (state[s] == 0) {
+      state[s] = 1;
+      stack.emplace_back(s, 0);
+    }
+  }
+
+  std::vector<DenseBitset> loops;
+
+  for (const auto& [latch, header] : back_edges) {
+    DenseBitset           blocks(n);
+    std::vector<uint32_t> work{ latch };
+    blocks.set(header);
+
+    while (!work.empty()) {
+      const uint32_t b = work.back();
+      work.pop_back();
+
+      if (blocks.test(b))
+        continue;
+
+      blocks.set(b);
+      work.insert(work.end(), preds[b].begin(), preds[b].end());
+    }
+
+    loops.push_back(std::move(blocks));
+  }
+
+  return loops;
+}
+
+// Successor of a two way branch predicted to be taken, without a profile:
+// not into a trap, not out of a loop, not into a return, or else the one
+// that came first in the source.
+static uint32_t
+likely_successor(const MFunction&                fn,
+                 const std::vector<DenseBitset>& loops,
+                 uint32_t                        b,
+                 uint32_t                        s0,
+                 uint32_t                        s1)
+{
+  const auto exits = [&](uint32_t s) {
+    for (const DenseBitset& loop : loops) {
+      if (loop.test(b) && !loop.test(s))
+        return true;
+    }
+
+    return false;
+  };
+
+  const auto returns = [&](uint32_t s) {
+    const auto& instrs = fn.blocks[s].instrs;
+    return !instrs.empty() && (instrs.back().op == MOp::ret ||
+                               instrs.back().op == MOp::tail_call);
+  };
+
+  if (is_cold(fn.blocks[s0]) != is_cold(fn.blocks[s1]))
+    return is_cold(fn.blocks[s0]) ? s1 : s0;
+
+  if (exits(s0) != exits(s1))
+    return exits(s0) ? s1 : s0;
+
+  if (returns(s0) != returns(s1))
+    return returns(s0) ? s1 : s0;
+
+  return std::min(s0, s1);
+}
+
+void
+layout_blocks(MFunction& fn)
+{
+  const uint32_t n = static_cast<uint32_t>(fn.blocks.size());
+
+  // Blocks falling into the next one get an explicit jump, the next one
+  // may move.
+  for (uint32_t b = 0; b + 1 < n; ++b) {
+    auto& instrs = fn.blocks[b].instrs;
+
+    if (!instrs.empty() && (instrs.back().op == MOp::jmp ||
+                            instrs.back().op == MOp::ret ||
+                            instrs.back().op == MOp::tail_call ||
+                            instrs.back().op == MOp::ud2))
+      continue;
+
+    MInstr jump{ .op = MOp::jmp, .size = 8, .num_ops = 1 };
+    jump.ops[0] = label(b + 1);
+    instrs.push_back(jump);
+  }
+
+  std::vector<std::vector<uint32_t>> succs(n);
+
+  for (uint32_t b = 0; b < n; ++b)
+    succs[b] = block_successors(fn, b);
+
+  const auto loops = find_machine_loops(succs);
+
+  // Chains follow the likely successor until it is placed already. The
+  // entry starts the first, cold blocks go last.
+  std::vector<uint32_t> order;
+  std::vector<bool>     placed(n, false);
+
+  const auto place_chain = [&](uint32_t b) {
+    while (!placed[b]) {
+      placed[b] = true;
+      order.push_back(b);
+
+      const auto& next   = succs[b];
+      uint32_t    likely = next.empty() ? b : next[0];
+
+      if (next.size() == 2)
+        likely = likely_successor(fn, loops, b, next[0], next[1]);
+
+      if (!next.empty() && placed[likely])
+        likely = next.back();
+
+      if (is_cold(fn.blocks[likely]))
+        break;
+
+      b = likely;
+    }
+  };
+
+  for (uint32_t b = 0; b < n; ++b) {
+    if (!is_cold(fn.blocks[b]))
+      place_chain(b);
+  }
+
+  for (uint32_t b = 0; b < n; ++b) {
+    if (!placed[b])
+      place_chain(b);
+  }
+
+  std::vector<uint32_t> position(n);
+  std::vector<MBlock>   blocks;
+
+  for (uint32_t i = 0; i < n; ++i) {
+    position[order[i]] = i;
+    blocks.push_back(std::move(fn.blocks[order[i]]));
+  }
+
+  for (MBlock& block : blocks) {
+    for (MInstr& instr : block.instrs) {
+      for (size_t i = 0; i < instr.num_ops; ++i) {
+        if (instr.ops[i].kind == OperandKind::label)
+          instr.ops[i].value = position[instr.ops[i].value];
+      }
+    }
+  }
+
+  fn.blocks = std::move(blocks);
+}
+
+MModule
+compile_module(const ir::Module& module, const CompileOptions& options)
+{
+  MModule out;
+
+  for (const auto& global : module.globals) {
+    const uint32_t count = std::max<uint32_t>(global.length, 1);
+    out.globals.push_back(
+      MGlobal{ global.name, count * type_size(global.type) });
+  }
+
+  for (const auto& fn : module.functions) {
+    MFunction mfn = select_function(module, fn, options);
+    layout_blocks(mfn);
+    allocate_registers(mfn);
+    remove_fallthrough_jumps(mfn);
+    out.functions.push_back(std::move(mfn));
+  }
+
+  return out;
+}
+
+} // namespace wcc::x64
@@ -0,0 +1,480 @@
+#include "util.h"
+#include "writer.h"
+#include "x64.h"
+
+#include <algorithm>
+
+namespace wcc::x64 {
+
+struct AsmContext
+{
+  const MModule&   module;
+  const MFunction& fn;
+  size_t           index; // of fn in the module, for block labels
+  BufferedWriter&  out;
+  bool             frame_allocated; // rsp was moved below the locals
+  bool             vzeroupper;      // upper ymm halves are dirty at ret
+};
+
+static const char SUFFIX[] = { 0, 'b', 'w', 0, 'l', 0, 0, 0, 'q' };
+
+static size_t
+size_index(uint8_t size)
+{
+  switch (size) {
+    case 1:
+      return 0;
+    case 2:
+      return 1;
+    case 4:
+      return 2;
+    default:
+      return 3;
+  }
+}
+
+static const char*
+reg_name(Reg r, uint8_t size)
+{
+  if (is_xmm(r) && size == 32)
+    return YMM_NAMES[underlay_cast(r) - underlay_cast(Reg::xmm0)];
+  if (is_xmm(r))
+    return XMM_NAMES[underlay_cast(r) - underlay_cast(Reg::xmm0)];
+
+  return GPR_NAMES[underlay_cast(r)][size_index(size)];
+}
+
+static void
+print_operand(AsmContext& ctx, const Operand& op, uint8_t size)
+{
+  BufferedWriter& out = ctx.out;
+
+  switch (op.kind) {
+    case OperandKind::reg:
+      out.print("%{}", reg_name(op.reg(), size));
+      return;
+    case OperandKind::imm:
+      out.print("${}", op.imm);
+      return;
+    case OperandKind::frame:
+    case OperandKind::arg:
+      out.print("{}(%rbp)", frame_offset(ctx.fn, op));
+      return;
+    case OperandKind::global:
+      out.print("{}(%rip)", ctx.module.globals[op.value].name);
+      return;
+    case OperandKind::label:
+      out.print(".L{}_{}", ctx.index, op.value);
+      return;
+    case OperandKind::func:
+      out.write(ctx.module.functions[op.value].name);
+      return;
+    case OperandKind::vreg:
+    case OperandKind::none:
+      break;
+  }
+
+  panic("Internal error: unallocated operand reached the assembly printer");
+}
+
+// AT&T order: source first, an immediate lane selector before it.
+static void
+print_ops(AsmContext& ctx,
+          const MInstr& instr,
+          uint8_t       dst_size,
+          uint8_t       src_size)
+{
+  for (size_t i = instr.num_ops; i-- > 1;) {
+    print_operand(ctx, instr.ops[i], src_size);
+    ctx.out.write(", ");
+  }
+
+  print_operand(ctx, instr.ops[0], dst_size);
+  ctx.out.put('\n');
+}
+
+static char
+float_suffix(uint8_t size)
+{
+  return size == 4 ? 's' : 'd';
+}
+
+// disp(%base, %index, scale)
+static void
+print_address(AsmContext&    ctx,
+              const MInstr&  instr,
+              const Operand& base,
+              const Operand& idx)
+{
+  BufferedWriter& out = ctx.out;
+
+  if (instr.disp != 0 || base.kind == OperandKind::none)
+    out.print("{}", instr.disp);
+
+  out.put('(');
+
+  if (base.kind != OperandKind::none)
+    out.print("%{}", reg_name(base.reg(), 8));
+
+  if (idx.kind != OperandKind::none)
+    out.print(", %{}, {}", reg_name(idx.reg(), 8), instr.scale);
+
+  out.put(')');
+}
+
+// lea disp(%base, %index, scale), dst
+static void
+print_lea_address(AsmContext& ctx, const MInstr& instr)
+{
+  ctx.out.print("lea{} ", SUFFIX[instr.size]);
+  print_address(ctx, instr, instr.ops[1], instr.ops[2]);
+  ctx.out.write(", ");
+  print_operand(ctx, instr.ops[0], instr.size);
+  ctx.out.put('\n');
+}
+
+// Element loads and stores: integer moves, zero extending below 4 bytes,
+// scalar float moves or unaligned vector moves, by register and size.
+static void
+print_element(AsmContext& ctx, const MInstr& instr)
+{
+  BufferedWriter& out   = ctx.out;
+  const bool      load  = instr.op == MOp::load;
+  const Operand&  value = load ? instr.ops[0] : instr.ops[2];
+  const uint8_t   size  = instr.size;
+
+  if (!is_xmm(value.reg()))
+    out.print(load && size < 4 ? "movz{}l " : "mov{} ", SUFFIX[size]);
+  else if (size <= 8)
+    out.print("movs{} ", float_suffix(size));
+  else
+    out.write(size == 32 ? "vmovups " : "movups ");
+
+  const uint8_t reg_size = load && size < 4 ? 4 : size;
+
+  if (!load) {
+    print_operand(ctx, value, reg_size);
+    out.write(", ");
+    print_address(ctx, instr, instr.ops[0], instr.ops[1]);
+  } else {
+    print_address(ctx, instr, instr.ops[1], instr.ops[2]);
+    out.write(", ");
+    print_operand(ctx, value, reg_size);
+  }
+
+  out.put('\n');
+}
+
+// VEX.256 form of packed arithmetic: dst is the first source as well.
+static void
+print_ymm(AsmContext& ctx, const MInstr& instr, const char* suffix)
+{
+  ctx.out.print("v{}{} ", MOP_STR[underlay_cast(instr.op)], suffix);
+  print_operand(ctx, instr.ops[1], 32);
+  ctx.out.write(", ");
+  print_operand(ctx, instr.ops[0], 32);
+  ctx.out.write(", ");
+  print_operand(ctx, instr.ops[0], 32);
+  ctx.out.put('\n');
+}
+
+static void
+print_epilogue(AsmContext& ctx)
+{
+  BufferedWriter& out = ctx.out;
+
+  if (ctx.vzeroupper)
+    out.write("\tvzeroupper\n");
+
+  if (!ctx.fn.saved.empty()) {
+    if (ctx.frame_allocated)
+      out.print("\tleaq {}(%rbp), %rsp\n", -8 * int64_t(ctx.fn.saved.size()));
+
+    for (size_t i = ctx.fn.saved.size(); i-- > 0;)
+      out.print("\tpopq %{}\n", reg_name(ctx.fn.saved[i], 8));
+
+    out.write("\tpopq %rbp\n");
+  } else if (ctx.frame_allocated) {
+    out.write("\tleave\n");
+  } else {
+    out.write("\tpopq %rbp\n");
+  }
+}
+
+static void
+print_instr(AsmContext& ctx, const MInstr& instr)
+{
+  BufferedWriter& out  = ctx.out;
+  const uint8_t   size = instr.size;
+  const char      sfx  = SUFFIX[size];
+
+  if (instr.op == MOp::ret) {
+    print_epilogue(ctx);
+    out.write("\tret\n");
+    return;
+  }
+
+  // The callee returns to our caller.
+  if (instr.op == MOp::tail_call) {
+    print_epilogue(ctx);
+    out.write("\tjmp ");
+    print_ops(ctx, instr, 8, 8);
+    return;
+  }
+
+  out.put('\t');
+
+  switch (instr.op) {
+    case MOp::mov:
+      if (size == 8 && instr.ops[1].is_imm() &&
+          (instr.ops[1].imm < INT32_MIN || instr.ops[1].imm > INT32_MAX))
+        out.write("movabsq ");
+      else
+        out.print("mov{} ", sfx);
+      print_ops(ctx, instr, size, size);
+      return;
+
+    case MOp::movsx:
+    case MOp::movzx:
+      // movslq is the only extension from 32 bits.
+      out.print("mov{}{}{} ",
+                instr.op == MOp::movsx ? 's' : 'z',
+                SUFFIX[instr.src_size],
+                sfx);
+      print_ops(ctx, instr, size, instr.src_size);
+      return;
+
+    case MOp::load:
+    case MOp::store:
+      print_element(ctx, instr);
+      return;
+
+    case MOp::lea:
+      if (instr.num_ops == 3) {
+        print_lea_address(ctx, instr);
+        return;
+      }
+      [[fallthrough]];
+    case MOp::add:
+    case MOp::sub:
+    case MOp::imul:
+    case MOp::and_:
+    case MOp::or_:
+    case MOp::xor_:
+    case MOp::cmp:
+    case MOp::test:
+      out.print("{}{} ", MOP_STR[underlay_cast(instr.op)], sfx);
+      print_ops(ctx, instr, size, size);
+      return;
+
+    case MOp::shl:
+    case MOp::shr:
+    case MOp::sar:
+      out.print("{}{} ", MOP_STR[underlay_cast(instr.op)], sfx);
+      print_ops(ctx, instr, size, 1);
+      return;
+
+    case MOp::neg:
+    case MOp::idiv:
+    case MOp::div:
+    case MOp::imulw:
+    case MOp::mulw:
+    case MOp::push:
+    case MOp::pop:
+      out.print("{}{} ", MOP_STR[underlay_cast(instr.op)], sfx);
+      print_ops(ctx, instr, size, size);
+      return;
+
+    case MOp::setcc:
+      out.print("set{} ", COND_STR[underlay_cast(instr.cond)]);
+      print_ops(ctx, instr, 1, 1);
+      return;
+
+    case MOp::cmov:
+      out.print("cmov{}{} ", COND_STR[underlay_cast(instr.cond)], sfx);
+      print_ops(ctx, instr, size, size);
+      return;
+
+    case MOp::cdq:
+      out.write(size == 8 ? "cqto\n" : "cltd\n");
+      return;
+
+    case MOp::movs:
+      if (instr.ops[0].is_reg() && instr.ops[1].is_reg())
+        out.write("movaps ");
+      else
+        out.print("movs{} ", float_suffix(size));
+      print_ops(ctx, instr, size, size);
+      return;
+
+    case MOp::movq:
+      out.write(size == 8 ? "movq " : "movd ");
+      print_ops(ctx, instr, size, size);
+      return;
+
+    case MOp::adds:
+    case MOp::subs:
+    case MOp::muls:
+    case MOp::divs:
+    case MOp::ucomis:
+      out.print("{}{} ", MOP_STR[underlay_cast(instr.op)], float_suffix(size));
+      print_ops(ctx, instr, size, size);
+      return;
+
+    case MOp::xorps:
+      if (instr.ymm) {
+        print_ymm(ctx, instr, "");
+        return;
+      }
+      out.write("xorps ");
+      print_ops(ctx, instr, size, size);
+      return;
+
+    case MOp::addp:
+    case MOp::subp:
+    case MOp::mulp:
+    case MOp::divp:
+      if (instr.ymm) {
+        print_ymm(ctx, instr, size == 4 ? "s" : "d");
+        return;
+      }
+      out.print("{}{} ", MOP_STR[underlay_cast(instr.op)], float_suffix(size));
+      print_ops(ctx, instr, size, size);
+      return;
+
+    case MOp::vfmadd231:
+    case MOp::vfmsub231:
+    case MOp::vfnmadd231:
+      out.print("{}s{} ", MOP_STR[underlay_cast(instr.op)], float_suffix(size));
+      print_ops(ctx, instr, size, size);
+      return;
+
+    case MOp::movups:
+      out.write(size == 32 ? "vmovups " : "movups ");
+      print_ops(ctx, instr, size, size);
+      return;
+
+    case MOp::broadcast:
+      out.print("vpbroadcast{} ", size == 8 ? 'q' : 'd');
+      print_ops(ctx, instr, 32, 16);
+      return;
+
+    case MOp::rep_stos:
+    case MOp::ud2:
+      out.print("{}\n", MOP_STR[underlay_cast(instr.op)]);
+      return;
+
+    case MOp::padd:
+    case MOp::psub:
+    case MOp::pmull:
+    case MOp::pand:
+    case MOp::por:
+    case MOp::pxor:
+      if (instr.ymm) {
+        print_ymm(ctx, instr, "");
+        return;
+      }
+      out.print("{} ", MOP_STR[underlay_cast(instr.op)]);
+      print_ops(ctx, instr, 4, 4);
+      return;
+
+    case MOp::insertps:
+    case MOp::movlhps:
+    case MOp::pinsrd:
+    case MOp::pextrd:
+    case MOp::pshufd:
+      out.print("{} ", MOP_STR[underlay_cast(instr.op)]);
+      print_ops(ctx, instr, 4, 4);
+      return;
+
+    case MOp::cvtsi2s:
+      out.print("cvtsi2s{}{} ", float_suffix(size), SUFFIX[instr.src_size]);
+      print_ops(ctx, instr, size, instr.src_size);
+      return;
+
+    case MOp::cvtts2si:
+      out.print("cvtts{}2si ", float_suffix(instr.src_size));
+      print_ops(ctx, instr, size, instr.src_size);
+      return;
+
+    case MOp::cvts2s:
+      out.print("cvts{}2s{} ",
+                float_suffix(instr.src_size),
+                float_suffix(size));
+      print_ops(ctx, instr, size, instr.src_size);
+      return;
+
+    case MOp::jmp:
+      out.write("jmp ");
+      print_ops(ctx, instr, 8, 8);
+      return;
+
+    case MOp::jcc:
+      out.print("j{} ", COND_STR[underlay_cast(instr.cond)]);
+      print_ops(ctx, instr, 8, 8);
+      return;
+
+    case MOp::call:
+      out.write("call ");
+      print_ops(ctx, instr, 8, 8);
+      return;
+
+    case MOp::tail_call:
+    case MOp::ret:
+      break;
+  }
+}
+
+static void
+print_function(const MModule& module, size_t index, BufferedWriter& out)
+{
+  const MFunction& fn = module.functions[index];
+
+  const bool allocate = allocates_frame(fn);
+  const bool ymm      = std::find(fn.vregs.begin(),
+                                  fn.vregs.end(),
+                                  RegClass::ymm) != fn.vregs.end();
+  AsmContext ctx{ module, fn, index, out, allocate, ymm };
+
+  out.print("\n\t.globl {0}\n\t.type {0}, @function\n{0}:\n", fn.name);
+  out.write("\tpushq %rbp\n\tmovq %rsp, %rbp\n");
+
+  for (const Reg r : fn.saved)
+    out.print("\tpushq %{}\n", reg_name(r, 8));
+
+  if (allocate)
+    out.print("\tsubq ${}, %rsp\n", fn.frame_size);
+
+  for (size_t b = 0; b < fn.blocks.size(); ++b) {
+    out.print(".L{}_{}:\n", index, b);
+
+    for (const MInstr& instr : fn.blocks[b].instrs)
+      print_instr(ctx, instr);
+  }
+
+  out.print("\t.size {0}, .-{0}\n", fn.name);
+}
+
+void
+emit_asm(const MModule& module, BufferedWriter& out)
+{
+  out.write("\t.text\n");
+
+  for (size_t i = 0; i < module.functions.size(); ++i)
+    print_function(module, i, out);
+
+  if (!module.globals.empty())
+    out.write("\n\t.bss\n");
+
+  for (const MGlobal& global : module.globals) {
+    out.print("\t.globl {0}\n\t.align {2}\n\t.type {0}, @object\n"
+              "\t.size {0}, {1}\n{0}:\n\t.zero {1}\n",
+              global.name,
+              global.size,
+              global_alignment(global));
+  }
+
+  out.write("\n\t.section .note.GNU-stack,\"\",@progbits\n");
+}
+
+} // namespace wcc::x64
@@ -0,0 +1,1088 @@
+#include "typecheck.h"
+#include "util.h"
+#include "x64.h"
+
+#include <algorithm>
+
+namespace wcc::x64 {
+
+struct EncodeContext
+{
+  const MFunction& fn;
+  MachineCode&     code;
+
+  std::vector<uint32_t> block_offsets;
+
+  // rel32 fields of jumps, patched once every block has its offset.
+  std::vector<std::pair<uint32_t, uint32_t>> fixups;
+
+  // The function leaves dirty upper ymm halves, vzeroupper before returning
+  // spares SSE code after it the transition penalty.
+  bool vzeroupper = false;
+};
+
+// Prefixes and REX bits shared by the forms of one instruction.
+struct Form
+{
+  uint8_t prefix    = 0;     // mandatory prefix of SSE instructions
+  bool    wide      = false; // REX.W, 64 bit operands
+  bool    word      = false; // 0x66, 16 bit operands
+  bool    byte_regs = false; // spl, bpl, sil and dil need a REX prefix
+  uint8_t vex       = 0;     // VEX opcode map (2: 0F 38), 0 for legacy
+  uint8_t vvvv      = 0;     // extra source register of VEX encodings
+  bool    ymm       = false; // VEX.L, 256 bit operands
+};
+
+static Form
+int_form(uint8_t size)
+{
+  return Form{ .wide = size == 8, .word = size == 2, .byte_regs = size == 1 };
+}
+
+static Form
+sse_form(uint8_t size)
+{
+  return Form{ .prefix = static_cast<uint8_t>(size == 4 ? 0xf3 : 0xf2) };
+}
+
+static bool
+fits_i8(int64_t value)
+{
+  return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static bool
+fits_i32(int64_t value)
+{
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Register number as it goes into ModRM and REX, xmm registers included.
+static uint8_t
+reg_number(Reg r)
+{
+  return underlay_cast(r) & 15;
+}
+
+static void
+put(EncodeContext& ctx, uint8_t byte)
+{
+  ctx.code.text.push_back(byte);
+}
+
+static void
+put_imm(EncodeContext& ctx, int64_t value, size_t bytes)
+{
+  for (size_t i = 0; i < bytes; ++i)
+    put(ctx, static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static uint32_t
+position(const EncodeContext& ctx)
+{
+  return static_cast<uint32_t>(ctx.code.text.size());
+}
+
+static void
+put_rex(EncodeContext& ctx,
+        const Form&    form,
+        uint8_t        reg,
+        uint8_t        base,
+        uint8_t        index = 0)
+{
+  uint8_t rex = 0x40;
+
+  if (form.wide)
+    rex |= 8;
+  if (reg & 8)
+    rex |= 4;
+  if (index & 8)
+    rex |= 2;
+  if (base & 8)
+    rex |= 1;
+
+  // Without REX the byte registers 4 to 7 would be ah, ch, dh and bh. An
+  // opcode extension in the reg field can trigger a harmless extra REX.
+  const bool byte_high =
+    form.byte_regs && ((reg & 12) == 4 || (base & 12) == 4);
+
+  if (rex != 0x40 || byte_high)
+    put(ctx, rex);
+}
+
+// Three byte VEX prefix, standing in for the mandatory prefix, REX and the
+// opcode escape: inverted R, X and B, the map, then W, the inverted extra
+// source, L and the prefix as pp.
+static void
+put_vex(EncodeContext& ctx,
+        const Form&    form,
+        uint8_t        reg,
+        uint8_t        base,
+        uint8_t        index = 0)
+{
+  uint8_t pp = 0;
+
+  if (form.prefix == 0x66)
+    pp = 1;
+  else if (form.prefix == 0xf3)
+    pp = 2;
+  else if (form.prefix == 0xf2)
+    pp = 3;
+
+  put(ctx, 0xc4);
+  put(ctx,
+      static_cast<uint8_t>((reg & 8 ? 0 : 0x80) | (index & 8 ? 0 : 0x40) |
+                           (base & 8 ? 0 : 0x20) | form.vex));
+  put(ctx,
+      static_cast<uint8_t>((form.wide ? 0x80 : 0) | (~form.vvvv & 15) << 3 |
+                           (form.ymm ? 4 : 0) | pp));
+}
+
+static void
+put_prefixes(EncodeContext& ctx, const Form& form)
+{
+  if (form.word)
+    put(ctx, 0x66);
+  if (form.prefix)
+    put(ctx, form.prefix);
+}
+
+// Emits prefixes, opcode and the ModRM addressing `rm`. `reg` is a register
+// number or an opcode extension. `trailing` immediate bytes follow, rip
+// relative displacements are measured from their end.
+static void
+put_modrm(EncodeContext&             ctx,
+          const Form&                form,
+          std::initializer_list<int> opcode,
+          uint8_t                    reg,
+          const Operand&             rm,
+          size_t                     trailing = 0)
+{
+  const uint8_t base = rm.is_reg() ? reg_number(rm.reg()) : 0;
+
+  if (form.vex != 0) {
+    put_vex(ctx, form, reg, base);
+  } else {
+    put_prefixes(ctx, form);
+    put_rex(ctx, form, reg, base);
+  }
+
+  for (const int byte : opcode)
+    put(ctx, static_cast<uint8_t>(byte));
+
+  const uint8_t field = static_cast<uint8_t>((reg & 7) << 3);
+
+  switch (rm.kind) {
+    case OperandKind::reg:
+      put(ctx, 0xc0 | field | reg_code(rm.reg()));
+      return;
+
+    case OperandKind::frame:
+    case OperandKind::arg: {
+      // rbp based, rbp as base always needs a displacement.
+      const int64_t disp = frame_offset(ctx.fn, rm);
+
+      if (fits_i8(disp)) {
+        put(ctx, 0x45 | field);
+        put_imm(ctx, disp, 1);
+      } else {
+        put(ctx, 0x85 | field);
+        put_imm(ctx, disp, 4);
+      }
+      return;
+    }
+
+    case OperandKind::global:
+      put(ctx, 0x05 | field);
+      ctx.code.relocs.push_back(
+        Relocation{ position(ctx),
+                    RelocKind::pc32,
+                    OperandKind::global,
+                    rm.value,
+                    -4 - static_cast<int64_t>(trailing) });
+      put_imm(ctx, 0, 4);
+      return;
+
+    default:
+      break;
+  }
+
+  panic("Internal error: operand cannot be encoded as ModRM");
+}
+
+// Like put_modrm, for the memory operand disp(base, index, scale) through a
+// SIB byte. Either register may be none, without a base the displacement is
+// 32 bits and rbp and r13 as base need one.
+static void
+put_address(EncodeContext&             ctx,
+            const Form&                form,
+            std::initializer_list<int> opcode,
+            uint8_t                    reg,
+            const Operand&             base_op,
+            const Operand&             index_op,
+            uint8_t                    scale,
+            int32_t                    disp)
+{
+  const bool    has_base  = base_op.kind != OperandKind::none;
+  const bool    has_index = index_op.kind != OperandKind::none;
+  const uint8_t base      = has_base ? reg_number(base_op.reg()) : 5;
+  const uint8_t index     = has_index ? reg_number(index_op.reg()) : 4;
+
+  if (form.vex != 0) {
+    put_vex(ctx, form, reg, base, index);
+  } else {
+    put_prefixes(ctx, form);
+    put_rex(ctx, form, reg, base, index);
+  }
+
+  for (const int byte : opcode)
+    put(ctx, static_cast<uint8_t>(byte));
+
+  uint8_t mod   = 0;
+  size_t  bytes = 0;
+
+  if (!has_base) {
+    bytes = 4;
+  } else if (disp != 0 || (base & 7) == 5) {
+    mod   = fits_i8(disp) ? 1 : 2;
+    bytes = fits_i8(disp) ? 1 : 4;
+  }
+
+  const uint8_t ss = static_cast<uint8_t>(__builtin_ctz(scale));
+
+  put(ctx, mod << 6 | (reg & 7) << 3 | 4);
+  put(ctx, ss << 6 | (index & 7) << 3 | (base & 7));
+  put_imm(ctx, disp, bytes);
+}
+
+// Operand of a register only form: the encoded number of a physical register.
+static uint8_t
+reg_of(const Operand& op)
+{
+  if (!op.is_reg())
+    panic("Internal error: instruction form needs a register operand");
+
+  return reg_number(op.reg());
+}
+
+// Immediate width of the full size forms, 64 bit operations sign extend 32.
+static size_t
+imm_width(uint8_t size)
+{
+  return size == 8 ? 4 : size;
+}
+
+// add, or, and, sub, xor and cmp share one encoding pattern, `digit` is both
+// the opcode row and the extension of the immediate forms.
+static void
+encode_alu(EncodeContext& ctx, uint8_t digit, const MInstr& instr)
+{
+  const uint8_t  size = instr.size;
+  const Form     form = int_form(size);
+  const Operand& dst  = instr.ops[0];
+  const Operand& src  = instr.ops[1];
+  const uint8_t  row  = static_cast<uint8_t>(digit << 3);
+
+  if (src.is_imm()) {
+    if (size == 1) {
+      put_modrm(ctx, form, { 0x80 }, digit, dst, 1);
+      put_imm(ctx, src.imm, 1);
+    } else if (fits_i8(src.imm)) {
+      put_modrm(ctx, form, { 0x83 }, digit, dst, 1);
+      put_imm(ctx, src.imm, 1);
+    } else {
+      put_modrm(ctx, form, { 0x81 }, digit, dst, imm_width(size));
+      put_imm(ctx, src.imm, imm_width(size));
+    }
+    return;
+  }
+
+  const uint8_t byte_op = size == 1 ? 0 : 1;
+
+  if (src.is_reg())
+    put_modrm(ctx, form, { row | byte_op }, reg_of(src), dst);
+  else
+    put_modrm(ctx, form, { row | 2 | byte_op }, reg_of(dst), src);
+}
+
+static void
+encode_mov(EncodeContext& ctx, const MInstr& instr)
+{
+  const uint8_t  size = instr.size;
+  const Form     form = int_form(size);
+  const Operand& dst  = instr.ops[0];
+  const Operand& src  = instr.ops[1];
+  const uint8_t  byte = size == 1 ? 0 : 1;
+
+  if (src.is_imm()) {
+    if (size == 8 && !fits_i32(src.imm)) {
+      const uint8_t r = reg_of(dst);
+      put_rex(ctx, form, 0, r);
+      put(ctx, 0xb8 | (r & 7));
+      put_imm(ctx, src.imm, 8);
+      return;
+    }
+
+    put_modrm(ctx, form, { 0xc6 | byte }, 0, dst, imm_width(size));
+    put_imm(ctx, src.imm, imm_width(size));
+    return;
+  }
+
+  if (src.is_reg())
+    put_modrm(ctx, form, { 0x88 | byte }, reg_of(src), dst);
+  else
+    put_modrm(ctx, form, { 0x8a | byte }, reg_of(dst), src);
+}
+
+static void
+encode_extend(EncodeContext& ctx, const MInstr& instr)
+{
+  const Form     form = int_form(instr.size);
+  const uint8_t  dst  = reg_of(instr.ops[0]);
+  const Operand& src  = instr.ops[1];
+  const bool     sx   = instr.op == MOp::movsx;
+
+  switch (instr.src_size) {
+    case 1:
+      put_modrm(ctx,
+                Form{ .wide = form.wide, .word = form.word, .byte_regs = true },
+                { 0x0f, sx ? 0xbe : 0xb6 },
+                dst,
+                src);
+      return;
+    case 2:
+      put_modrm(ctx, form, { 0x0f, sx ? 0xbf : 0xb7 }, dst, src);
+      return;
+    default:
+      // movslq, a zero extension from 32 bits is a plain 32 bit move.
+      if (sx)
+        put_modrm(ctx, form, { 0x63 }, dst, src);
+      else
+        put_modrm(ctx, int_form(4), { 0x8b }, dst, src);
+      return;
+  }
+}
+
+static void
+encode_imul(EncodeContext& ctx, const MInstr& instr)
+{
+  const Form     form = int_form(instr.size);
+  const Operand& dst  = instr.ops[0];
+  const Operand& src  = instr.ops[1];
+
+  if (!src.is_imm()) {
+    put_modrm(ctx, form, { 0x0f, 0xaf }, reg_of(dst), src);
+    return;
+  }
+
+  if (fits_i8(src.imm)) {
+    put_modrm(ctx, form, { 0x6b }, reg_of(dst), dst, 1);
+    put_imm(ctx, src.imm, 1);
+  } else {
+    put_modrm(ctx, form, { 0x69 }, reg_of(dst), dst, imm_width(instr.size));
+    put_imm(ctx, src.imm, imm_width(instr.size));
+  }
+}
+
+static void
+encode_test(EncodeContext& ctx, const MInstr& instr)
+{
+  const uint8_t size = instr.size;
+  const Form    form = int_form(size);
+  const uint8_t byte = size == 1 ? 0 : 1;
+  Operand       lhs  = instr.ops[0];
+  Operand       rhs  = instr.ops[1];
+
+  if (rhs.is_imm()) {
+    put_modrm(ctx, form, { 0xf6 | byte }, 0, lhs, imm_width(size));
+    put_imm(ctx, rhs.imm, imm_width(size));
+    return;
+  }
+
+  // Only test r/m, reg exists, the operation is symmetric.
+  if (!rhs.is_reg())
+    std::swap(lhs, rhs);
+
+  put_modrm(ctx, form, { 0x84 | byte }, reg_of(rhs), lhs);
+}
+
+// Single operand group 3 and shift instructions.
+static void
+encode_unary(EncodeContext& ctx, const MInstr& instr, uint8_t digit)
+{
+  const uint8_t byte = instr.size == 1 ? 0 : 1;
+  put_modrm(ctx, int_form(instr.size), { 0xf6 | byte }, digit, instr.ops[0]);
+}
+
+// lea disp(base, index, scale), dst
+static void
+encode_lea_address(EncodeContext& ctx, const MInstr& instr)
+{
+  put_address(ctx,
+              Form{ .wide = instr.size == 8 },
+              { 0x8d },
+              reg_of(instr.ops[0]),
+              instr.ops[1],
+              instr.ops[2],
+              instr.scale,
+              instr.disp);
+}
+
+// Moves between a register and the element at disp(base, index, scale):
+// size bytes into or out of a general purpose register, narrow loads zero
+// extended, or a scalar, 16 or 32 byte vector into or out of an xmm/ymm
+// register.
+static void
+encode_element(EncodeContext& ctx, const MInstr& instr)
+{
+  const bool     load  = instr.op == MOp::load;
+  const Operand& value = load ? instr.ops[0] : instr.ops[2];
+  const Operand& base  = load ? instr.ops[1] : instr.ops[0];
+  const Operand& index = load ? instr.ops[2] : instr.ops[1];
+  const uint8_t  size  = instr.size;
+  const uint8_t  sse   = load ? 0x10 : 0x11;
+
+  const auto emit = [&](Form form, std::initializer_list<int> opcode) {
+    put_address(ctx,
+                form,
+                opcode,
+                reg_number(value.reg()),
+                base,
+                index,
+                instr.scale,
+                instr.disp);
+  };
+
+  if (!is_xmm(value.reg())) {
+    if (load && size < 4)
+      emit(Form{}, { 0x0f, size == 1 ? 0xb6 : 0xb7 });
+    else
+      emit(int_form(size), { (load ? 0x8a : 0x88) | (size == 1 ? 0 : 1) });
+  } else if (size <= 8) {
+    emit(sse_form(size), { 0x0f, sse });
+  } else if (size == 16) {
+    emit(Form{}, { 0x0f, sse });
+  } else {
+    emit(Form{ .vex = 1, .ymm = true }, { sse });
+  }
+}
+
+static void
+encode_shift(EncodeContext& ctx, const MInstr& instr, uint8_t digit)
+{
+  const uint8_t byte = instr.size == 1 ? 0 : 1;
+
+  if (!instr.ops[1].is_imm())
+    panic("Internal error: shift count must be an immediate");
+
+  const Form form = int_form(instr.size);
+
+  if (instr.ops[1].imm == 1) {
+    put_modrm(ctx, form, { 0xd0 | byte }, digit, instr.ops[0]);
+    return;
+  }
+
+  put_modrm(ctx, form, { 0xc0 | byte }, digit, instr.ops[0], 1);
+  put_imm(ctx, instr.ops[1].imm, 1);
+}
+
+// VEX.256 form of packed SSE arithmetic dst op= src: the escape bytes go
+// into the VEX map and dst is the first source as well.
+static void
+encode_ymm(EncodeContext&             ctx,
+           const MInstr&              instr,
+           Form                       form,
+           std::initializer_list<int> opcode)
+{
+  const int* last = opcode.end() - 1;
+
+  form.vex  = opcode.size() == 3 ? (opcode.begin()[1] == 0x38 ? 2 : 3) : 1;
+  form.ymm  = true;
+  form.vvvv = reg_of(instr.ops[0]);
+
+  put_modrm(ctx, form, { *last }, reg_of(instr.ops[0]), instr.ops[1]);
+}
+
+// Scalar SSE arithmetic: dst op= src with dst a register.
+static void
+encode_sse(EncodeContext& ctx, const MInstr& instr, Form form, uint8_t opcode)
+{
+  if (instr.ymm)
+    encode_ymm(ctx, instr, form, { 0x0f, opcode });
+  else
+    put_modrm(ctx, form, { 0x0f, opcode }, reg_of(instr.ops[0]), instr.ops[1]);
+}
+
+static void
+encode_movs(EncodeContext& ctx, const MInstr& instr)
+{
+  const Operand& dst = instr.ops[0];
+  const Operand& src = instr.ops[1];
+
+  if (dst.is_reg() && src.is_reg())
+    put_modrm(ctx, Form{}, { 0x0f, 0x28 }, reg_of(dst), src);
+  else if (dst.is_reg())
+    put_modrm(ctx, sse_form(instr.size), { 0x0f, 0x10 }, reg_of(dst), src);
+  else
+    put_modrm(ctx, sse_form(instr.size), { 0x0f, 0x11 }, reg_of(src), dst);
+}
+
+// Whole vector moves, vmovups of ymm registers with size 32.
+static void
+encode_movups(EncodeContext& ctx, const MInstr& instr)
+{
+  const Operand& dst  = instr.ops[0];
+  const Operand& src  = instr.ops[1];
+  const bool     ymm  = instr.size == 32;
+  const Form     form = ymm ? Form{ .vex = 1, .ymm = true } : Form{};
+
+  if (dst.is_reg() && ymm)
+    put_modrm(ctx, form, { 0x10 }, reg_of(dst), src);
+  else if (dst.is_reg())
+    put_modrm(ctx, form, { 0x0f, 0x10 }, reg_of(dst), src);
+  else if (ymm)
+    put_modrm(ctx, form, { 0x11 }, reg_of(src), dst);
+  else
+    put_modrm(ctx, form, { 0x0f, 0x11 }, reg_of(src), dst);
+}
+
+// Packed arithmetic and lane moves: dst, src with an optional imm8 lane
+// selector. `reg` names the operand going into the ModRM reg field, the
+// other one is r/m.
+static void
+encode_packed(EncodeContext&             ctx,
+              const MInstr&              instr,
+              Form                       form,
+              std::initializer_list<int> opcode,
+              size_t                     reg = 0)
+{
+  const bool imm8 = instr.num_ops == 3;
+
+  if (instr.ymm) {
+    encode_ymm(ctx, instr, form, opcode);
+    return;
+  }
+
+  put_modrm(ctx,
+            form,
+            opcode,
+            reg_of(instr.ops[reg]),
+            instr.ops[1 - reg],
+            imm8 ? 1 : 0);
+
+  if (imm8)
+    put_imm(ctx, instr.ops[2].imm, 1);
+}
+
+// FMA3 dst, a, b: dst in ModRM reg, a in VEX.vvvv, b register or memory.
+static void
+encode_fma(EncodeContext& ctx, const MInstr& instr, uint8_t opcode)
+{
+  const Form form{ .prefix = 0x66,
+                   .wide   = instr.size == 8,
+                   .vex    = 2,
+                   .vvvv   = reg_of(instr.ops[1]) };
+
+  put_modrm(ctx, form, { opcode }, reg_of(instr.ops[0]), instr.ops[2]);
+}
+
+static void
+encode_movq(EncodeContext& ctx, const MInstr& instr)
+{
+  const Operand& dst  = instr.ops[0];
+  const Operand& src  = instr.ops[1];
+  const Form     form = { .prefix = 0x66, .wide = instr.size == 8 };
+
+  if (dst.is_reg() && is_xmm(dst.reg())) {
+    if (src.is_reg() && is_xmm(src.reg()))
+      put_modrm(ctx, Form{ .prefix = 0xf3 }, { 0x0f, 0x7e }, reg_of(dst), src);
+    else
+      put_modrm(ctx, form, { 0x0f, 0x6e }, reg_of(dst), src);
+  } else {
+    put_modrm(ctx, form, { 0x0f, 0x7e }, reg_of(src), dst);
+  }
+}
+
+static void
+encode_push_pop(EncodeContext& ctx, const MInstr& instr)
+{
+  const Operand& op   = instr.ops[0];
+  const bool     push = instr.op == MOp::push;
+
+  if (op.is_reg()) {
+    const uint8_t r = reg_of(op);
+    put_rex(ctx, Form{}, 0, r);
+    put(ctx, (push ? 0x50 : 0x58) | (r & 7));
+  } else if (op.is_imm()) {
+    if (fits_i8(op.imm)) {
+      put(ctx, 0x6a);
+      put_imm(ctx, op.imm, 1);
+    } else {
+      put(ctx, 0x68);
+      put_imm(ctx, op.imm, 4);
+    }
+  } else if (push) {
+    put_modrm(ctx, Form{}, { 0xff }, 6, op);
+  } else {
+    put_modrm(ctx, Form{}, { 0x8f }, 0, op);
+  }
+}
+
+static void
+encode_jump(EncodeContext& ctx, const MInstr& instr)
+{
+  if (instr.op == MOp::jmp) {
+    put(ctx, 0xe9);
+  } else {
+    put(ctx, 0x0f);
+    put(ctx, 0x80 | underlay_cast(instr.cond));
+  }
+
+  ctx.fixups.emplace_back(position(ctx), instr.ops[0].value);
+  put_imm(ctx, 0, 4);
+}
+
+// The rel32 of a call or jump to function `index`, left to the linker.
+static void
+encode_func_reloc(EncodeContext& ctx, uint32_t index)
+{
+  ctx.code.relocs.push_back(Relocation{
+    position(ctx), RelocKind::plt32, OperandKind::func, index, -4 });
+  put_imm(ctx, 0, 4);
+}
+
+static void
+encode_epilogue(EncodeContext& ctx)
+{
+  const MFunction& fn = ctx.fn;
+
+  if (ctx.vzeroupper) {
+    put(ctx, 0xc5);
+    put(ctx, 0xf8);
+    put(ctx, 0x77);
+  }
+
+  if (!fn.saved.empty()) {
+    // leaq -8 * saved(%rbp), %rsp
+    if (allocates_frame(fn)) {
+      put(ctx, 0x48);
+      put(ctx, 0x8d);
+      put(ctx, 0x65);
+      put_imm(ctx, -8 * static_cast<int64_t>(fn.saved.size()), 1);
+    }
+
+    for (size_t i = fn.saved.size(); i-- > 0;) {
+      put_rex(ctx, Form{}, 0, reg_number(fn.saved[i]));
+      put(ctx, 0x58 | reg_code(fn.saved[i]));
+    }
+
+    put(ctx, 0x5d); // popq %rbp
+  } else if (allocates_frame(fn)) {
+    put(ctx, 0xc9); // leave
+  } else {
+    put(ctx, 0x5d);
+  }
+}
+
+static void
+encode_prologue(EncodeContext& ctx)
+{
+  const MFunction& fn = ctx.fn;
+
+  put(ctx, 0x55); // pushq %rbp
+  put(ctx, 0x48); // movq %rsp, %rbp
+  put(ctx, 0x89);
+  put(ctx, 0xe5);
+
+  for (const Reg r : fn.saved) {
+    put_rex(ctx, Form{}, 0, reg_number(r));
+    put(ctx, 0x50 | reg_code(r));
+  }
+
+  if (allocates_frame(fn)) {
+    MInstr sub{ .op = MOp::sub, .size = 8, .num_ops = 2 };
+    sub.ops[0] = preg(Reg::rsp);
+    sub.ops[1] = imm(fn.frame_size);
+    encode_alu(ctx, 5, sub);
+  }
+}
+
+static void
+encode_instr(EncodeContext& ctx, const MInstr& instr)
+{
+  const uint8_t size = instr.size;
+
+  switch (instr.op) {
+    case MOp::mov:
+      encode_mov(ctx, instr);
+      return;
+    case MOp::movsx:
+    case MOp::movzx:
+      encode_extend(ctx, instr);
+      return;
+    case MOp::load:
+    case MOp::store:
+      encode_element(ctx, instr);
+      return;
+    case MOp::lea:
+      if (instr.num_ops == 3)
+        encode_lea_address(ctx, instr);
+      else
+        put_modrm(
+          ctx, int_form(size), { 0x8d }, reg_of(instr.ops[0]), instr.ops[1]);
+      return;
+    case MOp::add:
+      encode_alu(ctx, 0, instr);
+      return;
+    case MOp::or_:
+      encode_alu(ctx, 1, instr);
+      return;
+    case MOp::and_:
+      encode_alu(ctx, 4, instr);
+      return;
+    case MOp::sub:
+      encode_alu(ctx, 5, instr);
+      return;
+    case MOp::xor_:
+      encode_alu(ctx, 6, instr);
+      return;
+    case MOp::cmp:
+      encode_alu(ctx, 7, instr);
+      return;
+    case MOp::imul:
+      encode_imul(ctx, instr);
+      return;
+    case MOp::test:
+      encode_test(ctx, instr);
+      return;
+    case MOp::shl:
+      encode_shift(ctx, instr, 4);
+      return;
+    case MOp::shr:
+      encode_shift(ctx, instr, 5);
+      return;
+    case MOp::sar:
+      encode_shift(ctx, instr, 7);
+      return;
+    case MOp::neg:
+      encode_unary(ctx, instr, 3);
+      return;
+    case MOp::div:
+      encode_unary(ctx, instr, 6);
+      return;
+    case MOp::idiv:
+      encode_unary(ctx, instr, 7);
+      return;
+    case MOp::mulw:
+      encode_unary(ctx, instr, 4);
+      return;
+    case MOp::imulw:
+      encode_unary(ctx, instr, 5);
+      return;
+    case MOp::setcc:
+      put_modrm(ctx,
+                Form{ .byte_regs = true },
+                { 0x0f, 0x90 | underlay_cast(instr.cond) },
+                0,
+                instr.ops[0]);
+      return;
+    case MOp::cmov:
+      put_modrm(ctx,
+                int_form(size),
+                { 0x0f, 0x40 | underlay_cast(instr.cond) },
+                reg_of(instr.ops[0]),
+                instr.ops[1]);
+      return;
+    case MOp::cdq:
+      put_prefixes(ctx, int_form(size));
+      put_rex(ctx, int_form(size), 0, 0);
+      put(ctx, 0x99);
+      return;
+    case MOp::movs:
+      encode_movs(ctx, instr);
+      return;
+    case MOp::movq:
+      encode_movq(ctx, instr);
+      return;
+    case MOp::adds:
+      encode_sse(ctx, instr, sse_form(size), 0x58);
+      return;
+    case MOp::subs:
+      encode_sse(ctx, instr, sse_form(size), 0x5c);
+      return;
+    case MOp::muls:
+      encode_sse(ctx, instr, sse_form(size), 0x59);
+      return;
+    case MOp::divs:
+      encode_sse(ctx, instr, sse_form(size), 0x5e);
+      return;
+    case MOp::ucomis: {
+      const Form form{ .prefix = static_cast<uint8_t>(size == 8 ? 0x66 : 0) };
+      encode_sse(ctx, instr, form, 0x2e);
+      return;
+    }
+    case MOp::xorps:
+      encode_sse(ctx, instr, Form{}, 0x57);
+      return;
+    case MOp::movups:
+      encode_movups(ctx, instr);
+      return;
+    case MOp::addp:
+    case MOp::subp:
+    case MOp::mulp:
+    case MOp::divp: {
+      static constexpr uint8_t OPCODES[] = { 0x58, 0x5c, 0x59, 0x5e };
+      const Form form{ .prefix = static_cast<uint8_t>(size == 8 ? 0x66 : 0) };
+      const auto row = underlay_cast(instr.op) - underlay_cast(MOp::addp);
+
+      encode_sse(ctx, instr, form, OPCODES[row]);
+      return;
+    }
+    case MOp::padd:
+      encode_packed(ctx, instr, Form{ .prefix = 0x66 }, { 0x0f, 0xfe });
+      return;
+    case MOp::psub:
+      encode_packed(ctx, instr, Form{ .prefix = 0x66 }, { 0x0f, 0xfa });
+      return;
+    case MOp::pmull:
+      encode_packed(ctx, instr, Form{ .prefix = 0x66 }, { 0x0f, 0x38, 0x40 });
+      return;
+    case MOp::pand:
+      encode_packed(ctx, instr, Form{ .prefix = 0x66 }, { 0x0f, 0xdb });
+      return;
+    case MOp::por:
+      encode_packed(ctx, instr, Form{ .prefix = 0x66 }, { 0x0f, 0xeb });
+      return;
+    case MOp::pxor:
+      encode_packed(ctx, instr, Form{ .prefix = 0x66 }, { 0x0f, 0xef });
+      return;
+    case MOp::insertps:
+      encode_packed(ctx, instr, Form{ .prefix = 0x66 }, { 0x0f, 0x3a, 0x21 });
+      return;
+    case MOp::movlhps:
+      encode_packed(ctx, instr, Form{}, { 0x0f, 0x16 });
+      return;
+    case MOp::pinsrd:
+      encode_packed(ctx, instr, Form{ .prefix = 0x66 }, { 0x0f, 0x3a, 0x22 });
+      return;
+    case MOp::pextrd:
+      encode_packed(
+        ctx, instr, Form{ .prefix = 0x66 }, { 0x0f, 0x3a, 0x16 }, 1);
+      return;
+    case MOp::pshufd:
+      encode_packed(ctx, instr, Form{ .prefix = 0x66 }, { 0x0f, 0x70 });
+      return;
+    case MOp::broadcast: {
+      const Form form{ .prefix = 0x66, .vex = 2, .ymm = true };
+
+      put_modrm(ctx,
+                form,
+                { size == 8 ? 0x59 : 0x58 },
+                reg_of(instr.ops[0]),
+                instr.ops[1]);
+      return;
+    }
+    case MOp::vfmadd231:
+      encode_fma(ctx, instr, 0xb9);
+      return;
+    case MOp::vfmsub231:
+      encode_fma(ctx, instr, 0xbb);
+      return;
+    case MOp::vfnmadd231:
+      encode_fma(ctx, instr, 0xbd);
+      return;
+    case MOp::cvtsi2s: {
+      Form form = sse_form(size);
+      form.wide = instr.src_size == 8;
+      encode_sse(ctx, instr, form, 0x2a);
+      return;
+    }
+    case MOp::cvtts2si: {
+      Form form = sse_form(instr.src_size);
+      form.wide = size == 8;
+      encode_sse(ctx, instr, form, 0x2c);
+      return;
+    }
+    case MOp::cvts2s:
+      encode_sse(ctx, instr, sse_form(instr.src_size), 0x5a);
+      return;
+    case MOp::rep_stos:
+      put(ctx, 0xf3);
+      put(ctx, 0x48);
+      put(ctx, 0xab);
+      return;
+    case MOp::ud2:
+      put(ctx, 0x0f);
+      put(ctx, 0x0b);
+      return;
+    case MOp::push:
+    case MOp::pop:
+      encode_push_pop(ctx, instr);
+      return;
+    case MOp::jmp:
+    case MOp::jcc:
+      encode_jump(ctx, instr);
+      return;
+    case MOp::call:
+      put(ctx, 0xe8);
+      encode_func_reloc(ctx, instr.ops[0].value);
+      return;
+    case MOp::tail_call:
+      encode_epilogue(ctx);
+      put(ctx, 0xe9);
+      encode_func_reloc(ctx, instr.ops[0].value);
+      return;
+    case MOp::ret:
+      encode_epilogue(ctx);
+      put(ctx, 0xc3);
+      return;
+  }
+}
+
+static void
+encode_function(const MFunction& fn, MachineCode& code)
+{
+  EncodeContext ctx{ fn, code, {}, {} };
+
+  ctx.vzeroupper = std::find(fn.vregs.begin(),
+                             fn.vregs.end(),
+                             RegClass::ymm) != fn.vregs.end();
+
+  encode_prologue(ctx);
+
+  for (const MBlock& block : fn.blocks) {
+    ctx.block_offsets.push_back(position(ctx));
+
+    for (const MInstr& instr : block.instrs)
+      encode_instr(ctx, instr);
+  }
+
+  for (const auto& [field, block] : ctx.fixups) {
+    const int64_t rel = int64_t(ctx.block_offsets[block]) - (field + 4);
+
+    for (size_t i = 0; i < 4; ++i)
+      code.text[field + i] = static_cast<uint8_t>(rel >> (8 * i));
+  }
+}
+
+// Functions start 16 byte aligned, padded with int3.
+static void
+align_function(MachineCode& code)
+{
+  while (code.text.size() % 16 != 0)
+    code.text.push_back(0xcc);
+}
+
+MachineCode
+encode_module(const MModule& module)
+{
+  MachineCode code;
+
+  for (const MFunction& fn : module.functions) {
+    align_function(code);
+
+    const uint32_t begin = static_cast<uint32_t>(code.text.size());
+    encode_function(fn, code);
+
+    code.functions.push_back(EncodedFunction{
+      begin, static_cast<uint32_t>(code.text.size()) - begin });
+  }
+
+  return code;
+}
+
+// ModRM and disp32 of [r11 + disp], with `reg` in the reg field.
+static void
+put_r11_disp(EncodeContext& ctx, uint8_t reg, int64_t disp)
+{
+  put(ctx, 0x80 | static_cast<uint8_t>((reg & 7) << 3) | 3);
+  put_imm(ctx, disp, 4);
+}
+
+EncodedFunction
+encode_entry_stub(const ir::Function& fn, uint32_t index, MachineCode& code)
+{
+  const MFunction none;
+  EncodeContext   ctx{ none, code, {}, {} };
+
+  align_function(code);
+  const uint32_t begin = position(ctx);
+
+  // Arguments in registers and on the stack, by position, following the
+  // classification of select_function.
+  std::vector<std::pair<size_t, Reg>> in_regs;
+  std::vector<size_t>                 on_stack;
+  size_t                              ints   = 0;
+  size_t                              floats = 0;
+
+  for (size_t i = 0; i < fn.params.size(); ++i) {
+    if (is_float(fn.params[i]) && floats < std::size(FLOAT_ARG_REGS))
+      in_regs.emplace_back(i, FLOAT_ARG_REGS[floats++]);
+    else if (!is_float(fn.params[i]) && ints < std::size(INT_ARG_REGS))
+      in_regs.emplace_back(i, INT_ARG_REGS[ints++]);
+    else
+      on_stack.push_back(i);
+  }
+
+  put(ctx, 0x55); // pushq %rbp
+  put(ctx, 0x48); // movq %rsp, %rbp
+  put(ctx, 0x89);
+  put(ctx, 0xe5);
+
+  // movq %rdi, %r11
+  put(ctx, 0x49);
+  put(ctx, 0x89);
+  put(ctx, 0xfb);
+
+  // Keeps rsp 16 byte aligned at the call.
+  if (on_stack.size() % 2 != 0) {
+    put(ctx, 0x48); // subq $8, %rsp
+    put(ctx, 0x83);
+    put(ctx, 0xec);
+    put(ctx, 0x08);
+  }
+
+  // pushq 8 * i(%r11), last argument first
+  for (size_t i = on_stack.size(); i-- > 0;) {
+    put(ctx, 0x41);
+    put(ctx, 0xff);
+    put_r11_disp(ctx, 6, 8 * static_cast<int64_t>(on_stack[i]));
+  }
+
+  for (const auto& [arg, reg] : in_regs) {
+    const uint8_t r = reg_number(reg);
+
+    if (is_xmm(reg)) {
+      // movsd 8 * arg(%r11), %xmm; an f32 is the low half of its slot.
+      put(ctx, 0xf2);
+      put_rex(ctx, Form{}, r, 11);
+      put(ctx, 0x0f);
+      put(ctx, 0x10);
+    } else {
+      // movq 8 * arg(%r11), %reg
+      put_rex(ctx, Form{ .wide = true }, r, 11);
+      put(ctx, 0x8b);
+    }
+
+    put_r11_disp(ctx, r, 8 * static_cast<int64_t>(arg));
+  }
+
+  put(ctx, 0xe8);
+  encode_func_reloc(ctx, index);
+
+  // movq %xmm0, %rax
+  if (is_float(fn.return_type)) {
+    put(ctx, 0x66);
+    put(ctx, 0x48);
+    put(ctx, 0x0f);
+    put(ctx, 0x7e);
+    put(ctx, 0xc0);
+  }
+
+  put(ctx, 0xc9); // leave
+  put(ctx, 0xc3);
+
+  return EncodedFunction{ begin, position(ctx) - begin };
+}
+
+} // namespace wcc::x64
@@ -0,0 +1,1848 @@
+#include "typecheck.h"
+#include "util.h"
+#include "x64.h"
+#include "x64_burs.h"
+
+#include <algorithm>
+
+namespace wcc::x64 {
+
+// How an IR value takes part in an expression tree.
+enum class TreePart : uint8_t
+{
+  none,     // selected on its own, a register to its users
+  interior, // computed by the tree of its only user
+  memory,   // global load folded into its user as a memory operand
+  fused,    // float multiplication contracted into the FMA of its user
+  flags,    // integer compare read from the flags by its branch or select
+};
+
+// BURS state of a tree node: the cheapest cost of deriving each nonterminal
+// and the rule doing it.
+struct NodeLabel
+{
+  uint32_t cost[burs::NT_COUNT];
+  uint8_t  rule[burs::NT_COUNT];
+};
+
+struct SelectContext
+{
+  const ir::Module&     module;
+  const ir::Function&   fn;
+  MFunction&            mfn;
+  const CompileOptions& options;
+
+  std::vector<uint32_t>  block_map; // IR block -> machine block, NONE if empty
+  std::vector<uint32_t>  vreg_of;   // IR value -> virtual register
+  std::vector<TreePart>  part;      // IR value -> its place in a tree
+  std::vector<NodeLabel> labels;    // IR value -> state of a tree node
+  std::vector<uint32_t>  array_slot; // local array -> its lowest frame slot
+  std::vector<uint8_t>   sibling;    // IR value -> part of a sibling call
+  uint32_t               current = 0;
+  uint32_t               trap    = ir::NONE; // block of failed bounds checks
+};
+
+static MInstr&
+emit(SelectContext&                 ctx,
+     MOp                            op,
+     uint8_t                        size,
+     std::initializer_list<Operand> ops = {})
+{
+  MInstr instr{ .op = op, .size = size };
+
+  for (const Operand& op : ops)
+    instr.ops[instr.num_ops++] = op;
+
+  auto& instrs = ctx.mfn.blocks[ctx.current].instrs;
+  instrs.push_back(instr);
+  return instrs.back();
+}
+
+static RegClass
+class_of(LangType type)
+{
+  return is_float(type) ? RegClass::xmm : RegClass::gpr;
+}
+
+// Size integer arithmetic is done at. Values narrower than 32 bits live in
+// full registers with undefined upper bits, only operations that observe
+// those bits (compares, division, extensions) look at the real width.
+static uint8_t
+op_size(LangType type)
+{
+  return std::max<uint8_t>(type_size(type), 4);
+}
+
+static bool
+fits_imm32(int64_t value)
+{
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static bool
+is_constant(const SelectContext& ctx, ir::ValueId v)
+{
+  return ctx.fn.instrs[v].op == ir::Opcode::constant;
+}
+
+static Operand
+new_vreg(SelectContext& ctx, RegClass cls)
+{
+  return vreg(ctx.mfn.new_vreg(cls));
+}
+
+// Loads 64 constant bits into general purpose register `dst`.
+static void
+load_bits(SelectContext& ctx, Operand dst, uint64_t bits)
+{
+  // 32 bit moves zero extend, sign extended imm32 covers negative values.
+  if (bits <= UINT32_MAX)
+    emit(ctx, MOp::mov, 4, { dst, imm(static_cast<int64_t>(bits)) });
+  else
+    emit(ctx, MOp::mov, 8, { dst, imm(static_cast<int64_t>(bits)) });
+}
+
+static Operand
+materialize_bits(SelectContext& ctx, uint64_t bits)
+{
+  const Operand t = new_vreg(ctx, RegClass::gpr);
+  load_bits(ctx, t, bits);
+  return t;
+}
+
+static Operand
+materialize_float(SelectContext& ctx, LangType type, uint64_t bits)
+{
+  const Operand x = new_vreg(ctx, RegClass::xmm);
+
+  if (bits == 0) {
+    emit(ctx, MOp::xorps, 8, { x, x });
+    return x;
+  }
+
+  emit(ctx, MOp::movq, type_size(type), { x, materialize_bits(ctx, bits) });
+  return x;
+}
+
+// Operand reading IR value `v` in an instruction of `size` bytes. Constants
+// are rematerialized at every use, as an immediate if `allow_imm` and the
+// encoding has room for it.
+static Operand
+use(SelectContext& ctx, ir::ValueId v, bool allow_imm, uint8_t size = 8)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+
+  if (instr.op != ir::Opcode::constant)
+    return vreg(ctx.vreg_of[v]);
+
+  if (is_float(instr.type()))
+    return materialize_float(ctx, instr.type(), instr.imm);
+
+  const auto value = static_cast<int64_t>(instr.imm);
+
+  if (allow_imm && (size < 8 || fits_imm32(value)))
+    return imm(value);
+
+  return materialize_bits(ctx, instr.imm);
+}
+
+static Operand
+def(const SelectContext& ctx, ir::ValueId v)
+{
+  return vreg(ctx.vreg_of[v]);
+}
+
+static Operand
+global(uint32_t index)
+{
+  return Operand{ OperandKind::global, index, 0 };
+}
+
+// Register to register or memory move of a value of `type`.
+static void
+emit_move(SelectContext& ctx, LangType type, Operand dst, Operand src)
+{
+  if (is_float(type))
+    emit(ctx, MOp::movs, type_size(type), { dst, src });
+  else
+    emit(ctx, MOp::mov, 8, { dst, src });
+}
+
+// a + b * c as vfmadd231 into a copy of a, a - b * c negates the product
+// (vfnmadd231), b * c - a subtracts the copy (vfmsub231).
+static bool
+select_fma(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+  const uint8_t    size  = type_size(instr.type());
+
+  for (size_t k = 0; k < 2; ++k) {
+    const ir::ValueId product = ctx.fn.operand(v, k);
+
+    if (ctx.part[product] != TreePart::fused)
+      continue;
+
+    MOp op = MOp::vfmadd231;
+
+    if (instr.op == ir::Opcode::sub)
+      op = k == 0 ? MOp::vfmsub231 : MOp::vfnmadd231;
+
+    const Operand dst    = def(ctx, v);
+    const Operand addend = use(ctx, ctx.fn.operand(v, 1 - k), false);
+
+    emit(ctx, MOp::movs, size, { dst, addend });
+    emit(ctx,
+         op,
+         size,
+         { dst,
+           use(ctx, ctx.fn.operand(product, 0), false),
+           use(ctx, ctx.fn.operand(product, 1), false) });
+    return true;
+  }
+
+  return false;
+}
+
+// Floating point arithmetic. Integer arithmetic is selected by trees.
+static void
+select_binary(SelectContext& ctx, ir::ValueId v)
+{
+  // Products contracted into an FMA are emitted by their user.
+  if (ctx.part[v] == TreePart::fused || select_fma(ctx, v))
+    return;
+
+  const ir::Instr& instr = ctx.fn.instrs[v];
+  const uint8_t    size  = type_size(instr.type());
+  const Operand    dst   = def(ctx, v);
+  MOp              op;
+
+  switch (instr.op) {
+    case ir::Opcode::add:
+      op = MOp::adds;
+      break;
+    case ir::Opcode::sub:
+      op = MOp::subs;
+      break;
+    case ir::Opcode::mul:
+      op = MOp::muls;
+      break;
+    case ir::Opcode::div:
+      op = MOp::divs;
+      break;
+    default:
+      panic("Internal error: no float instruction for opcode");
+  }
+
+  emit(ctx, MOp::movs, size, { dst, use(ctx, ctx.fn.operand(v, 0), false) });
+  emit(ctx, op, size, { dst, use(ctx, ctx.fn.operand(v, 1), false) });
+}
+
+/*
+ * Integer arithmetic is selected over expression trees by the rules of
+ * x64_burs.h. Trees are labeled bottom up with the cheapest derivation of
+ * every nonterminal, the root is then reduced as a register.
+ */
+
+static bool
+is_tree_node(const ir::Function& fn, ir::ValueId v)
+{
+  const ir::Instr& instr = fn.instrs[v];
+  return burs::is_tree_op(instr.op) && is_integer(instr.type()) &&
+         instr.lanes == 1;
+}
+
+static bool
+has_side_effects(ir::Opcode op)
+{
+  return op == ir::Opcode::gstore || op == ir::Opcode::astore ||
+         op == ir::Opcode::call;
+}
+
+// Cuts the trees out of the function. A tree node with a single use by a
+// tree node of its block is interior to its user. A global load is a memory
+// operand of its only user when it has the width the user operates at and
+// nothing writes memory before the root of the tree reads it.
+static void
+find_trees(SelectContext& ctx)
+{
+  const ir::Function& fn = ctx.fn;
+  const size_t        n  = fn.instrs.size();
+
+  std::vector<uint32_t>    uses(n, 0);
+  std::vector<ir::ValueId> user(n, ir::NONE);
+  std::vector<ir::BlockId> block_of(n, ir::NONE);
+  std::vector<uint32_t>    pos(n, 0);
+
+  for (ir::BlockId b = 0; b < fn.blocks.size(); ++b) {
+    const auto& instrs = fn.blocks[b].instrs;
+
+    for (uint32_t i = 0; i < instrs.size(); ++i) {
+      const ir::ValueId v = instrs[i];
+
+      block_of[v] = b;
+      pos[v]      = i;
+
+      for (size_t k = 0; k < fn.instrs[v].num_operands; ++k) {
+        const ir::ValueId u = fn.operand(v, k);
+        ++uses[u];
+        user[u] = v;
+      }
+    }
+  }
+
+  const auto tree_user = [&](ir::ValueId v) {
+    const ir::ValueId u = user[v];
+
+    if (uses[v] != 1 || block_of[u] != block_of[v] || !is_tree_node(fn, u))
+      return ir::NONE;
+
+    return u;
+  };
+
+  ctx.part.assign(n, TreePart::none);
+
+  for (ir::ValueId v = 0; v < n; ++v) {
+    if (block_of[v] != ir::NONE && is_tree_node(fn, v) &&
+        tree_user(v) != ir::NONE)
+      ctx.part[v] = TreePart::interior;
+  }
+
+  for (ir::ValueId v = 0; v < n; ++v) {
+    const ir::Instr& instr = fn.instrs[v];
+
+    if (instr.op != ir::Opcode::gload || !is_integer(instr.type()))
+      continue;
+
+    const ir::ValueId u = tree_user(v);
+
+    if (u == ir::NONE || type_size(instr.type()) != op_size(instr.type()))
+      continue;
+
+    ir::ValueId root = u;
+
+    while (ctx.part[root] == TreePart::interior)
+      root = user[root];
+
+    const auto& instrs = fn.blocks[block_of[v]].instrs;
+    bool        clobbered = false;
+
+    for (uint32_t i = pos[v] + 1; i < pos[root]; ++i)
+      clobbered |= has_side_effects(fn.instrs[instrs[i]].op);
+
+    if (!clobbered)
+      ctx.part[v] = TreePart::memory;
+  }
+
+  // A compare used once, by the branch or select of its block, is made
+  // right before the jump or cmov reading its flags.
+  for (ir::ValueId v = 0; v < n; ++v) {
+    const ir::Instr& instr = fn.instrs[v];
+
+    if (block_of[v] == ir::NONE || !ir::is_compare(instr.op) ||
+        instr.lanes != 1 || uses[v] != 1)
+      continue;
+
+    const ir::ValueId u  = user[v];
+    const ir::Opcode  op = fn.instrs[u].op;
+
+    if (is_integer(fn.instrs[fn.operand(v, 0)].type()) &&
+        block_of[u] == block_of[v] && fn.operand(u, 0) == v &&
+        (op == ir::Opcode::condbr || op == ir::Opcode::select))
+      ctx.part[v] = TreePart::flags;
+  }
+
+  if (!ctx.options.fma)
+    return;
+
+  // A scalar float product used once, by an addition or subtraction of its
+  // block, is computed by the FMA selected for that user.
+  for (ir::ValueId v = 0; v < n; ++v) {
+    const ir::Instr& instr = fn.instrs[v];
+
+    if (instr.op != ir::Opcode::add && instr.op != ir::Opcode::sub)
+      continue;
+
+    if (block_of[v] == ir::NONE || !is_float(instr.type()) || instr.lanes > 1)
+      continue;
+
+    for (size_t k = 0; k < 2; ++k) {
+      const ir::ValueId p       = fn.operand(v, k);
+      const ir::Instr&  product = fn.instrs[p];
+
+      if (product.op == ir::Opcode::mul && product.ty == instr.ty &&
+          product.lanes == 1 && uses[p] == 1 && block_of[p] == block_of[v]) {
+        ctx.part[p] = TreePart::fused;
+        break;
+      }
+    }
+  }
+}
+
+constexpr uint32_t NO_COST = UINT32_MAX;
+constexpr uint8_t  LEAF    = UINT8_MAX;
+
+static void
+derive(NodeLabel& label, burs::Nt nt, uint32_t cost, uint8_t rule)
+{
+  if (cost < label.cost[underlay_cast(nt)]) {
+    label.cost[underlay_cast(nt)] = cost;
+    label.rule[underlay_cast(nt)] = rule;
+  }
+}
+
+// Nonterminals a value derives without a rule, as a leaf of a tree at
+// operation `size`.
+static void
+label_leaf(SelectContext& ctx, ir::ValueId v, uint8_t size, NodeLabel& label)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+
+  if (ctx.part[v] == TreePart::memory) {
+    derive(label, burs::Nt::mem, 0, LEAF);
+    return;
+  }
+
+  if (instr.op != ir::Opcode::constant) {
+    derive(label, burs::Nt::reg, 0, LEAF);
+    return;
+  }
+
+  const auto value = static_cast<int64_t>(instr.imm);
+
+  derive(label, burs::Nt::con, 0, LEAF);
+
+  if (size < 8 || fits_imm32(value))
+    derive(label, burs::Nt::imm, 0, LEAF);
+
+  if (value >= 1 && value <= 3)
+    derive(label, burs::Nt::count, 0, LEAF);
+
+  if (value == 3 || value == 5 || value == 9)
+    derive(label, burs::Nt::factor, 0, LEAF);
+}
+
+// Labels `v` for a tree computed at operation `size`: the root and interior
+// nodes by the rules matching their opcode, leaves by what they are. Chain
+// rules are applied until no derivation gets cheaper.
+static void
+label_node(SelectContext& ctx, ir::ValueId v, uint8_t size, bool root)
+{
+  using burs::MATCHERS;
+  using burs::RULES;
+
+  NodeLabel& label = ctx.labels[v];
+
+  std::fill(std::begin(label.cost), std::end(label.cost), NO_COST);
+
+  if (root || ctx.part[v] == TreePart::interior) {
+    const ir::ValueId kids[2] = { ctx.fn.operand(v, 0), ctx.fn.operand(v, 1) };
+
+    label_node(ctx, kids[0], size, false);
+    label_node(ctx, kids[1], size, false);
+
+    const burs::RuleRange range =
+      MATCHERS.by_op[underlay_cast(ctx.fn.instrs[v].op)];
+
+    for (uint8_t i = range.begin; i < range.end; ++i) {
+      const burs::Rule& rule = RULES[MATCHERS.order[i]];
+      const NodeLabel&  lhs  = ctx.labels[kids[0]];
+      const NodeLabel&  rhs  = ctx.labels[kids[1]];
+      const uint32_t    a    = lhs.cost[underlay_cast(rule.kids[0])];
+      const uint32_t    b    = rhs.cost[underlay_cast(rule.kids[1])];
+
+      if (a != NO_COST && b != NO_COST)
+        derive(label, rule.lhs, rule.cost + a + b, MATCHERS.order[i]);
+    }
+  } else {
+    label_leaf(ctx, v, size, label);
+  }
+
+  const burs::RuleRange chains = MATCHERS.by_op[underlay_cast(ir::Opcode::nop)];
+  bool                  changed;
+
+  do {
+    changed = false;
+
+    for (uint8_t i = chains.begin; i < chains.end; ++i) {
+      const burs::Rule& rule = RULES[MATCHERS.order[i]];
+      const uint32_t    from = label.cost[underlay_cast(rule.kids[0])];
+
+      if (from != NO_COST &&
+          from + rule.cost < label.cost[underlay_cast(rule.lhs)]) {
+        derive(label, rule.lhs, from + rule.cost, MATCHERS.order[i]);
+        changed = true;
+      }
+    }
+  } while (changed);
+}
+
+// A reduced nonterminal: the operand of reg, imm and mem, the address parts
+// of the others.
+struct Reduced
+{
+  Operand value;
+  Operand base;
+  Operand index;
+  uint8_t scale = 1;
+  int32_t disp  = 0;
+};
+
+static MOp
+alu_op(ir::Opcode op)
+{
+  switch (op) {
+    case ir::Opcode::add:
+      return MOp::add;
+    case ir::Opcode::sub:
+      return MOp::sub;
+    case ir::Opcode::mul:
+      return MOp::imul;
+    case ir::Opcode::bit_and:
+      return MOp::and_;
+    case ir::Opcode::bit_or:
+      return MOp::or_;
+    case ir::Opcode::bit_xor:
+      return MOp::xor_;
+    case ir::Opcode::shl:
+      return MOp::shl;
+    default:
+      panic("Internal error: no integer instruction for opcode");
+  }
+}
+
+static Reduced
+reduce(SelectContext& ctx,
+       ir::ValueId    v,
+       burs::Nt       nt,
+       uint8_t        size,
+       Operand        dst);
+
+// Reduces `v` as a register, computed into `dst` when given.
+static Operand
+reduce_reg(SelectContext& ctx, ir::ValueId v, uint8_t size, Operand dst = {})
+{
+  const Operand value = reduce(ctx, v, burs::Nt::reg, size, dst).value;
+
+  if (dst.kind == OperandKind::none || value == dst)
+    return value;
+
+  emit(ctx, MOp::mov, 8, { dst, value });
+  return dst;
+}
+
+// Emits the instructions of the rules deriving `nt` from `v`. Registers are
+// computed into `dst` when given, into fresh virtual registers otherwise.
+static Reduced
+reduce(SelectContext& ctx,
+       ir::ValueId    v,
+       burs::Nt       nt,
+       uint8_t        size,
+       Operand        dst)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+  const uint8_t    r     = ctx.labels[v].rule[underlay_cast(nt)];
+  Reduced          out;
+
+  if (r == LEAF) {
+    if (nt == burs::Nt::reg)
+      out.value = vreg(ctx.vreg_of[v]);
+    else if (nt == burs::Nt::mem)
+      out.value = global(instr.imm);
+    else
+      out.value = imm(static_cast<int64_t>(instr.imm));
+
+    return out;
+  }
+
+  const burs::Rule& rule   = burs::RULES[r];
+  const auto        target = [&] {
+    return dst.kind != OperandKind::none ? dst : new_vreg(ctx, RegClass::gpr);
+  };
+
+  if (rule.op == ir::Opcode::nop) {
+    switch (rule.action) {
+      case burs::Action::load_imm:
+        out.value = target();
+        load_bits(ctx, out.value, instr.imm);
+        return out;
+
+      case burs::Action::load_mem:
+        out.value = target();
+        emit(ctx, MOp::mov, size, { out.value, global(instr.imm) });
+        return out;
+
+      case burs::Action::lea: {
+        const Reduced a = reduce(ctx, v, rule.kids[0], size, {});
+
+        out.value  = target();
+        MInstr& mi = emit(ctx, MOp::lea, size, { out.value, a.base, a.index });
+        mi.scale   = a.scale;
+        mi.disp    = a.disp;
+        return out;
+      }
+
+      default:
+        return reduce(ctx, v, rule.kids[0], size, dst);
+    }
+  }
+
+  const ir::ValueId lhs = ctx.fn.operand(v, 0);
+  const ir::ValueId rhs = ctx.fn.operand(v, 1);
+
+  switch (rule.action) {
+    case burs::Action::alu: {
+      out.value       = reduce_reg(ctx, lhs, size, target());
+      const Reduced b = reduce(ctx, rhs, rule.kids[1], size, {});
+      emit(ctx, alu_op(instr.op), size, { out.value, b.value });
+      return out;
+    }
+
+    case burs::Action::alu_swap: {
+      out.value       = reduce_reg(ctx, rhs, size, target());
+      const Reduced a = reduce(ctx, lhs, rule.kids[0], size, {});
+      emit(ctx, alu_op(instr.op), size, { out.value, a.value });
+      return out;
+    }
+
+    case burs::Action::scale:
+      out.index = reduce_reg(ctx, lhs, size);
+      out.scale = uint8_t(1) << ctx.fn.instrs[rhs].imm;
+      return out;
+
+    case burs::Action::square: {
+      const bool        first  = rule.kids[0] == burs::Nt::factor;
+      const ir::ValueId factor = first ? lhs : rhs;
+
+      out.base  = reduce_reg(ctx, first ? rhs : lhs, size);
+      out.index = out.base;
+      out.scale = static_cast<uint8_t>(ctx.fn.instrs[factor].imm - 1);
+      return out;
+    }
+
+    case burs::Action::base_idx:
+      out      = reduce(ctx, rhs, burs::Nt::index, size, {});
+      out.base = reduce_reg(ctx, lhs, size);
+      return out;
+
+    case burs::Action::idx_base:
+      out      = reduce(ctx, lhs, burs::Nt::index, size, {});
+      out.base = reduce_reg(ctx, rhs, size);
+      return out;
+
+    case burs::Action::base_reg:
+      out.base  = reduce_reg(ctx, lhs, size);
+      out.index = reduce_reg(ctx, rhs, size);
+      return out;
+
+    case burs::Action::disp: {
+      const bool        first = rule.kids[0] == burs::Nt::imm;
+      const ir::ValueId value = first ? rhs : lhs;
+      const burs::Nt    kind  = rule.kids[first ? 1 : 0];
+
+      if (kind == burs::Nt::reg)
+        out.base = reduce_reg(ctx, value, size);
+      else
+        out = reduce(ctx, value, kind, size, {});
+
+      out.disp = static_cast<int32_t>(ctx.fn.instrs[first ? lhs : rhs].imm);
+      return out;
+    }
+
+    default:
+      panic("Internal error: chain rule action on a tree node");
+  }
+}
+
+// Selects the tree rooted at `v` into its virtual register.
+static void
+select_tree(SelectContext& ctx, ir::ValueId v)
+{
+  const uint8_t size = op_size(ctx.fn.instrs[v].type());
+
+  label_node(ctx, v, size, true);
+
+  if (ctx.labels[v].cost[underlay_cast(burs::Nt::reg)] == NO_COST)
+    panic("Internal error: no rule derives a register from tree");
+
+  reduce_reg(ctx, v, size, def(ctx, v));
+}
+
+/*
+ * Vectors built by the SLP vectorizer: four f32 or 32 bit integer lanes, or
+ * two f64 lanes, in one xmm register. Lane inserts and extracts need
+ * SSE4.1. The loop vectorizer builds 32 byte vectors, one ymm register with
+ * AVX2, otherwise two xmm halves in consecutive virtual registers operated
+ * on one after the other.
+ */
+
+static bool
+is_split(const SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+  return instr.lanes * type_size(instr.type()) == 32 && !ctx.options.avx2;
+}
+
+static Operand
+half(Operand vector, uint32_t h)
+{
+  return vreg(vector.value + h);
+}
+
+static bool
+in_ymm(const SelectContext& ctx, Operand op)
+{
+  return ctx.mfn.vregs[op.value] == RegClass::ymm;
+}
+
+static void
+select_packed_binary(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+  const LangType   type  = instr.type();
+  const Operand    dst   = def(ctx, v);
+  MOp              op;
+
+  switch (instr.op) {
+    case ir::Opcode::add:
+      op = is_float(type) ? MOp::addp : MOp::padd;
+      break;
+    case ir::Opcode::sub:
+      op = is_float(type) ? MOp::subp : MOp::psub;
+      break;
+    case ir::Opcode::mul:
+      op = is_float(type) ? MOp::mulp : MOp::pmull;
+      break;
+    case ir::Opcode::div:
+      op = MOp::divp;
+      break;
+    case ir::Opcode::bit_and:
+      op = MOp::pand;
+      break;
+    case ir::Opcode::bit_or:
+      op = MOp::por;
+      break;
+    case ir::Opcode::bit_xor:
+      op = MOp::pxor;
+      break;
+    default:
+      panic("Internal error: no packed instruction for opcode");
+  }
+
+  const Operand  a     = def(ctx, ctx.fn.operand(v, 0));
+  const Operand  b     = def(ctx, ctx.fn.operand(v, 1));
+  const uint8_t  size  = type_size(type);
+
+  if (in_ymm(ctx, dst)) {
+    emit(ctx, MOp::movups, 32, { dst, a });
+    emit(ctx, op, size, { dst, b }).ymm = true;
+    return;
+  }
+
+  const uint32_t halves = is_split(ctx, v) ? 2 : 1;
+
+  for (uint32_t h = 0; h < halves; ++h) {
+    emit(ctx, MOp::movs, 8, { half(dst, h), half(a, h) });
+    emit(ctx, op, size, { half(dst, h), half(b, h) });
+  }
+}
+
+// Moves scalars into the lanes of a vector. Lane 0 is copied with whatever
+// the register holds above it, the other lanes are inserted one by one. A
+// single value is broadcast with one shuffle, or vpbroadcast into a ymm
+// register. 32 byte vectors are only ever broadcasts.
+static void
+select_pack(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+  const LangType   type  = instr.type();
+  const Operand    dst   = def(ctx, v);
+  const size_t     lanes = instr.num_operands;
+
+  bool splat = true;
+
+  for (size_t i = 1; i < lanes; ++i)
+    splat &= ctx.fn.operand(v, i) == ctx.fn.operand(v, 0);
+
+  if (lanes * type_size(type) == 32 && !splat)
+    panic("Internal error: 32 byte vector built from distinct lanes");
+
+  const Operand first = use(ctx, ctx.fn.operand(v, 0), false);
+  const Operand lane0 = in_ymm(ctx, dst) ? new_vreg(ctx, RegClass::xmm) : dst;
+
+  if (is_float(type))
+    emit(ctx, MOp::movs, 8, { lane0, first });
+  else
+    emit(ctx, MOp::movq, 4, { lane0, first });
+
+  if (in_ymm(ctx, dst)) {
+    emit(ctx, MOp::broadcast, type_size(type), { dst, lane0 });
+    return;
+  }
+
+  if (splat) {
+    const int64_t order = type == LangType::lt_f64 ? 0x44 : 0x00;
+
+    emit(ctx, MOp::pshufd, 16, { dst, dst, imm(order) });
+
+    if (is_split(ctx, v))
+      emit(ctx, MOp::movs, 8, { half(dst, 1), dst });
+    return;
+  }
+
+  for (size_t i = 1; i < lanes; ++i) {
+    const Operand lane = use(ctx, ctx.fn.operand(v, i), false);
+
+    if (type == LangType::lt_f64)
+      emit(ctx, MOp::movlhps, 16, { dst, lane });
+    else if (is_float(type))
+      emit(ctx, MOp::insertps, 16, { dst, lane, imm(int64_t(i) << 4) });
+    else
+      emit(ctx, MOp::pinsrd, 16, { dst, lane, imm(int64_t(i)) });
+  }
+}
+
+static void
+select_extract(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr& instr  = ctx.fn.instrs[v];
+  const LangType   type   = instr.type();
+  const Operand    dst    = def(ctx, v);
+  const Operand    vector = def(ctx, ctx.fn.operand(v, 0));
+  const auto       lane   = static_cast<int64_t>(instr.imm);
+
+  if (!is_float(type)) {
+    if (lane == 0)
+      emit(ctx, MOp::movq, 4, { dst, vector });
+    else
+      emit(ctx, MOp::pextrd, 4, { dst, vector, imm(lane) });
+    return;
+  }
+
+  if (lane == 0) {
+    emit(ctx, MOp::movs, 8, { dst, vector });
+    return;
+  }
+
+  // The lane moves down to lane 0, f64 lane 1 is f32 lanes 2 and 3.
+  const int64_t order = type == LangType::lt_f64 ? 0xee : lane;
+
+  emit(ctx, MOp::pshufd, 16, { dst, vector, imm(order) });
+}
+
+// Address of the first element of an array, a local one in the frame or a
+// global, in a fresh register.
+static Operand
+array_base(SelectContext& ctx, uint64_t array)
+{
+  const Operand base  = new_vreg(ctx, RegClass::gpr);
+  const auto    index = static_cast<uint32_t>(array);
+  const Operand place = array & ir::LOCAL_ARRAY
+                          ? Operand{ OperandKind::frame, ctx.array_slot[index] }
+                          : global(index);
+
+  emit(ctx, MOp::lea, 8, { base, place });
+  return base;
+}
+
+// aload and astore: base + index * element size, a constant index folded
+// into the displacement. Split vectors move in two 16 byte pieces.
+static void
+select_element(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr&  instr = ctx.fn.instrs[v];
+  const bool        load  = instr.op == ir::Opcode::aload;
+  const ir::ValueId value = load ? v : ctx.fn.operand(v, 1);
+  const ir::ValueId index = ctx.fn.operand(v, 0);
+  const ir::Instr&  elem  = ctx.fn.instrs[value];
+  const uint8_t     scale = type_size(elem.type());
+  const Operand     base  = array_base(ctx, instr.imm);
+
+  Operand idx;
+  int32_t disp = 0;
+
+  if (is_constant(ctx, index) && ctx.fn.instrs[index].imm < MAX_ARRAY_LENGTH)
+    disp = static_cast<int32_t>(ctx.fn.instrs[index].imm * scale);
+  else
+    idx = use(ctx, index, false);
+
+  const Operand  reg    = load ? def(ctx, v) : use(ctx, value, false);
+  const uint32_t pieces = is_split(ctx, value) ? 2 : 1;
+  const auto     size   = static_cast<uint8_t>(elem.lanes * scale / pieces);
+
+  for (uint32_t h = 0; h < pieces; ++h) {
+    const Operand piece = pieces == 1 ? reg : half(reg, h);
+    MInstr&       m =
+      load ? emit(ctx, MOp::load, size, { piece, base, idx })
+           : emit(ctx, MOp::store, size, { base, idx, piece });
+
+    m.scale = scale;
+    m.disp  = disp + static_cast<int32_t>(h * size);
+  }
+}
+
+// cmp against the length, an index out of bounds (negative ones included,
+// compared unsigned) jumps to a block of its own holding ud2.
+static void
+select_bounds(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+
+  if (ctx.trap == ir::NONE) {
+    ctx.trap = static_cast<uint32_t>(ctx.mfn.blocks.size());
+    ctx.mfn.blocks.emplace_back();
+    ctx.mfn.blocks.back().instrs.push_back(MInstr{ .op = MOp::ud2 });
+  }
+
+  const Operand index = use(ctx, ctx.fn.operand(v, 0), false);
+
+  emit(ctx, MOp::cmp, 8, { index, imm(static_cast<int64_t>(instr.imm)) });
+  emit(ctx, MOp::jcc, 8, { label(ctx.trap) }).cond = Cond::ae;
+}
+
+// Local arrays are laid out in the first frame slots, each a whole number
+// of slots, and start out zeroed on every call: rep stosq clears them all.
+static void
+select_arrays(SelectContext& ctx)
+{
+  uint32_t slots = 0;
+
+  for (const ir::Array& array : ctx.fn.arrays) {
+    const uint32_t bytes = array.length * type_size(array.type);
+
+    slots += (bytes + 7) / 8;
+    ctx.array_slot.push_back(slots - 1);
+  }
+
+  ctx.mfn.array_slots = slots;
+
+  if (slots == 0)
+    return;
+
+  emit(ctx, MOp::mov, 4, { preg(Reg::rax), imm(0) });
+  emit(ctx,
+       MOp::lea,
+       8,
+       { preg(Reg::rdi), Operand{ OperandKind::frame, slots - 1 } });
+  emit(ctx, MOp::mov, 4, { preg(Reg::rcx), imm(slots) });
+  emit(ctx, MOp::rep_stos, 8);
+}
+
+// Sign or zero extends a narrow integer to 32 bits.
+static Operand
+widen(SelectContext& ctx, LangType type, Operand value)
+{
+  if (type_size(type) >= 4)
+    return value;
+
+  const Operand t  = new_vreg(ctx, RegClass::gpr);
+  MInstr&       mi = emit(
+    ctx, is_signed(type) ? MOp::movsx : MOp::movzx, 4, { t, value });
+  mi.src_size = type_size(type);
+  return t;
+}
+
+static void
+select_division(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+  const LangType   type  = instr.type();
+  const uint8_t    size  = op_size(type);
+  const Operand    rax   = preg(Reg::rax);
+  const Operand    rdx   = preg(Reg::rdx);
+
+  const ir::ValueId lhs = ctx.fn.operand(v, 0);
+  const ir::ValueId rhs = ctx.fn.operand(v, 1);
+
+  if (type_size(type) < 4)
+    emit(ctx, MOp::mov, 4, { rax, widen(ctx, type, use(ctx, lhs, false)) });
+  else
+    emit(ctx, MOp::mov, size, { rax, use(ctx, lhs, true, size) });
+
+  const Operand divisor = widen(ctx, type, use(ctx, rhs, false));
+
+  if (is_signed(type)) {
+    emit(ctx, MOp::cdq, size);
+    emit(ctx, MOp::idiv, size, { divisor });
+  } else {
+    emit(ctx, MOp::xor_, 4, { rdx, rdx });
+    emit(ctx, MOp::div, size, { divisor });
+  }
+
+  emit(ctx,
+       MOp::mov,
+       size,
+       { def(ctx, v), instr.op == ir::Opcode::div ? rax : rdx });
+}
+
+// Right shifts by a constant count, left shifts are tree nodes. They see
+// the real width, narrow values are extended to 32 bits first.
+static void
+select_shift(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+  const LangType   type  = instr.type();
+  const uint8_t    size  = op_size(type);
+  const Operand    dst   = def(ctx, v);
+  const ir::Opcode op    = instr.op;
+
+  const ir::ValueId lhs   = ctx.fn.operand(v, 0);
+  const Operand     count = use(ctx, ctx.fn.operand(v, 1), true);
+
+  if (!count.is_imm())
+    panic("Internal error: shift by a variable count");
+
+  Operand value = use(ctx, lhs, false);
+
+  // Extended by the kind of shift, not the signedness of the type.
+  if (type_size(type) < 4) {
+    const Operand t  = new_vreg(ctx, RegClass::gpr);
+    MInstr&       mi = emit(
+      ctx, op == ir::Opcode::sar ? MOp::movsx : MOp::movzx, 4, { t, value });
+    mi.src_size = type_size(type);
+    value       = t;
+  }
+
+  emit(ctx, MOp::mov, 8, { dst, value });
+  emit(ctx, op == ir::Opcode::sar ? MOp::sar : MOp::shr, size, { dst, count });
+}
+
+// Upper half of the double width product. Below 64 bits the product is
+// formed in a 64 bit register from the extended operands and shifted down,
+// 64 bit operands need the one operand form writing rdx:rax.
+static void
+select_mulhi(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+  const LangType   type  = instr.type();
+  const uint8_t    width = type_size(type);
+  const bool       sign  = is_signed(type);
+  const Operand    dst   = def(ctx, v);
+
+  const ir::ValueId lhs = ctx.fn.operand(v, 0);
+  const ir::ValueId rhs = ctx.fn.operand(v, 1);
+
+  if (width == 8) {
+    const Operand rax = preg(Reg::rax);
+
+    emit(ctx, MOp::mov, 8, { rax, use(ctx, lhs, false) });
+    emit(ctx, sign ? MOp::imulw : MOp::mulw, 8, { use(ctx, rhs, false) });
+    emit(ctx, MOp::mov, 8, { dst, preg(Reg::rdx) });
+    return;
+  }
+
+  // Constants are canonical, sign or zero extended to 64 bits already.
+  const Operand value = use(ctx, lhs, false);
+
+  if (sign) {
+    emit(ctx, MOp::movsx, 8, { dst, value }).src_size = width;
+  } else if (width == 4) {
+    emit(ctx, MOp::mov, 4, { dst, value });
+  } else {
+    emit(ctx, MOp::movzx, 4, { dst, value }).src_size = width;
+  }
+
+  emit(ctx, MOp::imul, 8, { dst, use(ctx, rhs, true, 8) });
+  emit(ctx, sign ? MOp::sar : MOp::shr, 8, { dst, imm(8 * width) });
+}
+
+static Cond
+compare_cond(ir::Opcode op, bool sign)
+{
+  switch (op) {
+    case ir::Opcode::cmp_lt:
+      return sign ? Cond::l : Cond::b;
+    case ir::Opcode::cmp_le:
+      return sign ? Cond::le : Cond::be;
+    case ir::Opcode::cmp_gt:
+      return sign ? Cond::g : Cond::a;
+    case ir::Opcode::cmp_ge:
+      return sign ? Cond::ge : Cond::ae;
+    case ir::Opcode::cmp_eq:
+      return Cond::e;
+    default:
+      return Cond::ne;
+  }
+}
+
+// Condition with the operands of the compare swapped.
+static Cond
+swap_cond(Cond c)
+{
+  switch (c) {
+    case Cond::l:
+      return Cond::g;
+    case Cond::g:
+      return Cond::l;
+    case Cond::le:
+      return Cond::ge;
+    case Cond::ge:
+      return Cond::le;
+    case Cond::b:
+      return Cond::a;
+    case Cond::a:
+      return Cond::b;
+    case Cond::be:
+      return Cond::ae;
+    case Cond::ae:
+      return Cond::be;
+    default:
+      return c;
+  }
+}
+
+static void
+emit_setcc(SelectContext& ctx, Cond cond, Operand dst)
+{
+  emit(ctx, MOp::setcc, 1, { dst }).cond = cond;
+}
+
+// Compares the integer operands of compare `v` and returns the condition
+// under which it holds.
+static Cond
+emit_int_compare(SelectContext& ctx, ir::ValueId v)
+{
+  ir::ValueId    lhs  = ctx.fn.operand(v, 0);
+  ir::ValueId    rhs  = ctx.fn.operand(v, 1);
+  const LangType type = ctx.fn.instrs[lhs].type();
+  Cond           cond = compare_cond(ctx.fn.instrs[v].op, is_signed(type));
+
+  if (is_constant(ctx, lhs) && !is_constant(ctx, rhs)) {
+    std::swap(lhs, rhs);
+    cond = swap_cond(cond);
+  }
+
+  const uint8_t size = type_size(type);
+  const Operand a    = use(ctx, lhs, false);
+
+  emit(ctx, MOp::cmp, size, { a, use(ctx, rhs, true, size) });
+  return cond;
+}
+
+static void
+select_compare(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+  ir::ValueId      lhs   = ctx.fn.operand(v, 0);
+  ir::ValueId      rhs   = ctx.fn.operand(v, 1);
+  const LangType   type  = ctx.fn.instrs[lhs].type();
+  const Operand    dst   = def(ctx, v);
+
+  if (is_float(type)) {
+    const uint8_t size = type_size(type);
+    Cond          cond;
+
+    // Unordered compares set ZF, PF and CF. a/ae are false then, so < and <=
+    // are done as > and >= with swapped operands. == and != check PF.
+    switch (instr.op) {
+      case ir::Opcode::cmp_lt:
+        std::swap(lhs, rhs);
+        cond = Cond::a;
+        break;
+      case ir::Opcode::cmp_le:
+        std::swap(lhs, rhs);
+        cond = Cond::ae;
+        break;
+      case ir::Opcode::cmp_gt:
+        cond = Cond::a;
+        break;
+      case ir::Opcode::cmp_ge:
+        cond = Cond::ae;
+        break;
+      case ir::Opcode::cmp_eq:
+        cond = Cond::e;
+        break;
+      default:
+        cond = Cond::ne;
+        break;
+    }
+
+    const Operand a = use(ctx, lhs, false);
+    emit(ctx, MOp::ucomis, size, { a, use(ctx, rhs, false) });
+    emit_setcc(ctx, cond, dst);
+
+    if (cond == Cond::e || cond == Cond::ne) {
+      const Operand parity = new_vreg(ctx, RegClass::gpr);
+      emit_setcc(ctx, cond == Cond::e ? Cond::np : Cond::p, parity);
+      emit(ctx, cond == Cond::e ? MOp::and_ : MOp::or_, 1, { dst, parity });
+    }
+  } else {
+    emit_setcc(ctx, emit_int_compare(ctx, v), dst);
+  }
+
+  emit(ctx, MOp::movzx, 4, { dst, dst }).src_size = 1;
+}
+
+// Sets the flags for a branch or select on `cond` and returns the condition
+// that holds if it is non-zero.
+static Cond
+emit_condition(SelectContext& ctx, ir::ValueId cond)
+{
+  if (ctx.part[cond] == TreePart::flags)
+    return emit_int_compare(ctx, cond);
+
+  const uint8_t size = type_size(ctx.fn.instrs[cond].type());
+  const Operand c    = use(ctx, cond, false);
+
+  emit(ctx, MOp::test, size, { c, c });
+  return Cond::ne;
+}
+
+// cmov only reads registers and memory, the value if the condition fails is
+// moved into place first, then replaced if it holds.
+static void
+select_conditional(SelectContext& ctx, ir::ValueId v)
+{
+  const uint8_t size = op_size(ctx.fn.instrs[v].type());
+  const Operand dst  = def(ctx, v);
+  const Operand t    = use(ctx, ctx.fn.operand(v, 1), false);
+  const Operand f    = use(ctx, ctx.fn.operand(v, 2), true, size);
+
+  emit(ctx, MOp::mov, size, { dst, f });
+
+  const Cond cond = emit_condition(ctx, ctx.fn.operand(v, 0));
+  emit(ctx, MOp::cmov, size, { dst, t }).cond = cond;
+}
+
+static Operand
+float_constant(SelectContext& ctx, LangType type, double value)
+{
+  VarValue bits;
+  bits.u64_value = 0;
+
+  if (type == LangType::lt_f32)
+    bits.f32_value = static_cast<float>(value);
+  else
+    bits.f64_value = value;
+
+  return materialize_float(ctx, type, bits.u64_value);
+}
+
+// u64 -> float. Values with the top bit set are halved (keeping the lowest
+// bit sticky for rounding), converted as signed and scaled back by 2.
+static void
+select_u64_to_float(SelectContext& ctx, LangType to, Operand x, Operand dst)
+{
+  const uint8_t size = type_size(to);
+  const Operand half = new_vreg(ctx, RegClass::gpr);
+  const Operand low  = new_vreg(ctx, RegClass::gpr);
+  const Operand src  = new_vreg(ctx, RegClass::gpr);
+
+  emit(ctx, MOp::mov, 8, { half, x });
+  emit(ctx, MOp::shr, 8, { half, imm(1) });
+  emit(ctx, MOp::mov, 8, { low, x });
+  emit(ctx, MOp::and_, 8, { low, imm(1) });
+  emit(ctx, MOp::or_, 8, { half, low });
+
+  VarValue one, two;
+  one.u64_value = two.u64_value = 0;
+
+  if (to == LangType::lt_f32) {
+    one.f32_value = 1.0f;
+    two.f32_value = 2.0f;
+  } else {
+    one.f64_value = 1.0;
+    two.f64_value = 2.0;
+  }
+
+  const Operand scale  = materialize_bits(ctx, one.u64_value);
+  const Operand doubled = materialize_bits(ctx, two.u64_value);
+
+  emit(ctx, MOp::mov, 8, { src, x });
+  emit(ctx, MOp::test, 8, { x, x });
+  emit(ctx, MOp::cmov, 8, { src, half }).cond   = Cond::s;
+  emit(ctx, MOp::cmov, 8, { scale, doubled }).cond = Cond::s;
+
+  const Operand factor = new_vreg(ctx, RegClass::xmm);
+
+  emit(ctx, MOp::cvtsi2s, size, { dst, src }).src_size = 8;
+  emit(ctx, MOp::movq, size, { factor, scale });
+  emit(ctx, MOp::muls, size, { dst, factor });
+}
+
+// float -> u64. Values from 2^63 on are converted after subtracting 2^63,
+// which the invalid result 0x8000000000000000 of the direct conversion then
+// supplies back as the top bit.
+static void
+select_float_to_u64(SelectContext& ctx, LangType from, Operand x, Operand dst)
+{
+  const uint8_t size    = type_size(from);
+  const Operand direct  = new_vreg(ctx, RegClass::gpr);
+  const Operand shifted = new_vreg(ctx, RegClass::gpr);
+  const Operand mask    = new_vreg(ctx, RegClass::gpr);
+  const Operand y       = new_vreg(ctx, RegClass::xmm);
+
+  emit(ctx, MOp::cvtts2si, 8, { direct, x }).src_size = size;
+  emit(ctx, MOp::movs, size, { y, x });
+  emit(ctx, MOp::subs, size, { y, float_constant(ctx, from, 0x1p63) });
+  emit(ctx, MOp::cvtts2si, 8, { shifted, y }).src_size = size;
+  emit(ctx, MOp::mov, 8, { mask, direct });
+  emit(ctx, MOp::sar, 8, { mask, imm(63) });
+  emit(ctx, MOp::and_, 8, { shifted, mask });
+  emit(ctx, MOp::or_, 8, { shifted, direct });
+  emit(ctx, MOp::mov, 8, { dst, shifted });
+}
+
+static void
+select_conversion(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr&  instr   = ctx.fn.instrs[v];
+  const ir::ValueId operand = ctx.fn.operand(v, 0);
+  const LangType    from    = ctx.fn.instrs[operand].type();
+  const LangType    to      = instr.type();
+  const Operand     dst     = def(ctx, v);
+  const Operand     x       = use(ctx, operand, false);
+
+  switch (static_cast<ConvKind>(instr.imm)) {
+    case ConvKind::none:
+    case ConvKind::trunc:
+      emit_move(ctx, to, dst, x);
+      return;
+
+    case ConvKind::sext:
+      emit(ctx, MOp::movsx, op_size(to), { dst, x }).src_size =
+        type_size(from);
+      return;
+
+    case ConvKind::zext:
+      // 32 bit operations clear the upper half.
+      if (type_size(from) == 4)
+        emit(ctx, MOp::mov, 4, { dst, x });
+      else
+        emit(ctx, MOp::movzx, 4, { dst, x }).src_size = type_size(from);
+      return;
+
+    case ConvKind::sitofp: {
+      const Operand src = widen(ctx, from, x);
+      emit(ctx, MOp::cvtsi2s, type_size(to), { dst, src }).src_size =
+        op_size(from);
+      return;
+    }
+
+    case ConvKind::uitofp: {
+      if (type_size(from) == 8) {
+        select_u64_to_float(ctx, to, x, dst);
+        return;
+      }
+
+      // Zero extended to 64 bits it converts as a non negative signed value.
+      const Operand src = new_vreg(ctx, RegClass::gpr);
+
+      if (type_size(from) == 4)
+        emit(ctx, MOp::mov, 4, { src, x });
+      else
+        emit(ctx, MOp::movzx, 4, { src, x }).src_size = type_size(from);
+
+      emit(ctx, MOp::cvtsi2s, type_size(to), { dst, src }).src_size = 8;
+      return;
+    }
+
+    case ConvKind::fptosi:
+      emit(ctx, MOp::cvtts2si, op_size(to), { dst, x }).src_size =
+        type_size(from);
+      return;
+
+    case ConvKind::fptoui:
+      if (type_size(to) == 8) {
+        select_float_to_u64(ctx, from, x, dst);
+        return;
+      }
+
+      emit(ctx, MOp::cvtts2si, 8, { dst, x }).src_size = type_size(from);
+      return;
+
+    case ConvKind::fpext:
+    case ConvKind::fptrunc:
+      emit(ctx, MOp::cvts2s, type_size(to), { dst, x }).src_size =
+        type_size(from);
+      return;
+
+    case ConvKind::invalid:
+      break;
+  }
+
+  panic("Internal error: invalid conversion reached instruction selection");
+}
+
+// Where the System V convention passes each of `types`: a register, or the
+// stack argument number when the register class ran out.
+struct ArgLocation
+{
+  Reg      reg;
+  uint32_t stack;
+};
+
+static std::vector<ArgLocation>
+classify_args(const std::vector<LangType>& types)
+{
+  std::vector<ArgLocation> locations;
+  size_t                   ints = 0, floats = 0;
+  uint32_t                 stack = 0;
+
+  for (const LangType type : types) {
+    if (is_float(type) && floats < std::size(FLOAT_ARG_REGS))
+      locations.push_back({ FLOAT_ARG_REGS[floats++], 0 });
+    else if (!is_float(type) && ints < std::size(INT_ARG_REGS))
+      locations.push_back({ INT_ARG_REGS[ints++], 0 });
+    else
+      locations.push_back({ Reg::none, stack++ });
+  }
+
+  return locations;
+}
+
+static std::vector<LangType>
+arg_types(const ir::Function& fn, ir::ValueId call)
+{
+  std::vector<LangType> types;
+
+  for (size_t i = 0; i < fn.instrs[call].num_operands; ++i)
+    types.push_back(fn.instrs[fn.operand(call, i)].type());
+
+  return types;
+}
+
+/*
+ * Sibling calls: calls whose result, if any, the next instruction returns,
+ * with every argument in a register. The callee can return to our caller
+ * itself, so the frame is torn down and the call becomes a jump. The
+ * callee finds the stack as we did, with our caller's return address on
+ * top, which is all System V asks for. Stack arguments would have to go
+ * where our own incoming ones are and are not done.
+ */
+static void
+find_sibling_calls(SelectContext& ctx)
+{
+  const ir::Function& fn = ctx.fn;
+  ctx.sibling.assign(fn.instrs.size(), 0);
+
+  for (const auto& block : fn.blocks) {
+    const auto& order = block.instrs;
+
+    if (order.size() < 2)
+      continue;
+
+    const ir::ValueId ret  = order.back();
+    const ir::ValueId call = order[order.size() - 2];
+
+    if (fn.instrs[ret].op != ir::Opcode::ret ||
+        fn.instrs[call].op != ir::Opcode::call)
+      continue;
+
+    const bool returned = fn.instrs[ret].num_operands == 0
+                            ? fn.instrs[call].type() == LangType::lt_void
+                            : fn.operand(ret, 0) == call;
+
+    if (!returned)
+      continue;
+
+    const auto locations = classify_args(arg_types(fn, call));
+    const auto in_reg    = [](const ArgLocation& loc) {
+      return loc.reg != Reg::none;
+    };
+
+    if (std::all_of(locations.begin(), locations.end(), in_reg))
+      ctx.sibling[call] = ctx.sibling[ret] = 1;
+  }
+}
+
+static void
+select_call(SelectContext& ctx, ir::ValueId v)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+  const size_t     argc  = instr.num_operands;
+
+  const std::vector<LangType> types     = arg_types(ctx.fn, v);
+  const auto                  locations = classify_args(types);
+  uint32_t   stack     = 0;
+
+  for (const auto& loc : locations)
+    stack += loc.reg == Reg::none;
+
+  // Stack arguments are pushed right to left, keeping rsp 16 byte aligned
+  // at the call.
+  const uint32_t pad = stack % 2;
+
+  if (pad)
+    emit(ctx, MOp::sub, 8, { preg(Reg::rsp), imm(8) });
+
+  for (size_t i = argc; i-- > 0;) {
+    if (locations[i].reg != Reg::none)
+      continue;
+
+    const ir::ValueId arg = ctx.fn.operand(v, i);
+
+    if (is_float(types[i])) {
+      const Operand bits = new_vreg(ctx, RegClass::gpr);
+      emit(ctx, MOp::movq, 8, { bits, use(ctx, arg, false) });
+      emit(ctx, MOp::push, 8, { bits });
+    } else {
+      emit(ctx, MOp::push, 8, { use(ctx, arg, true) });
+    }
+  }
+
+  MInstr call{ .op = ctx.sibling[v] ? MOp::tail_call : MOp::call, .size = 8 };
+
+  for (size_t i = 0; i < argc; ++i) {
+    const ArgLocation& loc = locations[i];
+
+    if (loc.reg == Reg::none)
+      continue;
+
+    emit_move(ctx, types[i], preg(loc.reg), use(ctx, ctx.fn.operand(v, i), true));
+
+    if (is_xmm(loc.reg))
+      ++call.float_args;
+    else
+      ++call.int_args;
+  }
+
+  call.ops[call.num_ops++] = Operand{ OperandKind::func,
+                                      static_cast<uint32_t>(instr.imm),
+                                      0 };
+  ctx.mfn.blocks[ctx.current].instrs.push_back(call);
+
+  // The callee returns to our caller.
+  if (call.op == MOp::tail_call)
+    return;
+
+  ctx.mfn.leaf = false;
+
+  if (stack + pad != 0)
+    emit(ctx, MOp::add, 8, { preg(Reg::rsp), imm(8 * (stack + pad)) });
+
+  if (instr.type() == LangType::lt_void)
+    return;
+
+  emit_move(ctx,
+            instr.type(),
+            def(ctx, v),
+            preg(is_float(instr.type()) ? Reg::xmm0 : Reg::rax));
+}
+
+static size_t
+pred_index(const ir::Function& fn, ir::BlockId block, ir::BlockId pred)
+{
+  const auto& preds = fn.blocks[block].preds;
+  return std::find(preds.begin(), preds.end(), pred) - preds.begin();
+}
+
+// Copies the incoming values of the phis of `succ` on the edge from `pred`.
+// The copies have parallel semantics, so they go through fresh registers.
+static void
+emit_phi_copies(SelectContext& ctx, ir::BlockId pred, ir::BlockId succ)
+{
+  const size_t         k = pred_index(ctx.fn, succ, pred);
+  std::vector<Operand> temps;
+
+  for (const ir::ValueId phi : ctx.fn.blocks[succ].instrs) {
+    if (ctx.fn.instrs[phi].op != ir::Opcode::phi)
+      break;
+
+    const LangType type = ctx.fn.instrs[phi].type();
+    const Operand  t    = new_vreg(ctx, class_of(type));
+
+    emit_move(ctx, type, t, use(ctx, ctx.fn.operand(phi, k), true));
+    temps.push_back(t);
+  }
+
+  size_t i = 0;
+
+  for (const ir::ValueId phi : ctx.fn.blocks[succ].instrs) {
+    if (ctx.fn.instrs[phi].op != ir::Opcode::phi)
+      break;
+
+    emit_move(ctx, ctx.fn.instrs[phi].type(), def(ctx, phi), temps[i++]);
+  }
+}
+
+static bool
+has_phis(const ir::Function& fn, ir::BlockId block)
+{
+  const auto& instrs = fn.blocks[block].instrs;
+  return !instrs.empty() && fn.instrs[instrs[0]].op == ir::Opcode::phi;
+}
+
+// Target of the edge pred -> succ. Edges into blocks with phis get a block
+// of their own holding the phi copies, which also splits critical edges.
+static uint32_t
+edge_target(SelectContext& ctx, ir::BlockId pred, ir::BlockId succ)
+{
+  if (!has_phis(ctx.fn, succ))
+    return ctx.block_map[succ];
+
+  const uint32_t saved = ctx.current;
+
+  ctx.mfn.blocks.emplace_back();
+  ctx.current = static_cast<uint32_t>(ctx.mfn.blocks.size() - 1);
+
+  emit_phi_copies(ctx, pred, succ);
+  emit(ctx, MOp::jmp, 8, { label(ctx.block_map[succ]) });
+
+  const uint32_t split = ctx.current;
+  ctx.current          = saved;
+  return split;
+}
+
+static void
+select_params(SelectContext& ctx)
+{
+  const auto locations = classify_args(ctx.fn.params);
+
+  for (const ir::ValueId v : ctx.fn.blocks[0].instrs) {
+    const ir::Instr& instr = ctx.fn.instrs[v];
+
+    if (instr.op != ir::Opcode::param)
+      continue;
+
+    const ArgLocation& loc = locations[instr.imm];
+    const Operand      src =
+      loc.reg != Reg::none ? preg(loc.reg)
+                           : Operand{ OperandKind::arg, loc.stack, 0 };
+
+    emit_move(ctx, instr.type(), def(ctx, v), src);
+  }
+}
+
+static void
+select_instr(SelectContext& ctx, ir::BlockId b, ir::ValueId v)
+{
+  const ir::Instr& instr = ctx.fn.instrs[v];
+
+  switch (instr.op) {
+    case ir::Opcode::nop:
+    case ir::Opcode::param:
+    case ir::Opcode::constant:
+    case ir::Opcode::phi:
+      return;
+
+    case ir::Opcode::add:
+    case ir::Opcode::sub:
+    case ir::Opcode::mul:
+    case ir::Opcode::bit_and:
+    case ir::Opcode::bit_or:
+    case ir::Opcode::bit_xor:
+      if (instr.lanes > 1)
+        select_packed_binary(ctx, v);
+      else if (is_float(instr.type()))
+        select_binary(ctx, v);
+      else if (ctx.part[v] == TreePart::none)
+        select_tree(ctx, v);
+      return;
+
+    case ir::Opcode::div:
+      if (instr.lanes > 1)
+        select_packed_binary(ctx, v);
+      else if (is_float(instr.type()))
+        select_binary(ctx, v);
+      else
+        select_division(ctx, v);
+      return;
+
+    case ir::Opcode::mod:
+      select_division(ctx, v);
+      return;
+
+    case ir::Opcode::shl:
+      if (ctx.part[v] == TreePart::none)
+        select_tree(ctx, v);
+      return;
+
+    case ir::Opcode::shr:
+    case ir::Opcode::sar:
+      select_shift(ctx, v);
+      return;
+
+    case ir::Opcode::mulhi:
+      select_mulhi(ctx, v);
+      return;
+
+    case ir::Opcode::cmp_lt:
+    case ir::Opcode::cmp_le:
+    case ir::Opcode::cmp_gt:
+    case ir::Opcode::cmp_ge:
+    case ir::Opcode::cmp_eq:
+    case ir::Opcode::cmp_ne:
+      if (ctx.part[v] != TreePart::flags)
+        select_compare(ctx, v);
+      return;
+
+    case ir::Opcode::select:
+      select_conditional(ctx, v);
+      return;
+
+    case ir::Opcode::conv:
+      select_conversion(ctx, v);
+      return;
+
+    case ir::Opcode::pack:
+      select_pack(ctx, v);
+      return;
+
+    case ir::Opcode::extract:
+      select_extract(ctx, v);
+      return;
+
+    case ir::Opcode::gload: {
+      const LangType type = instr.type();
+
+      if (ctx.part[v] == TreePart::memory)
+        return;
+
+      if (is_float(type))
+        emit(ctx, MOp::movs, type_size(type), { def(ctx, v), global(instr.imm) });
+      else
+        emit(ctx, MOp::mov, type_size(type), { def(ctx, v), global(instr.imm) });
+      return;
+    }
+
+    case ir::Opcode::gstore: {
+      const ir::ValueId value = ctx.fn.operand(v, 0);
+      const LangType    type  = ctx.module.globals[instr.imm].type;
+      const uint8_t     size  = type_size(type);
+
+      if (is_float(type))
+        emit(ctx, MOp::movs, size, { global(instr.imm), use(ctx, value, false) });
+      else
+        emit(ctx, MOp::mov, size, { global(instr.imm), use(ctx, value, true, size) });
+      return;
+    }
+
+    case ir::Opcode::aload:
+    case ir::Opcode::astore:
+      select_element(ctx, v);
+      return;
+
+    case ir::Opcode::bounds:
+      select_bounds(ctx, v);
+      return;
+
+    case ir::Opcode::call:
+      select_call(ctx, v);
+      return;
+
+    case ir::Opcode::br: {
+      const ir::BlockId succ = ctx.fn.blocks[b].succs[0];
+
+      if (has_phis(ctx.fn, succ))
+        emit_phi_copies(ctx, b, succ);
+
+      emit(ctx, MOp::jmp, 8, { label(ctx.block_map[succ]) });
+      return;
+    }
+
+    case ir::Opcode::condbr: {
+      const ir::ValueId cond = ctx.fn.operand(v, 0);
+      const LangType    type = ctx.fn.instrs[cond].type();
+      const auto&       succ = ctx.fn.blocks[b].succs;
+
+      if (is_float(type))
+        break;
+
+      const uint32_t taken = edge_target(ctx, b, succ[0]);
+      const uint32_t other = edge_target(ctx, b, succ[1]);
+
+      const Cond cc = emit_condition(ctx, cond);
+
+      emit(ctx, MOp::jcc, 8, { label(taken) }).cond = cc;
+      emit(ctx, MOp::jmp, 8, { label(other) });
+      return;
+    }
+
+    case ir::Opcode::ret: {
+      bool float_result = false, int_result = false;
+
+      // The sibling call before it returned already.
+      if (ctx.sibling[v])
+        return;
+
+      if (instr.num_operands != 0) {
+        const ir::ValueId value = ctx.fn.operand(v, 0);
+        const LangType    type  = ctx.fn.instrs[value].type();
+
+        float_result = is_float(type);
+        int_result   = !float_result;
+
+        emit_move(ctx,
+                  type,
+                  preg(float_result ? Reg::xmm0 : Reg::rax),
+                  use(ctx, value, true));
+      }
+
+      // The return register is read by the caller, like an argument.
+      MInstr& ret    = emit(ctx, MOp::ret, 8);
+      ret.int_args   = int_result;
+      ret.float_args = float_result;
+      return;
+    }
+
+    case ir::Opcode::local:
+    case ir::Opcode::load:
+    case ir::Opcode::store:
+      break;
+  }
+
+  panic("Internal error: unsupported instruction in instruction selection");
+}
+
+MFunction
+select_function(const ir::Module&     module,
+                const ir::Function&   fn,
+                const CompileOptions& options)
+{
+  MFunction     mfn{ .name = fn.name };
+  SelectContext ctx{
+    .module = module, .fn = fn, .mfn = mfn, .options = options
+  };
+
+  find_trees(ctx);
+  find_sibling_calls(ctx);
+  ctx.labels.resize(fn.instrs.size());
+  ctx.vreg_of.assign(fn.instrs.size(), ir::NONE);
+
+  // Values inside trees live in the registers their reduction picks.
+  for (ir::ValueId v = 0; v < fn.instrs.size(); ++v) {
+    const ir::Instr& instr = fn.instrs[v];
+
+    if (instr.type() == LangType::lt_void || instr.op == ir::Opcode::constant ||
+        instr.op == ir::Opcode::nop || ctx.part[v] != TreePart::none)
+      continue;
+
+    if (instr.lanes == 1) {
+      ctx.vreg_of[v] = mfn.new_vreg(class_of(instr.type()));
+    } else if (instr.lanes * type_size(instr.type()) < 32) {
+      ctx.vreg_of[v] = mfn.new_vreg(RegClass::vec);
+    } else if (options.avx2) {
+      ctx.vreg_of[v] = mfn.new_vreg(RegClass::ymm);
+    } else {
+      ctx.vreg_of[v] = mfn.new_vreg(RegClass::vec);
+      mfn.new_vreg(RegClass::vec);
+    }
+  }
+
+  // Empty blocks are what constant propagation left of unreachable code.
+  ctx.block_map.assign(fn.blocks.size(), ir::NONE);
+
+  for (ir::BlockId b = 0; b < fn.blocks.size(); ++b) {
+    if (b == 0 || !fn.blocks[b].instrs.empty()) {
+      ctx.block_map[b] = static_cast<uint32_t>(mfn.blocks.size());
+      mfn.blocks.emplace_back();
+    }
+  }
+
+  select_params(ctx);
+  select_arrays(ctx);
+
+  for (ir::BlockId b = 0; b < fn.blocks.size(); ++b) {
+    if (ctx.block_map[b] == ir::NONE)
+      continue;
+
+    ctx.current = ctx.block_map[b];
+
+    for (const ir::ValueId v : fn.blocks[b].instrs)
+      select_instr(ctx, b, v);
+  }
+
+  return mfn;
+}
+
+} // namespace wcc::x64
@@ -0,0 +1,84 @@
+#include "x64.h"
+
+namespace wcc::x64 {
+
+std::vector<uint32_t>
+block_successors(const MFunction& fn, uint32_t block)
+{
+  const auto&           instrs = fn.blocks[block].instrs;
+  std::vector<uint32_t> succs;
+
+  for (auto it = instrs.rbegin();
+       it != instrs.rend() && (it->op == MOp::jmp || it->op == MOp::jcc);
+       ++it)
+    succs.push_back(it->ops[0].value);
+
+  const MOp  last = instrs.empty() ? MOp::jmp : instrs.back().op;
+  const bool falls_through =
+    instrs.empty() ||
+    (last != MOp::jmp && last != MOp::ret && last != MOp::tail_call &&
+     last != MOp::ud2);
+
+  if (falls_through && block + 1 < fn.blocks.size())
+    succs.push_back(block + 1);
+
+  return succs;
+}
+
+Liveness
+compute_liveness(const MFunction& fn)
+{
+  const size_t n     = fn.blocks.size();
+  const size_t vregs = fn.vregs.size();
+
+  // Upward exposed uses and definitions of every block.
+  std::vector<DenseBitset>           gen(n, DenseBitset(vregs));
+  std::vector<DenseBitset>           kill(n, DenseBitset(vregs));
+  std::vector<std::vector<uint32_t>> succs(n);
+
+  for (uint32_t b = 0; b < n; ++b) {
+    succs[b] = block_successors(fn, b);
+
+    for (const MInstr& instr : fn.blocks[b].instrs) {
+      for (size_t i = 0; i < instr.num_ops; ++i) {
+        const Operand& op = instr.ops[i];
+
+        if (op.is_vreg() && (operand_use(instr, i) & USE) &&
+            !kill[b].test(op.value))
+          gen[b].set(op.value);
+      }
+
+      for (size_t i = 0; i < instr.num_ops; ++i) {
+        const Operand& op = instr.ops[i];
+
+        if (op.is_vreg() && (operand_use(instr, i) & DEF))
+          kill[b].set(op.value);
+      }
+    }
+  }
+
+  Liveness live{ std::vector<DenseBitset>(n, DenseBitset(vregs)),
+                 std::vector<DenseBitset>(n, DenseBitset(vregs)) };
+
+  for (uint32_t b = 0; b < n; ++b)
+    live.live_in[b].unite(gen[b]);
+
+  // Backward problem, visiting blocks last to first converges in few rounds
+  // on code laid out in program order.
+  bool changed = true;
+
+  while (changed) {
+    changed = false;
+
+    for (size_t b = n; b-- > 0;) {
+      for (const uint32_t s : succs[b])
+        live.live_out[b].unite(live.live_in[s]);
+
+      changed |= live.live_in[b].unite_difference(live.live_out[b], kill[b]);
+    }
+  }
+
+  return live;
+}
+
+} // namespace wcc::x64
@@ -0,0 +1,743 @@
+#include "ir.h"
+#include "util.h"
+#include "x64.h"
+
+#include <algorithm>
+
+namespace wcc::x64 {
+
+/*
+ * Linear scan register allocation after Poletto and Sarkar, "Linear Scan
+ * Register Allocation" (TOPLAS 1999), with the spilled interval split at the
+ * point of conflict instead of spilled as a whole.
+ *
+ * Instructions are numbered in layout order, instruction i reads its
+ * operands at position 2i and writes its results at 2i + 1. A virtual
+ * register's interval spans every position it is live at according to the
+ * block liveness sets, lifetime holes included. Physical registers named by
+ * instruction selection (argument and return registers, rax/rdx around
+ * division, everything a call clobbers) become fixed ranges no interval may
+ * overlap in the same register.
+ *
+ * An interval that loses its register at position p keeps it before p and
+ * lives in its stack slot from p on. Every definition of a split interval
+ * also stores to the slot, so the slot is valid wherever the register part
+ * ends and only edges into a block that expects the value in its register
+ * need a reload. Slot operands go through scratch registers reserved for
+ * that (r10/r11 and xmm14/xmm15).
+ */
+
+constexpr Reg GPR_SCRATCH[] = { Reg::r11, Reg::r10 };
+constexpr Reg XMM_SCRATCH[] = { Reg::xmm15, Reg::xmm14 };
+
+// Caller saved registers first, callee saved ones cost a push and a pop.
+constexpr Reg GPR_ALLOCATABLE[] = { Reg::rax, Reg::rcx, Reg::rdx, Reg::rsi,
+                                    Reg::rdi, Reg::r8,  Reg::r9,  Reg::rbx,
+                                    Reg::r12, Reg::r13, Reg::r14, Reg::r15 };
+
+constexpr Reg XMM_ALLOCATABLE[] = {
+  Reg::xmm0,  Reg::xmm1,  Reg::xmm2,  Reg::xmm3, Reg::xmm4,
+  Reg::xmm5,  Reg::xmm6,  Reg::xmm7,  Reg::xmm8, Reg::xmm9,
+  Reg::xmm10, Reg::xmm11, Reg::xmm12, Reg::xmm13,
+};
+
+constexpr uint32_t NO_POS = ~uint32_t(0);
+
+struct Interval
+{
+  uint32_t vreg;
+  uint32_t start      = NO_POS;
+  uint32_t end        = 0;
+  Reg      reg        = Reg::none;
+  uint32_t spill_from = NO_POS; // the value lives in its slot from here on
+  uint32_t slot       = NO_POS;
+
+  // Register or interval this one is copied from or to, tried first.
+  Reg      hint      = Reg::none;
+  uint32_t hint_vreg = ir::NONE;
+
+  void extend(uint32_t pos)
+  {
+    start = std::min(start, pos);
+    end   = std::max(end, pos);
+  }
+
+  bool in_register(uint32_t pos) const
+  {
+    return reg != Reg::none && pos < spill_from;
+  }
+};
+
+struct Range
+{
+  uint32_t start, end;
+};
+
+struct AllocContext
+{
+  MFunction& fn;
+
+  std::vector<uint32_t>           block_start, block_end;
+  std::vector<Interval>           intervals; // by virtual register
+  std::vector<std::vector<Range>> fixed;     // by physical register
+};
+
+static bool
+is_allocatable(Reg r)
+{
+  const auto contains = [r](const auto& regs) {
+    return std::find(std::begin(regs), std::end(regs), r) != std::end(regs);
+  };
+
+  return contains(GPR_ALLOCATABLE) || contains(XMM_ALLOCATABLE);
+}
+
+static void
+fixed_use(AllocContext& ctx, Reg r, uint32_t pos)
+{
+  if (!is_allocatable(r))
+    return;
+
+  auto& ranges = ctx.fixed[underlay_cast(r)];
+
+  // Read without a definition in the function: an incoming argument.
+  if (ranges.empty())
+    ranges.push_back({ 0, pos });
+  else
+    ranges.back().end = std::max(ranges.back().end, pos);
+}
+
+static void
+fixed_def(AllocContext& ctx, Reg r, uint32_t pos)
+{
+  if (is_allocatable(r))
+    ctx.fixed[underlay_cast(r)].push_back({ pos, pos });
+}
+
+static void
+implicit_uses(AllocContext& ctx, const MInstr& instr, uint32_t pos)
+{
+  switch (instr.op) {
+    case MOp::call:
+    case MOp::tail_call:
+      for (size_t i = 0; i < instr.int_args; ++i)
+        fixed_use(ctx, INT_ARG_REGS[i], pos);
+      for (size_t i = 0; i < instr.float_args; ++i)
+        fixed_use(ctx, FLOAT_ARG_REGS[i], pos);
+      break;
+    case MOp::cdq:
+      fixed_use(ctx, Reg::rax, pos);
+      break;
+    case MOp::idiv:
+    case MOp::div:
+      fixed_use(ctx, Reg::rax, pos);
+      fixed_use(ctx, Reg::rdx, pos);
+      break;
+    case MOp::imulw:
+    case MOp::mulw:
+      fixed_use(ctx, Reg::rax, pos);
+      break;
+    case MOp::rep_stos:
+      fixed_use(ctx, Reg::rax, pos);
+      fixed_use(ctx, Reg::rcx, pos);
+      fixed_use(ctx, Reg::rdi, pos);
+      break;
+    case MOp::ret:
+      if (instr.int_args)
+        fixed_use(ctx, Reg::rax, pos);
+      if (instr.float_args)
+        fixed_use(ctx, Reg::xmm0, pos);
+      break;
+    default:
+      break;
+  }
+}
+
+static void
+implicit_defs(AllocContext& ctx, const MInstr& instr, uint32_t pos)
+{
+  switch (instr.op) {
+    case MOp::call:
+      for (const Reg r : GPR_ALLOCATABLE) {
+        if (!is_callee_saved(r))
+          fixed_def(ctx, r, pos);
+      }
+      for (const Reg r : XMM_ALLOCATABLE)
+        fixed_def(ctx, r, pos);
+      break;
+    case MOp::cdq:
+      fixed_def(ctx, Reg::rdx, pos);
+      break;
+    case MOp::idiv:
+    case MOp::div:
+    case MOp::imulw:
+    case MOp::mulw:
+      fixed_def(ctx, Reg::rax, pos);
+      fixed_def(ctx, Reg::rdx, pos);
+      break;
+    case MOp::rep_stos:
+      fixed_def(ctx, Reg::rcx, pos);
+      fixed_def(ctx, Reg::rdi, pos);
+      break;
+    default:
+      break;
+  }
+}
+
+static bool
+is_copy(const MInstr& instr)
+{
+  return (instr.op == MOp::mov || instr.op == MOp::movs) &&
+         instr.num_ops == 2 && !instr.ops[0].is_mem() &&
+         !instr.ops[1].is_mem() && !instr.ops[1].is_imm();
+}
+
+static void
+build_intervals(AllocContext& ctx, const Liveness& live)
+{
+  MFunction& fn  = ctx.fn;
+  uint32_t   pos = 0;
+
+  ctx.intervals.resize(fn.vregs.size());
+  ctx.fixed.resize(REG_COUNT);
+
+  for (uint32_t v = 0; v < fn.vregs.size(); ++v)
+    ctx.intervals[v].vreg = v;
+
+  for (size_t b = 0; b < fn.blocks.size(); ++b) {
+    ctx.block_start.push_back(pos);
+
+    for (const MInstr& instr : fn.blocks[b].instrs) {
+      for (size_t i = 0; i < instr.num_ops; ++i) {
+        const Operand& op    = instr.ops[i];
+        const uint8_t  flags = operand_use(instr, i);
+
+        if (op.is_vreg()) {
+          if (flags & USE)
+            ctx.intervals[op.value].extend(pos);
+          if (flags & DEF)
+            ctx.intervals[op.value].extend(pos + 1);
+        } else if (op.is_reg() && (flags & USE)) {
+          fixed_use(ctx, op.reg(), pos);
+        }
+      }
+
+      implicit_uses(ctx, instr, pos);
+      implicit_defs(ctx, instr, pos + 1);
+
+      for (size_t i = 0; i < instr.num_ops; ++i) {
+        if (instr.ops[i].is_reg() && (operand_use(instr, i) & DEF))
+          fixed_def(ctx, instr.ops[i].reg(), pos + 1);
+      }
+
+      if (is_copy(instr)) {
+        const Operand& dst = instr.ops[0];
+        const Operand& src = instr.ops[1];
+
+        if (dst.is_vreg() && src.is_reg())
+          ctx.intervals[dst.value].hint = src.reg();
+        else if (dst.is_reg() && src.is_vreg())
+          ctx.intervals[src.value].hint = dst.reg();
+        else if (dst.is_vreg() && src.is_vreg())
+          ctx.intervals[dst.value].hint_vreg = src.value;
+      }
+
+      pos += 2;
+    }
+
+    ctx.block_end.push_back(pos - 1);
+  }
+
+  for (size_t b = 0; b < fn.blocks.size(); ++b) {
+    live.live_in[b].for_each(
+      [&](size_t v) { ctx.intervals[v].extend(ctx.block_start[b]); });
+    live.live_out[b].for_each(
+      [&](size_t v) { ctx.intervals[v].extend(ctx.block_end[b]); });
+  }
+}
+
+static bool
+fixed_conflict(const AllocContext& ctx, Reg r, const Interval& interval)
+{
+  for (const Range& range : ctx.fixed[underlay_cast(r)]) {
+    if (range.start <= interval.end && interval.start <= range.end)
+      return true;
+  }
+
+  return false;
+}
+
+static void
+allocate_interval(AllocContext&           ctx,
+                  std::vector<Interval*>& active,
+                  Interval&               cur)
+{
+  const bool xmm = in_xmm(ctx.fn.vregs[cur.vreg]);
+
+  const auto usable = [&](Reg r) {
+    if (r == Reg::none || is_xmm(r) != xmm || !is_allocatable(r))
+      return false;
+
+    for (const Interval* a : active) {
+      if (a->reg == r)
+        return false;
+    }
+
+    return !fixed_conflict(ctx, r, cur);
+  };
+
+  Reg choice = Reg::none;
+
+  if (cur.hint_vreg != ir::NONE && usable(ctx.intervals[cur.hint_vreg].reg))
+    choice = ctx.intervals[cur.hint_vreg].reg;
+  else if (usable(cur.hint))
+    choice = cur.hint;
+  else if (xmm) {
+    for (const Reg r : XMM_ALLOCATABLE) {
+      if (usable(r)) {
+        choice = r;
+        break;
+      }
+    }
+  } else {
+    for (const Reg r : GPR_ALLOCATABLE) {
+      if (usable(r)) {
+        choice = r;
+        break;
+      }
+    }
+  }
+
+  if (choice != Reg::none) {
+    cur.reg = choice;
+    active.push_back(&cur);
+    return;
+  }
+
+  // Spill the interval ending last. If that is another one, it keeps its
+  // register up to here and continues in its slot.
+  Interval* victim = nullptr;
+
+  for (Interval* a : active) {
+    if (is_xmm(a->reg) == xmm && !fixed_conflict(ctx, a->reg, cur) &&
+        (victim == nullptr || a->end > victim->end))
+      victim = a;
+  }
+
+  if (victim != nullptr && victim->end > cur.end) {
+    cur.reg            = victim->reg;
+    victim->spill_from = cur.start;
+
+    active.erase(std::find(active.begin(), active.end(), victim));
+    active.push_back(&cur);
+    return;
+  }
+
+  cur.spill_from = cur.start;
+}
+
+static void
+linear_scan(AllocContext& ctx)
+{
+  std::vector<Interval*> order;
+
+  for (Interval& interval : ctx.intervals) {
+    if (interval.start != NO_POS)
+      order.push_back(&interval);
+  }
+
+  std::stable_sort(order.begin(), order.end(), [](auto* a, auto* b) {
+    return a->start < b->start;
+  });
+
+  std::vector<Interval*> active;
+
+  for (Interval* cur : order) {
+    const auto expired = [cur](Interval* a) { return a->end < cur->start; };
+
+    active.erase(std::remove_if(active.begin(), active.end(), expired),
+                 active.end());
+
+    allocate_interval(ctx, active, *cur);
+  }
+}
+
+static Operand
+frame_slot(uint32_t slot)
+{
+  return Operand{ OperandKind::frame, slot, 0 };
+}
+
+static MInstr
+slot_move(RegClass cls, Operand dst, Operand src)
+{
+  MInstr move{ .op = MOp::mov, .size = 8 };
+
+  if (cls == RegClass::xmm) {
+    move.op = MOp::movs;
+  } else if (cls == RegClass::vec || cls == RegClass::ymm) {
+    move.op   = MOp::movups;
+    move.size = cls == RegClass::ymm ? 32 : 16;
+  }
+
+  move.num_ops = 2;
+  move.ops[0]  = dst;
+  move.ops[1]  = src;
+  return move;
+}
+
+static bool
+is_self_move(const MInstr& instr)
+{
+  // 32 bit moves clear the upper half, they are not no-ops.
+  return (instr.op == MOp::movs || (instr.op == MOp::mov && instr.size == 8)) &&
+         instr.ops[0].is_reg() && instr.ops[0] == instr.ops[1];
+}
+
+// A move between a slot operand and a register or immediate addresses the
+// slot directly. Narrow definitions still go through a register, the slot
+// has to hold the zero extended value.
+static bool
+rewrite_to_slot(AllocContext& ctx, MInstr& instr)
+{
+  if ((instr.op != MOp::mov && instr.op != MOp::movs) || instr.num_ops != 2)
+    return false;
+
+  Operand& dst = instr.ops[0];
+  Operand& src = instr.ops[1];
+
+  // Packed values fill several slots, a scalar move covers one.
+  for (const Operand& op : instr.ops) {
+    if (op.is_vreg() && (ctx.fn.vregs[op.value] == RegClass::vec ||
+                         ctx.fn.vregs[op.value] == RegClass::ymm))
+      return false;
+  }
+
+  if (src.is_vreg() && dst.is_reg()) {
+    src = frame_slot(ctx.intervals[src.value].slot);
+    ++ctx.fn.stats.reloads;
+    return true;
+  }
+
+  if (dst.is_vreg() && (src.is_reg() || src.is_imm()) &&
+      (instr.op == MOp::movs || instr.size == 8)) {
+    if (src.is_imm() && (src.imm < INT32_MIN || src.imm > INT32_MAX))
+      return false;
+
+    dst = frame_slot(ctx.intervals[dst.value].slot);
+    ++ctx.fn.stats.stores;
+    return true;
+  }
+
+  return false;
+}
+
+// Operands living in their slot at this instruction go through scratch
+// registers, loaded before and stored after it. With three operands, as lea
+// has, a definition shares the scratch register of a value only read: the
+// reads happen before the write.
+static void
+rewrite_slot_operands(AllocContext&        ctx,
+                      MInstr&              instr,
+                      const MInstr&        original,
+                      std::vector<MInstr>& before,
+                      std::vector<MInstr>& after)
+{
+  if (rewrite_to_slot(ctx, instr))
+    return;
+
+  // The last source of an FMA is r/m and reads its slot directly, the other
+  // two take both xmm scratch registers.
+  if (is_fma(instr.op) && instr.ops[2].is_vreg()) {
+    instr.ops[2] = frame_slot(ctx.intervals[instr.ops[2].value].slot);
+    ++ctx.fn.stats.reloads;
+  }
+
+  // A store with its address and value all in slots is one scratch register
+  // short, the address is computed into the second first.
+  if (instr.op == MOp::store && instr.ops[0].is_vreg() &&
+      instr.ops[1].is_vreg() && instr.ops[2].is_vreg() &&
+      !in_xmm(ctx.fn.vregs[instr.ops[2].value])) {
+    const Operand address = preg(GPR_SCRATCH[1]);
+    const Operand base    = frame_slot(ctx.intervals[instr.ops[0].value].slot);
+    const Operand index   = frame_slot(ctx.intervals[instr.ops[1].value].slot);
+
+    MInstr scaled{ .op = MOp::lea, .size = 8, .num_ops = 3 };
+    scaled.ops[0] = address;
+    scaled.ops[2] = address;
+    scaled.scale  = instr.scale;
+
+    MInstr add{ .op = MOp::add, .size = 8, .num_ops = 2 };
+    add.ops[0] = address;
+    add.ops[1] = base;
+
+    before.push_back(slot_move(RegClass::gpr, address, index));
+    before.push_back(scaled);
+    before.push_back(add);
+    ctx.fn.stats.reloads += 2;
+
+    instr.ops[0] = address;
+    instr.ops[1] = Operand{};
+    instr.scale  = 1;
+  }
+
+  uint32_t vregs[3] = { ir::NONE, ir::NONE, ir::NONE };
+  uint8_t  flags[3] = { 0, 0, 0 };
+  Reg      regs[3]  = { Reg::none, Reg::none, Reg::none };
+  size_t   count = 0, gprs = 0, xmms = 0;
+
+  for (size_t i = 0; i < instr.num_ops; ++i) {
+    if (!instr.ops[i].is_vreg())
+      continue;
+
+    const uint32_t v = instr.ops[i].value;
+    size_t         k = 0;
+
+    while (k < count && vregs[k] != v)
+      ++k;
+
+    if (k == count)
+      vregs[count++] = v;
+
+    flags[k] |= operand_use(original, i);
+  }
+
+  for (size_t k = 0; k < count; ++k) {
+    const bool xmm = in_xmm(ctx.fn.vregs[vregs[k]]);
+
+    if (xmm ? xmms < 2 : gprs < 2) {
+      regs[k] = xmm ? XMM_SCRATCH[xmms++] : GPR_SCRATCH[gprs++];
+      continue;
+    }
+
+    for (size_t j = 0; j < k && regs[k] == Reg::none; ++j) {
+      if (in_xmm(ctx.fn.vregs[vregs[j]]) == xmm &&
+          (flags[j] | flags[k]) == (USE | DEF) && flags[j] != flags[k])
+        regs[k] = regs[j];
+    }
+
+    if (regs[k] == Reg::none)
+      panic("Internal error: out of scratch registers for slot operands");
+  }
+
+  for (size_t i = 0; i < instr.num_ops; ++i) {
+    if (!instr.ops[i].is_vreg())
+      continue;
+
+    size_t k = 0;
+
+    while (vregs[k] != instr.ops[i].value)
+      ++k;
+
+    instr.ops[i] = preg(regs[k]);
+  }
+
+  for (size_t k = 0; k < count; ++k) {
+    const RegClass cls  = ctx.fn.vregs[vregs[k]];
+    const Operand  slot = frame_slot(ctx.intervals[vregs[k]].slot);
+
+    if (flags[k] & USE) {
+      before.push_back(slot_move(cls, preg(regs[k]), slot));
+      ++ctx.fn.stats.reloads;
+    }
+
+    if (flags[k] & DEF) {
+      after.push_back(slot_move(cls, slot, preg(regs[k])));
+      ++ctx.fn.stats.stores;
+    }
+  }
+}
+
+static void
+rewrite_block(AllocContext& ctx, size_t b, uint32_t& pos)
+{
+  auto&               instrs = ctx.fn.blocks[b].instrs;
+  std::vector<MInstr> rewritten;
+
+  rewritten.reserve(instrs.size());
+
+  for (const MInstr& original : instrs) {
+    MInstr              instr = original;
+    std::vector<MInstr> before, after;
+
+    for (size_t i = 0; i < instr.num_ops; ++i) {
+      if (!instr.ops[i].is_vreg())
+        continue;
+
+      const uint8_t   flags    = operand_use(original, i);
+      const uint32_t  at       = (flags & DEF) ? pos + 1 : pos;
+      const Interval& interval = ctx.intervals[instr.ops[i].value];
+
+      if (!interval.in_register(at))
+        continue;
+
+      instr.ops[i] = preg(interval.reg);
+
+      // Split intervals keep the slot up to date.
+      if ((flags & DEF) && interval.spill_from != NO_POS) {
+        after.push_back(slot_move(ctx.fn.vregs[interval.vreg],
+                                  frame_slot(interval.slot),
+                                  preg(interval.reg)));
+        ++ctx.fn.stats.stores;
+      }
+    }
+
+    rewrite_slot_operands(ctx, instr, original, before, after);
+
+    rewritten.insert(rewritten.end(), before.begin(), before.end());
+
+    if (!is_self_move(instr))
+      rewritten.push_back(instr);
+
+    rewritten.insert(rewritten.end(), after.begin(), after.end());
+    pos += 2;
+  }
+
+  instrs = std::move(rewritten);
+}
+
+struct EdgeMoves
+{
+  uint32_t            from, to;
+  std::vector<MInstr> moves;
+};
+
+// Reloads for values the target block expects in their register but that
+// are only in their slot at the end of the source block.
+static std::vector<EdgeMoves>
+resolve_edges(AllocContext& ctx, const Liveness& live)
+{
+  std::vector<EdgeMoves> edges;
+
+  for (uint32_t b = 0; b < ctx.fn.blocks.size(); ++b) {
+    for (const uint32_t s : block_successors(ctx.fn, b)) {
+      EdgeMoves edge{ b, s, {} };
+
+      live.live_in[s].for_each([&](size_t v) {
+        const Interval& interval = ctx.intervals[v];
+
+        if (interval.in_register(ctx.block_start[s]) &&
+            !interval.in_register(ctx.block_end[b])) {
+          edge.moves.push_back(slot_move(ctx.fn.vregs[v],
+                                         preg(interval.reg),
+                                         frame_slot(interval.slot)));
+          ++ctx.fn.stats.reloads;
+        }
+      });
+
+      if (!edge.moves.empty())
+        edges.push_back(std::move(edge));
+    }
+  }
+
+  return edges;
+}
+
+static void
+insert_edge_moves(MFunction& fn, std::vector<EdgeMoves>& edges)
+{
+  std::vector<uint32_t> num_preds(fn.blocks.size(), 0);
+  std::vector<size_t>   num_succs(fn.blocks.size(), 0);
+
+  for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+    const auto succs = block_successors(fn, b);
+    num_succs[b]     = succs.size();
+
+    for (const uint32_t s : succs)
+      ++num_preds[s];
+  }
+
+  for (EdgeMoves& edge : edges) {
+    auto& from = fn.blocks[edge.from].instrs;
+
+    if (num_succs[edge.from] == 1) {
+      from.insert(from.end() - 1, edge.moves.begin(), edge.moves.end());
+      continue;
+    }
+
+    if (num_preds[edge.to] == 1) {
+      auto& to = fn.blocks[edge.to].instrs;
+      to.insert(to.begin(), edge.moves.begin(), edge.moves.end());
+      continue;
+    }
+
+    // Critical edge, give the moves a block of their own.
+    const auto split = static_cast<uint32_t>(fn.blocks.size());
+
+    for (MInstr& instr : from) {
+      if ((instr.op == MOp::jmp || instr.op == MOp::jcc) &&
+          instr.ops[0] == label(edge.to))
+        instr.ops[0] = label(split);
+    }
+
+    MInstr jump{ .op = MOp::jmp, .size = 8 };
+    jump.num_ops = 1;
+    jump.ops[0]  = label(edge.to);
+
+    edge.moves.push_back(jump);
+    fn.blocks.push_back(MBlock{ std::move(edge.moves) });
+  }
+}
+
+void
+allocate_registers(MFunction& fn)
+{
+  AllocContext   ctx{ .fn = fn };
+  const Liveness live = compute_liveness(fn);
+
+  build_intervals(ctx, live);
+  linear_scan(ctx);
+
+  SpillStats& stats = fn.stats;
+  stats             = SpillStats{};
+  fn.num_slots      = fn.array_slots;
+  fn.saved.clear();
+
+  for (Interval& interval : ctx.intervals) {
+    if (interval.start == NO_POS)
+      continue;
+
+    ++stats.intervals;
+
+    // Slots are 8 bytes, the lowest of two or four holds a packed value.
+    if (interval.spill_from != NO_POS) {
+      const RegClass cls   = fn.vregs[interval.vreg];
+      const uint32_t extra = cls == RegClass::ymm   ? 3
+                             : cls == RegClass::vec ? 1
+                                                    : 0;
+
+      interval.slot = fn.num_slots + extra;
+      fn.num_slots += 1 + extra;
+
+      if (interval.spill_from == interval.start)
+        ++stats.spilled;
+      else
+        ++stats.split;
+    }
+
+    if (interval.reg != Reg::none && is_callee_saved(interval.reg) &&
+        std::find(fn.saved.begin(), fn.saved.end(), interval.reg) ==
+          fn.saved.end())
+      fn.saved.push_back(interval.reg);
+  }
+
+  std::sort(fn.saved.begin(), fn.saved.end());
+
+  // Edges are resolved on the original numbering.
+  auto edges = resolve_edges(ctx, live);
+
+  uint32_t pos = 0;
+
+  for (size_t b = 0; b < fn.blocks.size(); ++b)
+    rewrite_block(ctx, b, pos);
+
+  insert_edge_moves(fn, edges);
+
+  // rsp is 16 byte aligned after pushing rbp, keep it that way below the
+  // callee saved registers and the slots.
+  const uint32_t saved = static_cast<uint32_t>(fn.saved.size()) * 8;
+
+  fn.frame_size = ((saved + fn.num_slots * 8 + 15) & ~15u) - saved;
+}
+
+} // namespace wcc::x64
@@ -0,0 +1,246 @@
+#include <string>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "tree_walker.h"
+#include "util.h"
+#include "vm.h"
+#include "x64.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char array_src[] = "i32 a[37];\n"
+                         "i32 b[37];\n"
+                         "i32 c[37];\n"
+                         "f64 xs[13];\n"
+                         "i32 setup(i32 n) {\n"
+                         "i32 i;\n"
+                         "for (i = 0; i < n; i = i + 1) {\n"
+                         "a[i] = i * 3;\n"
+                         "b[i] = i + 7;\n"
+                         "}\n"
+                         "return 0;\n"
+                         "}\n"
+                         "i32 vadd(i32 n, i32 k) {\n"
+                         "i32 i;\n"
+                         "for (i = 0; i < n; i = i + 1) {\n"
+                         "c[i] = a[i] * b[i] + k;\n"
+                         "}\n"
+                         "return 0;\n"
+                         "}\n"
+                         "i32 total(i32 n) {\n"
+                         "i32 s;\n"
+                         "i32 i;\n"
+                         "s = 0;\n"
+                         "for (i = 0; i < n; i = i + 1) {\n"
+                         "s = s + c[i];\n"
+                         "}\n"
+                         "return s;\n"
+                         "}\n"
+                         "i32 fill() {\n"
+                         "i32 i;\n"
+                         "f64 v;\n"
+                         "v = 1.5;\n"
+                         "for (i = 0; i < 13; i = i + 1) {\n"
+                         "xs[i] = v;\n"
+                         "v = v + 1.0;\n"
+                         "}\n"
+                         "return 0;\n"
+                         "}\n"
+                         "f64 scale(i32 n, f64 k) {\n"
+                         "f64 ys[13];\n"
+                         "f64 s;\n"
+                         "i32 i;\n"
+                         "for (i = 0; i < n; i = i + 1) {\n"
+                         "ys[i] = xs[i] * k;\n"
+                         "}\n"
+                         "s = 0.0;\n"
+                         "for (i = 0; i < n; i = i + 1) {\n"
+                         "s = s + ys[i];\n"
+                         "}\n"
+                         "return s;\n"
+                         "}\n"
+                         "i32 get(i32 i) {\n"
+                         "return a[i];\n"
+                         "}\n"
+                         "i32 twice(i32 i) {\n"
+                         "return b[i] + b[i];\n"
+                         "}\n"
+                         "i32 fresh(i32 i) {\n"
+                         "i32 t[8];\n"
+                         "i32 r;\n"
+                         "r = t[i];\n"
+                         "t[i] = 5;\n"
+                         "return r;\n"
+                         "}\n";
+
+static size_t
+count_lanes(const ir::Function& fn, ir::Opcode op, uint8_t lanes)
+{
+  size_t count = 0;
+
+  for (const auto& block : fn.blocks) {
+    for (const ir::ValueId v : block.instrs)
+      count += fn.instrs[v].op == op && fn.instrs[v].lanes == lanes;
+  }
+
+  return count;
+}
+
+// setup, vadd and total over the first n elements, as compiled with `options`.
+static int32_t
+run_jit(const ir::Module& module, x64::CompileOptions options, int32_t n)
+{
+  const x64::MModule code = x64::compile_module(module, options);
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+
+  if (jit == nullptr)
+    return -1;
+
+  jit->function<int32_t (*)(int32_t)>("setup")(n);
+  jit->function<int32_t (*)(int32_t, int32_t)>("vadd")(n, 5);
+  return jit->function<int32_t (*)(int32_t)>("total")(n);
+}
+
+static int32_t
+expected_total(int32_t n)
+{
+  int32_t s = 0;
+
+  for (int32_t i = 0; i < n; ++i)
+    s += i * 3 * (i + 7) + 5;
+
+  return s;
+}
+
+bool
+array_test()
+{
+  // Arrays are only ever subscripted, by integers.
+  TEST_ASSERT(rejects("i32 a[4];\ni32 f() {\nreturn a;\n}\n"));
+  TEST_ASSERT(rejects("i32 a;\ni32 f() {\nreturn a[0];\n}\n"));
+  TEST_ASSERT(rejects("i32 a[4];\ni32 f(f64 x) {\nreturn a[x];\n}\n"));
+  TEST_ASSERT(rejects("i32 a[4];\ni32 f() {\na = 1;\nreturn 0;\n}\n"));
+
+  QueryDatabase db;
+  db.set<SourceTextQuery>("array.c", array_src);
+
+  const auto& file = db.get<TypecheckQuery>("array.c");
+  TEST_ASSERT(file->ok);
+
+  const auto lower = [&db](const char* name) {
+    return *db.get<LowerQuery>({ "array.c", name });
+  };
+
+  // The index is unknown, the check stays. The second one is redundant.
+  TEST_ASSERT(count_ops(lower("get"), ir::Opcode::bounds) == 1);
+  TEST_ASSERT(count_ops(lower("twice"), ir::Opcode::bounds) == 1);
+
+  // 0 <= i < 13 is the length of xs.
+  const ir::Function fill = lower("fill");
+  TEST_ASSERT(ir::verify(fill));
+  TEST_ASSERT(count_ops(fill, ir::Opcode::bounds) == 0);
+
+  // Eight i32 lanes, four f64 ones, with a scalar loop for the rest.
+  const ir::Function vadd = lower("vadd");
+  TEST_ASSERT(ir::verify(vadd));
+  TEST_ASSERT(count_lanes(vadd, ir::Opcode::aload, 8) > 0);
+  TEST_ASSERT(count_lanes(vadd, ir::Opcode::aload, 1) > 0);
+
+  const ir::Function scale = lower("scale");
+  TEST_ASSERT(ir::verify(scale));
+  TEST_ASSERT(count_lanes(scale, ir::Opcode::aload, 4) > 0);
+
+  // Every engine agrees.
+  const auto& module = db.get<ModuleQuery>("array.c");
+  TEST_ASSERT(module != nullptr);
+
+  for (const ir::Function& fn : module->functions)
+    TEST_ASSERT(ir::verify(fn));
+
+  const x64::MModule code = x64::compile_module(*module);
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+  TEST_ASSERT(jit != nullptr);
+
+  vm::Program program;
+  TEST_ASSERT(vm::compile(*file, db.get<LayoutQuery>("array.c"), program));
+
+  vm::Machine machine(program);
+  TreeWalker  walker(*file);
+
+  // Canonical i32 results are sign extended.
+  const auto agree = [&](const char*           name,
+                         std::vector<VarValue> args,
+                         int64_t               expected) {
+    VarValue reference, result;
+
+    return walker.call(name, args, reference) &&
+           machine.call(program.find(name), args, result) &&
+           result.u64_value == reference.u64_value &&
+           reference.i64_value == expected;
+  };
+
+  const auto setup_fn = jit->function<int32_t (*)(int32_t)>("setup");
+  const auto vadd_fn  = jit->function<int32_t (*)(int32_t, int32_t)>("vadd");
+  const auto total_fn = jit->function<int32_t (*)(int32_t)>("total");
+  const auto get_fn   = jit->function<int32_t (*)(int32_t)>("get");
+  const auto fresh_fn = jit->function<int32_t (*)(int32_t)>("fresh");
+
+  // Lengths around the vector width leave every remainder.
+  for (int32_t n = 0; n <= 37; ++n) {
+    const VarValue arg = int_value(n);
+
+    TEST_ASSERT(agree("setup", { arg }, setup_fn(n)));
+    TEST_ASSERT(agree("vadd", { arg, int_value(5) }, vadd_fn(n, 5)));
+    TEST_ASSERT(agree("total", { arg }, total_fn(n)));
+    TEST_ASSERT(total_fn(n) == expected_total(n));
+  }
+
+  TEST_ASSERT(agree("get", { int_value(36) }, get_fn(36)));
+  TEST_ASSERT(get_fn(36) == 108);
+
+  // Local arrays start zeroed on every call.
+  TEST_ASSERT(fresh_fn(3) == 0 && fresh_fn(3) == 0);
+  TEST_ASSERT(agree("fresh", { int_value(3) }, 0));
+  TEST_ASSERT(agree("fresh", { int_value(3) }, 0));
+
+  TEST_ASSERT(jit->function<int32_t (*)()>("fill")() == 0);
+  TEST_ASSERT(agree("fill", {}, 0));
+
+  const auto scale_fn = jit->function<double (*)(int32_t, double)>("scale");
+  VarValue   k, scaled;
+  k.f64_value = 2;
+
+  for (int32_t n = 0; n <= 13; ++n) {
+    const double expected = n * (n + 2) * 1.0;
+
+    TEST_ASSERT(scale_fn(n, 2) == expected);
+    TEST_ASSERT(walker.call("scale", { int_value(n), k }, scaled) &&
+                scaled.f64_value == expected);
+    TEST_ASSERT(
+      machine.call(program.find("scale"), { int_value(n), k }, scaled) &&
+      scaled.f64_value == expected);
+  }
+
+  // Out of bounds indices stop the interpreters, negative ones included.
+  VarValue ignored;
+  TEST_ASSERT(!walker.call("get", { int_value(37) }, ignored));
+  TEST_ASSERT(!walker.call("get", { int_value(-1) }, ignored));
+  TEST_ASSERT(!machine.call(program.find("get"), { int_value(37) }, ignored));
+  TEST_ASSERT(!machine.call(program.find("get"), { int_value(-1) }, ignored));
+
+  // Split into SSE halves or run as AVX2, where the CPU has it.
+  const x64::CompileOptions host = jit::for_host({ .avx2 = true });
+  TEST_ASSERT(host.avx2 == jit::cpu_has_avx2());
+
+  for (const int32_t n : { 7, 8, 29, 37 }) {
+    TEST_ASSERT(run_jit(*module, { .avx2 = false }, n) == expected_total(n));
+    TEST_ASSERT(run_jit(*module, host, n) == expected_total(n));
+  }
+
+  return true;
+}
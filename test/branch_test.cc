@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <string>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "tree_walker.h"
+#include "util.h"
+#include "vm.h"
+#include "x64.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char branch_src[] = "i32 xs[8];\n"
+                          "i32 setup() {\n"
+                          "i32 i;\n"
+                          "for (i = 0; i < 8; i = i + 1) {\n"
+                          "xs[i] = i * 5 % 7;\n"
+                          "}\n"
+                          "return 0;\n"
+                          "}\n"
+                          "i32 max(i32 a, i32 b) {\n"
+                          "if (a > b) {\n"
+                          "return a;\n"
+                          "}\n"
+                          "return b;\n"
+                          "}\n"
+                          "i32 clamp(i32 x, i32 lo, i32 hi) {\n"
+                          "i32 r;\n"
+                          "r = x;\n"
+                          "if (x < lo) {\n"
+                          "r = lo;\n"
+                          "} else if (x > hi) {\n"
+                          "r = hi;\n"
+                          "}\n"
+                          "return r;\n"
+                          "}\n"
+                          "i32 grade(i32 x) {\n"
+                          "if (x > 90) {\n"
+                          "return 4;\n"
+                          "} else if (x > 75) {\n"
+                          "return 3;\n"
+                          "} else {\n"
+                          "return x - 50;\n"
+                          "}\n"
+                          "}\n"
+                          "i32 safe(i32 a, i32 b) {\n"
+                          "if (b != 0) {\n"
+                          "return a / b;\n"
+                          "}\n"
+                          "return 0;\n"
+                          "}\n"
+                          "i32 sign(i32 x) {\n"
+                          "i32 r;\n"
+                          "if (x < 0) {\n"
+                          "r = 0 - 1;\n"
+                          "} else {\n"
+                          "r = 1;\n"
+                          "}\n"
+                          "if (x != 0) {\n"
+                          "} else {\n"
+                          "r = 0;\n"
+                          "}\n"
+                          "return r;\n"
+                          "}\n"
+                          "i32 guard(i32 i) {\n"
+                          "if (i >= 0 && i < 8 && xs[i] > 2) {\n"
+                          "return 1;\n"
+                          "}\n"
+                          "return 0;\n"
+                          "}\n"
+                          "i32 count(i32 n) {\n"
+                          "i32 i;\n"
+                          "i32 c;\n"
+                          "c = 0;\n"
+                          "for (i = 0; i < n; i = i + 1) {\n"
+                          "if (xs[i] > 2) {\n"
+                          "c = c + 1;\n"
+                          "}\n"
+                          "}\n"
+                          "return c;\n"
+                          "}\n"
+                          "i32 either(i32 a, i32 b) {\n"
+                          "return a < b && b < 10 || a != 0;\n"
+                          "}\n"
+                          "i32 prec(i32 a, i32 b) {\n"
+                          "return a * 4 - b - 1;\n"
+                          "}\n";
+
+bool
+branch_test()
+{
+  // The condition of an if is a value.
+  TEST_ASSERT(rejects("void f() {\n}\n"
+                      "i32 g() {\nif (f()) {\nreturn 1;\n}\nreturn 0;\n}\n"));
+
+  QueryDatabase db;
+  db.set<SourceTextQuery>("branch.c", branch_src);
+
+  const auto& file = db.get<TypecheckQuery>("branch.c");
+  TEST_ASSERT(file->ok);
+
+  const auto lower = [&db](const char* name) {
+    return *db.get<LowerQuery>({ "branch.c", name });
+  };
+
+  // Small arms of integer arithmetic become selects, returns included.
+  const ir::Function max = lower("max");
+  TEST_ASSERT(ir::verify(max));
+  TEST_ASSERT(count_ops(max, ir::Opcode::condbr) == 0);
+  TEST_ASSERT(count_ops(max, ir::Opcode::select) == 1);
+
+  const ir::Function clamp = lower("clamp");
+  TEST_ASSERT(ir::verify(clamp));
+  TEST_ASSERT(count_ops(clamp, ir::Opcode::condbr) == 0);
+  TEST_ASSERT(count_ops(clamp, ir::Opcode::select) == 2);
+
+  // Nested branches are converted inside out.
+  const ir::Function grade = lower("grade");
+  TEST_ASSERT(ir::verify(grade));
+  TEST_ASSERT(count_ops(grade, ir::Opcode::condbr) == 0);
+  TEST_ASSERT(count_ops(grade, ir::Opcode::select) == 2);
+
+  // A division may trap, the branch around it stays.
+  TEST_ASSERT(count_ops(lower("safe"), ir::Opcode::condbr) == 1);
+
+  TEST_ASSERT(count_ops(lower("sign"), ir::Opcode::condbr) == 0);
+  TEST_ASSERT(count_ops(lower("either"), ir::Opcode::condbr) == 0);
+
+  // The element is only read after the index was checked.
+  const ir::Function guard = lower("guard");
+  TEST_ASSERT(ir::verify(guard));
+  TEST_ASSERT(count_ops(guard, ir::Opcode::condbr) == 3);
+
+  const ir::Function count = lower("count");
+  TEST_ASSERT(ir::verify(count));
+  TEST_ASSERT(count_ops(count, ir::Opcode::select) > 0);
+
+  // Every engine agrees.
+  const auto& module = db.get<ModuleQuery>("branch.c");
+  TEST_ASSERT(module != nullptr);
+
+  for (const ir::Function& fn : module->functions)
+    TEST_ASSERT(ir::verify(fn));
+
+  const x64::MModule code = x64::compile_module(*module);
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+  TEST_ASSERT(jit != nullptr);
+
+  vm::Program program;
+  TEST_ASSERT(vm::compile(*file, db.get<LayoutQuery>("branch.c"), program));
+
+  vm::Machine machine(program);
+  TreeWalker  walker(*file);
+
+  const auto agree = [&](const char*           name,
+                         std::vector<VarValue> args,
+                         int64_t               expected) {
+    VarValue reference, result;
+
+    return walker.call(name, args, reference) &&
+           machine.call(program.find(name), args, result) &&
+           result.u64_value == reference.u64_value &&
+           reference.i64_value == expected;
+  };
+
+  using Binary = int32_t (*)(int32_t, int32_t);
+  using Unary  = int32_t (*)(int32_t);
+
+  const auto max_fn    = jit->function<Binary>("max");
+  const auto either_fn = jit->function<Binary>("either");
+  const auto prec_fn   = jit->function<Binary>("prec");
+  const auto grade_fn  = jit->function<Unary>("grade");
+  const auto sign_fn   = jit->function<Unary>("sign");
+  const auto guard_fn  = jit->function<Unary>("guard");
+  const auto count_fn  = jit->function<Unary>("count");
+  const auto clamp_fn =
+    jit->function<int32_t (*)(int32_t, int32_t, int32_t)>("clamp");
+
+  TEST_ASSERT(jit->function<int32_t (*)()>("setup")() == 0);
+  TEST_ASSERT(agree("setup", {}, 0));
+
+  // * binds tighter than -, which is left associative.
+  TEST_ASSERT(prec_fn(3, 1) == 10);
+  TEST_ASSERT(agree("prec", { int_value(3), int_value(1) }, 10));
+
+  for (int32_t x = -3; x <= 100; x += 7) {
+    const VarValue v = int_value(x);
+
+    TEST_ASSERT(max_fn(x, 40) == std::max(x, 40));
+    TEST_ASSERT(agree("max", { v, int_value(40) }, max_fn(x, 40)));
+
+    TEST_ASSERT(clamp_fn(x, 10, 60) == std::clamp(x, 10, 60));
+    TEST_ASSERT(agree(
+      "clamp", { v, int_value(10), int_value(60) }, clamp_fn(x, 10, 60)));
+
+    TEST_ASSERT(agree("grade", { v }, grade_fn(x)));
+    TEST_ASSERT(agree("sign", { v }, sign_fn(x)));
+    TEST_ASSERT(sign_fn(x) == (x > 0) - (x < 0));
+
+    for (int32_t y = -1; y <= 11; y += 4) {
+      const int32_t expected = (x < y && y < 10) || x != 0;
+
+      TEST_ASSERT(either_fn(x, y) == expected);
+      TEST_ASSERT(agree("either", { v, int_value(y) }, expected));
+    }
+  }
+
+  TEST_ASSERT(grade_fn(95) == 4 && grade_fn(80) == 3 && grade_fn(60) == 10);
+
+  const auto safe_fn = jit->function<Binary>("safe");
+  TEST_ASSERT(safe_fn(7, 0) == 0 && safe_fn(7, 2) == 3);
+  TEST_ASSERT(agree("safe", { int_value(7), int_value(0) }, 0));
+
+  // Short-circuit evaluation keeps out of bounds indices from being read.
+  const int32_t elements[] = { 0, 5, 3, 1, 6, 4, 2, 0 };
+
+  for (int32_t i = -2; i <= 9; ++i) {
+    const int32_t expected = i >= 0 && i < 8 && elements[i] > 2;
+
+    TEST_ASSERT(guard_fn(i) == expected);
+    TEST_ASSERT(agree("guard", { int_value(i) }, expected));
+  }
+
+  for (int32_t n = 0; n <= 8; ++n) {
+    const int32_t expected = static_cast<int32_t>(
+      std::count_if(elements, elements + n, [](int32_t e) { return e > 2; }));
+
+    TEST_ASSERT(count_fn(n) == expected);
+    TEST_ASSERT(agree("count", { int_value(n) }, expected));
+  }
+
+  // Selects are conditional moves, the compare feeding them sets the flags
+  // for the cmov directly.
+  const x64::MFunction* max_code = find_function(code, "max");
+  TEST_ASSERT(max_code != nullptr);
+  TEST_ASSERT(count_ops(*max_code, x64::MOp::cmov) == 1);
+  TEST_ASSERT(count_ops(*max_code, x64::MOp::setcc) == 0);
+  TEST_ASSERT(count_ops(*max_code, x64::MOp::jcc) == 0);
+
+  // Every branch falls through to one of its successors, the loop body
+  // follows its exit test and the trap of the bounds check is placed last.
+  const x64::MFunction* count_code = find_function(code, "count");
+  TEST_ASSERT(count_code != nullptr);
+  TEST_ASSERT(count_code->blocks.back().instrs.back().op == x64::MOp::ud2);
+
+  for (size_t b = 0; b + 1 < count_code->blocks.size(); ++b) {
+    const auto&  instrs = count_code->blocks[b].instrs;
+    const size_t n      = instrs.size();
+
+    TEST_ASSERT(n < 2 || instrs[n - 2].op != x64::MOp::jcc ||
+                instrs[n - 1].op != x64::MOp::jmp);
+
+    for (const auto& instr : instrs)
+      TEST_ASSERT(instr.op != x64::MOp::ud2);
+  }
+
+  return true;
+}
@@ -0,0 +1,125 @@
+#include <string>
+
+#include "jit.h"
+#include "queries.h"
+#include "util.h"
+#include "x64.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char burs_src[] = "i64 g;\n"
+                        "i64 address(i64 a, i64 b) {\n"
+                        "return a + b * 4 + 8;\n"
+                        "}\n"
+                        "i64 triple(i64 a) {\n"
+                        "return a * 3;\n"
+                        "}\n"
+                        "i64 plus_global(i64 a) {\n"
+                        "return a + g;\n"
+                        "}\n"
+                        "i64 swap_global(i64 a) {\n"
+                        "i64 t;\n"
+                        "t = g;\n"
+                        "g = a;\n"
+                        "return t + a;\n"
+                        "}\n"
+                        "i32 narrow(i32 a, i32 b) {\n"
+                        "return a * 12 + b - 7;\n"
+                        "}\n"
+                        "i64 wide(i64 a) {\n"
+                        "return a + 81985529216486895;\n"
+                        "}\n";
+
+// Instructions `op` with a global as their source operand.
+static size_t
+count_global_reads(const x64::MFunction& fn, x64::MOp op)
+{
+  size_t count = 0;
+
+  for (const auto& block : fn.blocks) {
+    for (const auto& instr : block.instrs) {
+      count += instr.op == op && instr.num_ops == 2 &&
+               instr.ops[1].kind == x64::OperandKind::global;
+    }
+  }
+
+  return count;
+}
+
+static const x64::MInstr*
+find_lea(const x64::MFunction& fn)
+{
+  for (const auto& block : fn.blocks) {
+    for (const auto& instr : block.instrs) {
+      if (instr.op == x64::MOp::lea)
+        return &instr;
+    }
+  }
+
+  return nullptr;
+}
+
+bool
+burs_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("burs.c", burs_src);
+
+  const auto& module = db.get<ModuleQuery>("burs.c");
+  TEST_ASSERT(module != nullptr);
+
+  const x64::MModule code = x64::compile_module(*module);
+
+  // a + b * 4 + 8 is one lea: base, scaled index and displacement.
+  const x64::MFunction* address = find_function(code, "address");
+  TEST_ASSERT(address != nullptr);
+  TEST_ASSERT(count_ops(*address, x64::MOp::lea) == 1);
+  TEST_ASSERT(count_ops(*address, x64::MOp::add) == 0);
+  TEST_ASSERT(count_ops(*address, x64::MOp::shl) == 0);
+
+  const x64::MInstr* lea = find_lea(*address);
+  TEST_ASSERT(lea->num_ops == 3 && lea->scale == 4 && lea->disp == 8);
+
+  const x64::MFunction* triple = find_function(code, "triple");
+  TEST_ASSERT(count_ops(*triple, x64::MOp::lea) == 1);
+  TEST_ASSERT(count_ops(*triple, x64::MOp::imul) == 0);
+  TEST_ASSERT(find_lea(*triple)->scale == 2);
+
+  // The global is an operand of the add, not loaded first.
+  const x64::MFunction* plus = find_function(code, "plus_global");
+  TEST_ASSERT(count_global_reads(*plus, x64::MOp::add) == 1);
+  TEST_ASSERT(count_global_reads(*plus, x64::MOp::mov) == 0);
+
+  // A store between the load and its use keeps the load where it was.
+  const x64::MFunction* swap = find_function(code, "swap_global");
+  TEST_ASSERT(count_global_reads(*swap, x64::MOp::add) == 0);
+  TEST_ASSERT(count_global_reads(*swap, x64::MOp::mov) == 1);
+
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+  TEST_ASSERT(jit != nullptr);
+
+  const auto run_address =
+    jit->function<int64_t (*)(int64_t, int64_t)>("address");
+  const auto run_triple = jit->function<int64_t (*)(int64_t)>("triple");
+  const auto run_plus   = jit->function<int64_t (*)(int64_t)>("plus_global");
+  const auto run_swap   = jit->function<int64_t (*)(int64_t)>("swap_global");
+  const auto run_narrow =
+    jit->function<int32_t (*)(int32_t, int32_t)>("narrow");
+  const auto run_wide = jit->function<int64_t (*)(int64_t)>("wide");
+
+  TEST_ASSERT(run_address(100, -3) == 96);
+  TEST_ASSERT(run_address(INT64_MAX, 1) == INT64_MIN + 11);
+  TEST_ASSERT(run_triple(-7) == -21);
+  TEST_ASSERT(run_plus(5) == 5);
+  TEST_ASSERT(run_swap(5) == 5);
+  TEST_ASSERT(run_swap(1) == 6);
+  TEST_ASSERT(run_plus(2) == 3);
+  TEST_ASSERT(run_narrow(3, 4) == 33);
+  TEST_ASSERT(run_narrow(-1000000, 0) == -12000007);
+  TEST_ASSERT(run_wide(1) == 81985529216486896);
+
+  return true;
+}
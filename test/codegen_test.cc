@@ -0,0 +1,355 @@
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "elf_writer.h"
+#include "ir.h"
+#include "queries.h"
+#include "util.h"
+#include "writer.h"
+#include "x64.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+// The programs report what they computed through their exit status.
+const char arith_src[] = "i32 mul3(i32 a, i32 b, i32 c) {\n"
+                         "return a * b * c;\n"
+                         "}\n"
+                         "i32 quot(i32 a, i32 b) {\n"
+                         "return a / b;\n"
+                         "}\n"
+                         "i32 rem(i32 a, i32 b) {\n"
+                         "return a % b;\n"
+                         "}\n"
+                         "i32 main() {\n"
+                         "i32 x;\n"
+                         "i32 y;\n"
+                         "i32 m;\n"
+                         "x = mul3(2, 3, 4);\n"
+                         "m = 0 - 7;\n"
+                         "y = quot(m, 2);\n"
+                         "m = rem(m, 2);\n"
+                         "return x + y + m;\n"
+                         "}\n";
+
+const char args_src[] = "i64 sum7(i64 a, i64 b, i64 c, i64 d, i64 e, i64 f, "
+                        "i64 g) {\n"
+                        "return a + b + c + d + e + f + g;\n"
+                        "}\n"
+                        "f64 scale(f64 x, f32 k) {\n"
+                        "return x * k;\n"
+                        "}\n"
+                        "i32 main() {\n"
+                        "i64 s;\n"
+                        "f64 d;\n"
+                        "s = sum7(1, 2, 3, 4, 5, 6, 7);\n"
+                        "d = scale(2.5, 4);\n"
+                        "return s + d;\n"
+                        "}\n";
+
+const char convert_src[] = "u64 big;\n"
+                           "i8 wrap(i8 a) {\n"
+                           "return a + 100;\n"
+                           "}\n"
+                           "i32 main() {\n"
+                           "f64 d;\n"
+                           "f32 h;\n"
+                           "u64 back;\n"
+                           "i8 w;\n"
+                           "i32 a;\n"
+                           "i32 b;\n"
+                           "i32 c;\n"
+                           "big = 12345678901234567890;\n"
+                           "d = big;\n"
+                           "back = d;\n"
+                           "w = wrap(100);\n"
+                           "h = 0.5;\n"
+                           "a = back > 12345678901234500000;\n"
+                           "b = w < 0;\n"
+                           "c = h < d;\n"
+                           "a = a && b;\n"
+                           "return a + c + 1;\n"
+                           "}\n";
+
+const char pressure_src[] =
+  "i64 many(i64 a, i64 b, i64 c, i64 d, i64 e, i64 f, i64 g, i64 h, i64 i, "
+  "i64 j, i64 k, i64 l, i64 m, i64 n) {\n"
+  "return a * n + b * m + c * l + d * k + e * j + f * i + g * h;\n"
+  "}\n"
+  "i32 main() {\n"
+  "i64 x;\n"
+  "i64 y;\n"
+  "x = many(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14);\n"
+  "y = many(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14);\n"
+  "x = x + y;\n"
+  "return x % 251;\n"
+  "}\n";
+
+// Code generation is checked on the IR before inlining, so the programs keep
+// their calls.
+static x64::MModule
+compile_source(const std::string& name, const std::string& source)
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>(name, source);
+
+  const auto& file = db.get<TypecheckQuery>(name);
+
+  if (!file->ok)
+    return {};
+
+  ir::Module module = ir::lower_module(*file, db.get<LayoutQuery>(name));
+
+  for (ir::Function& fn : module.functions) {
+    ir::mem2reg(fn);
+    ir::propagate_constants(fn);
+  }
+
+  return x64::compile_module(module);
+}
+
+static bool
+compile_to_asm(const std::string& name,
+               const std::string& source,
+               const std::string& path)
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>(name, source);
+
+  const auto& module = db.get<ModuleQuery>(name);
+
+  if (module == nullptr)
+    return false;
+
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0)
+    return false;
+
+  bool ok;
+
+  {
+    BufferedWriter out(fd);
+    x64::emit_asm(x64::compile_module(*module), out);
+    ok = out.flush();
+  }
+
+  close(fd);
+  return ok;
+}
+
+// Exit status of running `path`, -1 if it did not exit normally.
+static int
+run_program(const std::string& path)
+{
+  const int status = std::system(path.c_str());
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Exit status of the program built from `source` with the system assembler
+// and linker, -1 if any step failed.
+static int
+build_and_run(const std::string& dir,
+              const std::string& name,
+              const std::string& source)
+{
+  const std::string asm_path = dir + "/" + name + ".s";
+  const std::string exe_path = dir + "/" + name;
+
+  if (!compile_to_asm(name, source, asm_path))
+    return -1;
+
+  const std::string link = fmt::format("cc -o {} {}", exe_path, asm_path);
+
+  if (std::system(link.c_str()) != 0)
+    return -1;
+
+  return run_program(exe_path);
+}
+
+// Builds `source` with the built-in encoder, once as an object linked by cc
+// and once as a static executable.
+static bool
+check_binaries(const std::string& dir,
+               const std::string& name,
+               const std::string& source,
+               int                expected)
+{
+  const auto code    = compile_source(name, source);
+  const auto machine = x64::encode_module(code);
+
+  const std::string object = dir + "/" + name + ".o";
+  const std::string linked = dir + "/" + name + "_linked";
+  const std::string exe    = dir + "/" + name + "_static";
+
+  TEST_ASSERT(elf::write_object(object.c_str(), code, machine, name.c_str()));
+
+  const std::string link = fmt::format("cc -o {} {}", linked, object);
+
+  TEST_ASSERT(std::system(link.c_str()) == 0);
+  TEST_ASSERT(run_program(linked) == expected);
+
+  TEST_ASSERT(elf::write_executable(exe.c_str(), code, machine));
+  TEST_ASSERT(run_program(exe) == expected);
+
+  return true;
+}
+
+static std::string
+read_file(const std::string& path)
+{
+  std::ifstream f(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(f), {});
+}
+
+// Text of one function in an assembly listing.
+static std::string
+function_asm(const std::string& listing, const std::string& name)
+{
+  const size_t begin = listing.find("\n" + name + ":\n");
+  const size_t end   = listing.find(".size " + name + ",", begin);
+
+  if (begin == std::string::npos || end == std::string::npos)
+    return {};
+
+  return listing.substr(begin, end - begin);
+}
+
+static bool
+run_programs(const std::string& dir)
+{
+  TEST_ASSERT(build_and_run(dir, "arith", arith_src) == 20);
+  TEST_ASSERT(build_and_run(dir, "args", args_src) == 38);
+  TEST_ASSERT(build_and_run(dir, "convert", convert_src) == 3);
+
+  for (const char* sample : { "call", "file1", "file2" }) {
+    const std::string source =
+      read_file(std::string(WCC_TEST_DIR) + "/" + sample + ".c");
+
+    TEST_ASSERT(!source.empty());
+    TEST_ASSERT(build_and_run(dir, sample, source) == 0);
+  }
+
+  // Small functions live entirely in registers.
+  const std::string listing = read_file(dir + "/arith.s");
+  const std::string leaf    = function_asm(listing, "mul3");
+
+  TEST_ASSERT(!leaf.empty());
+  TEST_ASSERT(leaf.find("(%rbp)") == std::string::npos);
+  TEST_ASSERT(leaf.find("subq") == std::string::npos);
+
+  return true;
+}
+
+static bool
+bitset_test()
+{
+  DenseBitset a(130), b(130);
+
+  a.set(0);
+  a.set(64);
+  b.set(64);
+  b.set(129);
+
+  TEST_ASSERT(a.unite(b));
+  TEST_ASSERT(!a.unite(b));
+  TEST_ASSERT(a.count() == 3 && a.test(129) && !a.test(1));
+
+  DenseBitset c(130);
+  TEST_ASSERT(c.unite_difference(a, b));
+  TEST_ASSERT(c.count() == 1 && c.test(0));
+
+  size_t sum = 0;
+  a.for_each([&sum](size_t i) { sum += i; });
+  TEST_ASSERT(sum == 0 + 64 + 129);
+
+  return true;
+}
+
+static bool
+regalloc_test(const std::string& dir)
+{
+  // Straight line arithmetic on a few values never touches the stack.
+  const std::string file2 = read_file(std::string(WCC_TEST_DIR) + "/file2.c");
+  const auto        code  = compile_source("file2.c", file2);
+  const auto*       fn    = find_function(code, "add_twice");
+
+  TEST_ASSERT(fn != nullptr);
+  TEST_ASSERT(fn->stats.intervals > 0);
+  TEST_ASSERT(fn->stats.spilled == 0 && fn->stats.split == 0);
+  TEST_ASSERT(fn->stats.reloads == 0 && fn->stats.stores == 0);
+  TEST_ASSERT(fn->num_slots == 0 && fn->saved.empty());
+
+  // Fourteen live arguments do not fit, a value live across a call goes to
+  // a callee saved register.
+  const auto  pressure = compile_source("pressure.c", pressure_src);
+  const auto* many     = find_function(pressure, "many");
+  const auto* main     = find_function(pressure, "main");
+
+  TEST_ASSERT(many != nullptr && main != nullptr);
+  TEST_ASSERT(many->stats.spilled + many->stats.split > 0);
+  TEST_ASSERT(many->stats.reloads > 0);
+  TEST_ASSERT(!main->saved.empty());
+
+  TEST_ASSERT(build_and_run(dir, "pressure", pressure_src) == 58);
+
+  // A leaf addresses its spill slots in the red zone without moving rsp.
+  const std::string leaf = function_asm(read_file(dir + "/pressure.s"), "many");
+
+  TEST_ASSERT(leaf.find("(%rbp)") != std::string::npos);
+  TEST_ASSERT(leaf.find("subq") == std::string::npos);
+
+  return true;
+}
+
+static bool
+binary_test(const std::string& dir)
+{
+  TEST_ASSERT(check_binaries(dir, "arith", arith_src, 20));
+  TEST_ASSERT(check_binaries(dir, "args", args_src, 38));
+  TEST_ASSERT(check_binaries(dir, "convert", convert_src, 3));
+  TEST_ASSERT(check_binaries(dir, "pressure", pressure_src, 58));
+
+  for (const char* sample : { "call", "file1", "file2" }) {
+    const std::string source =
+      read_file(std::string(WCC_TEST_DIR) + "/" + sample + ".c");
+
+    TEST_ASSERT(check_binaries(dir, sample, source, 0));
+  }
+
+  // Globals are zero initialized .bss symbols.
+  const std::string nm =
+    fmt::format("nm {}/file2.o | grep -q ' B global_var$'", dir);
+
+  TEST_ASSERT(std::system(nm.c_str()) == 0);
+
+  return true;
+}
+
+bool
+codegen_test()
+{
+  if (std::system("cc --version > /dev/null 2>&1") != 0) {
+    fmt::print(stderr, "codegen_test: no cc, skipping\n");
+    return true;
+  }
+
+  char dir[] = "/tmp/wcc_codegen_XXXXXX";
+
+  if (mkdtemp(dir) == nullptr)
+    return false;
+
+  const bool ok = bitset_test() && run_programs(dir) && regalloc_test(dir) &&
+                  binary_test(dir);
+
+  std::system(fmt::format("rm -rf {}", dir).c_str());
+  return ok;
+}
@@ -0,0 +1,149 @@
+#include <string>
+
+#include "ir.h"
+#include "queries.h"
+#include "util.h"
+
+#include "test.h"
+
+using namespace wcc;
+
+const char eval_src[] = "i32 g;\n"
+                        "i32 down(i32 n) {\n"
+                        "i32 m;\n"
+                        "m = n - 1;\n"
+                        "return n && down(m);\n"
+                        "}\n"
+                        "i32 up(i32 n) {\n"
+                        "i32 m;\n"
+                        "m = n - 1;\n"
+                        "return n || up(m);\n"
+                        "}\n"
+                        "i32 quot(i32 a, i32 b) {\n"
+                        "return a / b;\n"
+                        "}\n"
+                        "i32 touch(i32 n) {\n"
+                        "g = n;\n"
+                        "return n;\n"
+                        "}\n"
+                        "i32 peek(i32 n) {\n"
+                        "return g + n;\n"
+                        "}\n"
+                        "i32 relay(i32 n) {\n"
+                        "return touch(n);\n"
+                        "}\n"
+                        "i32 forever(i32 n) {\n"
+                        "return forever(n);\n"
+                        "}\n"
+                        "i32 main() {\n"
+                        "i32 a;\n"
+                        "i32 b;\n"
+                        "i32 c;\n"
+                        "i32 d;\n"
+                        "a = down(20);\n"
+                        "b = up(0);\n"
+                        "c = down(10);\n"
+                        "d = quot(1, 0);\n"
+                        "return a + b + c + d + touch(3);\n"
+                        "}\n";
+
+static size_t
+count_calls(const ir::Function& fn,
+            const std::string&  callee,
+            const ir::Module&   module)
+{
+  size_t count = 0;
+
+  for (const auto& block : fn.blocks) {
+    for (const ir::ValueId v : block.instrs) {
+      const ir::Instr& instr = fn.instrs[v];
+      count += instr.op == ir::Opcode::call &&
+               module.functions[instr.imm].name == callee;
+    }
+  }
+
+  return count;
+}
+
+// The file as lowered, before inlining or evaluation.
+static ir::Module
+lowered(const AnalyzedFile&              file,
+        const std::vector<StructLayout>& layouts)
+{
+  ir::Module module = ir::lower_module(file, layouts);
+
+  for (ir::Function& fn : module.functions) {
+    ir::mem2reg(fn);
+    ir::propagate_constants(fn);
+  }
+
+  return module;
+}
+
+bool
+eval_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("eval.c", eval_src);
+
+  const auto& file    = db.get<TypecheckQuery>("eval.c");
+  const auto& layouts = db.get<LayoutQuery>("eval.c");
+  TEST_ASSERT(file->ok);
+
+  // Recursion alone does not make a function impure, state does, also
+  // through callees.
+  ir::Module                 module = lowered(*file, layouts);
+  const std::vector<uint8_t> pure   = ir::find_pure_functions(module);
+
+  TEST_ASSERT(pure[0] && pure[1] && pure[2]);
+  TEST_ASSERT(!pure[3] && !pure[4] && !pure[5]);
+  TEST_ASSERT(pure[6]);
+  TEST_ASSERT(!pure[7]);
+
+  const ir::EvalStats stats = ir::evaluate_calls(module);
+  const ir::Function& main  = module.functions[7];
+
+  TEST_ASSERT(ir::verify(main));
+
+  // down(10) was computed on the way to down(20) and comes from the memo.
+  TEST_ASSERT(stats.folded == 3);
+  TEST_ASSERT(stats.memo_hits >= 1);
+  TEST_ASSERT(count_calls(main, "down", module) == 0);
+  TEST_ASSERT(count_calls(main, "up", module) == 0);
+
+  // The division trap is left for run time, the impure call stays.
+  TEST_ASSERT(count_calls(main, "quot", module) == 1);
+  TEST_ASSERT(count_calls(main, "touch", module) == 1);
+
+  // Endless recursion runs into the limits, the call stays.
+  db.set<SourceTextQuery>("forever.c",
+                          std::string(eval_src) + "i32 spin() {\n"
+                                                  "i32 r;\n"
+                                                  "r = forever(1);\n"
+                                                  "return r;\n"
+                                                  "}\n");
+
+  ir::Module spin = lowered(*db.get<TypecheckQuery>("forever.c"),
+                            db.get<LayoutQuery>("forever.c"));
+
+  const ir::EvalStats spun = ir::evaluate_calls(spin);
+  TEST_ASSERT(spun.out_of_budget == 1);
+  TEST_ASSERT(count_calls(spin.functions[8], "forever", spin) == 1);
+
+  // A budget too small for the recursion gives up as well.
+  ir::Module tight = lowered(*file, layouts);
+
+  const ir::EvalStats cut = ir::evaluate_calls(tight, { .step_budget = 16 });
+  TEST_ASSERT(cut.out_of_budget >= 1);
+  TEST_ASSERT(count_calls(tight.functions[7], "down", tight) >= 1);
+
+  // The module query evaluates the recursive calls the inliner keeps.
+  const auto& optimized = db.get<ModuleQuery>("eval.c");
+  TEST_ASSERT(optimized != nullptr);
+
+  const ir::Function& opt_main = optimized->functions[7];
+  TEST_ASSERT(count_calls(opt_main, "down", *optimized) == 0);
+  TEST_ASSERT(count_calls(opt_main, "up", *optimized) == 0);
+
+  return true;
+}
@@ -0,0 +1,109 @@
+#include <cmath>
+#include <string>
+
+#include "jit.h"
+#include "queries.h"
+#include "util.h"
+#include "x64.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char fma_src[] = "f64 axpy(f64 a, f64 x, f64 y) {\n"
+                       "return y + a * x;\n"
+                       "}\n"
+                       "f32 nmadd(f32 a, f32 x, f32 y) {\n"
+                       "f32 t;\n"
+                       "t = a * x;\n"
+                       "return y - t;\n"
+                       "}\n"
+                       "f32 msub(f32 a, f32 x, f32 y) {\n"
+                       "f32 t;\n"
+                       "t = a * x;\n"
+                       "return t - y;\n"
+                       "}\n"
+                       "f32 add_twice(i32 a, f32 b) {\n"
+                       "return b + a * b;\n"
+                       "}\n"
+                       "f64 shared(f64 a, f64 x) {\n"
+                       "f64 t;\n"
+                       "t = a * x;\n"
+                       "return t + t;\n"
+                       "}\n";
+
+static size_t
+count_fma(const x64::MFunction& fn)
+{
+  return count_ops(fn, x64::MOp::vfmadd231) +
+         count_ops(fn, x64::MOp::vfmsub231) +
+         count_ops(fn, x64::MOp::vfnmadd231);
+}
+
+static size_t
+count_fma(const x64::MModule& code)
+{
+  size_t count = 0;
+
+  for (const auto& fn : code.functions)
+    count += count_fma(fn);
+
+  return count;
+}
+
+bool
+fma_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("fma.c", fma_src);
+
+  const auto& module = db.get<ModuleQuery>("fma.c");
+  TEST_ASSERT(module != nullptr);
+
+  // Contraction is opt in.
+  TEST_ASSERT(count_fma(x64::compile_module(*module)) == 0);
+
+  const x64::MModule fused = x64::compile_module(*module, { .fma = true });
+
+  TEST_ASSERT(count_fma(*find_function(fused, "axpy")) == 1);
+  TEST_ASSERT(count_fma(*find_function(fused, "add_twice")) == 1);
+
+  // y - a * x negates the product, a * x - y the addend.
+  const x64::MFunction* nmadd = find_function(fused, "nmadd");
+  const x64::MFunction* msub  = find_function(fused, "msub");
+  TEST_ASSERT(count_ops(*nmadd, x64::MOp::vfnmadd231) == 1);
+  TEST_ASSERT(count_ops(*msub, x64::MOp::vfmsub231) == 1);
+  TEST_ASSERT(count_ops(*msub, x64::MOp::muls) == 0);
+
+  // The product has a second use, it stays a separate multiplication.
+  TEST_ASSERT(count_fma(*find_function(fused, "shared")) == 0);
+
+  // Code for this process only fuses where the CPU can run it.
+  const x64::CompileOptions host = jit::for_host({ .fma = true });
+  TEST_ASSERT(host.fma == jit::cpu_has_fma());
+
+  const x64::MModule code = x64::compile_module(*module, host);
+  TEST_ASSERT(count_fma(code) == (host.fma ? 4 : 0));
+
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+  TEST_ASSERT(jit != nullptr);
+
+  const auto axpy = jit->function<double (*)(double, double, double)>("axpy");
+  const auto run_nmadd =
+    jit->function<float (*)(float, float, float)>("nmadd");
+  const auto run_msub = jit->function<float (*)(float, float, float)>("msub");
+  const auto add_twice = jit->function<float (*)(int32_t, float)>("add_twice");
+
+  TEST_ASSERT(axpy(2, 3, 1) == 7);
+  TEST_ASSERT(run_nmadd(2, 3, 1) == -5);
+  TEST_ASSERT(run_msub(2, 3, 1) == 5);
+  TEST_ASSERT(add_twice(3, 1.5f) == 6);
+  TEST_ASSERT(add_twice(-2, 0.25f) == -0.25f);
+
+  // (1 + e)(1 - e) - 1 is -e^2 exactly, the rounded product is 1.
+  const double e = std::ldexp(1.0, -30);
+  TEST_ASSERT(axpy(1 + e, 1 - e, -1) == (host.fma ? -e * e : 0.0));
+
+  return true;
+}
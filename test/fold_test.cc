@@ -0,0 +1,233 @@
+#include <string>
+
+#include "ast.h"
+#include "fold.h"
+#include "ir.h"
+#include "literal.h"
+#include "queries.h"
+#include "tokenizer.h"
+#include "util.h"
+
+#include "test.h"
+
+using namespace wcc;
+
+const char fold_src[] = "i32 main() {\n"
+                        "i8 a;\n"
+                        "u32 b;\n"
+                        "i32 c;\n"
+                        "f32 d;\n"
+                        "a = 100 + 100;\n"
+                        "b = 0 - 1;\n"
+                        "c = 10 + 20 * 30 + 5;\n"
+                        "c = 7 / 0;\n"
+                        "d = 1.5 * 2;\n"
+                        "return c;\n"
+                        "}\n";
+
+const char propagate_src[] = "i32 prop(i32 x) {\n"
+                             "i32 a;\n"
+                             "i32 b;\n"
+                             "a = 3;\n"
+                             "b = 1 + a * 4;\n"
+                             "a = b && 0;\n"
+                             "return a + b;\n"
+                             "}\n";
+
+static bool
+literal_test()
+{
+  TEST_ASSERT(is_eight_digits(load_eight_chars("12345678")));
+  TEST_ASSERT(!is_eight_digits(load_eight_chars("1234567a")));
+  TEST_ASSERT(!is_eight_digits(load_eight_chars("1234/678")));
+  TEST_ASSERT(parse_eight_digits(load_eight_chars("12345678")) == 12345678);
+  TEST_ASSERT(parse_eight_digits(load_eight_chars("00000009")) == 9);
+
+  uint64_t value;
+
+  TEST_ASSERT(parse_integer("0", value) && value == 0);
+  TEST_ASSERT(parse_integer("1234567890123", value) &&
+              value == 1234567890123);
+  TEST_ASSERT(parse_integer("18446744073709551615", value) &&
+              value == UINT64_MAX);
+  TEST_ASSERT(!parse_integer("18446744073709551616", value));
+  TEST_ASSERT(parse_integer("12345678901234567890", value) &&
+              value == 12345678901234567890u);
+  TEST_ASSERT(parse_integer("0x1F", value) && value == 31);
+  TEST_ASSERT(parse_integer("017", value) && value == 15);
+  TEST_ASSERT(!parse_integer("019", value));
+  TEST_ASSERT(!parse_integer("12a", value));
+  TEST_ASSERT(!parse_integer("0x", value));
+
+  AstLiteral literal;
+
+  TEST_ASSERT(parse_literal(TOKENID::INT_LITERAL, "2147483648", literal));
+  TEST_ASSERT(literal.type == LangType::lt_i64);
+  TEST_ASSERT(parse_literal(TOKENID::FLOAT_LITERAL, "2.5f", literal));
+  TEST_ASSERT(literal.type == LangType::lt_f32);
+  TEST_ASSERT(literal.value.f32_value == 2.5f);
+  TEST_ASSERT(parse_literal(TOKENID::FLOAT_LITERAL, "1e3", literal));
+  TEST_ASSERT(literal.type == LangType::lt_f64);
+  TEST_ASSERT(literal.value.f64_value == 1000.0);
+  TEST_ASSERT(!parse_literal(TOKENID::FLOAT_LITERAL, "1e999", literal));
+
+  const char src[] = "x = 1e-3 + 0x10 - 7;";
+  Tokenizer  tokenizer(src, sizeof(src) - 1);
+
+  TEST_ASSERT(tokenizer.get().id == TOKENID::IDENTIFIER);
+  TEST_ASSERT(tokenizer.get().id == TOKENID::OP_EQ);
+
+  Token token = tokenizer.get();
+  TEST_ASSERT(token.id == TOKENID::FLOAT_LITERAL && token.value == "1e-3");
+  TEST_ASSERT(tokenizer.get().id == TOKENID::OP_PLUS);
+
+  token = tokenizer.get();
+  TEST_ASSERT(token.id == TOKENID::INT_LITERAL && token.value == "0x10");
+  TEST_ASSERT(tokenizer.get().id == TOKENID::OP_MINUS);
+  TEST_ASSERT(tokenizer.get().id == TOKENID::INT_LITERAL);
+
+  return true;
+}
+
+static bool
+evaluator_test()
+{
+  const auto i8  = LangType::lt_i8;
+  const auto u8  = LangType::lt_u8;
+  const auto i32 = LangType::lt_i32;
+  const auto u32 = LangType::lt_u32;
+
+  // Wrapping at the width of the type, kept sign or zero extended.
+  TEST_ASSERT(fold_binary(ir::Opcode::add, i8, 100, 100) == uint64_t(-56));
+  TEST_ASSERT(fold_binary(ir::Opcode::add, u8, 200, 100) == 44);
+  TEST_ASSERT(fold_binary(ir::Opcode::sub, u32, 0, 1) == 0xFFFFFFFF);
+  TEST_ASSERT(fold_binary(ir::Opcode::div, i32, uint64_t(-7), 2) ==
+              uint64_t(-3));
+  TEST_ASSERT(fold_binary(ir::Opcode::mod, i32, uint64_t(-7), 2) ==
+              uint64_t(-1));
+
+  // Signedness decides comparisons and division.
+  TEST_ASSERT(fold_binary(ir::Opcode::cmp_lt, i32, uint64_t(-1), 1) == 1);
+  TEST_ASSERT(fold_binary(ir::Opcode::cmp_lt, u32, 0xFFFFFFFF, 1) == 0);
+  TEST_ASSERT(fold_binary(ir::Opcode::div, u32, 0xFFFFFFFF, 2) == 0x7FFFFFFF);
+
+  // Trapping operations are left alone.
+  TEST_ASSERT(!fold_binary(ir::Opcode::div, i32, 1, 0).has_value());
+  TEST_ASSERT(!fold_binary(ir::Opcode::div, i32, uint64_t(INT32_MIN), -1)
+                 .has_value());
+  TEST_ASSERT(!fold_binary(ir::Opcode::mod, i8, uint64_t(-128), -1)
+                 .has_value());
+
+  TEST_ASSERT(fold_conversion(ConvKind::trunc, i32, u8, 300) == 44);
+  TEST_ASSERT(fold_conversion(ConvKind::trunc, i32, i8, 200) ==
+              uint64_t(-56));
+  TEST_ASSERT(fold_conversion(ConvKind::sext, i8, i32, uint64_t(-1)) ==
+              uint64_t(-1));
+  TEST_ASSERT(fold_conversion(ConvKind::none, i32, u32, uint64_t(-1)) ==
+              0xFFFFFFFF);
+
+  VarValue f;
+  f.u64_value = 0;
+  f.f32_value = 3e9f;
+
+  TEST_ASSERT(!fold_conversion(ConvKind::fptosi, LangType::lt_f32, i32,
+                               f.u64_value)
+                 .has_value());
+  TEST_ASSERT(fold_conversion(ConvKind::fptoui, LangType::lt_f32, u32,
+                              f.u64_value) == 3000000000);
+
+  return true;
+}
+
+static const AstLiteral*
+assigned_literal(const AST& ast, size_t node)
+{
+  const auto& stmt = std::get<AstStmt>(ast.root.nodes[0]->nodes[node]->value);
+  const auto& rhs  = std::get<AstFunctionCall>(stmt.value).args[1];
+
+  if (rhs.type != StmtType::literal)
+    return nullptr;
+
+  return &std::get<AstLiteral>(rhs.value);
+}
+
+static bool
+ast_fold_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("fold.c", fold_src);
+
+  const auto& file = db.get<TypecheckQuery>("fold.c");
+  TEST_ASSERT(file->ok);
+
+  const AST& ast = *file->ast;
+
+  const AstLiteral* a = assigned_literal(ast, 4);
+  TEST_ASSERT(a != nullptr && a->type == LangType::lt_i8);
+  TEST_ASSERT(a->value.i64_value == -56);
+
+  const AstLiteral* b = assigned_literal(ast, 5);
+  TEST_ASSERT(b != nullptr && b->type == LangType::lt_u32);
+  TEST_ASSERT(b->value.u64_value == 0xFFFFFFFF);
+
+  const AstLiteral* c = assigned_literal(ast, 6);
+  TEST_ASSERT(c != nullptr && c->value.u64_value == 615);
+
+  // Division by zero is kept for the program to trap on.
+  TEST_ASSERT(assigned_literal(ast, 7) == nullptr);
+
+  const AstLiteral* d = assigned_literal(ast, 8);
+  TEST_ASSERT(d != nullptr && d->type == LangType::lt_f32);
+  TEST_ASSERT(d->value.f32_value == 3.0f);
+
+  return true;
+}
+
+static bool
+propagate_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("prop.c", propagate_src);
+
+  const auto& fn = db.get<LowerQuery>({ "prop.c", "prop" });
+  TEST_ASSERT(fn.has_value());
+  TEST_ASSERT(ir::verify(*fn));
+
+  // a = 3; b = 13; a = (13 != 0) && 0 = 0; return 13.
+  size_t      placed = 0;
+  ir::ValueId ret    = ir::NONE;
+
+  for (const auto& block : fn->blocks) {
+    for (const ir::ValueId v : block.instrs) {
+      ++placed;
+
+      TEST_ASSERT(fn->instrs[v].op != ir::Opcode::phi);
+      TEST_ASSERT(fn->instrs[v].op != ir::Opcode::condbr);
+
+      if (fn->instrs[v].op == ir::Opcode::ret)
+        ret = v;
+    }
+  }
+
+  TEST_ASSERT(ret != ir::NONE);
+
+  const ir::Instr& value = fn->instrs[fn->operand(ret, 0)];
+  TEST_ASSERT(value.op == ir::Opcode::constant && value.imm == 13);
+
+  // param, the returned constant, two branches along the former && and the
+  // return. Blocks are not merged here.
+  TEST_ASSERT(placed == 5);
+
+  return true;
+}
+
+bool
+fold_test()
+{
+  TEST_ASSERT(literal_test());
+  TEST_ASSERT(evaluator_test());
+  TEST_ASSERT(ast_fold_test());
+  TEST_ASSERT(propagate_test());
+
+  return true;
+}
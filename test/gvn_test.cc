@@ -0,0 +1,132 @@
+#include <string>
+
+#include "ir.h"
+#include "queries.h"
+#include "util.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char gvn_src[] = "i32 poly(i32 a, i32 b, i32 c) {\n"
+                       "i32 x;\n"
+                       "i32 y;\n"
+                       "i32 z;\n"
+                       "x = a + b * c;\n"
+                       "y = a + b * c;\n"
+                       "z = c * b + a;\n"
+                       "return x * y + z;\n"
+                       "}\n"
+                       "i32 order(i32 a, i32 b) {\n"
+                       "i32 x;\n"
+                       "i32 y;\n"
+                       "x = a < b;\n"
+                       "y = b > a;\n"
+                       "return x + y;\n"
+                       "}\n"
+                       "i32 down(i32 a, i32 b) {\n"
+                       "i32 x;\n"
+                       "i32 y;\n"
+                       "x = b / a;\n"
+                       "y = a && b / a;\n"
+                       "return x + y;\n"
+                       "}\n"
+                       "i32 up(i32 a, i32 b) {\n"
+                       "i32 x;\n"
+                       "i32 y;\n"
+                       "x = a && b / a;\n"
+                       "y = b / a;\n"
+                       "return x + y;\n"
+                       "}\n"
+                       "i32 quot(i32 a, i32 b) {\n"
+                       "i32 x;\n"
+                       "x = a / b;\n"
+                       "return x + b / a + a / b;\n"
+                       "}\n";
+
+bool
+gvn_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("gvn.c", gvn_src);
+
+  const auto lower = [&db](const char* name) {
+    return *db.get<LowerQuery>({ "gvn.c", name });
+  };
+
+  // All three spellings of a + b * c are one value.
+  const ir::Function poly = lower("poly");
+  TEST_ASSERT(ir::verify(poly));
+  TEST_ASSERT(count_ops(poly, ir::Opcode::mul) == 2);
+  TEST_ASSERT(count_ops(poly, ir::Opcode::add) == 2);
+
+  // a < b is b > a.
+  const ir::Function order = lower("order");
+  TEST_ASSERT(count_ops(order, ir::Opcode::cmp_lt) +
+                count_ops(order, ir::Opcode::cmp_gt) ==
+              1);
+
+  // A value is reused where its definition dominates, not where it was only
+  // computed on one path. A division may trap, so if-conversion leaves the
+  // path it is on alone.
+  const ir::Function down = lower("down");
+  const ir::Function up   = lower("up");
+  TEST_ASSERT(ir::verify(down) && ir::verify(up));
+  TEST_ASSERT(count_ops(down, ir::Opcode::div) == 1);
+  TEST_ASSERT(count_ops(up, ir::Opcode::div) == 2);
+
+  // Divisions are not commutative, and a repeated one traps at the first.
+  const ir::Function quot = lower("quot");
+  TEST_ASSERT(count_ops(quot, ir::Opcode::div) == 2);
+
+  // Phis of one block merging the same values, as two equal && produce.
+  ir::Function fn;
+  fn.name        = "phis";
+  fn.return_type = LangType::lt_i32;
+  fn.params      = { LangType::lt_i32 };
+
+  const ir::BlockId entry = fn.add_block();
+  const ir::BlockId other = fn.add_block();
+  const ir::BlockId join  = fn.add_block();
+
+  const LangType    i32  = LangType::lt_i32;
+  const ir::ValueId p    = fn.append(entry, ir::Opcode::param, i32);
+  const ir::ValueId zero = fn.append(entry, ir::Opcode::constant, i32);
+
+  fn.append(entry, ir::Opcode::condbr, LangType::lt_void, { p });
+  fn.add_edge(entry, other);
+  fn.add_edge(entry, join);
+  fn.append(other, ir::Opcode::br, LangType::lt_void);
+  fn.add_edge(other, join);
+
+  const ir::ValueId a   = fn.append(join, ir::Opcode::phi, i32, { p, zero });
+  const ir::ValueId b   = fn.append(join, ir::Opcode::phi, i32, { p, zero });
+  const ir::ValueId sum = fn.append(join, ir::Opcode::add, i32, { a, b });
+  fn.append(join, ir::Opcode::ret, LangType::lt_void, { sum });
+
+  ir::number_values(fn);
+  TEST_ASSERT(ir::verify(fn));
+  TEST_ASSERT(count_ops(fn, ir::Opcode::phi) == 1);
+  TEST_ASSERT(fn.operand(sum, 0) == fn.operand(sum, 1));
+
+  // An operation over vectors is not its scalar counterpart, even when the
+  // opcode, type and operands agree.
+  ir::Function lanes;
+  lanes.name        = "lanes";
+  lanes.return_type = LangType::lt_void;
+  lanes.params      = { LangType::lt_i32 };
+
+  const ir::BlockId body   = lanes.add_block();
+  const ir::ValueId x      = lanes.append(body, ir::Opcode::param, i32);
+  const ir::ValueId scalar = lanes.append(body, ir::Opcode::add, i32, { x, x });
+  const ir::ValueId vector = lanes.append(body, ir::Opcode::add, i32, { x, x });
+  lanes.instrs[vector].lanes = 4;
+  lanes.append(body, ir::Opcode::ret, LangType::lt_void);
+
+  ir::number_values(lanes);
+  TEST_ASSERT(count_ops(lanes, ir::Opcode::add) == 2);
+  TEST_ASSERT(lanes.instrs[scalar].op == ir::Opcode::add);
+
+  return true;
+}
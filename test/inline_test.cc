@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <string>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "util.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char inline_src[] = "i64 add(i64 a, i64 b) {\n"
+                          "return a + b;\n"
+                          "}\n"
+                          "i32 pick(i32 a, i32 b) {\n"
+                          "return a && b;\n"
+                          "}\n"
+                          "i32 both(i32 x, i32 y) {\n"
+                          "return pick(x, y) + pick(y, 0);\n"
+                          "}\n"
+                          "i32 even(i32 n) {\n"
+                          "return odd(n);\n"
+                          "}\n"
+                          "i32 odd(i32 n) {\n"
+                          "return even(n);\n"
+                          "}\n"
+                          "i32 main() {\n"
+                          "return add(3, 4);\n"
+                          "}\n";
+
+static bool
+decided(const ir::Module&  module,
+        const std::string& caller,
+        const std::string& callee,
+        ir::InlineVerdict  verdict)
+{
+  return std::any_of(module.inline_report.begin(),
+                     module.inline_report.end(),
+                     [&](const ir::InlineDecision& decision) {
+                       return decision.caller == caller &&
+                              decision.callee == callee &&
+                              decision.verdict == verdict;
+                     });
+}
+
+bool
+inline_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("inline.c", inline_src);
+
+  const auto& module = db.get<ModuleQuery>("inline.c");
+  TEST_ASSERT(module != nullptr);
+
+  for (const auto& fn : module->functions)
+    TEST_ASSERT(ir::verify(fn));
+
+  // add(3, 4) is inlined and folded into a constant.
+  const ir::Function* main = find_function(*module, "main");
+  TEST_ASSERT(main != nullptr);
+  TEST_ASSERT(count_ops(*main, ir::Opcode::call) == 0);
+  TEST_ASSERT(decided(*module, "main", "add", ir::InlineVerdict::inlined));
+
+  const ir::ValueId ret = main->blocks[0].instrs.back();
+  const ir::ValueId seven = main->operand(ret, 0);
+  TEST_ASSERT(main->instrs[ret].op == ir::Opcode::ret);
+  TEST_ASSERT(main->instrs[seven].op == ir::Opcode::constant);
+  TEST_ASSERT(main->instrs[seven].imm == 7);
+
+  // Both calls of a callee using && are expanded, if-conversion already
+  // left no branch in it.
+  const ir::Function* both = find_function(*module, "both");
+  TEST_ASSERT(both != nullptr);
+  TEST_ASSERT(count_ops(*both, ir::Opcode::call) == 0);
+  TEST_ASSERT(count_ops(*both, ir::Opcode::phi) == 0);
+  TEST_ASSERT(count_ops(*both, ir::Opcode::condbr) == 0);
+
+  // Calls within a cycle of the call graph stay calls.
+  TEST_ASSERT(decided(*module, "even", "odd", ir::InlineVerdict::recursive));
+  TEST_ASSERT(decided(*module, "odd", "even", ir::InlineVerdict::recursive));
+  TEST_ASSERT(count_ops(*find_function(*module, "odd"), ir::Opcode::call) == 1);
+
+  // The inlined code computes what the calls did.
+  const x64::MModule code = x64::compile_module(*module);
+  const auto         jit  = jit::JitModule::load(code, x64::encode_module(code));
+  TEST_ASSERT(jit != nullptr);
+
+  const auto run_both = jit->function<int32_t (*)(int32_t, int32_t)>("both");
+  const auto run_main = jit->function<int32_t (*)()>("main");
+  TEST_ASSERT(run_both(1, 2) == 1);
+  TEST_ASSERT(run_both(0, 2) == 0);
+  TEST_ASSERT(run_main() == 7);
+
+  // The limits of the cost model.
+  const auto& file    = db.get<TypecheckQuery>("inline.c");
+  const auto& layouts = db.get<LayoutQuery>("inline.c");
+
+  ir::Module costly = ir::lower_module(*file, layouts);
+  ir::Module large  = ir::lower_module(*file, layouts);
+
+  for (size_t i = 0; i < costly.functions.size(); ++i) {
+    for (ir::Function* fn : { &costly.functions[i], &large.functions[i] }) {
+      ir::mem2reg(*fn);
+      ir::propagate_constants(*fn);
+    }
+  }
+
+  ir::inline_calls(costly, { .threshold = -100 });
+  ir::inline_calls(large, { .max_caller_size = 3 });
+
+  TEST_ASSERT(decided(costly, "main", "add", ir::InlineVerdict::too_costly));
+  TEST_ASSERT(count_ops(*find_function(costly, "main"), ir::Opcode::call) == 1);
+  TEST_ASSERT(
+    decided(large, "both", "pick", ir::InlineVerdict::caller_too_large));
+
+  return true;
+}
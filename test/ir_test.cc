@@ -0,0 +1,92 @@
+#include <string>
+
+#include "ir.h"
+#include "queries.h"
+#include "query.h"
+#include "util.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char ir_src[] = "i32 g;\n"
+                      "i32 logic(i32 a, i32 b) {\n"
+                      "i32 c;\n"
+                      "c = a && b;\n"
+                      "c = c || a;\n"
+                      "g = c;\n"
+                      "return c;\n"
+                      "}\n"
+                      "i64 widen(i32 a) {\n"
+                      "i64 r;\n"
+                      "r = a;\n"
+                      "r *= 3;\n"
+                      "return r;\n"
+                      "}\n";
+
+bool
+ir_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("ir.c", ir_src);
+
+  const auto& module = db.get<ModuleQuery>("ir.c");
+  TEST_ASSERT(module != nullptr);
+  TEST_ASSERT(module->globals.size() == 1);
+  TEST_ASSERT(module->functions.size() == 2);
+
+  const ir::Function& logic = module->functions[0];
+  TEST_ASSERT(logic.name == "logic");
+  TEST_ASSERT(ir::verify(logic));
+
+  // Every local was promoted, only the global access stays in memory.
+  TEST_ASSERT(count_ops(logic, ir::Opcode::local) == 0);
+  TEST_ASSERT(count_ops(logic, ir::Opcode::load) == 0);
+  TEST_ASSERT(count_ops(logic, ir::Opcode::store) == 0);
+  TEST_ASSERT(count_ops(logic, ir::Opcode::gstore) == 1);
+
+  // If-conversion computes both operators without a branch.
+  TEST_ASSERT(count_ops(logic, ir::Opcode::condbr) == 0);
+  TEST_ASSERT(count_ops(logic, ir::Opcode::phi) == 0);
+  TEST_ASSERT(count_ops(logic, ir::Opcode::bit_and) == 1);
+  TEST_ASSERT(count_ops(logic, ir::Opcode::bit_or) == 1);
+
+  // Before it they short-circuit:
+  // entry -> {rhs1, end1}, rhs1 -> end1 -> {rhs2, end2}, rhs2 -> end2
+  const auto&  file = db.get<TypecheckQuery>("ir.c");
+  ir::Function cfg  = ir::lower_function(
+    *file, db.get<LayoutQuery>("ir.c"), *find_function(*file->ast, "logic"));
+  ir::mem2reg(cfg);
+
+  TEST_ASSERT(ir::verify(cfg));
+  TEST_ASSERT(count_ops(cfg, ir::Opcode::phi) == 2);
+  TEST_ASSERT(cfg.blocks.size() == 5);
+
+  const ir::DomTree dom = ir::build_dom_tree(cfg);
+  TEST_ASSERT(dom.idom[1] == 0);
+  TEST_ASSERT(dom.idom[2] == 0);
+  TEST_ASSERT(dom.idom[3] == 2);
+  TEST_ASSERT(dom.idom[4] == 2);
+  TEST_ASSERT(dom.dominates(0, 4));
+  TEST_ASSERT(!dom.dominates(1, 2));
+
+  const auto df = ir::dominance_frontiers(cfg, dom);
+  TEST_ASSERT(df[1].size() == 1 && df[1][0] == 2);
+  TEST_ASSERT(df[3].size() == 1 && df[3][0] == 4);
+
+  const ir::Function& widen = module->functions[1];
+  TEST_ASSERT(ir::verify(widen));
+  TEST_ASSERT(widen.blocks.size() == 1);
+  TEST_ASSERT(count_ops(widen, ir::Opcode::load) == 0);
+  // The literal 3 is widened at compile time, only the parameter is not.
+  TEST_ASSERT(count_ops(widen, ir::Opcode::conv) == 1);
+  TEST_ASSERT(count_ops(widen, ir::Opcode::mul) == 1);
+
+  // Lowering is deterministic, so an unchanged function backdates.
+  db.set<SourceTextQuery>("ir.c", std::string(ir_src) + "\n");
+  db.get<ModuleQuery>("ir.c");
+  TEST_ASSERT(db.stats.backdated > 0);
+
+  return true;
+}
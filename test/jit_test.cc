@@ -0,0 +1,95 @@
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <unistd.h>
+
+#include "jit.h"
+#include "queries.h"
+#include "util.h"
+
+#include "test.h"
+
+using namespace wcc;
+
+const char jit_src[] = "i64 counter;\n"
+                       "i32 mul3(i32 a, i32 b, i32 c) {\n"
+                       "return a * b * c;\n"
+                       "}\n"
+                       "f64 scale(f64 x, f32 k) {\n"
+                       "return x * k;\n"
+                       "}\n"
+                       "i64 bump(i64 by) {\n"
+                       "counter = counter + by;\n"
+                       "return counter;\n"
+                       "}\n"
+                       "i32 main() {\n"
+                       "i32 x;\n"
+                       "x = mul3(2, 3, 4);\n"
+                       "bump(x);\n"
+                       "return bump(1);\n"
+                       "}\n";
+
+static std::unique_ptr<jit::JitModule>
+load(const std::string& source)
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("jit.c", source);
+
+  const auto& module = db.get<ModuleQuery>("jit.c");
+
+  if (module == nullptr)
+    return nullptr;
+
+  const x64::MModule code = x64::compile_module(*module);
+  return jit::JitModule::load(code, x64::encode_module(code));
+}
+
+bool
+jit_test()
+{
+  auto jit = load(jit_src);
+
+  TEST_ASSERT(jit != nullptr);
+  TEST_ASSERT(jit->lookup("missing") == nullptr);
+
+  // Functions are called straight through their native signatures.
+  const auto mul3  = jit->function<int32_t (*)(int32_t, int32_t, int32_t)>("mul3");
+  const auto scale = jit->function<double (*)(double, float)>("scale");
+  const auto bump  = jit->function<int64_t (*)(int64_t)>("bump");
+  const auto entry = jit->function<int32_t (*)()>("main");
+
+  TEST_ASSERT(mul3 != nullptr && scale != nullptr);
+  TEST_ASSERT(bump != nullptr && entry != nullptr);
+  TEST_ASSERT(mul3(-2, 5, 7) == -70);
+  TEST_ASSERT(scale(2.5, 4.0f) == 10.0);
+
+  // main calls into the same buffer, the global starts out zero and keeps
+  // its value between calls.
+  TEST_ASSERT(entry() == 25);
+  TEST_ASSERT(bump(0) == 25);
+  TEST_ASSERT(entry() == 50);
+
+  // A second module gets its own globals.
+  auto other = load(jit_src);
+
+  TEST_ASSERT(other != nullptr);
+  TEST_ASSERT(other->function<int32_t (*)()>("main")() == 25);
+
+  const std::string map_path = fmt::format("/tmp/perf-{}.map", getpid());
+  unlink(map_path.c_str());
+
+  TEST_ASSERT(jit->write_perf_map());
+
+  std::ifstream     map(map_path);
+  const std::string lines(std::istreambuf_iterator<char>(map), {});
+  const std::string mul3_line =
+    fmt::format("{:x} ", reinterpret_cast<uintptr_t>(mul3));
+
+  TEST_ASSERT(lines.find(mul3_line) == 0);
+  TEST_ASSERT(lines.find(" main\n") != std::string::npos);
+
+  unlink(map_path.c_str());
+
+  return true;
+}
@@ -0,0 +1,297 @@
+#include <string>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "tree_walker.h"
+#include "util.h"
+#include "vm.h"
+#include "x64.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char loop_src[] = "i32 g;\n"
+                        "i32 sum(i32 n) {\n"
+                        "i32 s;\n"
+                        "i32 i;\n"
+                        "s = 0;\n"
+                        "for (i = 0; i < n; i = i + 1) {\n"
+                        "s = s + i;\n"
+                        "}\n"
+                        "return s;\n"
+                        "}\n"
+                        "i32 invariant(i32 n, i32 a, i32 b) {\n"
+                        "i32 s;\n"
+                        "i32 i;\n"
+                        "s = 0;\n"
+                        "for (i = 0; i < n; i = i + 1) {\n"
+                        "i32 t;\n"
+                        "t = a * b;\n"
+                        "s = s + t;\n"
+                        "}\n"
+                        "return s;\n"
+                        "}\n"
+                        "i32 stride(i32 n) {\n"
+                        "i32 s;\n"
+                        "i32 i;\n"
+                        "i32 u;\n"
+                        "s = 0;\n"
+                        "for (i = 0; i < n; i = i + 1) {\n"
+                        "u = i * 7;\n"
+                        "s = s + u;\n"
+                        "}\n"
+                        "return s;\n"
+                        "}\n"
+                        "i32 eight() {\n"
+                        "i32 s;\n"
+                        "i32 i;\n"
+                        "s = 0;\n"
+                        "for (i = 0; i < 8; i = i + 1) {\n"
+                        "s = s + i;\n"
+                        "}\n"
+                        "return s;\n"
+                        "}\n"
+                        "i32 count() {\n"
+                        "i32 i;\n"
+                        "i = 0;\n"
+                        "while (i < 1000) {\n"
+                        "i = i + 3;\n"
+                        "}\n"
+                        "return i;\n"
+                        "}\n"
+                        "i32 hundred() {\n"
+                        "i32 i;\n"
+                        "for (i = 0; i < 100; i = i + 1) {\n"
+                        "g = g + i;\n"
+                        "}\n"
+                        "return g;\n"
+                        "}\n"
+                        "i32 nested(i32 n) {\n"
+                        "i32 s;\n"
+                        "i32 i;\n"
+                        "i32 j;\n"
+                        "s = 0;\n"
+                        "for (i = 0; i < n; i = i + 1) {\n"
+                        "for (j = 0; j < 3; j = j + 1) {\n"
+                        "s = s + j;\n"
+                        "s = s + i;\n"
+                        "}\n"
+                        "}\n"
+                        "return s;\n"
+                        "}\n"
+                        "i32 ten() {\n"
+                        "i32 n;\n"
+                        "i32 s;\n"
+                        "n = 10;\n"
+                        "s = 0;\n"
+                        "while (n) {\n"
+                        "s = s + n;\n"
+                        "n = n - 1;\n"
+                        "}\n"
+                        "return s;\n"
+                        "}\n"
+                        "i32 back() {\n"
+                        "i32 s;\n"
+                        "i32 i;\n"
+                        "s = 0;\n"
+                        "for (i = 10; i > 0; i = i - 2) {\n"
+                        "s = s + i;\n"
+                        "}\n"
+                        "return s;\n"
+                        "}\n"
+                        "i32 wraps() {\n"
+                        "u8 i;\n"
+                        "i32 c;\n"
+                        "c = 0;\n"
+                        "for (i = 250; i > 5; i = i + 1) {\n"
+                        "c = c + 1;\n"
+                        "}\n"
+                        "return c;\n"
+                        "}\n"
+                        "f64 halves(f64 x) {\n"
+                        "f64 s;\n"
+                        "s = 0;\n"
+                        "while (x) {\n"
+                        "s = s + x;\n"
+                        "x = x - 0.5;\n"
+                        "}\n"
+                        "return s;\n"
+                        "}\n";
+
+static ir::ValueId
+find_op(const ir::Function& fn, ir::Opcode op)
+{
+  for (const auto& block : fn.blocks) {
+    for (const ir::ValueId v : block.instrs) {
+      if (fn.instrs[v].op == op)
+        return v;
+    }
+  }
+
+  return ir::NONE;
+}
+
+static size_t
+count_loops(ir::Function fn)
+{
+  return ir::find_loops(fn).loops.size();
+}
+
+// The closed form trip count of the only loop of `fn`.
+static std::optional<uint64_t>
+trip_count(ir::Function fn)
+{
+  const ir::LoopInfo info = ir::find_loops(fn);
+  return ir::trip_count(fn, info.loops[0]);
+}
+
+bool
+loop_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("loop.c", loop_src);
+
+  const auto& file = db.get<TypecheckQuery>("loop.c");
+  TEST_ASSERT(file->ok);
+
+  // Trip counts of the loops as lowered.
+  ir::Module lowered = ir::lower_module(*file, db.get<LayoutQuery>("loop.c"));
+
+  for (ir::Function& fn : lowered.functions) {
+    ir::mem2reg(fn);
+    ir::propagate_constants(fn);
+  }
+
+  TEST_ASSERT(!trip_count(lowered.functions[0]).has_value());
+  TEST_ASSERT(trip_count(lowered.functions[3]) == 8);
+  TEST_ASSERT(trip_count(lowered.functions[4]) == 334);
+  TEST_ASSERT(trip_count(lowered.functions[5]) == 100);
+  TEST_ASSERT(trip_count(lowered.functions[7]) == 10);
+  TEST_ASSERT(trip_count(lowered.functions[8]) == 5);
+
+  // The u8 counts up past 255 and wraps to leave.
+  TEST_ASSERT(!trip_count(lowered.functions[9]).has_value());
+
+  const auto lower = [&db](const char* name) {
+    return *db.get<LowerQuery>({ "loop.c", name });
+  };
+
+  // Unknown trip count: four copies, each with its exit test.
+  const ir::Function sum = lower("sum");
+  TEST_ASSERT(ir::verify(sum));
+  TEST_ASSERT(count_ops(sum, ir::Opcode::condbr) == 4);
+
+  // a * b is computed once, before the loop.
+  ir::Function       invariant = lower("invariant");
+  const ir::LoopInfo info      = ir::find_loops(invariant);
+  TEST_ASSERT(ir::verify(invariant));
+  TEST_ASSERT(count_ops(invariant, ir::Opcode::mul) == 1);
+  TEST_ASSERT(
+    info.loop_of[invariant.instrs[find_op(invariant, ir::Opcode::mul)].block] ==
+    ir::NONE);
+
+  // i * 7 is a variable of its own, advanced by 7.
+  const ir::Function stride = lower("stride");
+  TEST_ASSERT(ir::verify(stride));
+  TEST_ASSERT(count_ops(stride, ir::Opcode::mul) == 0);
+
+  // Unrolled completely and folded.
+  const ir::Function eight = lower("eight");
+  TEST_ASSERT(count_ops(eight, ir::Opcode::condbr) == 0);
+  TEST_ASSERT(count_loops(eight) == 0);
+
+  // The final value of the variable is known and the loop is gone.
+  const ir::Function count = lower("count");
+  TEST_ASSERT(count_loops(count) == 0);
+  TEST_ASSERT(count.instrs[find_op(count, ir::Opcode::constant)].imm == 1002);
+
+  // A hundred iterations, four per test.
+  const ir::Function hundred = lower("hundred");
+  TEST_ASSERT(ir::verify(hundred));
+  TEST_ASSERT(count_ops(hundred, ir::Opcode::condbr) == 1);
+  TEST_ASSERT(count_ops(hundred, ir::Opcode::gstore) == 4);
+
+  // The inner loop is unrolled completely, the outer one is left.
+  const ir::Function nested = lower("nested");
+  TEST_ASSERT(ir::verify(nested));
+  TEST_ASSERT(count_loops(nested) == 1);
+
+  // Nothing unrolls with the unroller disabled.
+  ir::Function plain = lowered.functions[0];
+  TEST_ASSERT(ir::unroll_loops(plain, { .full_trip_count = 0, .factor = 1 }) ==
+              0);
+  TEST_ASSERT(count_ops(plain, ir::Opcode::condbr) == 1);
+
+  // Every engine agrees.
+  const auto& module = db.get<ModuleQuery>("loop.c");
+  TEST_ASSERT(module != nullptr);
+
+  for (const ir::Function& fn : module->functions)
+    TEST_ASSERT(ir::verify(fn));
+
+  const x64::MModule code = x64::compile_module(*module);
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+  TEST_ASSERT(jit != nullptr);
+
+  vm::Program program;
+  TEST_ASSERT(vm::compile(*file, db.get<LayoutQuery>("loop.c"), program));
+
+  vm::Machine machine(program);
+  TreeWalker  walker(*file);
+
+  // Canonical i32 results are sign extended.
+  const auto agree = [&](const char*           name,
+                         std::vector<VarValue> args,
+                         int64_t               expected) {
+    VarValue reference, result;
+
+    return walker.call(name, args, reference) &&
+           machine.call(program.find(name), args, result) &&
+           result.u64_value == reference.u64_value &&
+           reference.i64_value == expected;
+  };
+
+  const auto sum_fn = jit->function<int32_t (*)(int32_t)>("sum");
+  const auto invariant_fn =
+    jit->function<int32_t (*)(int32_t, int32_t, int32_t)>("invariant");
+  const auto stride_fn = jit->function<int32_t (*)(int32_t)>("stride");
+  const auto nested_fn = jit->function<int32_t (*)(int32_t)>("nested");
+  const auto halves_fn = jit->function<double (*)(double)>("halves");
+
+  for (int32_t n = -1; n < 10; ++n) {
+    const VarValue arg = int_value(n);
+
+    TEST_ASSERT(agree("sum", { arg }, sum_fn(n)));
+    TEST_ASSERT(agree("stride", { arg }, stride_fn(n)));
+    TEST_ASSERT(agree("nested", { arg }, nested_fn(n)));
+    TEST_ASSERT(agree(
+      "invariant", { arg, int_value(3), int_value(5) }, invariant_fn(n, 3, 5)));
+  }
+
+  TEST_ASSERT(sum_fn(100) == 4950);
+  TEST_ASSERT(stride_fn(4) == 42);
+  TEST_ASSERT(nested_fn(4) == 30);
+  TEST_ASSERT(invariant_fn(6, 3, 5) == 90);
+
+  const std::pair<const char*, int32_t> constants[] = {
+    { "eight", 28 }, { "count", 1002 }, { "hundred", 4950 },
+    { "ten", 55 },   { "back", 30 },    { "wraps", 6 },
+  };
+
+  for (const auto& [name, expected] : constants) {
+    TEST_ASSERT(jit->function<int32_t (*)()>(name)() == expected);
+    TEST_ASSERT(agree(name, {}, expected));
+  }
+
+  VarValue x, halves;
+  x.f64_value = 2;
+  TEST_ASSERT(halves_fn(2) == 5);
+  TEST_ASSERT(walker.call("halves", { x }, halves) && halves.f64_value == 5);
+  TEST_ASSERT(machine.call(program.find("halves"), { x }, halves) &&
+              halves.f64_value == 5);
+
+  return true;
+}
@@ -43,6 +43,13 @@ struct test_ctx
   } second_assignment;
 };
 
+static bool
+is_int_literal(const AstStmt& stmt, uint64_t value)
+{
+  return stmt.type == StmtType::literal &&
+         std::get<AstLiteral>(stmt.value).value.u64_value == value;
+}
+
 static bool
 check_first_assign_(struct test_ctx& ctx, const AstStmt& stmt)
 {
@@ -61,10 +68,10 @@ check_first_assign_(struct test_ctx& ctx, const AstStmt& stmt)
     bool arg_20 = false, arg_30 = false;
 
     for (const auto& arg : call.args) {
-      TEST_ASSERT(arg.type == StmtType::varref);
+      TEST_ASSERT(arg.type == StmtType::literal);
 
-      arg_20 |= std::get<AstSymRef>(arg.value).name == "20";
-      arg_30 |= std::get<AstSymRef>(arg.value).name == "30";
+      arg_20 |= is_int_literal(arg, 20);
+      arg_30 |= is_int_literal(arg, 30);
     }
 
     TEST_ASSERT(arg_20);
@@ -77,15 +84,13 @@ check_first_assign_(struct test_ctx& ctx, const AstStmt& stmt)
     TEST_ASSERT(call.args.size() == 2);
 
     for (const auto& arg : call.args) {
-      if (arg.type != StmtType::varref)
+      if (arg.type != StmtType::literal)
         continue;
 
       // Make sure we have seen arg 10 and arg 5 only once and never at the
       // same time as an argument to the same operator plus.
-      const auto arg_10_local =
-        std::get<AstSymRef>(call.args[0].value).name == "10";
-      const auto arg_5_local =
-        std::get<AstSymRef>(call.args[0].value).name == "5";
+      const auto arg_10_local = is_int_literal(arg, 10);
+      const auto arg_5_local  = is_int_literal(arg, 5);
 
       ctx.first_assignment.arg_10 += arg_10_local;
       ctx.first_assignment.arg_5 += arg_5_local;
@@ -129,10 +134,10 @@ check_second_assign_(struct test_ctx& ctx, const AstStmt& stmt)
     bool arg_12 = false, arg_13 = false;
 
     for (const auto& arg : call.args) {
-      TEST_ASSERT(arg.type == StmtType::varref);
+      TEST_ASSERT(arg.type == StmtType::literal);
 
-      arg_12 |= std::get<AstSymRef>(arg.value).name == "12";
-      arg_13 |= std::get<AstSymRef>(arg.value).name == "13";
+      arg_12 |= is_int_literal(arg, 12);
+      arg_13 |= is_int_literal(arg, 13);
     }
 
     TEST_ASSERT(arg_12);
@@ -145,10 +150,10 @@ check_second_assign_(struct test_ctx& ctx, const AstStmt& stmt)
     TEST_ASSERT(call.args.size() == 2);
 
     for (const auto& arg : call.args) {
-      if (arg.type != StmtType::varref)
+      if (arg.type != StmtType::literal)
         continue;
 
-      TEST_ASSERT(std::get<AstSymRef>(call.args[0].value).name == "4");
+      TEST_ASSERT(is_int_literal(arg, 4));
     }
 
     ++ctx.second_assignment.adds_checked;
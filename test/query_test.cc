@@ -0,0 +1,125 @@
+#include <string>
+
+#include "ast.h"
+#include "queries.h"
+#include "query.h"
+#include "typecheck.h"
+#include "util.h"
+
+#include "test.h"
+
+using namespace wcc;
+
+const char query_src_v1[] = "i64 add(i64 a, i64 b) {\n"
+                            "i64 ret;\n"
+                            "ret = a + b;\n"
+                            "return ret;\n"
+                            "}\n";
+
+// Same signature, different body.
+const char query_src_v2[] = "i64 add(i64 a, i64 b) {\n"
+                            "i64 ret;\n"
+                            "ret = b + a;\n"
+                            "return ret;\n"
+                            "}\n";
+
+// Different signature.
+const char query_src_v3[] = "i64 add(i64 a, i32 b) {\n"
+                            "return a;\n"
+                            "}\n";
+
+static size_t param_count_runs = 0;
+
+// Depends only on the signature, so it must survive edits to the body.
+struct ParamCountQuery
+{
+  using Key   = FunctionKey;
+  using Value = size_t;
+
+  static constexpr const char* name = "param_count";
+
+  static Value execute(QueryDatabase& db, const Key& func)
+  {
+    ++param_count_runs;
+
+    const auto& sig = db.get<SignatureQuery>(func);
+    return sig.has_value() ? sig->params.size() : 0;
+  }
+};
+
+static size_t expr_width_runs = 0;
+
+// Depends on the type of a single expression.
+struct ExprWidthQuery
+{
+  using Key   = ExprKey;
+  using Value = uint32_t;
+
+  static constexpr const char* name = "expr_width";
+
+  static Value execute(QueryDatabase& db, const Key& expr)
+  {
+    ++expr_width_runs;
+    return type_size(db.get<TypeOfQuery>(expr));
+  }
+};
+
+bool
+query_test()
+{
+  QueryDatabase     db;
+  const FunctionKey add_key{ "query.c", "add" };
+
+  db.set<SourceTextQuery>("query.c", query_src_v1);
+
+  TEST_ASSERT(db.get<ParamCountQuery>(add_key) == 2);
+  TEST_ASSERT(param_count_runs == 1);
+
+  const auto* ast_v1 = db.get<ParseQuery>("query.c").get();
+
+  // a + b in the body of add.
+  const ExprKey sum_key{ "query.c", 2 };
+  TEST_ASSERT(db.get<TypeOfQuery>(sum_key) == LangType::lt_i64);
+  TEST_ASSERT(db.get<ExprWidthQuery>(sum_key) == 8);
+  TEST_ASSERT(expr_width_runs == 1);
+  TEST_ASSERT(db.get<TypeOfQuery>({ "query.c", 1000 }) == LangType::lt_void);
+
+  // Nothing changed: everything is served from the memo tables.
+  TEST_ASSERT(db.get<ParamCountQuery>(add_key) == 2);
+  TEST_ASSERT(param_count_runs == 1);
+  TEST_ASSERT(db.get<ParseQuery>("query.c").get() == ast_v1);
+
+  // Setting an identical input does not start a new revision.
+  const auto revision = db.revision();
+  db.set<SourceTextQuery>("query.c", query_src_v1);
+  TEST_ASSERT(db.revision() == revision);
+
+  // Body edit: the file is reparsed, the signature is recomputed but equal
+  // (backdated), so the dependent query stays green.
+  db.set<SourceTextQuery>("query.c", query_src_v2);
+
+  TEST_ASSERT(db.get<ParamCountQuery>(add_key) == 2);
+  TEST_ASSERT(param_count_runs == 1);
+  TEST_ASSERT(db.get<ParseQuery>("query.c").get() != ast_v1);
+  TEST_ASSERT(db.stats.backdated == 1);
+
+  // The file is analyzed again, the type of the expression is the same.
+  TEST_ASSERT(db.get<ExprWidthQuery>(sum_key) == 8);
+  TEST_ASSERT(expr_width_runs == 1);
+  TEST_ASSERT(db.stats.backdated == 2);
+
+  // Signature edit: the change propagates.
+  db.set<SourceTextQuery>("query.c", query_src_v3);
+
+  TEST_ASSERT(db.get<ParamCountQuery>(add_key) == 2);
+  TEST_ASSERT(param_count_runs == 2);
+
+  const auto& sig = db.get<SignatureQuery>(add_key);
+  TEST_ASSERT(sig.has_value());
+  TEST_ASSERT(sig->return_type == LangType::lt_i64);
+  TEST_ASSERT(sig->params[1] == LangType::lt_i32);
+
+  TEST_ASSERT(!db.get<SignatureQuery>({ "query.c", "missing" }).has_value());
+
+  return true;
+}
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <string>
+
+#include "ir.h"
+#include "queries.h"
+#include "util.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char reassoc_src[] = "i64 sum8(i64 a, i64 b, i64 c, i64 d,\n"
+                           "i64 e, i64 f, i64 g, i64 h) {\n"
+                           "return a + b + c + d + e + f + g + h;\n"
+                           "}\n"
+                           "i32 consts(i32 a, i32 b, i32 c) {\n"
+                           "return a + 1 + b + 2 + c;\n"
+                           "}\n"
+                           "i32 masks(i32 a, i32 b) {\n"
+                           "return a & 255 & b & 15;\n"
+                           "}\n"
+                           "f64 fsum(f64 a, f64 b, f64 c, f64 d) {\n"
+                           "return a + b + c + d;\n"
+                           "}\n"
+                           "i32 shared(i32 a, i32 b, i32 c, i32 d) {\n"
+                           "i32 x;\n"
+                           "x = a + b;\n"
+                           "return x + c + d + x;\n"
+                           "}\n"
+                           "i32 perm(i32 a, i32 b, i32 c) {\n"
+                           "i32 x;\n"
+                           "i32 y;\n"
+                           "x = a + b + c;\n"
+                           "y = c + b + a;\n"
+                           "return x - y;\n"
+                           "}\n";
+
+// The returned value of a single block function.
+static ir::ValueId
+returned(const ir::Function& fn)
+{
+  for (const ir::ValueId v : fn.blocks[0].instrs) {
+    if (fn.instrs[v].op == ir::Opcode::ret)
+      return fn.operand(v, 0);
+  }
+
+  return ir::NONE;
+}
+
+// Longest path of `op` instructions ending in `v`.
+static size_t
+depth(const ir::Function& fn, ir::ValueId v, ir::Opcode op)
+{
+  if (fn.instrs[v].op != op)
+    return 0;
+
+  return 1 + std::max(depth(fn, fn.operand(v, 0), op),
+                      depth(fn, fn.operand(v, 1), op));
+}
+
+bool
+reassoc_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("reassoc.c", reassoc_src);
+
+  const auto& file = db.get<TypecheckQuery>("reassoc.c");
+  TEST_ASSERT(file->ok);
+
+  ir::Module before = ir::lower_module(*file, db.get<LayoutQuery>("reassoc.c"));
+
+  for (ir::Function& fn : before.functions) {
+    ir::mem2reg(fn);
+    ir::propagate_constants(fn);
+  }
+
+  ir::Module after = before;
+
+  for (ir::Function& fn : after.functions) {
+    ir::reassociate(fn);
+    TEST_ASSERT(ir::verify(fn));
+  }
+
+  // Eight leaves chained to the left become a tree of depth three.
+  const ir::Function& sum8 = after.functions[0];
+  TEST_ASSERT(depth(before.functions[0],
+                    returned(before.functions[0]),
+                    ir::Opcode::add) == 7);
+  TEST_ASSERT(depth(sum8, returned(sum8), ir::Opcode::add) == 3);
+  TEST_ASSERT(count_ops(sum8, ir::Opcode::add) == 7);
+
+  // The constants meet in one, added last.
+  const ir::Function& consts = after.functions[1];
+  const ir::ValueId   top    = returned(consts);
+  TEST_ASSERT(count_ops(consts, ir::Opcode::add) == 3);
+  TEST_ASSERT(consts.instrs[consts.operand(top, 1)].op ==
+              ir::Opcode::constant);
+  TEST_ASSERT(consts.instrs[consts.operand(top, 1)].imm == 3);
+
+  const ir::Function& masks = after.functions[2];
+  TEST_ASSERT(count_ops(masks, ir::Opcode::bit_and) == 2);
+
+  // Floating point addition is not associative.
+  const ir::Function& fsum = after.functions[3];
+  TEST_ASSERT(depth(fsum, returned(fsum), ir::Opcode::add) == 3);
+
+  // A value used twice stays computed once.
+  TEST_ASSERT(count_ops(after.functions[4], ir::Opcode::add) == 4);
+
+  // Every function still computes what it did.
+  const std::vector<std::vector<uint64_t>> args = {
+    { 1, 2, 3, 4, 5, 6, 7, uint64_t(-100) },
+    { 10, uint32_t(-20), 30 },
+    { 0x1234, 0xfff7 },
+    {},
+    { 5, 6, 7, 8 },
+    { 3, 4, 5 },
+  };
+
+  for (uint32_t f = 0; f < args.size(); ++f) {
+    if (args[f].empty())
+      continue;
+
+    ir::EvalStats stats;
+    const auto    expected = ir::evaluate(before, f, args[f], stats);
+
+    TEST_ASSERT(expected.has_value());
+    TEST_ASSERT(ir::evaluate(after, f, args[f], stats) == expected);
+  }
+
+  // In a canonical order the two spellings are one value.
+  const ir::Function perm = *db.get<LowerQuery>({ "reassoc.c", "perm" });
+  TEST_ASSERT(ir::verify(perm));
+  TEST_ASSERT(count_ops(perm, ir::Opcode::add) == 2);
+
+  return true;
+}
@@ -0,0 +1,127 @@
+#include <string>
+
+#include <fmt/format.h>
+
+#include "ast.h"
+#include "parser.h"
+#include "resolve.h"
+#include "symtab.h"
+#include "tokenizer.h"
+#include "util.h"
+
+#include "test.h"
+
+using namespace wcc;
+
+const char resolve_src[] = "i64 add(i64 a, i64 b) {\n"
+                           "i64 ret;\n"
+                           "ret = a + global_var;\n"
+                           "return ret;\n"
+                           "}\n"
+                           "i64 global_var;\n"
+                           "i32 main() {\n"
+                           "i32 a;\n"
+                           "a = add(a, 4);\n"
+                           "}\n";
+
+const char resolve_undeclared_src[] = "i32 main() {\n"
+                                      "i32 a;\n"
+                                      "a = b;\n"
+                                      "}\n";
+
+const char resolve_redeclared_src[] = "i32 main(i32 a) {\n"
+                                      "i32 a;\n"
+                                      "}\n";
+
+static AST
+parse(const char* src, size_t size)
+{
+  Tokenizer tokenizer(src, size);
+  Parser    parser(tokenizer);
+
+  return parser.buildAST();
+}
+
+static const AstStmt&
+stmt_at(const AST& ast, size_t func, size_t node)
+{
+  return std::get<AstStmt>(ast.root.nodes[func]->nodes[node]->value);
+}
+
+static bool
+symbol_table_test()
+{
+  SymbolTable table;
+
+  const auto global = table.declare(Symbol{ .name = "x" });
+  TEST_ASSERT(table.lookup("x") == global);
+
+  table.enter_scope();
+  const auto local = table.declare(Symbol{ .name = "x" });
+  TEST_ASSERT(local != INVALID_SYMBOL && local != global);
+  TEST_ASSERT(table.lookup("x") == local);
+  TEST_ASSERT(table.declare(Symbol{ .name = "x" }) == INVALID_SYMBOL);
+
+  // Enough names to force the bucket array to grow while a scope is open.
+  for (size_t i = 0; i < 1000; ++i)
+    table.declare(Symbol{ .name = fmt::format("v{}", i) });
+
+  TEST_ASSERT(table.lookup("x") == local);
+  TEST_ASSERT(table.symbols[table.lookup("v500")].name == "v500");
+
+  table.leave_scope();
+
+  TEST_ASSERT(table.lookup("x") == global);
+  TEST_ASSERT(table.lookup("v500") == INVALID_SYMBOL);
+  TEST_ASSERT(table.lookup("y") == INVALID_SYMBOL);
+
+  return true;
+}
+
+bool
+resolve_test()
+{
+  TEST_ASSERT(symbol_table_test());
+
+  AST     ast = parse(resolve_src, sizeof(resolve_src) - 1);
+  Symbols symbols;
+
+  TEST_ASSERT(resolve_names(ast, symbols));
+
+  // ret = a + global_var;
+  const auto& assign = std::get<AstFunctionCall>(stmt_at(ast, 0, 1).value);
+  const auto& lhs    = std::get<AstSymRef>(assign.args[0].value);
+  const auto& plus   = std::get<AstFunctionCall>(assign.args[1].value);
+  const auto& a      = std::get<AstSymRef>(plus.args[0].value);
+  const auto& global = std::get<AstSymRef>(plus.args[1].value);
+
+  TEST_ASSERT(assign.symbol == INVALID_SYMBOL);
+  TEST_ASSERT(symbols[lhs.symbol].kind == SymbolKind::local);
+  TEST_ASSERT(symbols[lhs.symbol].slot == 0);
+  TEST_ASSERT(symbols[a.symbol].kind == SymbolKind::param);
+  TEST_ASSERT(symbols[a.symbol].slot == 0);
+  TEST_ASSERT(symbols[global.symbol].kind == SymbolKind::global);
+  TEST_ASSERT(symbols[global.symbol].node == ast.root.nodes[1].get());
+
+  // a = add(a, 4); binds to main's local, add() to the function.
+  const auto& main_assign =
+    std::get<AstFunctionCall>(stmt_at(ast, 2, 1).value);
+  const auto& main_a = std::get<AstSymRef>(main_assign.args[0].value);
+  const auto& call   = std::get<AstFunctionCall>(main_assign.args[1].value);
+
+  TEST_ASSERT(symbols[main_a.symbol].kind == SymbolKind::local);
+  TEST_ASSERT(symbols[main_a.symbol].owner != symbols[a.symbol].owner);
+  TEST_ASSERT(symbols[call.symbol].kind == SymbolKind::function);
+  TEST_ASSERT(symbols[call.symbol].name == "add");
+  TEST_ASSERT(call.args[1].type == StmtType::literal);
+
+  AST undeclared =
+    parse(resolve_undeclared_src, sizeof(resolve_undeclared_src) - 1);
+  TEST_ASSERT(!resolve_names(undeclared, symbols));
+
+  AST redeclared =
+    parse(resolve_redeclared_src, sizeof(resolve_redeclared_src) - 1);
+  TEST_ASSERT(!resolve_names(redeclared, symbols));
+
+  return true;
+}
@@ -6,12 +6,104 @@
 bool
 operator_precedence_test();
 
+bool
+query_test();
+
+bool
+resolve_test();
+
+bool
+typecheck_test();
+
+bool
+ir_test();
+
+bool
+fold_test();
+
+bool
+codegen_test();
+
+bool
+jit_test();
+
+bool
+inline_test();
+
+bool
+eval_test();
+
+bool
+gvn_test();
+
+bool
+reassoc_test();
+
+bool
+strength_test();
+
+bool
+burs_test();
+
+bool
+slp_test();
+
+bool
+fma_test();
+
+bool
+loop_test();
+
+bool
+array_test();
+
+bool
+branch_test();
+
+bool
+struct_test();
+
+bool
+sroa_test();
+
+bool
+tailcall_test();
+
+bool
+vm_test();
+
+bool
+tier_test();
+
 int
 main()
 {
   size_t tests_failed = 0;
 
   RUN_TEST(operator_precedence_test);
+  RUN_TEST(query_test);
+  RUN_TEST(resolve_test);
+  RUN_TEST(typecheck_test);
+  RUN_TEST(ir_test);
+  RUN_TEST(fold_test);
+  RUN_TEST(codegen_test);
+  RUN_TEST(jit_test);
+  RUN_TEST(inline_test);
+  RUN_TEST(eval_test);
+  RUN_TEST(gvn_test);
+  RUN_TEST(reassoc_test);
+  RUN_TEST(strength_test);
+  RUN_TEST(burs_test);
+  RUN_TEST(slp_test);
+  RUN_TEST(fma_test);
+  RUN_TEST(loop_test);
+  RUN_TEST(array_test);
+  RUN_TEST(branch_test);
+  RUN_TEST(struct_test);
+  RUN_TEST(sroa_test);
+  RUN_TEST(tailcall_test);
+  RUN_TEST(vm_test);
+  RUN_TEST(tier_test);
 
   return tests_failed != 0;
 }
@@ -0,0 +1,149 @@
+#include <string>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "util.h"
+#include "x64.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char slp_src[] = "f32 lanes(f32 a, f32 b, f32 c, f32 d) {\n"
+                       "a = a * 3.0f + 1.0f;\n"
+                       "b = b * 3.0f + 1.0f;\n"
+                       "c = c * 3.0f + 1.0f;\n"
+                       "d = d * 3.0f + 1.0f;\n"
+                       "a = a * 3.0f + 1.0f;\n"
+                       "b = b * 3.0f + 1.0f;\n"
+                       "c = c * 3.0f + 1.0f;\n"
+                       "d = d * 3.0f + 1.0f;\n"
+                       "return a + b + c + d;\n"
+                       "}\n"
+                       "i32 ints(i32 a, i32 b, i32 c, i32 d, i32 k, i32 m) {\n"
+                       "a = a * k + m;\n"
+                       "b = b * k + m;\n"
+                       "c = c * k + m;\n"
+                       "d = d * k + m;\n"
+                       "a = a * k + m;\n"
+                       "b = b * k + m;\n"
+                       "c = c * k + m;\n"
+                       "d = d * k + m;\n"
+                       "a = a * k + m;\n"
+                       "b = b * k + m;\n"
+                       "c = c * k + m;\n"
+                       "d = d * k + m;\n"
+                       "b = b * 10;\n"
+                       "c = c * 100;\n"
+                       "d = d * 1000;\n"
+                       "return a + b + c + d;\n"
+                       "}\n"
+                       "f64 halves(f64 x, f64 y, f64 p, f64 q) {\n"
+                       "x = 0.5 + x / p;\n"
+                       "y = 0.5 + y / q;\n"
+                       "x = 0.5 + x / p;\n"
+                       "y = 0.5 + y / q;\n"
+                       "return x / y;\n"
+                       "}\n"
+                       "f64 chained(f64 x, f64 y, f64 p, f64 q) {\n"
+                       "x = y + x / p;\n"
+                       "y = x + y / q;\n"
+                       "return x / y;\n"
+                       "}\n"
+                       "i32 shallow(i32 a, i32 b, i32 c, i32 d, i32 k) {\n"
+                       "a = a * k;\n"
+                       "b = b * k;\n"
+                       "c = c * k;\n"
+                       "d = d * k;\n"
+                       "return a + b + c + d;\n"
+                       "}\n";
+
+// Arithmetic over vectors of `lanes`.
+static size_t
+count_vector_ops(const ir::Function& fn, uint8_t lanes)
+{
+  size_t count = 0;
+
+  for (const auto& block : fn.blocks) {
+    for (const ir::ValueId v : block.instrs) {
+      const ir::Instr& instr = fn.instrs[v];
+      count += ir::is_binary(instr.op) && instr.lanes == lanes;
+    }
+  }
+
+  return count;
+}
+
+static float
+scalar_lanes(float a, float b, float c, float d)
+{
+  for (int i = 0; i < 2; ++i) {
+    a = a * 3.0f + 1.0f;
+    b = b * 3.0f + 1.0f;
+    c = c * 3.0f + 1.0f;
+    d = d * 3.0f + 1.0f;
+  }
+
+  return a + (b + (c + d));
+}
+
+bool
+slp_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("slp.c", slp_src);
+
+  const auto& module = db.get<ModuleQuery>("slp.c");
+  TEST_ASSERT(module != nullptr);
+
+  // Two rounds of multiply and add over the four variables, constants
+  // broadcast, the results extracted for the final sum.
+  const ir::Function* lanes = find_function(*module, "lanes");
+  TEST_ASSERT(lanes != nullptr && ir::verify(*lanes));
+  TEST_ASSERT(count_vector_ops(*lanes, 4) == 4);
+  TEST_ASSERT(count_ops(*lanes, ir::Opcode::pack) == 3);
+  TEST_ASSERT(count_ops(*lanes, ir::Opcode::extract) == 4);
+
+  const ir::Function* ints = find_function(*module, "ints");
+  TEST_ASSERT(ints != nullptr && ir::verify(*ints));
+  TEST_ASSERT(count_vector_ops(*ints, 4) == 6);
+
+  const ir::Function* halves = find_function(*module, "halves");
+  TEST_ASSERT(halves != nullptr && ir::verify(*halves));
+  TEST_ASSERT(count_vector_ops(*halves, 2) == 4);
+
+  // y depends on x: the lanes are not independent.
+  const ir::Function* chained = find_function(*module, "chained");
+  TEST_ASSERT(count_ops(*chained, ir::Opcode::pack) == 0);
+
+  // One multiply per lane does not pay for packing the operands.
+  const ir::Function* shallow = find_function(*module, "shallow");
+  TEST_ASSERT(count_ops(*shallow, ir::Opcode::pack) == 0);
+
+  const x64::MModule code = x64::compile_module(*module);
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+  TEST_ASSERT(jit != nullptr);
+
+  const auto run_lanes =
+    jit->function<float (*)(float, float, float, float)>("lanes");
+  const auto run_ints =
+    jit->function<int32_t (*)(int32_t, int32_t, int32_t, int32_t, int32_t,
+                              int32_t)>("ints");
+  const auto run_halves =
+    jit->function<double (*)(double, double, double, double)>("halves");
+
+  TEST_ASSERT(run_lanes(1, 2, 3, 4) == scalar_lanes(1, 2, 3, 4));
+  TEST_ASSERT(run_lanes(-0.5f, 8, 1e6f, 0.25f) ==
+              scalar_lanes(-0.5f, 8, 1e6f, 0.25f));
+
+  // Three rounds of x * k + m per lane.
+  TEST_ASSERT(run_ints(1, 2, 3, 4, 3, 1) == 40 + 67 * 10 + 94 * 100 + 121000);
+  TEST_ASSERT(run_ints(7, 0, 100, -3, -2, 5) ==
+              -41 + 15 * 10 + -785 * 100 + 39 * 1000);
+
+  TEST_ASSERT(run_halves(8, 3, 2, 4) == 2.75 / 0.8125);
+
+  return true;
+}
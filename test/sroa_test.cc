@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <string>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "tree_walker.h"
+#include "vm.h"
+#include "x64.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char sroa_src[] = "struct Vec {\n"
+                        "f64 x;\n"
+                        "f64 y;\n"
+                        "};\n"
+                        "struct Span {\n"
+                        "i32 lo;\n"
+                        "i32 hi;\n"
+                        "};\n"
+                        "f64 norm2(f64 x, f64 y) {\n"
+                        "struct Vec v;\n"
+                        "v.x = x;\n"
+                        "v.y = y;\n"
+                        "v.x *= v.x;\n"
+                        "return v.x + v.y * v.y;\n"
+                        "}\n"
+                        "f64 norm2_scalar(f64 x, f64 y) {\n"
+                        "f64 vx;\n"
+                        "f64 vy;\n"
+                        "vx = x;\n"
+                        "vy = y;\n"
+                        "vx *= vx;\n"
+                        "return vx + vy * vy;\n"
+                        "}\n"
+                        "i32 clamp(i32 v, i32 lo, i32 hi) {\n"
+                        "struct Span s;\n"
+                        "s.lo = lo;\n"
+                        "s.hi = hi;\n"
+                        "if (v < s.lo) {\n"
+                        "return s.lo;\n"
+                        "}\n"
+                        "if (v > s.hi) {\n"
+                        "return s.hi;\n"
+                        "}\n"
+                        "return v;\n"
+                        "}\n"
+                        "i32 width(i32 n) {\n"
+                        "struct Span s;\n"
+                        "s.hi = n;\n"
+                        "return s.hi - s.lo;\n"
+                        "}\n"
+                        "i32 use(i32 v) {\n"
+                        "return clamp(v, 0, 10);\n"
+                        "}\n"
+                        "i32 table(i32 k) {\n"
+                        "i32 t[4];\n"
+                        "t[0] = 1;\n"
+                        "t[1] = k;\n"
+                        "t[3] = t[0] + t[1];\n"
+                        "return t[3] + t[2];\n"
+                        "}\n"
+                        "i32 walk(i32 i) {\n"
+                        "struct Span s[4];\n"
+                        "s[1].hi = 7;\n"
+                        "return s[i].hi;\n"
+                        "}\n";
+
+static size_t
+count_instrs(const ir::Function& fn)
+{
+  size_t count = 0;
+
+  for (const auto& block : fn.blocks)
+    count += block.instrs.size();
+
+  return count;
+}
+
+// Nothing is left in memory.
+static bool
+in_registers(const ir::Function& fn)
+{
+  return fn.arrays.empty() && count_ops(fn, ir::Opcode::aload) == 0 &&
+         count_ops(fn, ir::Opcode::astore) == 0 &&
+         count_ops(fn, ir::Opcode::load) == 0 &&
+         count_ops(fn, ir::Opcode::store) == 0;
+}
+
+// An array written as an i32 and read back as a u64 is kept in memory.
+static bool
+overlap_test()
+{
+  ir::Function fn;
+  fn.name        = "overlap";
+  fn.return_type = LangType::lt_u64;
+  fn.arrays      = { ir::Array{ LangType::lt_u64, 1 } };
+
+  const ir::BlockId entry = fn.add_block();
+  const ir::ValueId zero =
+    fn.append(entry, ir::Opcode::constant, LangType::lt_i64, {}, 0);
+  const ir::ValueId five =
+    fn.append(entry, ir::Opcode::constant, LangType::lt_i32, {}, 5);
+
+  fn.append(entry,
+            ir::Opcode::astore,
+            LangType::lt_void,
+            { zero, five },
+            ir::LOCAL_ARRAY | 0);
+
+  const ir::ValueId word = fn.append(
+    entry, ir::Opcode::aload, LangType::lt_u64, { zero }, ir::LOCAL_ARRAY | 0);
+  fn.append(entry, ir::Opcode::ret, LangType::lt_void, { word });
+
+  TEST_ASSERT(ir::scalarize_aggregates(fn) == 0);
+  TEST_ASSERT(ir::verify(fn));
+  TEST_ASSERT(fn.arrays.size() == 1);
+
+  return true;
+}
+
+bool
+sroa_test()
+{
+  TEST_ASSERT(overlap_test());
+
+  QueryDatabase db;
+  db.set<SourceTextQuery>("sroa.c", sroa_src);
+
+  const auto& file = db.get<TypecheckQuery>("sroa.c");
+  TEST_ASSERT(file->ok);
+
+  const auto lower = [&db](const char* name) {
+    return *db.get<LowerQuery>({ "sroa.c", name });
+  };
+
+  // A structure that does not escape costs as much as its fields would.
+  const ir::Function norm2 = lower("norm2");
+  TEST_ASSERT(ir::verify(norm2));
+  TEST_ASSERT(in_registers(norm2));
+  TEST_ASSERT(count_instrs(norm2) == count_instrs(lower("norm2_scalar")));
+
+  TEST_ASSERT(in_registers(lower("clamp")));
+  TEST_ASSERT(in_registers(lower("table")));
+
+  // Fields never stored read as zero, like the memory they replace.
+  const ir::Function width = lower("width");
+  TEST_ASSERT(in_registers(width));
+
+  for (const ir::ValueId v : width.blocks[0].instrs) {
+    if (width.instrs[v].op == ir::Opcode::sub) {
+      const ir::Instr& lo = width.instrs[width.operand(v, 1)];
+      TEST_ASSERT(lo.op == ir::Opcode::constant && lo.imm == 0);
+    }
+  }
+
+  // A dynamic index needs the memory.
+  const ir::Function walk = lower("walk");
+  TEST_ASSERT(ir::verify(walk));
+  TEST_ASSERT(walk.arrays.size() == 1);
+  TEST_ASSERT(count_ops(walk, ir::Opcode::aload) == 1);
+
+  const auto& module = db.get<ModuleQuery>("sroa.c");
+  TEST_ASSERT(module != nullptr);
+
+  for (const ir::Function& fn : module->functions)
+    TEST_ASSERT(ir::verify(fn));
+
+  // Without arrays left, nothing has to be zeroed at the call.
+  TEST_ASSERT(std::any_of(module->inline_report.begin(),
+                          module->inline_report.end(),
+                          [](const ir::InlineDecision& decision) {
+                            return decision.caller == "use" &&
+                                   decision.callee == "clamp" &&
+                                   decision.verdict ==
+                                     ir::InlineVerdict::inlined;
+                          }));
+
+  // Every engine agrees.
+  const x64::MModule code = x64::compile_module(*module);
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+  TEST_ASSERT(jit != nullptr);
+
+  vm::Program program;
+  TEST_ASSERT(vm::compile(*file, db.get<LayoutQuery>("sroa.c"), program));
+
+  vm::Machine machine(program);
+  TreeWalker  walker(*file);
+
+  const auto agree = [&](const char*           name,
+                         std::vector<VarValue> args,
+                         int64_t               expected) {
+    VarValue reference, result;
+
+    return walker.call(name, args, reference) &&
+           machine.call(program.find(name), args, result) &&
+           result.u64_value == reference.u64_value &&
+           reference.i64_value == expected;
+  };
+
+  using Unary = int32_t (*)(int32_t);
+
+  const auto norm2_fn = jit->function<double (*)(double, double)>("norm2");
+  TEST_ASSERT(norm2_fn(3, 4) == 25);
+
+  VarValue reference, result;
+  TEST_ASSERT(walker.call("norm2", { f64_value(3), f64_value(4) }, reference));
+  TEST_ASSERT(machine.call(
+    program.find("norm2"), { f64_value(3), f64_value(4) }, result));
+  TEST_ASSERT(reference.f64_value == 25 && result.f64_value == 25);
+
+  for (int32_t v = -5; v <= 15; v += 4) {
+    const int32_t expected = std::clamp(v, 0, 10);
+
+    TEST_ASSERT(jit->function<Unary>("use")(v) == expected);
+    TEST_ASSERT(agree("use", { int_value(v) }, expected));
+    TEST_ASSERT(jit->function<Unary>("table")(v) == 1 + v);
+    TEST_ASSERT(agree("table", { int_value(v) }, 1 + v));
+  }
+
+  TEST_ASSERT(jit->function<Unary>("width")(9) == 9);
+  TEST_ASSERT(agree("width", { int_value(9) }, 9));
+  TEST_ASSERT(jit->function<Unary>("walk")(1) == 7);
+  TEST_ASSERT(agree("walk", { int_value(1) }, 7));
+  TEST_ASSERT(agree("walk", { int_value(2) }, 0));
+
+  return true;
+}
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "fold.h"
+#include "ir.h"
+#include "jit.h"
+#include "util.h"
+#include "x64.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+constexpr LangType INT_TYPES[] = {
+  LangType::lt_i8,  LangType::lt_u8,  LangType::lt_i16, LangType::lt_u16,
+  LangType::lt_i32, LangType::lt_u32, LangType::lt_i64, LangType::lt_u64,
+};
+
+constexpr ir::Opcode OPS[] = { ir::Opcode::mul,
+                               ir::Opcode::div,
+                               ir::Opcode::mod };
+
+// One case: `x op c` for a constant c of `type`.
+struct StrengthCase
+{
+  LangType   type;
+  ir::Opcode op;
+  uint64_t   c;
+};
+
+static ir::Function
+by_constant(const StrengthCase& test, const std::string& name)
+{
+  ir::Function fn;
+  fn.name        = name;
+  fn.return_type = test.type;
+  fn.params      = { test.type };
+
+  const ir::BlockId entry = fn.add_block();
+  const ir::ValueId x     = fn.append(entry, ir::Opcode::param, test.type);
+  const ir::ValueId c =
+    fn.append(entry, ir::Opcode::constant, test.type, {}, test.c);
+  const ir::ValueId r = fn.append(entry, test.op, test.type, { x, c });
+
+  fn.append(entry, ir::Opcode::ret, LangType::lt_void, { r });
+  return fn;
+}
+
+// Constants around the interesting points of a width: small values, powers
+// of two and their neighbours, the extremes. Canonical for `type`.
+static std::vector<uint64_t>
+edge_values(LangType type)
+{
+  std::vector<uint64_t> values;
+
+  for (uint64_t v = 0; v < 64; ++v)
+    values.push_back(v);
+
+  for (unsigned k = 2; k < 64; ++k) {
+    for (const int64_t delta : { -1, 0, 1 })
+      values.push_back((uint64_t(1) << k) + delta);
+  }
+
+  for (const uint64_t v :
+       { 100ull, 641ull, 1000ull, 7919ull, 1000000007ull, 0x5555555555ull }) {
+    values.push_back(v);
+  }
+
+  const size_t n = values.size();
+
+  for (size_t i = 0; i < n; ++i)
+    values.push_back(0 - values[i]);
+
+  for (uint64_t& v : values)
+    v = normalize_constant(type, v);
+
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  return values;
+}
+
+// Every value of 8 bit types. The edge values of wider ones, a stride
+// through all 16 bit values and pseudo random ones above that.
+static std::vector<uint64_t>
+dividends(LangType type)
+{
+  std::vector<uint64_t> values;
+
+  if (type_size(type) == 1) {
+    for (uint64_t v = 0; v < 256; ++v)
+      values.push_back(normalize_constant(type, v));
+
+    return values;
+  }
+
+  values = edge_values(type);
+
+  if (type_size(type) == 2) {
+    for (uint64_t v = 0; v < 65536; v += 61)
+      values.push_back(normalize_constant(type, v));
+
+    return values;
+  }
+
+  uint64_t state = 0x9e3779b97f4a7c15ull;
+
+  for (int i = 0; i < 2000; ++i) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    values.push_back(normalize_constant(type, state >> (i % 64)));
+  }
+
+  return values;
+}
+
+// Every constant of 8 bit types, the edge values of wider ones.
+static std::vector<uint64_t>
+constants(LangType type)
+{
+  if (type_size(type) > 1)
+    return edge_values(type);
+
+  std::vector<uint64_t> values;
+
+  for (uint64_t v = 0; v < 256; ++v)
+    values.push_back(normalize_constant(type, v));
+
+  return values;
+}
+
+bool
+strength_test()
+{
+  std::vector<StrengthCase> cases;
+  ir::Module                module;
+
+  for (const LangType type : INT_TYPES) {
+    for (const ir::Opcode op : OPS) {
+      for (const uint64_t c : constants(type))
+        cases.push_back({ type, op, c });
+    }
+  }
+
+  for (size_t i = 0; i < cases.size(); ++i) {
+    const StrengthCase& test = cases[i];
+    ir::Function fn = by_constant(test, "f" + std::to_string(i));
+
+    ir::reduce_strength(fn);
+    TEST_ASSERT(ir::verify(fn));
+
+    // Only the trapping divisions stay divisions.
+    const bool traps =
+      test.c == 0 || (is_signed(test.type) && int64_t(test.c) == -1);
+
+    if (test.op != ir::Opcode::mul && !traps) {
+      TEST_ASSERT(count_ops(fn, ir::Opcode::div) == 0);
+      TEST_ASSERT(count_ops(fn, ir::Opcode::mod) == 0);
+    }
+
+    module.functions.push_back(std::move(fn));
+  }
+
+  const x64::MModule code = x64::compile_module(module);
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+  TEST_ASSERT(jit != nullptr);
+
+  // The reduced code against the folded operation. Arguments and results
+  // travel in full registers whose upper bits the callee may not rely on.
+  LangType              last = LangType::lt_void;
+  std::vector<uint64_t> xs;
+
+  for (size_t i = 0; i < cases.size(); ++i) {
+    const StrengthCase& test = cases[i];
+    const auto          run =
+      jit->function<uint64_t (*)(uint64_t)>("f" + std::to_string(i));
+
+    if (test.type != last) {
+      xs   = dividends(test.type);
+      last = test.type;
+    }
+
+    for (const uint64_t x : xs) {
+      const auto expected = fold_binary(test.op, test.type, x, test.c);
+
+      // Division by zero, and the smallest value by -1, trap.
+      if (!expected.has_value())
+        continue;
+
+      const uint64_t garbage = 0xdead000000000000ull;
+      const uint64_t arg = type_size(test.type) < 8 ? x ^ garbage : x;
+
+      TEST_ASSERT(normalize_constant(test.type, run(arg)) == *expected);
+    }
+  }
+
+  // Products by a constant use no multiplication where shifts do, and one
+  // lea for the factors it covers.
+  const auto reduced = [](LangType type, ir::Opcode op, uint64_t c) {
+    ir::Function fn = by_constant({ type, op, c }, "f");
+    ir::reduce_strength(fn);
+    return fn;
+  };
+
+  TEST_ASSERT(count_ops(reduced(LangType::lt_i32, ir::Opcode::mul, 8),
+                        ir::Opcode::mul) == 0);
+  TEST_ASSERT(count_ops(reduced(LangType::lt_i32, ir::Opcode::mul, 17),
+                        ir::Opcode::mul) == 0);
+  TEST_ASSERT(count_ops(reduced(LangType::lt_i32, ir::Opcode::mul, 10),
+                        ir::Opcode::mul) == 1);
+  TEST_ASSERT(count_ops(reduced(LangType::lt_i64, ir::Opcode::mul, 24),
+                        ir::Opcode::mul) == 1);
+  TEST_ASSERT(count_ops(reduced(LangType::lt_u32, ir::Opcode::div, 7),
+                        ir::Opcode::mulhi) == 1);
+  TEST_ASSERT(count_ops(reduced(LangType::lt_u32, ir::Opcode::mod, 16),
+                        ir::Opcode::bit_and) == 1);
+
+  return true;
+}
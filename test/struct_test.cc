@@ -0,0 +1,254 @@
+#include <string>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "tier.h"
+#include "tree_walker.h"
+#include "vm.h"
+#include "x64.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char struct_src[] = "struct Rec {\n"
+                          "u8 tag;\n"
+                          "f64 weight;\n"
+                          "u16 id;\n"
+                          "i32 count;\n"
+                          "u8 flag;\n"
+                          "};\n"
+                          "struct Pair origin;\n"
+                          "struct Pair {\n"
+                          "i32 a;\n"
+                          "i32 b;\n"
+                          "};\n"
+                          "struct Rec recs[16];\n"
+                          "struct Rec last;\n"
+                          "i32 fill(i32 n) {\n"
+                          "i32 i;\n"
+                          "for (i = 0; i < n; i = i + 1) {\n"
+                          "recs[i].tag = i % 3;\n"
+                          "recs[i].weight = i * 0.5;\n"
+                          "recs[i].id = 100 + i;\n"
+                          "recs[i].count = i * i;\n"
+                          "recs[i].flag = 1;\n"
+                          "}\n"
+                          "last.count = n;\n"
+                          "origin.b = n;\n"
+                          "return 0;\n"
+                          "}\n"
+                          "i32 heavy(i32 n) {\n"
+                          "i32 i;\n"
+                          "i32 c;\n"
+                          "c = 0;\n"
+                          "for (i = 0; i < n; i = i + 1) {\n"
+                          "if (recs[i].weight > 2.0 && recs[i].tag != 0) {\n"
+                          "c = c + recs[i].id;\n"
+                          "}\n"
+                          "}\n"
+                          "return c + last.count;\n"
+                          "}\n"
+                          "i32 swap(i32 x, i32 y) {\n"
+                          "struct Pair p;\n"
+                          "i32 t;\n"
+                          "p.a = x;\n"
+                          "p.b = y;\n"
+                          "t = p.a;\n"
+                          "p.a = p.b;\n"
+                          "p.b = t;\n"
+                          "p.a *= 10;\n"
+                          "return p.a - p.b;\n"
+                          "}\n"
+                          "i32 wrap(i32 x) {\n"
+                          "struct Rec r;\n"
+                          "r.tag = x;\n"
+                          "r.flag = r.tag + 1;\n"
+                          "return r.tag + r.flag;\n"
+                          "}\n"
+                          "i32 count(i32 i) {\n"
+                          "return recs[i].count;\n"
+                          "}\n";
+
+// Every aload and astore of `fn` has a constant index.
+static bool
+constant_indices(const ir::Function& fn)
+{
+  for (const auto& block : fn.blocks) {
+    for (const ir::ValueId v : block.instrs) {
+      const ir::Opcode op = fn.instrs[v].op;
+
+      if ((op == ir::Opcode::aload || op == ir::Opcode::astore) &&
+          fn.instrs[fn.operand(v, 0)].op != ir::Opcode::constant)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+// Runs the program in every engine, all have to agree.
+static bool
+check_engines(QueryDatabase& db)
+{
+  const auto& file   = db.get<TypecheckQuery>("struct.c");
+  const auto& module = db.get<ModuleQuery>("struct.c");
+  TEST_ASSERT(file->ok && module != nullptr);
+
+  for (const ir::Function& fn : module->functions)
+    TEST_ASSERT(ir::verify(fn));
+
+  const x64::MModule code = x64::compile_module(*module);
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+  TEST_ASSERT(jit != nullptr);
+
+  vm::Program program;
+  TEST_ASSERT(vm::compile(*file, db.get<LayoutQuery>("struct.c"), program));
+
+  vm::Machine machine(program);
+  TreeWalker  walker(*file);
+
+  const auto agree = [&](const char*           name,
+                         std::vector<VarValue> args,
+                         int64_t               expected) {
+    VarValue reference, result;
+
+    return walker.call(name, args, reference) &&
+           machine.call(program.find(name), args, result) &&
+           result.u64_value == reference.u64_value &&
+           reference.i64_value == expected;
+  };
+
+  using Unary = int32_t (*)(int32_t);
+
+  TEST_ASSERT(jit->function<Unary>("fill")(16) == 0);
+  TEST_ASSERT(agree("fill", { int_value(16) }, 0));
+
+  // Weights above 2 from element 5 on, tags of 0 every third element.
+  const int32_t heavy = 768 + 16;
+
+  TEST_ASSERT(jit->function<Unary>("heavy")(16) == heavy);
+  TEST_ASSERT(agree("heavy", { int_value(16) }, heavy));
+
+  for (int32_t i = 0; i < 16; ++i) {
+    TEST_ASSERT(jit->function<Unary>("count")(i) == i * i);
+    TEST_ASSERT(agree("count", { int_value(i) }, i * i));
+  }
+
+  // The index of the element is checked, not the one of the field.
+  VarValue r;
+  TEST_ASSERT(!walker.call("count", { int_value(16) }, r));
+  TEST_ASSERT(!machine.call(program.find("count"), { int_value(16) }, r));
+  TEST_ASSERT(!machine.call(program.find("count"), { int_value(-1) }, r));
+
+  const auto swap = jit->function<int32_t (*)(int32_t, int32_t)>("swap");
+  TEST_ASSERT(swap(3, 4) == 37);
+  TEST_ASSERT(agree("swap", { int_value(3), int_value(4) }, 37));
+
+  // Fields narrower than the operands wrap at their own width.
+  for (const int32_t x : { 0, 7, 255, 300 }) {
+    const int32_t expected = jit->function<Unary>("wrap")(x);
+
+    TEST_ASSERT(agree("wrap", { int_value(x) }, expected));
+  }
+
+  TEST_ASSERT(jit->function<Unary>("wrap")(255) == 255);
+  TEST_ASSERT(jit->function<Unary>("wrap")(300) == 89);
+
+  return true;
+}
+
+bool
+struct_test()
+{
+  TEST_ASSERT(rejects("struct S {\ni32 a;\n};\n"
+                      "i32 f() {\nstruct S s;\nreturn s;\n}\n"));
+  TEST_ASSERT(rejects("struct S {\ni32 a;\n};\n"
+                      "i32 f() {\nstruct S s;\nreturn s.b;\n}\n"));
+  TEST_ASSERT(rejects("i32 f() {\ni32 x;\nreturn x.a;\n}\n"));
+  TEST_ASSERT(rejects("struct S {\ni32 a;\n};\n"
+                      "i32 f() {\nstruct S t[2];\nreturn t.a;\n}\n"));
+  TEST_ASSERT(rejects("struct S {\ni32 a;\n};\n"
+                      "i32 f() {\nstruct S t[2];\nreturn t[0];\n}\n"));
+  TEST_ASSERT(rejects("struct S {\ni32 a;\n};\n"
+                      "i32 f() {\nstruct S s;\nreturn s->a;\n}\n"));
+  TEST_ASSERT(rejects("struct S {\ni32 a;\ni8 a;\n};\n"));
+  TEST_ASSERT(rejects("struct S {\nvoid a;\n};\n"));
+  TEST_ASSERT(rejects("struct E {\n};\nstruct E e;\n"));
+  TEST_ASSERT(rejects("i32 f() {\nstruct T t;\nreturn 0;\n}\n"));
+  TEST_ASSERT(rejects("struct S {\nf64 a;\nf64 b;\n};\n"
+                      "struct S s[16777216];\n"));
+
+  QueryDatabase db;
+  db.set<SourceTextQuery>("struct.c", struct_src);
+
+  // Declared order pads the u8 before the f64 and the tail.
+  const auto analyzed = db.get<TypecheckQuery>("struct.c");
+  const auto declared = db.get<LayoutQuery>("struct.c");
+  TEST_ASSERT(analyzed->ok);
+  TEST_ASSERT(declared.size() == 2);
+
+  const StructLayout& rec = declared[0];
+  TEST_ASSERT(rec.name == "Rec");
+  TEST_ASSERT(rec.size == 32 && rec.align == 8 && rec.declared_size == 32);
+  TEST_ASSERT((rec.offsets == std::vector<uint32_t>{ 0, 8, 16, 20, 24 }));
+
+  const StructLayout& pair = declared[1];
+  TEST_ASSERT(pair.size == 8 && pair.align == 4);
+  TEST_ASSERT((pair.offsets == std::vector<uint32_t>{ 0, 4 }));
+
+  // Field access is base + offset addressing.
+  const ir::Function swap = *db.get<LowerQuery>({ "struct.c", "swap" });
+  TEST_ASSERT(ir::verify(swap));
+  TEST_ASSERT(constant_indices(swap));
+  TEST_ASSERT(constant_indices(*db.get<LowerQuery>({ "struct.c", "wrap" })));
+
+  // Structures are arrays of words as wide as their alignment.
+  const auto& module = db.get<ModuleQuery>("struct.c");
+  TEST_ASSERT(module != nullptr);
+  TEST_ASSERT(module->globals[0].type == LangType::lt_u32);
+  TEST_ASSERT(module->globals[0].length == 2);
+  TEST_ASSERT(module->globals[1].type == LangType::lt_u64);
+  TEST_ASSERT(module->globals[1].length == 64);
+
+  TEST_ASSERT(check_engines(db));
+
+  // Reordering invalidates what was computed with the declared layout, the
+  // analyzed file stays as it is.
+  db.set<FieldOrderQuery>("struct.c", FieldOrder::by_alignment);
+
+  const size_t executed = db.stats.executed;
+  const auto&  packed   = db.get<LayoutQuery>("struct.c");
+  TEST_ASSERT(db.stats.executed == executed + 1);
+  TEST_ASSERT(db.get<TypecheckQuery>("struct.c") == analyzed);
+
+  const StructLayout& small = packed[0];
+  TEST_ASSERT(small.size == 16 && small.align == 8);
+  TEST_ASSERT(small.declared_size == 32);
+  TEST_ASSERT((small.offsets == std::vector<uint32_t>{ 14, 0, 12, 8, 15 }));
+  TEST_ASSERT(packed[1].size == 8);
+
+  TEST_ASSERT(db.get<ModuleQuery>("struct.c")->globals[1].length == 32);
+  TEST_ASSERT(check_engines(db));
+
+  // The interpreter and native code share the memory of global structures.
+  const auto tiered = tier::TieredModule::create(
+    *analyzed, packed, db.get<ModuleQuery>("struct.c"), 4);
+  TEST_ASSERT(tiered != nullptr);
+
+  VarValue r;
+
+  for (int i = 0; i < 8; ++i)
+    TEST_ASSERT(tiered->call("fill", { int_value(16) }, r));
+
+  tiered->wait();
+  TEST_ASSERT(tiered->is_native("fill"));
+  TEST_ASSERT(tiered->call("fill", { int_value(12) }, r));
+  TEST_ASSERT(tiered->call("heavy", { int_value(16) }, r));
+  TEST_ASSERT(!tiered->is_native("heavy"));
+  TEST_ASSERT(r.i64_value == 768 + 12);
+
+  return true;
+}
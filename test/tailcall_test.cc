@@ -0,0 +1,174 @@
+#include <string>
+
+#include "ir.h"
+#include "jit.h"
+#include "queries.h"
+#include "tree_walker.h"
+#include "vm.h"
+#include "x64.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char tailcall_src[] = "i64 sum(i64 n, i64 acc) {\n"
+                            "i64 m;\n"
+                            "i64 a;\n"
+                            "if (n != 0) {\n"
+                            "m = n - 1;\n"
+                            "a = acc + n;\n"
+                            "return sum(m, a);\n"
+                            "}\n"
+                            "return acc;\n"
+                            "}\n"
+                            "i32 fact(i32 n) {\n"
+                            "i32 m;\n"
+                            "if (n > 1) {\n"
+                            "m = n - 1;\n"
+                            "return n * fact(m);\n"
+                            "}\n"
+                            "return 1;\n"
+                            "}\n"
+                            "i32 is_even(i32 n) {\n"
+                            "i32 m;\n"
+                            "if (n != 0) {\n"
+                            "m = n - 1;\n"
+                            "return is_odd(m);\n"
+                            "}\n"
+                            "return 1;\n"
+                            "}\n"
+                            "i32 is_odd(i32 n) {\n"
+                            "i32 m;\n"
+                            "if (n != 0) {\n"
+                            "m = n - 1;\n"
+                            "return is_even(m);\n"
+                            "}\n"
+                            "return 0;\n"
+                            "}\n"
+                            "i32 walk(i32 n, i32 acc) {\n"
+                            "i32 t[4];\n"
+                            "i32 k;\n"
+                            "i32 m;\n"
+                            "i32 a;\n"
+                            "k = n % 4;\n"
+                            "t[k] = t[k] + 1;\n"
+                            "if (n != 0) {\n"
+                            "m = n - 1;\n"
+                            "a = acc + t[k];\n"
+                            "return walk(m, a);\n"
+                            "}\n"
+                            "return acc;\n"
+                            "}\n"
+                            "i64 mix(i32 a, i32 b, i32 c, i32 d, i32 e, i32 f, "
+                            "i32 g) {\n"
+                            "i64 z;\n"
+                            "if (a > 100) {\n"
+                            "z = mix(0, b, c, d, e, f, g);\n"
+                            "return z + a;\n"
+                            "}\n"
+                            "return a + b + c + d + e + f + g;\n"
+                            "}\n"
+                            "i64 spill(i32 n) {\n"
+                            "return mix(n, n, n, n, n, n, n);\n"
+                            "}\n"
+                            "i64 widen(i32 n) {\n"
+                            "return is_odd(n);\n"
+                            "}\n";
+
+bool
+tailcall_test()
+{
+  QueryDatabase db;
+  db.set<SourceTextQuery>("tailcall.c", tailcall_src);
+
+  const auto& file = db.get<TypecheckQuery>("tailcall.c");
+  TEST_ASSERT(file->ok);
+
+  const auto lower = [&db](const char* name) {
+    return *db.get<LowerQuery>({ "tailcall.c", name });
+  };
+
+  // Self tail calls become loops.
+  const ir::Function sum = lower("sum");
+  TEST_ASSERT(ir::verify(sum));
+  TEST_ASSERT(count_ops(sum, ir::Opcode::call) == 0);
+
+  // The result of the call is still needed after it returns.
+  TEST_ASSERT(count_ops(lower("fact"), ir::Opcode::call) == 1);
+
+  // Each call of a function with local arrays starts them out zeroed.
+  TEST_ASSERT(count_ops(lower("walk"), ir::Opcode::call) == 1);
+
+  const auto& module = db.get<ModuleQuery>("tailcall.c");
+  TEST_ASSERT(module != nullptr);
+
+  for (const ir::Function& fn : module->functions)
+    TEST_ASSERT(ir::verify(fn));
+
+  // Other calls in tail position are jumps, unless arguments go on the
+  // stack or the result is converted.
+  const x64::MModule code = x64::compile_module(*module);
+
+  for (const char* name : { "is_even", "is_odd", "walk" }) {
+    const x64::MFunction* fn = find_function(code, name);
+    TEST_ASSERT(fn != nullptr);
+    TEST_ASSERT(count_ops(*fn, x64::MOp::tail_call) == 1);
+    TEST_ASSERT(count_ops(*fn, x64::MOp::call) == 0);
+  }
+
+  for (const char* name : { "fact", "spill", "widen" }) {
+    const x64::MFunction* fn = find_function(code, name);
+    TEST_ASSERT(fn != nullptr);
+    TEST_ASSERT(count_ops(*fn, x64::MOp::tail_call) == 0);
+    TEST_ASSERT(count_ops(*fn, x64::MOp::call) == 1);
+  }
+
+  const auto jit = jit::JitModule::load(code, x64::encode_module(code));
+  TEST_ASSERT(jit != nullptr);
+
+  // Every engine agrees while the recursion is shallow.
+  vm::Program program;
+  TEST_ASSERT(vm::compile(*file, db.get<LayoutQuery>("tailcall.c"), program));
+
+  vm::Machine machine(program);
+  TreeWalker  walker(*file);
+
+  const auto agree = [&](const char*           name,
+                         std::vector<VarValue> args,
+                         int64_t               expected) {
+    VarValue reference, result;
+
+    return walker.call(name, args, reference) &&
+           machine.call(program.find(name), args, result) &&
+           result.u64_value == reference.u64_value &&
+           reference.i64_value == expected;
+  };
+
+  using Unary = int32_t (*)(int32_t);
+
+  const auto sum_fn  = jit->function<int64_t (*)(int64_t, int64_t)>("sum");
+  const auto walk_fn = jit->function<int32_t (*)(int32_t, int32_t)>("walk");
+  const auto even_fn = jit->function<Unary>("is_even");
+
+  TEST_ASSERT(sum_fn(100, 0) == 5050);
+  TEST_ASSERT(agree("sum", { int_value(100), int_value(0) }, 5050));
+  TEST_ASSERT(jit->function<Unary>("fact")(10) == 3628800);
+  TEST_ASSERT(agree("fact", { int_value(10) }, 3628800));
+  TEST_ASSERT(even_fn(51) == 0 && even_fn(50) == 1);
+  TEST_ASSERT(agree("is_even", { int_value(51) }, 0));
+  TEST_ASSERT(walk_fn(100, 0) == 100);
+  TEST_ASSERT(agree("walk", { int_value(100), int_value(0) }, 100));
+  TEST_ASSERT(jit->function<int64_t (*)(int32_t)>("spill")(3) == 21);
+  TEST_ASSERT(agree("spill", { int_value(3) }, 21));
+  TEST_ASSERT(jit->function<int64_t (*)(int32_t)>("widen")(3) == 1);
+  TEST_ASSERT(agree("widen", { int_value(3) }, 1));
+
+  // Ten million calls deep would need far more than the whole stack, tail
+  // calls run in the frame of the first call.
+  TEST_ASSERT(sum_fn(10000000, 0) == int64_t(10000000) * 10000001 / 2);
+  TEST_ASSERT(even_fn(10000001) == 0);
+  TEST_ASSERT(walk_fn(10000000, 0) == 10000000);
+
+  return true;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+
+#include "ir.h"
+#include "queries.h"
+#include "x64.h"
+
+/*
+ * Helpers shared by the tests of the compiler phases.
+ */
+
+// Instructions `op` of `fn`.
+inline size_t
+count_ops(const wcc::ir::Function& fn, wcc::ir::Opcode op)
+{
+  size_t count = 0;
+
+  for (const auto& block : fn.blocks) {
+    for (const wcc::ir::ValueId v : block.instrs)
+      count += fn.instrs[v].op == op;
+  }
+
+  return count;
+}
+
+inline size_t
+count_ops(const wcc::x64::MFunction& fn, wcc::x64::MOp op)
+{
+  size_t count = 0;
+
+  for (const auto& block : fn.blocks) {
+    for (const auto& instr : block.instrs)
+      count += instr.op == op;
+  }
+
+  return count;
+}
+
+inline const wcc::ir::Function*
+find_function(const wcc::ir::Module& module, const std::string& name)
+{
+  for (const auto& fn : module.functions) {
+    if (fn.name == name)
+      return &fn;
+  }
+
+  return nullptr;
+}
+
+inline const wcc::x64::MFunction*
+find_function(const wcc::x64::MModule& code, const std::string& name)
+{
+  for (const auto& fn : code.functions) {
+    if (fn.name == name)
+      return &fn;
+  }
+
+  return nullptr;
+}
+
+// True if `src` fails semantic analysis.
+inline bool
+rejects(const char* src)
+{
+  wcc::QueryDatabase db;
+  db.set<wcc::SourceTextQuery>("bad.c", src);
+
+  return !db.get<wcc::TypecheckQuery>("bad.c")->ok;
+}
+
+inline wcc::VarValue
+int_value(int64_t v)
+{
+  wcc::VarValue value;
+  value.i64_value = v;
+  return value;
+}
+
+inline wcc::VarValue
+f32_value(float f)
+{
+  wcc::VarValue value;
+  value.u64_value = 0;
+  value.f32_value = f;
+  return value;
+}
+
+inline wcc::VarValue
+f64_value(double d)
+{
+  wcc::VarValue value;
+  value.f64_value = d;
+  return value;
+}
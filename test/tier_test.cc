@@ -0,0 +1,129 @@
+#include <string>
+
+#include "queries.h"
+#include "tier.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char tier_src[] = "i32 hits;\n"
+                        "i32 add(i32 a, i32 b) {\n"
+                        "return a + b;\n"
+                        "}\n"
+                        "i32 cold(i32 a) {\n"
+                        "return a - 1;\n"
+                        "}\n"
+                        "i32 count(i32 by) {\n"
+                        "hits = hits + by;\n"
+                        "return hits;\n"
+                        "}\n"
+                        "i32 peek() {\n"
+                        "return hits;\n"
+                        "}\n"
+                        "i8 wrap(i8 a) {\n"
+                        "return a + 100;\n"
+                        "}\n"
+                        "f64 scale(f64 x, f32 k) {\n"
+                        "return x * k;\n"
+                        "}\n"
+                        "i64 many(i64 a, i64 b, i64 c, i64 d, i64 e, i64 f,\n"
+                        "f64 g, i64 h, i64 i, i64 j, i64 k, i64 l, i64 m,\n"
+                        "f32 n) {\n"
+                        "return a + b + c + d + e + f + g + h + i + j + k + l\n"
+                        "+ m + n;\n"
+                        "}\n"
+                        "i32 twice(i32 a) {\n"
+                        "return add(a, a);\n"
+                        "}\n";
+
+bool
+tier_test()
+{
+  constexpr int THRESHOLD = 8;
+
+  QueryDatabase db;
+  db.set<SourceTextQuery>("tier.c", tier_src);
+
+  const auto& file   = db.get<TypecheckQuery>("tier.c");
+  const auto& module = db.get<ModuleQuery>("tier.c");
+
+  TEST_ASSERT(file->ok && module != nullptr);
+
+  const auto tiered = tier::TieredModule::create(
+    *file, db.get<LayoutQuery>("tier.c"), module, THRESHOLD);
+  VarValue   r;
+
+  TEST_ASSERT(tiered != nullptr);
+  TEST_ASSERT(!tiered->call("missing", {}, r));
+
+  // Results are the same before, while and after add switches tiers.
+  for (int64_t i = 0; i < 3 * THRESHOLD; ++i) {
+    TEST_ASSERT(tiered->call("add", { int_value(i), int_value(-3) }, r));
+    TEST_ASSERT(r.i64_value == i - 3);
+  }
+
+  TEST_ASSERT(tiered->call("cold", { int_value(5) }, r));
+
+  tiered->wait();
+  TEST_ASSERT(tiered->is_native("add"));
+  TEST_ASSERT(!tiered->is_native("cold"));
+
+  TEST_ASSERT(tiered->call("add", { int_value(40), int_value(2) }, r));
+  TEST_ASSERT(r.i64_value == 42);
+
+  // Both tiers update the same global, the interpreter sees what native code
+  // stored.
+  for (int64_t i = 0; i < 2 * THRESHOLD; ++i)
+    TEST_ASSERT(tiered->call("count", { int_value(-1) }, r));
+
+  tiered->wait();
+  TEST_ASSERT(tiered->is_native("count"));
+  TEST_ASSERT(tiered->call("count", { int_value(-1) }, r));
+  TEST_ASSERT(r.i64_value == -2 * THRESHOLD - 1);
+  TEST_ASSERT(tiered->call("peek", {}, r));
+  TEST_ASSERT(r.i64_value == -2 * THRESHOLD - 1);
+  TEST_ASSERT(!tiered->is_native("peek"));
+
+  // Native results come back in canonical form.
+  for (int i = 0; i < THRESHOLD; ++i) {
+    TEST_ASSERT(tiered->call("wrap", { int_value(100) }, r));
+    TEST_ASSERT(
+      tiered->call("scale", { f64_value(2.5), f32_value(4.0f) }, r));
+  }
+
+  tiered->wait();
+  TEST_ASSERT(tiered->is_native("wrap") && tiered->is_native("scale"));
+  TEST_ASSERT(tiered->call("wrap", { int_value(100) }, r));
+  TEST_ASSERT(r.i64_value == -56);
+  TEST_ASSERT(tiered->call("scale", { f64_value(2.5), f32_value(4.0f) }, r));
+  TEST_ASSERT(r.f64_value == 10.0);
+
+  // Arguments beyond the registers go through the native stack.
+  std::vector<VarValue> args;
+
+  for (int64_t i = 1; i <= 14; ++i) {
+    if (i == 7)
+      args.push_back(f64_value(0.5));
+    else if (i == 14)
+      args.push_back(f32_value(0.5f));
+    else
+      args.push_back(int_value(i));
+  }
+
+  for (int i = 0; i < THRESHOLD; ++i)
+    TEST_ASSERT(tiered->call("many", args, r));
+
+  tiered->wait();
+  TEST_ASSERT(tiered->is_native("many"));
+  TEST_ASSERT(tiered->call("many", args, r));
+  TEST_ASSERT(r.i64_value == 85);
+
+  // Interpreted code calls into native code.
+  TEST_ASSERT(tiered->call("twice", { int_value(21) }, r));
+  TEST_ASSERT(!tiered->is_native("twice"));
+  TEST_ASSERT(r.i64_value == 42);
+
+  return true;
+}
@@ -0,0 +1,136 @@
+#include <string>
+
+#include "ast.h"
+#include "parser.h"
+#include "resolve.h"
+#include "symtab.h"
+#include "tokenizer.h"
+#include "typecheck.h"
+#include "util.h"
+
+#include "test.h"
+
+using namespace wcc;
+
+const char typecheck_src[] = "i64 add(i64 a, i64 b) {\n"
+                             "i64 ret;\n"
+                             "ret = a + b;\n"
+                             "return ret;\n"
+                             "}\n"
+                             "i32 add_twice(i32 a, f32 b) {\n"
+                             "i32 ret;\n"
+                             "i32 d;\n"
+                             "d = b;\n"
+                             "ret = a + b;\n"
+                             "return ret;\n"
+                             "}\n"
+                             "i32 main() {\n"
+                             "i32 c;\n"
+                             "c = add(3,4);\n"
+                             "}\n";
+
+const char typecheck_bad_mod_src[] = "f32 f(f32 a) {\n"
+                                     "a = a % a;\n"
+                                     "}\n";
+
+const char typecheck_bad_args_src[] = "i64 add(i64 a, i64 b) {\n"
+                                      "return a;\n"
+                                      "}\n"
+                                      "i32 main() {\n"
+                                      "add(1);\n"
+                                      "}\n";
+
+static bool
+check_source(const char* src, size_t size, AST& ast, ExprTypes& types)
+{
+  Tokenizer tokenizer(src, size);
+  Parser    parser(tokenizer);
+  Symbols   symbols;
+
+  ast = parser.buildAST();
+
+  TEST_ASSERT(resolve_names(ast, symbols));
+  return typecheck(ast, symbols, types);
+}
+
+static const AstStmt&
+stmt_at(const AST& ast, size_t func, size_t node)
+{
+  return std::get<AstStmt>(ast.root.nodes[func]->nodes[node]->value);
+}
+
+static bool
+conversion_table_test()
+{
+  constexpr auto i8  = underlay_cast(LangType::lt_i8);
+  constexpr auto i64 = underlay_cast(LangType::lt_i64);
+  constexpr auto u16 = underlay_cast(LangType::lt_u16);
+  constexpr auto u32 = underlay_cast(LangType::lt_u32);
+  constexpr auto f64 = underlay_cast(LangType::lt_f64);
+
+  TEST_ASSERT(CONV_KIND[i8][i64] == ConvKind::sext);
+  TEST_ASSERT(CONV_KIND[u16][i64] == ConvKind::zext);
+  TEST_ASSERT(CONV_KIND[i64][u16] == ConvKind::trunc);
+  TEST_ASSERT(CONV_KIND[u32][f64] == ConvKind::uitofp);
+  TEST_ASSERT(CONV_KIND[f64][u32] == ConvKind::fptoui);
+  TEST_ASSERT(ARITH_RESULT[i8][u16] == LangType::lt_u16);
+  TEST_ASSERT(ARITH_RESULT[u32][i64] == LangType::lt_i64);
+  TEST_ASSERT(ARITH_RESULT[f64][i64] == LangType::lt_f64);
+
+  return true;
+}
+
+bool
+typecheck_test()
+{
+  TEST_ASSERT(conversion_table_test());
+
+  AST       ast;
+  ExprTypes types;
+
+  TEST_ASSERT(check_source(typecheck_src, sizeof(typecheck_src) - 1, ast, types));
+
+  // ret = a + b; in add needs no conversion.
+  const auto& add_assign = stmt_at(ast, 0, 1);
+  TEST_ASSERT(types[add_assign] == LangType::lt_i64);
+  TEST_ASSERT(std::get<AstFunctionCall>(add_assign.value).args[1].type ==
+              StmtType::call);
+
+  // d = b; converts f32 to i32.
+  const auto& d_assign = std::get<AstFunctionCall>(stmt_at(ast, 1, 2).value);
+  TEST_ASSERT(d_assign.args[1].type == StmtType::conv);
+
+  const auto& d_conv = std::get<AstConversion>(d_assign.args[1].value);
+  TEST_ASSERT(d_conv.kind == ConvKind::fptosi);
+  TEST_ASSERT(types[d_assign.args[1]] == LangType::lt_i32);
+  TEST_ASSERT(types[d_conv.operand[0]] == LangType::lt_f32);
+
+  // ret = a + b; computes in f32, then converts back to i32.
+  const auto& ret_assign = std::get<AstFunctionCall>(stmt_at(ast, 1, 3).value);
+  const auto& ret_conv   = std::get<AstConversion>(ret_assign.args[1].value);
+  const auto& plus       = std::get<AstFunctionCall>(ret_conv.operand[0].value);
+
+  TEST_ASSERT(ret_conv.kind == ConvKind::fptosi);
+  TEST_ASSERT(types[ret_conv.operand[0]] == LangType::lt_f32);
+  TEST_ASSERT(plus.args[0].type == StmtType::conv);
+  TEST_ASSERT(std::get<AstConversion>(plus.args[0].value).kind ==
+              ConvKind::sitofp);
+  TEST_ASSERT(types[plus.args[1]] == LangType::lt_f32);
+
+  // c = add(3,4); widens the literals to the parameter types.
+  const auto& c_assign = std::get<AstFunctionCall>(stmt_at(ast, 2, 1).value);
+  const auto& c_conv   = std::get<AstConversion>(c_assign.args[1].value);
+  const auto& call     = std::get<AstFunctionCall>(c_conv.operand[0].value);
+
+  TEST_ASSERT(c_conv.kind == ConvKind::trunc);
+  TEST_ASSERT(std::get<AstConversion>(call.args[0].value).kind ==
+              ConvKind::sext);
+  TEST_ASSERT(types[call.args[1]] == LangType::lt_i64);
+
+  TEST_ASSERT(!check_source(
+    typecheck_bad_mod_src, sizeof(typecheck_bad_mod_src) - 1, ast, types));
+  TEST_ASSERT(!check_source(
+    typecheck_bad_args_src, sizeof(typecheck_bad_args_src) - 1, ast, types));
+
+  return true;
+}
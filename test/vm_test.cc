@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "queries.h"
+#include "tree_walker.h"
+#include "util.h"
+#include "vm.h"
+
+#include "test.h"
+#include "test_util.h"
+
+using namespace wcc;
+
+const char vm_src[] = "i64 counter;\n"
+                      "i32 quot(i32 a, i32 b) {\n"
+                      "return a / b;\n"
+                      "}\n"
+                      "i32 rem(i32 a, i32 b) {\n"
+                      "return a % b;\n"
+                      "}\n"
+                      "i8 wrap(i8 a) {\n"
+                      "return a + 100;\n"
+                      "}\n"
+                      "u32 under(u32 a) {\n"
+                      "return a - 1;\n"
+                      "}\n"
+                      "f64 scale(f64 x, f32 k) {\n"
+                      "return x * k;\n"
+                      "}\n"
+                      "i64 bump(i64 by) {\n"
+                      "counter = counter + by;\n"
+                      "return counter;\n"
+                      "}\n"
+                      "i32 step(i32 x) {\n"
+                      "x = x + 1;\n"
+                      "return x - 2;\n"
+                      "}\n"
+                      "i32 flip(i32 x, i32 y) {\n"
+                      "x = y - x;\n"
+                      "x *= y;\n"
+                      "return x;\n"
+                      "}\n"
+                      "i32 logic(i32 z) {\n"
+                      "i32 a;\n"
+                      "i32 b;\n"
+                      "i32 c;\n"
+                      "a = z && 5 / z;\n"
+                      "b = 1 || 5 / z;\n"
+                      "c = 2 && 0.5;\n"
+                      "return a * 100 + b * 10 + c;\n"
+                      "}\n"
+                      "i32 convert() {\n"
+                      "u64 big;\n"
+                      "f64 d;\n"
+                      "u64 back;\n"
+                      "big = 12345678901234567890;\n"
+                      "d = big;\n"
+                      "back = d;\n"
+                      "return back > 12345678901234500000;\n"
+                      "}\n"
+                      "i32 forever(i32 a) {\n"
+                      "return forever(a);\n"
+                      "}\n"
+                      "i32 main() {\n"
+                      "i32 m;\n"
+                      "m = 0 - 7;\n"
+                      "return quot(m, 2) + rem(m, 2) + step(5) + flip(2, 5);\n"
+                      "}\n";
+
+static std::shared_ptr<const AnalyzedFile>
+analyze(QueryDatabase& db, const std::string& name, const std::string& source)
+{
+  db.set<SourceTextQuery>(name, source);
+
+  return db.get<TypecheckQuery>(name);
+}
+
+// Runs a function in both engines, they have to agree.
+static bool
+run_both(const vm::Program&           program,
+         vm::Machine&                 machine,
+         TreeWalker&                  walker,
+         const std::string&           name,
+         const std::vector<VarValue>& args,
+         VarValue&                    result)
+{
+  VarValue reference;
+
+  if (!walker.call(name, args, reference))
+    return false;
+
+  if (!machine.call(program.find(name), args, result))
+    return false;
+
+  return result.u64_value == reference.u64_value;
+}
+
+static bool
+uses(const vm::Function& fn, vm::Op op)
+{
+  return std::any_of(fn.code.begin(),
+                     fn.code.end(),
+                     [op](const vm::Instr& instr) { return instr.op == op; });
+}
+
+// The test/*.c programs run in both engines with equal results.
+static bool
+sample_test(const std::string& name)
+{
+  std::ifstream     in(std::string(WCC_TEST_DIR) + "/" + name);
+  const std::string source(std::istreambuf_iterator<char>(in), {});
+  QueryDatabase     db;
+  const auto        file = analyze(db, name, source);
+
+  TEST_ASSERT(!source.empty());
+  TEST_ASSERT(file->ok);
+
+  vm::Program program;
+  TEST_ASSERT(vm::compile(*file, db.get<LayoutQuery>(name), program));
+
+  vm::Machine machine(program);
+  TreeWalker  walker(*file);
+  VarValue    result;
+
+  TEST_ASSERT(run_both(program, machine, walker, "main", {}, result));
+  TEST_ASSERT(machine.globals.size() == walker.globals.size());
+
+  for (size_t i = 0; i < walker.globals.size(); ++i)
+    TEST_ASSERT(machine.globals[i].u64_value == walker.globals[i].u64_value);
+
+  return true;
+}
+
+bool
+vm_test()
+{
+  QueryDatabase db;
+  const auto    file = analyze(db, "vm.c", vm_src);
+
+  TEST_ASSERT(file->ok);
+
+  vm::Program program;
+  TEST_ASSERT(vm::compile(*file, db.get<LayoutQuery>("vm.c"), program));
+  TEST_ASSERT(program.find("missing") == -1);
+
+  vm::Machine machine(program);
+  TreeWalker  walker(*file);
+  VarValue    r;
+
+  const auto both = [&](const char* name, std::vector<VarValue> args) {
+    return run_both(program, machine, walker, name, args, r);
+  };
+
+  // -3 - 1 + 4 + 15
+  TEST_ASSERT(both("main", {}));
+  TEST_ASSERT(r.i64_value == 15);
+
+  TEST_ASSERT(both("wrap", { int_value(100) }));
+  TEST_ASSERT(r.i64_value == -56);
+  TEST_ASSERT(both("under", { int_value(0) }));
+  TEST_ASSERT(r.u64_value == 0xFFFFFFFF);
+  TEST_ASSERT(both("scale", { f64_value(2.5), f32_value(4.0f) }));
+  TEST_ASSERT(r.f64_value == 10.0);
+  TEST_ASSERT(both("convert", {}));
+  TEST_ASSERT(r.i64_value == 1);
+
+  // The divisions by zero are never evaluated.
+  TEST_ASSERT(both("logic", { int_value(0) }));
+  TEST_ASSERT(r.i64_value == 11);
+
+  // Globals keep their values between calls.
+  TEST_ASSERT(both("bump", { int_value(20) }));
+  TEST_ASSERT(both("bump", { int_value(5) }));
+  TEST_ASSERT(r.i64_value == 25);
+
+  // Load-add-store on a global and constant adds are single instructions,
+  // assignments to locals compute straight into the variable.
+  const vm::Function& bump = program.functions[program.find("bump")];
+  const vm::Function& step = program.functions[program.find("step")];
+  const vm::Function& flip = program.functions[program.find("flip")];
+
+  TEST_ASSERT(uses(bump, vm::Op::gadd_x64));
+  TEST_ASSERT(bump.code.size() == 3);
+  TEST_ASSERT(uses(step, vm::Op::addk_i32) && uses(step, vm::Op::subk_i32));
+  TEST_ASSERT(step.code.size() == 3);
+  TEST_ASSERT(!uses(flip, vm::Op::mov));
+
+  // Traps are reported by both.
+  TEST_ASSERT(!machine.call(
+    program.find("quot"), { int_value(1), int_value(0) }, r));
+  TEST_ASSERT(!walker.call("quot", { int_value(1), int_value(0) }, r));
+  TEST_ASSERT(!machine.call(program.find("forever"), { int_value(0) }, r));
+  TEST_ASSERT(!walker.call("forever", { int_value(0) }, r));
+
+  // The machine is still usable after a trap.
+  TEST_ASSERT(machine.call(program.find("step"), { int_value(1) }, r));
+  TEST_ASSERT(r.i64_value == 0);
+
+  TEST_ASSERT(sample_test("call.c"));
+  TEST_ASSERT(sample_test("file1.c"));
+  TEST_ASSERT(sample_test("file2.c"));
+
+  return true;
+}